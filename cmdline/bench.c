@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2026 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "portable.h"
+
+#include "support.h"
+#include "util.h"
+#include "elem.h"
+#include "state.h"
+#include "parity.h"
+
+/****************************************************************************/
+/* bench */
+
+#define BENCH_DISK 4 /**< Default number of data disks. */
+#define BENCH_SIZE 256 /**< Default MiB of data in each disk. */
+#define BENCH_BLOCK 256 /**< Default block size in KiB. */
+#define BENCH_LEVEL 2 /**< Parity levels. */
+#define BENCH_FILE_MIN_BIT 12 /**< Minimum file size, as power of 2. */
+#define BENCH_FILE_MAX_BIT 26 /**< Maximum file size, as power of 2. */
+#define BENCH_CHUNK (1024 * 1024) /**< Size of the writes of the files. */
+#define BENCH_FILE_BLOCK 8 /**< Max blocks of the files of the content bench. */
+#define BENCH_FILE_DIR 1000 /**< Files in each directory of the content bench. */
+
+/**
+ * Pseudo random number generator.
+ *
+ * It has a fixed seed, to create the same array at each run.
+ */
+static uint64_t bench_seed = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t bench_rnd(void)
+{
+	/* xorshift64 */
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 7;
+	bench_seed ^= bench_seed << 17;
+
+	return bench_seed;
+}
+
+/**
+ * Get the size of the next file.
+ *
+ * The size is uniform in the logarithmic scale, to have both small
+ * and large files, with most of the data in the large ones.
+ */
+static uint64_t bench_file_size(void)
+{
+	unsigned bit = BENCH_FILE_MIN_BIT + bench_rnd() % (BENCH_FILE_MAX_BIT - BENCH_FILE_MIN_BIT);
+	uint64_t base = (uint64_t)1 << bit;
+
+	return base + bench_rnd() % base;
+}
+
+static void bench_file(const char* path, uint64_t size, unsigned char* buffer)
+{
+	FILE* f;
+
+	f = fopen(path, "wb");
+	if (!f) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error creating the bench file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	while (size != 0) {
+		size_t run = size < BENCH_CHUNK ? size : BENCH_CHUNK;
+		size_t i;
+
+		/* different data for each chunk, as the hash of real files */
+		for (i = 0; i < BENCH_CHUNK / 8; ++i) {
+			uint64_t v = bench_rnd();
+			memcpy(buffer + i * 8, &v, 8);
+		}
+
+		if (fwrite(buffer, run, 1, f) != 1) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error writing the bench file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		size -= run;
+	}
+
+	if (fclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing the bench file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+/**
+ * Check that the directory is empty, creating it if missing.
+ */
+static void bench_dir(const char* dir)
+{
+	struct dirent* dd;
+	DIR* d;
+
+	if (mkdir(dir, 0777) == 0)
+		return;
+
+	d = opendir(dir);
+	if (!d) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening the bench directory '%s'. %s.\n", dir, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	while ((dd = readdir(d)) != 0) {
+		const char* name = dd->d_name;
+
+		/* skip "." and ".." files */
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+			continue;
+
+		/* LCOV_EXCL_START */
+		log_fatal("The bench directory '%s' is not empty.\n", dir);
+		log_fatal("It must be empty, because all its content is removed at the end.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	closedir(d);
+}
+
+void bench_create(struct snapraid_option* opt, char* conf, size_t conf_size)
+{
+	char dir[PATH_MAX];
+	char path[PATH_MAX];
+	unsigned char* buffer;
+	unsigned disk_max;
+	uint64_t disk_size;
+	unsigned i;
+	FILE* f;
+
+	if (!opt->bench_dir) {
+		/* LCOV_EXCL_START */
+		log_fatal("You must specify the directory of the synthetic array with --bench-dir.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	disk_max = opt->bench_disks ? opt->bench_disks : BENCH_DISK;
+	disk_size = (opt->bench_size ? opt->bench_size : BENCH_SIZE) * (uint64_t)MEBI;
+
+	pathimport(dir, sizeof(dir), opt->bench_dir);
+	pathslash(dir, sizeof(dir));
+
+	bench_dir(dir);
+
+	msg_progress("Creating the synthetic array in '%s'...\n", dir);
+
+	buffer = malloc_nofail(BENCH_CHUNK);
+
+	for (i = 0; i < disk_max; ++i) {
+		uint64_t size = 0;
+		unsigned j;
+
+		pathprint(path, sizeof(path), "%sd%u", dir, i + 1);
+		if (mkdir(path, 0777) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error creating the bench directory '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* the content bench uses only synthetic files in memory */
+		if (opt->bench_files)
+			continue;
+
+		for (j = 0; size < disk_size; ++j) {
+			uint64_t file_size = bench_file_size();
+
+			if (file_size > disk_size - size)
+				file_size = disk_size - size;
+
+			pathprint(path, sizeof(path), "%sd%u/file%u", dir, i + 1, j);
+			bench_file(path, file_size, buffer);
+
+			size += file_size;
+		}
+	}
+
+	free(buffer);
+
+	/* the configuration file of the array */
+	pathprint(conf, conf_size, "%sbench.conf", dir);
+	f = fopen(conf, "w");
+	if (!f) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error creating the bench configuration '%s'. %s.\n", conf, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+	fprintf(f, "blocksize %u\n", opt->bench_block ? opt->bench_block : BENCH_BLOCK);
+	for (i = 0; i < BENCH_LEVEL; ++i)
+		fprintf(f, "%s %s%s\n", lev_config_name(i), dir, lev_config_name(i));
+	fprintf(f, "content %scontent\n", dir);
+	for (i = 0; i < disk_max; ++i)
+		fprintf(f, "data d%u %sd%u/\n", i + 1, dir, i + 1);
+	if (fclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the bench configuration '%s'. %s.\n", conf, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* all the disks are in the same directory */
+	opt->skip_device = 1;
+}
+
+/**
+ * Remove all the content of the directory.
+ */
+static void bench_clear_dir(const char* dir)
+{
+	struct dirent* dd;
+	DIR* d;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	while ((dd = readdir(d)) != 0) {
+		char path[PATH_MAX];
+		const char* name = dd->d_name;
+		struct stat st;
+
+		/* skip "." and ".." files */
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+			continue;
+
+		pathprint(path, sizeof(path), "%s%s", dir, name);
+
+		if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+			pathslash(path, sizeof(path));
+			bench_clear_dir(path);
+			rmdir(path);
+		} else {
+			remove(path);
+		}
+	}
+
+	closedir(d);
+}
+
+void bench_clear(struct snapraid_option* opt)
+{
+	char dir[PATH_MAX];
+
+	pathimport(dir, sizeof(dir), opt->bench_dir);
+	pathslash(dir, sizeof(dir));
+
+	bench_clear_dir(dir);
+}
+
+/**
+ * Clear the usage stats, to measure each step alone.
+ */
+static void bench_reset(struct snapraid_state* state)
+{
+	tommy_node* i;
+	unsigned l;
+
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+		disk->tick = 0;
+		histo_init(&disk->histo_io);
+		histo_init(&disk->histo_wait);
+	}
+	for (l = 0; l < state->level; ++l) {
+		state->parity[l].tick = 0;
+		histo_init(&state->parity[l].histo_io);
+		histo_init(&state->parity[l].histo_wait);
+	}
+	state->tick_io = 0;
+	state->tick_misc = 0;
+	state->tick_sched = 0;
+	state->tick_raid = 0;
+	state->tick_hash = 0;
+	histo_init(&state->histo_raid);
+	histo_init(&state->histo_hash);
+	state->tick_last = tick();
+}
+
+static void bench_report(struct snapraid_state* state, const char* step, uint64_t elapsed_ms, data_off_t data_size)
+{
+	block_off_t blockmax = parity_allocated_size(state);
+	double freq = tick_freq();
+	uint64_t stripe_speed = 0;
+	uint64_t size_speed = 0;
+
+	if (elapsed_ms != 0) {
+		stripe_speed = blockmax * 1000ULL / elapsed_ms;
+		size_speed = data_size * 1000ULL / elapsed_ms / MEGA;
+	}
+
+	log_tag("bench:%s:%u:%" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n", step, blockmax, elapsed_ms, stripe_speed, size_speed);
+	log_flush();
+
+	msg_status("\n");
+	msg_status("Bench %s of %u stripes in %" PRIu64 ".%03u seconds\n", step, blockmax, elapsed_ms / 1000, (unsigned)(elapsed_ms % 1000));
+	msg_status("%12" PRIu64 " stripes/s\n", stripe_speed);
+	msg_status("%12" PRIu64 " MB/s of data\n", size_speed);
+	msg_status("Main thread time in seconds:\n");
+	msg_status("%12.3f raid\n", state->tick_raid / freq);
+	msg_status("%12.3f hash\n", state->tick_hash / freq);
+	msg_status("%12.3f sched\n", state->tick_sched / freq);
+	msg_status("%12.3f misc\n", state->tick_misc / freq);
+	msg_status("%12.3f waiting the disks\n", state->tick_io / freq);
+	msg_status("\n");
+}
+
+int state_bench(struct snapraid_state* state)
+{
+	data_off_t data_size;
+	uint64_t start;
+	tommy_node* i;
+	int ret;
+
+	/* as in "sync", as the array is new it has no past hash to keep */
+	state->clear_past_hash = 1;
+
+	state_read(state);
+
+	state_scan(state);
+
+	/* refresh the size info before the content write */
+	state_refresh(state);
+
+	data_size = 0;
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+		tommy_node* j;
+
+		for (j = tommy_list_head(&disk->filelist); j != 0; j = j->next) {
+			struct snapraid_file* file = j->data;
+			data_size += file->size;
+		}
+	}
+
+	bench_reset(state);
+	start = tick_ms();
+
+	ret = state_sync(state, 0, 0);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	bench_report(state, "sync", tick_ms() - start, data_size);
+
+	bench_reset(state);
+	start = tick_ms();
+
+	ret = state_scrub(state, SCRUB_FULL, SCRUB_AUTO);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	bench_report(state, "scrub", tick_ms() - start, data_size);
+
+	return 0;
+}
+
+/**
+ * Fill the disks with synthetic files, without creating them.
+ *
+ * The files have from 1 to BENCH_FILE_BLOCK blocks, all already synced,
+ * as in the content file of a large array.
+ */
+static void bench_content_generate(struct snapraid_state* state, uint64_t* out_block_count, data_off_t* out_size)
+{
+	struct snapraid_disk** disk_map;
+	unsigned disk_max;
+	time_t now = time(0);
+	uint64_t block_count;
+	data_off_t data_size;
+	tommy_node* i;
+	unsigned f;
+
+	disk_max = tommy_list_count(&state->disklist);
+	disk_map = malloc_nofail(disk_max * sizeof(struct snapraid_disk*));
+	disk_max = 0;
+	for (i = state->disklist; i != 0; i = i->next)
+		disk_map[disk_max++] = i->data;
+
+	block_count = 0;
+	data_size = 0;
+	for (f = 0; f < state->opt.bench_files; ++f) {
+		struct snapraid_disk* disk = disk_map[f % disk_max];
+		struct snapraid_file* file;
+		char sub[PATH_MAX];
+		block_off_t count;
+		data_off_t size;
+		block_off_t j;
+
+		count = 1 + bench_rnd() % BENCH_FILE_BLOCK;
+		size = (count - 1) * (data_off_t)state->block_size + 1 + bench_rnd() % state->block_size;
+
+		snprintf(sub, sizeof(sub), "dir%u/file%u", f / BENCH_FILE_DIR, f);
+
+		file = file_alloc(&disk->arena, state->block_size, sub, size, 1000000000 + f, bench_rnd() % 1000000000, f + 1, FILEPHY_WITHOUT_OFFSET);
+
+		for (j = 0; j < file->blockmax; ++j) {
+			struct snapraid_block* block = file_block(file, j);
+			block_off_t parity_pos = disk->first_free_block++;
+			uint64_t hash[2];
+
+			hash[0] = bench_rnd();
+			hash[1] = bench_rnd();
+			memcpy(block->hash, hash, BLOCK_HASH_SIZE);
+			block_state_set(block, BLOCK_STATE_BLK);
+
+			fs_allocate(disk, parity_pos, file, j);
+
+			info_set(&state->infoarr, parity_pos, info_make(now, 0, 0, 0));
+
+			++block_count;
+		}
+
+		/* insert in the same containers of the content read */
+		tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
+		tommy_list_insert_tail(&disk->filelist, &file->nodelist, file);
+
+		data_size += size;
+	}
+
+	free(disk_map);
+
+	*out_block_count = block_count;
+	*out_size = data_size;
+}
+
+static uint64_t bench_ms(uint64_t ticks)
+{
+	return ticks * 1000 / tick_freq();
+}
+
+int state_bench_content(struct snapraid_state* state, const char* conf)
+{
+	struct snapraid_state* other;
+	tommy_list filterlist;
+	uint64_t block_count;
+	data_off_t data_size;
+	uint64_t tick_generate;
+	uint64_t tick_serialize;
+	uint64_t tick_verify;
+	uint64_t tick_read;
+	uint64_t tick_fileset;
+	uint64_t peak = 0;
+	size_t used;
+	uint64_t start;
+	tommy_node* i;
+
+	/* generate and write the content file with another state, freed before reading it */
+	other = malloc_nofail(sizeof(struct snapraid_state));
+	state_init(other);
+	tommy_list_init(&filterlist);
+	state_config(other, conf, "bench", &state->opt, &filterlist);
+
+	state_read(other);
+
+	msg_progress("Generating %u files...\n", state->opt.bench_files);
+
+	start = tick();
+	bench_content_generate(other, &block_count, &data_size);
+	tick_generate = tick() - start;
+
+	state_write(other);
+
+	tick_serialize = other->tick_content_serialize;
+	tick_verify = other->tick_content_verify;
+
+	state_done(other);
+	free(other);
+
+	/* load the content file just written */
+	start = tick();
+	state_read(state);
+	tick_read = tick() - start;
+
+	/* build the sets used by "sync" and "diff" to detect moved and copied files */
+	start = tick();
+	for (i = state->disklist; i != 0; i = i->next)
+		disk_fileset_build(i->data);
+	tick_fileset = tick() - start;
+
+	used = malloc_counter_get();
+
+#if HAVE_GETRUSAGE
+	{
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			peak = usage.ru_maxrss * (uint64_t)KIBI; /* in KiB in Linux */
+	}
+#endif
+
+	log_tag("bench:content:%u:%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n",
+		state->opt.bench_files, block_count, data_size,
+		bench_ms(tick_generate), bench_ms(tick_serialize), bench_ms(tick_verify),
+		bench_ms(state->tick_content_parse), bench_ms(state->tick_content_map), bench_ms(tick_fileset),
+		(uint64_t)used, peak);
+	log_flush();
+
+	msg_status("\n");
+	msg_status("Bench content of %u files and %" PRIu64 " blocks, for %" PRIu64 " GB of data\n", state->opt.bench_files, block_count, data_size / GIGA);
+	msg_status("Time in milliseconds:\n");
+	msg_status("%12" PRIu64 " generate\n", bench_ms(tick_generate));
+	msg_status("%12" PRIu64 " write, serialization\n", bench_ms(tick_serialize));
+	msg_status("%12" PRIu64 " write, verify\n", bench_ms(tick_verify));
+	msg_status("%12" PRIu64 " read, parse with hashtable and tree build\n", bench_ms(state->tick_content_parse));
+	msg_status("%12" PRIu64 " read, map and check\n", bench_ms(state->tick_content_map));
+	msg_status("%12" PRIu64 " read, total\n", bench_ms(tick_read));
+	msg_status("%12" PRIu64 " fileset hashtables build\n", bench_ms(tick_fileset));
+	msg_status("Memory in MiB:\n");
+	msg_status("%12" PRIu64 " allocated\n", (uint64_t)used / MEBI);
+	if (peak != 0)
+		msg_status("%12" PRIu64 " peak RSS\n", peak / MEBI);
+	msg_status("\n");
+
+	return 0;
+}
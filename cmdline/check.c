@@ -63,11 +63,349 @@ struct failed_struct {
 	struct snapraid_handle* handle; /**< The handle containing the failed block, or 0 for a DELETED block */
 };
 
+/**
+ * Sort the failed blocks by disk index.
+ */
+static void failed_sort(struct failed_struct* failed, unsigned failed_count)
+{
+	unsigned i, j;
+
+	/* insertion sort, as the failed blocks are few, and mostly already sorted */
+	for (i = 1; i < failed_count; ++i) {
+		struct failed_struct item = failed[i];
+
+		for (j = i; j > 0 && failed[j - 1].index > item.index; --j)
+			failed[j] = failed[j - 1];
+
+		failed[j] = item;
+	}
+}
+
+/**
+ * A block read, with the hash to verify.
+ */
+struct verify_struct {
+	unsigned index; /**< Index of the block read. */
+	struct snapraid_block* block; /**< The block read. */
+	struct snapraid_file* file; /**< The file of the block. */
+	block_off_t file_pos; /**< Offset inside the file */
+	unsigned read_size; /**< Size read. */
+	unsigned char hash[HASH_MAX]; /**< Hash of the data read. */
+};
+
+#if HAVE_PTHREAD
+/**
+ * Pool of threads used to compute the recovery.
+ *
+ * The caller sets up a job of ::count items, and the threads
+ * and the caller process them together, until all are completed.
+ * It's used to hash the blocks read, and to split in slices
+ * the computation of the parity and the recovering of the data.
+ */
+struct snapraid_check_pool {
+	unsigned thread_max; /**< Number of threads, including the caller. */
+	pthread_t* thread_map; /**< Vector of the threads, the caller excluded. */
+	pthread_mutex_t mutex;
+	pthread_cond_t sched; /**< Signaled when a new job is ready. */
+	pthread_cond_t done; /**< Signaled when the last item of the job is completed. */
+	int exit; /**< Exit condition for the threads. */
+	unsigned generation; /**< Incremented at each new job. */
+
+	void (*func)(struct snapraid_check_pool* pool, unsigned index); /**< Function processing an item. */
+	unsigned next; /**< Next item to process. */
+	unsigned count; /**< Number of items of the job. */
+	unsigned pending; /**< Number of items not yet completed. */
+
+	/* arguments of the hash job */
+	struct snapraid_state* state;
+	int rehash;
+	struct verify_struct* verify;
+
+	/* arguments of the raid jobs */
+	int nr;
+	int* id;
+	int* ip;
+	int nd;
+	int np;
+	size_t size;
+	void** v;
+	unsigned vmax; /**< Number of pointers of each slice vector. */
+	void** slice_map; /**< Vector of ::thread_max slice vectors. */
+};
+
+/**
+ * Process the items of the current job.
+ * Called with the mutex locked.
+ */
+static void check_pool_work(struct snapraid_check_pool* pool)
+{
+	while (pool->next < pool->count) {
+		unsigned index = pool->next++;
+
+		thread_mutex_unlock(&pool->mutex);
+
+		pool->func(pool, index);
+
+		thread_mutex_lock(&pool->mutex);
+
+		/* the latest item completed wakes up the caller */
+		if (--pool->pending == 0)
+			thread_cond_signal(&pool->done);
+	}
+}
+
+static void* check_pool_thread(void* arg)
+{
+	struct snapraid_check_pool* pool = arg;
+	unsigned generation;
+
+	thread_mutex_lock(&pool->mutex);
+
+	generation = pool->generation;
+
+	while (1) {
+		/* wait for a new job */
+		while (!pool->exit && pool->generation == generation)
+			thread_cond_wait(&pool->sched, &pool->mutex);
+
+		if (pool->exit)
+			break;
+
+		generation = pool->generation;
+
+		check_pool_work(pool);
+	}
+
+	thread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+/**
+ * Run a job of the specified number of items, and wait for its completion.
+ */
+static void check_pool_run(struct snapraid_check_pool* pool, unsigned count, void (*func)(struct snapraid_check_pool* pool, unsigned index))
+{
+	thread_mutex_lock(&pool->mutex);
+
+	/* setup the new job */
+	pool->func = func;
+	pool->next = 0;
+	pool->count = count;
+	pool->pending = count;
+	++pool->generation;
+
+	thread_cond_broadcast(&pool->sched);
+
+	/* process items also in the caller */
+	check_pool_work(pool);
+
+	/* wait for the items processed by the threads */
+	while (pool->pending != 0)
+		thread_cond_wait(&pool->done, &pool->mutex);
+
+	thread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Allocate the pool, if enabled with --raid-threads.
+ * Return 0 if not enabled.
+ */
+static struct snapraid_check_pool* check_pool_alloc(struct snapraid_state* state, unsigned vmax)
+{
+	struct snapraid_check_pool* pool;
+	unsigned i;
+
+	if (state->opt.raid_threads <= 1)
+		return 0;
+
+	pool = malloc_nofail(sizeof(struct snapraid_check_pool));
+	pool->thread_max = state->opt.raid_threads;
+	pool->thread_map = malloc_nofail((pool->thread_max - 1) * sizeof(pthread_t));
+	pool->exit = 0;
+	pool->generation = 0;
+	pool->next = 0;
+	pool->count = 0;
+	pool->pending = 0;
+	pool->state = state;
+	pool->vmax = vmax;
+	pool->slice_map = malloc_nofail(pool->thread_max * vmax * sizeof(void*));
+
+	thread_mutex_init(&pool->mutex, 0);
+	thread_cond_init(&pool->sched, 0);
+	thread_cond_init(&pool->done, 0);
+
+	for (i = 0; i < pool->thread_max - 1; ++i)
+		thread_create(&pool->thread_map[i], 0, check_pool_thread, pool);
+
+	return pool;
+}
+
+static void check_pool_free(struct snapraid_check_pool* pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+
+	thread_mutex_lock(&pool->mutex);
+
+	/* mark that we are stopping */
+	pool->exit = 1;
+
+	/* signal all the threads to recognize the new state */
+	thread_cond_broadcast(&pool->sched);
+
+	thread_mutex_unlock(&pool->mutex);
+
+	/* wait for all the threads to terminate */
+	for (i = 0; i < pool->thread_max - 1; ++i)
+		thread_join(pool->thread_map[i], 0);
+
+	thread_cond_destroy(&pool->done);
+	thread_cond_destroy(&pool->sched);
+	thread_mutex_destroy(&pool->mutex);
+
+	free(pool->slice_map);
+	free(pool->thread_map);
+	free(pool);
+}
+
+/**
+ * Get the vector of the slice ::index of the blocks.
+ * Return 0 if the slice is empty.
+ */
+static void** check_pool_slice(struct snapraid_check_pool* pool, unsigned index, size_t* size)
+{
+	size_t unit = pool->size / 64;
+	size_t begin = unit * index / pool->thread_max * 64;
+	size_t end = unit * (index + 1) / pool->thread_max * 64;
+	void** v = pool->slice_map + index * pool->vmax;
+	unsigned i;
+
+	if (begin == end)
+		return 0;
+
+	for (i = 0; i < (unsigned)(pool->nd + pool->np); ++i)
+		v[i] = (unsigned char*)pool->v[i] + begin;
+
+	*size = end - begin;
+
+	return v;
+}
+
+static void check_pool_gen(struct snapraid_check_pool* pool, unsigned index)
+{
+	size_t size;
+	void** v = check_pool_slice(pool, index, &size);
+
+	if (v)
+		raid_gen(pool->nd, pool->np, size, v);
+}
+
+static void check_pool_data(struct snapraid_check_pool* pool, unsigned index)
+{
+	size_t size;
+	void** v = check_pool_slice(pool, index, &size);
+
+	if (v)
+		raid_data(pool->nr, pool->id, pool->ip, pool->nd, size, v);
+}
+
+static void check_pool_hash(struct snapraid_check_pool* pool, unsigned index)
+{
+	struct snapraid_state* state = pool->state;
+	struct verify_struct* verify = &pool->verify[index];
+	void* buffer = pool->v[verify->index];
+
+	if (pool->rehash) {
+		memhash(state->prevhash, state->prevhashseed, verify->hash, buffer, verify->read_size);
+	} else {
+		memhash(state->hash, state->hashseed, verify->hash, buffer, verify->read_size);
+	}
+}
+#else
+struct snapraid_check_pool;
+#endif
+
+/**
+ * Compute the parity like raid_gen(), splitting it in the pool threads, if any.
+ */
+static void check_raid_gen(struct snapraid_check_pool* pool, int nd, int np, size_t size, void** v)
+{
+#if HAVE_PTHREAD
+	if (pool) {
+		pool->nd = nd;
+		pool->np = np;
+		pool->size = size;
+		pool->v = v;
+		check_pool_run(pool, pool->thread_max, check_pool_gen);
+		return;
+	}
+#else
+	(void)pool;
+#endif
+
+	raid_gen(nd, np, size, v);
+}
+
+/**
+ * Recover the data like raid_data(), splitting it in the pool threads, if any.
+ */
+static void check_raid_data(struct snapraid_check_pool* pool, int nr, int* id, int* ip, int nd, size_t size, void** v)
+{
+#if HAVE_PTHREAD
+	if (pool) {
+		pool->nr = nr;
+		pool->id = id;
+		pool->ip = ip;
+		pool->nd = nd;
+		pool->np = ip[nr - 1] + 1; /* parities up to the last used */
+		pool->size = size;
+		pool->v = v;
+		check_pool_run(pool, pool->thread_max, check_pool_data);
+		return;
+	}
+#else
+	(void)pool;
+#endif
+
+	raid_data(nr, id, ip, nd, size, v);
+}
+
+/**
+ * Compute the hashes of the blocks read, using the pool threads, if any.
+ */
+static void check_hash(struct snapraid_check_pool* pool, struct snapraid_state* state, int rehash, struct verify_struct* verify, unsigned verify_count, void** buffer)
+{
+	unsigned j;
+
+#if HAVE_PTHREAD
+	if (pool && verify_count > 1) {
+		pool->rehash = rehash;
+		pool->verify = verify;
+		pool->v = buffer;
+		check_pool_run(pool, verify_count, check_pool_hash);
+		return;
+	}
+#else
+	(void)pool;
+#endif
+
+	for (j = 0; j < verify_count; ++j) {
+		if (rehash) {
+			memhash(state->prevhash, state->prevhashseed, verify[j].hash, buffer[verify[j].index], verify[j].read_size);
+		} else {
+			memhash(state->hash, state->hashseed, verify[j].hash, buffer[verify[j].index], verify[j].read_size);
+		}
+	}
+}
+
 /**
  * Check if a block hash matches the specified buffer.
  * Return ==0 if equal
  */
-static int blockcmp(struct snapraid_state* state, int rehash, struct snapraid_block* block, unsigned pos_size, unsigned char* buffer, unsigned char* buffer_zero)
+static int blockcmp(struct snapraid_state* state, int rehash, struct snapraid_block* block, unsigned pos_size, unsigned char* buffer)
 {
 	unsigned char hash[HASH_MAX];
 
@@ -85,7 +423,7 @@ static int blockcmp(struct snapraid_state* state, int rehash, struct snapraid_bl
 
 	/* compare to the end of the block */
 	if (pos_size < state->block_size) {
-		if (memcmp(buffer + pos_size, buffer_zero + pos_size, state->block_size - pos_size) != 0) {
+		if (!memiszero(buffer + pos_size, state->block_size - pos_size)) {
 			return -1;
 		}
 	}
@@ -96,7 +434,7 @@ static int blockcmp(struct snapraid_state* state, int rehash, struct snapraid_bl
 /**
  * Check if the hash of all the failed block we are expecting to recover are now matching.
  */
-static int is_hash_matching(struct snapraid_state* state, int rehash, unsigned diskmax, struct failed_struct* failed, unsigned* failed_map, unsigned failed_count, void** buffer, void* buffer_zero)
+static int is_hash_matching(struct snapraid_check_pool* pool, struct snapraid_state* state, int rehash, unsigned diskmax, struct failed_struct* failed, unsigned* failed_map, unsigned failed_count, void** buffer)
 {
 	unsigned j;
 	int hash_checked;
@@ -112,7 +450,7 @@ static int is_hash_matching(struct snapraid_state* state, int rehash, unsigned d
 		) {
 			/* if a hash doesn't match, fail the check */
 			unsigned pos_size = file_block_size(failed[failed_map[j]].file, failed[failed_map[j]].file_pos, state->block_size);
-			if (blockcmp(state, rehash, failed[failed_map[j]].block, pos_size, buffer[failed[failed_map[j]].index], buffer_zero) != 0) {
+			if (blockcmp(state, rehash, failed[failed_map[j]].block, pos_size, buffer[failed[failed_map[j]].index]) != 0) {
 				log_tag("hash_error: Hash mismatch on entry %u\n", failed_map[j]);
 				return 0;
 			}
@@ -132,22 +470,22 @@ static int is_hash_matching(struct snapraid_state* state, int rehash, unsigned d
 
 	/* if we checked something, and no block failed the check */
 	/* recompute all the redundancy information */
-	raid_gen(diskmax, state->level, state->block_size, buffer);
+	check_raid_gen(pool, diskmax, state->level, state->block_size, buffer);
 	return 1;
 }
 
 /**
  * Check if specified parity is now matching with a recomputed one.
  */
-static int is_parity_matching(struct snapraid_state* state, unsigned diskmax, unsigned i, void** buffer, void** buffer_recov)
+static int is_parity_matching(struct snapraid_check_pool* pool, struct snapraid_state* state, unsigned diskmax, unsigned i, void** buffer, void** buffer_recov)
 {
 	/* recompute parity, note that we don't need parity over i */
-	raid_gen(diskmax, i + 1, state->block_size, buffer);
+	check_raid_gen(pool, diskmax, i + 1, state->block_size, buffer);
 
 	/* if the recovered parity block matches */
 	if (memcmp(buffer[diskmax + i], buffer_recov[i], state->block_size) == 0) {
 		/* recompute all the redundancy information */
-		raid_gen(diskmax, state->level, state->block_size, buffer);
+		check_raid_gen(pool, diskmax, state->level, state->block_size, buffer);
 		return 1;
 	}
 
@@ -159,7 +497,7 @@ static int is_parity_matching(struct snapraid_state* state, unsigned diskmax, un
  * Return <0 if failure for missing strategy, >0 if data is wrong and we cannot rebuild correctly, 0 on success.
  * If success, the parity are computed in the buffer variable.
  */
-static int repair_step(struct snapraid_state* state, int rehash, unsigned pos, unsigned diskmax, struct failed_struct* failed, unsigned* failed_map, unsigned failed_count, void** buffer, void** buffer_recov, void* buffer_zero)
+static int repair_step(struct snapraid_check_pool* pool, struct snapraid_state* state, int rehash, unsigned pos, unsigned diskmax, struct failed_struct* failed, unsigned* failed_map, unsigned failed_count, void** buffer, void** buffer_recov)
 {
 	unsigned i, n;
 	int error;
@@ -171,7 +509,7 @@ static int repair_step(struct snapraid_state* state, int rehash, unsigned pos, u
 	if (failed_count == 0) {
 		/* LCOV_EXCL_START */
 		/* recompute only the parity */
-		raid_gen(diskmax, state->level, state->block_size, buffer);
+		check_raid_gen(pool, diskmax, state->level, state->block_size, buffer);
 		return 0;
 		/* LCOV_EXCL_STOP */
 	}
@@ -217,10 +555,10 @@ static int repair_step(struct snapraid_state* state, int rehash, unsigned pos, u
 				memcpy(buffer[diskmax + ip[i]], buffer_recov[ip[i]], state->block_size);
 
 			/* recover using one less parity, the ip[r-1] one */
-			raid_data(r - 1, id, ip, diskmax, state->block_size, buffer);
+			check_raid_data(pool, r - 1, id, ip, diskmax, state->block_size, buffer);
 
 			/* use the remaining ip[r-1] parity to check the result */
-			if (is_parity_matching(state, diskmax, ip[r - 1], buffer, buffer_recov))
+			if (is_parity_matching(pool, state, diskmax, ip[r - 1], buffer, buffer_recov))
 				return 0;
 
 			/* log */
@@ -257,10 +595,10 @@ static int repair_step(struct snapraid_state* state, int rehash, unsigned pos, u
 				memcpy(buffer[diskmax + ip[i]], buffer_recov[ip[i]], state->block_size);
 
 			/* recover */
-			raid_data(r, id, ip, diskmax, state->block_size, buffer);
+			check_raid_data(pool, r, id, ip, diskmax, state->block_size, buffer);
 
 			/* use the hash to check the result */
-			if (is_hash_matching(state, rehash, diskmax, failed, failed_map, failed_count, buffer, buffer_zero))
+			if (is_hash_matching(pool, state, rehash, diskmax, failed, failed_map, failed_count, buffer))
 				return 0;
 
 			/* log */
@@ -284,7 +622,7 @@ static int repair_step(struct snapraid_state* state, int rehash, unsigned pos, u
 	return -1;
 }
 
-static int repair(struct snapraid_state* state, int rehash, unsigned pos, unsigned diskmax, struct failed_struct* failed, unsigned* failed_map, unsigned failed_count, void** buffer, void** buffer_recov, void* buffer_zero)
+static int repair(struct snapraid_check_pool* pool, struct snapraid_state* state, int rehash, unsigned pos, unsigned diskmax, struct failed_struct* failed, unsigned* failed_map, unsigned failed_count, void** buffer, void** buffer_recov)
 {
 	int ret;
 	int error;
@@ -298,7 +636,7 @@ static int repair(struct snapraid_state* state, int rehash, unsigned pos, unsign
 
 	/* if nothing failed, just recompute the parity */
 	if (failed_count == 0) {
-		raid_gen(diskmax, state->level, state->block_size, buffer);
+		check_raid_gen(pool, diskmax, state->level, state->block_size, buffer);
 		return 0;
 	}
 
@@ -392,11 +730,11 @@ static int repair(struct snapraid_state* state, int rehash, unsigned pos, unsign
 		log_tag("recover_sync:%u:%u: Skipped for already recovered\n", pos, n);
 
 		/* recompute only the parity */
-		raid_gen(diskmax, state->level, state->block_size, buffer);
+		check_raid_gen(pool, diskmax, state->level, state->block_size, buffer);
 		return 0;
 	}
 
-	ret = repair_step(state, rehash, pos, diskmax, failed, failed_map, n, buffer, buffer_recov, buffer_zero);
+	ret = repair_step(pool, state, rehash, pos, diskmax, failed, failed_map, n, buffer, buffer_recov);
 	if (ret == 0) {
 		/* reprocess the CHG blocks, for which we don't have a hash to check */
 		/* if they were BAD we have to use some heuristics to ensure that we have recovered  */
@@ -430,7 +768,7 @@ static int repair(struct snapraid_state* state, int rehash, unsigned pos, unsign
 					/* instead, if the block is filled with 0, it could be either that the */
 					/* block after the sync is really filled by 0, or that */
 					/* we restored the block before the 'sync'. */
-					if (memcmp(buffer[failed[j].index], buffer_zero, state->block_size) == 0) {
+					if (memiszero(buffer[failed[j].index], state->block_size)) {
 						/* it may contain garbage */
 						failed[j].is_outofdate = 1;
 
@@ -443,7 +781,7 @@ static int repair(struct snapraid_state* state, int rehash, unsigned pos, unsign
 					/* block after the sync has this hash, or that */
 					/* we restored the block before the 'sync'. */
 					unsigned pos_size = file_block_size(failed[j].file, failed[j].file_pos, state->block_size);
-					if (blockcmp(state, rehash, failed[j].block, pos_size, buffer[failed[j].index], buffer_zero) == 0) {
+					if (blockcmp(state, rehash, failed[j].block, pos_size, buffer[failed[j].index]) == 0) {
 						/* it may contain garbage */
 						failed[j].is_outofdate = 1;
 
@@ -539,7 +877,7 @@ static int repair(struct snapraid_state* state, int rehash, unsigned pos, unsign
 	/* if nothing to fix, we just don't try */
 	/* if nothing unsynced we also don't retry, because it's the same try as before */
 	if (something_to_recover && something_unsynced) {
-		ret = repair_step(state, rehash, pos, diskmax, failed, failed_map, n, buffer, buffer_recov, buffer_zero);
+		ret = repair_step(pool, state, rehash, pos, diskmax, failed, failed_map, n, buffer, buffer_recov);
 		if (ret == 0) {
 			/* reprocess the REP and CHG blocks, for which we have recovered and old state */
 			/* that we don't want to save into disk */
@@ -782,7 +1120,11 @@ close_and_continue:
 		if (handle[j].file == file) {
 			/* ensure to close the file just after finishing with it */
 			/* to avoid to keep it open without any possible use */
-			ret = handle_close(&handle[j]);
+			/* if only reading, release it, as the other files in the cache are still in use */
+			if (fix)
+				ret = handle_close(&handle[j]);
+			else
+				ret = handle_release(&handle[j]);
 			if (ret != 0) {
 				/* LCOV_EXCL_START */
 				log_tag("error:%u:%s:%s: Close error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
@@ -847,6 +1189,409 @@ static int block_is_enabled(struct snapraid_state* state, block_off_t i, struct
 	return 0;
 }
 
+/**
+ * Audit of the disks, used with --audit-only.
+ *
+ * Without the parity, there is no need to assemble the positions of all
+ * the disks, and each disk is read independently in the order of the files.
+ */
+struct snapraid_audit {
+	struct snapraid_state* state;
+	block_off_t blockstart; /**< First position to audit. */
+	block_off_t blockmax; /**< Position after the last one to audit. */
+#if HAVE_PTHREAD
+	pthread_mutex_t mutex; /**< Mutex protecting the progress. */
+#endif
+	block_off_t countpos; /**< Number of blocks processed. */
+	block_off_t countmax; /**< Number of blocks to process. */
+	data_off_t countsize; /**< Size of the data read. */
+	int stop; /**< If the audit was interrupted. */
+};
+
+/**
+ * Audit of a single disk.
+ */
+struct snapraid_audit_disk {
+	struct snapraid_audit* audit; /**< Parent pointer. */
+	struct snapraid_handle* handle; /**< Handle of the disk. */
+	struct snapraid_file** file_map; /**< Files to audit, in physical order. */
+	unsigned file_max; /**< Number of files to audit. */
+	unsigned error; /**< Number of errors found. */
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+static int audit_file_compare(const void* void_a, const void* void_b)
+{
+	const struct snapraid_file* const* file_a = void_a;
+	const struct snapraid_file* const* file_b = void_b;
+
+	return file_physical_compare(*file_a, *file_b);
+}
+
+/**
+ * Check if the block at the specified parity position has to be audited.
+ */
+static int audit_is_enabled(struct snapraid_audit* audit, block_off_t parity_pos)
+{
+	struct snapraid_state* state = audit->state;
+
+	if (parity_pos < audit->blockstart || parity_pos >= audit->blockmax)
+		return 0;
+
+	/* if we filter for only bad blocks */
+	if (state->opt.badonly && !info_get_bad(info_get(&state->infoarr, parity_pos)))
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Update the progress with the block just processed.
+ * Return !=0 if the audit has to stop.
+ */
+static int audit_progress(struct snapraid_audit* audit, block_off_t parity_pos, unsigned read_size)
+{
+	int stop;
+
+#if HAVE_PTHREAD
+	thread_mutex_lock(&audit->mutex);
+#endif
+
+	++audit->countpos;
+	audit->countsize += read_size;
+
+	if (!audit->stop && state_progress(audit->state, 0, parity_pos, audit->countpos, audit->countmax, audit->countsize))
+		audit->stop = 1;
+
+	stop = audit->stop;
+
+#if HAVE_PTHREAD
+	thread_mutex_unlock(&audit->mutex);
+#endif
+
+	return stop;
+}
+
+/**
+ * Audit a file, reading all its blocks sequentially.
+ * Return -1 on fatal error, 1 if interrupted, 0 otherwise.
+ */
+static int audit_file(struct snapraid_audit_disk* audit_disk, struct snapraid_file* file, unsigned char* buffer)
+{
+	struct snapraid_audit* audit = audit_disk->audit;
+	struct snapraid_state* state = audit->state;
+	struct snapraid_handle* handle = audit_disk->handle;
+	struct snapraid_disk* disk = handle->disk;
+	block_off_t file_pos;
+	block_off_t parity_pos;
+	int opened;
+	int ret;
+	char esc_buffer[ESC_MAX];
+
+	opened = 0;
+	parity_pos = 0;
+	for (file_pos = 0; file_pos < file->blockmax; ++file_pos) {
+		struct snapraid_block* block = file_block(file, file_pos);
+		unsigned char hash[HASH_MAX];
+		int read_size;
+
+		parity_pos = fs_file2par_get(disk, file, file_pos);
+
+		if (!audit_is_enabled(audit, parity_pos))
+			continue;
+
+		/* open the file at the first block to audit */
+		if (!opened) {
+			opened = 1;
+
+			if (!file_flag_has(file, FILE_IS_MISSING))
+				ret = handle_open(handle, file, state->file_mode,
+					log_error, state->opt.expected_missing ? log_expected : 0);
+			else
+				ret = -1; /* if the file is missing, we cannot open it */
+			if (ret == -1) {
+				/* mark the file as missing, to avoid to retry to open it again */
+				file_flag_set(file, FILE_IS_MISSING);
+			} else {
+				/* check if the file is changed */
+				if (handle->st.st_size != file->size
+					|| handle->st.st_mtime != file->mtime_sec
+					|| STAT_NSEC(&handle->st) != file->mtime_nsec
+				        /* don't check the inode to support file-system without persistent inodes */
+				) {
+					/* report that the file is not synced */
+					file_flag_set(file, FILE_IS_UNSYNCED);
+				}
+
+				if (!(state->opt.syncedonly && file_flag_has(file, FILE_IS_UNSYNCED))
+					&& handle->st.st_size > file->size
+				) {
+					log_error("File '%s' is larger than expected.\n", handle->path);
+					log_tag("error:%u:%s:%s: Size error\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer));
+					++audit_disk->error;
+				}
+
+				file_flag_set(file, FILE_IS_OPENED);
+			}
+		}
+
+		if (file_flag_has(file, FILE_IS_MISSING)) {
+			log_tag("error:%u:%s:%s: Open error at position %u\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), file_pos);
+			++audit_disk->error;
+			file_flag_set(file, FILE_IS_DAMAGED);
+			read_size = 0;
+			goto progress;
+		}
+
+		/* read together the next blocks of the file */
+		read_size = handle_read_ahead(handle, file_pos, file->blockmax - file_pos, buffer, state->block_size,
+			log_error, state->opt.expected_missing ? log_expected : 0);
+		if (read_size == -1) {
+			log_tag("error:%u:%s:%s: Read error at position %u\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), file_pos);
+			++audit_disk->error;
+			file_flag_set(file, FILE_IS_DAMAGED);
+			read_size = 0;
+			goto progress;
+		}
+
+		/* CHG blocks don't have a hash to check */
+		if (block_state_get(block) == BLOCK_STATE_CHG)
+			goto progress;
+
+		/* compute the hash of the block just read */
+		if (info_get_rehash(info_get(&state->infoarr, parity_pos))) {
+			memhash(state->prevhash, state->prevhashseed, hash, buffer, read_size);
+		} else {
+			memhash(state->hash, state->hashseed, hash, buffer, read_size);
+		}
+
+		/* compare the hash */
+		if (memcmp(hash, block->hash, BLOCK_HASH_SIZE) != 0) {
+			unsigned diff = memdiff(hash, block->hash, BLOCK_HASH_SIZE);
+
+			log_tag("error:%u:%s:%s: Data error at position %u, diff bits %u/%u\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), file_pos, diff, BLOCK_HASH_SIZE * 8);
+			++audit_disk->error;
+			file_flag_set(file, FILE_IS_DAMAGED);
+		}
+
+progress:
+		if (audit_progress(audit, parity_pos, read_size)) {
+			/* LCOV_EXCL_START */
+			handle_close(handle);
+			return 1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	if (handle->file == file) {
+		ret = handle_close(handle);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Close error. %s\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected close error in a data disk.\n");
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	/* print the final status, if the last block was in the range */
+	/* like file_post(), nothing to report if processing only bad blocks */
+	if (!state->opt.badonly
+		&& parity_pos >= audit->blockstart && parity_pos < audit->blockmax
+	) {
+		if (file_flag_has(file, FILE_IS_DAMAGED)) {
+			log_tag("status:damaged:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
+			msg_info("damaged %s\n", fmt_term(disk, file->sub, esc_buffer));
+		} else if (msg_level >= MSG_VERBOSE) {
+			/* we don't use msg_verbose() because it also goes into the log */
+			log_tag("status:correct:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
+			msg_info("correct %s\n", fmt_term(disk, file->sub, esc_buffer));
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Audit all the files of a disk.
+ * Return -1 on fatal error, 0 otherwise.
+ */
+static int audit_disk_process(struct snapraid_audit_disk* audit_disk)
+{
+	struct snapraid_state* state = audit_disk->audit->state;
+	unsigned char* buffer;
+	void* buffer_alloc;
+	unsigned i;
+	int ret;
+
+	buffer = malloc_nofail_direct(state->block_size, &buffer_alloc);
+
+	ret = 0;
+	for (i = 0; i < audit_disk->file_max; ++i) {
+		ret = audit_file(audit_disk, audit_disk->file_map[i], buffer);
+		if (ret != 0)
+			break;
+	}
+
+	free(buffer_alloc);
+
+	/* an interruption isn't an error */
+	return ret == -1 ? -1 : 0;
+}
+
+#if HAVE_PTHREAD
+static void* audit_disk_thread(void* arg)
+{
+	struct snapraid_audit_disk* audit_disk = arg;
+
+	if (audit_disk_process(audit_disk) != 0) {
+		/* LCOV_EXCL_START */
+		return audit_disk;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * Audit all the disks, each one independently from the others.
+ * Return -1 on fatal error, 0 otherwise.
+ */
+static int state_audit_process(struct snapraid_state* state, struct snapraid_handle* handle, unsigned diskmax, block_off_t blockstart, block_off_t blockmax, block_off_t* countpos, block_off_t* countmax, data_off_t* countsize, unsigned* error)
+{
+	struct snapraid_audit audit;
+	struct snapraid_audit_disk* audit_map;
+	unsigned j;
+	int ret;
+
+	audit.state = state;
+	audit.blockstart = blockstart;
+	audit.blockmax = blockmax;
+	audit.countpos = 0;
+	audit.countmax = 0;
+	audit.countsize = 0;
+	audit.stop = 0;
+
+	audit_map = malloc_nofail(diskmax * sizeof(struct snapraid_audit_disk));
+
+	/* collect the files to audit, and count the blocks to process */
+	for (j = 0; j < diskmax; ++j) {
+		struct snapraid_audit_disk* audit_disk = &audit_map[j];
+		struct snapraid_disk* disk = handle[j].disk;
+		tommy_node* node;
+
+		audit_disk->audit = &audit;
+		audit_disk->handle = &handle[j];
+		audit_disk->file_map = 0;
+		audit_disk->file_max = 0;
+		audit_disk->error = 0;
+
+		if (!disk)
+			continue;
+
+		audit_disk->file_map = malloc_nofail(tommy_list_count(&disk->filelist) * sizeof(struct snapraid_file*));
+
+		for (node = disk->filelist; node != 0; node = node->next) {
+			struct snapraid_file* file = node->data;
+			block_off_t file_pos;
+			block_off_t count;
+
+			/* excluded files are not even read */
+			if (file_flag_has(file, FILE_IS_EXCLUDED))
+				continue;
+
+			count = 0;
+			for (file_pos = 0; file_pos < file->blockmax; ++file_pos) {
+				if (audit_is_enabled(&audit, fs_file2par_get(disk, file, file_pos)))
+					++count;
+			}
+
+			if (count == 0)
+				continue;
+
+			audit.countmax += count;
+			audit_disk->file_map[audit_disk->file_max++] = file;
+		}
+
+		/* read the files in the order they are stored in the disk */
+		qsort(audit_disk->file_map, audit_disk->file_max, sizeof(struct snapraid_file*), audit_file_compare);
+	}
+
+	ret = 0;
+	state_progress_begin(state, blockstart, blockmax, audit.countmax);
+
+#if HAVE_PTHREAD
+	thread_mutex_init(&audit.mutex, 0);
+
+	for (j = 0; j < diskmax; ++j) {
+		if (audit_map[j].file_max != 0)
+			thread_create(&audit_map[j].thread, 0, audit_disk_thread, &audit_map[j]);
+	}
+
+	for (j = 0; j < diskmax; ++j) {
+		void* retval;
+
+		if (audit_map[j].file_max == 0)
+			continue;
+
+		thread_join(audit_map[j].thread, &retval);
+		if (retval != 0) {
+			/* LCOV_EXCL_START */
+			ret = -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	thread_mutex_destroy(&audit.mutex);
+#else
+	for (j = 0; j < diskmax; ++j) {
+		if (audit_disk_process(&audit_map[j]) != 0) {
+			/* LCOV_EXCL_START */
+			ret = -1;
+			break;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+#endif
+
+	for (j = 0; j < diskmax; ++j) {
+		*error += audit_map[j].error;
+		free(audit_map[j].file_map);
+	}
+	free(audit_map);
+
+	*countpos = audit.countpos;
+	*countmax = audit.countmax;
+	*countsize = audit.countsize;
+
+	return ret;
+}
+
+/**
+ * Get the first position enabled in the map, starting from ::i.
+ * Return ::blockmax if none.
+ */
+static block_off_t check_map_next(const unsigned char* map, block_off_t i, block_off_t blockmax)
+{
+	while (i < blockmax) {
+		/* skip quickly the empty bytes */
+		if (map[i / 8] == 0) {
+			i = (i / 8 + 1) * 8;
+			continue;
+		}
+
+		if (map[i / 8] & (1 << (i % 8)))
+			return i;
+
+		++i;
+	}
+
+	return blockmax;
+}
+
 static int state_check_process(struct snapraid_state* state, int fix, struct snapraid_parity_handle** parity, block_off_t blockstart, block_off_t blockmax)
 {
 	struct snapraid_handle* handle;
@@ -860,12 +1605,17 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 	data_off_t countsize;
 	block_off_t countpos;
 	block_off_t countmax;
+	struct snapraid_disk** spinup_map;
 	unsigned error;
 	unsigned unrecoverable_error;
 	unsigned recovered_error;
 	struct failed_struct* failed;
 	unsigned* failed_map;
+	struct verify_struct* verify;
+	struct snapraid_check_pool* pool;
+	unsigned char* map;
 	unsigned l;
+	unsigned k;
 	char esc_buffer[ESC_MAX];
 	char esc_buffer_alt[ESC_MAX];
 
@@ -884,17 +1634,81 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 
 	failed = malloc_nofail(diskmax * sizeof(struct failed_struct));
 	failed_map = malloc_nofail(diskmax * sizeof(unsigned));
+	verify = malloc_nofail(diskmax * sizeof(struct verify_struct));
+
+#if HAVE_PTHREAD
+	/* the slices of the raid computation use data and parity */
+	/* not used with audit only, as no parity is computed */
+	pool = 0;
+	if (!state->opt.auditonly)
+		pool = check_pool_alloc(state, diskmax + state->level);
+#else
+	pool = 0;
+#endif
 
 	error = 0;
 	unrecoverable_error = 0;
 	recovered_error = 0;
 
+	map = 0;
+
+	/* with audit only, the disks are read independently from each other */
+	if (state->opt.auditonly) {
+		ret = state_audit_process(state, handle, diskmax, blockstart, blockmax, &countpos, &countmax, &countsize, &error);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_fatal("Stopping\n");
+			++unrecoverable_error;
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+		goto others;
+	}
+
+	/* if all the parities are excluded, only the positions of the files */
+	/* not excluded are processed, and we get them from the files, */
+	/* instead of searching them in all the positions */
+	for (l = 0; l < state->level; ++l) {
+		if (!state->parity[l].is_excluded_by_filter)
+			break;
+	}
+	if (l == state->level) {
+		map = calloc_nofail((blockmax + 7) / 8, 1);
+		for (j = 0; j < diskmax; ++j) {
+			if (handle[j].disk)
+				fs_included_map(handle[j].disk, blockmax, map);
+		}
+	}
+
 	/* first count the number of blocks to process */
+	spinup_map = 0;
+	if (state->opt.lazy_spinup)
+		spinup_map = calloc_nofail(diskmax, sizeof(struct snapraid_disk*));
+
 	countmax = 0;
 	for (i = blockstart; i < blockmax; ++i) {
+		if (map) {
+			i = check_map_next(map, i, blockmax);
+			if (i == blockmax)
+				break;
+		}
 		if (!block_is_enabled(state, i, handle, diskmax))
 			continue;
 		++countmax;
+
+		/* mark the disks with a block to read */
+		if (spinup_map) {
+			for (j = 0; j < diskmax; ++j) {
+				if (handle[j].disk && !spinup_map[j] && block_has_file(fs_par2block_find(handle[j].disk, i)))
+					spinup_map[j] = handle[j].disk;
+			}
+		}
+	}
+
+	/* spin up together only the disks used, before starting to read them */
+	if (spinup_map) {
+		state_device_spinup(state, spinup_map, diskmax, countmax != 0);
+		free(spinup_map);
 	}
 
 	/* check all the blocks in files */
@@ -903,11 +1717,20 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 	state_progress_begin(state, blockstart, blockmax, countmax);
 	for (i = blockstart; i < blockmax; ++i) {
 		unsigned failed_count;
+		unsigned verify_count;
 		int valid_parity;
 		int used_parity;
 		snapraid_info info;
 		int rehash;
 
+		/* jump to the next position of the files not excluded */
+		/* the positions skipped have only excluded files, closed at the end */
+		if (map) {
+			i = check_map_next(map, i, blockmax);
+			if (i == blockmax)
+				break;
+		}
+
 		if (!block_is_enabled(state, i, handle, diskmax)) {
 			/* post process the files */
 			ret = file_post(state, fix, i, handle, diskmax);
@@ -936,6 +1759,9 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 		/* keep track of the number of failed blocks */
 		failed_count = 0;
 
+		/* keep track of the number of blocks to verify */
+		verify_count = 0;
+
 		/* get block specific info */
 		info = info_get(&state->infoarr, i);
 
@@ -945,11 +1771,11 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 		/* for each disk, process the block */
 		for (j = 0; j < diskmax; ++j) {
 			int read_size;
-			unsigned char hash[HASH_MAX];
 			struct snapraid_disk* disk;
 			struct snapraid_block* block;
 			struct snapraid_file* file;
 			block_off_t file_pos;
+			block_off_t run;
 			unsigned block_state;
 
 			/* if the disk position is not used */
@@ -1015,8 +1841,11 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 
 			/* if the file is closed or different than the current one */
 			if (handle[j].file == 0 || handle[j].file != file) {
-				/* close the old one, if any */
-				ret = handle_close(&handle[j]);
+				/* close the old one, if any, or release it if only reading */
+				if (fix)
+					ret = handle_close(&handle[j]);
+				else
+					ret = handle_release(&handle[j]);
 				if (ret == -1) {
 					/* LCOV_EXCL_START */
 					log_tag("error:%u:%s:%s: Close error. %s\n", i, disk->name, esc_tag(handle[j].file->sub, esc_buffer), strerror(errno));
@@ -1127,8 +1956,11 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 				file_flag_set(file, FILE_IS_OPENED);
 			}
 
+			/* read together the next blocks of the file, if they follow in the parity */
+			run = handle[j].ahead_max > 1 ? fs_par2run_index(disk, i) : 1;
+
 			/* read from the file */
-			read_size = handle_read(&handle[j], file_pos, buffer[j], state->block_size,
+			read_size = handle_read_ahead(&handle[j], file_pos, run, buffer[j], state->block_size,
 				log_error, state->opt.expected_missing ? log_expected : 0);
 			if (read_size == -1) {
 				/* save the failed block for the check/fix */
@@ -1169,29 +2001,41 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 
 			assert(block_state == BLOCK_STATE_BLK || block_state == BLOCK_STATE_REP);
 
-			/* compute the hash of the block just read */
-			if (rehash) {
-				memhash(state->prevhash, state->prevhashseed, hash, buffer[j], read_size);
-			} else {
-				memhash(state->hash, state->hashseed, hash, buffer[j], read_size);
-			}
+			/* verify the hash later, together with the other blocks read */
+			verify[verify_count].index = j;
+			verify[verify_count].block = block;
+			verify[verify_count].file = file;
+			verify[verify_count].file_pos = file_pos;
+			verify[verify_count].read_size = read_size;
+			++verify_count;
+		}
+
+		/* compute the hashes of the blocks read */
+		check_hash(pool, state, rehash, verify, verify_count, buffer);
 
-			/* compare the hash */
-			if (memcmp(hash, block->hash, BLOCK_HASH_SIZE) != 0) {
-				unsigned diff = memdiff(hash, block->hash, BLOCK_HASH_SIZE);
+		/* for each block read, compare the hash */
+		for (k = 0; k < verify_count; ++k) {
+			struct snapraid_block* block = verify[k].block;
+			struct snapraid_file* file = verify[k].file;
+			block_off_t file_pos = verify[k].file_pos;
+
+			j = verify[k].index;
+
+			if (memcmp(verify[k].hash, block->hash, BLOCK_HASH_SIZE) != 0) {
+				unsigned diff = memdiff(verify[k].hash, block->hash, BLOCK_HASH_SIZE);
 
 				/* save the failed block for the check/fix */
 				failed[failed_count].is_bad = 1; /* it's bad because the hash doesn't match */
 				failed[failed_count].is_outofdate = 0;
 				failed[failed_count].index = j;
 				failed[failed_count].block = block;
-				failed[failed_count].disk = disk;
+				failed[failed_count].disk = handle[j].disk;
 				failed[failed_count].file = file;
 				failed[failed_count].file_pos = file_pos;
 				failed[failed_count].handle = &handle[j];
 				++failed_count;
 
-				log_tag("error:%u:%s:%s: Data error at position %u, diff bits %u/%u\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, diff, BLOCK_HASH_SIZE * 8);
+				log_tag("error:%u:%s:%s: Data error at position %u, diff bits %u/%u\n", i, handle[j].disk->name, esc_tag(file->sub, esc_buffer), file_pos, diff, BLOCK_HASH_SIZE * 8);
 				++error;
 				continue;
 			}
@@ -1199,12 +2043,12 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			/* always insert REP blocks, the repair functions needs all of them */
 			/* because the parity may be still referring at the old state */
 			/* and the repair must be aware of it */
-			if (block_state == BLOCK_STATE_REP) {
+			if (block_state_get(block) == BLOCK_STATE_REP) {
 				failed[failed_count].is_bad = 0; /* it's not bad */
 				failed[failed_count].is_outofdate = 0;
 				failed[failed_count].index = j;
 				failed[failed_count].block = block;
-				failed[failed_count].disk = disk;
+				failed[failed_count].disk = handle[j].disk;
 				failed[failed_count].file = file;
 				failed[failed_count].file_pos = file_pos;
 				failed[failed_count].handle = &handle[j];
@@ -1213,10 +2057,13 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			}
 		}
 
+		/* the repair functions need the failed blocks in the disk order */
+		if (verify_count != 0)
+			failed_sort(failed, failed_count);
+
 		/* now read and check the parity if requested */
 		if (!state->opt.auditonly) {
 			void* buffer_recov[LEV_MAX];
-			void* buffer_zero;
 
 			/* buffers for parity read and not computed */
 			for (l = 0; l < state->level; ++l)
@@ -1224,9 +2071,6 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			for (; l < LEV_MAX; ++l)
 				buffer_recov[l] = 0;
 
-			/* the zero buffer is the last one */
-			buffer_zero = buffer[buffermax - 1];
-
 			/* read the parity */
 			for (l = 0; l < state->level; ++l) {
 				if (parity[l]) {
@@ -1243,7 +2087,7 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			}
 
 			/* try all the recovering strategies */
-			ret = repair(state, rehash, i, diskmax, failed, failed_map, failed_count, buffer, buffer_recov, buffer_zero);
+			ret = repair(pool, state, rehash, i, diskmax, failed, failed_map, failed_count, buffer, buffer_recov);
 			if (ret != 0) {
 				/* increment the number of errors */
 				if (ret > 0)
@@ -1426,6 +2270,7 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 		}
 	}
 
+others:
 	/* for each disk, recover empty files, symlinks and empty dirs */
 	for (i = 0; i < diskmax; ++i) {
 		tommy_node* node;
@@ -1904,9 +2749,14 @@ bail:
 	}
 	log_flush();
 
+#if HAVE_PTHREAD
+	check_pool_free(pool);
+#endif
+	free(map);
+	free(verify);
 	free(failed);
 	free(failed_map);
-	free(handle);
+	handle_unmapping(handle, diskmax);
 	free(buffer_alloc);
 	free(buffer);
 
@@ -1941,12 +2791,15 @@ int state_check(struct snapraid_state* state, int fix, block_off_t blockstart, b
 	data_off_t size;
 	int ret;
 	struct snapraid_parity_handle parity[LEV_MAX];
+	struct snapraid_parity_resize resize[LEV_MAX];
 	struct snapraid_parity_handle* parity_ptr[LEV_MAX];
 	unsigned error;
 	unsigned l;
 
 	msg_progress("Initializing...\n");
 
+	state_index(state);
+
 	blockmax = parity_allocated_size(state);
 	size = blockmax * (data_off_t)state->block_size;
 
@@ -1963,6 +2816,9 @@ int state_check(struct snapraid_state* state, int fix, block_off_t blockstart, b
 	}
 
 	if (fix) {
+		/* the recovered files are checked for inode collisions */
+		state_fileset(state);
+
 		/* if fixing, create the file and open for writing */
 		/* if it fails, we cannot continue */
 		for (l = 0; l < state->level; ++l) {
@@ -1991,14 +2847,29 @@ int state_check(struct snapraid_state* state, int fix, block_off_t blockstart, b
 					exit(EXIT_FAILURE);
 					/* LCOV_EXCL_STOP */
 				}
+			}
+		}
 
-				ret = parity_chsize(parity_ptr[l], &state->parity[l], 0, size, state->block_size, state->opt.skip_fallocate, state->opt.skip_space_holder);
-				if (ret == -1) {
-					/* LCOV_EXCL_START */
-					log_fatal("WARNING! Without an accessible %s file, it isn't possible to sync.\n", lev_name(l));
-					exit(EXIT_FAILURE);
-					/* LCOV_EXCL_STOP */
-				}
+		/* resize the created parity files, all the levels at the same time */
+		for (l = 0; l < state->level; ++l) {
+			int is_created = parity_ptr[l] && !state->parity[l].is_excluded_by_filter;
+
+			resize[l].handle = is_created ? parity_ptr[l] : 0;
+			resize[l].parity = &state->parity[l];
+			resize[l].size = size;
+			resize[l].block_size = state->block_size;
+			resize[l].skip_fallocate = state->opt.skip_fallocate;
+			resize[l].skip_space_holder = state->opt.skip_space_holder;
+		}
+
+		parity_chsize_multi(resize, state->level);
+
+		for (l = 0; l < state->level; ++l) {
+			if (resize[l].handle && resize[l].ret == -1) {
+				/* LCOV_EXCL_START */
+				log_fatal("WARNING! Without an accessible %s file, it isn't possible to sync.\n", lev_name(l));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
 			}
 		}
 	} else if (!state->opt.auditonly) {
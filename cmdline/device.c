@@ -19,6 +19,8 @@
 
 #include "support.h"
 #include "state.h"
+#include "stream.h"
+#include "remote.h"
 #include "raid/raid.h"
 
 /**
@@ -902,6 +904,288 @@ static int devtest(tommy_list* low, int operation)
 	return 0;
 }
 
+/**
+ * SMART attributes of a device, saved to avoid to query it again.
+ */
+struct snapraid_smart_cache {
+	char file[PATH_MAX]; /**< File device. */
+	char smartctl[PATH_MAX]; /**< Options for smartctl. */
+	int64_t time; /**< Time of the query. */
+	uint64_t smart[SMART_COUNT]; /**< SMART raw attributes. */
+	char serial[SMART_MAX]; /**< SMART serial number. */
+	char vendor[SMART_MAX]; /**< SMART vendor. */
+	char model[SMART_MAX]; /**< SMART model. */
+
+	/* nodes for data structures */
+	tommy_hashdyn_node node;
+};
+
+static int smart_cache_compare(const void* void_arg, const void* void_data)
+{
+	const devinfo_t* arg = void_arg;
+	const struct snapraid_smart_cache* cache = void_data;
+
+	if (strcmp(arg->file, cache->file) != 0)
+		return 1;
+
+	return strcmp(arg->smartctl, cache->smartctl);
+}
+
+static struct snapraid_smart_cache* smart_cache_search(tommy_hashdyn* cacheset, devinfo_t* devinfo)
+{
+	return tommy_hashdyn_search(cacheset, smart_cache_compare, devinfo, tommy_strhash_u32(0, devinfo->file));
+}
+
+/**
+ * Read the SMART cache, ignoring it if invalid.
+ */
+static void smart_cache_read(const char* path, tommy_hashdyn* cacheset)
+{
+	STREAM* f;
+	unsigned char header[12];
+	uint32_t count;
+	uint32_t crc_computed;
+	uint32_t crc;
+	uint32_t i;
+	unsigned j;
+	int ret;
+
+	f = sopen_read(path);
+	if (f == 0) {
+		if (errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Error opening the SMART cache '%s'. %s.\n", path, strerror(errno));
+			/* LCOV_EXCL_STOP */
+		}
+		return;
+	}
+
+	ret = sread(f, header, 12);
+	if (ret < 0 || memcmp(header, "SNAPSMT1\n\3\0\0", 12) != 0)
+		goto bail;
+
+	if (sgetb32(f, &count) < 0)
+		goto bail;
+
+	for (i = 0; i < count; ++i) {
+		struct snapraid_smart_cache* cache;
+		uint64_t time;
+
+		cache = malloc_nofail(sizeof(struct snapraid_smart_cache));
+		tommy_hashdyn_insert(cacheset, &cache->node, cache, 0);
+
+		if (sgetbs(f, cache->file, sizeof(cache->file)) < 0
+			|| sgetbs(f, cache->smartctl, sizeof(cache->smartctl)) < 0
+			|| sgetb64(f, &time) < 0
+			|| sgetbs(f, cache->serial, sizeof(cache->serial)) < 0
+			|| sgetbs(f, cache->vendor, sizeof(cache->vendor)) < 0
+			|| sgetbs(f, cache->model, sizeof(cache->model)) < 0)
+			goto bail;
+
+		cache->time = time;
+
+		for (j = 0; j < SMART_COUNT; ++j) {
+			if (sgetb64(f, &cache->smart[j]) < 0)
+				goto bail;
+		}
+
+		/* insert again with the real hash */
+		tommy_hashdyn_remove_existing(cacheset, &cache->node);
+		tommy_hashdyn_insert(cacheset, &cache->node, cache, tommy_strhash_u32(0, cache->file));
+	}
+
+	crc_computed = scrc(f);
+
+	if (sgetble32(f, &crc) < 0 || crc != crc_computed)
+		goto bail;
+
+	sclose(f);
+	return;
+
+bail:
+	/* LCOV_EXCL_START */
+	log_fatal("WARNING! Ignoring the invalid SMART cache '%s'.\n", path);
+	tommy_hashdyn_foreach(cacheset, free);
+	tommy_hashdyn_done(cacheset);
+	tommy_hashdyn_init(cacheset);
+	sclose(f);
+	/* LCOV_EXCL_STOP */
+}
+
+/**
+ * Write the SMART cache with all the devices.
+ * On error the cache is not updated.
+ */
+static void smart_cache_write(const char* path, tommy_list* low, tommy_hashdyn* cacheset, int64_t now)
+{
+	STREAM* f;
+	char tmp[PATH_MAX];
+	tommy_node* i;
+	unsigned j;
+
+	pathprint(tmp, sizeof(tmp), "%s.tmp", path);
+
+	/* ensure to delete a previous stale file */
+	if (remove(tmp) != 0 && errno != ENOENT) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error removing the stale SMART cache '%s'. %s.\n", tmp, strerror(errno));
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	f = sopen_write(tmp);
+	if (f == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error creating the SMART cache '%s'. %s.\n", tmp, strerror(errno));
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	swrite("SNAPSMT1\n\3\0\0", 12, f);
+	sputb32(tommy_list_count(low), f);
+	for (i = tommy_list_head(low); i != 0; i = i->next) {
+		devinfo_t* devinfo = i->data;
+		int64_t time = now;
+
+		/* keep the time of the query for the cached devices */
+		if (devinfo->skip)
+			time = smart_cache_search(cacheset, devinfo)->time;
+
+		sputbs(devinfo->file, f);
+		sputbs(devinfo->smartctl, f);
+		sputb64(time, f);
+		sputbs(devinfo->smart_serial, f);
+		sputbs(devinfo->smart_vendor, f);
+		sputbs(devinfo->smart_model, f);
+		for (j = 0; j < SMART_COUNT; ++j)
+			sputb64(devinfo->smart[j], f);
+	}
+
+	sputble32(scrc(f), f);
+
+	if (serror(f) || sflush(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error writing the SMART cache '%s'. %s.\n", tmp, strerror(errno));
+		sclose(f);
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (sclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error closing the SMART cache '%s'. %s.\n", tmp, strerror(errno));
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (rename(tmp, path) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error renaming the SMART cache '%s' to '%s'. %s.\n", tmp, path, strerror(errno));
+		remove(tmp);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+/**
+ * Get the SMART attributes, reusing the ones in the cache if recent enough.
+ */
+static int devsmart_cache(struct snapraid_state* state, tommy_list* low)
+{
+	char path[PATH_MAX];
+	tommy_hashdyn cacheset;
+	struct snapraid_content* content;
+	tommy_node* i;
+	int64_t now;
+	unsigned cached;
+	int ret;
+
+	/* the cache is stored next to the first content file */
+	content = tommy_list_head(&state->contentlist)->data;
+	pathprint(path, sizeof(path), "%s.smart", content->content);
+
+	tommy_hashdyn_init(&cacheset);
+	smart_cache_read(path, &cacheset);
+
+	now = time(0);
+
+	/* fill the devices with recent attributes, and skip their query */
+	cached = 0;
+	for (i = tommy_list_head(low); i != 0; i = i->next) {
+		devinfo_t* devinfo = i->data;
+		struct snapraid_smart_cache* cache;
+
+		cache = smart_cache_search(&cacheset, devinfo);
+		if (!cache || cache->time > now || now - cache->time >= state->smart_cache)
+			continue;
+
+		memcpy(devinfo->smart, cache->smart, sizeof(devinfo->smart));
+		pathcpy(devinfo->smart_serial, sizeof(devinfo->smart_serial), cache->serial);
+		pathcpy(devinfo->smart_vendor, sizeof(devinfo->smart_vendor), cache->vendor);
+		pathcpy(devinfo->smart_model, sizeof(devinfo->smart_model), cache->model);
+		devinfo->skip = 1;
+		++cached;
+	}
+
+	if (cached != 0)
+		msg_progress("Using the SMART cache for %u devices...\n", cached);
+
+	ret = devoperate(low, DEVICE_SMART);
+
+	/* update the cache only if some device was queried */
+	if (ret == 0 && cached != tommy_list_count(low))
+		smart_cache_write(path, low, &cacheset, now);
+
+	tommy_hashdyn_foreach(&cacheset, free);
+	tommy_hashdyn_done(&cacheset);
+
+	return ret;
+}
+
+/**
+ * Add a data disk to the list of devices.
+ */
+static void device_disk(tommy_list* high, struct snapraid_disk* disk)
+{
+	devinfo_t* entry;
+
+	entry = calloc_nofail(1, sizeof(devinfo_t));
+
+	entry->device = disk->device;
+	pathcpy(entry->name, sizeof(entry->name), disk->name);
+	pathcpy(entry->mount, sizeof(entry->mount), disk->dir);
+	pathcpy(entry->smartctl, sizeof(entry->smartctl), disk->smartctl);
+
+	tommy_list_insert_tail(high, &entry->node, entry);
+}
+
+/**
+ * Add all the splits of a parity to the list of devices.
+ */
+static void device_parity(tommy_list* high, struct snapraid_parity* parity, unsigned level)
+{
+	unsigned s;
+
+	for (s = 0; s < parity->split_mac; ++s) {
+		devinfo_t* entry;
+
+		/* a remote parity has no local device */
+		if (remote_is(parity->split_map[s].path))
+			continue;
+
+		entry = calloc_nofail(1, sizeof(devinfo_t));
+
+		entry->device = parity->split_map[s].device;
+		pathcpy(entry->name, sizeof(entry->name), lev_config_name(level));
+		pathcpy(entry->mount, sizeof(entry->mount), parity->split_map[s].path);
+		pathcpy(entry->smartctl, sizeof(entry->smartctl), parity->smartctl);
+		pathcut(entry->mount); /* remove the parity file */
+
+		tommy_list_insert_tail(high, &entry->node, entry);
+	}
+}
+
 void state_device(struct snapraid_state* state, int operation, tommy_list* filterlist_disk)
 {
 	tommy_node* i;
@@ -921,44 +1205,28 @@ void state_device(struct snapraid_state* state, int operation, tommy_list* filte
 	/* for all disks */
 	for (i = state->disklist; i != 0; i = i->next) {
 		struct snapraid_disk* disk = i->data;
-		devinfo_t* entry;
 
 		if (filterlist_disk != 0 && filter_path(filterlist_disk, 0, disk->name, 0) != 0)
 			continue;
 
-		entry = calloc_nofail(1, sizeof(devinfo_t));
-
-		entry->device = disk->device;
-		pathcpy(entry->name, sizeof(entry->name), disk->name);
-		pathcpy(entry->mount, sizeof(entry->mount), disk->dir);
-		pathcpy(entry->smartctl, sizeof(entry->smartctl), disk->smartctl);
-
-		tommy_list_insert_tail(&high, &entry->node, entry);
+		device_disk(&high, disk);
 	}
 
 	/* for all parities */
 	for (j = 0; j < state->level; ++j) {
-		devinfo_t* entry;
-		unsigned s;
-
 		if (filterlist_disk != 0 && filter_path(filterlist_disk, 0, lev_config_name(j), 0) != 0)
 			continue;
 
-		for (s = 0; s < state->parity[j].split_mac; ++s) {
-			entry = calloc_nofail(1, sizeof(devinfo_t));
-
-			entry->device = state->parity[j].split_map[s].device;
-			pathcpy(entry->name, sizeof(entry->name), lev_config_name(j));
-			pathcpy(entry->mount, sizeof(entry->mount), state->parity[j].split_map[s].path);
-			pathcpy(entry->smartctl, sizeof(entry->smartctl), state->parity[j].smartctl);
-			pathcut(entry->mount); /* remove the parity file */
-
-			tommy_list_insert_tail(&high, &entry->node, entry);
-		}
+		device_parity(&high, &state->parity[j], j);
 	}
 
 	if (state->opt.fake_device) {
 		ret = devtest(&low, operation);
+	} else if (operation == DEVICE_SMART && state->smart_cache != 0) {
+		/* list the devices, and query only the ones not in the cache */
+		ret = devquery(&high, &low, DEVICE_LIST, 1);
+		if (ret == 0)
+			ret = devsmart_cache(state, &low);
 	} else {
 		int others = operation == DEVICE_SMART;
 
@@ -999,3 +1267,47 @@ void state_device(struct snapraid_state* state, int operation, tommy_list* filte
 	tommy_list_foreach(&low, free);
 }
 
+
+void state_device_spinup(struct snapraid_state* state, struct snapraid_disk** disk_map, unsigned disk_max, int parity)
+{
+	tommy_list high;
+	tommy_list low;
+	unsigned j;
+	int ret;
+
+	tommy_list_init(&high);
+	tommy_list_init(&low);
+
+	for (j = 0; j < disk_max; ++j) {
+		if (disk_map[j])
+			device_disk(&high, disk_map[j]);
+	}
+
+	if (parity) {
+		for (j = 0; j < state->level; ++j)
+			device_parity(&high, &state->parity[j], j);
+	}
+
+	if (!tommy_list_empty(&high)) {
+		tommy_node* i;
+
+		msg_progress("Spinup...\n");
+
+		for (i = tommy_list_head(&high); i != 0; i = i->next) {
+			devinfo_t* devinfo = i->data;
+			log_tag("spinup:%s:%s\n", devinfo->name, devinfo->mount);
+		}
+
+		/* with fake devices, only report the disks */
+		if (state->opt.fake_device)
+			ret = 0;
+		else
+			ret = devquery(&high, &low, DEVICE_UP, 0);
+
+		if (ret != 0)
+			log_fatal("WARNING! Spinup is unsupported in this platform. The disks are spun up when accessed.\n");
+	}
+
+	tommy_list_foreach(&high, free);
+	tommy_list_foreach(&low, free);
+}
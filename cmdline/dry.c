@@ -28,6 +28,151 @@
 /****************************************************************************/
 /* dry */
 
+#define DRY_ZONE_MAX 64 /**< Number of ranges of positions used to find the slow ones. */
+#define DRY_ZONE_MIN (64 * MEBI) /**< Min bytes read in a range to measure its speed. */
+
+/**
+ * Read profile of a data or parity disk.
+ */
+struct snapraid_dry_profile {
+	const char* name; /**< Name of the disk. 0 if not used. */
+	const struct snapraid_histo* histo; /**< Latency of the reads. */
+	uint64_t size; /**< Bytes read. */
+	uint64_t tick_io; /**< Ticks spent reading. */
+	uint64_t tick_elapsed; /**< Ticks of the whole pass reading the disk. */
+	uint64_t zone_size[DRY_ZONE_MAX]; /**< Bytes read in each range of positions. */
+	uint64_t zone_tick[DRY_ZONE_MAX]; /**< Ticks spent reading in each range of positions. */
+};
+
+/**
+ * Account a read in the profile.
+ */
+static void dry_profile_add(struct snapraid_dry_profile* profile, struct snapraid_task* task, unsigned size, block_off_t blockstart, block_off_t blockmax)
+{
+	uint64_t delta = task->tick_done - task->tick_start;
+	unsigned zone = (uint64_t)(task->position - blockstart) * DRY_ZONE_MAX / (blockmax - blockstart);
+
+	profile->size += size;
+	profile->tick_io += delta;
+	profile->zone_size[zone] += size;
+	profile->zone_tick[zone] += delta;
+}
+
+static uint64_t dry_speed(uint64_t size, uint64_t ticks, uint64_t freq)
+{
+	if (ticks == 0)
+		return 0;
+
+	return size * freq / (ticks * MEGA);
+}
+
+static int dry_speed_compare(const void* void_a, const void* void_b)
+{
+	uint64_t a = *(const uint64_t*)void_a;
+	uint64_t b = *(const uint64_t*)void_b;
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+/**
+ * Print the ranges of positions read at less than half the median speed of the disk.
+ *
+ * They are the zones where the throughput collapses, like the shingled
+ * zones of SMR disks, heavily fragmented files, or sectors slow to read.
+ */
+static void dry_profile_slow(struct snapraid_dry_profile* profile, block_off_t blockstart, block_off_t blockmax, uint64_t freq)
+{
+	uint64_t speed[DRY_ZONE_MAX];
+	uint64_t sorted[DRY_ZONE_MAX];
+	uint64_t median;
+	unsigned count;
+	unsigned z;
+
+	count = 0;
+	for (z = 0; z < DRY_ZONE_MAX; ++z) {
+		speed[z] = dry_speed(profile->zone_size[z], profile->zone_tick[z], freq);
+		if (profile->zone_size[z] >= DRY_ZONE_MIN)
+			sorted[count++] = speed[z];
+	}
+
+	if (count == 0)
+		return;
+
+	qsort(sorted, count, sizeof(uint64_t), dry_speed_compare);
+	median = sorted[count / 2];
+
+	z = 0;
+	while (z < DRY_ZONE_MAX) {
+		block_off_t pos_begin;
+		block_off_t pos_end;
+		uint64_t size;
+		uint64_t ticks;
+
+		if (profile->zone_size[z] < DRY_ZONE_MIN || speed[z] * 2 >= median) {
+			++z;
+			continue;
+		}
+
+		/* merge the following slow zones */
+		pos_begin = blockstart + (uint64_t)(blockmax - blockstart) * z / DRY_ZONE_MAX;
+		size = 0;
+		ticks = 0;
+		while (z < DRY_ZONE_MAX && profile->zone_size[z] >= DRY_ZONE_MIN && speed[z] * 2 < median) {
+			size += profile->zone_size[z];
+			ticks += profile->zone_tick[z];
+			++z;
+		}
+		pos_end = blockstart + (uint64_t)(blockmax - blockstart) * z / DRY_ZONE_MAX;
+
+		log_tag("dry:slow:%s:%u:%u:%" PRIu64 ":%" PRIu64 "\n", profile->name, pos_begin, pos_end, dry_speed(size, ticks, freq), median);
+		msg_status("%8s slow at blocks %u-%u, %" PRIu64 " MB/s instead of %" PRIu64 " MB/s\n", profile->name, pos_begin, pos_end - 1, dry_speed(size, ticks, freq), median);
+	}
+}
+
+/**
+ * Print the read profile of all the disks.
+ */
+static void dry_profile_print(struct snapraid_dry_profile* profile, unsigned profile_max, block_off_t blockstart, block_off_t blockmax)
+{
+	uint64_t freq = tick_freq();
+	unsigned i;
+
+	msg_status("\n");
+	msg_status("%8s %10s %10s %10s %10s %10s\n", "", "MB", "MB/s", "busy %", "p50 us", "p99 us");
+
+	for (i = 0; i < profile_max; ++i) {
+		struct snapraid_dry_profile* p = &profile[i];
+		uint64_t speed;
+		uint64_t busy;
+		uint64_t p50;
+		uint64_t p99;
+
+		if (!p->name || p->size == 0)
+			continue;
+
+		/* sustained speed in the pass, and the time the disk was busy reading */
+		speed = dry_speed(p->size, p->tick_elapsed, freq);
+		busy = p->tick_elapsed != 0 ? p->tick_io * 100 / p->tick_elapsed : 0;
+		p50 = histo_percentile(p->histo, 500) * 1000000 / freq;
+		p99 = histo_percentile(p->histo, 990) * 1000000 / freq;
+
+		log_tag("dry:disk:%s:%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n", p->name, p->size, speed, busy, p50, p99);
+		msg_status("%8s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", p->name, p->size / MEGA, speed, busy, p50, p99);
+	}
+
+	msg_status("\n");
+
+	for (i = 0; i < profile_max; ++i) {
+		if (!profile[i].name)
+			continue;
+		dry_profile_slow(&profile[i], blockstart, blockmax, freq);
+	}
+}
+
 /**
  * Check if we have to process the specified block index ::i.
  */
@@ -46,6 +191,7 @@ static void dry_data_reader(struct snapraid_worker* worker, struct snapraid_task
 	struct snapraid_handle* handle = worker->handle;
 	struct snapraid_disk* disk = handle->disk;
 	block_off_t blockcur = task->position;
+	block_off_t run;
 	unsigned char* buffer = task->buffer;
 	int ret;
 	char esc_buffer[ESC_MAX];
@@ -72,11 +218,11 @@ static void dry_data_reader(struct snapraid_worker* worker, struct snapraid_task
 	/* get the file of this block */
 	task->file = fs_par2file_get(disk, blockcur, &task->file_pos);
 
-	/* if the file is different than the current one, close it */
+	/* if the file is different than the current one, release it */
 	if (handle->file != 0 && handle->file != task->file) {
 		/* keep a pointer at the file we are going to close for error reporting */
 		struct snapraid_file* report = handle->file;
-		ret = handle_close(handle);
+		ret = handle_release(handle);
 		if (ret == -1) {
 			/* LCOV_EXCL_START */
 			/* This one is really an unexpected error, because we are only reading */
@@ -118,7 +264,10 @@ static void dry_data_reader(struct snapraid_worker* worker, struct snapraid_task
 		return;
 	}
 
-	task->read_size = handle_read(handle, task->file_pos, buffer, state->block_size, log_error, 0);
+	/* read together the next blocks of the file, if they follow in the parity */
+	run = handle->ahead_max > 1 ? fs_par2run_index(disk, blockcur) : 1;
+
+	task->read_size = handle_read_ahead(handle, task->file_pos, run, buffer, state->block_size, log_error, 0);
 	if (task->read_size == -1) {
 		if (errno == EIO) {
 			log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), task->file_pos, strerror(errno));
@@ -166,11 +315,14 @@ static void dry_parity_reader(struct snapraid_worker* worker, struct snapraid_ta
 	task->state = TASK_STATE_DONE;
 }
 
-static int state_dry_process(struct snapraid_state* state, struct snapraid_parity_handle* parity_handle, block_off_t blockstart, block_off_t blockmax)
+/**
+ * Read the specified data and parity disks.
+ *
+ * The profile of each disk read is updated, and the errors are added to the counters.
+ */
+static void state_dry_process(struct snapraid_state* state, struct snapraid_handle* handle, unsigned diskmax, struct snapraid_parity_handle* parity_handle, unsigned levelmax, struct snapraid_dry_profile* data_profile, struct snapraid_dry_profile* parity_profile, block_off_t blockstart, block_off_t blockmax, unsigned* error_count, unsigned* io_error_count)
 {
 	struct snapraid_io io;
-	struct snapraid_handle* handle;
-	unsigned diskmax;
 	block_off_t blockcur;
 	unsigned j;
 	unsigned buffermax;
@@ -183,15 +335,15 @@ static int state_dry_process(struct snapraid_state* state, struct snapraid_parit
 	unsigned l;
 	unsigned* waiting_map;
 	unsigned waiting_mac;
+	uint64_t tick_start;
+	uint64_t tick_elapsed;
 	char esc_buffer[ESC_MAX];
 
-	handle = handle_mapping(state, &diskmax);
-
 	/* we need 1 * data + 2 * parity */
-	buffermax = diskmax + 2 * state->level;
+	buffermax = diskmax + 2 * levelmax;
 
 	/* initialize the io threads */
-	io_init(&io, state, state->opt.io_cache, buffermax, dry_data_reader, handle, diskmax, dry_parity_reader, 0, parity_handle, state->level);
+	io_init(&io, state, state->opt.io_cache, buffermax, dry_data_reader, handle, diskmax, dry_parity_reader, 0, parity_handle, levelmax);
 
 	/* possibly waiting disks */
 	waiting_mac = diskmax > RAID_PARITY_MAX ? diskmax : RAID_PARITY_MAX;
@@ -207,6 +359,8 @@ static int state_dry_process(struct snapraid_state* state, struct snapraid_parit
 	countsize = 0;
 	countpos = 0;
 
+	tick_start = tick();
+
 	/* start all the worker threads */
 	io_start(&io, blockstart, blockmax, &block_is_enabled, 0);
 
@@ -293,13 +447,15 @@ static int state_dry_process(struct snapraid_state* state, struct snapraid_parit
 			}
 
 			countsize += read_size;
+
+			dry_profile_add(&data_profile[diskcur], task, read_size, blockstart, blockmax);
 		}
 
 		/* until now is misc */
 		state_usage_misc(state);
 
 		/* read the parity */
-		for (l = 0; l < state->level; ++l) {
+		for (l = 0; l < levelmax; ++l) {
 			struct snapraid_task* task;
 			unsigned levcur;
 
@@ -343,6 +499,8 @@ static int state_dry_process(struct snapraid_state* state, struct snapraid_parit
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
+
+			dry_profile_add(&parity_profile[levcur], task, state->block_size, blockstart, blockmax);
 		}
 
 		/* count the number of processed block */
@@ -364,6 +522,13 @@ bail:
 	/* stop all the worker threads */
 	io_stop(&io);
 
+	/* all the disks of the pass share the same elapsed time */
+	tick_elapsed = tick() - tick_start;
+	for (j = 0; j < diskmax; ++j)
+		data_profile[j].tick_elapsed += tick_elapsed;
+	for (l = 0; l < levelmax; ++l)
+		parity_profile[l].tick_elapsed += tick_elapsed;
+
 	for (j = 0; j < diskmax; ++j) {
 		struct snapraid_file* file = handle[j].file;
 		struct snapraid_disk* disk = handle[j].disk;
@@ -378,26 +543,11 @@ bail:
 		}
 	}
 
-	if (error || io_error) {
-		msg_status("\n");
-		msg_status("%8u file errors\n", error);
-		msg_status("%8u io errors\n", io_error);
-	} else {
-		msg_status("Everything OK\n");
-	}
-
-	if (error)
-		log_fatal("DANGER! Unexpected errors!\n");
-	if (io_error)
-		log_fatal("DANGER! Unexpected input/output errors!\n");
-
-	free(handle);
 	free(waiting_map);
 	io_done(&io);
 
-	if (error + io_error != 0)
-		return -1;
-	return 0;
+	*error_count += error;
+	*io_error_count += io_error;
 }
 
 void state_dry(struct snapraid_state* state, block_off_t blockstart, block_off_t blockcount)
@@ -405,11 +555,18 @@ void state_dry(struct snapraid_state* state, block_off_t blockstart, block_off_t
 	block_off_t blockmax;
 	int ret;
 	struct snapraid_parity_handle parity_handle[LEV_MAX];
+	struct snapraid_handle* handle;
+	struct snapraid_dry_profile* profile;
+	unsigned diskmax;
 	unsigned error;
+	unsigned io_error;
+	unsigned j;
 	unsigned l;
 
 	msg_progress("Drying...\n");
 
+	state_index(state);
+
 	blockmax = parity_allocated_size(state);
 
 	if (blockstart > blockmax) {
@@ -436,19 +593,66 @@ void state_dry(struct snapraid_state* state, block_off_t blockstart, block_off_t
 		}
 	}
 
+	handle = handle_mapping(state, &diskmax);
+
+	/* the data profiles are followed by the parity ones */
+	profile = malloc_nofail((diskmax + state->level) * sizeof(struct snapraid_dry_profile));
+	memset(profile, 0, (diskmax + state->level) * sizeof(struct snapraid_dry_profile));
+	for (j = 0; j < diskmax; ++j) {
+		if (handle[j].disk) {
+			profile[j].name = handle[j].disk->name;
+			profile[j].histo = &handle[j].disk->histo_io;
+		}
+	}
+	for (l = 0; l < state->level; ++l) {
+		profile[diskmax + l].name = lev_config_name(l);
+		profile[diskmax + l].histo = &state->parity[l].histo_io;
+	}
+
 	error = 0;
+	io_error = 0;
 
 	/* skip degenerated cases of empty parity, or skipping all */
 	if (blockstart < blockmax) {
-		ret = state_dry_process(state, parity_handle, blockstart, blockmax);
-		if (ret == -1) {
-			/* LCOV_EXCL_START */
-			++error;
-			/* continue, as we are already exiting */
-			/* LCOV_EXCL_STOP */
+		if (!state->opt.dry_isolate) {
+			/* read all the disks together, as the other commands do */
+			state_dry_process(state, handle, diskmax, parity_handle, state->level, profile, profile + diskmax, blockstart, blockmax, &error, &io_error);
+		} else {
+			/* read each disk alone, to compare with the speed reading all together */
+			/* exposing the limits of the shared controllers */
+			for (j = 0; j < diskmax; ++j) {
+				if (!handle[j].disk)
+					continue;
+				msg_progress("Reading disk '%s' alone...\n", handle[j].disk->name);
+				state_dry_process(state, handle + j, 1, parity_handle, 0, profile + j, 0, blockstart, blockmax, &error, &io_error);
+			}
+			for (l = 0; l < state->level; ++l) {
+				msg_progress("Reading %s alone...\n", lev_name(l));
+				state_dry_process(state, handle, 0, parity_handle + l, 1, 0, profile + diskmax + l, blockstart, blockmax, &error, &io_error);
+			}
 		}
+
+		state_usage_latency(state);
+
+		dry_profile_print(profile, diskmax + state->level, blockstart, blockmax);
 	}
 
+	if (error || io_error) {
+		msg_status("\n");
+		msg_status("%8u file errors\n", error);
+		msg_status("%8u io errors\n", io_error);
+	} else {
+		msg_status("Everything OK\n");
+	}
+
+	if (error)
+		log_fatal("DANGER! Unexpected errors!\n");
+	if (io_error)
+		log_fatal("DANGER! Unexpected input/output errors!\n");
+
+	handle_unmapping(handle, diskmax);
+	free(profile);
+
 	/* try to close only if opened */
 	for (l = 0; l < state->level; ++l) {
 		ret = parity_close(&parity_handle[l]);
@@ -461,7 +665,7 @@ void state_dry(struct snapraid_state* state, block_off_t blockstart, block_off_t
 	}
 
 	/* abort if required */
-	if (error != 0) {
+	if (error + io_error != 0) {
 		/* LCOV_EXCL_START */
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
@@ -86,10 +86,185 @@ int hash_compare(const void* void_arg, const void* void_data)
 	return memcmp(arg, hash->hash, HASH_MAX);
 }
 
+/**
+ * Key used to select the files that could be duplicated.
+ *
+ * The files are first selected by size, with a zero hash, as files with
+ * a unique size cannot be duplicated, and then by size and hash of the
+ * first block, before computing the hash of the whole file.
+ */
+struct snapraid_dup_key {
+	data_off_t size; /**< Size of the file. */
+	unsigned char hash[HASH_MAX]; /**< Hash of the first block, or zero. */
+};
+
+static int dup_key_compare(const void* void_a, const void* void_b)
+{
+	const struct snapraid_dup_key* a = void_a;
+	const struct snapraid_dup_key* b = void_b;
+
+	if (a->size < b->size)
+		return -1;
+	if (a->size > b->size)
+		return 1;
+
+	return memcmp(a->hash, b->hash, HASH_MAX);
+}
+
+/**
+ * Set the key of the file.
+ * Return 0 if the file cannot be compared.
+ */
+static int dup_key_set(struct snapraid_dup_key* key, struct snapraid_file* file, int with_hash)
+{
+	struct snapraid_block* block;
+
+	/* if empty, skip it */
+	if (file->size == 0)
+		return 0;
+
+	/* if no hash, skip it */
+	block = fs_file2block_get(file, 0);
+	if (!block_has_updated_hash(block))
+		return 0;
+
+	key->size = file->size;
+	memset(key->hash, 0, HASH_MAX);
+	if (with_hash)
+		memcpy(key->hash, block->hash, BLOCK_HASH_SIZE);
+
+	return 1;
+}
+
+/**
+ * Check if the file matches one of the keys in the sorted vector.
+ */
+static int dup_key_match(const struct snapraid_dup_key* map, size_t max, struct snapraid_file* file, int with_hash)
+{
+	struct snapraid_dup_key key;
+
+	if (!dup_key_set(&key, file, with_hash))
+		return 0;
+
+	return bsearch(&key, map, max, sizeof(struct snapraid_dup_key), dup_key_compare) != 0;
+}
+
+/**
+ * Select the keys of the files matching the previous keys, and keep only
+ * the ones present more than one time.
+ * Return the sorted vector of keys, and its size in ::max.
+ */
+static struct snapraid_dup_key* dup_key_select(struct snapraid_state* state, const struct snapraid_dup_key* prev_map, size_t prev_max, int with_hash, size_t* max)
+{
+	struct snapraid_dup_key* map;
+	size_t count;
+	size_t i, j, k;
+	tommy_node* node;
+
+	/* count the files to insert */
+	count = 0;
+	for (node = state->disklist; node != 0; node = node->next) {
+		struct snapraid_disk* disk = node->data;
+		tommy_node* n;
+
+		for (n = disk->filelist; n != 0; n = n->next) {
+			struct snapraid_file* file = n->data;
+			struct snapraid_dup_key key;
+
+			if (!dup_key_set(&key, file, with_hash))
+				continue;
+			if (prev_map && !dup_key_match(prev_map, prev_max, file, 0))
+				continue;
+
+			++count;
+		}
+	}
+
+	map = malloc_nofail((count + 1) * sizeof(struct snapraid_dup_key));
+
+	count = 0;
+	for (node = state->disklist; node != 0; node = node->next) {
+		struct snapraid_disk* disk = node->data;
+		tommy_node* n;
+
+		for (n = disk->filelist; n != 0; n = n->next) {
+			struct snapraid_file* file = n->data;
+
+			if (!dup_key_set(&map[count], file, with_hash))
+				continue;
+			if (prev_map && !dup_key_match(prev_map, prev_max, file, 0))
+				continue;
+
+			++count;
+		}
+	}
+
+	qsort(map, count, sizeof(struct snapraid_dup_key), dup_key_compare);
+
+	/* keep only the repeated keys */
+	k = 0;
+	for (i = 0; i < count; i = j) {
+		j = i + 1;
+		while (j < count && dup_key_compare(&map[i], &map[j]) == 0)
+			++j;
+		if (j - i >= 2)
+			map[k++] = map[i];
+	}
+
+	*max = k;
+	return map;
+}
+
+/**
+ * Hashes of the candidate files of a disk.
+ */
+struct snapraid_dup_disk {
+	struct snapraid_state* state;
+	struct snapraid_disk* disk;
+	const struct snapraid_dup_key* key_map; /**< Keys of the candidate files. */
+	size_t key_max;
+	struct snapraid_hash** hash_map; /**< Hashes of the candidate files, in the order of the file list. */
+	unsigned hash_max;
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+/**
+ * Compute the hashes of the candidate files of a disk.
+ */
+static void* dup_disk_thread(void* arg)
+{
+	struct snapraid_dup_disk* dup_disk = arg;
+	tommy_node* node;
+
+	dup_disk->hash_max = 0;
+	dup_disk->hash_map = malloc_nofail(tommy_list_count(&dup_disk->disk->filelist) * sizeof(struct snapraid_hash*));
+
+	for (node = dup_disk->disk->filelist; node != 0; node = node->next) {
+		struct snapraid_file* file = node->data;
+
+		if (!dup_key_match(dup_disk->key_map, dup_disk->key_max, file, 1))
+			continue;
+
+		/* it could be 0 if some hash is missing */
+		dup_disk->hash_map[dup_disk->hash_max++] = hash_alloc(dup_disk->state, dup_disk->disk, file);
+	}
+
+	return 0;
+}
+
 void state_dup(struct snapraid_state* state)
 {
 	tommy_hashdyn hashset;
 	tommy_node* i;
+	struct snapraid_dup_key* size_map;
+	struct snapraid_dup_key* first_map;
+	size_t size_max;
+	size_t first_max;
+	struct snapraid_dup_disk* dup_map;
+	unsigned diskmax;
+	unsigned d;
 	unsigned count;
 	data_off_t size;
 	char esc_buffer[ESC_MAX];
@@ -102,27 +277,50 @@ void state_dup(struct snapraid_state* state)
 
 	msg_progress("Comparing...\n");
 
+	/* select the files with a repeated size */
+	size_map = dup_key_select(state, 0, 0, 0, &size_max);
+
+	/* of them, select the files with a repeated size and hash of the first block */
+	first_map = dup_key_select(state, size_map, size_max, 1, &first_max);
+
+	free(size_map);
+
+	/* compute the hash of the whole files in parallel for each disk */
+	diskmax = tommy_list_count(&state->disklist);
+	dup_map = malloc_nofail(diskmax * sizeof(struct snapraid_dup_disk));
+	for (i = state->disklist, d = 0; i != 0; i = i->next, ++d) {
+		dup_map[d].state = state;
+		dup_map[d].disk = i->data;
+		dup_map[d].key_map = first_map;
+		dup_map[d].key_max = first_max;
+#if HAVE_PTHREAD
+		thread_create(&dup_map[d].thread, 0, dup_disk_thread, &dup_map[d]);
+#else
+		dup_disk_thread(&dup_map[d]);
+#endif
+	}
+
+#if HAVE_PTHREAD
+	for (d = 0; d < diskmax; ++d)
+		thread_join(dup_map[d].thread, 0);
+#endif
+
 	/* for each disk */
-	for (i = state->disklist; i != 0; i = i->next) {
-		tommy_node* j;
+	for (i = state->disklist, d = 0; i != 0; i = i->next, ++d) {
 		struct snapraid_disk* disk = i->data;
+		unsigned k;
 
-		/* for each file */
-		for (j = disk->filelist; j != 0; j = j->next) {
-			struct snapraid_file* file = j->data;
-			struct snapraid_hash* hash;
+		/* for each candidate file, in the same order of the file list */
+		for (k = 0; k < dup_map[d].hash_max; ++k) {
+			struct snapraid_hash* hash = dup_map[d].hash_map[k];
+			struct snapraid_file* file;
 			tommy_hash_t hash32;
 
-			/* if empty, skip it */
-			if (file->size == 0)
-				continue;
-
-			hash = hash_alloc(state, disk, file);
-
 			/* if no hash, skip it */
 			if (!hash)
 				continue;
 
+			file = hash->file;
 			hash32 = hash_hash(hash);
 
 			struct snapraid_hash* found = tommy_hashdyn_search(&hashset, hash_compare, hash->hash, hash32);
@@ -136,8 +334,13 @@ void state_dup(struct snapraid_state* state)
 				tommy_hashdyn_insert(&hashset, &hash->node, hash, hash32);
 			}
 		}
+
+		free(dup_map[d].hash_map);
 	}
 
+	free(dup_map);
+	free(first_map);
+
 	tommy_hashdyn_foreach(&hashset, (tommy_foreach_func*)hash_free);
 	tommy_hashdyn_done(&hashset);
 
@@ -26,6 +26,8 @@
 
 int BLOCK_HASH_SIZE = HASH_MAX;
 
+int BLOCK_HASH_STORED = 1;
+
 struct snapraid_content* content_alloc(const char* path, uint64_t dev)
 {
 	struct snapraid_content* content;
@@ -42,6 +44,114 @@ void content_free(struct snapraid_content* content)
 	free(content);
 }
 
+/**
+ * Check if a char has a special meaning for fnmatch().
+ */
+static int filter_is_special(char c)
+{
+	return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+/**
+ * Select how to match the pattern.
+ *
+ * This is done once at the allocation, to avoid to call fnmatch()
+ * in the common cases of patterns without wildcards, or with a single
+ * one at the start or at the end, like "*.tmp" and "/backup".
+ */
+static void filter_compile(struct snapraid_filter* filter)
+{
+	const char* pattern = filter->pattern;
+	size_t len;
+	size_t i;
+	unsigned special;
+
+	/* path patterns are matched without the initial slash */
+	if (filter->is_path)
+		++pattern;
+
+	len = strlen(pattern);
+
+	special = 0;
+	for (i = 0; i < len; ++i)
+		if (filter_is_special(pattern[i]))
+			++special;
+
+	filter->match = FILTER_MATCH_FNMATCH;
+	filter->literal = pattern;
+	filter->literal_len = len;
+
+	if (special == 0) {
+		filter->match = FILTER_MATCH_LITERAL;
+	} else if (special == 1 && len > 0 && pattern[len - 1] == '*') {
+		filter->match = FILTER_MATCH_PREFIX;
+		filter->literal_len = len - 1;
+	} else if (special == 1 && pattern[0] == '*') {
+		filter->match = FILTER_MATCH_SUFFIX;
+		filter->literal = pattern + 1;
+		filter->literal_len = len - 1;
+	}
+}
+
+/**
+ * Compare two strings like the pattern matching does.
+ */
+static int filter_compare(const char* a, const char* b, size_t len)
+{
+#ifdef _WIN32
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+			return 1;
+
+	return 0;
+#else
+	return memcmp(a, b, len);
+#endif
+}
+
+/**
+ * Match a pattern.
+ * Return 0 on match, like fnmatch().
+ */
+static int filter_match(struct snapraid_filter* filter, const char* text, int flags)
+{
+	size_t len;
+	const char* wild;
+	size_t wild_len;
+
+	if (filter->match == FILTER_MATCH_FNMATCH)
+		return fnmatch(filter->literal, text, flags);
+
+	len = strlen(text);
+
+	switch (filter->match) {
+	case FILTER_MATCH_LITERAL :
+		if (len != filter->literal_len)
+			return 1;
+		return filter_compare(text, filter->literal, len);
+	case FILTER_MATCH_PREFIX :
+		if (len < filter->literal_len || filter_compare(text, filter->literal, filter->literal_len) != 0)
+			return 1;
+		wild = text + filter->literal_len;
+		wild_len = len - filter->literal_len;
+		break;
+	default : /* FILTER_MATCH_SUFFIX */
+		if (len < filter->literal_len || filter_compare(text + len - filter->literal_len, filter->literal, filter->literal_len) != 0)
+			return 1;
+		wild = text;
+		wild_len = len - filter->literal_len;
+		break;
+	}
+
+	/* with FNM_PATHNAME the '*' doesn't match the slash */
+	if ((flags & FNM_PATHNAME) != 0 && memchr(wild, '/', wild_len) != 0)
+		return 1;
+
+	return 0;
+}
+
 struct snapraid_filter* filter_alloc_file(int direction, const char* pattern)
 {
 	struct snapraid_filter* filter;
@@ -118,6 +228,8 @@ struct snapraid_filter* filter_alloc_file(int direction, const char* pattern)
 		}
 	}
 
+	filter_compile(filter);
+
 	return filter;
 }
 
@@ -142,6 +254,8 @@ struct snapraid_filter* filter_alloc_disk(int direction, const char* pattern)
 		/* LCOV_EXCL_STOP */
 	}
 
+	filter_compile(filter);
+
 	return filter;
 }
 
@@ -180,11 +294,11 @@ static int filter_apply(struct snapraid_filter* filter, struct snapraid_filter**
 		return 0;
 
 	if (filter->is_path) {
-		/* skip initial slash, as always missing from the path */
-		if (fnmatch(filter->pattern + 1, path, FNM_PATHNAME | FNM_CASEINSENSITIVE_FOR_WIN) == 0)
+		/* the initial slash is already skipped by filter_compile(), as always missing from the path */
+		if (filter_match(filter, path, FNM_PATHNAME | FNM_CASEINSENSITIVE_FOR_WIN) == 0)
 			ret = filter->direction;
 	} else {
-		if (fnmatch(filter->pattern, name, FNM_CASEINSENSITIVE_FOR_WIN) == 0)
+		if (filter_match(filter, name, FNM_CASEINSENSITIVE_FOR_WIN) == 0)
 			ret = filter->direction;
 	}
 
@@ -194,14 +308,16 @@ static int filter_apply(struct snapraid_filter* filter, struct snapraid_filter**
 	return ret;
 }
 
-static int filter_recurse(struct snapraid_filter* filter, struct snapraid_filter** reason, const char* const_path, int is_dir)
+/**
+ * Apply a filter to all the elements of the path.
+ *
+ * The path is temporarily modified, but it's restored before returning.
+ */
+static int filter_recurse(struct snapraid_filter* filter, struct snapraid_filter** reason, char* path, int is_dir)
 {
-	char path[PATH_MAX];
 	char* name;
 	unsigned i;
 
-	pathcpy(path, sizeof(path), const_path);
-
 	/* filter for all the directories */
 	name = path;
 	for (i = 0; path[i] != 0; ++i) {
@@ -210,8 +326,10 @@ static int filter_recurse(struct snapraid_filter* filter, struct snapraid_filter
 			path[i] = 0;
 
 			/* filter the directory */
-			if (filter_apply(filter, reason, path, name, 1) != 0)
+			if (filter_apply(filter, reason, path, name, 1) != 0) {
+				path[i] = '/';
 				return filter->direction;
+			}
 
 			/* restore the slash */
 			path[i] = '/';
@@ -231,23 +349,29 @@ static int filter_recurse(struct snapraid_filter* filter, struct snapraid_filter
 static int filter_element(tommy_list* filterlist, struct snapraid_filter** reason, const char* disk, const char* sub, int is_dir, int is_def_include)
 {
 	tommy_node* i;
+	char path[PATH_MAX];
 
 	int direction = 1; /* by default include all */
 
+	/* copy the path only once for all the filters */
+	/* note that it's missing if there are only disk filters */
+	if (sub)
+		pathcpy(path, sizeof(path), sub);
+
 	/* for each filter */
 	for (i = tommy_list_head(filterlist); i != 0; i = i->next) {
 		int ret;
 		struct snapraid_filter* filter = i->data;
 
 		if (filter->is_disk) {
-			if (fnmatch(filter->pattern, disk, FNM_CASEINSENSITIVE_FOR_WIN) == 0)
+			if (filter_match(filter, disk, FNM_CASEINSENSITIVE_FOR_WIN) == 0)
 				ret = filter->direction;
 			else
 				ret = 0;
 			if (reason != 0 && ret < 0)
 				*reason = filter;
 		} else {
-			ret = filter_recurse(filter, reason, sub, is_dir);
+			ret = filter_recurse(filter, reason, path, is_dir);
 		}
 
 		if (ret > 0) {
@@ -317,7 +441,7 @@ int filter_existence(int filter_missing, const char* dir, const char* sub)
 	return 1;
 }
 
-int filter_correctness(int filter_error, tommy_arrayblkof* infoarr, struct snapraid_disk* disk, struct snapraid_file* file)
+int filter_correctness(int filter_error, struct snapraid_infoarr* infoarr, struct snapraid_disk* disk, struct snapraid_file* file)
 {
 	unsigned i;
 
@@ -358,43 +482,83 @@ int filter_content(tommy_list* contentlist, const char* path)
 		pathprint(tmp, sizeof(tmp), "%s.lock", content->content);
 		if (pathcmp(tmp, path) == 0)
 			return -1;
+
+		/* exclude also the ".journal" file */
+		pathprint(tmp, sizeof(tmp), "%s.journal", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+
+		/* exclude also the ".import" cache, and its ".tmp" copy */
+		pathprint(tmp, sizeof(tmp), "%s.import", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+		pathprint(tmp, sizeof(tmp), "%s.import.tmp", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+
+		/* exclude also the ".pool" state, and its ".tmp" copy */
+		pathprint(tmp, sizeof(tmp), "%s.pool", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+		pathprint(tmp, sizeof(tmp), "%s.pool.tmp", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+
+		/* exclude also the ".smart" cache, and its ".tmp" copy */
+		pathprint(tmp, sizeof(tmp), "%s.smart", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+		pathprint(tmp, sizeof(tmp), "%s.smart.tmp", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+
+		/* exclude also the ".status" summary, and its ".tmp" copy */
+		pathprint(tmp, sizeof(tmp), "%s.status", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
+		pathprint(tmp, sizeof(tmp), "%s.status.tmp", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
 	}
 
 	return 0;
 }
 
-struct snapraid_file* file_alloc(unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical)
+struct snapraid_file* file_alloc(struct snapraid_arena* arena, unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical)
 {
 	struct snapraid_file* file;
+	block_off_t blockmax;
 	block_off_t i;
 
-	file = malloc_nofail(sizeof(struct snapraid_file));
-	file->sub = strdup_nofail(sub);
+	/* allocate the blocks together with the file */
+	blockmax = (size + block_size - 1) / block_size;
+	file = arena_alloc(arena, file_sizeof(blockmax));
+	file->sub = arena_strdup(arena, sub);
 	file->size = size;
-	file->blockmax = (size + block_size - 1) / block_size;
+	file->blockmax = blockmax;
 	file->mtime_sec = mtime_sec;
 	file->mtime_nsec = mtime_nsec;
 	file->inode = inode;
 	file->physical = physical;
 	file->flag = 0;
-	file->blockvec = malloc_nofail(file->blockmax * block_sizeof());
 
 	for (i = 0; i < file->blockmax; ++i) {
 		struct snapraid_block* block = file_block(file, i);
 		block_state_set(block, BLOCK_STATE_CHG);
-		hash_invalid_set(block->hash);
+		if (BLOCK_HASH_STORED)
+			hash_invalid_set(block->hash);
 	}
 
 	return file;
 }
 
-struct snapraid_file* file_dup(struct snapraid_file* copy)
+struct snapraid_file* file_dup(struct snapraid_arena* arena, struct snapraid_file* copy)
 {
 	struct snapraid_file* file;
 	block_off_t i;
 
-	file = malloc_nofail(sizeof(struct snapraid_file));
-	file->sub = strdup_nofail(copy->sub);
+	file = arena_alloc(arena, file_sizeof(copy->blockmax));
+	file->sub = arena_strdup(arena, copy->sub);
 	file->size = copy->size;
 	file->blockmax = copy->blockmax;
 	file->mtime_sec = copy->mtime_sec;
@@ -402,31 +566,29 @@ struct snapraid_file* file_dup(struct snapraid_file* copy)
 	file->inode = copy->inode;
 	file->physical = copy->physical;
 	file->flag = copy->flag;
-	file->blockvec = malloc_nofail(file->blockmax * block_sizeof());
 
 	for (i = 0; i < file->blockmax; ++i) {
 		struct snapraid_block* block = file_block(file, i);
 		struct snapraid_block* copy_block = file_block(copy, i);
 		block->state = copy_block->state;
-		memcpy(block->hash, copy_block->hash, BLOCK_HASH_SIZE);
+		if (BLOCK_HASH_STORED)
+			memcpy(block->hash, copy_block->hash, BLOCK_HASH_SIZE);
 	}
 
 	return file;
 }
 
-void file_free(struct snapraid_file* file)
+void file_free(struct snapraid_arena* arena, struct snapraid_file* file)
 {
-	free(file->sub);
+	arena_strfree(arena, file->sub);
 	file->sub = 0;
-	free(file->blockvec);
-	file->blockvec = 0;
-	free(file);
+	arena_free(arena, file, file_sizeof(file->blockmax));
 }
 
-void file_rename(struct snapraid_file* file, const char* sub)
+void file_rename(struct snapraid_arena* arena, struct snapraid_file* file, const char* sub)
 {
-	free(file->sub);
-	file->sub = strdup_nofail(sub);
+	arena_strfree(arena, file->sub);
+	file->sub = arena_strdup(arena, sub);
 }
 
 void file_copy(struct snapraid_file* src_file, struct snapraid_file* dst_file)
@@ -614,7 +776,7 @@ int file_pathstamp_compare(const void* void_a, const void* void_b)
 	return file_stamp_compare(void_a, void_b);
 }
 
-struct snapraid_extent* extent_alloc(block_off_t parity_pos, struct snapraid_file* file, block_off_t file_pos, block_off_t count)
+struct snapraid_extent* extent_alloc(struct snapraid_arena* arena, block_off_t parity_pos, struct snapraid_file* file, block_off_t file_pos, block_off_t count)
 {
 	struct snapraid_extent* extent;
 
@@ -631,7 +793,7 @@ struct snapraid_extent* extent_alloc(block_off_t parity_pos, struct snapraid_fil
 		/* LCOV_EXCL_STOP */
 	}
 
-	extent = malloc_nofail(sizeof(struct snapraid_extent));
+	extent = arena_alloc(arena, sizeof(struct snapraid_extent));
 	extent->parity_pos = parity_pos;
 	extent->file = file;
 	extent->file_pos = file_pos;
@@ -640,9 +802,9 @@ struct snapraid_extent* extent_alloc(block_off_t parity_pos, struct snapraid_fil
 	return extent;
 }
 
-void extent_free(struct snapraid_extent* extent)
+void extent_free(struct snapraid_arena* arena, struct snapraid_extent* extent)
 {
-	free(extent);
+	arena_free(arena, extent, sizeof(struct snapraid_extent));
 }
 
 int extent_parity_compare(const void* void_a, const void* void_b)
@@ -676,23 +838,29 @@ int extent_file_compare(const void* void_a, const void* void_b)
 	return 0;
 }
 
-struct snapraid_link* link_alloc(const char* sub, const char* linkto, unsigned link_flag)
+struct snapraid_link* link_alloc(struct snapraid_arena* arena, const char* sub, const char* linkto, unsigned link_flag)
 {
 	struct snapraid_link* slink;
 
-	slink = malloc_nofail(sizeof(struct snapraid_link));
-	slink->sub = strdup_nofail(sub);
-	slink->linkto = strdup_nofail(linkto);
+	slink = arena_alloc(arena, sizeof(struct snapraid_link));
+	slink->sub = arena_strdup(arena, sub);
+	slink->linkto = arena_strdup(arena, linkto);
 	slink->flag = link_flag;
 
 	return slink;
 }
 
-void link_free(struct snapraid_link* slink)
+void link_free(struct snapraid_arena* arena, struct snapraid_link* slink)
 {
-	free(slink->sub);
-	free(slink->linkto);
-	free(slink);
+	arena_strfree(arena, slink->sub);
+	arena_strfree(arena, slink->linkto);
+	arena_free(arena, slink, sizeof(struct snapraid_link));
+}
+
+void link_relink(struct snapraid_arena* arena, struct snapraid_link* slink, const char* linkto)
+{
+	arena_strfree(arena, slink->linkto);
+	slink->linkto = arena_strdup(arena, linkto);
 }
 
 int link_name_compare_to_arg(const void* void_arg, const void* void_data)
@@ -711,21 +879,21 @@ int link_alpha_compare(const void* void_a, const void* void_b)
 	return strcmp(slink_a->sub, slink_b->sub);
 }
 
-struct snapraid_dir* dir_alloc(const char* sub)
+struct snapraid_dir* dir_alloc(struct snapraid_arena* arena, const char* sub)
 {
 	struct snapraid_dir* dir;
 
-	dir = malloc_nofail(sizeof(struct snapraid_dir));
-	dir->sub = strdup_nofail(sub);
+	dir = arena_alloc(arena, sizeof(struct snapraid_dir));
+	dir->sub = arena_strdup(arena, sub);
 	dir->flag = 0;
 
 	return dir;
 }
 
-void dir_free(struct snapraid_dir* dir)
+void dir_free(struct snapraid_arena* arena, struct snapraid_dir* dir)
 {
-	free(dir->sub);
-	free(dir);
+	arena_strfree(arena, dir->sub);
+	arena_free(arena, dir, sizeof(struct snapraid_dir));
 }
 
 int dir_name_compare(const void* void_arg, const void* void_data)
@@ -736,6 +904,34 @@ int dir_name_compare(const void* void_arg, const void* void_data)
 	return strcmp(arg, dir->sub);
 }
 
+struct snapraid_dirstamp* dirstamp_alloc(const char* sub, uint64_t inode, int64_t mtime_sec, int mtime_nsec)
+{
+	struct snapraid_dirstamp* dirstamp;
+
+	dirstamp = malloc_nofail(sizeof(struct snapraid_dirstamp));
+	dirstamp->sub = strdup_nofail(sub);
+	dirstamp->flag = 0;
+	dirstamp->inode = inode;
+	dirstamp->mtime_sec = mtime_sec;
+	dirstamp->mtime_nsec = mtime_nsec;
+
+	return dirstamp;
+}
+
+void dirstamp_free(struct snapraid_dirstamp* dirstamp)
+{
+	free(dirstamp->sub);
+	free(dirstamp);
+}
+
+int dirstamp_name_compare(const void* void_arg, const void* void_data)
+{
+	const char* arg = void_arg;
+	const struct snapraid_dirstamp* dirstamp = void_data;
+
+	return strcmp(arg, dirstamp->sub);
+}
+
 struct snapraid_disk* disk_alloc(const char* name, const char* dir, uint64_t dev, const char* uuid, int skip)
 {
 	struct snapraid_disk* disk;
@@ -752,9 +948,18 @@ struct snapraid_disk* disk_alloc(const char* name, const char* dir, uint64_t dev
 	thread_mutex_init(&disk->fs_mutex, 0);
 #endif
 
+	arena_init(&disk->arena);
+	arena_init(&disk->fs_arena);
+
+	disk->fs_index_pos = 0;
+	disk->fs_index_entry = 0;
+	disk->fs_index_count = 0;
+
 	disk->smartctl[0] = 0;
 	disk->device = dev;
 	disk->tick = 0;
+	histo_init(&disk->histo_io);
+	histo_init(&disk->histo_wait);
 	disk->cached_blocks = 0;
 	disk->progress_file = 0;
 	disk->total_blocks = 0;
@@ -768,15 +973,22 @@ struct snapraid_disk* disk_alloc(const char* name, const char* dir, uint64_t dev
 	disk->had_empty_uuid = 0;
 	disk->mapping_idx = -1;
 	disk->skip_access = skip;
+	disk->journal_id = 0;
+	disk->journal_pos = 0;
+	disk->journal_filter = 0;
 	tommy_list_init(&disk->filelist);
 	tommy_list_init(&disk->deletedlist);
 	tommy_hashdyn_init(&disk->inodeset);
-	tommy_hashdyn_init(&disk->pathset);
 	tommy_hashdyn_init(&disk->stampset);
+	disk->has_fileset = 0;
+	tommy_hashdyn_init(&disk->pathset);
 	tommy_list_init(&disk->linklist);
 	tommy_hashdyn_init(&disk->linkset);
 	tommy_list_init(&disk->dirlist);
 	tommy_hashdyn_init(&disk->dirset);
+	tommy_list_init(&disk->dirstamplist);
+	tommy_hashdyn_init(&disk->dirstampset);
+	disk->dirstamp_filter = 0;
 	tommy_tree_init(&disk->fs_parity, extent_parity_compare);
 	tommy_tree_init(&disk->fs_file, extent_file_compare);
 	disk->fs_last = 0;
@@ -786,24 +998,50 @@ struct snapraid_disk* disk_alloc(const char* name, const char* dir, uint64_t dev
 
 void disk_free(struct snapraid_disk* disk)
 {
-	tommy_list_foreach(&disk->filelist, (tommy_foreach_func*)file_free);
-	tommy_list_foreach(&disk->deletedlist, (tommy_foreach_func*)file_free);
-	tommy_tree_foreach(&disk->fs_file, (tommy_foreach_func*)extent_free);
 	tommy_hashdyn_done(&disk->inodeset);
 	tommy_hashdyn_done(&disk->pathset);
 	tommy_hashdyn_done(&disk->stampset);
-	tommy_list_foreach(&disk->linklist, (tommy_foreach_func*)link_free);
 	tommy_hashdyn_done(&disk->linkset);
-	tommy_list_foreach(&disk->dirlist, (tommy_foreach_func*)dir_free);
 	tommy_hashdyn_done(&disk->dirset);
+	tommy_list_foreach(&disk->dirstamplist, (tommy_foreach_func*)dirstamp_free);
+	tommy_hashdyn_done(&disk->dirstampset);
 
 #if HAVE_PTHREAD
 	thread_mutex_destroy(&disk->fs_mutex);
 #endif
 
+	free(disk->fs_index_pos);
+	free(disk->fs_index_entry);
+
+	/* release all the files, extents, links and dirs */
+	arena_done(&disk->arena);
+	arena_done(&disk->fs_arena);
+
 	free(disk);
 }
 
+void disk_fileset_build(struct snapraid_disk* disk)
+{
+	tommy_node* i;
+
+	if (disk->has_fileset)
+		return;
+
+	tommy_hashdyn_reserve(&disk->inodeset, tommy_hashdyn_count(&disk->pathset));
+	tommy_hashdyn_reserve(&disk->stampset, tommy_hashdyn_count(&disk->pathset));
+
+	/* insert in the same order of the file list */
+	for (i = tommy_list_head(&disk->filelist); i != 0; i = i->next) {
+		struct snapraid_file* file = i->data;
+
+		if (!file_flag_has(file, FILE_IS_WITHOUT_INODE))
+			tommy_hashdyn_insert(&disk->inodeset, &file->nodeset, file, file_inode_hash(file->inode));
+		tommy_hashdyn_insert(&disk->stampset, &file->stampset, file, file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec));
+	}
+
+	disk->has_fileset = 1;
+}
+
 static inline void fs_lock(struct snapraid_disk* disk)
 {
 #if HAVE_PTHREAD
@@ -1112,6 +1350,175 @@ static int extent_parity_inside_compare_unlock(const void* void_a, const void* v
 	return 0;
 }
 
+/**
+ * Release the index of the extents, and the extents removed while using it.
+ */
+static void fs_index_drop_unlock(struct snapraid_disk* disk)
+{
+	tommy_size_t i;
+
+	if (!disk->fs_index_pos)
+		return;
+
+	for (i = 0; i < disk->fs_index_count; ++i) {
+		if (disk->fs_index_entry[i].extent->count == 0)
+			extent_free(&disk->fs_arena, disk->fs_index_entry[i].extent);
+	}
+
+	free(disk->fs_index_pos);
+	free(disk->fs_index_entry);
+	disk->fs_index_pos = 0;
+	disk->fs_index_entry = 0;
+	disk->fs_index_count = 0;
+}
+
+static void fs_index_insert_foreach_unlock(void* void_arg, void* void_obj)
+{
+	struct snapraid_disk* disk = void_arg;
+	struct snapraid_extent* extent = void_obj;
+
+	struct snapraid_index_entry* entry = &disk->fs_index_entry[disk->fs_index_count];
+
+	disk->fs_index_pos[disk->fs_index_count] = extent->parity_pos;
+	entry->extent = extent;
+	entry->file = extent->file;
+	entry->file_pos = extent->file_pos;
+	entry->count = extent->count;
+	++disk->fs_index_count;
+}
+
+/**
+ * Search the entry at the specified parity position in the index.
+ *
+ * It doesn't check if the position is inside the extent.
+ * It reads only data that never changes, and then it doesn't need the lock.
+ */
+static inline struct snapraid_index_entry* fs_index_search(struct snapraid_disk* disk, block_off_t parity_pos)
+{
+	const block_off_t* base = disk->fs_index_pos;
+	tommy_size_t n = disk->fs_index_count;
+
+	if (n == 0 || parity_pos < base[0])
+		return 0;
+
+	/* search the last extent starting before the position, without branches */
+	while (n > 1) {
+		tommy_size_t half = n / 2;
+		base = base[half] <= parity_pos ? base + half : base;
+		n -= half;
+	}
+
+	return &disk->fs_index_entry[base - disk->fs_index_pos];
+}
+
+/**
+ * Search the extent at the specified parity position in the index.
+ * \return If not found return 0
+ */
+static inline struct snapraid_extent* fs_index_search_unlock(struct snapraid_disk* disk, block_off_t parity_pos)
+{
+	struct snapraid_index_entry* entry;
+	struct snapraid_extent* extent;
+	struct extent_parity_inside arg = { parity_pos };
+
+	entry = fs_index_search(disk, parity_pos);
+	if (!entry || parity_pos >= disk->fs_index_pos[entry - disk->fs_index_entry] + entry->count) {
+		/* the position was not used when the index was built */
+		return 0;
+	}
+
+	/* the extent may be shrunk or removed after building the index */
+	extent = entry->extent;
+	if (parity_pos >= extent->parity_pos && parity_pos < extent->parity_pos + extent->count)
+		return extent;
+
+	/* the position may be in the second part of a split extent */
+	return tommy_tree_search_compare(&disk->fs_parity, extent_parity_inside_compare_unlock, &arg);
+}
+
+void fs_index_build(struct snapraid_disk* disk)
+{
+	tommy_size_t count;
+
+	fs_lock(disk);
+
+	fs_index_drop_unlock(disk);
+
+	count = tommy_tree_count(&disk->fs_parity);
+
+	/* allocate at least one element to mark the index as built */
+	disk->fs_index_pos = malloc_nofail((count + 1) * sizeof(block_off_t));
+	disk->fs_index_entry = malloc_nofail((count + 1) * sizeof(struct snapraid_index_entry));
+	disk->fs_index_count = 0;
+
+	tommy_tree_foreach_arg(&disk->fs_parity, fs_index_insert_foreach_unlock, disk);
+
+	fs_unlock(disk);
+}
+
+struct fs_map_arg {
+	block_off_t blockmax;
+	unsigned char* map;
+};
+
+static void fs_invalid_map_foreach_unlock(void* void_arg, void* void_obj)
+{
+	struct fs_map_arg* arg = void_arg;
+	struct snapraid_extent* extent = void_obj;
+	block_off_t i;
+
+	for (i = 0; i < extent->count; ++i) {
+		block_off_t parity_pos = extent->parity_pos + i;
+
+		if (parity_pos >= arg->blockmax)
+			break;
+
+		if (block_has_invalid_parity(file_block(extent->file, extent->file_pos + i)))
+			arg->map[parity_pos / 8] |= 1 << (parity_pos % 8);
+	}
+}
+
+void fs_invalid_map(struct snapraid_disk* disk, block_off_t blockmax, unsigned char* map)
+{
+	struct fs_map_arg arg = { blockmax, map };
+
+	fs_lock(disk);
+
+	tommy_tree_foreach_arg(&disk->fs_parity, fs_invalid_map_foreach_unlock, &arg);
+
+	fs_unlock(disk);
+}
+
+static void fs_included_map_foreach_unlock(void* void_arg, void* void_obj)
+{
+	struct fs_map_arg* arg = void_arg;
+	struct snapraid_extent* extent = void_obj;
+	block_off_t i;
+
+	if (file_flag_has(extent->file, FILE_IS_EXCLUDED))
+		return;
+
+	for (i = 0; i < extent->count; ++i) {
+		block_off_t parity_pos = extent->parity_pos + i;
+
+		if (parity_pos >= arg->blockmax)
+			break;
+
+		arg->map[parity_pos / 8] |= 1 << (parity_pos % 8);
+	}
+}
+
+void fs_included_map(struct snapraid_disk* disk, block_off_t blockmax, unsigned char* map)
+{
+	struct fs_map_arg arg = { blockmax, map };
+
+	fs_lock(disk);
+
+	tommy_tree_foreach_arg(&disk->fs_parity, fs_included_map_foreach_unlock, &arg);
+
+	fs_unlock(disk);
+}
+
 /**
  * Search the extent at the specified parity position.
  * The search is optimized for sequential accesses.
@@ -1127,6 +1534,8 @@ static struct snapraid_extent* fs_par2extent_get_unlock(struct snapraid_disk* di
 		&& parity_pos < (*fs_last)->parity_pos + (*fs_last)->count
 	) {
 		extent = *fs_last;
+	} else if (disk->fs_index_pos) {
+		extent = fs_index_search_unlock(disk, parity_pos);
 	} else {
 		struct extent_parity_inside arg = { parity_pos };
 		extent = tommy_tree_search_compare(&disk->fs_parity, extent_parity_inside_compare_unlock, &arg);
@@ -1220,6 +1629,62 @@ struct snapraid_file* fs_par2file_find(struct snapraid_disk* disk, block_off_t p
 	return file;
 }
 
+struct snapraid_file* fs_par2file_find_index(struct snapraid_disk* disk, block_off_t parity_pos, block_off_t* file_pos)
+{
+	struct snapraid_index_entry* entry;
+	block_off_t start;
+
+	if (!disk->fs_index_pos)
+		return fs_par2file_find(disk, parity_pos, file_pos);
+
+	/* use only the copy of the extent, as the extent may change concurrently */
+	entry = fs_index_search(disk, parity_pos);
+	if (!entry)
+		return 0;
+
+	start = disk->fs_index_pos[entry - disk->fs_index_entry];
+	if (parity_pos >= start + entry->count)
+		return 0;
+
+	if (file_pos)
+		*file_pos = entry->file_pos + (parity_pos - start);
+
+	return entry->file;
+}
+
+block_off_t fs_par2run_index(struct snapraid_disk* disk, block_off_t parity_pos)
+{
+	struct snapraid_extent* extent;
+	block_off_t run;
+
+	if (disk->fs_index_pos) {
+		struct snapraid_index_entry* entry;
+		block_off_t start;
+
+		/* use only the copy of the extent, as the extent may change concurrently */
+		entry = fs_index_search(disk, parity_pos);
+		if (!entry)
+			return 0;
+
+		start = disk->fs_index_pos[entry - disk->fs_index_entry];
+		if (parity_pos >= start + entry->count)
+			return 0;
+
+		return start + entry->count - parity_pos;
+	}
+
+	fs_lock(disk);
+
+	extent = fs_par2extent_get_unlock(disk, &disk->fs_last, parity_pos);
+
+	run = 0;
+	if (extent)
+		run = extent->parity_pos + extent->count - parity_pos;
+
+	fs_unlock(disk);
+	return run;
+}
+
 block_off_t fs_file2par_find(struct snapraid_disk* disk, struct snapraid_file* file, block_off_t file_pos)
 {
 	struct snapraid_extent* extent;
@@ -1247,6 +1712,9 @@ void fs_allocate(struct snapraid_disk* disk, block_off_t parity_pos, struct snap
 
 	fs_lock(disk);
 
+	/* the index cannot represent the new allocation */
+	fs_index_drop_unlock(disk);
+
 	if (file_pos > 0) {
 		/* search an existing extent for the previous file_pos */
 		extent = fs_file2extent_get_unlock(disk, &disk->fs_last, file, file_pos - 1);
@@ -1269,7 +1737,7 @@ void fs_allocate(struct snapraid_disk* disk, block_off_t parity_pos, struct snap
 	}
 
 	/* a extent doesn't exist, and we have to create a new one */
-	extent = extent_alloc(parity_pos, file, file_pos, 1);
+	extent = extent_alloc(&disk->fs_arena, parity_pos, file, file_pos, 1);
 
 	/* insert the extent in the trees */
 	parity_extent = tommy_tree_insert(&disk->fs_parity, &extent->parity_node, extent);
@@ -1312,8 +1780,11 @@ void fs_deallocate(struct snapraid_disk* disk, block_off_t parity_pos)
 		tommy_tree_remove(&disk->fs_parity, extent);
 		tommy_tree_remove(&disk->fs_file, extent);
 
-		/* deallocate */
-		extent_free(extent);
+		/* deallocate, but if in the index, keep it there as removed */
+		if (disk->fs_index_pos)
+			extent->count = 0;
+		else
+			extent_free(&disk->fs_arena, extent);
 
 		/* clear the last accessed extent */
 		disk->fs_last = 0;
@@ -1340,7 +1811,8 @@ void fs_deallocate(struct snapraid_disk* disk, block_off_t parity_pos)
 		return;
 	}
 
-	/* otherwise it's in the middle */
+	/* otherwise it's in the middle, and we split the extent */
+	/* the index keeps the first part, and the second one is searched in the tree */
 	first_count = parity_pos - extent->parity_pos;
 	second_count = extent->count - first_count - 1;
 
@@ -1348,7 +1820,7 @@ void fs_deallocate(struct snapraid_disk* disk, block_off_t parity_pos)
 	extent->count = first_count;
 
 	/* allocate the second extent */
-	second_extent = extent_alloc(extent->parity_pos + first_count + 1, extent->file, extent->file_pos + first_count + 1, second_count);
+	second_extent = extent_alloc(&disk->fs_arena, extent->parity_pos + first_count + 1, extent->file, extent->file_pos + first_count + 1, second_count);
 
 	/* insert the extent in the trees */
 	parity_extent = tommy_tree_insert(&disk->fs_parity, &second_extent->parity_node, second_extent);
@@ -1410,6 +1882,54 @@ void map_free(struct snapraid_map* map)
 	free(map);
 }
 
+void infoarr_init(struct snapraid_infoarr* infoarr)
+{
+	tommy_arrayblkof_init(&infoarr->array, sizeof(snapraid_info));
+	infoarr->granularity = 0;
+	infoarr->base = 0;
+}
+
+void infoarr_done(struct snapraid_infoarr* infoarr)
+{
+	tommy_arrayblkof_done(&infoarr->array);
+}
+
+void infoarr_granularity(struct snapraid_infoarr* infoarr, unsigned granularity)
+{
+	assert(tommy_arrayblkof_size(&infoarr->array) == 0);
+
+	/* change the element size, the array is still empty */
+	tommy_arrayblkof_done(&infoarr->array);
+	tommy_arrayblkof_init(&infoarr->array, granularity != 0 ? sizeof(uint16_t) : sizeof(snapraid_info));
+	infoarr->granularity = granularity;
+	infoarr->base = 0;
+}
+
+void infoarr_unpack(struct snapraid_infoarr* infoarr)
+{
+	tommy_arrayblkof unpacked;
+	block_off_t size;
+	block_off_t i;
+
+	size = tommy_arrayblkof_size(&infoarr->array);
+
+	tommy_arrayblkof_init(&unpacked, sizeof(snapraid_info));
+	tommy_arrayblkof_grow(&unpacked, size);
+
+	for (i = 0; i < size; ++i) {
+		snapraid_info info = info_get(infoarr, i);
+		memcpy(tommy_arrayblkof_ref(&unpacked, i), &info, sizeof(snapraid_info));
+	}
+
+	tommy_arrayblkof_done(&infoarr->array);
+
+	infoarr->array = unpacked;
+	infoarr->granularity = 0;
+	infoarr->base = 0;
+
+	log_tag("info:unpack:%u\n", size);
+}
+
 int time_compare(const void* void_a, const void* void_b)
 {
 	const time_t* time_a = void_a;
@@ -55,6 +55,16 @@ struct snapraid_content {
 	tommy_node node; /**< Next node in the list. */
 };
 
+/**
+ * How a filter pattern is matched.
+ *
+ * Simple patterns are matched directly, without calling fnmatch().
+ */
+#define FILTER_MATCH_FNMATCH 0 /**< Generic pattern, use fnmatch(). */
+#define FILTER_MATCH_LITERAL 1 /**< Pattern without wildcards, like "file.txt". */
+#define FILTER_MATCH_PREFIX 2 /**< Literal followed by a single final '*', like "file.*". */
+#define FILTER_MATCH_SUFFIX 3 /**< Literal preceded by a single initial '*', like "*.txt". */
+
 /**
  * Filter for paths.
  */
@@ -64,6 +74,9 @@ struct snapraid_filter {
 	int is_path; /**< If the pattern is only for the complete path. */
 	int is_dir; /**< If the pattern is only for dir. */
 	int direction; /**< If it's an inclusion (=1) or an exclusion (=-1). */
+	int match; /**< How the pattern is matched. One of FILTER_MATCH_*. */
+	const char* literal; /**< Literal part of the pattern, if ::match is not FILTER_MATCH_FNMATCH. */
+	size_t literal_len; /**< Length of the literal part. */
 	tommy_node node; /**< Next node in the list. */
 };
 
@@ -158,6 +171,15 @@ struct snapraid_filter {
  */
 extern int BLOCK_HASH_SIZE;
 
+/**
+ * If the block hashes are stored in memory.
+ *
+ * It's cleared by the commands not using the hashes, to load the
+ * content file with a fraction of the memory. In such case only
+ * the state of the blocks is available.
+ */
+extern int BLOCK_HASH_STORED;
+
 /**
  * Block of a file.
  */
@@ -263,15 +285,24 @@ struct snapraid_block {
 #define FILE_IS_JUNCTION 0x8000 /**< If it's a junction for Windows. Not yet supported. */
 #define FILE_IS_LINK_MASK 0xF000 /**< Mask for link type. */
 
+/**
+ * If the file copy shares all its data in the disk with the original file.
+ * It's a copy done with a reflink or a deduplication, and the data
+ * is the same of the original file, then it's not necessary to verify it.
+ */
+#define FILE_IS_CLONE 0x10000
+
 /**
  * File.
+ *
+ * The blocks of the file are allocated together with it, just after
+ * the structure, without a pointer to them. Use file_block() to get them.
  */
 struct snapraid_file {
 	int64_t mtime_sec; /**< Modification time. */
 	uint64_t inode; /**< Inode. */
 	uint64_t physical; /**< Physical offset of the file. */
 	data_off_t size; /**< Size of the file. */
-	struct snapraid_block* blockvec; /**< All the blocks of the file. */
 	int mtime_nsec; /**< Modification time nanoseconds. In the range 0 <= x < 1,000,000,000, or STAT_NSEC_INVALID if not present. */
 	block_off_t blockmax; /**< Number of blocks. */
 	unsigned flag; /**< FILE_IS_* flags. */
@@ -309,6 +340,26 @@ struct snapraid_dir {
 	tommy_hashdyn_node nodeset;
 };
 
+/**
+ * Directory stamp.
+ *
+ * It stores the modification time of a directory at the last scan,
+ * and it's used to detect directories with unchanged entries.
+ * Differently than snapraid_dir, it's used for all the directories,
+ * and not only for the empty ones.
+ */
+struct snapraid_dirstamp {
+	unsigned flag; /**< FILE_IS_* flags. */
+	char* sub; /**< Sub path of the directory, terminated with a slash. Empty for the disk root. */
+	uint64_t inode; /**< Inode of the directory. 0 if unknown. */
+	int64_t mtime_sec; /**< Modification time. 0 if not reliable. */
+	int mtime_nsec; /**< Modification time nanoseconds. */
+
+	/* nodes for data structures */
+	tommy_node nodelist;
+	tommy_hashdyn_node nodeset;
+};
+
 /**
  * Chunk.
  *
@@ -323,6 +374,16 @@ struct snapraid_extent {
 	tommy_tree_node file_node; /**< Tree sorter by <file,file_pos>. */
 };
 
+/**
+ * Entry of the read optimized index of the extents.
+ */
+struct snapraid_index_entry {
+	struct snapraid_extent* extent; /**< Extent of the entry. */
+	struct snapraid_file* file; /**< File of the extent when the index was built. */
+	block_off_t file_pos; /**< File position of the extent when the index was built. */
+	block_off_t count; /**< Number of blocks of the extent when the index was built. */
+};
+
 /**
  * Disk.
  */
@@ -338,6 +399,8 @@ struct snapraid_disk {
 
 	uint64_t tick; /**< Usage time. */
 	uint64_t progress_tick[PROGRESS_MAX]; /**< Last ticks of progress. */
+	struct snapraid_histo histo_io; /**< Latency of the reads, in ticks. */
+	struct snapraid_histo histo_wait; /**< Time the completed reads waited in the task ring, in ticks. */
 	unsigned cached_blocks; /**< Number of IO blocks cached. */
 	struct snapraid_file* progress_file; /**< File in progress. */
 
@@ -357,12 +420,26 @@ struct snapraid_disk {
 	int mapping_idx; /**< Index in the mapping vector. Used only as buffer when writing the content file. */
 	int skip_access; /**< If the disk is inaccessible and it should be skipped. */
 
+	/**
+	 * Position in the file-system change journal at the last scan.
+	 *
+	 * It's saved in the content file, and it's used by the next scan to
+	 * process only the directories changed after this position.
+	 * The position is valid only if the journal identifier matches,
+	 * and if the filters are the same of the last scan.
+	 */
+	uint64_t journal_id; /**< Identifier of the change journal. 0 if unknown. */
+	uint64_t journal_pos; /**< Position in the change journal. */
+	uint32_t journal_filter; /**< Checksum of the filters used in the last scan. */
+
 #if HAVE_PTHREAD
 	/**
 	 * Mutex for protecting the filesystem structure.
 	 *
-	 * Specifically, this protects ::fs_parity, ::fs_file, and ::fs_last,
-	 * meaning that it protects only extents.
+	 * Specifically, this protects ::fs_parity, ::fs_file, ::fs_last and
+	 * the ::fs_index, meaning that it protects only extents.
+	 * The copies of the extents in the ::fs_index never change, and
+	 * fs_par2file_find_index() reads them without it.
 	 *
 	 * Files, links and dirs are not protected as they are not expected to
 	 * change during multithread processing.
@@ -370,6 +447,21 @@ struct snapraid_disk {
 	pthread_mutex_t fs_mutex;
 #endif
 
+	/**
+	 * Memory of the files, links and dirs of the disk, with their paths and blocks.
+	 *
+	 * All of them are released together when the disk is freed.
+	 */
+	struct snapraid_arena arena;
+
+	/**
+	 * Memory of the extents of the disk.
+	 *
+	 * It's separated from ::arena because the extents may change during
+	 * multithread processing, and then it's protected by ::fs_mutex.
+	 */
+	struct snapraid_arena fs_arena;
+
 	/**
 	 * Mapping of extents in the parity.
 	 * Sorted by <parity_pos> and by <file,file_pos>
@@ -383,6 +475,27 @@ struct snapraid_disk {
 	 */
 	struct snapraid_extent* fs_last;
 
+	/**
+	 * Read optimized index of the extents, sorted by parity position.
+	 *
+	 * It's built by fs_index_build() before the block loops, and used
+	 * by the parity lookups instead of the ::fs_parity tree.
+	 * The parity positions are stored in a separated vector to keep
+	 * the binary search in cache.
+	 *
+	 * Each entry keeps also a copy of the extent as it was when the index
+	 * was built. The copy never changes, and it allows the worker threads
+	 * to search the index without taking ::fs_mutex.
+	 *
+	 * Releasing blocks keeps it valid. The extents removed are left in
+	 * the index with a zero count until the index is released, and the
+	 * extents split are searched in the ::fs_parity tree.
+	 * Any allocation releases it.
+	 */
+	block_off_t* fs_index_pos; /**< Parity position of each extent, or 0 if not built. */
+	struct snapraid_index_entry* fs_index_entry; /**< Extents of the index. */
+	tommy_size_t fs_index_count; /**< Number of extents in the index. */
+
 	/**
 	 * List of all the snapraid_file for the disk.
 	 */
@@ -396,13 +509,25 @@ struct snapraid_disk {
 	 */
 	tommy_list deletedlist;
 
-	tommy_hashdyn inodeset; /**< Hashtable by inode of all the files. */
+	/**
+	 * Hashtables by inode, and by stamp (size and time), of all the files.
+	 *
+	 * They are used only to detect moved and copied files, and then they are
+	 * not filled when loading the content file, but only by disk_fileset_build()
+	 * when a command needs them. Until then ::has_fileset is 0.
+	 */
+	tommy_hashdyn inodeset;
+	tommy_hashdyn stampset;
+	int has_fileset; /**< If the ::inodeset and ::stampset are filled. */
+
 	tommy_hashdyn pathset; /**< Hashtable by path of all the files. */
-	tommy_hashdyn stampset; /**< Hashtable by stamp (size and time) of all the files. */
 	tommy_list linklist; /**< List of all the links. */
 	tommy_hashdyn linkset; /**< Hashtable by name of all the links. */
 	tommy_list dirlist; /**< List of all the empty dirs. */
 	tommy_hashdyn dirset; /**< Hashtable by name of all the empty dirs. */
+	tommy_list dirstamplist; /**< List of all the dir stamps. */
+	tommy_hashdyn dirstampset; /**< Hashtable by name of all the dir stamps. */
+	uint32_t dirstamp_filter; /**< Checksum of the filters used when the dir stamps were taken. */
 
 	/* nodes for data structures */
 	tommy_node node;
@@ -454,6 +579,7 @@ struct snapraid_split {
 	data_off_t size;
 
 	uint64_t device; /**< Device identifier of the parity. */
+	char device_uuid[UUID_MAX]; /**< UUID read from the device at startup. Empty if unsupported. */
 };
 
 /**
@@ -469,6 +595,8 @@ struct snapraid_parity {
 	int skip_access; /**< If at least one of the parity disk is inaccessible and it should be skipped. */
 	uint64_t tick; /**< Usage time. */
 	uint64_t progress_tick[PROGRESS_MAX]; /**< Last cpu ticks of progress. */
+	struct snapraid_histo histo_io; /**< Latency of the reads and writes, in ticks. */
+	struct snapraid_histo histo_wait; /**< Time the completed reads waited in the task ring, in ticks. */
 	unsigned cached_blocks; /**< Number of IO blocks cached. */
 };
 
@@ -477,6 +605,27 @@ struct snapraid_parity {
  */
 typedef uint32_t snapraid_info;
 
+/**
+ * Max number of time units of the packed info.
+ */
+#define INFO_PACKED_MAX 8191
+
+/**
+ * Array of the info of each parity position.
+ *
+ * With a granularity, the info is packed in 16 bits, with the time quantized
+ * in units of the granularity starting from a base time.
+ * The 0 value means no info, the lowest 3 bits are the INFO_MASK flags,
+ * and the other 13 bits are the number of units plus one.
+ * If a time is out of the range of the units, the array is converted to
+ * the unpacked format, keeping the rounded times already stored.
+ */
+struct snapraid_infoarr {
+	tommy_arrayblkof array; /**< Info of each position. */
+	unsigned granularity; /**< Seconds of each unit of time. 0 to store the info unpacked. */
+	time_t base; /**< Time of the first unit. 0 if not yet set. */
+};
+
 /**
  * Allocate a content.
  */
@@ -538,7 +687,7 @@ int filter_existence(int filter_missing, const char* dir, const char* sub);
  * Filter a file if bad.
  * Return !=0 if the file is correct and it should be excluded.
  */
-int filter_correctness(int filter_error, tommy_arrayblkof* infoarr, struct snapraid_disk* disk, struct snapraid_file* file);
+int filter_correctness(int filter_error, struct snapraid_infoarr* infoarr, struct snapraid_disk* disk, struct snapraid_file* file);
 
 /**
  * Filter a dir using a list of filters.
@@ -640,6 +789,9 @@ static inline void hash_zero_set(unsigned char* hash)
  */
 static inline size_t block_sizeof(void)
 {
+	if (!BLOCK_HASH_STORED)
+		return 1;
+
 	return 1 + BLOCK_HASH_SIZE;
 }
 
@@ -744,30 +896,38 @@ static inline void file_flag_clear(struct snapraid_file* file, unsigned mask)
 }
 
 /**
- * Allocate a file.
+ * Allocate a file in the arena of its disk.
  */
-struct snapraid_file* file_alloc(unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical);
+struct snapraid_file* file_alloc(struct snapraid_arena* arena, unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical);
 
 /**
  * Duplicate a file.
  */
-struct snapraid_file* file_dup(struct snapraid_file* copy);
+struct snapraid_file* file_dup(struct snapraid_arena* arena, struct snapraid_file* copy);
 
 /**
  * Deallocate a file.
  */
-void file_free(struct snapraid_file* file);
+void file_free(struct snapraid_arena* arena, struct snapraid_file* file);
 
 /**
  * Rename a file.
  */
-void file_rename(struct snapraid_file* file, const char* sub);
+void file_rename(struct snapraid_arena* arena, struct snapraid_file* file, const char* sub);
 
 /**
  * Copy a file.
  */
 void file_copy(struct snapraid_file* src_file, struct snapraid_file* dest_file);
 
+/**
+ * Allocated space for a file with the specified number of blocks.
+ */
+static inline size_t file_sizeof(block_off_t blockmax)
+{
+	return sizeof(struct snapraid_file) + blockmax * block_sizeof();
+}
+
 /**
  * Return the block at the specified position.
  *
@@ -775,7 +935,7 @@ void file_copy(struct snapraid_file* src_file, struct snapraid_file* dest_file);
  */
 static inline struct snapraid_block* file_block(struct snapraid_file* file, size_t pos)
 {
-	unsigned char* ptr = (unsigned char*)file->blockvec;
+	unsigned char* ptr = (unsigned char*)(file + 1);
 
 	return (struct snapraid_block*)(ptr + pos * block_sizeof());
 }
@@ -856,12 +1016,12 @@ static inline tommy_uint32_t file_stamp_hash(data_off_t size, int64_t mtime_sec,
 /**
  * Allocate a extent.
  */
-struct snapraid_extent* extent_alloc(block_off_t parity_pos, struct snapraid_file* file, block_off_t file_pos, block_off_t count);
+struct snapraid_extent* extent_alloc(struct snapraid_arena* arena, block_off_t parity_pos, struct snapraid_file* file, block_off_t file_pos, block_off_t count);
 
 /**
  * Deallocate a extent.
  */
-void extent_free(struct snapraid_extent* extent);
+void extent_free(struct snapraid_arena* arena, struct snapraid_extent* extent);
 
 /**
  * Compare extent by parity position.
@@ -902,12 +1062,17 @@ static inline unsigned link_flag_get(struct snapraid_link* slink, unsigned mask)
 /**
  * Allocate a link.
  */
-struct snapraid_link* link_alloc(const char* name, const char* slink, unsigned link_flag);
+struct snapraid_link* link_alloc(struct snapraid_arena* arena, const char* name, const char* slink, unsigned link_flag);
 
 /**
  * Deallocate a link.
  */
-void link_free(struct snapraid_link* slink);
+void link_free(struct snapraid_arena* arena, struct snapraid_link* slink);
+
+/**
+ * Change the destination of a link.
+ */
+void link_relink(struct snapraid_arena* arena, struct snapraid_link* slink, const char* linkto);
 
 /**
  * Compare a link with a name.
@@ -945,12 +1110,12 @@ static inline void dir_flag_clear(struct snapraid_dir* dir, unsigned mask)
 /**
  * Allocate a dir.
  */
-struct snapraid_dir* dir_alloc(const char* name);
+struct snapraid_dir* dir_alloc(struct snapraid_arena* arena, const char* name);
 
 /**
  * Deallocate a dir.
  */
-void dir_free(struct snapraid_dir* dir);
+void dir_free(struct snapraid_arena* arena, struct snapraid_dir* dir);
 
 /**
  * Compare a dir with a name.
@@ -965,6 +1130,39 @@ static inline tommy_uint32_t dir_name_hash(const char* name)
 	return tommy_hash_u32(0, name, strlen(name));
 }
 
+static inline int dirstamp_flag_has(const struct snapraid_dirstamp* dirstamp, unsigned mask)
+{
+	return (dirstamp->flag & mask) == mask;
+}
+
+static inline void dirstamp_flag_set(struct snapraid_dirstamp* dirstamp, unsigned mask)
+{
+	dirstamp->flag |= mask;
+}
+
+/**
+ * Allocate a dir stamp.
+ */
+struct snapraid_dirstamp* dirstamp_alloc(const char* sub, uint64_t inode, int64_t mtime_sec, int mtime_nsec);
+
+/**
+ * Deallocate a dir stamp.
+ */
+void dirstamp_free(struct snapraid_dirstamp* dirstamp);
+
+/**
+ * Compare a dir stamp with a name.
+ */
+int dirstamp_name_compare(const void* void_arg, const void* void_data);
+
+/**
+ * Compute the hash of a dir stamp name.
+ */
+static inline tommy_uint32_t dirstamp_name_hash(const char* name)
+{
+	return tommy_hash_u32(0, name, strlen(name));
+}
+
 /**
  * Allocate a disk.
  */
@@ -975,6 +1173,14 @@ struct snapraid_disk* disk_alloc(const char* name, const char* dir, uint64_t dev
  */
 void disk_free(struct snapraid_disk* disk);
 
+/**
+ * Fill the inode and stamp hashtables of the files of the disk.
+ *
+ * If they are already filled, nothing is done.
+ * After this call, the changes to the files must keep them updated.
+ */
+void disk_fileset_build(struct snapraid_disk* disk);
+
 /**
  * Get the size of the disk in blocks.
  */
@@ -994,6 +1200,29 @@ int fs_is_empty(struct snapraid_disk* disk, block_off_t blockmax);
  */
 int fs_check(struct snapraid_disk* disk);
 
+/**
+ * Build the read optimized index of the extents.
+ *
+ * Call it after the changes of scan, before processing the blocks.
+ */
+void fs_index_build(struct snapraid_disk* disk);
+
+/**
+ * Mark the parity positions of the blocks with invalid parity.
+ *
+ * The position ::i is the bit (i % 8) of the byte (i / 8) of the map,
+ * and the positions from ::blockmax are ignored.
+ * It visits the extents, and not the positions, skipping the free ones.
+ */
+void fs_invalid_map(struct snapraid_disk* disk, block_off_t blockmax, unsigned char* map);
+
+/**
+ * Mark the parity positions of the blocks of the files not excluded.
+ *
+ * The map has the same format of fs_invalid_map().
+ */
+void fs_included_map(struct snapraid_disk* disk, block_off_t blockmax, unsigned char* map);
+
 /**
  * Allocate a parity position for the specified file position.
  *
@@ -1025,6 +1254,31 @@ struct snapraid_block* fs_file2block_get(struct snapraid_file* file, block_off_t
  */
 struct snapraid_file* fs_par2file_find(struct snapraid_disk* disk, block_off_t parity_pos, block_off_t* file_pos);
 
+/**
+ * Get the file position from the parity position, without locking.
+ * Return 0 if no file is using it.
+ *
+ * It uses only the index built by fs_index_build(), and it reports the
+ * association as it was when the index was built. Use it only for
+ * parity positions not allocated nor released since then, like the
+ * positions still to process in the block loops.
+ * If the index is not built, it falls back to fs_par2file_find().
+ *
+ * \note This function is thread-safe, and it's intended for worker threads.
+ */
+struct snapraid_file* fs_par2file_find_index(struct snapraid_disk* disk, block_off_t parity_pos, block_off_t* file_pos);
+
+/**
+ * Get the number of blocks of the same file following in both the parity
+ * and the file, starting from the parity position, and including it.
+ * Return 0 if no file is using it.
+ *
+ * Like fs_par2file_find_index(), it uses the index if built.
+ *
+ * \note This function is thread-safe, and it's intended for worker threads.
+ */
+block_off_t fs_par2run_index(struct snapraid_disk* disk, block_off_t parity_pos);
+
 /**
  * Get the file position from the parity position.
  */
@@ -1179,29 +1433,127 @@ static inline snapraid_info info_set_rehash(snapraid_info info)
 	return info | 0x2;
 }
 
+/**
+ * Initialize the info array, unpacked.
+ */
+void infoarr_init(struct snapraid_infoarr* infoarr);
+
+/**
+ * Deinitialize the info array.
+ */
+void infoarr_done(struct snapraid_infoarr* infoarr);
+
+/**
+ * Pack the info in units of the specified seconds.
+ * It must be called when the array is still empty.
+ */
+void infoarr_granularity(struct snapraid_infoarr* infoarr, unsigned granularity);
+
+/**
+ * Set the base time of the packed info, at the oldest time that will be stored.
+ * It must be called before storing any info.
+ */
+static inline void infoarr_base(struct snapraid_infoarr* infoarr, time_t oldest)
+{
+	if (infoarr->granularity != 0 && (infoarr->base == 0 || oldest < infoarr->base))
+		infoarr->base = oldest - oldest % infoarr->granularity;
+}
+
+/**
+ * Convert the info array to the unpacked format.
+ * Used when a time is out of the range of the packed info.
+ */
+void infoarr_unpack(struct snapraid_infoarr* infoarr);
+
+/**
+ * Pack the info in 16 bits.
+ * Return 0 on success, or -1 if the time is out of the range of the packed info.
+ */
+static inline int info_pack(struct snapraid_infoarr* infoarr, snapraid_info info, uint16_t* packed)
+{
+	time_t t;
+	time_t unit;
+
+	t = info_get_time(info);
+
+	/* without a time, like a bad block never synced, only the flags are stored */
+	if (t == 0) {
+		*packed = info & INFO_MASK;
+		return 0;
+	}
+
+	/* the first time stored is the base, if not set before */
+	if (infoarr->base == 0)
+		infoarr_base(infoarr, t);
+
+	if (t < infoarr->base)
+		return -1;
+
+	unit = (t - infoarr->base) / infoarr->granularity;
+	if (unit > INFO_PACKED_MAX - 1)
+		return -1;
+
+	*packed = (unit + 1) << 3 | (info & INFO_MASK);
+
+	return 0;
+}
+
+/**
+ * Unpack the info from 16 bits.
+ */
+static inline snapraid_info info_unpack(struct snapraid_infoarr* infoarr, uint16_t packed)
+{
+	time_t t;
+
+	if ((packed >> 3) == 0)
+		return packed & INFO_MASK;
+
+	t = infoarr->base + (time_t)((packed >> 3) - 1) * infoarr->granularity;
+
+	return info_make(t, packed & 0x1, packed & 0x2, packed & 0x4);
+}
+
 /**
  * Set the info at the specified position.
  * The position is allocated if not yet done.
  */
-static inline void info_set(tommy_arrayblkof* array, block_off_t pos, snapraid_info info)
+static inline void info_set(struct snapraid_infoarr* infoarr, block_off_t pos, snapraid_info info)
 {
-	tommy_arrayblkof_grow(array, pos + 1);
+	if (infoarr->granularity != 0) {
+		uint16_t packed;
+
+		if (info_pack(infoarr, info, &packed) == 0) {
+			tommy_arrayblkof_grow(&infoarr->array, pos + 1);
+			memcpy(tommy_arrayblkof_ref(&infoarr->array, pos), &packed, sizeof(packed));
+			return;
+		}
 
-	memcpy(tommy_arrayblkof_ref(array, pos), &info, sizeof(snapraid_info));
+		/* the time doesn't fit, and we switch to the exact time */
+		infoarr_unpack(infoarr);
+	}
+
+	tommy_arrayblkof_grow(&infoarr->array, pos + 1);
+	memcpy(tommy_arrayblkof_ref(&infoarr->array, pos), &info, sizeof(snapraid_info));
 }
 
 /**
  * Get the info at the specified position.
  * For not allocated position, 0 is returned.
  */
-static inline snapraid_info info_get(tommy_arrayblkof* array, block_off_t pos)
+static inline snapraid_info info_get(struct snapraid_infoarr* infoarr, block_off_t pos)
 {
 	snapraid_info info;
 
-	if (pos >= tommy_arrayblkof_size(array))
+	if (pos >= tommy_arrayblkof_size(&infoarr->array))
 		return 0;
 
-	memcpy(&info, tommy_arrayblkof_ref(array, pos), sizeof(snapraid_info));
+	if (infoarr->granularity != 0) {
+		uint16_t packed;
+		memcpy(&packed, tommy_arrayblkof_ref(&infoarr->array, pos), sizeof(packed));
+		return info_unpack(infoarr, packed);
+	}
+
+	memcpy(&info, tommy_arrayblkof_ref(&infoarr->array, pos), sizeof(snapraid_info));
 
 	return info;
 }
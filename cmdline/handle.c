@@ -19,22 +19,110 @@
 
 #include "elem.h"
 #include "support.h"
+#include "util.h"
 #include "handle.h"
 
 /****************************************************************************/
 /* handle */
 
+/**
+ * Take a file from the cache.
+ * Return the handle of the file, or -1 if not present.
+ */
+static int handle_cache_take(struct snapraid_handle* handle, struct snapraid_file* file, struct advise_struct* advise)
+{
+	unsigned i;
+
+	/* search from the most recently used */
+	for (i = handle->cache_count; i > 0; --i) {
+		struct snapraid_handle_cache* entry = &handle->cache_map[i - 1];
+
+		if (entry->file == file) {
+			int f = entry->f;
+
+			*advise = entry->advise;
+
+			/* remove it, keeping the order of the others */
+			memmove(entry, entry + 1, (handle->cache_count - i) * sizeof(struct snapraid_handle_cache));
+			--handle->cache_count;
+
+			return f;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Write the blocks written behind with a single write.
+ * Return 0 on success, -1 on error.
+ */
+static int handle_flush(struct snapraid_handle* handle)
+{
+	ssize_t write_ret;
+	data_off_t offset;
+	size_t write_size;
+	block_off_t count;
+	int ret;
+
+	if (handle->behind_count == 0)
+		return 0;
+
+	count = handle->behind_count;
+	offset = handle->behind_pos * (data_off_t)handle->block_size;
+
+	/* only the last block may be shorter */
+	write_size = (count - 1) * (size_t)handle->block_size + file_block_size(handle->file, handle->behind_pos + count - 1, handle->block_size);
+
+	/* the blocks are dropped also on error, to not report it again */
+	handle->behind_count = 0;
+
+	write_ret = pwrite(handle->f, handle->behind_buffer, write_size, offset);
+	if (write_ret != (ssize_t)write_size) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing file '%s'. %s.\n", handle->path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* adjust the size of the valid data */
+	if (handle->valid_size < offset + (data_off_t)write_size) {
+		handle->valid_size = offset + write_size;
+	}
+
+	ret = advise_write(&handle->advise, handle->f, offset, count * handle->block_size);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error advising file '%s'. %s.\n", handle->path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+}
+
 int handle_create(struct snapraid_handle* handle, struct snapraid_file* file, int mode)
 {
 	int ret;
 	int flags;
+	int f;
 
 	/* if it's the same file, and already opened, nothing to do */
 	if (handle->file == file && handle->f != -1) {
 		return 0;
 	}
 
+	/* if the file is kept open for reading, close it, as it's opened again for writing */
+	f = handle_cache_take(handle, file, &handle->advise);
+	if (f != -1 && close(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing file '%s'. %s.\n", file->sub, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
 	advise_init(&handle->advise, mode);
+
 	pathprint(handle->path, sizeof(handle->path), "%s%s", handle->disk->dir, file->sub);
 
 	ret = mkancestor(handle->path);
@@ -95,6 +183,7 @@ int handle_create(struct snapraid_handle* handle, struct snapraid_file* file, in
 
 	/* just opened */
 	handle->file = file;
+	handle->ahead_count = 0;
 
 	/* get the stat info */
 	ret = fstat(handle->f, &handle->st);
@@ -108,6 +197,20 @@ int handle_create(struct snapraid_handle* handle, struct snapraid_file* file, in
 	/* get the size of the existing data */
 	handle->valid_size = handle->st.st_size;
 
+#if HAVE_FALLOCATE && defined(FALLOC_FL_KEEP_SIZE)
+	/*
+	 * Reserve the space of the whole file when it's created, to have
+	 * it contiguous, even if it's recovered in many steps.
+	 * The size isn't changed, as the data not yet written is missing.
+	 *
+	 * It's only an optimization, and errors are ignored, as not all
+	 * the file-systems support it. A real lack of space is reported
+	 * by the writes.
+	 */
+	if (handle->created && file->size != 0)
+		(void)fallocate(handle->f, FALLOC_FL_KEEP_SIZE, 0, file->size);
+#endif
+
 	ret = advise_open(&handle->advise, handle->f);
 	if (ret != 0) {
 		/* LCOV_EXCL_START */
@@ -123,6 +226,13 @@ int handle_truncate(struct snapraid_handle* handle, struct snapraid_file* file)
 {
 	int ret;
 
+	ret = handle_flush(handle);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
 	ret = ftruncate(handle->f, file->size);
 	if (ret != 0) {
 		/* LCOV_EXCL_START */
@@ -154,12 +264,35 @@ int handle_open(struct snapraid_handle* handle, struct snapraid_file* file, int
 		return 0;
 	}
 
-	advise_init(&handle->advise, mode);
 	pathprint(handle->path, sizeof(handle->path), "%s%s", handle->disk->dir, file->sub);
 
 	/* for sure not created */
 	handle->created = 0;
 
+	/* if kept open in the cache, take it from there */
+	handle->f = handle_cache_take(handle, file, &handle->advise);
+	if (handle->f != -1) {
+		/* just taken */
+		handle->file = file;
+		handle->ahead_count = 0;
+
+		/* get the stat info again, to detect changes done after the first open */
+		ret = fstat(handle->f, &handle->st);
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			out("Error accessing file '%s'. %s.\n", handle->path, strerror(errno));
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* get the size of the existing data */
+		handle->valid_size = handle->st.st_size;
+
+		return 0;
+	}
+
+	advise_init(&handle->advise, mode);
+
 	/* flags for opening */
 	/* O_BINARY: open as binary file (Windows only) */
 	/* O_NOFOLLOW: do not follow links to ensure to open the real file */
@@ -182,6 +315,7 @@ int handle_open(struct snapraid_handle* handle, struct snapraid_file* file, int
 
 	/* just opened */
 	handle->file = file;
+	handle->ahead_count = 0;
 
 	/* get the stat info */
 	ret = fstat(handle->f, &handle->st);
@@ -206,9 +340,77 @@ int handle_open(struct snapraid_handle* handle, struct snapraid_file* file, int
 	return 0;
 }
 
+int handle_release(struct snapraid_handle* handle)
+{
+	struct snapraid_handle_cache* entry;
+	int ret;
+
+	/* if not open, nothing to do */
+	if (handle->f == -1)
+		return 0;
+
+	ret = handle_flush(handle);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* if no cache, close it */
+	if (handle->cache_max == 0)
+		return handle_close(handle);
+
+	/* if the cache is full, close the least recently used */
+	if (handle->cache_count == handle->cache_max) {
+		entry = &handle->cache_map[0];
+
+		ret = close(entry->f);
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error closing file '%s'. %s.\n", entry->file->sub, strerror(errno));
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		memmove(entry, entry + 1, (handle->cache_count - 1) * sizeof(struct snapraid_handle_cache));
+		--handle->cache_count;
+	}
+
+	/* insert as the most recently used */
+	entry = &handle->cache_map[handle->cache_count++];
+	entry->file = handle->file;
+	entry->f = handle->f;
+	entry->advise = handle->advise;
+
+	/* reset the descriptor */
+	handle->file = 0;
+	handle->f = -1;
+	handle->valid_size = 0;
+	handle->ahead_count = 0;
+
+	return 0;
+}
+
 int handle_close(struct snapraid_handle* handle)
 {
 	int ret;
+	int flush_ret;
+
+	/* write the blocks left, and close anyway */
+	flush_ret = handle_flush(handle);
+
+	/* close all the files in the cache, from the most recently used */
+	while (handle->cache_count != 0) {
+		struct snapraid_handle_cache* entry = &handle->cache_map[--handle->cache_count];
+
+		ret = close(entry->f);
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error closing file '%s'. %s.\n", entry->file->sub, strerror(errno));
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
 
 	/* close if open */
 	if (handle->f != -1) {
@@ -230,11 +432,68 @@ int handle_close(struct snapraid_handle* handle)
 	handle->file = 0;
 	handle->f = -1;
 	handle->valid_size = 0;
+	handle->ahead_count = 0;
+
+	if (flush_ret != 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+}
+
+/**
+ * Read the blocks of a run with a single read, in the read ahead buffer.
+ * Return 0 on success, -1 on error, without reporting it.
+ */
+static int handle_read_run(struct snapraid_handle* handle, block_off_t file_pos, block_off_t run, unsigned block_size)
+{
+	ssize_t read_ret;
+	data_off_t offset;
+	size_t size;
+	size_t read_size;
+	size_t count;
+
+	offset = file_pos * (data_off_t)block_size;
+	size = run * (size_t)block_size;
+
+	/* only the last block may be shorter */
+	read_size = (run - 1) * (size_t)block_size + file_block_size(handle->file, file_pos + run - 1, block_size);
+
+	/* the buffer is going to be overwritten */
+	handle->ahead_count = 0;
+
+	count = 0;
+	do {
+		/* read the full blocks to support O_DIRECT */
+		read_ret = pread(handle->f, handle->ahead_buffer + count, size - count, offset + count);
+		if (read_ret <= 0)
+			return -1;
+
+		count += read_ret;
+	} while (count < read_size);
+
+	/* pad with 0 */
+	if (read_size < size) {
+		memset(handle->ahead_buffer + read_size, 0, size - read_size);
+	}
+
+	if (advise_read(&handle->advise, handle->f, offset, size) != 0)
+		return -1;
+
+	handle->ahead_pos = file_pos;
+	handle->ahead_count = run;
 
 	return 0;
 }
 
 int handle_read(struct snapraid_handle* handle, block_off_t file_pos, unsigned char* block_buffer, unsigned block_size, fptr* out, fptr* out_missing)
+{
+	return handle_read_ahead(handle, file_pos, 1, block_buffer, block_size, out, out_missing);
+}
+
+int handle_read_ahead(struct snapraid_handle* handle, block_off_t file_pos, block_off_t run, unsigned char* block_buffer, unsigned block_size, fptr* out, fptr* out_missing)
 {
 	ssize_t read_ret;
 	data_off_t offset;
@@ -247,6 +506,18 @@ int handle_read(struct snapraid_handle* handle, block_off_t file_pos, unsigned c
 	if (!out_missing)
 		out_missing = out;
 
+	/* if reading blocks written behind, write them before */
+	if (handle->behind_count != 0
+		&& file_pos < handle->behind_pos + handle->behind_count
+		&& file_pos + (run > 1 ? run : 1) > handle->behind_pos
+	) {
+		if (handle_flush(handle) != 0) {
+			/* LCOV_EXCL_START */
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
 	/* check if we are going to read only not initialized data */
 	if (offset >= handle->valid_size) {
 		/* if the file is missing, it's at 0 size, or it's rebuilt while reading */
@@ -259,6 +530,20 @@ int handle_read(struct snapraid_handle* handle, block_off_t file_pos, unsigned c
 
 	read_size = file_block_size(handle->file, file_pos, block_size);
 
+	/* if already read ahead, copy it */
+	if (file_pos >= handle->ahead_pos && file_pos < handle->ahead_pos + handle->ahead_count) {
+		memcpy(block_buffer, handle->ahead_buffer + (file_pos - handle->ahead_pos) * (size_t)block_size, block_size);
+		return read_size;
+	}
+
+	/* if the next blocks are going to be read, read them together */
+	if (run > handle->ahead_max)
+		run = handle->ahead_max;
+	if (run > 1 && handle_read_run(handle, file_pos, run, block_size) == 0) {
+		memcpy(block_buffer, handle->ahead_buffer, block_size);
+		return read_size;
+	}
+
 	count = 0;
 	do {
 		/* read the full block to support O_DIRECT */
@@ -304,6 +589,37 @@ int handle_write(struct snapraid_handle* handle, block_off_t file_pos, unsigned
 
 	write_size = file_block_size(handle->file, file_pos, block_size);
 
+	/* the blocks read ahead may be changed */
+	handle->ahead_count = 0;
+
+	/* if the write behind buffer is used */
+	if (handle->ahead_max > 1) {
+		/* if the block doesn't continue the run, or the buffer is full, write the run */
+		if (handle->behind_count != 0
+			&& (file_pos != handle->behind_pos + handle->behind_count || handle->behind_count == handle->ahead_max)
+		) {
+			ret = handle_flush(handle);
+			if (ret != 0) {
+				/* LCOV_EXCL_START */
+				return -1;
+				/* LCOV_EXCL_STOP */
+			}
+		}
+
+		/* allocate the buffer at the first use, as only fix writes */
+		if (!handle->behind_buffer)
+			handle->behind_buffer = malloc_nofail_direct(handle->ahead_max * (size_t)block_size, &handle->behind_alloc);
+
+		if (handle->behind_count == 0)
+			handle->behind_pos = file_pos;
+		handle->block_size = block_size;
+
+		memcpy(handle->behind_buffer + handle->behind_count * (size_t)block_size, block_buffer, block_size);
+		++handle->behind_count;
+
+		return 0;
+	}
+
 	write_ret = pwrite(handle->f, block_buffer, write_size, offset);
 	if (write_ret != (ssize_t)write_size) { /* conversion is safe because block_size is always small */
 		/* LCOV_EXCL_START */
@@ -336,6 +652,14 @@ int handle_utime(struct snapraid_handle* handle)
 	if (handle->f == -1)
 		return 0;
 
+	/* the time is changed by the writes */
+	ret = handle_flush(handle);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
 	ret = fmtime(handle->f, handle->file->mtime_sec, handle->file->mtime_nsec);
 
 	if (ret != 0) {
@@ -354,6 +678,8 @@ struct snapraid_handle* handle_mapping(struct snapraid_state* state, unsigned* h
 	unsigned j;
 	unsigned size = 0;
 	struct snapraid_handle* handle;
+	unsigned cache_max;
+	unsigned limit;
 
 	/* get the size of the mapping */
 	size = 0;
@@ -366,12 +692,39 @@ struct snapraid_handle* handle_mapping(struct snapraid_state* state, unsigned* h
 
 	handle = malloc_nofail(size * sizeof(struct snapraid_handle));
 
+	/* files kept open for each disk, limited by the ones the process can open */
+	cache_max = state->opt.file_cache;
+	limit = open_max();
+	if (cache_max != 0 && limit != 0) {
+		unsigned threads = state->opt.disk_threads > 1 ? state->opt.disk_threads : 1;
+
+		/* leave half of the limit for the parity, content and log files */
+		unsigned allowed = limit / 2 / (size * threads);
+
+		if (cache_max > allowed) {
+			msg_verbose("Keeping open %u files for each disk, for the limit of %u open files.\n", allowed, limit);
+			cache_max = allowed;
+		}
+	}
+
 	for (j = 0; j < size; ++j) {
 		/* default for empty position */
 		handle[j].disk = 0;
 		handle[j].file = 0;
 		handle[j].f = -1;
 		handle[j].valid_size = 0;
+		handle[j].cache_count = 0;
+		handle[j].cache_max = cache_max;
+		handle[j].ahead_buffer = 0;
+		handle[j].ahead_alloc = 0;
+		handle[j].ahead_pos = 0;
+		handle[j].ahead_count = 0;
+		handle[j].ahead_max = 0;
+		handle[j].behind_buffer = 0;
+		handle[j].behind_alloc = 0;
+		handle[j].behind_pos = 0;
+		handle[j].behind_count = 0;
+		handle[j].block_size = state->block_size;
 	}
 
 	/* set the vector */
@@ -395,9 +748,27 @@ struct snapraid_handle* handle_mapping(struct snapraid_state* state, unsigned* h
 		}
 
 		handle[map->position].disk = disk;
+
+		/* the read ahead buffer, aligned for direct io */
+		if (state->opt.io_ahead > 1) {
+			handle[map->position].ahead_buffer = malloc_nofail_direct(state->opt.io_ahead * (size_t)state->block_size, &handle[map->position].ahead_alloc);
+			handle[map->position].ahead_max = state->opt.io_ahead;
+		}
 	}
 
 	*handlemax = size;
 	return handle;
 }
 
+void handle_unmapping(struct snapraid_handle* handle, unsigned handlemax)
+{
+	unsigned j;
+
+	for (j = 0; j < handlemax; ++j) {
+		free(handle[j].ahead_alloc);
+		free(handle[j].behind_alloc);
+	}
+
+	free(handle);
+}
+
@@ -24,6 +24,25 @@
 /****************************************************************************/
 /* handle */
 
+/**
+ * Max number of files kept open in the cache of a handle.
+ */
+#define HANDLE_CACHE_MAX 64
+
+/**
+ * Max number of blocks of a file read together.
+ */
+#define HANDLE_AHEAD_MAX 64
+
+/**
+ * File kept open in the cache of a handle.
+ */
+struct snapraid_handle_cache {
+	struct snapraid_file* file; /**< File opened. */
+	int f; /**< Handle of the file. */
+	struct advise_struct advise; /**< Advise information. */
+};
+
 struct snapraid_handle {
 	char path[PATH_MAX]; /**< Path of the file. */
 	struct snapraid_disk* disk; /**< Disk of the file. */
@@ -33,12 +52,51 @@ struct snapraid_handle {
 	struct advise_struct advise; /**< Advise information. */
 	data_off_t valid_size; /**< Size of the valid data. */
 	int created; /**< If the file was created, otherwise it was already existing. */
+
+	/**
+	 * Files read before, and kept open to read them again.
+	 *
+	 * When the files of a disk are interleaved in the parity, the same
+	 * files are read alternately, and keeping them open saves
+	 * the open() calls.
+	 */
+	struct snapraid_handle_cache cache_map[HANDLE_CACHE_MAX]; /**< Cache, from the least recently used. */
+	unsigned cache_count; /**< Number of files in the cache. */
+	unsigned cache_max; /**< Max number of files in the cache. 0 if not used. */
+
+	/**
+	 * Blocks read ahead.
+	 *
+	 * When the next blocks of the file are going to be read, they are
+	 * read together with a single read, and then copied from here.
+	 * It contains only blocks of the file opened.
+	 */
+	unsigned char* ahead_buffer; /**< Buffer of the blocks. */
+	void* ahead_alloc; /**< Allocation of the buffer. */
+	block_off_t ahead_pos; /**< Position in the file of the first block. */
+	block_off_t ahead_count; /**< Number of blocks in the buffer. 0 if empty. */
+	block_off_t ahead_max; /**< Max number of blocks read together. 0 if not used. */
+
+	/**
+	 * Blocks written behind.
+	 *
+	 * When writing the next blocks of the file, they are collected
+	 * here, and written together with a single write, up to ::ahead_max blocks.
+	 * They are written when the run breaks, and before any other operation
+	 * on the file that needs them, like reading, closing, or setting the time.
+	 */
+	unsigned char* behind_buffer; /**< Buffer of the blocks. */
+	void* behind_alloc; /**< Allocation of the buffer. */
+	block_off_t behind_pos; /**< Position in the file of the first block. */
+	block_off_t behind_count; /**< Number of blocks in the buffer. 0 if empty. */
+	unsigned block_size; /**< Size of the blocks in the buffer. */
 };
 
 /**
  * Create a file.
  * The file is created if missing, and opened with write access.
- * If the file is created, the handle->created is set.
+ * If the file is created, the handle->created is set, and if supported,
+ * the space of the whole file is reserved without changing its size.
  * The initial size of the file is stored in the file->st struct.
  * If the file cannot be opened for write access, it's opened with read-only access.
  * The read-only access works only if the file has already the correct size and doesn't need to be modified.
@@ -53,11 +111,20 @@ int handle_truncate(struct snapraid_handle* handle, struct snapraid_file* file);
 /**
  * Open a file.
  * The file is opened for reading.
+ * If the file is kept open in the cache, it's taken from there.
  */
 int handle_open(struct snapraid_handle* handle, struct snapraid_file* file, int mode, fptr* out, fptr* out_missing);
 
 /**
- * Close a file.
+ * Release a file opened for reading.
+ * The file is kept open in the cache, to be opened again later.
+ * If the cache is full, the least recently used file is closed.
+ * If the cache is not used, the file is closed.
+ */
+int handle_release(struct snapraid_handle* handle);
+
+/**
+ * Close a file, and all the files kept open in the cache.
  */
 int handle_close(struct snapraid_handle* handle);
 
@@ -67,8 +134,20 @@ int handle_close(struct snapraid_handle* handle);
  */
 int handle_read(struct snapraid_handle* handle, block_off_t file_pos, unsigned char* block_buffer, unsigned block_size, fptr* out, fptr* out_missing);
 
+/**
+ * Read a block from a file, reading together the next blocks.
+ * Like handle_read(), but if the next blocks are going to be read, up to
+ * ::ahead_max blocks are read with a single read, for the next calls.
+ * If the single read fails, only the block is read, to report the error
+ * for the correct block.
+ * \param run Number of blocks going to be read, starting from this one.
+ */
+int handle_read_ahead(struct snapraid_handle* handle, block_off_t file_pos, block_off_t run, unsigned char* block_buffer, unsigned block_size, fptr* out, fptr* out_missing);
+
 /**
  * Write a block to a file.
+ * If the write behind buffer is used, the block may be written later,
+ * together with the next ones.
  */
 int handle_write(struct snapraid_handle* handle, block_off_t file_pos, unsigned char* block_buffer, unsigned block_size);
 
@@ -84,5 +163,10 @@ int handle_utime(struct snapraid_handle* handle);
  */
 struct snapraid_handle* handle_mapping(struct snapraid_state* state, unsigned* diskmax);
 
+/**
+ * Free the vector allocated by handle_mapping().
+ */
+void handle_unmapping(struct snapraid_handle* handle, unsigned diskmax);
+
 #endif
 
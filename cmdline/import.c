@@ -18,6 +18,7 @@
 #include "portable.h"
 
 #include "support.h"
+#include "stream.h"
 #include "import.h"
 
 /****************************************************************************/
@@ -52,25 +53,56 @@ static inline tommy_uint32_t import_block_hash(const unsigned char* hash)
 	return hash[0] | ((uint32_t)hash[1] << 8) | ((uint32_t)hash[2] << 16) | ((uint32_t)hash[3] << 24);
 }
 
-static void import_file(struct snapraid_state* state, const char* path, uint64_t size)
+/**
+ * Default number of threads used to hash the import files.
+ * It can be changed with the --hash-threads option.
+ */
+#define IMPORT_THREAD_DEFAULT 4
+
+static void import_file(struct snapraid_state* state, const char* path, struct stat* st)
 {
 	struct snapraid_import_file* file;
 	block_off_t i;
 	data_off_t offset;
-	void* buffer;
-	int ret;
-	int f;
-	int flags;
+	data_off_t size = st->st_size;
 	unsigned block_size = state->block_size;
-	struct advise_struct advise;
 
 	file = malloc_nofail(sizeof(struct snapraid_import_file));
 	file->path = strdup_nofail(path);
 	file->size = size;
+	file->mtime_sec = st->st_mtime;
+	file->mtime_nsec = STAT_NSEC(st);
+	file->inode = st->st_ino;
 	file->blockmax = (size + block_size - 1) / block_size;
 	file->blockimp = malloc_nofail(file->blockmax * sizeof(struct snapraid_import_block));
 
-	buffer = malloc_nofail(block_size);
+	offset = 0;
+	for (i = 0; i < file->blockmax; ++i) {
+		struct snapraid_import_block* block = &file->blockimp[i];
+		unsigned read_size = block_size;
+		if (read_size > size)
+			read_size = size;
+
+		block->file = file;
+		block->offset = offset;
+		block->size = read_size;
+
+		offset += read_size;
+		size -= read_size;
+	}
+
+	/* the hashes are computed later, only if not cached */
+	tommy_list_insert_tail(&state->importlist, &file->nodelist, file);
+}
+
+static void import_file_hash(struct snapraid_state* state, struct snapraid_import_file* file, void* buffer)
+{
+	block_off_t i;
+	int ret;
+	int f;
+	int flags;
+	const char* path = file->path;
+	struct advise_struct advise;
 
 	advise_init(&advise, state->file_mode);
 
@@ -92,12 +124,9 @@ static void import_file(struct snapraid_state* state, const char* path, uint64_t
 		/* LCOV_EXCL_STOP */
 	}
 
-	offset = 0;
 	for (i = 0; i < file->blockmax; ++i) {
 		struct snapraid_import_block* block = &file->blockimp[i];
-		unsigned read_size = block_size;
-		if (read_size > size)
-			read_size = size;
+		unsigned read_size = block->size;
 
 		ret = read(f, buffer, read_size);
 		if (ret < 0 || (unsigned)ret != read_size) {
@@ -107,22 +136,13 @@ static void import_file(struct snapraid_state* state, const char* path, uint64_t
 			/* LCOV_EXCL_STOP */
 		}
 
-		block->file = file;
-		block->offset = offset;
-		block->size = read_size;
-
 		memhash(state->hash, state->hashseed, block->hash, buffer, read_size);
-		tommy_hashdyn_insert(&state->importset, &block->nodeset, block, import_block_hash(block->hash));
 
 		/* if we are in a rehash state */
 		if (state->prevhash != HASH_UNDEFINED) {
 			/* compute also the previous hash */
 			memhash(state->prevhash, state->prevhashseed, block->prevhash, buffer, read_size);
-			tommy_hashdyn_insert(&state->previmportset, &block->prevnodeset, block, import_block_hash(block->prevhash));
 		}
-
-		offset += read_size;
-		size -= read_size;
 	}
 
 	ret = close(f);
@@ -132,10 +152,51 @@ static void import_file(struct snapraid_state* state, const char* path, uint64_t
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
+}
 
-	tommy_list_insert_tail(&state->importlist, &file->nodelist, file);
+/**
+ * Files to hash, shared by all the import threads.
+ */
+struct snapraid_import_job {
+	struct snapraid_state* state;
+	struct snapraid_import_file** file_map; /**< Files to hash. */
+	unsigned file_max; /**< Number of files to hash. */
+	unsigned file_next; /**< Next file to hash. Protected by the mutex. */
+#if HAVE_PTHREAD
+	pthread_mutex_t mutex;
+#endif
+};
+
+static void* import_thread(void* arg)
+{
+	struct snapraid_import_job* job = arg;
+	void* buffer;
+
+	buffer = malloc_nofail(job->state->block_size);
+
+	while (1) {
+		struct snapraid_import_file* file;
+
+#if HAVE_PTHREAD
+		thread_mutex_lock(&job->mutex);
+#endif
+		if (job->file_next < job->file_max)
+			file = job->file_map[job->file_next++];
+		else
+			file = 0;
+#if HAVE_PTHREAD
+		thread_mutex_unlock(&job->mutex);
+#endif
+
+		if (!file)
+			break;
+
+		import_file_hash(job->state, file, buffer);
+	}
 
 	free(buffer);
+
+	return 0;
 }
 
 void import_file_free(struct snapraid_import_file* file)
@@ -284,7 +345,7 @@ static void import_dir(struct snapraid_state* state, const char* dir)
 #endif
 
 		if (S_ISREG(st.st_mode)) {
-			import_file(state, path_next, st.st_size);
+			import_file(state, path_next, &st);
 		} else if (S_ISDIR(st.st_mode)) {
 			pathslash(path_next, sizeof(path_next));
 			import_dir(state, path_next);
@@ -299,9 +360,267 @@ static void import_dir(struct snapraid_state* state, const char* dir)
 	}
 }
 
+/****************************************************************************/
+/* import cache */
+
+/**
+ * Cached hashes of an import file.
+ * The file is identified by path, size, modification time and inode.
+ */
+struct snapraid_import_cache {
+	char* path; /**< Full path of the file. */
+	data_off_t size; /**< Size of the file. */
+	int64_t mtime_sec; /**< Modification time. */
+	int mtime_nsec; /**< Modification time nanoseconds. */
+	uint64_t inode; /**< Inode. */
+	block_off_t blockmax; /**< Number of blocks. */
+	unsigned char* hash; /**< Hashes of the blocks, followed by the previous hashes if in rehash state. */
+
+	/* nodes for data structures */
+	tommy_hashdyn_node node;
+};
+
+static int import_cache_compare(const void* void_arg, const void* void_data)
+{
+	const char* arg = void_arg;
+	const struct snapraid_import_cache* cache = void_data;
+
+	return strcmp(arg, cache->path);
+}
+
+static void import_cache_free(struct snapraid_import_cache* cache)
+{
+	free(cache->path);
+	free(cache->hash);
+	free(cache);
+}
+
+/**
+ * Number of hashes stored for each block.
+ */
+static unsigned import_cache_level(struct snapraid_state* state)
+{
+	return state->prevhash != HASH_UNDEFINED ? 2 : 1;
+}
+
+/**
+ * Read the cache, ignoring it if invalid, or if it refers to a different hash or block size.
+ */
+static void import_cache_read(struct snapraid_state* state, const char* path, tommy_hashdyn* cacheset)
+{
+	STREAM* f;
+	unsigned char header[12];
+	unsigned char seed[HASH_MAX];
+	unsigned level = import_cache_level(state);
+	uint32_t value;
+	uint32_t count;
+	uint32_t crc_computed;
+	uint32_t crc;
+	uint32_t i;
+	int ret;
+
+	f = sopen_read(path);
+	if (f == 0) {
+		if (errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Error opening the import cache '%s'. %s.\n", path, strerror(errno));
+			/* LCOV_EXCL_STOP */
+		}
+		return;
+	}
+
+	ret = sread(f, header, 12);
+	if (ret < 0 || memcmp(header, "SNAPIMP1\n\3\0\0", 12) != 0)
+		goto bail;
+
+	/* a cache with different hashes is stale */
+	if (sgetb32(f, &value) < 0 || value != state->block_size)
+		goto stale;
+	if (sgetc(f) != (int)state->hash)
+		goto stale;
+	if (sread(f, seed, HASH_MAX) < 0 || memcmp(seed, state->hashseed, HASH_MAX) != 0)
+		goto stale;
+	if (sgetc(f) != (int)state->prevhash)
+		goto stale;
+	if (state->prevhash != HASH_UNDEFINED) {
+		if (sread(f, seed, HASH_MAX) < 0 || memcmp(seed, state->prevhashseed, HASH_MAX) != 0)
+			goto stale;
+	}
+
+	if (sgetb32(f, &count) < 0)
+		goto bail;
+
+	for (i = 0; i < count; ++i) {
+		struct snapraid_import_cache* cache;
+		char buffer[PATH_MAX];
+		uint64_t size;
+		uint64_t mtime_sec;
+		uint32_t mtime_nsec;
+		uint64_t inode;
+
+		if (sgetbs(f, buffer, sizeof(buffer)) < 0
+			|| sgetb64(f, &size) < 0
+			|| sgetb64(f, &mtime_sec) < 0
+			|| sgetb32(f, &mtime_nsec) < 0
+			|| sgetb64(f, &inode) < 0)
+			goto bail;
+
+		cache = malloc_nofail(sizeof(struct snapraid_import_cache));
+		cache->path = strdup_nofail(buffer);
+		cache->size = size;
+		cache->mtime_sec = mtime_sec;
+		cache->mtime_nsec = (int)mtime_nsec;
+		cache->inode = inode;
+		cache->blockmax = (size + state->block_size - 1) / state->block_size;
+		cache->hash = malloc_nofail((size_t)cache->blockmax * level * HASH_MAX);
+		tommy_hashdyn_insert(cacheset, &cache->node, cache, tommy_strhash_u32(0, cache->path));
+
+		if (sread(f, cache->hash, cache->blockmax * level * HASH_MAX) < 0)
+			goto bail;
+	}
+
+	crc_computed = scrc(f);
+
+	if (sgetble32(f, &crc) < 0 || crc != crc_computed)
+		goto bail;
+
+	sclose(f);
+	return;
+
+bail:
+	/* LCOV_EXCL_START */
+	log_fatal("WARNING! Ignoring the invalid import cache '%s'.\n", path);
+	/* LCOV_EXCL_STOP */
+stale:
+	tommy_hashdyn_foreach(cacheset, (tommy_foreach_func*)import_cache_free);
+	tommy_hashdyn_done(cacheset);
+	tommy_hashdyn_init(cacheset);
+	sclose(f);
+}
+
+/**
+ * Copy the cached hashes in the file, if it didn't change.
+ * Return 1 if the hashes were copied.
+ */
+static int import_cache_apply(struct snapraid_state* state, tommy_hashdyn* cacheset, struct snapraid_import_file* file)
+{
+	struct snapraid_import_cache* cache;
+	block_off_t i;
+
+	cache = tommy_hashdyn_search(cacheset, import_cache_compare, file->path, tommy_strhash_u32(0, file->path));
+	if (!cache)
+		return 0;
+
+	if (cache->size != file->size
+		|| cache->mtime_sec != file->mtime_sec
+		|| cache->mtime_nsec != file->mtime_nsec
+		|| cache->inode != file->inode)
+		return 0;
+
+	for (i = 0; i < file->blockmax; ++i) {
+		struct snapraid_import_block* block = &file->blockimp[i];
+
+		memcpy(block->hash, cache->hash + i * HASH_MAX, HASH_MAX);
+		if (state->prevhash != HASH_UNDEFINED)
+			memcpy(block->prevhash, cache->hash + (file->blockmax + i) * HASH_MAX, HASH_MAX);
+	}
+
+
+	return 1;
+}
+
+/**
+ * Write the cache with all the files imported.
+ * On error the cache is not updated, but the import continues.
+ */
+static void import_cache_write(struct snapraid_state* state, const char* path)
+{
+	STREAM* f;
+	char tmp[PATH_MAX];
+	tommy_node* i;
+	block_off_t j;
+
+	pathprint(tmp, sizeof(tmp), "%s.tmp", path);
+
+	/* ensure to delete a previous stale file */
+	if (remove(tmp) != 0 && errno != ENOENT) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error removing the stale import cache '%s'. %s.\n", tmp, strerror(errno));
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	f = sopen_write(tmp);
+	if (f == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error creating the import cache '%s'. %s.\n", tmp, strerror(errno));
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	swrite("SNAPIMP1\n\3\0\0", 12, f);
+	sputb32(state->block_size, f);
+	sputc(state->hash, f);
+	swrite(state->hashseed, HASH_MAX, f);
+	sputc(state->prevhash, f);
+	if (state->prevhash != HASH_UNDEFINED)
+		swrite(state->prevhashseed, HASH_MAX, f);
+
+	sputb32(tommy_list_count(&state->importlist), f);
+	for (i = tommy_list_head(&state->importlist); i != 0; i = i->next) {
+		struct snapraid_import_file* file = i->data;
+
+		sputbs(file->path, f);
+		sputb64(file->size, f);
+		sputb64(file->mtime_sec, f);
+		sputb32(file->mtime_nsec, f);
+		sputb64(file->inode, f);
+		for (j = 0; j < file->blockmax; ++j)
+			swrite(file->blockimp[j].hash, HASH_MAX, f);
+		if (state->prevhash != HASH_UNDEFINED) {
+			for (j = 0; j < file->blockmax; ++j)
+				swrite(file->blockimp[j].prevhash, HASH_MAX, f);
+		}
+	}
+
+	sputble32(scrc(f), f);
+
+	if (serror(f) || sflush(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error writing the import cache '%s'. %s.\n", tmp, strerror(errno));
+		sclose(f);
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (sclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error closing the import cache '%s'. %s.\n", tmp, strerror(errno));
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (rename(tmp, path) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error renaming the import cache '%s' to '%s'. %s.\n", tmp, path, strerror(errno));
+		remove(tmp);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
 void state_import(struct snapraid_state* state, const char* dir)
 {
 	char path[PATH_MAX];
+	char cache_path[PATH_MAX];
+	tommy_hashdyn cacheset;
+	struct snapraid_import_job job;
+	struct snapraid_content* content;
+	tommy_node* i;
+	unsigned cache_count;
+	unsigned cached;
+	unsigned thread_max;
 
 	msg_progress("Importing...\n");
 
@@ -318,5 +637,78 @@ void state_import(struct snapraid_state* state, const char* dir)
 	pathslash(path, sizeof(path));
 
 	import_dir(state, path);
+
+	/* the cache is stored next to the first content file, as the import dir may be read-only */
+	content = tommy_list_head(&state->contentlist)->data;
+	pathprint(cache_path, sizeof(cache_path), "%s.import", content->content);
+
+	tommy_hashdyn_init(&cacheset);
+	import_cache_read(state, cache_path, &cacheset);
+	cache_count = tommy_hashdyn_count(&cacheset);
+
+	/* reuse the cached hashes, and collect the files to hash */
+	job.state = state;
+	job.file_map = malloc_nofail(tommy_list_count(&state->importlist) * sizeof(struct snapraid_import_file*));
+	job.file_max = 0;
+	job.file_next = 0;
+	cached = 0;
+	for (i = tommy_list_head(&state->importlist); i != 0; i = i->next) {
+		struct snapraid_import_file* file = i->data;
+
+		if (import_cache_apply(state, &cacheset, file))
+			++cached;
+		else
+			job.file_map[job.file_max++] = file;
+	}
+
+	tommy_hashdyn_foreach(&cacheset, (tommy_foreach_func*)import_cache_free);
+	tommy_hashdyn_done(&cacheset);
+
+	if (cached != 0)
+		msg_progress("Using the import cache for %u files...\n", cached);
+
+	/* hash the new and changed files in parallel */
+	thread_max = state->opt.hash_threads != 0 ? state->opt.hash_threads : IMPORT_THREAD_DEFAULT;
+	if (thread_max > job.file_max)
+		thread_max = job.file_max;
+
+#if HAVE_PTHREAD
+	if (thread_max != 0) {
+		pthread_t* thread_map;
+		unsigned t;
+
+		thread_mutex_init(&job.mutex, 0);
+		thread_map = malloc_nofail(thread_max * sizeof(pthread_t));
+		for (t = 0; t < thread_max; ++t)
+			thread_create(&thread_map[t], 0, import_thread, &job);
+		for (t = 0; t < thread_max; ++t)
+			thread_join(thread_map[t], 0);
+		free(thread_map);
+		thread_mutex_destroy(&job.mutex);
+	}
+#else
+	(void)thread_max;
+	import_thread(&job);
+#endif
+
+	/* insert the blocks in the same order of the directory listing */
+	for (i = tommy_list_head(&state->importlist); i != 0; i = i->next) {
+		struct snapraid_import_file* file = i->data;
+		block_off_t j;
+
+		for (j = 0; j < file->blockmax; ++j) {
+			struct snapraid_import_block* block = &file->blockimp[j];
+
+			tommy_hashdyn_insert(&state->importset, &block->nodeset, block, import_block_hash(block->hash));
+			if (state->prevhash != HASH_UNDEFINED)
+				tommy_hashdyn_insert(&state->previmportset, &block->prevnodeset, block, import_block_hash(block->prevhash));
+		}
+	}
+
+	/* update the cache only if something changed */
+	if (job.file_max != 0 || cache_count != cached)
+		import_cache_write(state, cache_path);
+
+	free(job.file_map);
 }
 
@@ -46,6 +46,9 @@ struct snapraid_import_block {
  */
 struct snapraid_import_file {
 	data_off_t size; /**< Size of the file. */
+	int64_t mtime_sec; /**< Modification time. */
+	int mtime_nsec; /**< Modification time nanoseconds. */
+	uint64_t inode; /**< Inode. */
 	struct snapraid_import_block* blockimp; /**< All the blocks of the file. */
 	block_off_t blockmax; /**< Number of blocks. */
 	char* path; /**< Full path of the file. */
@@ -67,6 +70,8 @@ int state_import_fetch(struct snapraid_state* state, int prevhash, struct snapra
 
 /**
  * Import files from the specified directory.
+ * The hashes of the files are cached in a ".import" file next to the first content file,
+ * and only new or changed files are read again.
  */
 void state_import(struct snapraid_state* state, const char* dir);
 
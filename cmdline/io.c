@@ -18,6 +18,7 @@
 #include "portable.h"
 
 #include "io.h"
+#include "raid/raid.h"
 
 void (*io_start)(struct snapraid_io* io,
 	block_off_t blockstart, block_off_t blockmax,
@@ -35,12 +36,13 @@ void (*io_refresh)(struct snapraid_io* io) = 0;
 /**
  * Get the next block position to process.
  */
-static block_off_t io_position_next(struct snapraid_io* io)
+static block_off_t io_position_next(struct snapraid_io* io, int* plan)
 {
 	block_off_t blockcur;
 
 	/* get the next position */
-	while (io->block_next < io->block_max && !io->block_is_enabled(io->block_arg, io->block_next))
+	*plan = 0;
+	while (io->block_next < io->block_max && (*plan = io->block_is_enabled(io->block_arg, io->block_next)) == 0)
 		++io->block_next;
 
 	blockcur = io->block_next;
@@ -51,10 +53,101 @@ static block_off_t io_position_next(struct snapraid_io* io)
 	return blockcur;
 }
 
+/**
+ * Wait if the disk of the worker is going faster than the allowed rate.
+ *
+ * It's called before reading or writing a block.
+ */
+static void io_throttle(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	/* the lanes of a parity reader read different split disks */
+	struct snapraid_worker* owner = worker->handle ? worker->parent : worker;
+	uint64_t now;
+	uint64_t ahead;
+
+	if (io->throttle_rate == 0)
+		return;
+
+	now = tick_ms() * 1000;
+
+#if HAVE_PTHREAD
+	/* the lanes of a data reader share the same bucket */
+	if (io->lane_max != 0 && owner->handle != 0)
+		thread_mutex_lock(&io->io_mutex);
+#endif
+
+	/* an idle disk doesn't accumulate more than the burst */
+	if (owner->throttle_time < now)
+		owner->throttle_time = now;
+
+	/* pay for the new blocks */
+	owner->throttle_time += worker->batch * (uint64_t)io->state->block_size * 1000000ULL / io->throttle_rate;
+
+	ahead = owner->throttle_time - now;
+
+#if HAVE_PTHREAD
+	if (io->lane_max != 0 && owner->handle != 0)
+		thread_mutex_unlock(&io->io_mutex);
+#endif
+
+	/* wait for the part exceeding the burst */
+	if (ahead > IO_THROTTLE_BURST)
+		sleep_ms((ahead - IO_THROTTLE_BURST) / 1000);
+}
+
+/**
+ * Name of the disk of the worker, for the trace.
+ */
+static const char* io_worker_name(struct snapraid_worker* worker)
+{
+	if (worker->handle)
+		return worker->handle->disk ? worker->handle->disk->name : "data";
+
+	return lev_config_name(worker->parity_handle->level);
+}
+
+/**
+ * Run the worker function on the task, measuring its latency.
+ *
+ * \param name Name of the operation, for the trace.
+ */
+static void io_task_run(struct snapraid_worker* worker, struct snapraid_task* task, const char* name)
+{
+	task->tick_start = tick();
+
+	/* simulate a slower disk for the bench */
+	if (worker->io->state->opt.bench_latency)
+		sleep_ms(worker->io->state->opt.bench_latency);
+
+	worker->func(worker, task);
+
+	task->tick_done = tick();
+
+	histo_add(&worker->histo_io, task->tick_done - task->tick_start);
+
+	trace_event(worker, io_worker_name(worker), name, task->tick_start, task->tick_done, task->position);
+}
+
+/**
+ * Measure the time the completed task waited for the caller.
+ */
+static void io_task_wait(struct snapraid_worker* worker, struct snapraid_task* task)
+{
+	uint64_t now;
+
+	/* the dummy tasks are not read */
+	if (task->state == TASK_STATE_EMPTY)
+		return;
+
+	now = tick();
+
+	histo_add(&worker->histo_wait, now > task->tick_done ? now - task->tick_done : 0);
+}
+
 /**
  * Setup the next pending task for all readers.
  */
-static void io_reader_sched(struct snapraid_io* io, int task_index, block_off_t blockcur)
+static void io_reader_sched(struct snapraid_io* io, int task_index, block_off_t blockcur, int plan)
 {
 	unsigned i;
 
@@ -75,11 +168,18 @@ static void io_reader_sched(struct snapraid_io* io, int task_index, block_off_t
 			task->disk = 0;
 		task->buffer = io->buffer_map[task_index][worker->buffer_skew + i];
 		task->position = blockcur;
+		task->plan = plan;
 		task->block = 0;
 		task->file = 0;
 		task->file_pos = 0;
 		task->read_size = 0;
+		task->is_hashed = 0;
+		task->is_zero = 0;
 		task->is_timestamp_different = 0;
+		task->hash_pending = 0;
+		task->ring_state = RING_STATE_NONE;
+		task->pending = 1;
+		task->taken = 0;
 	}
 }
 
@@ -100,11 +200,16 @@ static void io_writer_sched(struct snapraid_io* io, int task_index, block_off_t
 		task->disk = 0;
 		task->buffer = io->buffer_map[task_index][worker->buffer_skew + i];
 		task->position = blockcur;
+		task->plan = 0;
 		task->block = 0;
 		task->file = 0;
 		task->file_pos = 0;
 		task->read_size = 0;
+		task->is_hashed = 0;
+		task->is_zero = 0;
 		task->is_timestamp_different = 0;
+		task->hash_pending = 0;
+		task->ring_state = RING_STATE_NONE;
 	}
 }
 
@@ -125,11 +230,16 @@ static void io_writer_sched_empty(struct snapraid_io* io, int task_index, block_
 		task->disk = 0;
 		task->buffer = 0;
 		task->position = blockcur;
+		task->plan = 0;
 		task->block = 0;
 		task->file = 0;
 		task->file_pos = 0;
 		task->read_size = 0;
+		task->is_hashed = 0;
+		task->is_zero = 0;
 		task->is_timestamp_different = 0;
+		task->hash_pending = 0;
+		task->ring_state = RING_STATE_NONE;
 	}
 }
 
@@ -139,14 +249,15 @@ static void io_writer_sched_empty(struct snapraid_io* io, int task_index, block_
 static block_off_t io_read_next_mono(struct snapraid_io* io, void*** buffer)
 {
 	block_off_t blockcur_schedule;
+	int plan;
 
 	/* reset the index */
 	io->reader_index = 0;
 
-	blockcur_schedule = io_position_next(io);
+	blockcur_schedule = io_position_next(io, &plan);
 
 	/* schedule the next read */
-	io_reader_sched(io, 0, blockcur_schedule);
+	io_reader_sched(io, 0, blockcur_schedule, plan);
 
 	/* set the buffer to use */
 	*buffer = io->buffer_map[0];
@@ -206,8 +317,10 @@ static struct snapraid_task* io_task_read_mono(struct snapraid_io* io, unsigned
 	task = &worker->task_map[0];
 
 	/* do the work */
-	if (task->state != TASK_STATE_EMPTY)
-		worker->func(worker, task);
+	if (task->state != TASK_STATE_EMPTY) {
+		io_throttle(io, worker);
+		io_task_run(worker, task, "read");
+	}
 
 	/* return the position */
 	*pos = i - base;
@@ -244,8 +357,10 @@ static void io_parity_write_mono(struct snapraid_io* io, unsigned* pos, unsigned
 	io->writer_error[i] = 0;
 
 	/* do the work */
-	if (task->state != TASK_STATE_EMPTY)
-		worker->func(worker, task);
+	if (task->state != TASK_STATE_EMPTY) {
+		io_throttle(io, worker);
+		io_task_run(worker, task, "write");
+	}
 
 	/* return the position */
 	*pos = i;
@@ -266,9 +381,86 @@ static void io_start_mono(struct snapraid_io* io,
 	io->block_next = blockstart;
 }
 
+/**
+ * Collect the latency stats of the worker in its disk.
+ */
+static void io_stats_worker(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	struct snapraid_histo* histo_io;
+	struct snapraid_histo* histo_wait;
+
+	if (worker->handle) {
+		struct snapraid_disk* disk = worker->handle->disk;
+
+		if (!disk)
+			return;
+
+		histo_io = &disk->histo_io;
+		histo_wait = &disk->histo_wait;
+	} else {
+		struct snapraid_parity* parity = &io->state->parity[worker->parity_handle->level];
+
+		histo_io = &parity->histo_io;
+		histo_wait = &parity->histo_wait;
+	}
+
+	histo_merge(histo_io, &worker->histo_io);
+	histo_merge(histo_wait, &worker->histo_wait);
+
+	/* collect them only once */
+	histo_init(&worker->histo_io);
+	histo_init(&worker->histo_wait);
+}
+
+/**
+ * Collect the latency stats of all the workers.
+ */
+static void io_stats(struct snapraid_io* io)
+{
+	unsigned i;
+
+	for (i = 0; i < io->reader_max; ++i)
+		io_stats_worker(io, &io->reader_map[i]);
+	for (i = 0; i < io->data_count * io->lane_max; ++i)
+		io_stats_worker(io, &io->lane_map[i]);
+	for (i = 0; i < io->parity_count * io->split_lane_max; ++i)
+		io_stats_worker(io, &io->split_lane_map[i]);
+	for (i = 0; i < io->writer_max; ++i)
+		io_stats_worker(io, &io->writer_map[i]);
+}
+
 static void io_stop_mono(struct snapraid_io* io)
 {
-	(void)io;
+	io_stats(io);
+}
+
+/**
+ * Compute the parity of the range of the blocks, and add the old parity if required.
+ */
+static void io_raid_range(struct snapraid_io* io, void** v, size_t begin, size_t end)
+{
+	int i;
+
+	/* if the range is empty, nothing to do */
+	if (begin == end)
+		return;
+
+	for (i = 0; i < io->raid_nd + io->raid_np; ++i)
+		v[i] = (unsigned char*)io->raid_v[i] + begin;
+
+	raid_gen(io->raid_nd, io->raid_np, end - begin, v);
+
+	/* add it to the old parity, as P' = P ^ gen(old ^ new) */
+	/* with gen() with one parity being a plain xor */
+	if (io->raid_old) {
+		for (i = 0; i < io->raid_np; ++i) {
+			void* xor_vector[3];
+			xor_vector[0] = (unsigned char*)io->raid_old[i] + begin;
+			xor_vector[1] = (unsigned char*)io->raid_v[io->raid_nd + i] + begin;
+			xor_vector[2] = (unsigned char*)io->raid_out[i] + begin;
+			raid_gen(2, 1, end - begin, xor_vector);
+		}
+	}
 }
 
 /*****************************************************************************/
@@ -278,185 +470,862 @@ static void io_stop_mono(struct snapraid_io* io)
 #if HAVE_PTHREAD
 
 /**
- * Get the next task to work on for a reader.
+ * If the worker uses the pool of buffers.
+ */
+static int io_pool_worker(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	return io->pool_max != 0 && worker->handle != 0;
+}
+
+/**
+ * If the worker can use another buffer.
  *
- * This is the synchronization point for workers with the io.
+ * This is always true for the workers not using the pool.
  */
-static struct snapraid_task* io_reader_step(struct snapraid_worker* worker)
+static int io_pool_allow(struct snapraid_io* io, struct snapraid_worker* worker)
 {
-	struct snapraid_io* io = worker->io;
+	return !io_pool_worker(io, worker) || worker->held < worker->depth;
+}
 
-	/* the synchronization is protected by the io mutex */
-	thread_mutex_lock(&io->io_mutex);
+/**
+ * Get a buffer from the pool, for the task of the worker at the specified index.
+ */
+static void io_pool_acquire(struct snapraid_io* io, struct snapraid_worker* worker, unsigned task_index)
+{
+	struct snapraid_task* task = &worker->task_map[task_index];
+	unsigned i = worker - io->reader_map;
+	void* buffer;
 
-	while (1) {
-		unsigned next_index;
+	/* ensured by the depths of all the workers */
+	assert(io->pool_free_count != 0);
 
-		/* check if the worker has to exit */
-		/* even if there is work to do */
-		if (io->done) {
-			thread_mutex_unlock(&io->io_mutex);
-			return 0;
-		}
+	buffer = io->pool_free[--io->pool_free_count];
 
-		/* get the next pending task */
-		next_index = (worker->index + 1) % io->io_max;
+	/* data buffers have no skew */
+	io->buffer_map[task_index][i] = buffer;
+	task->buffer = buffer;
+	++worker->held;
+}
 
-		/* if the queue of pending tasks is not empty */
-		if (next_index != io->reader_index) {
-			struct snapraid_task* task;
+/**
+ * Return to the pool the buffers of all the tasks at the specified index.
+ */
+static void io_pool_release(struct snapraid_io* io, unsigned task_index)
+{
+	unsigned i;
 
-			/* the index that the IO may be waiting for */
-			unsigned waiting_index = io->reader_index;
+	for (i = io->data_base; i < io->data_base + io->data_count; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
+		struct snapraid_task* task = &worker->task_map[task_index];
 
-			/* the index that worker just completed */
-			unsigned done_index = worker->index;
+		if (!task->buffer)
+			continue;
 
-			/* get the new working task */
-			worker->index = next_index;
-			task = &worker->task_map[worker->index];
+		io->pool_free[io->pool_free_count++] = task->buffer;
+		io->buffer_map[task_index][i] = 0;
+		task->buffer = 0;
+		--worker->held;
+	}
+}
 
-			/* if the just completed task is at this index */
-			if (done_index == waiting_index) {
-				/* notify the IO that a new read is complete */
-				thread_cond_signal_and_unlock(&io->read_done, &io->io_mutex);
-			} else {
-				thread_mutex_unlock(&io->io_mutex);
-			}
+/**
+ * Number of free buffers the workers are allowed to take.
+ */
+static unsigned io_pool_reserved(struct snapraid_io* io)
+{
+	unsigned reserved;
+	unsigned i;
 
-			/* return the new task */
-			return task;
-		}
+	reserved = 0;
+	for (i = io->data_base; i < io->data_base + io->data_count; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
 
-		/* otherwise wait for a read_sched event */
-		thread_cond_wait(&io->read_sched, &io->io_mutex);
+		if (worker->depth > worker->held)
+			reserved += worker->depth - worker->held;
 	}
+
+	return reserved;
 }
 
 /**
- * Get the next task to work on for a writer.
+ * Adapt the depths of the workers, giving more buffers to the ones
+ * the caller waited for in the latest period.
  *
- * This is the synchronization point for workers with the io.
+ * The buffers are taken from the free ones, or from the workers
+ * the caller never waited for.
  */
-static struct snapraid_task* io_writer_step(struct snapraid_worker* worker, int state)
+static void io_pool_adapt(struct snapraid_io* io)
 {
-	struct snapraid_io* io = worker->io;
-	int error_index;
-
-	/* the synchronization is protected by the io mutex */
-	thread_mutex_lock(&io->io_mutex);
-
-	/* counts the number of errors in the global state */
-	error_index = state - IO_WRITER_ERROR_BASE;
-	if (error_index >= 0 && error_index < IO_WRITER_ERROR_MAX)
-		++io->writer_error[error_index];
+	unsigned i;
 
 	while (1) {
-		unsigned next_index;
-
-		/* get the next pending task */
-		next_index = (worker->index + 1) % io->io_max;
-
-		/* if the queue of pending tasks is not empty */
-		if (next_index != io->writer_index) {
-			struct snapraid_task* task;
+		struct snapraid_worker* wanting = 0;
+		struct snapraid_worker* giving = 0;
 
-			/* the index that the IO may be waiting for */
-			unsigned waiting_index = (io->writer_index + 1) % io->io_max;
-
-			/* the index that worker just completed */
-			unsigned done_index = worker->index;
-
-			/* get the new working task */
-			worker->index = next_index;
-			task = &worker->task_map[worker->index];
+		/* the most waited worker, and the deepest one never waited */
+		for (i = io->data_base; i < io->data_base + io->data_count; ++i) {
+			struct snapraid_worker* worker = &io->reader_map[i];
 
-			/* if the just completed task is at this index */
-			if (done_index == waiting_index) {
-				/* notify the IO that a new write is complete */
-				thread_cond_signal_and_unlock(&io->write_done, &io->io_mutex);
-			} else {
-				thread_mutex_unlock(&io->io_mutex);
+			if (worker->wait_count != 0 && worker->depth < io->io_max) {
+				if (!wanting || worker->wait_count > wanting->wait_count)
+					wanting = worker;
 			}
 
-			/* return the new task */
-			return task;
+			if (worker->wait_count == 0 && worker->depth > IO_DEPTH_MIN) {
+				if (!giving || worker->depth > giving->depth)
+					giving = worker;
+			}
 		}
 
-		/* check if the worker has to exit */
-		/* but only if there is no work to do */
-		if (io->done) {
-			thread_mutex_unlock(&io->io_mutex);
-			return 0;
+		if (!wanting)
+			break;
+
+		/* if no free buffer, take it from another worker */
+		/* it will be really available only when that worker releases it */
+		if (io_pool_reserved(io) + (wanting->depth >= wanting->held) > io->pool_free_count) {
+			if (giving)
+				--giving->depth;
+			break;
 		}
 
-		/* otherwise wait for a write_sched event */
-		thread_cond_wait(&io->write_sched, &io->io_mutex);
+		++wanting->depth;
+
+		/* one buffer at time for each worker */
+		wanting->wait_count = 0;
 	}
+
+	/* start a new period */
+	for (i = io->data_base; i < io->data_base + io->data_count; ++i)
+		io->reader_map[i].wait_count = 0;
+	io->pool_period = 0;
 }
 
 /**
- * Get the next block position to operate on.
+ * Wait for new tasks, until woken up by the IO.
  *
- * This is the synchronization point for workers with the io.
+ * It must be called with the io mutex locked.
  */
-static block_off_t io_read_next_thread(struct snapraid_io* io, void*** buffer)
+static void io_worker_sleep(struct snapraid_worker* worker)
 {
-	block_off_t blockcur_schedule;
-	block_off_t blockcur_caller;
-	unsigned i;
+	worker->sleeping = 1;
+	thread_cond_wait(&worker->sched, &worker->io->io_mutex);
+	worker->sleeping = 0;
+}
 
-	/* get the next parity position to process */
-	blockcur_schedule = io_position_next(io);
+/**
+ * Wake up a sleeping worker.
+ *
+ * It must be called with the io mutex locked.
+ */
+static void io_worker_wake(struct snapraid_worker* worker)
+{
+	if (worker->sleeping) {
+		/* don't signal it again before it runs */
+		worker->sleeping = 0;
+		thread_cond_signal(&worker->sched);
+	}
+}
 
-	/* ensure that all data/parity was read */
-	assert(io->reader_list[0] == io->reader_max);
+/**
+ * If the worker reads the parity splits with more lanes.
+ */
+static int io_split_worker(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	return io->split_lane_max != 0 && io->ring == 0 && worker->parity_handle != 0 && worker->parity_handle->split_mac > 1;
+}
 
-	/* setup the list of workers to process */
-	for (i = 0; i <= io->reader_max; ++i)
-		io->reader_list[i] = i;
+/**
+ * Get the lane of a parity reader reading the specified split.
+ */
+static struct snapraid_worker* io_split_lane(struct snapraid_io* io, struct snapraid_worker* worker, unsigned split)
+{
+	if (split == 0)
+		return worker;
 
-	/* the synchronization is protected by the io mutex */
-	thread_mutex_lock(&io->io_mutex);
+	return &io->split_lane_map[(worker - io->reader_map - io->parity_base) * io->split_lane_max + split - 1];
+}
 
-	/* schedule the next read */
-	io_reader_sched(io, io->reader_index, blockcur_schedule);
+/**
+ * Get the parity split containing the position of a task.
+ */
+static unsigned io_split_of(struct snapraid_io* io, struct snapraid_worker* worker, struct snapraid_task* task)
+{
+	struct snapraid_parity_handle* parity_handle = worker->parity_handle;
+	struct snapraid_split_handle* split;
+	data_off_t offset;
 
-	/* set the index for the tasks to return to the caller */
-	io->reader_index = (io->reader_index + 1) % io->io_max;
+	/* the tasks past the end are completed without reading */
+	if (task->position >= io->block_max)
+		return 0;
 
-	/* get the position to operate at high level from one task */
-	blockcur_caller = io->reader_map[0].task_map[io->reader_index].position;
+	offset = task->position * (data_off_t)io->state->block_size;
 
-	/* set the buffer to use */
-	*buffer = io->buffer_map[io->reader_index];
+	split = parity_split_find(parity_handle, &offset);
 
-	/* signal all the workers that there is a new pending task */
-	thread_cond_broadcast_and_unlock(&io->read_sched, &io->io_mutex);
+	/* a position outside the parity is reported by the read */
+	if (!split)
+		return parity_handle->split_mac - 1;
 
-	return blockcur_caller;
+	return split - parity_handle->split_map;
 }
 
-static void io_write_preset_thread(struct snapraid_io* io, block_off_t blockcur, int skip)
+/**
+ * Get the oldest task not yet taken in the split of a lane.
+ *
+ * It must be called with the io mutex locked.
+ */
+static struct snapraid_task* io_split_next(struct snapraid_io* io, struct snapraid_worker* lane)
 {
-	(void)io;
-	(void)blockcur;
-	(void)skip;
+	struct snapraid_worker* worker = lane->parent;
+	unsigned i;
+
+	/* start from the one the IO is going to wait for */
+	for (i = 0; i < io->io_max; ++i) {
+		struct snapraid_task* task = &worker->task_map[(io->reader_index + i) % io->io_max];
+
+		if (!task->taken && io_split_of(io, worker, task) == lane->split)
+			return task;
+	}
+
+	return 0;
 }
 
-static void io_write_next_thread(struct snapraid_io* io, block_off_t blockcur, int skip, int* writer_error)
+/**
+ * If a sleeping reader has enough tasks to process to be woken up.
+ *
+ * The reader is woken up only when it can fill half of its read-ahead,
+ * to process more tasks for each wake up.
+ * It's never too late, because the reader still has the other half
+ * already read, before the IO has to wait for it.
+ */
+static int io_reader_ready(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	unsigned room;
+	unsigned limit;
+
+	/* tasks not yet taken, excluding the one at the IO index */
+	room = (io->reader_index + io->io_max - worker->index - 1) % io->io_max;
+	limit = io->io_max - 1;
+
+	/* limited also by the buffers available from the pool */
+	if (io_pool_worker(io, worker)) {
+		unsigned avail = worker->depth > worker->held ? worker->depth - worker->held : 0;
+		if (room > avail)
+			room = avail;
+		limit = worker->depth;
+	}
+
+	return room != 0 && 2 * room >= limit;
+}
+
+/**
+ * Wake up the sleeping readers and lanes with enough tasks to process.
+ *
+ * It must be called with the io mutex locked.
+ */
+static void io_reader_wake(struct snapraid_io* io)
 {
 	unsigned i;
 
-	/* ensure that all parity was written */
-	assert(io->writer_list[0] == io->writer_max);
+	for (i = 0; i < io->reader_max; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
 
-	/* setup the list of workers to process */
-	for (i = 0; i <= io->writer_max; ++i)
-		io->writer_list[i] = i;
+		if (io_split_worker(io, worker))
+			continue;
 
-	/* the synchronization is protected by the io mutex */
-	thread_mutex_lock(&io->io_mutex);
+		if (worker->sleeping && io_reader_ready(io, worker))
+			io_worker_wake(worker);
+	}
+
+	for (i = 0; i < io->data_count * io->lane_max; ++i) {
+		struct snapraid_worker* lane = &io->lane_map[i];
+
+		if (lane->sleeping && io_reader_ready(io, lane->parent))
+			io_worker_wake(lane);
+	}
+
+	/* the split lanes are woken up when a task of their split is available */
+	for (i = io->parity_base; i < io->reader_max; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
+		unsigned j;
+
+		if (!io_split_worker(io, worker))
+			continue;
+
+		for (j = 0; j < worker->parity_handle->split_mac; ++j) {
+			struct snapraid_worker* lane = io_split_lane(io, worker, j);
+
+			if (lane->sleeping && io_split_next(io, lane) != 0)
+				io_worker_wake(lane);
+		}
+	}
+}
+
+/**
+ * Get the next task to work on for a reader.
+ *
+ * This is the synchronization point for workers with the io.
+ */
+static struct snapraid_task* io_reader_step(struct snapraid_worker* worker)
+{
+	struct snapraid_io* io = worker->io;
+
+	/* the synchronization is protected by the io mutex */
+	thread_mutex_lock(&io->io_mutex);
+
+	while (1) {
+		unsigned next_index;
+
+		/* check if the worker has to exit */
+		/* even if there is work to do */
+		if (io->done) {
+			thread_mutex_unlock(&io->io_mutex);
+			return 0;
+		}
+
+		/* get the next pending task */
+		next_index = (worker->index + 1) % io->io_max;
+
+		/* if the queue of pending tasks is not empty, and a buffer is available */
+		if (!worker->task_map[next_index].taken && io_pool_allow(io, worker)) {
+			struct snapraid_task* task;
+
+			/* the index that the IO may be waiting for */
+			unsigned waiting_index = io->reader_index;
+
+			/* the index that worker just completed */
+			unsigned done_index = worker->index;
+
+			/* get the new working task */
+			worker->index = next_index;
+			task = &worker->task_map[worker->index];
+			task->taken = 1;
+
+			/* get the buffer from the pool */
+			if (io_pool_worker(io, worker))
+				io_pool_acquire(io, worker, worker->index);
+
+			/* if the just completed task is at this index, and the IO is waiting for it */
+			if (done_index == waiting_index && io->read_waiting) {
+				/* notify the IO that a new read is complete */
+				thread_cond_signal_and_unlock(&io->read_done, &io->io_mutex);
+			} else {
+				thread_mutex_unlock(&io->io_mutex);
+			}
+
+			/* return the new task */
+			return task;
+		}
+
+		/* otherwise wait to be woken up by the IO */
+		io_worker_sleep(worker);
+	}
+}
+
+/**
+ * If the worker reads with more lanes.
+ */
+static int io_lane_worker(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	return io->lane_max != 0 && worker->handle != 0;
+}
+
+/**
+ * If the reader has completed the task at the specified index.
+ */
+static int io_reader_finished(struct snapraid_io* io, struct snapraid_worker* worker, unsigned task_index)
+{
+	/* with lanes, more tasks are in progress at the same time */
+	if (io_lane_worker(io, worker) || io_split_worker(io, worker))
+		return !worker->task_map[task_index].pending;
+
+	/* otherwise all the taken ones, except the one the worker is at */
+	return worker->task_map[task_index].taken && worker->index != task_index;
+}
+
+/**
+ * Wake up a reader, and its lanes, because the IO is waiting for it.
+ *
+ * The IO may reach a task not yet taken by a reader, if the reader was not
+ * able to run for all the tasks of the ring after being woken up.
+ *
+ * It must be called with the io mutex locked.
+ */
+static void io_reader_wait(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	unsigned i;
+
+	io_worker_wake(worker);
+
+	if (io_lane_worker(io, worker)) {
+		for (i = 0; i < io->lane_max; ++i)
+			io_worker_wake(&io->lane_map[(worker - io->reader_map - io->data_base) * io->lane_max + i]);
+	}
+
+	if (io_split_worker(io, worker)) {
+		for (i = 1; i < worker->parity_handle->split_mac; ++i)
+			io_worker_wake(io_split_lane(io, worker, i));
+	}
+}
+
+/**
+ * Get the next task to work on for a lane of a data reader.
+ *
+ * Like io_reader_step(), but all the lanes of a reader take the
+ * tasks of its ring, and the previous task of the lane is completed here.
+ */
+static struct snapraid_task* io_lane_step(struct snapraid_worker* lane, struct snapraid_task* done)
+{
+	struct snapraid_io* io = lane->io;
+	struct snapraid_worker* worker = lane->parent;
+
+	/* the synchronization is protected by the io mutex */
+	thread_mutex_lock(&io->io_mutex);
+
+	if (done) {
+		done->pending = 0;
+
+		/* if the IO is waiting for this task, notify it */
+		if (done == &worker->task_map[io->reader_index] && io->read_waiting)
+			thread_cond_signal(&io->read_done);
+	}
+
+	while (1) {
+		unsigned next_index;
+
+		/* check if the lane has to exit */
+		/* even if there is work to do */
+		if (io->done) {
+			thread_mutex_unlock(&io->io_mutex);
+			return 0;
+		}
+
+		/* get the next pending task not taken by the other lanes */
+		next_index = (worker->index + 1) % io->io_max;
+
+		/* if the queue of pending tasks is not empty, and a buffer is available */
+		if (!worker->task_map[next_index].taken && io_pool_allow(io, worker)) {
+			struct snapraid_task* task;
+
+			/* get the new working task */
+			worker->index = next_index;
+			task = &worker->task_map[worker->index];
+			task->taken = 1;
+
+			/* get the buffer from the pool */
+			if (io_pool_worker(io, worker))
+				io_pool_acquire(io, worker, worker->index);
+
+			thread_mutex_unlock(&io->io_mutex);
+
+			/* return the new task */
+			return task;
+		}
+
+		/* otherwise wait to be woken up by the IO */
+		io_worker_sleep(lane);
+	}
+}
+
+/**
+ * Get the next task to work on for a lane of a parity reader.
+ *
+ * Like io_lane_step(), but each lane takes only the tasks of its split,
+ * in any order, the oldest first.
+ */
+static struct snapraid_task* io_split_step(struct snapraid_worker* lane, struct snapraid_task* done)
+{
+	struct snapraid_io* io = lane->io;
+	struct snapraid_worker* worker = lane->parent;
+
+	/* the synchronization is protected by the io mutex */
+	thread_mutex_lock(&io->io_mutex);
+
+	if (done) {
+		done->pending = 0;
+
+		/* if the IO is waiting for this task, notify it */
+		if (done == &worker->task_map[io->reader_index] && io->read_waiting)
+			thread_cond_signal(&io->read_done);
+	}
+
+	while (1) {
+		struct snapraid_task* task;
+
+		/* check if the lane has to exit */
+		/* even if there is work to do */
+		if (io->done) {
+			thread_mutex_unlock(&io->io_mutex);
+			return 0;
+		}
+
+		/* get the next pending task of the split */
+		task = io_split_next(io, lane);
+		if (task) {
+			task->taken = 1;
+
+			thread_mutex_unlock(&io->io_mutex);
+
+			/* return the new task */
+			return task;
+		}
+
+		/* otherwise wait to be woken up by the IO */
+		io_worker_sleep(lane);
+	}
+}
+
+/**
+ * Get the next task to work on for a writer.
+ *
+ * This is the synchronization point for workers with the io.
+ */
+static struct snapraid_task* io_writer_step(struct snapraid_worker* worker, int state)
+{
+	struct snapraid_io* io = worker->io;
+	int error_index;
+
+	/* the synchronization is protected by the io mutex */
+	thread_mutex_lock(&io->io_mutex);
+
+	/* counts the number of errors in the global state, one for each task of the batch */
+	error_index = state - IO_WRITER_ERROR_BASE;
+	if (error_index >= 0 && error_index < IO_WRITER_ERROR_MAX)
+		io->writer_error[error_index] += worker->batch;
+
+	/* if a batch is completed, move to its last task */
+	if (worker->batch > 1) {
+		/* the IO may be waiting only for the first task of the batch */
+		unsigned done_index = worker->index;
+
+		worker->index = (worker->index + worker->batch - 1) % io->io_max;
+
+		if (done_index == (io->writer_index + 1) % io->io_max && io->write_waiting)
+			thread_cond_signal(&io->write_done);
+	}
+	worker->batch = 1;
+
+	while (1) {
+		unsigned next_index;
+
+		/* get the next pending task */
+		next_index = (worker->index + 1) % io->io_max;
+
+		/* if the queue of pending tasks is not empty */
+		if (next_index != io->writer_index) {
+			struct snapraid_task* task;
+
+			/* the index that the IO may be waiting for */
+			unsigned waiting_index = (io->writer_index + 1) % io->io_max;
+
+			/* the index that worker just completed */
+			unsigned done_index = worker->index;
+
+			/* get the new working task */
+			worker->index = next_index;
+			task = &worker->task_map[worker->index];
+
+			/* gather the following queued tasks at consecutive positions */
+			if (task->state == TASK_STATE_READY) {
+				while (worker->batch < PARITY_WRITE_VECTOR_MAX) {
+					unsigned batch_index = (worker->index + worker->batch) % io->io_max;
+					struct snapraid_task* batch_task = &worker->task_map[batch_index];
+
+					if (batch_index == io->writer_index
+						|| batch_task->state != TASK_STATE_READY
+						|| batch_task->position != task->position + worker->batch)
+						break;
+
+					++worker->batch;
+				}
+			}
+
+			/* if the just completed task is at this index, and the IO is waiting for it */
+			if (done_index == waiting_index && io->write_waiting) {
+				/* notify the IO that a new write is complete */
+				thread_cond_signal_and_unlock(&io->write_done, &io->io_mutex);
+			} else {
+				thread_mutex_unlock(&io->io_mutex);
+			}
+
+			/* return the new task */
+			return task;
+		}
+
+		/* check if the worker has to exit */
+		/* but only if there is no work to do */
+		if (io->done) {
+			thread_mutex_unlock(&io->io_mutex);
+			return 0;
+		}
+
+		/* otherwise wait to be woken up by the IO */
+		io_worker_sleep(worker);
+	}
+}
+
+/**
+ * Queue in the ring the request of a parity worker.
+ *
+ * If the request cannot be queued, the task is left to the worker function,
+ * that also reports the error.
+ *
+ * \param n Index of the worker, with the writers after the readers.
+ * \param j Index of the parity.
+ */
+static void io_ring_queue(struct snapraid_io* io, struct snapraid_worker* worker, unsigned n, unsigned j, unsigned task_index, int write)
+{
+	struct snapraid_task* task = &worker->task_map[task_index];
+	unsigned block_size = io->state->block_size;
+	struct snapraid_split_handle* split;
+	data_off_t offset;
+
+	task->ring_state = RING_STATE_NONE;
+
+	/* nothing to do */
+	if (task->state != TASK_STATE_READY || task->position >= io->block_max)
+		return;
+
+	offset = task->position * (data_off_t)block_size;
+
+	split = parity_split_find(worker->parity_handle, &offset);
+	if (!split)
+		return;
+
+	if (write) {
+		/* update the valid range, like parity_write() */
+		if (split->valid_size < offset + block_size)
+			split->valid_size = offset + block_size;
+	} else {
+		/* if read is completely out of the valid range, like parity_read() */
+		if (offset >= split->valid_size)
+			return;
+	}
+
+	task->tick_start = tick();
+
+	if (aio_ring_queue(io->ring, write, split->f, task_index * io->parity_count + j, offset, task_index + IO_MAX * (uint64_t)n) != 0)
+		return;
+
+	task->ring_state = RING_STATE_PENDING;
+}
+
+/**
+ * Complete a request of the ring.
+ */
+static void io_ring_complete(struct snapraid_io* io, uint64_t user_data, int result)
+{
+	unsigned block_size = io->state->block_size;
+	unsigned task_index = user_data % IO_MAX;
+	unsigned n = user_data / IO_MAX;
+	int write = n >= io->reader_max;
+	struct snapraid_worker* worker;
+	struct snapraid_task* task;
+
+	if (write)
+		worker = &io->writer_map[n - io->reader_max];
+	else
+		worker = &io->reader_map[n];
+	task = &worker->task_map[task_index];
+
+	task->ring_state = RING_STATE_NONE;
+
+	if (result == (int)block_size) {
+		struct snapraid_split_handle* split;
+		data_off_t offset;
+		int ret;
+
+		offset = task->position * (data_off_t)block_size;
+		split = parity_split_find(worker->parity_handle, &offset);
+
+		if (write)
+			ret = advise_write(&split->advise, split->f, offset, block_size);
+		else
+			ret = advise_read(&split->advise, split->f, offset, block_size);
+		if (ret == 0) {
+			task->ring_state = RING_STATE_DONE;
+			task->state = TASK_STATE_DONE;
+			task->tick_done = tick();
+			histo_add(&worker->histo_io, task->tick_done - task->tick_start);
+			trace_event(worker, io_worker_name(worker), write ? "ring write" : "ring read", task->tick_start, task->tick_done, task->position);
+		}
+	}
+
+	/* a failed write is retried at once by the worker function, that reports the error */
+	/* a failed read is instead retried when the task is returned by io_parity_read() */
+	if (write && task->ring_state != RING_STATE_DONE) {
+		int error_index;
+
+		io_task_run(worker, task, "write");
+
+		task->ring_state = RING_STATE_DONE;
+
+		/* counts the number of errors in the global state, like io_writer_step() */
+		error_index = task->state - IO_WRITER_ERROR_BASE;
+		if (error_index >= 0 && error_index < IO_WRITER_ERROR_MAX) {
+			thread_mutex_lock(&io->io_mutex);
+			++io->writer_error[error_index];
+			thread_mutex_unlock(&io->io_mutex);
+		}
+	}
+}
+
+/**
+ * Complete one request of the ring.
+ *
+ * \param wait Wait for a request, if none is completed.
+ * \return 1 if a request was completed.
+ */
+static int io_ring_reap(struct snapraid_io* io, int wait)
+{
+	uint64_t user_data;
+	int result;
+
+	if (!aio_ring_wait(io->ring, wait, &user_data, &result))
+		return 0;
+
+	io_ring_complete(io, user_data, result);
+
+	return 1;
+}
+
+/**
+ * Submit the parity reads of the specified task index.
+ */
+static void io_ring_read_sched(struct snapraid_io* io, unsigned task_index)
+{
+	unsigned i;
+
+	/* the parity readers are after the data ones */
+	for (i = io->parity_base; i < io->reader_max; ++i)
+		io_ring_queue(io, &io->reader_map[i], i, i - io->parity_base, task_index, 0);
+
+	aio_ring_submit(io->ring);
+
+	/* collect the completed requests */
+	while (io_ring_reap(io, 0))
+		;
+}
+
+/**
+ * Submit the parity writes of the specified task index.
+ */
+static void io_ring_write_sched(struct snapraid_io* io, unsigned task_index)
+{
+	unsigned i;
+
+	for (i = 0; i < io->writer_max; ++i)
+		io_ring_queue(io, &io->writer_map[i], io->reader_max + i, i, task_index, 1);
+
+	aio_ring_submit(io->ring);
+
+	/* collect the completed requests */
+	while (io_ring_reap(io, 0))
+		;
+}
+
+/**
+ * Count the tasks not in progress in the ring, starting from the specified index.
+ */
+static unsigned io_ring_cached(struct snapraid_io* io, struct snapraid_worker* worker, unsigned begin)
+{
+	unsigned cached;
+
+	cached = 0;
+	while (cached < io->io_max - 1 && worker->task_map[(begin + cached) % io->io_max].ring_state != RING_STATE_PENDING)
+		++cached;
+
+	return cached;
+}
+
+/**
+ * If the worker uses the ring, and not a thread.
+ */
+static int io_ring_worker(struct snapraid_io* io, struct snapraid_worker* worker)
+{
+	return io->ring != 0 && worker->parity_handle != 0;
+}
+
+/**
+ * Get the next block position to operate on.
+ *
+ * This is the synchronization point for workers with the io.
+ */
+static block_off_t io_read_next_thread(struct snapraid_io* io, void*** buffer)
+{
+	block_off_t blockcur_schedule;
+	block_off_t blockcur_caller;
+	unsigned sched_index;
+	int plan;
+	unsigned i;
+
+	/* get the next parity position to process */
+	blockcur_schedule = io_position_next(io, &plan);
+
+	/* ensure that all data/parity was read */
+	assert(io->reader_list[0] == io->reader_max);
+
+	/* setup the list of workers to process */
+	for (i = 0; i <= io->reader_max; ++i)
+		io->reader_list[i] = i;
+
+	/* the synchronization is protected by the io mutex */
+	thread_mutex_lock(&io->io_mutex);
+
+	/* schedule the next read */
+	sched_index = io->reader_index;
+	if (io->pool_max != 0) {
+		/* the caller has finished with the buffers at this index */
+		io_pool_release(io, sched_index);
+
+		/* periodically adapt the depths */
+		if (++io->pool_period >= io->io_max)
+			io_pool_adapt(io);
+	}
+	io_reader_sched(io, sched_index, blockcur_schedule, plan);
+
+	/* set the index for the tasks to return to the caller */
+	io->reader_index = (io->reader_index + 1) % io->io_max;
+
+	/* get the position to operate at high level from one task */
+	blockcur_caller = io->reader_map[0].task_map[io->reader_index].position;
+
+	/* set the buffer to use */
+	*buffer = io->buffer_map[io->reader_index];
+
+	/* signal only the workers with enough pending tasks */
+	io_reader_wake(io);
+
+	thread_mutex_unlock(&io->io_mutex);
+
+	/* submit the parity reads not done by the workers */
+	if (io->ring)
+		io_ring_read_sched(io, sched_index);
+
+	return blockcur_caller;
+}
+
+static void io_write_preset_thread(struct snapraid_io* io, block_off_t blockcur, int skip)
+{
+	(void)io;
+	(void)blockcur;
+	(void)skip;
+}
+
+static void io_write_next_thread(struct snapraid_io* io, block_off_t blockcur, int skip, int* writer_error)
+{
+	unsigned sched_index;
+	unsigned i;
+
+	/* ensure that all parity was written */
+	assert(io->writer_list[0] == io->writer_max);
+
+	/* setup the list of workers to process */
+	for (i = 0; i <= io->writer_max; ++i)
+		io->writer_list[i] = i;
+
+	/* the synchronization is protected by the io mutex */
+	thread_mutex_lock(&io->io_mutex);
 
 	/* report errors */
 	for (i = 0; i < IO_WRITER_ERROR_MAX; ++i) {
@@ -476,10 +1345,19 @@ static void io_write_next_thread(struct snapraid_io* io, block_off_t blockcur, i
 	assert(io->writer_index == io->reader_index);
 
 	/* set the index to be used for the next write */
+	sched_index = io->writer_index;
 	io->writer_index = (io->writer_index + 1) % io->io_max;
 
-	/* signal all the workers that there is a new pending task */
-	thread_cond_broadcast_and_unlock(&io->write_sched, &io->io_mutex);
+	/* signal the workers that there is a new pending task */
+	/* they are woken up for each write, to not delay the parity update */
+	for (i = 0; i < io->writer_max; ++i)
+		io_worker_wake(&io->writer_map[i]);
+
+	thread_mutex_unlock(&io->io_mutex);
+
+	/* submit the parity writes not done by the workers */
+	if (io->ring)
+		io_ring_write_sched(io, sched_index);
 }
 
 static void io_refresh_thread(struct snapraid_io* io)
@@ -496,11 +1374,20 @@ static void io_refresh_thread(struct snapraid_io* io)
 
 		/* the first block read */
 		begin = io->reader_index + 1;
-		/* the block in reading */
-		end = worker->index;
-		if (begin > end)
-			end += io->io_max;
-		cached = end - begin;
+		if (io_ring_worker(io, worker)) {
+			cached = io_ring_cached(io, worker, begin);
+		} else if (io_split_worker(io, worker)) {
+			/* the blocks completed in order by the lanes */
+			cached = 0;
+			while (cached < io->io_max - 1 && !worker->task_map[(begin + cached) % io->io_max].pending)
+				++cached;
+		} else {
+			/* the block in reading */
+			end = worker->index;
+			if (begin > end)
+				end += io->io_max;
+			cached = end - begin;
+		}
 
 		if (worker->parity_handle)
 			io->state->parity[worker->parity_handle->level].cached_blocks = cached;
@@ -516,11 +1403,15 @@ static void io_refresh_thread(struct snapraid_io* io)
 
 		/* the first block written */
 		begin = io->writer_index + 1;
-		/* the block in writing */
-		end = worker->index;
-		if (begin > end)
-			end += io->io_max;
-		cached = end - begin;
+		if (io_ring_worker(io, worker)) {
+			cached = io_ring_cached(io, worker, begin);
+		} else {
+			/* the block in writing */
+			end = worker->index;
+			if (begin > end)
+				end += io->io_max;
+			cached = end - begin;
+		}
 
 		io->state->parity[worker->parity_handle->level].cached_blocks = cached;
 	}
@@ -531,6 +1422,7 @@ static void io_refresh_thread(struct snapraid_io* io)
 static struct snapraid_task* io_task_read_thread(struct snapraid_io* io, unsigned base, unsigned count, unsigned* pos, unsigned* waiting_map, unsigned* waiting_mac)
 {
 	unsigned waiting_cycle;
+	uint64_t wait_start;
 
 	/* count the waiting cycle */
 	waiting_cycle = 0;
@@ -571,12 +1463,16 @@ static struct snapraid_task* io_task_read_thread(struct snapraid_io* io, unsigne
 
 				worker = &io->reader_map[i];
 
-				/* if the worker has finished this index */
-				if (busy_index != worker->index) {
+				/* if the worker has finished this index, and its hash */
+				if (io_reader_finished(io, worker, busy_index) && !worker->task_map[io->reader_index].hash_pending) {
 					struct snapraid_task* task;
 
 					task = &worker->task_map[io->reader_index];
 
+					/* count the waits for the worker, to adapt its depth */
+					if (waiting_cycle != 0)
+						++worker->wait_count;
+
 					thread_mutex_unlock(&io->io_mutex);
 
 					/* mark the worker as processed */
@@ -590,8 +1486,13 @@ static struct snapraid_task* io_task_read_thread(struct snapraid_io* io, unsigne
 					if (waiting_cycle == 0)
 						*waiting_mac = 0;
 
+					io_task_wait(worker, task);
+
 					return task;
 				}
+
+				/* ensure that the worker we are going to wait for is running */
+				io_reader_wait(io, worker);
 			}
 
 			/* next position to check */
@@ -599,7 +1500,11 @@ static struct snapraid_task* io_task_read_thread(struct snapraid_io* io, unsigne
 		}
 
 		/* if no worker is ready, wait for an event */
+		wait_start = tick();
+		io->read_waiting = 1;
 		thread_cond_wait(&io->read_done, &io->io_mutex);
+		io->read_waiting = 0;
+		trace_event(0, "main", "wait read", wait_start, tick(), 0);
 
 		/* count the cycles */
 		++waiting_cycle;
@@ -611,14 +1516,173 @@ static struct snapraid_task* io_data_read_thread(struct snapraid_io* io, unsigne
 	return io_task_read_thread(io, io->data_base, io->data_count, pos, waiting_map, waiting_mac);
 }
 
-static struct snapraid_task* io_parity_read_thread(struct snapraid_io* io, unsigned* pos, unsigned* waiting_map, unsigned* waiting_mac)
-{
-	return io_task_read_thread(io, io->parity_base, io->parity_count, pos, waiting_map, waiting_mac);
+static struct snapraid_task* io_parity_read_thread(struct snapraid_io* io, unsigned* pos, unsigned* waiting_map, unsigned* waiting_mac)
+{
+	return io_task_read_thread(io, io->parity_base, io->parity_count, pos, waiting_map, waiting_mac);
+}
+
+static void io_parity_write_thread(struct snapraid_io* io, unsigned* pos, unsigned* waiting_map, unsigned* waiting_mac)
+{
+	unsigned waiting_cycle;
+	uint64_t wait_start;
+
+	/* count the waiting cycle */
+	waiting_cycle = 0;
+
+	/* clear the waiting indexes */
+	*waiting_mac = 0;
+
+	/* the synchronization is protected by the io mutex */
+	thread_mutex_lock(&io->io_mutex);
+
+	while (1) {
+		unsigned char* let;
+		unsigned busy_index;
+
+		/* get the next index the IO is going to use */
+		/* we must ensure that this index has not a write in progress */
+		/* to avoid a concurrent access */
+		/* note that we are already sure that a write is not in progress */
+		/* at the index the IO is using at now */
+		busy_index = (io->writer_index + 1) % io->io_max;
+
+		/* search for a worker that has already finished */
+		let = &io->writer_list[0];
+		while (1) {
+			unsigned i = *let;
+			struct snapraid_worker* worker;
+
+			/* if we are at the end */
+			if (i == io->writer_max)
+				break;
+
+			/* if it's the first cycle */
+			if (waiting_cycle == 0) {
+				/* store the waiting indexes */
+				waiting_map[(*waiting_mac)++] = i;
+			}
+
+			worker = &io->writer_map[i];
+
+			/* the two indexes cannot be equal */
+			assert(io->writer_index != worker->index);
+
+			/* if the worker has finished this index */
+			if (busy_index != worker->index) {
+				thread_mutex_unlock(&io->io_mutex);
+
+				/* mark the worker as processed */
+				/* setting the previous one to point at the next one */
+				*let = io->writer_list[i + 1];
+
+				/* return the position */
+				*pos = i;
+
+				/* on the first cycle, no one is waiting */
+				if (waiting_cycle == 0)
+					*waiting_mac = 0;
+
+				return;
+			}
+
+			/* next position to check */
+			let = &io->writer_list[i + 1];
+		}
+
+		/* if no worker is ready, wait for an event */
+		wait_start = tick();
+		io->write_waiting = 1;
+		thread_cond_wait(&io->write_done, &io->io_mutex);
+		io->write_waiting = 0;
+		trace_event(0, "main", "wait write", wait_start, tick(), 0);
+
+		/* count the cycles */
+		++waiting_cycle;
+	}
+}
+
+static struct snapraid_task* io_parity_read_ring(struct snapraid_io* io, unsigned* pos, unsigned* waiting_map, unsigned* waiting_mac)
+{
+	unsigned base = io->parity_base;
+	unsigned count = io->parity_count;
+	unsigned waiting_cycle;
+	uint64_t wait_start;
+
+	/* count the waiting cycle */
+	waiting_cycle = 0;
+
+	/* clear the waiting indexes */
+	*waiting_mac = 0;
+
+	/* collect the completed requests */
+	while (io_ring_reap(io, 0))
+		;
+
+	while (1) {
+		unsigned char* let;
+
+		/* search for a request that has already finished */
+		let = &io->reader_list[0];
+		while (1) {
+			unsigned i = *let;
+
+			/* if we are at the end */
+			if (i == io->reader_max)
+				break;
+
+			/* if it's in range */
+			if (base <= i && i < base + count) {
+				struct snapraid_worker* worker = &io->reader_map[i];
+				struct snapraid_task* task = &worker->task_map[io->reader_index];
+
+				/* if it's the first cycle */
+				if (waiting_cycle == 0) {
+					/* store the waiting indexes */
+					waiting_map[(*waiting_mac)++] = i - base;
+				}
+
+				/* if the request is not in progress */
+				if (task->ring_state != RING_STATE_PENDING) {
+					/* mark the worker as processed */
+					/* setting the previous one to point at the next one */
+					*let = io->reader_list[i + 1];
+
+					/* return the position */
+					*pos = i - base;
+
+					/* on the first cycle, no one is waiting */
+					if (waiting_cycle == 0)
+						*waiting_mac = 0;
+
+					/* if not read with the ring, read it now, also to report the error */
+					if (task->state == TASK_STATE_READY && task->ring_state != RING_STATE_DONE)
+						io_task_run(worker, task, "read");
+
+					io_task_wait(worker, task);
+
+					return task;
+				}
+			}
+
+			/* next position to check */
+			let = &io->reader_list[i + 1];
+		}
+
+		/* if no request is completed, wait for one */
+		wait_start = tick();
+		io_ring_reap(io, 1);
+		trace_event(0, "main", "wait ring", wait_start, tick(), 0);
+
+		/* count the cycles */
+		++waiting_cycle;
+	}
 }
 
-static void io_parity_write_thread(struct snapraid_io* io, unsigned* pos, unsigned* waiting_map, unsigned* waiting_mac)
+static void io_parity_write_ring(struct snapraid_io* io, unsigned* pos, unsigned* waiting_map, unsigned* waiting_mac)
 {
 	unsigned waiting_cycle;
+	uint64_t wait_start;
+	unsigned busy_index;
 
 	/* count the waiting cycle */
 	waiting_cycle = 0;
@@ -626,21 +1690,17 @@ static void io_parity_write_thread(struct snapraid_io* io, unsigned* pos, unsign
 	/* clear the waiting indexes */
 	*waiting_mac = 0;
 
-	/* the synchronization is protected by the io mutex */
-	thread_mutex_lock(&io->io_mutex);
+	/* get the next index the IO is going to use, like io_parity_write_thread() */
+	busy_index = (io->writer_index + 1) % io->io_max;
+
+	/* collect the completed requests */
+	while (io_ring_reap(io, 0))
+		;
 
 	while (1) {
 		unsigned char* let;
-		unsigned busy_index;
-
-		/* get the next index the IO is going to use */
-		/* we must ensure that this index has not a write in progress */
-		/* to avoid a concurrent access */
-		/* note that we are already sure that a write is not in progress */
-		/* at the index the IO is using at now */
-		busy_index = (io->writer_index + 1) % io->io_max;
 
-		/* search for a worker that has already finished */
+		/* search for a request that has already finished */
 		let = &io->writer_list[0];
 		while (1) {
 			unsigned i = *let;
@@ -658,13 +1718,8 @@ static void io_parity_write_thread(struct snapraid_io* io, unsigned* pos, unsign
 
 			worker = &io->writer_map[i];
 
-			/* the two indexes cannot be equal */
-			assert(io->writer_index != worker->index);
-
-			/* if the worker has finished this index */
-			if (busy_index != worker->index) {
-				thread_mutex_unlock(&io->io_mutex);
-
+			/* if the request at this index is not in progress */
+			if (worker->task_map[busy_index].ring_state != RING_STATE_PENDING) {
 				/* mark the worker as processed */
 				/* setting the previous one to point at the next one */
 				*let = io->writer_list[i + 1];
@@ -683,14 +1738,70 @@ static void io_parity_write_thread(struct snapraid_io* io, unsigned* pos, unsign
 			let = &io->writer_list[i + 1];
 		}
 
-		/* if no worker is ready, wait for an event */
-		thread_cond_wait(&io->write_done, &io->io_mutex);
+		/* if no request is completed, wait for one */
+		wait_start = tick();
+		io_ring_reap(io, 1);
+		trace_event(0, "main", "wait ring", wait_start, tick(), 0);
 
 		/* count the cycles */
 		++waiting_cycle;
 	}
 }
 
+/**
+ * Setup the ring for the parity workers.
+ *
+ * If not supported, the parity workers use their threads.
+ */
+static void io_ring_init(struct snapraid_io* io)
+{
+	unsigned max = io->io_max * io->parity_count;
+	void** buffer;
+	unsigned i;
+	unsigned j;
+
+	/* a remote parity has no file to submit to the ring */
+	for (j = 0; j < io->parity_count; ++j) {
+		struct snapraid_worker* worker = io->writer_max != 0 ? &io->writer_map[j] : &io->reader_map[io->parity_base + j];
+
+		if (parity_is_remote(worker->parity_handle)) {
+			msg_verbose("The io_uring support is not used with a remote parity. Using threads.\n");
+			return;
+		}
+	}
+
+	io->ring = aio_ring_alloc(max);
+	if (!io->ring) {
+		msg_verbose("The io_uring support is not available. Using threads.\n");
+		return;
+	}
+
+	/* the buffers are indexed as task index * parity_count + parity index */
+	buffer = malloc_nofail(max * sizeof(void*));
+	for (i = 0; i < io->io_max; ++i) {
+		for (j = 0; j < io->parity_count; ++j) {
+			struct snapraid_worker* worker;
+			unsigned n;
+
+			if (io->writer_max != 0)
+				n = j;
+			else
+				n = io->parity_base + j;
+			worker = io->writer_max != 0 ? &io->writer_map[n] : &io->reader_map[n];
+
+			buffer[i * io->parity_count + j] = io->buffer_map[i][worker->buffer_skew + n];
+		}
+	}
+
+	if (aio_ring_register(io->ring, buffer, max, io->state->block_size) != 0)
+		msg_verbose("Using io_uring without registered buffers.\n");
+
+	free(buffer);
+
+	io_parity_read = io_parity_read_ring;
+	io_parity_write = io_parity_write_ring;
+}
+
 static void io_reader_worker(struct snapraid_worker* worker, struct snapraid_task* task)
 {
 	/* if we reached the end */
@@ -698,14 +1809,29 @@ static void io_reader_worker(struct snapraid_worker* worker, struct snapraid_tas
 		/* complete a dummy task */
 		task->state = TASK_STATE_EMPTY;
 	} else {
-		worker->func(worker, task);
+		io_throttle(worker->io, worker);
+		io_task_run(worker, task, "read");
 	}
 }
 
+/**
+ * Run the calling thread on the CPUs of a NUMA node, if specified.
+ */
+static void io_numa_bind(int node)
+{
+	if (node < 0)
+		return;
+
+	if (numa_thread(node) != 0)
+		log_tag("numa:%d: failed to bind the thread. %s\n", node, strerror(errno));
+}
+
 static void* io_reader_thread(void* arg)
 {
 	struct snapraid_worker* worker = arg;
 
+	io_numa_bind(worker->numa);
+
 	/* force completion of the first task */
 	io_reader_worker(worker, &worker->task_map[0]);
 
@@ -719,50 +1845,377 @@ static void* io_reader_thread(void* arg)
 		if (!task)
 			break;
 
-		/* nothing more to do */
-		if (task->state == TASK_STATE_EMPTY)
-			continue;
+		/* nothing more to do */
+		if (task->state == TASK_STATE_EMPTY)
+			continue;
+
+		assert(task->state == TASK_STATE_READY);
+
+		/* work on the assigned task */
+		io_reader_worker(worker, task);
+	}
+
+	return 0;
+}
+
+static void* io_lane_thread(void* arg)
+{
+	struct snapraid_worker* lane = arg;
+	struct snapraid_task* task;
+
+	io_numa_bind(lane->numa);
+
+	if (lane == lane->parent) {
+		/* the worker starts with the first task, taken by io_start_thread() */
+		task = &lane->task_map[0];
+		io_reader_worker(lane, task);
+	} else {
+		/* the other lanes have no task to complete at the first step */
+		task = 0;
+	}
+
+	while (1) {
+		/* complete the previous task, and get the new one */
+		task = io_lane_step(lane, task);
+
+		/* if no task, it means to exit */
+		if (!task)
+			break;
+
+		/* nothing more to do */
+		if (task->state == TASK_STATE_EMPTY)
+			continue;
+
+		assert(task->state == TASK_STATE_READY);
+
+		/* work on the assigned task */
+		io_reader_worker(lane, task);
+	}
+
+	return 0;
+}
+
+static void* io_split_thread(void* arg)
+{
+	struct snapraid_worker* lane = arg;
+	struct snapraid_task* task;
+
+	io_numa_bind(lane->numa);
+
+	/* no task to complete at the first step */
+	task = 0;
+
+	while (1) {
+		/* complete the previous task, and get the new one */
+		task = io_split_step(lane, task);
+
+		/* if no task, it means to exit */
+		if (!task)
+			break;
+
+		/* nothing more to do */
+		if (task->state == TASK_STATE_EMPTY)
+			continue;
+
+		assert(task->state == TASK_STATE_READY);
+
+		/* work on the assigned task */
+		io_reader_worker(lane, task);
+	}
+
+	return 0;
+}
+
+static void* io_writer_thread(void* arg)
+{
+	struct snapraid_worker* worker = arg;
+	int latest_state = TASK_STATE_DONE;
+
+	io_numa_bind(worker->numa);
+
+	while (1) {
+		struct snapraid_task* task;
+
+		/* get the new task */
+		task = io_writer_step(worker, latest_state);
+
+		/* if no task, it means to exit */
+		if (!task)
+			break;
+
+		/* nothing more to do */
+		if (task->state == TASK_STATE_EMPTY) {
+			latest_state = TASK_STATE_DONE;
+			continue;
+		}
+
+		assert(task->state == TASK_STATE_READY);
+
+		/* work on the assigned task */
+		io_throttle(worker->io, worker);
+		io_task_run(worker, task, "write");
+
+		/* save the resulting state */
+		latest_state = task->state;
+	}
+
+	return 0;
+}
+
+/**
+ * Compute the parity of the specified slice of the blocks.
+ */
+static void io_raid_slice(struct snapraid_io* io, void** v, unsigned index)
+{
+	size_t unit = io->raid_size / 64;
+	size_t begin = unit * index / io->raid_max * 64;
+	size_t end = unit * (index + 1) / io->raid_max * 64;
+
+	io_raid_range(io, v, begin, end);
+}
+
+static void* io_raid_thread(void* arg)
+{
+	struct snapraid_raid_worker* worker = arg;
+	struct snapraid_io* io = worker->io;
+	uint64_t raid_start;
+
+	io_numa_bind(io->raid_numa);
+
+	thread_mutex_lock(&io->raid_mutex);
+
+	while (1) {
+		/* wait for a new computation */
+		while (!io->raid_exit && io->raid_generation == worker->generation)
+			thread_cond_wait(&io->raid_sched, &io->raid_mutex);
+
+		if (io->raid_exit)
+			break;
+
+		worker->generation = io->raid_generation;
+
+		thread_mutex_unlock(&io->raid_mutex);
+
+		raid_start = tick();
+		io_raid_slice(io, worker->v, worker->index);
+		trace_event(worker, "raid", "raid", raid_start, tick(), 0);
+
+		thread_mutex_lock(&io->raid_mutex);
+
+		/* the latest slice completed wakes up the caller */
+		if (--io->raid_pending == 0)
+			thread_cond_signal(&io->raid_done);
+	}
+
+	thread_mutex_unlock(&io->raid_mutex);
+
+	return 0;
+}
+
+static void io_raid_start(struct snapraid_io* io)
+{
+	unsigned i;
+
+	io->raid_exit = 0;
+
+	/* the slice 0 is computed by the caller */
+	for (i = 1; i < io->raid_max; ++i) {
+		struct snapraid_raid_worker* worker = &io->raid_map[i];
+
+		worker->generation = io->raid_generation;
+
+		thread_create(&worker->thread, 0, io_raid_thread, worker);
+	}
+
+	io->raid_started = 1;
+}
+
+static void io_raid_stop(struct snapraid_io* io)
+{
+	unsigned i;
+
+	if (!io->raid_started)
+		return;
+
+	thread_mutex_lock(&io->raid_mutex);
+
+	/* mark that we are stopping */
+	io->raid_exit = 1;
+
+	/* signal all the threads to recognize the new state */
+	thread_cond_broadcast(&io->raid_sched);
+
+	thread_mutex_unlock(&io->raid_mutex);
+
+	/* wait for all the threads to terminate */
+	for (i = 1; i < io->raid_max; ++i) {
+		struct snapraid_raid_worker* worker = &io->raid_map[i];
+		void* retval;
+
+		/* wait for thread termination */
+		thread_join(worker->thread, &retval);
+	}
+
+	io->raid_started = 0;
+}
+
+static void io_raid_begin_thread(struct snapraid_io* io)
+{
+	/* start the threads at the first use */
+	if (!io->raid_started)
+		io_raid_start(io);
+
+	thread_mutex_lock(&io->raid_mutex);
+
+	/* setup the new computation */
+	io->raid_pending = io->raid_max - 1;
+	++io->raid_generation;
+
+	thread_cond_broadcast(&io->raid_sched);
+
+	thread_mutex_unlock(&io->raid_mutex);
+}
+
+static void io_raid_end_thread(struct snapraid_io* io)
+{
+	/* compute the first slice */
+	io_raid_slice(io, io->raid_map[0].v, 0);
+
+	/* wait for the other slices */
+	thread_mutex_lock(&io->raid_mutex);
+
+	while (io->raid_pending != 0)
+		thread_cond_wait(&io->raid_done, &io->raid_mutex);
+
+	thread_mutex_unlock(&io->raid_mutex);
+}
+
+static void io_hash_push(struct snapraid_io* io, struct snapraid_task* task)
+{
+	thread_mutex_lock(&io->hash_mutex);
+
+	/* there is space for all the data tasks */
+	assert(io->hash_queue_count < io->hash_queue_max);
+
+	io->hash_queue[(io->hash_queue_first + io->hash_queue_count) % io->hash_queue_max] = task;
+	++io->hash_queue_count;
+
+	thread_cond_signal_and_unlock(&io->hash_sched, &io->hash_mutex);
+}
+
+static void* io_hash_thread(void* arg)
+{
+	struct snapraid_hash_worker* worker = arg;
+	struct snapraid_io* io = worker->io;
+	uint64_t hash_start;
+
+	thread_mutex_lock(&io->hash_mutex);
+
+	while (1) {
+		struct snapraid_task* task;
+
+		/* wait for a new task */
+		while (!io->hash_exit && io->hash_queue_count == 0)
+			thread_cond_wait(&io->hash_sched, &io->hash_mutex);
+
+		if (io->hash_exit)
+			break;
+
+		task = io->hash_queue[io->hash_queue_first];
+		io->hash_queue_first = (io->hash_queue_first + 1) % io->hash_queue_max;
+		--io->hash_queue_count;
+
+		thread_mutex_unlock(&io->hash_mutex);
+
+		hash_start = tick();
+		memhash(task->hash_kind, task->hash_seed, task->hash, task->buffer, task->read_size);
+		trace_event(worker, "hash", "hash", hash_start, tick(), task->position);
+
+		/* notify the IO that the task is now complete, if it's waiting */
+		thread_mutex_lock(&io->io_mutex);
+		task->hash_pending = 0;
+		if (io->read_waiting)
+			thread_cond_signal(&io->read_done);
+		thread_mutex_unlock(&io->io_mutex);
+
+		thread_mutex_lock(&io->hash_mutex);
+	}
+
+	thread_mutex_unlock(&io->hash_mutex);
+
+	return 0;
+}
+
+static void io_hash_start(struct snapraid_io* io)
+{
+	unsigned i;
+
+	io->hash_exit = 0;
+	io->hash_queue_first = 0;
+	io->hash_queue_count = 0;
+
+	for (i = 0; i < io->hash_max; ++i) {
+		struct snapraid_hash_worker* worker = &io->hash_map[i];
+
+		thread_create(&worker->thread, 0, io_hash_thread, worker);
+	}
+}
+
+static void io_hash_stop(struct snapraid_io* io)
+{
+	unsigned i;
+
+	thread_mutex_lock(&io->hash_mutex);
+
+	/* mark that we are stopping, the tasks still queued are discarded */
+	io->hash_exit = 1;
 
-		assert(task->state == TASK_STATE_READY);
+	/* signal all the threads to recognize the new state */
+	thread_cond_broadcast(&io->hash_sched);
 
-		/* work on the assigned task */
-		io_reader_worker(worker, task);
-	}
+	thread_mutex_unlock(&io->hash_mutex);
 
-	return 0;
+	/* wait for all the threads to terminate */
+	for (i = 0; i < io->hash_max; ++i) {
+		struct snapraid_hash_worker* worker = &io->hash_map[i];
+		void* retval;
+
+		/* wait for thread termination */
+		thread_join(worker->thread, &retval);
+	}
 }
 
-static void* io_writer_thread(void* arg)
+/**
+ * Reset the pool, with all buffers free, and the same depth for all the readers.
+ */
+static void io_pool_start(struct snapraid_io* io)
 {
-	struct snapraid_worker* worker = arg;
-	int latest_state = TASK_STATE_DONE;
-
-	while (1) {
-		struct snapraid_task* task;
-
-		/* get the new task */
-		task = io_writer_step(worker, latest_state);
+	unsigned depth;
+	unsigned i;
+	unsigned j;
 
-		/* if no task, it means to exit */
-		if (!task)
-			break;
+	io->pool_free_count = 0;
+	for (i = 0; i < io->pool_max; ++i)
+		io->pool_free[io->pool_free_count++] = io->pool_map[i];
+	io->pool_period = 0;
 
-		/* nothing more to do */
-		if (task->state == TASK_STATE_EMPTY) {
-			latest_state = TASK_STATE_DONE;
-			continue;
-		}
+	depth = io->pool_max / io->data_count;
+	if (depth > io->io_max)
+		depth = io->io_max;
 
-		assert(task->state == TASK_STATE_READY);
+	for (i = io->data_base; i < io->data_base + io->data_count; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
 
-		/* work on the assigned task */
-		worker->func(worker, task);
+		worker->depth = depth;
+		worker->held = 0;
+		worker->wait_count = 0;
 
-		/* save the resulting state */
-		latest_state = task->state;
+		/* no buffer is assigned */
+		for (j = 0; j < io->io_max; ++j) {
+			worker->task_map[j].buffer = 0;
+			io->buffer_map[j][i] = 0;
+		}
 	}
-
-	return 0;
 }
 
 static void io_start_thread(struct snapraid_io* io,
@@ -780,17 +2233,38 @@ static void io_start_thread(struct snapraid_io* io,
 	io->done = 0;
 	io->reader_index = io->io_max - 1;
 	io->writer_index = 0;
+	io->read_waiting = 0;
+	io->write_waiting = 0;
 
 	/* clear writer errors */
 	for (i = 0; i < IO_WRITER_ERROR_MAX; ++i)
 		io->writer_error[i] = 0;
 
+	/* initially all the buffers of the pool are free */
+	if (io->pool_max != 0)
+		io_pool_start(io);
+
+	/* the latest task is not yet pending, and no reader must take it */
+	for (i = 0; i < io->reader_max; ++i) {
+		io->reader_map[i].task_map[io->io_max - 1].pending = 0;
+		io->reader_map[i].task_map[io->io_max - 1].taken = 1;
+	}
+
 	/* setup the initial read pending tasks, except the latest one, */
 	/* the latest will be initialized at the fist io_read_next() call */
 	for (i = 0; i < io->io_max - 1; ++i) {
-		block_off_t blockcur = io_position_next(io);
+		int plan;
+		block_off_t blockcur = io_position_next(io, &plan);
+
+		io_reader_sched(io, i, blockcur, plan);
+	}
 
-		io_reader_sched(io, i, blockcur);
+	/* the writers using the ring have no previous request */
+	for (i = 0; i < io->writer_max; ++i) {
+		unsigned j;
+
+		for (j = 0; j < io->io_max; ++j)
+			io->writer_map[i].task_map[j].ring_state = RING_STATE_NONE;
 	}
 
 	/* setup the lists of workers to process */
@@ -798,13 +2272,48 @@ static void io_start_thread(struct snapraid_io* io,
 	for (i = 0; i <= io->writer_max; ++i)
 		io->writer_list[i] = i;
 
+	/* start the hash threads, before the readers that use them */
+	io_hash_start(io);
+
 	/* start the reader threads */
 	for (i = 0; i < io->reader_max; ++i) {
 		struct snapraid_worker* worker = &io->reader_map[i];
 
+		worker->sleeping = 0;
+
+		if (io_split_worker(io, worker)) {
+			unsigned j;
+
+			/* the worker and its lanes take the first tasks of their split */
+			for (j = 0; j < worker->parity_handle->split_mac; ++j) {
+				struct snapraid_worker* lane = io_split_lane(io, worker, j);
+				lane->sleeping = 0;
+				thread_create(&lane->thread, 0, io_split_thread, lane);
+			}
+			continue;
+		}
+
 		worker->index = 0;
+		worker->task_map[0].taken = 1;
+
+		/* the first task is started without io_reader_step() */
+		if (io_pool_worker(io, worker))
+			io_pool_acquire(io, worker, 0);
+
+		if (io_lane_worker(io, worker)) {
+			unsigned j;
+
+			thread_create(&worker->thread, 0, io_lane_thread, worker);
+			for (j = 0; j < io->lane_max; ++j) {
+				struct snapraid_worker* lane = &io->lane_map[(i - io->data_base) * io->lane_max + j];
+				lane->sleeping = 0;
+				thread_create(&lane->thread, 0, io_lane_thread, lane);
+			}
+			continue;
+		}
 
-		thread_create(&worker->thread, 0, io_reader_thread, worker);
+		if (!io_ring_worker(io, worker))
+			thread_create(&worker->thread, 0, io_reader_thread, worker);
 	}
 
 	/* start the writer threads */
@@ -812,8 +2321,17 @@ static void io_start_thread(struct snapraid_io* io,
 		struct snapraid_worker* worker = &io->writer_map[i];
 
 		worker->index = io->io_max - 1;
+		worker->sleeping = 0;
+		worker->batch = 1;
+
+		if (!io_ring_worker(io, worker))
+			thread_create(&worker->thread, 0, io_writer_thread, worker);
+	}
 
-		thread_create(&worker->thread, 0, io_writer_thread, worker);
+	/* submit the initial parity reads not done by the threads */
+	if (io->ring) {
+		for (i = 0; i < io->io_max - 1; ++i)
+			io_ring_read_sched(io, i);
 	}
 }
 
@@ -821,14 +2339,23 @@ static void io_stop_thread(struct snapraid_io* io)
 {
 	unsigned i;
 
+	/* stop the parity threads, if started */
+	io_raid_stop(io);
+
 	thread_mutex_lock(&io->io_mutex);
 
 	/* mark that we are stopping */
 	io->done = 1;
 
 	/* signal all the threads to recognize the new state */
-	thread_cond_broadcast(&io->read_sched);
-	thread_cond_broadcast(&io->write_sched);
+	for (i = 0; i < io->reader_max; ++i)
+		io_worker_wake(&io->reader_map[i]);
+	for (i = 0; i < io->data_count * io->lane_max; ++i)
+		io_worker_wake(&io->lane_map[i]);
+	for (i = 0; i < io->parity_count * io->split_lane_max; ++i)
+		io_worker_wake(&io->split_lane_map[i]);
+	for (i = 0; i < io->writer_max; ++i)
+		io_worker_wake(&io->writer_map[i]);
 
 	thread_mutex_unlock(&io->io_mutex);
 
@@ -837,18 +2364,72 @@ static void io_stop_thread(struct snapraid_io* io)
 		struct snapraid_worker* worker = &io->reader_map[i];
 		void* retval;
 
+		if (io_ring_worker(io, worker))
+			continue;
+
 		/* wait for thread termination */
 		thread_join(worker->thread, &retval);
 	}
 
+	/* wait for all lanes to terminate, closing their files */
+	for (i = 0; i < io->data_count * io->lane_max; ++i) {
+		struct snapraid_worker* lane = &io->lane_map[i];
+		void* retval;
+
+		thread_join(lane->thread, &retval);
+
+		/* the error is already reported, and the file was only read */
+		handle_close(lane->handle);
+	}
+
+	/* wait for all split lanes to terminate */
+	for (i = io->parity_base; i < io->reader_max; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
+		unsigned j;
+
+		if (!io_split_worker(io, worker))
+			continue;
+
+		for (j = 1; j < worker->parity_handle->split_mac; ++j) {
+			void* retval;
+
+			thread_join(io_split_lane(io, worker, j)->thread, &retval);
+		}
+	}
+
 	/* wait for all writers to terminate */
 	for (i = 0; i < io->writer_max; ++i) {
 		struct snapraid_worker* worker = &io->writer_map[i];
 		void* retval;
 
+		if (io_ring_worker(io, worker))
+			continue;
+
 		/* wait for thread termination */
 		thread_join(worker->thread, &retval);
 	}
+
+	/* complete all the requests in the ring, including the pending writes */
+	if (io->ring) {
+		while (io_ring_reap(io, 1))
+			;
+	}
+
+	/* stop the hash threads, now that no reader can use them */
+	io_hash_stop(io);
+
+	/* collect the latency stats, now that no worker is running */
+	io_stats(io);
+
+	/* report the depths reached */
+	if (io->pool_max != 0) {
+		for (i = io->data_base; i < io->data_base + io->data_count; ++i) {
+			struct snapraid_worker* worker = &io->reader_map[i];
+
+			if (worker->handle->disk)
+				msg_verbose("Read-ahead of disk '%s' at %u blocks.\n", worker->handle->disk->name, worker->depth);
+		}
+	}
 }
 
 #endif
@@ -856,6 +2437,197 @@ static void io_stop_thread(struct snapraid_io* io)
 /*****************************************************************************/
 /* global */
 
+/**
+ * Allocate a vector of buffers, as required by the file mode.
+ */
+static void** io_alloc_vector(struct snapraid_io* io, int nd, int n, void** freeptr)
+{
+	struct snapraid_state* state = io->state;
+
+	if (state->opt.io_huge) {
+		void** v;
+		int huge;
+
+		v = malloc_nofail_vector_huge(nd, n, state->block_size, state->file_mode == ADVISE_DIRECT, freeptr, &huge);
+
+		++io->huge_alloc;
+		if (huge)
+			++io->huge_count;
+
+		return v;
+	}
+
+	if (state->file_mode != ADVISE_DIRECT)
+		return malloc_nofail_vector_align(nd, n, state->block_size, freeptr);
+	else
+		return malloc_nofail_vector_direct(nd, n, state->block_size, freeptr);
+}
+
+/**
+ * Get the NUMA node of the controller of a parity split.
+ */
+static int io_numa_split(struct snapraid_io* io, struct snapraid_worker* worker, unsigned split)
+{
+	return devnuma(io->state->parity[worker->parity_handle->level].split_map[split].device);
+}
+
+/**
+ * Set the NUMA node of the workers, and move their buffers to it.
+ *
+ * The buffers of the data disks shared in the pool are not moved,
+ * as they are used by all the data disks.
+ */
+static void io_numa_init(struct snapraid_io* io)
+{
+	struct snapraid_state* state = io->state;
+	unsigned worker_max = io->reader_max + io->writer_max;
+	unsigned placed;
+	unsigned best;
+	unsigned i;
+	unsigned j;
+
+	/* by default run everywhere */
+	for (i = 0; i < worker_max; ++i) {
+		struct snapraid_worker* worker = i < io->reader_max ? &io->reader_map[i] : &io->writer_map[i - io->reader_max];
+		worker->numa = -1;
+	}
+	for (i = 0; i < io->data_count * io->lane_max; ++i)
+		io->lane_map[i].numa = -1;
+	for (i = 0; i < io->parity_count * io->split_lane_max; ++i)
+		io->split_lane_map[i].numa = -1;
+	io->raid_numa = -1;
+
+	/* only the threads are placed */
+	if (!state->opt.io_numa || io->io_max <= 1)
+		return;
+
+	placed = 0;
+	for (i = 0; i < worker_max; ++i) {
+		struct snapraid_worker* worker = i < io->reader_max ? &io->reader_map[i] : &io->writer_map[i - io->reader_max];
+
+		if (worker->handle)
+			worker->numa = devnuma(worker->handle->disk->device);
+		else
+			worker->numa = io_numa_split(io, worker, 0);
+
+		if (worker->numa >= 0)
+			++placed;
+	}
+
+	/* the lanes of a data disk use its node */
+	for (i = 0; i < io->data_count * io->lane_max; ++i)
+		io->lane_map[i].numa = io->lane_map[i].parent->numa;
+
+	/* the lanes of a parity split use the node of the split */
+	for (i = 0; i < io->parity_count * io->split_lane_max; ++i) {
+		struct snapraid_worker* lane = &io->split_lane_map[i];
+
+		if (lane->split < lane->parity_handle->split_mac)
+			lane->numa = io_numa_split(io, lane, lane->split);
+	}
+
+	/* the parity is computed on the node with most of the data disks */
+	best = 0;
+	for (i = io->data_base; i < io->data_base + io->data_count; ++i) {
+		unsigned count = 0;
+
+		if (io->reader_map[i].numa < 0)
+			continue;
+
+		for (j = io->data_base; j < io->data_base + io->data_count; ++j) {
+			if (io->reader_map[j].numa == io->reader_map[i].numa)
+				++count;
+		}
+
+		if (count > best) {
+			best = count;
+			io->raid_numa = io->reader_map[i].numa;
+		}
+	}
+
+	/* move the buffers of each disk to its node */
+	for (i = 0; i < worker_max; ++i) {
+		struct snapraid_worker* worker = i < io->reader_max ? &io->reader_map[i] : &io->writer_map[i - io->reader_max];
+		unsigned index = worker->buffer_skew + (i < io->reader_max ? i : i - io->reader_max);
+
+		if (worker->numa < 0 || io_pool_worker(io, worker))
+			continue;
+
+		for (j = 0; j < io->io_max; ++j) {
+			if (numa_memory(io->buffer_map[j][index], state->block_size, worker->numa) != 0) {
+				log_tag("numa:%d: failed to move the buffers. %s\n", worker->numa, strerror(errno));
+				break;
+			}
+		}
+	}
+
+	msg_progress("Using the NUMA node of the controller for %u of %u disks.\n", placed, worker_max);
+}
+
+/**
+ * Allocate the buffers of all the tasks, except the first ones.
+ *
+ * The first buffers are left empty, to be set by the readers.
+ * With huge pages all the buffers are allocated together, to fill
+ * the huge pages, otherwise each task has its allocation.
+ */
+static void io_alloc_task(struct snapraid_io* io, unsigned handle_max, unsigned first)
+{
+	unsigned n = io->buffer_max - first;
+	void** all;
+	unsigned i;
+
+	all = 0;
+	if (io->state->opt.io_huge)
+		all = io_alloc_vector(io, 0, io->io_max * n, &io->buffer_alloc_map[0]);
+
+	for (i = 0; i < io->io_max; ++i) {
+		void** v;
+
+		io->buffer_map[i] = malloc_nofail(io->buffer_max * sizeof(void*));
+		memset(io->buffer_map[i], 0, first * sizeof(void*));
+
+		if (all) {
+			v = all + i * n;
+			if (i != 0)
+				io->buffer_alloc_map[i] = 0;
+			memcpy(io->buffer_map[i] + first, v, n * sizeof(void*));
+		} else {
+			v = io_alloc_vector(io, first == 0 ? handle_max : 0, n, &io->buffer_alloc_map[i]);
+			memcpy(io->buffer_map[i] + first, v, n * sizeof(void*));
+			free(v);
+		}
+	}
+
+	free(all);
+}
+
+unsigned io_cache_max(unsigned block_size, unsigned io_cache)
+{
+#if HAVE_PTHREAD
+	unsigned io_max;
+
+	if (io_cache != 0)
+		return io_cache;
+
+	/* default is 8 MiB of cache */
+	/* this seems to be a good tradeoff between speed and memory usage */
+	io_max = 8 * 1024 * 1024 / block_size;
+	if (io_max < IO_MIN)
+		io_max = IO_MIN;
+	if (io_max > IO_MAX)
+		io_max = IO_MAX;
+
+	return io_max;
+#else
+	(void)block_size;
+	(void)io_cache;
+
+	/* without pthread force the mono thread mode */
+	return 1;
+#endif
+}
+
 void io_init(struct snapraid_io* io, struct snapraid_state* state,
 	unsigned io_cache, unsigned buffer_max,
 	void (*data_reader)(struct snapraid_worker*, struct snapraid_task*),
@@ -869,41 +2641,65 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 
 	io->state = state;
 
-#if HAVE_PTHREAD
-	if (io_cache == 0) {
-		/* default is 8 MiB of cache */
-		/* this seems to be a good tradeoff between speed and memory usage */
-		io->io_max = 8 * 1024 * 1024 / state->block_size;
-		if (io->io_max < IO_MIN)
-			io->io_max = IO_MIN;
-		if (io->io_max > IO_MAX)
-			io->io_max = IO_MAX;
-	} else {
-		io->io_max = io_cache;
-	}
-#else
-	(void)io_cache;
+	io->io_max = io_cache_max(state->block_size, io_cache);
 
-	/* without pthread force the mono thread mode */
-	io->io_max = 1;
-#endif
+	io->hash_zero_kind = state->hash;
+	if (io->hash_zero_kind != HASH_UNDEFINED) {
+		unsigned char* zero = calloc_nofail(1, state->block_size);
+		memhash(state->hash, state->hashseed, io->hash_zero, zero, state->block_size);
+		free(zero);
+	}
 
 	assert(io->io_max == 1 || (io->io_max >= IO_MIN && io->io_max <= IO_MAX));
 
 	io->buffer_max = buffer_max;
+
+	/* the data buffers are shared only with the other threads */
+	io->pool_max = 0;
+	if (io->io_max > 1 && state->opt.io_memory != 0 && handle_max != 0) {
+		io->pool_max = state->opt.io_memory * (uint64_t)MEBI / state->block_size;
+		if (io->pool_max < IO_DEPTH_MIN * handle_max)
+			io->pool_max = IO_DEPTH_MIN * handle_max;
+		if (io->pool_max > io->io_max * handle_max)
+			io->pool_max = io->io_max * handle_max;
+	}
+
+	io->huge_alloc = 0;
+	io->huge_count = 0;
+
 	allocated = 0;
-	for (i = 0; i < io->io_max; ++i) {
-		if (state->file_mode != ADVISE_DIRECT)
-			io->buffer_map[i] = malloc_nofail_vector_align(handle_max, buffer_max, state->block_size, &io->buffer_alloc_map[i]);
-		else
-			io->buffer_map[i] = malloc_nofail_vector_direct(handle_max, buffer_max, state->block_size, &io->buffer_alloc_map[i]);
+	if (io->pool_max != 0) {
+		io->pool_map = io_alloc_vector(io, io->pool_max, io->pool_max, &io->pool_alloc);
+		io->pool_free = malloc_nofail(io->pool_max * sizeof(void*));
+		allocated += state->block_size * (size_t)io->pool_max;
+
+		/* allocate only the not data buffers, the data ones are set by the readers */
+		io_alloc_task(io, handle_max, handle_max);
+		for (i = 0; i < io->io_max; ++i) {
+			if (!state->opt.skip_self)
+				mtest_vector(buffer_max - handle_max, state->block_size, io->buffer_map[i] + handle_max);
+			allocated += state->block_size * (buffer_max - handle_max);
+		}
 		if (!state->opt.skip_self)
-			mtest_vector(io->buffer_max, state->block_size, io->buffer_map[i]);
-		allocated += state->block_size * buffer_max;
+			mtest_vector(io->pool_max, state->block_size, io->pool_map);
+	} else {
+		io_alloc_task(io, handle_max, 0);
+		for (i = 0; i < io->io_max; ++i) {
+			if (!state->opt.skip_self)
+				mtest_vector(io->buffer_max, state->block_size, io->buffer_map[i]);
+			allocated += state->block_size * buffer_max;
+		}
 	}
 
 	msg_progress("Using %u MiB of memory for %u cached blocks.\n", (unsigned)(allocated / MEBI), io->io_max);
 
+	if (io->huge_alloc != 0) {
+		if (io->huge_count != 0)
+			msg_progress("Using huge pages for %u of %u buffer allocations.\n", io->huge_count, io->huge_alloc);
+		else
+			msg_progress("Huge pages not available, or buffers too small, using normal pages.\n");
+	}
+
 	if (parity_writer) {
 		io->reader_max = handle_max;
 		io->writer_max = parity_handle_max;
@@ -926,6 +2722,12 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 		struct snapraid_worker* worker = &io->reader_map[i];
 
 		worker->io = io;
+		worker->parent = worker;
+		worker->throttle_time = 0;
+		worker->batch = 1;
+		worker->split = 0;
+		histo_init(&worker->histo_io);
+		histo_init(&worker->histo_wait);
 
 		if (i < handle_max) {
 			/* it's a data read */
@@ -946,10 +2748,77 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 		}
 	}
 
+	/* the lanes are used only with the other threads */
+	io->lane_max = 0;
+	if (io->io_max > 1 && state->opt.disk_threads > 1)
+		io->lane_max = state->opt.disk_threads - 1;
+	io->lane_map = malloc_nofail(sizeof(struct snapraid_worker) * handle_max * io->lane_max);
+	io->lane_handle_map = malloc_nofail(sizeof(struct snapraid_handle) * handle_max * io->lane_max);
+	for (i = 0; i < handle_max * io->lane_max; ++i) {
+		struct snapraid_worker* lane = &io->lane_map[i];
+		struct snapraid_handle* handle = &io->lane_handle_map[i];
+
+		/* the same disk, with a file not yet opened */
+		*handle = handle_map[i / io->lane_max];
+		handle->file = 0;
+		handle->f = -1;
+		handle->valid_size = 0;
+		handle->cache_count = 0;
+
+		/* no read ahead, as the lanes read alternate blocks */
+		handle->ahead_buffer = 0;
+		handle->ahead_alloc = 0;
+		handle->ahead_count = 0;
+		handle->ahead_max = 0;
+
+		lane->io = io;
+		lane->parent = &io->reader_map[io->data_base + i / io->lane_max];
+		histo_init(&lane->histo_io);
+		histo_init(&lane->histo_wait);
+		lane->handle = handle;
+		lane->parity_handle = 0;
+		lane->func = data_reader;
+		lane->buffer_skew = 0;
+		lane->batch = 1;
+	}
+
+	/* the split lanes are used only with the other threads, and for reading */
+	io->split_lane_max = 0;
+	if (io->io_max > 1 && !parity_writer) {
+		for (i = 0; i < parity_handle_max; ++i) {
+			if (parity_handle_map[i].split_mac > io->split_lane_max + 1)
+				io->split_lane_max = parity_handle_map[i].split_mac - 1;
+		}
+	}
+	io->split_lane_map = malloc_nofail(sizeof(struct snapraid_worker) * parity_handle_max * io->split_lane_max);
+	for (i = 0; i < parity_handle_max * io->split_lane_max; ++i) {
+		struct snapraid_worker* lane = &io->split_lane_map[i];
+		struct snapraid_worker* worker = &io->reader_map[io->parity_base + i / io->split_lane_max];
+
+		lane->io = io;
+		lane->parent = worker;
+		histo_init(&lane->histo_io);
+		histo_init(&lane->histo_wait);
+		lane->handle = 0;
+		lane->parity_handle = worker->parity_handle;
+		lane->func = worker->func;
+		lane->buffer_skew = worker->buffer_skew;
+		lane->throttle_time = 0;
+		lane->batch = 1;
+		lane->split = i % io->split_lane_max + 1;
+		lane->sleeping = 0;
+	}
+
 	for (i = 0; i < io->writer_max; ++i) {
 		struct snapraid_worker* worker = &io->writer_map[i];
 
 		worker->io = io;
+		worker->parent = worker;
+		worker->throttle_time = 0;
+		worker->batch = 1;
+		worker->split = 0;
+		histo_init(&worker->histo_io);
+		histo_init(&worker->histo_wait);
 
 		/* it's a parity write */
 		worker->handle = 0;
@@ -960,6 +2829,43 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 		worker->buffer_skew = handle_max;
 	}
 
+	io_numa_init(io);
+
+	io->throttle_rate = state->opt.io_rate * (uint64_t)MEBI;
+
+	/* the parity threads are used only with the other threads */
+	io->raid_max = 1;
+	if (io->io_max > 1 && state->opt.raid_threads > 1)
+		io->raid_max = state->opt.raid_threads;
+	io->raid_started = 0;
+	io->raid_exit = 0;
+	io->raid_generation = 0;
+	io->raid_pending = 0;
+	io->raid_map = malloc_nofail(sizeof(struct snapraid_raid_worker) * io->raid_max);
+	for (i = 0; i < io->raid_max; ++i) {
+		struct snapraid_raid_worker* worker = &io->raid_map[i];
+
+		worker->io = io;
+		worker->index = i;
+		worker->generation = 0;
+		worker->v = malloc_nofail(io->buffer_max * sizeof(void*));
+	}
+
+	/* the hash threads are used only with the other threads */
+	io->hash_max = 0;
+	if (io->io_max > 1)
+		io->hash_max = state->opt.hash_threads;
+	io->hash_exit = 0;
+	io->hash_map = malloc_nofail(sizeof(struct snapraid_hash_worker) * io->hash_max);
+	for (i = 0; i < io->hash_max; ++i)
+		io->hash_map[i].io = io;
+	io->hash_queue_max = handle_max * io->io_max;
+	io->hash_queue_first = 0;
+	io->hash_queue_count = 0;
+	io->hash_queue = malloc_nofail(sizeof(struct snapraid_task*) * io->hash_queue_max);
+
+	io->ring = 0;
+
 #if HAVE_PTHREAD
 	if (io->io_max > 1) {
 		io_read_next = io_read_next_thread;
@@ -974,9 +2880,25 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 
 		thread_mutex_init(&io->io_mutex, 0);
 		thread_cond_init(&io->read_done, 0);
-		thread_cond_init(&io->read_sched, 0);
 		thread_cond_init(&io->write_done, 0);
-		thread_cond_init(&io->write_sched, 0);
+		for (i = 0; i < io->reader_max; ++i)
+			thread_cond_init(&io->reader_map[i].sched, 0);
+		for (i = 0; i < handle_max * io->lane_max; ++i)
+			thread_cond_init(&io->lane_map[i].sched, 0);
+		for (i = 0; i < parity_handle_max * io->split_lane_max; ++i)
+			thread_cond_init(&io->split_lane_map[i].sched, 0);
+		for (i = 0; i < io->writer_max; ++i)
+			thread_cond_init(&io->writer_map[i].sched, 0);
+		thread_mutex_init(&io->raid_mutex, 0);
+		thread_cond_init(&io->raid_sched, 0);
+		thread_cond_init(&io->raid_done, 0);
+		thread_mutex_init(&io->hash_mutex, 0);
+		thread_cond_init(&io->hash_sched, 0);
+
+		/* the parity workers use the ring, if requested */
+		/* but not if throttled, as the ring submits all the requests at once */
+		if (state->opt.io_uring && parity_handle_max != 0 && io->throttle_rate == 0)
+			io_ring_init(io);
 	} else
 #endif
 	{
@@ -1001,19 +2923,130 @@ void io_done(struct snapraid_io* io)
 		free(io->buffer_alloc_map[i]);
 	}
 
+#if HAVE_PTHREAD
+	if (io->io_max > 1) {
+		thread_mutex_destroy(&io->io_mutex);
+		thread_cond_destroy(&io->read_done);
+		thread_cond_destroy(&io->write_done);
+		for (i = 0; i < io->reader_max; ++i)
+			thread_cond_destroy(&io->reader_map[i].sched);
+		for (i = 0; i < io->data_count * io->lane_max; ++i)
+			thread_cond_destroy(&io->lane_map[i].sched);
+		for (i = 0; i < io->parity_count * io->split_lane_max; ++i)
+			thread_cond_destroy(&io->split_lane_map[i].sched);
+		for (i = 0; i < io->writer_max; ++i)
+			thread_cond_destroy(&io->writer_map[i].sched);
+		thread_mutex_destroy(&io->raid_mutex);
+		thread_cond_destroy(&io->raid_sched);
+		thread_cond_destroy(&io->raid_done);
+		thread_mutex_destroy(&io->hash_mutex);
+		thread_cond_destroy(&io->hash_sched);
+	}
+#endif
+
 	free(io->reader_map);
 	free(io->reader_list);
 	free(io->writer_map);
 	free(io->writer_list);
+	free(io->lane_map);
+	free(io->lane_handle_map);
+	free(io->split_lane_map);
+
+	for (i = 0; i < io->raid_max; ++i)
+		free(io->raid_map[i].v);
+	free(io->raid_map);
+
+	free(io->hash_map);
+	free(io->hash_queue);
+
+	if (io->pool_max != 0) {
+		free(io->pool_map);
+		free(io->pool_alloc);
+		free(io->pool_free);
+	}
+
+	if (io->ring)
+		aio_ring_free(io->ring);
+}
+
+void io_task_hash(struct snapraid_worker* worker, struct snapraid_task* task, unsigned kind, const unsigned char* seed)
+{
+	struct snapraid_io* io = worker->io;
+
+	task->is_hashed = 1;
+
+	/* a full block of zeros has a known hash */
+	if (kind == io->hash_zero_kind && seed == io->state->hashseed
+		&& task->read_size == (int)io->state->block_size
+		&& memiszero(task->buffer, task->read_size)) {
+		task->is_zero = 1;
+		memcpy(task->hash, io->hash_zero, HASH_MAX);
+		return;
+	}
+
+	/* if no thread, compute it now */
+	if (io->hash_max == 0) {
+		memhash(kind, seed, task->hash, task->buffer, task->read_size);
+		return;
+	}
 
 #if HAVE_PTHREAD
-	if (io->io_max > 1) {
-		thread_mutex_destroy(&io->io_mutex);
-		thread_cond_destroy(&io->read_done);
-		thread_cond_destroy(&io->read_sched);
-		thread_cond_destroy(&io->write_done);
-		thread_cond_destroy(&io->write_sched);
+	task->hash_kind = kind;
+	task->hash_seed = seed;
+	task->hash_pending = 1;
+
+	io_hash_push(io, task);
+#endif
+}
+
+unsigned io_writer_batch(struct snapraid_worker* worker, struct snapraid_task* task, unsigned char** buffer_map)
+{
+	struct snapraid_io* io = worker->io;
+	unsigned i;
+
+	buffer_map[0] = task->buffer;
+
+	/* the other tasks of the batch follow the one passed */
+	for (i = 1; i < worker->batch; ++i)
+		buffer_map[i] = worker->task_map[(worker->index + i) % io->io_max].buffer;
+
+	return worker->batch;
+}
+
+void io_raid_begin(struct snapraid_io* io, int nd, int np, size_t size, void** v, void** old, void** out)
+{
+	io->raid_nd = nd;
+	io->raid_np = np;
+	io->raid_size = size;
+	io->raid_v = v;
+	io->raid_old = old;
+	io->raid_out = out;
+
+	/* if no thread, or too many blocks for the slice vectors, */
+	/* everything is computed at the end by the caller */
+	io->raid_sliced = io->raid_max > 1 && (unsigned)(nd + np) <= io->buffer_max;
+
+#if HAVE_PTHREAD
+	if (io->raid_sliced)
+		io_raid_begin_thread(io);
+#endif
+}
+
+void io_raid_end(struct snapraid_io* io)
+{
+	if (!io->raid_sliced) {
+		io_raid_range(io, io->raid_v, 0, io->raid_size);
+		return;
 	}
+
+#if HAVE_PTHREAD
+	io_raid_end_thread(io);
 #endif
 }
 
+void io_raid_gen(struct snapraid_io* io, int nd, int np, size_t size, void** v)
+{
+	io_raid_begin(io, nd, np, size, v, 0, 0);
+	io_raid_end(io);
+}
+
@@ -42,6 +42,21 @@
 #define IO_MIN 3 /* required by writers, readers can work also with 2 */
 #define IO_MAX 128
 
+/**
+ * Minimum read-ahead of a data disk, if the buffers are shared.
+ *
+ * One buffer is used by the caller, and one by the read in progress.
+ */
+#define IO_DEPTH_MIN 2
+
+/**
+ * Burst allowed to a throttled disk, in microseconds.
+ *
+ * A disk idle for a while can read or write at full speed
+ * for this time, before being slowed down to its rate.
+ */
+#define IO_THROTTLE_BURST 100000
+
 /**
  * State of the task.
  */
@@ -53,6 +68,13 @@
 #define TASK_STATE_READY 1 /**< Ready to start. */
 #define TASK_STATE_DONE 2 /**< Task completed. */
 
+/**
+ * State of the request of the task submitted to the ring.
+ */
+#define RING_STATE_NONE 0 /**< Not submitted, or failed. The worker function has to process the task. */
+#define RING_STATE_PENDING 1 /**< Submitted, and not yet completed. */
+#define RING_STATE_DONE 2 /**< Completed. */
+
 /**
  * Task of work.
  *
@@ -69,6 +91,7 @@ struct snapraid_task {
 	struct snapraid_disk* disk; /**< Disk of the file. */
 	unsigned char* buffer; /**< Where to read the data. */
 	block_off_t position; /**< Parity position to read. */
+	int plan; /**< Value returned by the block_is_enabled() callback for this position. */
 
 	/**
 	 * Result of the task.
@@ -77,7 +100,40 @@ struct snapraid_task {
 	struct snapraid_file* file;
 	block_off_t file_pos;
 	int read_size; /**< Size of the data read. */
+	unsigned char hash[HASH_MAX]; /**< Hash of the data read, if computed by the worker. */
+	int is_hashed; /**< If ::hash contains the hash of the data read. */
+	int is_zero; /**< If the data read is a full block of zeros. Set only if hashed by io_task_hash(). */
 	int is_timestamp_different; /**< Report if file has a changed timestamp. */
+
+	/**
+	 * Hash requested to the hash threads.
+	 */
+	unsigned hash_kind; /**< Hash kind to use. */
+	const unsigned char* hash_seed; /**< Hash seed to use. */
+	int hash_pending; /**< If the hash is requested, and not yet computed. */
+
+	/**
+	 * Request submitted to the ring, for parity workers without thread.
+	 */
+	int ring_state; /**< One of the RING_STATE_*. */
+
+	/**
+	 * If the task is not yet completed, for data readers with lanes.
+	 */
+	int pending;
+
+	/**
+	 * If the task is taken by the reader, or by one of its lanes.
+	 *
+	 * It's cleared when the task is scheduled again.
+	 */
+	int taken;
+
+	/**
+	 * Time measures of the access, for the latency stats.
+	 */
+	uint64_t tick_start; /**< Tick when the access was started. */
+	uint64_t tick_done; /**< Tick when the access was completed. */
 };
 
 /**
@@ -89,7 +145,17 @@ struct snapraid_task {
 struct snapraid_worker {
 #if HAVE_PTHREAD
 	pthread_t thread; /**< Thread context for the worker. */
+
+	/**
+	 * Condition for new tasks to process.
+	 *
+	 * The worker waits on this condition, with ::sleeping set, when
+	 * it has no task to process. The IO signals it only when there
+	 * is enough work to do, to not wake up the worker for each block.
+	 */
+	pthread_cond_t sched;
 #endif
+	int sleeping; /**< If the worker is waiting on ::sched. */
 
 	struct snapraid_io* io; /**< Parent pointer. */
 
@@ -117,10 +183,106 @@ struct snapraid_worker {
 	 */
 	unsigned index;
 
+	/**
+	 * Number of tasks written together, starting from ::index.
+	 *
+	 * Only the writers gather more than one task, when consecutive
+	 * positions are queued, up to ::PARITY_WRITE_VECTOR_MAX.
+	 */
+	unsigned batch;
+
 	/**
 	 * Which buffer base index should be used for destination.
 	 */
 	unsigned buffer_skew;
+
+	/**
+	 * Read-ahead of the data readers, if the buffers are shared.
+	 *
+	 * See ::pool_max in the io.
+	 */
+	unsigned depth; /**< Max number of buffers in use, including the one used by the caller. */
+	unsigned held; /**< Number of buffers in use. */
+	unsigned wait_count; /**< Times the caller waited for the worker in the current period. */
+
+	/**
+	 * Latency stats, in ticks.
+	 *
+	 * The ::histo_io is updated only by the thread running the worker,
+	 * and the ::histo_wait only by the caller, so no lock is needed.
+	 * They are collected in the disks by io_stop().
+	 */
+	struct snapraid_histo histo_io; /**< Latency of the accesses. */
+	struct snapraid_histo histo_wait; /**< Time the completed tasks waited for the caller. */
+
+	/**
+	 * Worker owning the tasks.
+	 *
+	 * It's the worker itself, if it's not a lane of another one.
+	 * See ::lane_max in the io.
+	 */
+	struct snapraid_worker* parent;
+
+	/**
+	 * Parity split read by the worker, if the parity reader has split lanes.
+	 *
+	 * The parity reader reads the first split, and each lane another one.
+	 * See ::split_lane_max in the io.
+	 */
+	unsigned split;
+
+	/**
+	 * NUMA node of the disk controller, where the thread runs.
+	 *
+	 * It's -1 if the thread can run everywhere.
+	 * See the --io-numa option.
+	 */
+	int numa;
+
+	/**
+	 * Token bucket of the disk, if throttled.
+	 *
+	 * It's the time in microseconds when all the blocks transferred
+	 * are paid off at the allowed rate. When it's ahead of the current
+	 * time by more than ::IO_THROTTLE_BURST, the worker waits.
+	 * The lanes use the one of their parent.
+	 * See ::throttle_rate in the io.
+	 */
+	uint64_t throttle_time;
+};
+
+/**
+ * Worker for the parity computation.
+ *
+ * This represents a thread designated to compute the parity
+ * of a slice of the blocks.
+ */
+struct snapraid_raid_worker {
+#if HAVE_PTHREAD
+	pthread_t thread; /**< Thread context for the worker. */
+#endif
+
+	struct snapraid_io* io; /**< Parent pointer. */
+
+	unsigned index; /**< Index of the slice to compute. The caller computes the slice 0. */
+
+	unsigned generation; /**< Latest computation processed. */
+
+	void** v; /**< Vector of pointers at the slice of the blocks. */
+};
+
+/**
+ * Worker for the hash computation.
+ *
+ * This represents a thread designated to compute the hash
+ * of the data read by the readers.
+ */
+struct snapraid_hash_worker {
+#if HAVE_PTHREAD
+	pthread_t thread; /**< Thread context for the worker. */
+#endif
+
+	struct snapraid_io* io; /**< Parent pointer. */
 };
 
 /**
@@ -163,15 +325,6 @@ struct snapraid_io {
 	 */
 	pthread_cond_t read_done;
 
-	/**
-	 * Condition for a new read scheduled.
-	 *
-	 * The workers wait on this condition when they are waiting for a new
-	 * read to process.
-	 * The IO signals this condition when new reads are scheduled.
-	 */
-	pthread_cond_t read_sched;
-
 	/**
 	 * Condition for a new write is completed.
 	 *
@@ -181,15 +334,15 @@ struct snapraid_io {
 	 */
 	pthread_cond_t write_done;
 
+#endif
+
 	/**
-	 * Condition for a new write scheduled.
+	 * If the IO is waiting on ::read_done or ::write_done.
 	 *
-	 * The workers wait on this condition when they are waiting for a new
-	 * write to process.
-	 * The IO signals this condition when new writes are scheduled.
+	 * The workers signal the conditions only if the IO is waiting.
 	 */
-	pthread_cond_t write_sched;
-#endif
+	int read_waiting;
+	int write_waiting;
 
 	/**
 	 * Base position for workers.
@@ -229,6 +382,15 @@ struct snapraid_io {
 	void* buffer_alloc_map[IO_MAX]; /**< Allocation map for buffers. */
 	void** buffer_map[IO_MAX]; /**< Buffers for data. */
 
+	/**
+	 * Huge pages.
+	 *
+	 * With huge pages requested, the buffers are aligned at the huge page
+	 * size, and the system is advised to back them with huge pages.
+	 */
+	unsigned huge_alloc; /**< Number of buffer allocations. 0 if huge pages are not requested. */
+	unsigned huge_count; /**< Number of buffer allocations backed by huge pages. */
+
 	/**
 	 * Workers.
 	 *
@@ -264,7 +426,7 @@ struct snapraid_io {
 	 * it goes again to 0.
 	 *
 	 * When the caller finish with the current index,
-	 * it's incremented, and a read_sched() signal is sent.
+	 * it's incremented, and the waiting readers are signaled.
 	 *
 	 * In monothread mode it isn't the task index,
 	 * but the worker index.
@@ -278,7 +440,7 @@ struct snapraid_io {
 	 * it goes again to 0.
 	 *
 	 * When the caller finish with the current index,
-	 * it's incremented, and a write_sched() signal is sent.
+	 * it's incremented, and the waiting writers are signaled.
 	 *
 	 * In monothread mode it isn't the task index,
 	 * but the worker index.
@@ -289,8 +451,159 @@ struct snapraid_io {
 	 * Counts the error happening in the writers.
 	 */
 	int writer_error[IO_WRITER_ERROR_MAX];
+
+	/**
+	 * Workers for the parity computation.
+	 *
+	 * The threads are started at the first io_raid_gen() call,
+	 * and are kept until io_stop().
+	 */
+	unsigned raid_max; /**< Number of slices, including the one computed by the caller. */
+	int raid_started; /**< If the threads are started. */
+	int raid_exit; /**< Exit condition for the threads. */
+	struct snapraid_raid_worker* raid_map; /**< Vector of workers, with ::raid_max elements. */
+	int raid_numa; /**< NUMA node where the threads run, the one with most data disks. -1 for everywhere. */
+
+#if HAVE_PTHREAD
+	/**
+	 * Mutex and conditions for the parity computation.
+	 *
+	 * The caller signals ::raid_sched when a new computation is ready,
+	 * and the workers signal ::raid_done when the last slice is completed.
+	 */
+	pthread_mutex_t raid_mutex;
+	pthread_cond_t raid_sched;
+	pthread_cond_t raid_done;
+#endif
+
+	/**
+	 * Parity computation in progress.
+	 */
+	unsigned raid_generation; /**< Incremented at each new computation. */
+	unsigned raid_pending; /**< Number of slices not yet completed by the workers. */
+	int raid_nd;
+	int raid_np;
+	size_t raid_size;
+	void** raid_v;
+	void** raid_old; /**< Old parity to update, or 0 to compute a new one. */
+	void** raid_out; /**< Updated parity, used only with ::raid_old. */
+	int raid_sliced; /**< If the slices are computed by the threads. */
+
+	/**
+	 * Workers for the hash computation.
+	 *
+	 * The readers queue the data read, and continue with the next read,
+	 * while these threads compute the hashes.
+	 * A task is returned by io_data_read() only when its hash is computed.
+	 */
+	unsigned hash_max; /**< Number of threads. 0 to compute the hash in the readers. */
+	int hash_exit; /**< Exit condition for the threads. */
+	struct snapraid_hash_worker* hash_map; /**< Vector of workers, with ::hash_max elements. */
+
+	/**
+	 * Hash of a full block of zeros, computed once with the hash and seed of the state.
+	 *
+	 * Zero blocks are common in sparse and preallocated files,
+	 * and checking them is a lot faster than hashing them.
+	 */
+	unsigned hash_zero_kind; /**< Hash kind of ::hash_zero, or HASH_UNDEFINED if not computed. */
+	unsigned char hash_zero[HASH_MAX];
+
+#if HAVE_PTHREAD
+	/**
+	 * Mutex and condition for the hash queue.
+	 *
+	 * The readers signal ::hash_sched when a new task is queued.
+	 * The completion is signaled with ::read_done, like for a read.
+	 */
+	pthread_mutex_t hash_mutex;
+	pthread_cond_t hash_sched;
+#endif
+
+	/**
+	 * Queue of tasks to hash.
+	 *
+	 * It's a ring with space for all the data tasks.
+	 */
+	struct snapraid_task** hash_queue;
+	unsigned hash_queue_max; /**< Size of the ring. */
+	unsigned hash_queue_first; /**< First task in the ring. */
+	unsigned hash_queue_count; /**< Number of tasks in the ring. */
+
+	/**
+	 * Ring used for the parity reads and writes.
+	 *
+	 * If not 0, the parity workers have no thread, and their requests
+	 * are submitted and completed by the caller, without waiting
+	 * for them until the buffer is needed.
+	 * The requests are identified by the task index plus IO_MAX
+	 * multiplied by the worker index, with the writers after the readers.
+	 */
+	struct aio_ring* ring;
+
+	/**
+	 * Buffers shared by the data readers.
+	 *
+	 * If ::pool_max is not 0, the data buffers of ::buffer_map are not
+	 * fixed. A reader takes one from the pool when it starts a task,
+	 * and the caller returns it when moving to the next position.
+	 *
+	 * Each reader can use up to its ::depth buffers, and the depths are
+	 * adapted periodically, moving buffers from the disks the caller never
+	 * waits for, to the ones it waits for.
+	 * It's ensured that the free buffers are always enough to let all
+	 * the readers reach their depth, to never block the caller.
+	 */
+	unsigned pool_max; /**< Number of buffers. 0 if not used. */
+	void* pool_alloc; /**< Allocation of the buffers. */
+	void** pool_map; /**< Vector of all the buffers. */
+	void** pool_free; /**< Stack of the free buffers. */
+	unsigned pool_free_count; /**< Number of free buffers. */
+	unsigned pool_period; /**< Positions processed in the current period. */
+
+	/**
+	 * Additional readers of the data disks.
+	 *
+	 * If ::lane_max is not 0, each data reader has ::lane_max more
+	 * lanes, each one with its own thread and file handle.
+	 * The worker and its lanes take the tasks of the worker ring in
+	 * order, keeping more reads of the same disk in progress, and
+	 * complete them in any order.
+	 */
+	unsigned lane_max; /**< Number of additional lanes for each data reader. 0 if not used. */
+	struct snapraid_worker* lane_map; /**< Vector of lanes. The ones of the data reader i start at i * ::lane_max. */
+	struct snapraid_handle* lane_handle_map; /**< Vector of the handles of the lanes. */
+
+	/**
+	 * Additional readers of the parity splits.
+	 *
+	 * If ::split_lane_max is not 0, each parity reader split in more
+	 * files has a lane for each split after the first, each one with its own
+	 * thread. The worker and its lanes take the tasks of the worker ring
+	 * at positions inside their split, the oldest first, keeping all the
+	 * split disks busy at the same time, and complete them in any order.
+	 * Only the lanes of the existing splits are started.
+	 */
+	unsigned split_lane_max; /**< Number of additional lanes for each parity reader. 0 if not used. */
+	struct snapraid_worker* split_lane_map; /**< Vector of lanes. The ones of the parity reader i start at i * ::split_lane_max. */
+
+	/**
+	 * Max rate of each disk in bytes per second.
+	 *
+	 * Each data and parity worker waits before starting a new block
+	 * if it's going faster. 0 if not used.
+	 */
+	uint64_t throttle_rate;
 };
 
+/**
+ * Get the number of IO buffers used by io_init().
+ *
+ * \param block_size The size of the block.
+ * \param io_cache The number of IO buffers requested. 0 for default.
+ */
+unsigned io_cache_max(unsigned block_size, unsigned io_cache);
+
 /**
  * Initialize the InputOutput workers.
  *
@@ -312,6 +625,9 @@ void io_done(struct snapraid_io* io);
 
 /**
  * Start all the worker threads.
+ *
+ * The block_is_enabled() callback returns 0 for the positions to skip.
+ * Any other value is stored in the ::plan field of the reading tasks.
  */
 extern void (*io_start)(struct snapraid_io* io,
 	block_off_t blockstart, block_off_t blockmax,
@@ -319,6 +635,8 @@ extern void (*io_start)(struct snapraid_io* io,
 
 /**
  * Stop all the worker threads.
+ *
+ * The latency stats of the workers are collected in the disks.
  */
 extern void (*io_stop)(struct snapraid_io* io);
 
@@ -396,5 +714,75 @@ extern void (*io_write_next)(struct snapraid_io* io, block_off_t blockcur, int s
  */
 extern void (*io_refresh)(struct snapraid_io* io);
 
+/**
+ * Compute the hash of the data read by a task.
+ *
+ * It's called by the readers, and the hash is stored in ::hash.
+ * If hash threads are used, the computation is queued to them,
+ * and the reader can continue with the next read.
+ *
+ * \param worker The reader.
+ * \param task The task with the data read.
+ * \param kind The hash kind.
+ * \param seed The hash seed.
+ */
+void io_task_hash(struct snapraid_worker* worker, struct snapraid_task* task, unsigned kind, const unsigned char* seed);
+
+/**
+ * Get the buffers of the tasks written together by a writer.
+ *
+ * It's called by the writers, and the buffers must be written
+ * at consecutive positions, starting from the one of the task.
+ *
+ * \param worker The writer.
+ * \param task The task to write, the first of the batch.
+ * \param buffer_map Vector of PARITY_WRITE_VECTOR_MAX elements.
+ * \return The number of buffers.
+ */
+unsigned io_writer_batch(struct snapraid_worker* worker, struct snapraid_task* task, unsigned char** buffer_map);
+
+/**
+ * Compute the parity like raid_gen().
+ *
+ * The blocks are split in slices, computed at the same time by the
+ * parity threads, as set by the --raid-threads option.
+ * It must be called between io_start() and io_stop().
+ *
+ * \param io InputOutput context.
+ * \param nd Number of data blocks.
+ * \param np Number of parity blocks.
+ * \param size Size of the blocks. It must be a multiplier of 64.
+ * \param v Vector of pointers to the blocks of data and parity.
+ */
+void io_raid_gen(struct snapraid_io* io, int nd, int np, size_t size, void** v);
+
+/**
+ * Start the computation of the parity, like io_raid_gen().
+ *
+ * The caller can continue with other work, not touching the blocks,
+ * and it must call io_raid_end() to complete the computation.
+ *
+ * If ::old is not 0, the parity computed in the parity blocks of ::v is
+ * added to the old parity, and stored in ::out, as needed to update
+ * the parity with only the changed data. The addition is done in the
+ * same slices, without waiting the end of the computation.
+ *
+ * \param io InputOutput context.
+ * \param nd Number of data blocks.
+ * \param np Number of parity blocks.
+ * \param size Size of the blocks. It must be a multiplier of 64.
+ * \param v Vector of pointers to the blocks of data and parity.
+ * \param old Vector of pointers to the old parity blocks, or 0.
+ * \param out Vector of pointers to the updated parity blocks, used only with ::old.
+ */
+void io_raid_begin(struct snapraid_io* io, int nd, int np, size_t size, void** v, void** old, void** out);
+
+/**
+ * Complete the computation of the parity started with io_raid_begin().
+ *
+ * The caller computes its slice, or all the blocks without the parity threads.
+ */
+void io_raid_end(struct snapraid_io* io);
+
 #endif
 
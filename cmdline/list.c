@@ -26,6 +26,258 @@
 /****************************************************************************/
 /* list */
 
+/**
+ * Size of the chunks of output generated for each disk.
+ */
+#define LIST_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * Max number of chunks of each disk waiting to be written.
+ */
+#define LIST_CHUNK_MAX 8
+
+static const char* link_type(struct snapraid_link* slink)
+{
+	switch (slink->flag & FILE_IS_LINK_MASK) {
+	case FILE_IS_HARDLINK : return "hardlink";
+	case FILE_IS_SYMLINK : return "symlink";
+	case FILE_IS_SYMDIR : return "symdir";
+	case FILE_IS_JUNCTION : return "junction";
+	}
+
+	/* LCOV_EXCL_START */
+	return "unknown";
+	/* LCOV_EXCL_STOP */
+}
+
+/**
+ * Chunk of machine-readable output.
+ */
+struct snapraid_list_chunk {
+	char* data;
+	size_t size;
+
+	/* nodes for data structures */
+	tommy_node node;
+};
+
+/**
+ * Machine-readable output of a disk.
+ */
+struct snapraid_list_disk {
+	struct snapraid_disk* disk;
+	int format; /**< Output format. */
+	unsigned file_count;
+	data_off_t file_size;
+	unsigned link_count;
+#if HAVE_PTHREAD
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; /**< Signaled when a chunk is added or removed. */
+	tommy_list chunklist; /**< Chunks ready to be written. */
+	unsigned chunk_count; /**< Number of chunks in the list. */
+	int done; /**< If all the chunks of the disk are in the list. */
+#endif
+};
+
+static void list_write(const char* data, size_t size)
+{
+	if (size != 0 && fwrite(data, size, 1, stdout) != 1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the output. %s.\n", strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+/**
+ * Pass the output generated to the writer.
+ */
+static void list_push(struct snapraid_list_disk* ld, struct snapraid_output* out)
+{
+#if HAVE_PTHREAD
+	struct snapraid_list_chunk* chunk;
+
+	chunk = malloc_nofail(sizeof(struct snapraid_list_chunk));
+	chunk->data = out->data;
+	chunk->size = out->size;
+
+	/* continue with a new buffer */
+	output_init(out, ld->format, LIST_CHUNK_SIZE + ESC_MAX);
+
+	thread_mutex_lock(&ld->mutex);
+
+	/* don't go too much ahead of the writer */
+	while (ld->chunk_count >= LIST_CHUNK_MAX)
+		thread_cond_wait(&ld->cond, &ld->mutex);
+
+	tommy_list_insert_tail(&ld->chunklist, &chunk->node, chunk);
+	++ld->chunk_count;
+
+	thread_cond_signal_and_unlock(&ld->cond, &ld->mutex);
+#else
+	(void)ld;
+
+	list_write(out->data, out->size);
+	out->size = 0;
+#endif
+}
+
+/**
+ * Generate the machine-readable output of a disk.
+ */
+static void list_generate(struct snapraid_list_disk* ld)
+{
+	struct snapraid_disk* disk = ld->disk;
+	struct snapraid_output out;
+	tommy_node* j;
+
+	output_init(&out, ld->format, LIST_CHUNK_SIZE + ESC_MAX);
+
+	/* sort by name */
+	tommy_list_sort(&disk->filelist, file_path_compare);
+
+	/* for each file */
+	for (j = disk->filelist; j != 0; j = j->next) {
+		struct snapraid_file* file = j->data;
+
+		++ld->file_count;
+		ld->file_size += file->size;
+
+		output_begin(&out);
+		output_field(&out, "type", "file");
+		output_field(&out, "disk", disk->name);
+		output_field(&out, "path", file->sub);
+		output_field_u64(&out, "size", file->size);
+		output_field_i64(&out, "mtime", file->mtime_sec);
+		output_field_i64(&out, "mtime_nsec", file->mtime_nsec);
+		output_field_u64(&out, "inode", file->inode);
+		output_end(&out);
+
+		if (out.size >= LIST_CHUNK_SIZE)
+			list_push(ld, &out);
+	}
+
+	/* sort by name */
+	tommy_list_sort(&disk->linklist, link_alpha_compare);
+
+	/* for each link */
+	for (j = disk->linklist; j != 0; j = j->next) {
+		struct snapraid_link* slink = j->data;
+
+		++ld->link_count;
+
+		output_begin(&out);
+		output_field(&out, "type", link_type(slink));
+		output_field(&out, "disk", disk->name);
+		output_field(&out, "path", slink->sub);
+		output_field(&out, "target", slink->linkto);
+		output_end(&out);
+
+		if (out.size >= LIST_CHUNK_SIZE)
+			list_push(ld, &out);
+	}
+
+	if (out.size != 0)
+		list_push(ld, &out);
+
+	output_done(&out);
+}
+
+#if HAVE_PTHREAD
+static void* list_thread(void* arg)
+{
+	struct snapraid_list_disk* ld = arg;
+
+	list_generate(ld);
+
+	thread_mutex_lock(&ld->mutex);
+	ld->done = 1;
+	thread_cond_signal_and_unlock(&ld->cond, &ld->mutex);
+
+	return 0;
+}
+#endif
+
+/**
+ * List the files in a machine-readable format.
+ *
+ * The output of the disks is generated in parallel, and written in the disk order.
+ */
+static void state_list_output(struct snapraid_state* state, unsigned* file_count, data_off_t* file_size, unsigned* link_count)
+{
+	struct snapraid_list_disk* map;
+	unsigned disk_max;
+	unsigned d;
+	tommy_node* i;
+
+	disk_max = tommy_list_count(&state->disklist);
+	map = calloc_nofail(disk_max, sizeof(struct snapraid_list_disk));
+
+	for (i = state->disklist, d = 0; i != 0; i = i->next, ++d) {
+		struct snapraid_list_disk* ld = &map[d];
+
+		ld->disk = i->data;
+		ld->format = state->opt.output_format;
+#if HAVE_PTHREAD
+		thread_mutex_init(&ld->mutex, 0);
+		thread_cond_init(&ld->cond, 0);
+		tommy_list_init(&ld->chunklist);
+		thread_create(&ld->thread, 0, list_thread, ld);
+#else
+		list_generate(ld);
+#endif
+	}
+
+	for (d = 0; d < disk_max; ++d) {
+		struct snapraid_list_disk* ld = &map[d];
+
+#if HAVE_PTHREAD
+		while (1) {
+			struct snapraid_list_chunk* chunk;
+
+			thread_mutex_lock(&ld->mutex);
+
+			while (ld->chunk_count == 0 && !ld->done)
+				thread_cond_wait(&ld->cond, &ld->mutex);
+
+			if (ld->chunk_count == 0) {
+				thread_mutex_unlock(&ld->mutex);
+				break;
+			}
+
+			chunk = tommy_list_head(&ld->chunklist)->data;
+			tommy_list_remove_existing(&ld->chunklist, &chunk->node);
+			--ld->chunk_count;
+
+			thread_cond_signal_and_unlock(&ld->cond, &ld->mutex);
+
+			list_write(chunk->data, chunk->size);
+
+			free(chunk->data);
+			free(chunk);
+		}
+
+		thread_join(ld->thread, 0);
+		thread_cond_destroy(&ld->cond);
+		thread_mutex_destroy(&ld->mutex);
+#endif
+
+		*file_count += ld->file_count;
+		*file_size += ld->file_size;
+		*link_count += ld->link_count;
+	}
+
+	if (fflush(stdout) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the output. %s.\n", strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	free(map);
+}
+
 void state_list(struct snapraid_state* state)
 {
 	tommy_node* i;
@@ -41,6 +293,11 @@ void state_list(struct snapraid_state* state)
 
 	msg_progress("Listing...\n");
 
+	if (state->opt.output_format != OUTPUT_TEXT) {
+		state_list_output(state, &file_count, &file_size, &link_count);
+		goto summary;
+	}
+
 	/* for each disk */
 	for (i = state->disklist; i != 0; i = i->next) {
 		tommy_node* j;
@@ -86,17 +343,7 @@ void state_list(struct snapraid_state* state)
 		/* for each link */
 		for (j = disk->linklist; j != 0; j = j->next) {
 			struct snapraid_link* slink = j->data;
-			const char* type;
-
-			switch (slink->flag & FILE_IS_LINK_MASK) {
-			case FILE_IS_HARDLINK : type = "hardlink"; break;
-			case FILE_IS_SYMLINK : type = "symlink"; break;
-			case FILE_IS_SYMDIR : type = "symdir"; break;
-			case FILE_IS_JUNCTION : type = "junction"; break;
-			/* LCOV_EXCL_START */
-			default : type = "unknown"; break;
-				/* LCOV_EXCL_STOP */
-			}
+			const char* type = link_type(slink);
 
 			++link_count;
 
@@ -110,6 +357,7 @@ void state_list(struct snapraid_state* state)
 		}
 	}
 
+summary:
 	msg_status("\n");
 	msg_status("%8u files, for %" PRIu64 " GB\n", file_count, file_size / GIGA);
 	msg_status("%8u links\n", link_count);
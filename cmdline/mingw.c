@@ -37,9 +37,36 @@ int exit_sync_needed = 2;
 #define WIN32_ES_AWAYMODE_REQUIRED    0x00000040L
 #define WIN32_ES_CONTINUOUS           0x80000000L
 
+/* For SetPriorityClass */
+#define WIN32_PROCESS_MODE_BACKGROUND_BEGIN 0x00100000
+
 /* File Index */
 #define FILE_INVALID_FILE_ID          ((ULONGLONG)-1LL)
 
+/* For GetFileInformationByHandleEx, available from Windows 8 and Windows Server 2012 */
+#define WIN32_FILE_ID_EXTD_DIRECTORY_INFO ((FILE_INFO_BY_HANDLE_CLASS)19)
+
+typedef struct _WIN32_FILE_ID_EXTD_DIR_INFO {
+	ULONG NextEntryOffset;
+	ULONG FileIndex;
+	LARGE_INTEGER CreationTime;
+	LARGE_INTEGER LastAccessTime;
+	LARGE_INTEGER LastWriteTime;
+	LARGE_INTEGER ChangeTime;
+	LARGE_INTEGER EndOfFile;
+	LARGE_INTEGER AllocationSize;
+	ULONG FileAttributes;
+	ULONG FileNameLength;
+	ULONG EaSize;
+	ULONG ReparsePointTag;
+	BYTE FileId[16];
+	WCHAR FileName[1];
+} WIN32_FILE_ID_EXTD_DIR_INFO;
+
+/* For FindFirstFileEx, available from Windows 7 */
+#define WIN32_FIND_EX_INFO_BASIC ((FINDEX_INFO_LEVELS)1)
+#define WIN32_FIND_FIRST_EX_LARGE_FETCH 0x00000002
+
 /**
  * Direct access to RtlGenRandom().
  * This function is accessible only with LoadLibrary() and it's available from Windows XP.
@@ -572,6 +599,57 @@ static int windows_stream2stat(const BY_HANDLE_FILE_INFORMATION* info, const FIL
 	return 0;
 }
 
+/**
+ * Convert Windows extended directory stream info to the Unix stat format.
+ */
+static int windows_extd2stat(const BY_HANDLE_FILE_INFORMATION* info, const WIN32_FILE_ID_EXTD_DIR_INFO* stream, struct windows_stat* st)
+{
+	uint64_t mtime;
+	uint64_t high;
+	unsigned i;
+
+	/* the FILE_ID_EXTD_DIR_INFO has the ReparseTag, avoiding to call lstat_sync() for reparse points */
+	windows_attr2stat(stream->FileAttributes, stream->ReparsePointTag, st);
+
+	st->st_size = stream->EndOfFile.QuadPart;
+
+	mtime = stream->LastWriteTime.QuadPart;
+
+	/*
+	 * Convert to unix time
+	 *
+	 * How To Convert a UNIX time_t to a Win32 FILETIME or SYSTEMTIME
+	 * http://support.microsoft.com/kb/167296
+	 */
+	mtime -= 116444736000000000LL;
+	st->st_mtime = mtime / 10000000;
+	st->st_mtimensec = (mtime % 10000000) * 100;
+
+	/* the 128 bit ID is little endian, with the 64 bit one in the lower part */
+	st->st_ino = 0;
+	high = 0;
+	for (i = 0; i < 8; ++i) {
+		st->st_ino |= (uint64_t)stream->FileId[i] << (i * 8);
+		high |= (uint64_t)stream->FileId[i + 8] << (i * 8);
+	}
+
+	st->st_nlink = info->nNumberOfLinks;
+
+	st->st_dev = info->dwVolumeSerialNumber;
+
+	/* directory listing doesn't ensure to return synced information */
+	st->st_sync = 0;
+
+	/* in ReFS the IDs are 128 bit, and they may not fit in 64 bit */
+	if (high != 0 || st->st_ino == FILE_INVALID_FILE_ID) {
+		log_fatal("Invalid inode number! Is this ReFS?\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
 /**
  * Convert Windows findfirst info to the Unix stat format.
  */
@@ -650,6 +728,25 @@ static int windows_stream2dirent(const BY_HANDLE_FILE_INFORMATION* info, const F
 	return windows_stream2stat(info, stream, &dirent->d_stat);
 }
 
+static int windows_extd2dirent(const BY_HANDLE_FILE_INFORMATION* info, const WIN32_FILE_ID_EXTD_DIR_INFO* stream, struct windows_dirent* dirent)
+{
+	char conv_buf[CONV_MAX];
+	const char* name;
+	size_t len;
+
+	name = u16tou8ex(conv_buf, stream->FileName, stream->FileNameLength / 2, &len);
+
+	if (len + 1 >= sizeof(dirent->d_name)) {
+		log_fatal("Name too long\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(dirent->d_name, name, len);
+	dirent->d_name[len] = 0;
+
+	return windows_extd2stat(info, stream, &dirent->d_stat);
+}
+
 /**
  * Convert Windows error to errno.
  */
@@ -1267,9 +1364,20 @@ struct windows_dir_struct {
 	unsigned char* buffer;
 	unsigned buffer_size;
 	unsigned buffer_pos;
+	FILE_INFO_BY_HANDLE_CLASS info_class;
+	int started;
 	int state;
 };
 
+/**
+ * Size of the buffer used to read the directories.
+ *
+ * A large buffer returns a whole directory with few calls, but the network
+ * shares limit it to 64 kB, and in such case we retry with the small one.
+ */
+#define DIR_BUFFER_LARGE (1024 * 1024)
+#define DIR_BUFFER_SMALL (64 * 1024)
+
 #define DIR_STATE_EOF -1 /**< End of the dir stream */
 #define DIR_STATE_EMPTY 0 /**< The entry is empty. */
 #define DIR_STATE_FILLED 1 /**< The entry is valid. */
@@ -1296,7 +1404,12 @@ static windows_dir* windows_opendir_find(const char* dir)
 	wdir[len++] = L'*';
 	wdir[len++] = 0;
 
-	dirstream->h = FindFirstFileW(wdir, &dirstream->find);
+	/* get the entries in large batches, without the short names */
+	dirstream->h = FindFirstFileExW(wdir, WIN32_FIND_EX_INFO_BASIC, &dirstream->find, FindExSearchNameMatch, 0, WIN32_FIND_FIRST_EX_LARGE_FETCH);
+	if (dirstream->h == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER) {
+		/* before Windows 7 the FindExInfoBasic and the large fetch are not supported */
+		dirstream->h = FindFirstFileW(wdir, &dirstream->find);
+	}
 	if (dirstream->h == INVALID_HANDLE_VALUE) {
 		DWORD error = GetLastError();
 
@@ -1364,11 +1477,21 @@ static int windows_closedir_find(windows_dir* dirstream)
 	return 0;
 }
 
-static int windows_first_stream(windows_dir* dirstream)
+static int windows_entry_stream(windows_dir* dirstream)
 {
-	FILE_ID_BOTH_DIR_INFO* fd;
+	void* fd = dirstream->buffer + dirstream->buffer_pos;
+
+	dirstream->state = DIR_STATE_FILLED;
+
+	if (dirstream->info_class == WIN32_FILE_ID_EXTD_DIRECTORY_INFO)
+		return windows_extd2dirent(&dirstream->info, fd, &dirstream->entry);
+	else
+		return windows_stream2dirent(&dirstream->info, fd, &dirstream->entry);
+}
 
-	if (!GetFileInformationByHandleEx(dirstream->h, FileIdBothDirectoryInfo, dirstream->buffer, dirstream->buffer_size)) {
+static int windows_first_stream(windows_dir* dirstream)
+{
+	while (!GetFileInformationByHandleEx(dirstream->h, dirstream->info_class, dirstream->buffer, dirstream->buffer_size)) {
 		DWORD error = GetLastError();
 
 		if (error == ERROR_NO_MORE_FILES) {
@@ -1376,26 +1499,40 @@ static int windows_first_stream(windows_dir* dirstream)
 			return 0;
 		}
 
+		/* before reading the first entries, fall back to what is supported */
+		if (!dirstream->started && (error == ERROR_INVALID_PARAMETER || error == ERROR_INVALID_FUNCTION || error == ERROR_NOT_SUPPORTED)) {
+			if (dirstream->info_class == WIN32_FILE_ID_EXTD_DIRECTORY_INFO) {
+				/* before Windows 8 and in some file-systems, the extended info is not supported */
+				dirstream->info_class = FileIdBothDirectoryInfo;
+				continue;
+			}
+			if (dirstream->buffer_size > DIR_BUFFER_SMALL) {
+				/* the network shares don't support buffers larger than 64 kB */
+				dirstream->buffer_size = DIR_BUFFER_SMALL;
+				continue;
+			}
+		}
+
 		windows_errno(error);
 		return -1;
 	}
 
 	/* get the first entry */
-	dirstream->state = DIR_STATE_FILLED;
+	dirstream->started = 1;
 	dirstream->buffer_pos = 0;
-	fd = (FILE_ID_BOTH_DIR_INFO*)dirstream->buffer;
-	return windows_stream2dirent(&dirstream->info, fd, &dirstream->entry);
+	return windows_entry_stream(dirstream);
 }
 
 static int windows_next_stream(windows_dir* dirstream)
 {
-	FILE_ID_BOTH_DIR_INFO* fd;
+	/* the NextEntryOffset is the first field of all the directory info */
+	ULONG* next_offset;
 
 	/* last entry read */
-	fd = (FILE_ID_BOTH_DIR_INFO*)(dirstream->buffer + dirstream->buffer_pos);
+	next_offset = (ULONG*)(dirstream->buffer + dirstream->buffer_pos);
 
 	/* check if there is a next one */
-	if (fd->NextEntryOffset == 0) {
+	if (*next_offset == 0) {
 		/* if not, fill it up again */
 		if (windows_first_stream(dirstream) != 0)
 			return -1;
@@ -1403,10 +1540,8 @@ static int windows_next_stream(windows_dir* dirstream)
 	}
 
 	/* go to the next one */
-	dirstream->state = DIR_STATE_FILLED;
-	dirstream->buffer_pos += fd->NextEntryOffset;
-	fd = (FILE_ID_BOTH_DIR_INFO*)(dirstream->buffer + dirstream->buffer_pos);
-	return windows_stream2dirent(&dirstream->info, fd, &dirstream->entry);
+	dirstream->buffer_pos += *next_offset;
+	return windows_entry_stream(dirstream);
 }
 
 static windows_dir* windows_opendir_stream(const char* dir)
@@ -1423,8 +1558,10 @@ static windows_dir* windows_opendir_stream(const char* dir)
 
 	wdir = convert(conv_buf, dir);
 
-	/* uses a 64 kB buffer for reading directory */
-	dirstream->buffer_size = 64 * 1024;
+	/* start with the extended info and the large buffer, and fall back if not supported */
+	dirstream->info_class = WIN32_FILE_ID_EXTD_DIRECTORY_INFO;
+	dirstream->started = 0;
+	dirstream->buffer_size = DIR_BUFFER_LARGE;
 	dirstream->buffer = malloc(dirstream->buffer_size);
 	if (!dirstream->buffer) {
 		log_fatal("Low memory\n");
@@ -1716,6 +1853,15 @@ int filephy(const char* file, uint64_t size, uint64_t* physical)
 	return 0;
 }
 
+int fileclone(const char* path, const char* path_src)
+{
+	/* the shared extents are not reported */
+	(void)path;
+	(void)path_src;
+
+	return -1;
+}
+
 int fsinfo(const char* path, int* has_persistent_inode, int* has_syncronized_hardlinks, uint64_t* total_space, uint64_t* free_space)
 {
 	wchar_t conv_buf[CONV_MAX];
@@ -1790,6 +1936,504 @@ int fsinfo(const char* path, int* has_persistent_inode, int* has_syncronized_har
 	return 0;
 }
 
+/**
+ * Size of the buffer used to read the USN journal.
+ */
+#define JOURNAL_BUFFER_SIZE (64 * 1024)
+
+/**
+ * Get the normalized path of a directory handle, terminated with a backslash.
+ *
+ * The volume is always specified with the GUID, to have
+ * the same path independently on how the volume is mounted.
+ * Return the length of the path, or 0 on error.
+ */
+static DWORD windows_handle_dir(HANDLE h, wchar_t* path, DWORD size)
+{
+	DWORD len;
+
+	len = GetFinalPathNameByHandleW(h, path, size, FILE_NAME_NORMALIZED | VOLUME_NAME_GUID);
+	if (len == 0 || len + 2 > size)
+		return 0;
+
+	if (path[len - 1] != L'\\') {
+		path[len++] = L'\\';
+		path[len] = 0;
+	}
+
+	return len;
+}
+
+static int journal_compare(const void* void_a, const void* void_b)
+{
+	const uint64_t* a = void_a;
+	const uint64_t* b = void_b;
+
+	if (*a < *b)
+		return -1;
+	if (*a > *b)
+		return 1;
+	return 0;
+}
+
+int fsjournal(const char* dir, uint64_t* journal_id, uint64_t* journal_pos, void (*func)(void* arg, const char* sub), void* arg)
+{
+	wchar_t conv_buf[CONV_MAX];
+	char conv_buf_sub[CONV_MAX];
+	wchar_t dir_path[CONV_MAX];
+	wchar_t parent_path[CONV_MAX];
+	WCHAR volume_mount[MAX_PATH];
+	WCHAR volume_guid[MAX_PATH];
+	USN_JOURNAL_DATA journal;
+	READ_USN_JOURNAL_DATA read_data;
+	unsigned char* buffer;
+	uint64_t* parent_map;
+	size_t parent_max;
+	size_t parent_mac;
+	size_t i, j;
+	HANDLE hv;
+	HANDLE h;
+	DWORD dir_len;
+	DWORD n;
+	int ret;
+
+	/* get the normalized path of the disk dir */
+	h = CreateFileW(convert(conv_buf, dir), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+	if (h == INVALID_HANDLE_VALUE) {
+		windows_errno(GetLastError());
+		return -1;
+	}
+
+	dir_len = windows_handle_dir(h, dir_path, CONV_MAX);
+	if (dir_len == 0) {
+		DWORD error = GetLastError();
+		CloseHandle(h);
+		windows_errno(error);
+		return -1;
+	}
+
+	CloseHandle(h);
+
+	/* get the volume containing the dir */
+	if (!GetVolumePathNameW(convert(conv_buf, dir), volume_mount, sizeof(volume_mount) / sizeof(WCHAR))) {
+		windows_errno(GetLastError());
+		return -1;
+	}
+
+	if (!GetVolumeNameForVolumeMountPointW(volume_mount, volume_guid, sizeof(volume_guid) / sizeof(WCHAR))) {
+		windows_errno(GetLastError());
+		return -1;
+	}
+
+	/* remove the final slash, otherwise CreateFile() opens the file-system */
+	/* and not the volume */
+	n = wcslen(volume_guid);
+	if (n != 0 && volume_guid[n - 1] == L'\\')
+		volume_guid[n - 1] = 0;
+
+	/* open the volume, note that this requires administrator rights */
+	hv = CreateFileW(volume_guid, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0, 0);
+	if (hv == INVALID_HANDLE_VALUE) {
+		windows_errno(GetLastError());
+		return -1;
+	}
+
+	/* get the present state of the journal */
+	if (!DeviceIoControl(hv, FSCTL_QUERY_USN_JOURNAL, 0, 0, &journal, sizeof(journal), &n, 0)) {
+		/* ERROR_JOURNAL_NOT_ACTIVE, or ERROR_INVALID_FUNCTION if not NTFS/ReFS */
+		CloseHandle(hv);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	/* if the journal is different, or the position is not available anymore */
+	if (*journal_id != (uint64_t)journal.UsnJournalID
+		|| *journal_pos < (uint64_t)journal.LowestValidUsn
+		|| *journal_pos > (uint64_t)journal.NextUsn
+	) {
+		CloseHandle(hv);
+		*journal_id = journal.UsnJournalID;
+		*journal_pos = journal.NextUsn;
+		return 1;
+	}
+
+	buffer = malloc_nofail(JOURNAL_BUFFER_SIZE);
+	parent_max = 1024;
+	parent_mac = 0;
+	parent_map = malloc_nofail(parent_max * sizeof(uint64_t));
+
+	/* read all the records up to the present position */
+	/* records after it may be also read, but this is harmless */
+	ret = 0;
+	read_data.StartUsn = *journal_pos;
+	read_data.ReasonMask = 0xFFFFFFFF;
+	read_data.ReturnOnlyOnClose = 0;
+	read_data.Timeout = 0;
+	read_data.BytesToWaitFor = 0;
+	read_data.UsnJournalID = journal.UsnJournalID;
+	while (read_data.StartUsn < journal.NextUsn) {
+		USN next;
+		DWORD offset;
+
+		if (!DeviceIoControl(hv, FSCTL_READ_USN_JOURNAL, &read_data, sizeof(read_data), buffer, JOURNAL_BUFFER_SIZE, &n, 0)) {
+			/* ERROR_JOURNAL_ENTRY_DELETED if the records were overwritten */
+			ret = 1;
+			break;
+		}
+
+		/* the output starts with the next USN to read */
+		if (n < sizeof(USN))
+			break;
+		next = *(USN*)buffer;
+
+		offset = sizeof(USN);
+		while (offset + sizeof(USN_RECORD) <= n) {
+			USN_RECORD* record = (USN_RECORD*)(buffer + offset);
+
+			if (record->RecordLength == 0)
+				break;
+
+			/* a record in another format may have a 128 bits file id */
+			/* that we cannot open, and then we cannot know what changed */
+			if (record->MajorVersion != 2) {
+				ret = 1;
+				break;
+			}
+
+			/* remember the directory containing the changed entry */
+			if (parent_mac == parent_max) {
+				uint64_t* parent_new = malloc_nofail(2 * parent_max * sizeof(uint64_t));
+				memcpy(parent_new, parent_map, parent_max * sizeof(uint64_t));
+				free(parent_map);
+				parent_map = parent_new;
+				parent_max *= 2;
+			}
+			parent_map[parent_mac++] = record->ParentFileReferenceNumber;
+
+			offset += record->RecordLength;
+		}
+
+		if (ret != 0)
+			break;
+
+		/* stop if no progress */
+		if (next <= read_data.StartUsn)
+			break;
+
+		read_data.StartUsn = next;
+	}
+
+	/* report each directory only one time */
+	qsort(parent_map, parent_mac, sizeof(uint64_t), journal_compare);
+
+	for (i = 0; ret == 0 && i < parent_mac; i = j) {
+		FILE_ID_DESCRIPTOR id;
+		DWORD parent_len;
+
+		/* skip duplicates */
+		j = i + 1;
+		while (j < parent_mac && parent_map[j] == parent_map[i])
+			++j;
+
+		/* open the directory by id */
+		id.dwSize = sizeof(id);
+		id.Type = FileIdType;
+		id.FileId.QuadPart = parent_map[i];
+		h = OpenFileById(hv, &id, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, FILE_FLAG_BACKUP_SEMANTICS);
+		if (h == INVALID_HANDLE_VALUE) {
+			/* the directory doesn't exist anymore */
+			/* its removal is recorded in the parent directory */
+			continue;
+		}
+
+		parent_len = windows_handle_dir(h, parent_path, CONV_MAX);
+
+		CloseHandle(h);
+
+		if (parent_len == 0) {
+			/* without the path we cannot know what changed */
+			ret = 1;
+			break;
+		}
+
+		/* report only directories inside the disk dir */
+		if (parent_len >= dir_len && wcsncmp(parent_path, dir_path, dir_len) == 0) {
+			wchar_t* p;
+
+			/* convert any \ to / */
+			for (p = parent_path + dir_len; *p; ++p)
+				if (*p == L'\\')
+					*p = L'/';
+
+			func(arg, u16tou8(conv_buf_sub, parent_path + dir_len));
+		}
+	}
+
+	free(parent_map);
+	free(buffer);
+	CloseHandle(hv);
+
+	/* set the position where the next call should start */
+	*journal_id = journal.UsnJournalID;
+	*journal_pos = journal.NextUsn;
+
+	return ret;
+}
+
+struct lstat_batch* lstat_batch_alloc(void)
+{
+	/* the stat info is already read with the directory */
+	return 0;
+}
+
+void lstat_batch_free(struct lstat_batch* batch)
+{
+	(void)batch;
+}
+
+int lstat_batch(struct lstat_batch* batch, const char* dir, unsigned count, const char** name, struct windows_stat* st, int* result)
+{
+	(void)batch;
+	(void)dir;
+	(void)count;
+	(void)name;
+	(void)st;
+	(void)result;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+/**
+ * Request of the ring in progress.
+ */
+struct aio_request {
+	OVERLAPPED overlapped; /**< Overlapped of the request. It must be the first field. */
+	uint64_t user_data; /**< Data returned at the completion. */
+	int next; /**< Next free request, or -1. */
+};
+
+/**
+ * Overlapped handle of a file, reopened from the synchronous one.
+ */
+struct aio_handle {
+	HANDLE h; /**< Synchronous handle of the file descriptor. */
+	HANDLE overlapped; /**< Overlapped handle of the same file. */
+};
+
+/**
+ * Max number of files used with the ring.
+ */
+#define AIO_HANDLE_MAX 64
+
+struct aio_ring {
+	HANDLE port; /**< Completion port. */
+	struct aio_request* request; /**< Requests. */
+	int request_free; /**< First free request, or -1. */
+	unsigned pending; /**< Requests submitted, and not yet completed. */
+	struct aio_handle handle[AIO_HANDLE_MAX]; /**< Overlapped handles. */
+	unsigned handle_max; /**< Number of overlapped handles. */
+	int unbuffered; /**< If the buffers allow to bypass the system cache. */
+	void** buffer; /**< Buffers usable for the requests. */
+	unsigned buffer_max; /**< Number of buffers. */
+	DWORD buffer_size; /**< Size of the buffers. */
+};
+
+struct aio_ring* aio_ring_alloc(unsigned depth)
+{
+	struct aio_ring* aio;
+	unsigned i;
+
+	aio = malloc_nofail(sizeof(struct aio_ring));
+
+	aio->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 1);
+	if (!aio->port) {
+		free(aio);
+		return 0;
+	}
+
+	aio->request = malloc_nofail(depth * sizeof(struct aio_request));
+	for (i = 0; i < depth; ++i)
+		aio->request[i].next = i + 1 < depth ? (int)i + 1 : -1;
+	aio->request_free = depth != 0 ? 0 : -1;
+	aio->pending = 0;
+	aio->handle_max = 0;
+	aio->unbuffered = 0;
+	aio->buffer = 0;
+	aio->buffer_max = 0;
+	aio->buffer_size = 0;
+
+	return aio;
+}
+
+void aio_ring_free(struct aio_ring* aio)
+{
+	unsigned i;
+
+	for (i = 0; i < aio->handle_max; ++i)
+		CloseHandle(aio->handle[i].overlapped);
+	CloseHandle(aio->port);
+	free(aio->request);
+	free(aio->buffer);
+	free(aio);
+}
+
+int aio_ring_register(struct aio_ring* aio, void** buffer, unsigned count, size_t size)
+{
+	size_t direct = windows_direct_size();
+	unsigned i;
+
+	free(aio->buffer);
+	aio->buffer = malloc_nofail(count * sizeof(void*));
+	aio->buffer_max = count;
+	aio->buffer_size = size;
+
+	/* the unbuffered IO requires aligned buffers, sizes and offsets */
+	aio->unbuffered = size % direct == 0;
+	for (i = 0; i < count; ++i) {
+		aio->buffer[i] = buffer[i];
+		if ((uintptr_t)buffer[i] % direct != 0)
+			aio->unbuffered = 0;
+	}
+
+	/* the buffers are not registered in the kernel */
+	return -1;
+}
+
+/**
+ * Get the overlapped handle of a file descriptor.
+ *
+ * The file is reopened with the same sharing, and the new handle
+ * is associated to the completion port.
+ * Return INVALID_HANDLE_VALUE on error.
+ */
+static HANDLE aio_ring_handle(struct aio_ring* aio, int f)
+{
+	HANDLE h;
+	HANDLE overlapped;
+	DWORD attr;
+	unsigned i;
+
+	h = (HANDLE)_get_osfhandle(f);
+	if (h == INVALID_HANDLE_VALUE)
+		return INVALID_HANDLE_VALUE;
+
+	for (i = 0; i < aio->handle_max; ++i)
+		if (aio->handle[i].h == h)
+			return aio->handle[i].overlapped;
+
+	if (aio->handle_max == AIO_HANDLE_MAX)
+		return INVALID_HANDLE_VALUE;
+
+	attr = FILE_FLAG_OVERLAPPED;
+	if (aio->unbuffered)
+		attr |= FILE_FLAG_NO_BUFFERING;
+
+	/* the writes need both accesses, but a read-only file allows only to read */
+	overlapped = ReOpenFile(h, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, attr);
+	if (overlapped == INVALID_HANDLE_VALUE)
+		overlapped = ReOpenFile(h, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, attr);
+	if (overlapped == INVALID_HANDLE_VALUE)
+		return INVALID_HANDLE_VALUE;
+
+	if (CreateIoCompletionPort(overlapped, aio->port, 0, 0) != aio->port) {
+		CloseHandle(overlapped);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	aio->handle[aio->handle_max].h = h;
+	aio->handle[aio->handle_max].overlapped = overlapped;
+	++aio->handle_max;
+
+	return overlapped;
+}
+
+int aio_ring_queue(struct aio_ring* aio, int write, int f, unsigned index, data_off_t offset, uint64_t user_data)
+{
+	struct aio_request* request;
+	HANDLE h;
+	BOOL ret;
+	int i;
+
+	assert(index < aio->buffer_max);
+
+	if (aio->request_free < 0)
+		return -1;
+
+	h = aio_ring_handle(aio, f);
+	if (h == INVALID_HANDLE_VALUE)
+		return -1;
+
+	i = aio->request_free;
+	request = &aio->request[i];
+
+	memset(&request->overlapped, 0, sizeof(request->overlapped));
+	request->overlapped.Offset = offset & 0xFFFFFFFF;
+	request->overlapped.OffsetHigh = offset >> 32;
+	request->user_data = user_data;
+
+	/* the request is started immediately, and the completion is always queued in the port */
+	if (write)
+		ret = WriteFile(h, aio->buffer[index], aio->buffer_size, 0, &request->overlapped);
+	else
+		ret = ReadFile(h, aio->buffer[index], aio->buffer_size, 0, &request->overlapped);
+	if (!ret && GetLastError() != ERROR_IO_PENDING) {
+		/* the worker function repeats the request, and reports the error */
+		return -1;
+	}
+
+	aio->request_free = request->next;
+	++aio->pending;
+
+	return 0;
+}
+
+void aio_ring_submit(struct aio_ring* aio)
+{
+	/* the requests are already started by aio_ring_queue() */
+	(void)aio;
+}
+
+int aio_ring_wait(struct aio_ring* aio, int wait, uint64_t* user_data, int* result)
+{
+	struct aio_request* request;
+	OVERLAPPED* overlapped;
+	ULONG_PTR key;
+	DWORD count;
+	BOOL ret;
+
+	if (aio->pending == 0)
+		return 0;
+
+	ret = GetQueuedCompletionStatus(aio->port, &count, &key, &overlapped, wait ? INFINITE : 0);
+	if (!overlapped) {
+		/* no request completed */
+		return 0;
+	}
+
+	request = (struct aio_request*)overlapped;
+
+	*user_data = request->user_data;
+	if (ret) {
+		*result = count;
+	} else {
+		DWORD error = GetLastError();
+		if (error == ERROR_HANDLE_EOF) {
+			/* reading after the end of the file */
+			*result = 0;
+		} else {
+			windows_errno(error);
+			*result = -errno;
+		}
+	}
+
+	request->next = aio->request_free;
+	aio->request_free = request - aio->request;
+	--aio->pending;
+
+	return 1;
+}
+
 /* ensure to call the real C strerror() */
 #undef strerror
 
@@ -2044,6 +2688,21 @@ uint64_t tick(void)
 	return r;
 }
 
+uint64_t tick_freq(void)
+{
+	LARGE_INTEGER f;
+
+	/*
+	 * MSDN 'QueryPerformanceFrequency'
+	 * "On systems that run Windows XP or later, the function"
+	 * "will always succeed and will thus never return zero."
+	 */
+	if (!QueryPerformanceFrequency(&f) || f.QuadPart == 0)
+		return 1000000ULL;
+
+	return f.QuadPart;
+}
+
 uint64_t tick_ms(void)
 {
 	/* GetTickCount64() isn't supported in Windows XP */
@@ -2053,6 +2712,72 @@ uint64_t tick_ms(void)
 	return GetTickCount();
 }
 
+void sleep_ms(unsigned ms)
+{
+	Sleep(ms);
+}
+
+int ioprio_idle(void)
+{
+	/* background mode lowers the IO priority of the process */
+	if (!SetPriorityClass(GetCurrentProcess(), WIN32_PROCESS_MODE_BACKGROUND_BEGIN)) {
+		windows_errno(GetLastError());
+		return -1;
+	}
+
+	return 0;
+}
+
+int madvise_huge(void* ptr, size_t size)
+{
+	(void)ptr;
+	(void)size;
+
+	/* large pages need VirtualAlloc() and the lock memory privilege */
+	errno = ENOSYS;
+	return -1;
+}
+
+unsigned open_max(void)
+{
+	/* limit of the low level files of the C runtime */
+	return 8192;
+}
+
+int devnuma(uint64_t device)
+{
+	(void)device;
+
+	return -1;
+}
+
+int devcontroller(uint64_t device, char* name, size_t size)
+{
+	(void)device;
+	(void)name;
+	(void)size;
+
+	return -1;
+}
+
+int numa_thread(int node)
+{
+	(void)node;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int numa_memory(void* ptr, size_t size, int node)
+{
+	(void)ptr;
+	(void)size;
+	(void)node;
+
+	errno = ENOSYS;
+	return -1;
+}
+
 int randomize(void* void_ptr, size_t size)
 {
 	size_t i;
@@ -2591,23 +3316,52 @@ static void* thread_smart(void* arg)
 	return 0;
 }
 
-static int device_thread(tommy_list* list, void* (*func)(void* arg))
+/**
+ * Run the function for each device in a separate thread.
+ * If max is not 0, at most max threads are running at the same time.
+ */
+static int device_thread(tommy_list* list, void* (*func)(void* arg), unsigned max)
 {
 	int fail = 0;
 	tommy_node* i;
+	tommy_node* j;
+	unsigned running;
 
-	/* starts all threads */
+	/* starts all threads, waiting for the oldest one when too many are running */
+	running = 0;
+	j = tommy_list_head(list);
 	for (i = tommy_list_head(list); i != 0; i = i->next) {
 		devinfo_t* devinfo = i->data;
 
+		if (devinfo->skip)
+			continue;
+
+		if (max != 0 && running == max) {
+			void* retval;
+
+			while (((devinfo_t*)j->data)->skip)
+				j = j->next;
+
+			thread_join(((devinfo_t*)j->data)->thread, &retval);
+			if (retval != 0)
+				++fail;
+
+			j = j->next;
+			--running;
+		}
+
 		thread_create(&devinfo->thread, 0, func, devinfo);
+		++running;
 	}
 
-	/* joins all threads */
-	for (i = tommy_list_head(list); i != 0; i = i->next) {
-		devinfo_t* devinfo = i->data;
+	/* joins the remaining threads */
+	for (; j != 0; j = j->next) {
+		devinfo_t* devinfo = j->data;
 		void* retval;
 
+		if (devinfo->skip)
+			continue;
+
 		thread_join(devinfo->thread, &retval);
 
 		if (retval != 0)
@@ -2626,7 +3380,6 @@ static int device_thread(tommy_list* list, void* (*func)(void* arg))
 int devquery(tommy_list* high, tommy_list* low, int operation, int others)
 {
 	tommy_node* i;
-	void* (*func)(void* arg) = 0;
 
 	if (operation != DEVICE_UP) {
 		/* for each device */
@@ -2677,16 +3430,18 @@ int devquery(tommy_list* high, tommy_list* low, int operation, int others)
 		}
 	}
 
+	return devoperate(low, operation);
+}
+
+int devoperate(tommy_list* low, int operation)
+{
 	switch (operation) {
-	case DEVICE_UP : func = thread_spinup; break;
-	case DEVICE_DOWN : func = thread_spindown; break;
-	case DEVICE_SMART : func = thread_smart; break;
+	case DEVICE_UP : return device_thread(low, thread_spinup, 0);
+	case DEVICE_DOWN : return device_thread(low, thread_spindown, 0);
+	case DEVICE_SMART : return device_thread(low, thread_smart, DEVICE_SMART_MAX);
 	}
 
-	if (!func)
-		return 0;
-
-	return device_thread(low, func);
+	return 0;
 }
 
 /****************************************************************************/
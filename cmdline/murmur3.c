@@ -75,60 +75,17 @@ uint32_t c2 = 0xab0e9789;
 uint32_t c3 = 0x38b34ae5;
 uint32_t c4 = 0xa1e38b93;
 
-void MurmurHash3_x86_128(const void* data, size_t size, const uint8_t* seed, void* digest)
+/*
+ * Tail and finalization, shared by the single and multi buffer versions.
+ */
+static inline void MurmurHash3_x86_128_end(uint32_t h1, uint32_t h2, uint32_t h3, uint32_t h4, const void* end, size_t size, void* digest)
 {
-	size_t nblocks;
-	const uint32_t* blocks;
-	const uint32_t* end;
 	size_t size_remainder;
-	uint32_t h1, h2, h3, h4;
-
-	h1 = util_read32(seed + 0);
-	h2 = util_read32(seed + 4);
-	h3 = util_read32(seed + 8);
-	h4 = util_read32(seed + 12);
-
-	nblocks = size / 16;
-	blocks = data;
-	end = blocks + nblocks * 4;
-
-	/* body */
-	while (blocks < end) {
-		uint32_t k1 = blocks[0];
-		uint32_t k2 = blocks[1];
-		uint32_t k3 = blocks[2];
-		uint32_t k4 = blocks[3];
-
-#if WORDS_BIGENDIAN
-		k1 = util_swap32(k1);
-		k2 = util_swap32(k2);
-		k3 = util_swap32(k3);
-		k4 = util_swap32(k4);
-#endif
-
-		k1 *= c1; k1 = util_rotl32(k1, 15); k1 *= c2; h1 ^= k1;
-
-		h1 = util_rotl32(h1, 19); h1 += h2; h1 = h1 * 5 + 0x561ccd1b;
-
-		k2 *= c2; k2 = util_rotl32(k2, 16); k2 *= c3; h2 ^= k2;
-
-		h2 = util_rotl32(h2, 17); h2 += h3; h2 = h2 * 5 + 0x0bcaa747;
-
-		k3 *= c3; k3 = util_rotl32(k3, 17); k3 *= c4; h3 ^= k3;
-
-		h3 = util_rotl32(h3, 15); h3 += h4; h3 = h3 * 5 + 0x96cd1c35;
-
-		k4 *= c4; k4 = util_rotl32(k4, 18); k4 *= c1; h4 ^= k4;
-
-		h4 = util_rotl32(h4, 13); h4 += h1; h4 = h4 * 5 + 0x32ac3b17;
-
-		blocks += 4;
-	}
 
 	/* tail */
 	size_remainder = size & 15;
 	if (size_remainder != 0) {
-		const uint8_t* tail = (const uint8_t*)blocks;
+		const uint8_t* tail = end;
 
 		uint32_t k1 = 0;
 		uint32_t k2 = 0;
@@ -182,3 +139,162 @@ void MurmurHash3_x86_128(const void* data, size_t size, const uint8_t* seed, voi
 	util_write32(digest + 12, h4);
 }
 
+void MurmurHash3_x86_128(const void* data, size_t size, const uint8_t* seed, void* digest)
+{
+	size_t nblocks;
+	const uint32_t* blocks;
+	const uint32_t* end;
+	uint32_t h1, h2, h3, h4;
+
+	h1 = util_read32(seed + 0);
+	h2 = util_read32(seed + 4);
+	h3 = util_read32(seed + 8);
+	h4 = util_read32(seed + 12);
+
+	nblocks = size / 16;
+	blocks = data;
+	end = blocks + nblocks * 4;
+
+	/* body */
+	while (blocks < end) {
+		uint32_t k1 = blocks[0];
+		uint32_t k2 = blocks[1];
+		uint32_t k3 = blocks[2];
+		uint32_t k4 = blocks[3];
+
+#if WORDS_BIGENDIAN
+		k1 = util_swap32(k1);
+		k2 = util_swap32(k2);
+		k3 = util_swap32(k3);
+		k4 = util_swap32(k4);
+#endif
+
+		k1 *= c1; k1 = util_rotl32(k1, 15); k1 *= c2; h1 ^= k1;
+
+		h1 = util_rotl32(h1, 19); h1 += h2; h1 = h1 * 5 + 0x561ccd1b;
+
+		k2 *= c2; k2 = util_rotl32(k2, 16); k2 *= c3; h2 ^= k2;
+
+		h2 = util_rotl32(h2, 17); h2 += h3; h2 = h2 * 5 + 0x0bcaa747;
+
+		k3 *= c3; k3 = util_rotl32(k3, 17); k3 *= c4; h3 ^= k3;
+
+		h3 = util_rotl32(h3, 15); h3 += h4; h3 = h3 * 5 + 0x96cd1c35;
+
+		k4 *= c4; k4 = util_rotl32(k4, 18); k4 *= c1; h4 ^= k4;
+
+		h4 = util_rotl32(h4, 13); h4 += h1; h4 = h4 * 5 + 0x32ac3b17;
+
+		blocks += 4;
+	}
+
+	MurmurHash3_x86_128_end(h1, h2, h3, h4, blocks, size, digest);
+}
+
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+/*
+ * Constants of the body, in the order of use.
+ */
+static const uint32_t murmur3_avx2_n[4] = { 0x561ccd1b, 0x0bcaa747, 0x96cd1c35, 0x32ac3b17 };
+
+/* rotate left the ymm register s, using ymm8 as temporary */
+#define MURMUR3_AVX2_ROTL(s, r) \
+	asm volatile ("vpslld $" #r ",%ymm" #s ",%ymm8"); \
+	asm volatile ("vpsrld $(32-" #r "),%ymm" #s ",%ymm" #s); \
+	asm volatile ("vpor %ymm8,%ymm" #s ",%ymm" #s);
+
+/* one of the four steps of the body, with k in ymm "k" and h in ymm "h" */
+#define MURMUR3_AVX2_STEP(k, ca, ra, cb, h, hn, rh, n) \
+	asm volatile ("vpmulld %ymm" #ca ",%ymm" #k ",%ymm" #k); \
+	MURMUR3_AVX2_ROTL(k, ra) \
+	asm volatile ("vpmulld %ymm" #cb ",%ymm" #k ",%ymm" #k); \
+	asm volatile ("vpxor %ymm" #k ",%ymm" #h ",%ymm" #h); \
+	MURMUR3_AVX2_ROTL(h, rh) \
+	asm volatile ("vpaddd %ymm" #hn ",%ymm" #h ",%ymm" #h); \
+	asm volatile ("vpslld $2,%ymm" #h ",%ymm8"); \
+	asm volatile ("vpaddd %ymm8,%ymm" #h ",%ymm" #h); \
+	asm volatile ("vpbroadcastd %0,%%ymm8" : : "m" (murmur3_avx2_n[n])); \
+	asm volatile ("vpaddd %ymm8,%ymm" #h ",%ymm" #h);
+
+/*
+ * Computes the hash of eight buffers of the same size at the same time.
+ *
+ * Each 32 bits lane of the ymm registers processes a different buffer,
+ * with the same exact operations of MurmurHash3_x86_128().
+ * The state is in ymm0-3, the constants c1-c4 in ymm12-15.
+ */
+void MurmurHash3_x86_128_avx2x8(const void* const* data, size_t size, const uint8_t* seed, void* const* digest)
+{
+	const uint8_t* p0 = data[0];
+	const uint8_t* p1 = data[1];
+	const uint8_t* p2 = data[2];
+	const uint8_t* p3 = data[3];
+	const uint8_t* p4 = data[4];
+	const uint8_t* p5 = data[5];
+	const uint8_t* p6 = data[6];
+	const uint8_t* p7 = data[7];
+	uint32_t seed32[4];
+	uint32_t h[4][8];
+	size_t body;
+	size_t i;
+	unsigned j;
+
+	seed32[0] = util_read32(seed + 0);
+	seed32[1] = util_read32(seed + 4);
+	seed32[2] = util_read32(seed + 8);
+	seed32[3] = util_read32(seed + 12);
+
+	body = size & ~(size_t)15;
+
+	raid_avx_begin();
+
+	asm volatile ("vpbroadcastd %0,%%ymm0" : : "m" (seed32[0]));
+	asm volatile ("vpbroadcastd %0,%%ymm1" : : "m" (seed32[1]));
+	asm volatile ("vpbroadcastd %0,%%ymm2" : : "m" (seed32[2]));
+	asm volatile ("vpbroadcastd %0,%%ymm3" : : "m" (seed32[3]));
+	asm volatile ("vpbroadcastd %0,%%ymm12" : : "m" (c1));
+	asm volatile ("vpbroadcastd %0,%%ymm13" : : "m" (c2));
+	asm volatile ("vpbroadcastd %0,%%ymm14" : : "m" (c3));
+	asm volatile ("vpbroadcastd %0,%%ymm15" : : "m" (c4));
+
+	for (i = 0; i < body; i += 16) {
+		/* load 16 bytes of each buffer, the last four in the high lane */
+		asm volatile ("vmovdqu %0,%%xmm4" : : "m" (p0[i]));
+		asm volatile ("vmovdqu %0,%%xmm5" : : "m" (p1[i]));
+		asm volatile ("vmovdqu %0,%%xmm6" : : "m" (p2[i]));
+		asm volatile ("vmovdqu %0,%%xmm7" : : "m" (p3[i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm4,%%ymm4" : : "m" (p4[i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm5,%%ymm5" : : "m" (p5[i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm6,%%ymm6" : : "m" (p6[i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm7,%%ymm7" : : "m" (p7[i]));
+
+		/* transpose to have k1-k4 of all the buffers in ymm4-7 */
+		asm volatile ("vpunpckldq %ymm5,%ymm4,%ymm8");
+		asm volatile ("vpunpckhdq %ymm5,%ymm4,%ymm9");
+		asm volatile ("vpunpckldq %ymm7,%ymm6,%ymm10");
+		asm volatile ("vpunpckhdq %ymm7,%ymm6,%ymm11");
+		asm volatile ("vpunpcklqdq %ymm10,%ymm8,%ymm4");
+		asm volatile ("vpunpckhqdq %ymm10,%ymm8,%ymm5");
+		asm volatile ("vpunpcklqdq %ymm11,%ymm9,%ymm6");
+		asm volatile ("vpunpckhqdq %ymm11,%ymm9,%ymm7");
+
+		MURMUR3_AVX2_STEP(4, 12, 15, 13, 0, 1, 19, 0)
+		MURMUR3_AVX2_STEP(5, 13, 16, 14, 1, 2, 17, 1)
+		MURMUR3_AVX2_STEP(6, 14, 17, 15, 2, 3, 15, 2)
+		MURMUR3_AVX2_STEP(7, 15, 18, 12, 3, 0, 13, 3)
+	}
+
+	asm volatile ("vmovdqu %%ymm0,%0" : "=m" (h[0]));
+	asm volatile ("vmovdqu %%ymm1,%0" : "=m" (h[1]));
+	asm volatile ("vmovdqu %%ymm2,%0" : "=m" (h[2]));
+	asm volatile ("vmovdqu %%ymm3,%0" : "=m" (h[3]));
+
+	raid_avx_end();
+
+	for (j = 0; j < 8; ++j) {
+		const uint8_t* p = data[j];
+		MurmurHash3_x86_128_end(h[0][j], h[1][j], h[2][j], h[3][j], p + body, size, digest[j]);
+	}
+}
+#endif
@@ -22,6 +22,7 @@
 #include "state.h"
 #include "parity.h"
 #include "handle.h"
+#include "remote.h"
 
 /**
  * Pseudo random limits for parity
@@ -157,6 +158,18 @@ void parity_overflow(struct snapraid_state* state, data_off_t size)
 	}
 }
 
+int parity_is_remote(struct snapraid_parity_handle* handle)
+{
+	unsigned s;
+
+	for (s = 0; s < handle->split_mac; ++s) {
+		if (handle->split_map[s].remote)
+			return 1;
+	}
+
+	return 0;
+}
+
 void parity_size(struct snapraid_parity_handle* handle, data_off_t* out_size)
 {
 	unsigned s;
@@ -174,6 +187,78 @@ void parity_size(struct snapraid_parity_handle* handle, data_off_t* out_size)
 	*out_size = size;
 }
 
+/**
+ * Open a parity split, local or kept by a remote agent.
+ */
+static int parity_split_open(struct snapraid_split_handle* split, int create, int flags)
+{
+	if (remote_is(split->path)) {
+		split->f = -1;
+		split->remote = remote_open(split->path, create);
+		return split->remote != 0 ? 0 : -1;
+	}
+
+	split->remote = 0;
+	if (create)
+		split->f = open(split->path, flags, 0600);
+	else
+		split->f = open_noatime(split->path, flags);
+	return split->f != -1 ? 0 : -1;
+}
+
+/**
+ * Get the stat info of a parity split.
+ * For a remote split only the size is set.
+ */
+static int parity_split_stat(struct snapraid_split_handle* split)
+{
+	if (split->remote) {
+		data_off_t size;
+
+		if (remote_size(split->remote, &size) != 0)
+			return -1;
+
+		memset(&split->st, 0, sizeof(split->st));
+		split->st.st_size = size;
+		return 0;
+	}
+
+	return fstat(split->f, &split->st);
+}
+
+static int parity_split_truncate(struct snapraid_split_handle* split, data_off_t size)
+{
+	if (split->remote)
+		return remote_chsize(split->remote, size);
+
+	return ftruncate(split->f, size);
+}
+
+static int parity_split_close(struct snapraid_split_handle* split)
+{
+	int ret;
+
+	if (split->remote) {
+		ret = remote_close(split->remote);
+		split->remote = 0;
+	} else {
+		ret = close(split->f);
+	}
+
+	/* reset the descriptor */
+	split->f = -1;
+
+	return ret;
+}
+
+static ssize_t parity_split_pwrite(struct snapraid_split_handle* split, const void* buf, size_t size, data_off_t offset)
+{
+	if (split->remote)
+		return remote_pwrite(split->remote, buf, size, offset);
+
+	return pwrite(split->f, buf, size, offset);
+}
+
 int parity_create(struct snapraid_parity_handle* handle, const struct snapraid_parity* parity, unsigned level, int mode, uint32_t block_size, data_off_t limit_size)
 {
 	unsigned s;
@@ -190,15 +275,15 @@ int parity_create(struct snapraid_parity_handle* handle, const struct snapraid_p
 		int ret;
 		int flags;
 
-		advise_init(&split->advise, mode);
 		pathcpy(split->path, sizeof(split->path), parity->split_map[s].path);
+		/* the cache of a remote split is managed by its agent */
+		advise_init(&split->advise, remote_is(split->path) ? ADVISE_NONE : mode);
 		split->size = parity->split_map[s].size;
 		split->limit_size = PARITY_LIMIT(limit_size, s, level);
 
 		/* opening in sequential mode in Windows */
 		flags = O_RDWR | O_CREAT | O_BINARY | advise_flags(&split->advise);
-		split->f = open(split->path, flags, 0600);
-		if (split->f == -1) {
+		if (parity_split_open(split, 1, flags) != 0) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error opening parity file '%s'. %s.\n", split->path, strerror(errno));
 			goto bail;
@@ -209,7 +294,7 @@ int parity_create(struct snapraid_parity_handle* handle, const struct snapraid_p
 		++handle->split_mac;
 
 		/* get the stat info */
-		ret = fstat(split->f, &split->st);
+		ret = parity_split_stat(split);
 		if (ret != 0) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error accessing parity file '%s'. %s.\n", split->path, strerror(errno));
@@ -252,8 +337,7 @@ bail:
 	/* LCOV_EXCL_START */
 	for (s = 0; s < handle->split_mac; ++s) {
 		struct snapraid_split_handle* split = &handle->split_map[s];
-		close(split->f);
-		split->f = -1;
+		parity_split_close(split);
 	}
 	return -1;
 	/* LCOV_EXCL_STOP */
@@ -270,7 +354,8 @@ static int parity_handle_grow(struct snapraid_split_handle* split, data_off_t pr
 		return -1;
 
 #if HAVE_FALLOCATE
-	if (!skip_fallocate) {
+	/* the agent allocates the remote file as sparse */
+	if (!skip_fallocate && !split->remote) {
 		/*
 		 * Allocate real space using the specific Linux fallocate() operation.
 		 * If the underline file-system doesn't support it, this operation fails.
@@ -326,13 +411,13 @@ static int parity_handle_grow(struct snapraid_split_handle* split, data_off_t pr
 	 */
 	if (ret != 0 && (errno == EOPNOTSUPP || errno == ENOSYS)) {
 		/* fallback using ftruncate() */
-		ret = ftruncate(split->f, size);
+		ret = parity_split_truncate(split, size);
 	}
 #else
 	(void)skip_fallocate; /* avoid the warning */
 
 	/* allocate using a sparse file */
-	ret = ftruncate(split->f, size);
+	ret = parity_split_truncate(split, size);
 #endif
 
 	if (ret != 0)
@@ -347,7 +432,7 @@ static int parity_handle_shrink(struct snapraid_split_handle* split, data_off_t
 {
 	int ret;
 
-	ret = ftruncate(split->f, size);
+	ret = parity_split_truncate(split, size);
 
 	if (ret != 0)
 		log_tag("split:shrink:%s:%" PRIu64 ": failed with error %s\n", split->path, size, strerror(errno));
@@ -507,7 +592,7 @@ static int parity_handle_chsize(struct snapraid_split_handle* split, data_off_t
 	}
 
 	/* get the stat info */
-	ret = fstat(split->f, &split->st);
+	ret = parity_split_stat(split);
 	if (ret != 0) {
 		/* LCOV_EXCL_START */
 		log_fatal("Error accessing parity file '%s'. %s.\n", split->path, strerror(errno));
@@ -659,6 +744,47 @@ int parity_chsize(struct snapraid_parity_handle* handle, struct snapraid_parity*
 	return 0;
 }
 
+static void* parity_chsize_thread(void* arg)
+{
+	struct snapraid_parity_resize* resize = arg;
+
+	resize->is_modified = 0;
+	resize->ret = parity_chsize(resize->handle, resize->parity, &resize->is_modified, resize->size, resize->block_size, resize->skip_fallocate, resize->skip_space_holder);
+
+	return 0;
+}
+
+void parity_chsize_multi(struct snapraid_parity_resize* resize_map, unsigned count)
+{
+	unsigned l;
+
+#if HAVE_PTHREAD
+	/* a single level doesn't need a thread */
+	if (count > 1) {
+		for (l = 0; l < count; ++l) {
+			struct snapraid_parity_resize* resize = &resize_map[l];
+			if (resize->handle)
+				thread_create(&resize->thread, 0, parity_chsize_thread, resize);
+		}
+
+		for (l = 0; l < count; ++l) {
+			struct snapraid_parity_resize* resize = &resize_map[l];
+			void* retval;
+			if (resize->handle)
+				thread_join(resize->thread, &retval);
+		}
+
+		return;
+	}
+#endif
+
+	for (l = 0; l < count; ++l) {
+		struct snapraid_parity_resize* resize = &resize_map[l];
+		if (resize->handle)
+			parity_chsize_thread(resize);
+	}
+}
+
 int parity_open(struct snapraid_parity_handle* handle, const struct snapraid_parity* parity, unsigned level, int mode, uint32_t block_size, data_off_t limit_size)
 {
 	unsigned s;
@@ -675,8 +801,9 @@ int parity_open(struct snapraid_parity_handle* handle, const struct snapraid_par
 		int ret;
 		int flags;
 
-		advise_init(&split->advise, mode);
 		pathcpy(split->path, sizeof(split->path), parity->split_map[s].path);
+		/* the cache of a remote split is managed by its agent */
+		advise_init(&split->advise, remote_is(split->path) ? ADVISE_NONE : mode);
 		split->size = parity->split_map[s].size;
 		split->limit_size = PARITY_LIMIT(limit_size, s, level);
 
@@ -684,8 +811,7 @@ int parity_open(struct snapraid_parity_handle* handle, const struct snapraid_par
 		/* O_NOATIME: do not change access time */
 		flags = O_RDONLY | O_BINARY | advise_flags(&split->advise);
 
-		split->f = open_noatime(split->path, flags);
-		if (split->f == -1) {
+		if (parity_split_open(split, 0, flags) != 0) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error opening parity file '%s'. %s.\n", split->path, strerror(errno));
 			goto bail;
@@ -696,7 +822,7 @@ int parity_open(struct snapraid_parity_handle* handle, const struct snapraid_par
 		++handle->split_mac;
 
 		/* get the stat info */
-		ret = fstat(split->f, &split->st);
+		ret = parity_split_stat(split);
 		if (ret != 0) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error accessing parity file '%s'. %s.\n", split->path, strerror(errno));
@@ -739,8 +865,7 @@ bail:
 	/* LCOV_EXCL_START */
 	for (s = 0; s < handle->split_mac; ++s) {
 		struct snapraid_split_handle* split = &handle->split_map[s];
-		close(split->f);
-		split->f = -1;
+		parity_split_close(split);
 	}
 	return -1;
 	/* LCOV_EXCL_STOP */
@@ -758,7 +883,10 @@ int parity_sync(struct snapraid_parity_handle* handle)
 		/* Ensure that data changes are written to disk. */
 		/* This is required to ensure that parity is more updated than content */
 		/* in case of a system crash. */
-		ret = fsync(split->f);
+		if (split->remote)
+			ret = remote_sync(split->remote);
+		else
+			ret = fsync(split->f);
 		if (ret != 0) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error syncing parity file '%s'. %s.\n", split->path, strerror(errno));
@@ -781,7 +909,7 @@ int parity_truncate(struct snapraid_parity_handle* handle)
 		int ret;
 
 		/* truncate any data that we know it's not valid */
-		ret = ftruncate(split->f, split->valid_size);
+		ret = parity_split_truncate(split, split->valid_size);
 		if (ret != 0) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error truncating the parity file '%s' to size %" PRIu64 ". %s.\n", split->path, split->valid_size, strerror(errno));
@@ -804,7 +932,7 @@ int parity_close(struct snapraid_parity_handle* handle)
 		struct snapraid_split_handle* split = &handle->split_map[s];
 		int ret;
 
-		ret = close(split->f);
+		ret = parity_split_close(split);
 		if (ret != 0) {
 			/* LCOV_EXCL_START */
 			/* This is a serious error, as it may be the result of a failed write */
@@ -816,9 +944,6 @@ int parity_close(struct snapraid_parity_handle* handle)
 
 			/* continue to close the others */
 		}
-
-		/* reset the descriptor */
-		split->f = -1;
 	}
 
 	return f_ret;
@@ -864,7 +989,7 @@ int parity_write(struct snapraid_parity_handle* handle, block_off_t pos, unsigne
 	if (split->valid_size < offset + block_size)
 		split->valid_size = offset + block_size;
 
-	write_ret = pwrite(split->f, block_buffer, block_size, offset);
+	write_ret = parity_split_pwrite(split, block_buffer, block_size, offset);
 	if (write_ret != (ssize_t)block_size) { /* conversion is safe because block_size is always small */
 		/* LCOV_EXCL_START */
 		if (errno == ENOSPC) {
@@ -887,6 +1012,95 @@ int parity_write(struct snapraid_parity_handle* handle, block_off_t pos, unsigne
 	return 0;
 }
 
+int parity_write_vector(struct snapraid_parity_handle* handle, block_off_t pos, unsigned char** block_map, unsigned count, unsigned block_size)
+{
+	unsigned i;
+
+	assert(count <= PARITY_WRITE_VECTOR_MAX);
+
+	i = 0;
+	while (i < count) {
+		ssize_t write_ret;
+		data_off_t offset;
+		size_t size;
+		unsigned n;
+		struct snapraid_split_handle* split;
+		int ret;
+
+		offset = (pos + i) * (data_off_t)block_size;
+
+		split = parity_split_find(handle, &offset);
+		if (!split) {
+			/* LCOV_EXCL_START */
+			log_fatal("Writing parity data outside range at extra offset %" PRIu64 ".\n", offset);
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* the blocks after the first one go in the same split only if they start inside it */
+		n = 1;
+		while (i + n < count && offset + n * (data_off_t)block_size < split->size)
+			++n;
+
+		size = n * (size_t)block_size;
+
+		/* update the valid range */
+		if (split->valid_size < offset + (data_off_t)size)
+			split->valid_size = offset + size;
+
+#if HAVE_PWRITEV
+		/* a remote split batches the writes by itself */
+		if (!split->remote) {
+			struct iovec iov[PARITY_WRITE_VECTOR_MAX];
+			unsigned j;
+
+			for (j = 0; j < n; ++j) {
+				iov[j].iov_base = block_map[i + j];
+				iov[j].iov_len = block_size;
+			}
+
+			write_ret = pwritev(split->f, iov, n, offset);
+		} else
+#endif
+		{
+			unsigned j;
+
+			write_ret = 0;
+			for (j = 0; j < n; ++j) {
+				ssize_t block_ret = parity_split_pwrite(split, block_map[i + j], block_size, offset + j * (data_off_t)block_size);
+				if (block_ret != (ssize_t)block_size) {
+					write_ret = -1;
+					break;
+				}
+				write_ret += block_ret;
+			}
+		}
+		if (write_ret != (ssize_t)size) { /* conversion is safe because the size is always small */
+			/* LCOV_EXCL_START */
+			if (errno == ENOSPC) {
+				log_fatal("Failed to grow parity file '%s' using write due lack of space.\n", split->path);
+			} else {
+				log_fatal("Error writing file '%s'. %s.\n", split->path, strerror(errno));
+			}
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* advise once for all the blocks written */
+		ret = advise_write(&split->advise, split->f, offset, size);
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error advising parity file '%s'. %s.\n", split->path, strerror(errno));
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		i += n;
+	}
+
+	return 0;
+}
+
 int parity_read(struct snapraid_parity_handle* handle, block_off_t pos, unsigned char* block_buffer, unsigned block_size, fptr* out)
 {
 	ssize_t read_ret;
@@ -915,7 +1129,10 @@ int parity_read(struct snapraid_parity_handle* handle, block_off_t pos, unsigned
 
 	count = 0;
 	do {
-		read_ret = pread(split->f, block_buffer + count, block_size - count, offset + count);
+		if (split->remote)
+			read_ret = remote_pread(split->remote, block_buffer + count, block_size - count, offset + count);
+		else
+			read_ret = pread(split->f, block_buffer + count, block_size - count, offset + count);
 		if (read_ret < 0) {
 			/* LCOV_EXCL_START */
 			out("Error reading file '%s' at offset %" PRIu64 " for size %u. %s.\n", split->path, offset + count, block_size - count, strerror(errno));
@@ -26,6 +26,7 @@
 struct snapraid_split_handle {
 	char path[PATH_MAX]; /**< Path of the file. */
 	int f; /**< Handle of the files. */
+	struct snapraid_remote* remote; /**< Connection to the remote agent, or 0 for a local file. */
 	struct stat st; /**< Stat info of the opened file. */
 	struct advise_struct advise; /**< Advise information. */
 
@@ -106,6 +107,43 @@ int parity_create(struct snapraid_parity_handle* handle, const struct snapraid_p
  */
 int parity_chsize(struct snapraid_parity_handle* handle, struct snapraid_parity* parity, int* is_modified, data_off_t size, uint32_t block_size, int skip_fallocate, int skip_space_holder);
 
+/**
+ * Resize of a parity level, done by parity_chsize_multi().
+ */
+struct snapraid_parity_resize {
+	struct snapraid_parity_handle* handle; /**< Parity to resize. 0 to skip it. */
+	struct snapraid_parity* parity;
+	int is_modified; /**< Output. Like the parity_chsize() argument. */
+	int ret; /**< Output. Result of parity_chsize(). */
+
+	/**
+	 * Arguments of parity_chsize().
+	 */
+	data_off_t size;
+	uint32_t block_size;
+	int skip_fallocate;
+	int skip_space_holder;
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+/**
+ * Change the parity size of multiple levels concurrently.
+ *
+ * Each level is resized by a different thread, as on file-systems without
+ * a fast fallocate() growing the parity may take hours for each one.
+ * The splits of a level are still resized in order, as the size of each
+ * one depends on the space allocated by the previous ones.
+ * The result of each level is stored in its ::ret field.
+ */
+void parity_chsize_multi(struct snapraid_parity_resize* resize_map, unsigned count);
+
+/**
+ * If some split of the parity is kept by a remote agent.
+ */
+int parity_is_remote(struct snapraid_parity_handle* handle);
+
 /**
  * Get the size of the parity.
  *
@@ -133,6 +171,14 @@ int parity_truncate(struct snapraid_parity_handle* handle);
  */
 int parity_close(struct snapraid_parity_handle* handle);
 
+/**
+ * Find the split containing the specified offset of the parity.
+ *
+ * On return ::offset is relative at the split found.
+ * Return 0 if the offset is outside the parity.
+ */
+struct snapraid_split_handle* parity_split_find(struct snapraid_parity_handle* handle, data_off_t* offset);
+
 /**
  * Read a block from the parity file.
  */
@@ -143,5 +189,19 @@ int parity_read(struct snapraid_parity_handle* handle, block_off_t pos, unsigned
  */
 int parity_write(struct snapraid_parity_handle* handle, block_off_t pos, unsigned char* block_buffer, unsigned block_size);
 
+/**
+ * Max number of blocks written with a single call by parity_write_vector().
+ */
+#define PARITY_WRITE_VECTOR_MAX 16
+
+/**
+ * Write consecutive blocks in the parity file.
+ *
+ * The blocks are written with a single call for each split touched, if possible.
+ * \param pos Position of the first block.
+ * \param block_map Vector of count buffers. Up to PARITY_WRITE_VECTOR_MAX.
+ */
+int parity_write_vector(struct snapraid_parity_handle* handle, block_off_t pos, unsigned char** block_map, unsigned count, unsigned block_size);
+
 #endif
 
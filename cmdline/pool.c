@@ -20,6 +20,7 @@
 #include "support.h"
 #include "elem.h"
 #include "state.h"
+#include "stream.h"
 
 struct snapraid_pool {
 	char file[PATH_MAX];
@@ -277,32 +278,101 @@ static void read_dir(tommy_hashdyn* poolset, const char* base_dir, const char* s
 	}
 }
 
+/**
+ * Remove the empty ancestor directories of a removed link.
+ * Used when the pool tree is not read, instead of clean_dir().
+ */
+static void clean_ancestor(const char* pool_dir, const char* sub)
+{
+	char sub_dir[PATH_MAX];
+	char dir[PATH_MAX];
+	char* slash;
+	int ret;
+
+	pathcpy(sub_dir, sizeof(sub_dir), sub);
+
+	while (1) {
+		/* the sub path always uses forward slashes */
+		slash = strrchr(sub_dir, '/');
+		if (!slash)
+			break;
+		*slash = 0;
+
+		pathprint(dir, sizeof(dir), "%s%s", pool_dir, sub_dir);
+
+		ret = rmdir(dir);
+		if (ret < 0) {
+			/* stop at the first directory not empty */
+			if (errno == ENOTEMPTY || errno == EEXIST || errno == ENOENT)
+				break;
+#ifdef _WIN32
+			/* in Windows just ignore EACCES errors removing directories */
+			/* because it could happen that the directory is in use */
+			if (errno == EACCES) {
+				log_fatal("Directory '%s' not removed because it's in use.\n", dir);
+				break;
+			}
+#endif
+			/* LCOV_EXCL_START */
+			log_fatal("Error removing pool directory '%s'. %s.\n", dir, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+}
+
+struct pool_remove_arg {
+	const char* pool_dir; /**< Pool directory with final slash. */
+	int saved; /**< If the links come from the saved pool state, and not from the pool tree. */
+};
+
 /**
  * Remove the link
  */
 static void remove_link(void* void_arg, void* void_pool)
 {
 	char path[PATH_MAX];
-	const char* arg = void_arg;
+	struct pool_remove_arg* arg = void_arg;
 	struct snapraid_pool* pool = void_pool;
 	int ret;
 
-	pathprint(path, sizeof(path), "%s%s", arg, pool->file);
+	pathprint(path, sizeof(path), "%s%s", arg->pool_dir, pool->file);
 
 	/* delete the link */
 	ret = remove(path);
 	if (ret < 0) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error removing symlink '%s'. %s.\n", path, strerror(errno));
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
+		/* a saved link may be already removed by the user */
+		if (!arg->saved || errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error removing symlink '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
 	}
+
+	if (arg->saved)
+		clean_ancestor(arg->pool_dir, pool->file);
+}
+
+/**
+ * Save a link in the pool state.
+ */
+static void pool_save_link(STREAM* f, const char* sub, const char* linkto, int64_t mtime_sec, int mtime_nsec)
+{
+	if (!f)
+		return;
+
+	sputc('L', f);
+	sputbs(sub, f);
+	sputbs(linkto, f);
+	sputb64(mtime_sec, f);
+	sputb32(mtime_nsec, f);
 }
 
 /**
  * Create a link to the specified disk link.
  */
-static void make_link(tommy_hashdyn* poolset, const char* pool_dir, const char* share_dir, struct snapraid_disk* disk, const char* sub, int64_t mtime_sec, int mtime_nsec)
+static void make_link(tommy_hashdyn* poolset, STREAM* f, const char* pool_dir, const char* share_dir, struct snapraid_disk* disk, const char* sub, int64_t mtime_sec, int mtime_nsec)
 {
 	char path[PATH_MAX];
 	char linkto[PATH_MAX];
@@ -334,13 +404,14 @@ static void make_link(tommy_hashdyn* poolset, const char* pool_dir, const char*
 			&& strcmp(found->linkto, linkto) == 0
 		) {
 			/* nothing to do */
+			pool_save_link(f, sub, linkto, mtime_sec, mtime_nsec);
 			pool_free(found);
 			return;
 		}
 
 		/* delete the link */
 		ret = remove(path);
-		if (ret < 0) {
+		if (ret < 0 && errno != ENOENT) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error removing symlink '%s'. %s.\n", path, strerror(errno));
 			exit(EXIT_FAILURE);
@@ -366,6 +437,8 @@ static void make_link(tommy_hashdyn* poolset, const char* pool_dir, const char*
 	if (ret != 0) {
 		if (errno == EEXIST) {
 			log_fatal("WARNING! Duplicate pooling for '%s'\n", path);
+			/* the link is not saved, as it points to the other file */
+			return;
 #ifdef _WIN32
 		} else if (errno == EPERM) {
 			/* LCOV_EXCL_START */
@@ -390,6 +463,153 @@ static void make_link(tommy_hashdyn* poolset, const char* pool_dir, const char*
 			/* LCOV_EXCL_STOP */
 		}
 	}
+
+	pool_save_link(f, sub, linkto, mtime_sec, mtime_nsec);
+}
+
+/**
+ * Read the pool state saved by the previous run.
+ * Return 0 on success, or -1 if missing, invalid, or referring to other directories.
+ */
+static int pool_read_state(tommy_hashdyn* poolset, const char* path, const char* pool_dir, const char* share_dir)
+{
+	STREAM* f;
+	unsigned char header[12];
+	char buffer[PATH_MAX];
+	uint32_t crc_computed;
+	uint32_t crc;
+	int ret;
+
+	f = sopen_read(path);
+	if (f == 0) {
+		if (errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Error opening the pool state '%s'. %s.\n", path, strerror(errno));
+			/* LCOV_EXCL_STOP */
+		}
+		return -1;
+	}
+
+	ret = sread(f, header, 12);
+	if (ret < 0 || memcmp(header, "SNAPPOL1\n\3\0\0", 12) != 0)
+		goto bail;
+
+	/* a state of different directories is stale */
+	if (sgetbs(f, buffer, sizeof(buffer)) < 0 || strcmp(buffer, pool_dir) != 0)
+		goto stale;
+	if (sgetbs(f, buffer, sizeof(buffer)) < 0 || strcmp(buffer, share_dir) != 0)
+		goto stale;
+
+	while (1) {
+		struct snapraid_pool* pool;
+		char linkto[PATH_MAX];
+		uint64_t mtime_sec;
+		uint32_t mtime_nsec;
+		int c;
+
+		c = sgetc(f);
+		if (c == 'E')
+			break;
+		if (c != 'L')
+			goto bail;
+
+		if (sgetbs(f, buffer, sizeof(buffer)) < 0
+			|| sgetbs(f, linkto, sizeof(linkto)) < 0
+			|| sgetb64(f, &mtime_sec) < 0
+			|| sgetb32(f, &mtime_nsec) < 0)
+			goto bail;
+
+		pool = malloc_nofail(sizeof(struct snapraid_pool));
+		pathcpy(pool->file, sizeof(pool->file), buffer);
+		pathcpy(pool->linkto, sizeof(pool->linkto), linkto);
+		pool->mtime_sec = mtime_sec;
+		pool->mtime_nsec = (int)mtime_nsec;
+
+		tommy_hashdyn_insert(poolset, &pool->node, pool, pool_hash(pool->file));
+	}
+
+	crc_computed = scrc(f);
+
+	if (sgetble32(f, &crc) < 0 || crc != crc_computed)
+		goto bail;
+
+	sclose(f);
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	log_fatal("WARNING! Ignoring the invalid pool state '%s'.\n", path);
+	/* LCOV_EXCL_STOP */
+stale:
+	tommy_hashdyn_foreach(poolset, (tommy_foreach_func*)pool_free);
+	tommy_hashdyn_done(poolset);
+	tommy_hashdyn_init(poolset);
+	sclose(f);
+	return -1;
+}
+
+/**
+ * Open the pool state for writing.
+ * On error the state is not saved, and the next run reads the pool tree.
+ */
+static STREAM* pool_open_state(const char* path, const char* pool_dir, const char* share_dir)
+{
+	STREAM* f;
+
+	/* ensure to delete a previous stale file */
+	if (remove(path) != 0 && errno != ENOENT) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error removing the stale pool state '%s'. %s.\n", path, strerror(errno));
+		return 0;
+		/* LCOV_EXCL_STOP */
+	}
+
+	f = sopen_write(path);
+	if (f == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error creating the pool state '%s'. %s.\n", path, strerror(errno));
+		return 0;
+		/* LCOV_EXCL_STOP */
+	}
+
+	swrite("SNAPPOL1\n\3\0\0", 12, f);
+	sputbs(pool_dir, f);
+	sputbs(share_dir, f);
+
+	return f;
+}
+
+static void pool_close_state(STREAM* f, const char* tmp, const char* path)
+{
+	if (!f)
+		return;
+
+	sputc('E', f);
+	sputble32(scrc(f), f);
+
+	if (serror(f) || sflush(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error writing the pool state '%s'. %s.\n", tmp, strerror(errno));
+		sclose(f);
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (sclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error closing the pool state '%s'. %s.\n", tmp, strerror(errno));
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (rename(tmp, path) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error renaming the pool state '%s' to '%s'. %s.\n", tmp, path, strerror(errno));
+		remove(tmp);
+		/* LCOV_EXCL_STOP */
+	}
 }
 
 void state_pool(struct snapraid_state* state)
@@ -398,6 +618,11 @@ void state_pool(struct snapraid_state* state)
 	tommy_node* i;
 	char pool_dir[PATH_MAX];
 	char share_dir[PATH_MAX];
+	char state_path[PATH_MAX];
+	char state_tmp[PATH_MAX];
+	struct snapraid_content* content;
+	struct pool_remove_arg arg;
+	STREAM* f;
 	unsigned count;
 
 	tommy_hashdyn_init(&poolset);
@@ -419,8 +644,30 @@ void state_pool(struct snapraid_state* state)
 	pathprint(share_dir, sizeof(share_dir), "%s", state->share);
 	pathslash(share_dir, sizeof(share_dir));
 
-	/* first read the previous pool tree */
-	read_dir(&poolset, pool_dir, "");
+	/* the pool state is saved next to the first content file */
+	content = tommy_list_head(&state->contentlist)->data;
+	pathprint(state_path, sizeof(state_path), "%s.pool", content->content);
+	pathprint(state_tmp, sizeof(state_tmp), "%s.pool.tmp", content->content);
+
+	/* first read the previous pool state, or the pool tree if not available */
+	arg.pool_dir = pool_dir;
+	arg.saved = 0;
+	if (!state->opt.force_full && pool_read_state(&poolset, state_path, pool_dir, share_dir) == 0) {
+		msg_verbose("Using the pool state in '%s'\n", state_path);
+		arg.saved = 1;
+	} else {
+		read_dir(&poolset, pool_dir, "");
+	}
+
+	/* the saved state is stale as soon as the pool changes */
+	if (remove(state_path) != 0 && errno != ENOENT) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error removing the pool state '%s'. %s.\n", state_path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	f = pool_open_state(state_tmp, pool_dir, share_dir);
 
 	msg_progress("Writing...\n");
 
@@ -433,14 +680,14 @@ void state_pool(struct snapraid_state* state)
 		/* for each file */
 		for (j = disk->filelist; j != 0; j = j->next) {
 			struct snapraid_file* file = j->data;
-			make_link(&poolset, pool_dir, share_dir, disk, file->sub, file->mtime_sec, file->mtime_nsec);
+			make_link(&poolset, f, pool_dir, share_dir, disk, file->sub, file->mtime_sec, file->mtime_nsec);
 			++count;
 		}
 
 		/* for each link */
 		for (j = disk->linklist; j != 0; j = j->next) {
 			struct snapraid_link* slink = j->data;
-			make_link(&poolset, pool_dir, share_dir, disk, slink->sub, 0, 0);
+			make_link(&poolset, f, pool_dir, share_dir, disk, slink->sub, 0, 0);
 			++count;
 		}
 
@@ -450,10 +697,13 @@ void state_pool(struct snapraid_state* state)
 	msg_progress("Cleaning...\n");
 
 	/* delete all the remaining links */
-	tommy_hashdyn_foreach_arg(&poolset, (tommy_foreach_arg_func*)remove_link, pool_dir);
+	tommy_hashdyn_foreach_arg(&poolset, (tommy_foreach_arg_func*)remove_link, &arg);
+
+	/* delete empty dirs, with the saved state only the ones of the removed links are checked */
+	if (!arg.saved)
+		clean_dir(pool_dir);
 
-	/* delete empty dirs */
-	clean_dir(pool_dir);
+	pool_close_state(f, state_tmp, state_path);
 
 	tommy_hashdyn_foreach(&poolset, (tommy_foreach_func*)pool_free);
 	tommy_hashdyn_done(&poolset);
@@ -467,4 +717,3 @@ void state_pool(struct snapraid_state* state)
 	log_tag("summary:exit:ok\n");
 	log_flush();
 }
-
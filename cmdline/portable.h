@@ -129,6 +129,54 @@
 #include <linux/fiemap.h>
 #endif
 
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#if HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#if HAVE_SYS_AUXV_H
+#include <sys/auxv.h>
+#endif
+
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#if HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+
+#if HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+#if HAVE_NETDB_H
+#include <netdb.h>
+#endif
+
+#if HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#if HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+
 #if HAVE_BLKID_BLKID_H
 #include <blkid/blkid.h>
 #if HAVE_BLKID_DEVNO_TO_DEVNAME && HAVE_BLKID_GET_TAG_VALUE
@@ -275,6 +323,20 @@
 #define HAVE_LOCKFILE 1
 #endif
 
+/**
+ * Enables the daemon on a local socket.
+ */
+#if HAVE_SYS_SOCKET_H && HAVE_SYS_UN_H && HAVE_SYS_SELECT_H
+#define HAVE_SERVE 1
+#endif
+
+/**
+ * Enables the parity kept by a remote agent.
+ */
+#if HAVE_SERVE && HAVE_NETDB_H && HAVE_NETINET_IN_H
+#define HAVE_REMOTE 1
+#endif
+
 /**
  * Basic block position type.
  * With 32 bits and 128k blocks you can address 256 TB.
@@ -343,12 +405,115 @@ int devuuid(uint64_t device, char* uuid, size_t size);
  */
 int filephy(const char* path, uint64_t size, uint64_t* physical);
 
+/**
+ * Check if a file is a clone of another file, sharing all its data in the disk.
+ * Files copied with reflinks, or deduplicated, share the same data extents.
+ * Return 0 if it's a clone, -1 if not, on error, or if not supported.
+ */
+int fileclone(const char* path, const char* path_src);
+
 /**
  * Check if the underline file-system support persistent inodes.
  * Return -1 on error, 0 on success.
  */
 int fsinfo(const char* path, int* has_persistent_inode, int* has_syncronized_hardlinks, uint64_t* total_space, uint64_t* free_space);
 
+/**
+ * Read the changes from the file-system change journal.
+ *
+ * On input ::journal_id and ::journal_pos are the values returned by a previous call,
+ * or 0 if unknown. On output they are set at the present position in the journal,
+ * and they can be saved to be used in the next call.
+ *
+ * For each directory containing changes after the input position, the specified
+ * function is called with the path of the directory relative at ::dir,
+ * terminated with a slash. The same directory may be reported more times.
+ * Directories outside ::dir, or not existing anymore, are not reported.
+ *
+ * Return 0 on success, 1 if the journal doesn't have all the changes after the
+ * input position, and -1 if the journal is not supported.
+ * In case of 1 ::journal_id and ::journal_pos are anyway updated.
+ */
+int fsjournal(const char* dir, uint64_t* journal_id, uint64_t* journal_pos, void (*func)(void* arg, const char* sub), void* arg);
+
+/**
+ * Context used to get the stat info of multiple files at the same time.
+ */
+struct lstat_batch;
+
+/**
+ * Allocate a context for lstat_batch().
+ * Return 0 if not supported.
+ */
+struct lstat_batch* lstat_batch_alloc(void);
+
+/**
+ * Deallocate a context of lstat_batch().
+ */
+void lstat_batch_free(struct lstat_batch* batch);
+
+/**
+ * Get the stat info of multiple entries of the same directory, like lstat().
+ *
+ * All the requests are submitted at the same time, to allow the system
+ * to process them in parallel, and in the most convenient order.
+ * Only the fields st_mode, st_ino, st_nlink, st_size, st_mtime and st_dev,
+ * with the nanoseconds of st_mtime, are set.
+ *
+ * On return, ::result is 0 for the entries with valid stat info.
+ * Otherwise it's an error code, and the caller should call lstat()
+ * to get the info, or a more detailed error.
+ * Return 0 on success, -1 on error.
+ */
+int lstat_batch(struct lstat_batch* batch, const char* dir, unsigned count, const char** name, struct stat* st, int* result);
+
+/**
+ * Context used to submit reads and writes of whole buffers from a single thread.
+ */
+struct aio_ring;
+
+/**
+ * Allocate a context for at most ::depth requests in progress.
+ * Return 0 if not supported.
+ */
+struct aio_ring* aio_ring_alloc(unsigned depth);
+
+/**
+ * Deallocate a context of aio_ring_alloc().
+ * All the requests must be completed.
+ */
+void aio_ring_free(struct aio_ring* aio);
+
+/**
+ * Set the buffers usable for the requests, all of the same size.
+ *
+ * If possible the buffers are also registered in the kernel, to avoid
+ * to map them at every request.
+ * Return 0 if registered, -1 if not. In both cases the buffers are usable.
+ */
+int aio_ring_register(struct aio_ring* aio, void** buffer, unsigned count, size_t size);
+
+/**
+ * Queue the read or write of a whole buffer, specified by its index.
+ *
+ * The request is started at the next aio_ring_submit() or aio_ring_wait().
+ * Return 0 on success, -1 if too many requests are in progress.
+ */
+int aio_ring_queue(struct aio_ring* aio, int write, int f, unsigned index, data_off_t offset, uint64_t user_data);
+
+/**
+ * Start all the queued requests.
+ */
+void aio_ring_submit(struct aio_ring* aio);
+
+/**
+ * Get a completed request, with the result like pread() and pwrite(), or -errno.
+ *
+ * If ::wait is set and no request is completed, it waits for one.
+ * Return 1 if a completed request is returned, 0 if not.
+ */
+int aio_ring_wait(struct aio_ring* aio, int wait, uint64_t* user_data, int* result);
+
 /**
  * Get the tick counter value.
  *
@@ -357,11 +522,73 @@ int fsinfo(const char* path, int* has_persistent_inode, int* has_syncronized_har
  */
 uint64_t tick(void);
 
+/**
+ * Get the frequency of the tick counter, in ticks for second.
+ *
+ * It's used only to report usage times as absolute values.
+ */
+uint64_t tick_freq(void);
+
 /**
  * Get the tick counter value in millisecond.
  */
 uint64_t tick_ms(void);
 
+/**
+ * Sleep for the specified number of milliseconds.
+ */
+void sleep_ms(unsigned ms);
+
+/**
+ * Set the IO priority of the process to the idle class.
+ *
+ * The process reads and writes only when the disks are not used by other
+ * processes. It must be called before starting the threads, that inherit it.
+ * Return 0 on success, -1 if not supported.
+ */
+int ioprio_idle(void);
+
+/**
+ * Advise the system to back the memory with huge pages.
+ *
+ * The memory is not required to be backed, as it depends on the system
+ * availability of huge pages.
+ * Return 0 on success, -1 if not supported.
+ */
+int madvise_huge(void* ptr, size_t size);
+
+/**
+ * Get the max number of files that the process can open.
+ * Return 0 if unknown or unlimited.
+ */
+unsigned open_max(void);
+
+/**
+ * Get the NUMA node of the controller of a device.
+ * Return -1 if unknown, or if the system is not NUMA.
+ */
+int devnuma(uint64_t device);
+
+/**
+ * Get the name of the controller of a device, like the PCI address of the HBA.
+ * Return -1 if unknown.
+ */
+int devcontroller(uint64_t device, char* name, size_t size);
+
+/**
+ * Run the calling thread only on the CPUs of a NUMA node.
+ * Return 0 on success, -1 if not supported.
+ */
+int numa_thread(int node);
+
+/**
+ * Move the memory to a NUMA node.
+ *
+ * Only the full pages inside the range are moved.
+ * Return 0 on success, -1 if not supported.
+ */
+int numa_memory(void* ptr, size_t size, int node);
+
 /**
  * Initializes the system.
  */
@@ -470,6 +697,7 @@ struct devinfo_struct {
 	char smart_serial[SMART_MAX]; /**< SMART serial number. */
 	char smart_vendor[SMART_MAX]; /**< SMART vendor. */
 	char smart_model[SMART_MAX]; /**< SMART model. */
+	int skip; /**< Skip the operation for this device. Used when the SMART attributes are already known. */
 #if HAVE_PTHREAD
 	pthread_t thread;
 #endif
@@ -482,6 +710,11 @@ typedef struct devinfo_struct devinfo_t;
 #define DEVICE_UP 2
 #define DEVICE_SMART 3
 
+/**
+ * Max number of devices queried at the same time for SMART attributes.
+ */
+#define DEVICE_SMART_MAX 8
+
 /**
  * Query all the "high" level devices with the specified operation,
  * and produces a list of "low" level devices to operate on.
@@ -490,5 +723,12 @@ typedef struct devinfo_struct devinfo_t;
  */
 int devquery(tommy_list* high, tommy_list* low, int operation, int others);
 
+/**
+ * Run the specified operation on a list of "low" level devices.
+ * The list is the one produced by devquery() with DEVICE_LIST, and
+ * the devices with the skip flag set are not processed.
+ */
+int devoperate(tommy_list* low, int operation);
+
 #endif
 
@@ -23,20 +23,471 @@
 #include "state.h"
 #include "parity.h"
 #include "handle.h"
+#include "io.h"
 #include "raid/raid.h"
 
 /****************************************************************************/
 /* rehash */
 
-void state_rehash(struct snapraid_state* state)
+/**
+ * Buffer for storing the new hashes.
+ */
+struct snapraid_rehash {
+	unsigned char hash[HASH_MAX];
+	struct snapraid_block* block;
+};
+
+/**
+ * Check if we have to rehash the specified block index ::i.
+ *
+ * Only the positions with all the blocks synced are rehashed. The others
+ * have changes not yet in the parity, and get the new hash in the next sync.
+ */
+static int block_is_enabled(void* void_state, block_off_t i)
+{
+	struct snapraid_state* state = void_state;
+	tommy_node* node;
+
+	if (!info_get_rehash(info_get(&state->infoarr, i)))
+		return 0;
+
+	for (node = state->disklist; node != 0; node = node->next) {
+		struct snapraid_disk* disk = node->data;
+		unsigned block_state = block_state_get(fs_par2block_find(disk, i));
+
+		if (block_state != BLOCK_STATE_EMPTY && block_state != BLOCK_STATE_BLK)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void rehash_data_reader(struct snapraid_worker* worker, struct snapraid_task* task)
+{
+	struct snapraid_io* io = worker->io;
+	struct snapraid_state* state = io->state;
+	struct snapraid_handle* handle = worker->handle;
+	struct snapraid_disk* disk = handle->disk;
+	block_off_t blockcur = task->position;
+	block_off_t run;
+	unsigned char* buffer = task->buffer;
+	unsigned char hash[HASH_MAX];
+	int ret;
+	char esc_buffer[ESC_MAX];
+
+	/* if the disk position is not used */
+	if (!disk) {
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* get the file of this block, without locking as the index doesn't change */
+	task->file = fs_par2file_find_index(disk, blockcur, &task->file_pos);
+
+	/* get the block */
+	task->block = task->file ? fs_file2block_get(task->file, task->file_pos) : BLOCK_NULL;
+
+	/* if the block is not used */
+	if (!block_has_file(task->block)) {
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* if the file is different than the current one, release it */
+	if (handle->file != 0 && handle->file != task->file) {
+		/* keep a pointer at the file we are going to close for error reporting */
+		struct snapraid_file* report = handle->file;
+		ret = handle_release(handle);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			/* This one is really an unexpected error, because we are only reading */
+			/* and closing a descriptor should never fail */
+			if (errno == EIO) {
+				log_tag("error:%u:%s:%s: Close EIO error. %s\n", blockcur, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
+				log_fatal("DANGER! Unexpected input/output close error in a data disk, it isn't possible to rehash.\n");
+				log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle->path);
+				log_fatal("Stopping at block %u\n", blockcur);
+				task->state = TASK_STATE_IOERROR;
+				return;
+			}
+
+			log_tag("error:%u:%s:%s: Close error. %s\n", blockcur, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
+			log_fatal("WARNING! Unexpected close error in a data disk, it isn't possible to rehash.\n");
+			log_fatal("Ensure that file '%s' can be accessed.\n", handle->path);
+			log_fatal("Stopping at block %u\n", blockcur);
+			task->state = TASK_STATE_ERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	ret = handle_open(handle, task->file, state->file_mode, log_error, 0);
+	if (ret == -1) {
+		if (errno == EIO) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Open EIO error. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected input/output open error in a data disk, it isn't possible to rehash.\n");
+			log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle->path);
+			log_fatal("Stopping at block %u\n", blockcur);
+			task->state = TASK_STATE_IOERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+
+		log_tag("error:%u:%s:%s: Open error. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), strerror(errno));
+		task->state = TASK_STATE_ERROR_CONTINUE;
+		return;
+	}
+
+	/* a file changed after the sync doesn't match its hash, leave it to the next sync */
+	if (handle->st.st_size != task->file->size
+		|| handle->st.st_mtime != task->file->mtime_sec
+		|| STAT_NSEC(&handle->st) != task->file->mtime_nsec
+	        /* don't check the inode to support filesystem without persistent inodes */
+	) {
+		log_tag("error:%u:%s:%s: Unsynced file\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer));
+		task->state = TASK_STATE_ERROR_CONTINUE;
+		return;
+	}
+
+	/* read together the next blocks of the file, if they follow in the parity */
+	run = handle->ahead_max > 1 ? fs_par2run_index(disk, blockcur) : 1;
+
+	task->read_size = handle_read_ahead(handle, task->file_pos, run, buffer, state->block_size, log_error, 0);
+	if (task->read_size == -1) {
+		if (errno == EIO) {
+			log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), task->file_pos, strerror(errno));
+			log_error("Input/Output error in file '%s' at position '%u'\n", handle->path, task->file_pos);
+			task->state = TASK_STATE_IOERROR_CONTINUE;
+			return;
+		}
+
+		log_tag("error:%u:%s:%s: Read error at position %u. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), task->file_pos, strerror(errno));
+		task->state = TASK_STATE_ERROR_CONTINUE;
+		return;
+	}
+
+	/* verify the data with the old hash */
+	memhash(state->prevhash, state->prevhashseed, hash, buffer, task->read_size);
+	if (memcmp(hash, task->block->hash, BLOCK_HASH_SIZE) != 0) {
+		unsigned diff = memdiff(hash, task->block->hash, BLOCK_HASH_SIZE);
+
+		log_tag("error:%u:%s:%s: Data error at position %u, diff bits %u/%u\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), task->file_pos, diff, BLOCK_HASH_SIZE * 8);
+		log_error("Data error in file '%s' at position '%u', diff bits %u/%u\n", handle->path, task->file_pos, diff, BLOCK_HASH_SIZE * 8);
+		task->state = TASK_STATE_ERROR_CONTINUE;
+		return;
+	}
+
+	/* compute the new hash from the same data, in the hash threads if present */
+	io_task_hash(worker, task, state->hash, state->hashseed);
+
+	/* store the path of the opened file */
+	pathcpy(task->path, sizeof(task->path), handle->path);
+
+	task->state = TASK_STATE_DONE;
+}
+
+/**
+ * Complete the rehash reading all the data disks.
+ *
+ * Each disk is read by its own thread, ahead of the others as much as
+ * the io cache allows, and it verifies the old hash of the blocks read.
+ * The new hash is computed by the hash threads, if enabled.
+ * The parity is not read, as the rehash doesn't need it.
+ *
+ * The new hashes of a position are stored only if all its blocks are
+ * verified, because the rehash info is shared by all the disks.
+ */
+static int state_rehash_process(struct snapraid_state* state, block_off_t blockmax)
+{
+	struct snapraid_io io;
+	struct snapraid_handle* handle;
+	void* rehandle_alloc;
+	struct snapraid_rehash* rehandle;
+	unsigned diskmax;
+	block_off_t blockcur;
+	unsigned j;
+	int ret;
+	data_off_t countsize;
+	block_off_t countpos;
+	block_off_t countmax;
+	block_off_t autosavedone;
+	block_off_t autosavelimit;
+	block_off_t autosavemissing;
+	block_off_t autosavestart;
+	block_off_t autosaveend;
+	uint64_t autosavetick;
+	unsigned error;
+	unsigned io_error;
+	unsigned* waiting_map;
+	unsigned waiting_mac;
+	char esc_buffer[ESC_MAX];
+
+	handle = handle_mapping(state, &diskmax);
+
+	/* rehash buffers */
+	rehandle = malloc_nofail_align(diskmax * sizeof(struct snapraid_rehash), &rehandle_alloc);
+
+	/* initialize the io threads, only for the data */
+	io_init(&io, state, state->opt.io_cache, diskmax, rehash_data_reader, handle, diskmax, 0, 0, 0, 0);
+
+	/* possibly waiting disks */
+	waiting_mac = diskmax > RAID_PARITY_MAX ? diskmax : RAID_PARITY_MAX;
+	waiting_map = malloc_nofail(waiting_mac * sizeof(unsigned));
+
+	error = 0;
+	io_error = 0;
+
+	/* first count the number of blocks to process */
+	countmax = 0;
+	for (blockcur = 0; blockcur < blockmax; ++blockcur) {
+		if (!block_is_enabled(state, blockcur))
+			continue;
+		++countmax;
+	}
+
+	/* compute the autosave size for all disk, even if not read */
+	/* this makes sense because the speed should be almost the same */
+	/* if the disks are read in parallel */
+	autosavelimit = state->autosave / (diskmax * state->block_size);
+	autosavemissing = countmax; /* blocks to do */
+	autosavedone = 0; /* blocks done */
+	autosavestart = 0; /* first block not yet saved */
+	autosaveend = 0; /* last block not yet saved, plus one */
+	autosavetick = tick_ms() + state->autosave_time * 1000ULL; /* time of the next autosave */
+
+	/* drop until now */
+	state_usage_waste(state);
+
+	countsize = 0;
+	countpos = 0;
+
+	/* start all the worker threads */
+	io_start(&io, 0, blockmax, &block_is_enabled, state);
+
+	state_progress_begin(state, 0, blockmax, countmax);
+	while (1) {
+		snapraid_info info;
+		int error_on_this_block;
+		void** buffer;
+
+		/* go to the next block */
+		blockcur = io_read_next(&io, &buffer);
+		if (blockcur >= blockmax)
+			break;
+
+		/* until now is scheduling */
+		state_usage_sched(state);
+
+		/* one more block processed for autosave */
+		++autosavedone;
+		--autosavemissing;
+
+		/* the positions rehashed since the last autosave */
+		if (autosavestart == autosaveend)
+			autosavestart = blockcur;
+		autosaveend = blockcur + 1;
+
+		error_on_this_block = 0;
+
+		/* for each disk, process the block */
+		for (j = 0; j < diskmax; ++j) {
+			struct snapraid_task* task;
+			struct snapraid_disk* disk;
+			unsigned diskcur;
+
+			/* until now is misc */
+			state_usage_misc(state);
+
+			/* get the next task */
+			task = io_data_read(&io, &diskcur, waiting_map, &waiting_mac);
+
+			/* until now is disk */
+			state_usage_disk(state, handle, waiting_map, waiting_mac);
+
+			/* by default no rehash in case of "continue" */
+			rehandle[diskcur].block = 0;
+
+			/* get the task results */
+			disk = task->disk;
+
+			/* if the disk position is not used */
+			if (!disk)
+				continue;
+
+			state_usage_file(state, disk, task->file);
+
+			/* if the block is not used */
+			if (!block_has_file(task->block))
+				continue;
+
+			/* handle error conditions */
+			if (task->state == TASK_STATE_IOERROR) {
+				/* LCOV_EXCL_START */
+				++io_error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			if (task->state == TASK_STATE_ERROR) {
+				/* LCOV_EXCL_START */
+				++error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			if (task->state == TASK_STATE_ERROR_CONTINUE) {
+				++error;
+				error_on_this_block = 1;
+				continue;
+			}
+			if (task->state == TASK_STATE_IOERROR_CONTINUE) {
+				++io_error;
+				if (io_error >= state->opt.io_error_limit) {
+					/* LCOV_EXCL_START */
+					log_fatal("DANGER! Too many input/output read error in a data disk, it isn't possible to rehash.\n");
+					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, task->path);
+					log_fatal("Stopping at block %u\n", blockcur);
+					goto bail;
+					/* LCOV_EXCL_STOP */
+				}
+
+				/* otherwise continue */
+				error_on_this_block = 1;
+				continue;
+			}
+			if (task->state != TASK_STATE_DONE) {
+				/* LCOV_EXCL_START */
+				log_fatal("Internal inconsistency in task state\n");
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* keep the new hash, to store it only if all the position is verified */
+			rehandle[diskcur].block = task->block;
+			memcpy(rehandle[diskcur].hash, task->hash, BLOCK_HASH_SIZE);
+
+			countsize += task->read_size;
+		}
+
+		/* until now is misc */
+		state_usage_misc(state);
+
+		/* a position with errors keeps the old hash, and it's left to the next scrub */
+		if (!error_on_this_block) {
+			for (j = 0; j < diskmax; ++j) {
+				if (rehandle[j].block)
+					memcpy(rehandle[j].block->hash, rehandle[j].hash, BLOCK_HASH_SIZE);
+			}
+
+			/* clear the rehash flag, keeping the other info */
+			info = info_get(&state->infoarr, blockcur);
+			info_set(&state->infoarr, blockcur, info_make(info_get_time(info), info_get_bad(info), 0, info_get_justsynced(info)));
+
+			/* mark the state as needing write */
+			state->need_write = 1;
+		}
+
+		/* count the number of processed block */
+		++countpos;
+
+		/* progress */
+		if (state_progress(state, &io, blockcur, countpos, countmax, countsize)) {
+			/* LCOV_EXCL_START */
+			break;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* autosave */
+		if ((state->autosave != 0
+			&& autosavedone >= autosavelimit /* if we have reached the limit */
+			&& autosavemissing >= autosavelimit) /* if we have at least a full step to do */
+			/* or if we have reached the time limit, and there is still something to do */
+			|| (state->autosave_time != 0 && autosavemissing != 0 && tick_ms() >= autosavetick)
+		) {
+			autosavedone = 0; /* restart the counter */
+
+			/* until now is misc */
+			state_usage_misc(state);
+
+			state_progress_stop(state);
+
+			msg_progress("Autosaving...\n");
+			state_autosave(state, autosavestart, autosaveend);
+			autosavestart = autosaveend;
+			autosavetick = tick_ms() + state->autosave_time * 1000ULL;
+
+			state_progress_restart(state);
+
+			/* drop until now */
+			state_usage_waste(state);
+		}
+	}
+
+	state_progress_end(state, countpos, countmax, countsize);
+
+	state_usage_print(state);
+
+bail:
+	/* stop all the worker threads */
+	io_stop(&io);
+
+	state_usage_latency(state);
+
+	for (j = 0; j < diskmax; ++j) {
+		struct snapraid_file* file = handle[j].file;
+		struct snapraid_disk* disk = handle[j].disk;
+		ret = handle_close(&handle[j]);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Close error. %s\n", blockmax, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected close error in a data disk.\n");
+			++error;
+			/* continue, as we are already exiting */
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	if (error || io_error) {
+		msg_status("\n");
+		msg_status("%8u file errors\n", error);
+		msg_status("%8u io errors\n", io_error);
+		msg_status("The blocks with errors keep the old hash, and they are rehashed\n");
+		msg_status("in the next 'sync' and 'scrub' commands.\n");
+	} else {
+		msg_status("Everything OK\n");
+	}
+
+	if (error)
+		log_fatal("DANGER! Unexpected errors!\n");
+	if (io_error)
+		log_fatal("DANGER! Unexpected input/output errors!\n");
+
+	handle_unmapping(handle, diskmax);
+	free(rehandle_alloc);
+	free(waiting_map);
+	io_done(&io);
+
+	if (error + io_error != 0)
+		return -1;
+	return 0;
+}
+
+int state_rehash(struct snapraid_state* state)
 {
 	block_off_t blockmax;
 	block_off_t i;
 
+	state_index(state);
+
 	blockmax = parity_allocated_size(state);
 
 	/* check if a rehash is already in progress */
 	if (state->prevhash != HASH_UNDEFINED) {
+		/* a rehash in progress can be completed now */
+		if (state->opt.rehash_now) {
+			msg_progress("Rehashing...\n");
+			return state_rehash_process(state, blockmax);
+		}
+
 		/* LCOV_EXCL_START */
 		log_fatal("You already have a rehash in progress.\n");
 		exit(EXIT_FAILURE);
@@ -91,8 +542,14 @@ void state_rehash(struct snapraid_state* state)
 	/* save the new content file */
 	state->need_write = 1;
 
+	if (state->opt.rehash_now) {
+		msg_progress("Rehashing...\n");
+		return state_rehash_process(state, blockmax);
+	}
+
 	msg_status("A rehash is now scheduled. It will take place progressively in the next\n");
 	msg_status("'sync' and 'scrub' commands. You can check the rehash progress using the\n");
 	msg_status("'status' command.\n");
-}
 
+	return 0;
+}
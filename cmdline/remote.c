@@ -0,0 +1,1325 @@
+/*
+ * Copyright (C) 2026 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "portable.h"
+
+#include "support.h"
+#include "util.h"
+#include "elem.h"
+#include "state.h"
+#include "stream.h"
+#include "remote.h"
+
+/****************************************************************************/
+/* remote */
+
+/*
+ * Each request is a header of 16 bytes, followed by its data, if any:
+ *   op:1, reserved:3, size:4, offset:8
+ * The requests that need an answer get a reply of 16 bytes, followed by its data, if any:
+ *   status:4, pending:4, value:8
+ * The status is the errno of the request, and pending is the errno of
+ * a previous WRITE or ZERO request, as these ones have no reply.
+ * This allows to stream the writes without waiting for the agent,
+ * with the network latency paid only by the requests with a reply.
+ * All the numbers are in little endian.
+ *
+ * Before any request, the agent sends a random challenge of 32 bytes,
+ * the client answers with its HMAC-SHA256 computed with the shared key,
+ * and the agent replies with a status of EACCES if the key is wrong.
+ */
+
+#define REMOTE_OP_OPEN 1 /**< Open the file named in the data. Create it if the offset is 1. */
+#define REMOTE_OP_STAT 2 /**< Reply with the size of the file. */
+#define REMOTE_OP_READ 3 /**< Reply with the data read, and its size. */
+#define REMOTE_OP_WRITE 4 /**< Write the data. No reply. */
+#define REMOTE_OP_ZERO 5 /**< Write zeros, without sending them. No reply. */
+#define REMOTE_OP_CHSIZE 6 /**< Change the size to the offset. */
+#define REMOTE_OP_SYNC 7 /**< Sync the file on disk. */
+#define REMOTE_OP_FSINFO 8 /**< Reply with the total and free space as data. */
+#define REMOTE_OP_CLOSE 9 /**< Close the file and the connection. */
+
+#define REMOTE_HEADER 16 /**< Size of the request and of the reply. */
+#define REMOTE_BATCH (4 * MEBI) /**< Requests queued before sending them. */
+#define REMOTE_DATA_MAX (256 * MEBI) /**< Max data of a request accepted by the agent. */
+#define REMOTE_NAME_MAX 256 /**< Max length of the file name. */
+#define REMOTE_WAIT 1 /**< Seconds waited for a connection before checking for interruption. */
+#define REMOTE_CHALLENGE 32 /**< Size of the challenge of the login. */
+#define REMOTE_LOGIN_TIMEOUT 10 /**< Seconds waited for the answer to the challenge. */
+
+/**
+ * Shared key of the agent, from the 'remotekey' option.
+ */
+static char remote_secret[PATH_MAX];
+
+void remote_key(const char* key)
+{
+	pathcpy(remote_secret, sizeof(remote_secret), key);
+}
+
+#if HAVE_REMOTE
+
+#ifdef MSG_NOSIGNAL
+#define REMOTE_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define REMOTE_SEND_FLAGS 0
+#endif
+
+static void remote_put32(unsigned char* ptr, uint32_t v)
+{
+	unsigned i;
+
+	for (i = 0; i < 4; ++i)
+		ptr[i] = v >> (8 * i);
+}
+
+static void remote_put64(unsigned char* ptr, uint64_t v)
+{
+	unsigned i;
+
+	for (i = 0; i < 8; ++i)
+		ptr[i] = v >> (8 * i);
+}
+
+static uint32_t remote_get32(const unsigned char* ptr)
+{
+	uint32_t v = 0;
+	unsigned i;
+
+	for (i = 0; i < 4; ++i)
+		v |= (uint32_t)ptr[i] << (8 * i);
+
+	return v;
+}
+
+static uint64_t remote_get64(const unsigned char* ptr)
+{
+	uint64_t v = 0;
+	unsigned i;
+
+	for (i = 0; i < 8; ++i)
+		v |= (uint64_t)ptr[i] << (8 * i);
+
+	return v;
+}
+
+/**
+ * Send all the data, retrying on partial writes.
+ */
+static int remote_send(int s, const void* data, size_t size)
+{
+	const char* ptr = data;
+
+	while (size > 0) {
+		ssize_t ret = send(s, ptr, size, REMOTE_SEND_FLAGS);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			if (errno == EINTR)
+				continue;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+		ptr += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Send a header and its data with a single call, retrying on partial writes.
+ * This avoids to send the header in a packet of its own.
+ */
+static int remote_send_data(int s, const void* header, size_t header_size, const void* data, size_t data_size)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	iov[0].iov_base = (void*)header;
+	iov[0].iov_len = header_size;
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = data_size;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while (iov[0].iov_len + iov[1].iov_len > 0) {
+		ssize_t ret = sendmsg(s, &msg, REMOTE_SEND_FLAGS);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			if (errno == EINTR)
+				continue;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* skip what was already sent */
+		if ((size_t)ret < iov[0].iov_len) {
+			iov[0].iov_base = (char*)iov[0].iov_base + ret;
+			iov[0].iov_len -= ret;
+		} else {
+			ret -= iov[0].iov_len;
+			iov[0].iov_len = 0;
+			iov[1].iov_base = (char*)iov[1].iov_base + ret;
+			iov[1].iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Receive all the data, retrying on partial reads.
+ */
+static int remote_recv(int s, void* data, size_t size)
+{
+	char* ptr = data;
+
+	while (size > 0) {
+		ssize_t ret = recv(s, ptr, size, 0);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			if (errno == EINTR)
+				continue;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+		if (ret == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		ptr += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Split a "tcp://HOST:PORT/NAME" path.
+ */
+static int remote_parse(const char* path, char* host, size_t host_size, char* port, size_t port_size, char* name, size_t name_size)
+{
+	const char* begin = path + sizeof(REMOTE_PREFIX) - 1;
+	const char* slash;
+	const char* colon;
+	const char* host_end;
+
+	slash = strchr(begin, '/');
+	if (!slash)
+		goto bail;
+
+	/* the last colon before the name, to allow IPv6 addresses in brackets */
+	colon = slash;
+	while (colon > begin && *colon != ':')
+		--colon;
+	if (colon == begin || colon + 1 == slash)
+		goto bail;
+
+	host_end = colon;
+	if (*begin == '[' && host_end[-1] == ']') {
+		++begin;
+		--host_end;
+	}
+
+	if ((size_t)(host_end - begin) + 1 > host_size
+		|| (size_t)(slash - colon - 1) + 1 > port_size
+		|| strlen(slash + 1) + 1 > name_size
+		|| slash[1] == 0)
+		goto bail;
+
+	memcpy(host, begin, host_end - begin);
+	host[host_end - begin] = 0;
+	memcpy(port, colon + 1, slash - colon - 1);
+	port[slash - colon - 1] = 0;
+	strcpy(name, slash + 1);
+
+	return 0;
+
+bail:
+	log_fatal("Invalid remote path '%s'. It must be in the form '%sHOST:PORT/NAME'.\n", path, REMOTE_PREFIX);
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Set the options of a connected socket.
+ */
+static void remote_socket(int s)
+{
+#if HAVE_NETINET_TCP_H && defined(TCP_NODELAY)
+	/* the requests and the replies are sent whole, don't delay them */
+	{
+		int on = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (void*)&on, sizeof(on));
+	}
+#endif
+#ifdef SO_NOSIGPIPE
+	{
+		int on = 1;
+		setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, (void*)&on, sizeof(on));
+	}
+#endif
+}
+
+/**
+ * Answer the challenge of the agent with the shared key.
+ */
+static int remote_login(int s, const char* path)
+{
+	unsigned char challenge[REMOTE_CHALLENGE];
+	unsigned char digest[SHA256_SIZE];
+	unsigned char reply[REMOTE_HEADER];
+	uint32_t status;
+
+	if (remote_secret[0] == 0) {
+		log_fatal("Missing 'remotekey' specification, required by the remote parity '%s'\n", path);
+		errno = EACCES;
+		return -1;
+	}
+
+	if (remote_recv(s, challenge, sizeof(challenge)) != 0)
+		return -1;
+
+	hmac_sha256(digest, remote_secret, strlen(remote_secret), challenge, sizeof(challenge));
+
+	if (remote_send(s, digest, sizeof(digest)) != 0)
+		return -1;
+
+	if (remote_recv(s, reply, sizeof(reply)) != 0)
+		return -1;
+
+	status = remote_get32(reply);
+	if (status != 0) {
+		log_fatal("The agent of the remote parity '%s' refused the 'remotekey' specification\n", path);
+		errno = status;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Connect to the agent of the path.
+ */
+static int remote_connect(const char* path, char* name, size_t name_size)
+{
+	char host[REMOTE_NAME_MAX];
+	char port[32];
+	struct addrinfo hints;
+	struct addrinfo* list;
+	struct addrinfo* i;
+	int s;
+	int ret;
+
+	if (remote_parse(path, host, sizeof(host), port, sizeof(port), name, name_size) != 0)
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	ret = getaddrinfo(host, port, &hints, &list);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error resolving the remote host '%s'. %s.\n", host, gai_strerror(ret));
+		errno = EHOSTUNREACH;
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	s = -1;
+	for (i = list; i != 0; i = i->ai_next) {
+		s = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+		if (s == -1)
+			continue;
+		if (connect(s, i->ai_addr, i->ai_addrlen) == 0)
+			break;
+		close(s);
+		s = -1;
+	}
+
+	freeaddrinfo(list);
+
+	if (s == -1)
+		return -1;
+
+	remote_socket(s);
+
+	if (remote_login(s, path) != 0) {
+		int error = errno;
+		close(s);
+		errno = error;
+		return -1;
+	}
+
+	return s;
+}
+
+struct snapraid_remote {
+	int s; /**< Socket connected to the agent. */
+	unsigned char* batch; /**< Requests not yet sent. */
+	size_t batch_size; /**< Size of the queued requests. */
+	size_t last; /**< Position of the latest request, if it can be extended with a contiguous write. SIZE_MAX if not. */
+	data_off_t last_end; /**< End offset of the latest request. */
+	int error; /**< Error of the previous writes, not yet reported. */
+#if HAVE_PTHREAD
+	pthread_mutex_t mutex; /**< Serializes the requests of the split lanes. */
+#endif
+};
+
+static void remote_lock(struct snapraid_remote* remote)
+{
+#if HAVE_PTHREAD
+	thread_mutex_lock(&remote->mutex);
+#else
+	(void)remote;
+#endif
+}
+
+static void remote_unlock(struct snapraid_remote* remote)
+{
+#if HAVE_PTHREAD
+	thread_mutex_unlock(&remote->mutex);
+#else
+	(void)remote;
+#endif
+}
+
+/**
+ * Send the queued requests.
+ */
+static int remote_flush(struct snapraid_remote* remote)
+{
+	int ret;
+
+	ret = remote_send(remote->s, remote->batch, remote->batch_size);
+
+	remote->batch_size = 0;
+	remote->last = SIZE_MAX;
+
+	return ret;
+}
+
+/**
+ * Queue a request.
+ */
+static int remote_queue(struct snapraid_remote* remote, unsigned op, uint32_t size, uint64_t offset, const void* data, size_t data_size)
+{
+	unsigned char* header;
+
+	if (remote->batch_size + REMOTE_HEADER + data_size > REMOTE_BATCH) {
+		if (remote_flush(remote) != 0)
+			return -1;
+	}
+
+	header = remote->batch + remote->batch_size;
+	memset(header, 0, REMOTE_HEADER);
+	header[0] = op;
+	remote_put32(header + 4, size);
+	remote_put64(header + 8, offset);
+	remote->batch_size += REMOTE_HEADER;
+
+	/* data too big for the batch is sent directly */
+	if (REMOTE_HEADER + data_size > REMOTE_BATCH) {
+		if (remote_flush(remote) != 0)
+			return -1;
+		return remote_send(remote->s, data, data_size);
+	}
+
+	if (data_size != 0) {
+		memcpy(remote->batch + remote->batch_size, data, data_size);
+		remote->batch_size += data_size;
+	}
+
+	return 0;
+}
+
+/**
+ * Queue a request, send it with all the others, and wait for the reply.
+ */
+static int remote_call(struct snapraid_remote* remote, unsigned op, uint32_t size, uint64_t offset, const void* data, size_t data_size, uint64_t* value)
+{
+	unsigned char reply[REMOTE_HEADER];
+	uint32_t status;
+	uint32_t pending;
+
+	if (remote_queue(remote, op, size, offset, data, data_size) != 0
+		|| remote_flush(remote) != 0
+		|| remote_recv(remote->s, reply, sizeof(reply)) != 0) {
+		/* the connection is lost, fail also all the next writes */
+		if (remote->error == 0)
+			remote->error = errno;
+		return -1;
+	}
+
+	status = remote_get32(reply);
+	pending = remote_get32(reply + 4);
+	if (value)
+		*value = remote_get64(reply + 8);
+
+	if (pending != 0 && remote->error == 0)
+		remote->error = pending;
+
+	if (status != 0) {
+		errno = status;
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct snapraid_remote* remote_alloc(int s)
+{
+	struct snapraid_remote* remote;
+
+	remote = malloc_nofail(sizeof(struct snapraid_remote));
+	remote->s = s;
+	remote->batch = malloc_nofail(REMOTE_BATCH);
+	remote->batch_size = 0;
+	remote->last = SIZE_MAX;
+	remote->last_end = 0;
+	remote->error = 0;
+#if HAVE_PTHREAD
+	thread_mutex_init(&remote->mutex, 0);
+#endif
+
+	return remote;
+}
+
+struct snapraid_remote* remote_open(const char* path, int create)
+{
+	struct snapraid_remote* remote;
+	char name[PATH_MAX];
+	int s;
+
+	s = remote_connect(path, name, sizeof(name));
+	if (s == -1)
+		return 0;
+
+	remote = remote_alloc(s);
+
+	if (remote_call(remote, REMOTE_OP_OPEN, strlen(name), create != 0, name, strlen(name), 0) != 0) {
+		int error = errno;
+		remote_close(remote);
+		errno = error;
+		return 0;
+	}
+
+	return remote;
+}
+
+int remote_close(struct snapraid_remote* remote)
+{
+	int ret;
+
+	ret = remote_call(remote, REMOTE_OP_CLOSE, 0, 0, 0, 0, 0);
+	if (ret == 0 && remote->error != 0) {
+		errno = remote->error;
+		ret = -1;
+	}
+
+	close(remote->s);
+#if HAVE_PTHREAD
+	thread_mutex_destroy(&remote->mutex);
+#endif
+	free(remote->batch);
+	free(remote);
+
+	return ret;
+}
+
+int remote_size(struct snapraid_remote* remote, data_off_t* out_size)
+{
+	uint64_t value;
+	int ret;
+
+	remote_lock(remote);
+	ret = remote_call(remote, REMOTE_OP_STAT, 0, 0, 0, 0, &value);
+	remote_unlock(remote);
+
+	if (ret == 0)
+		*out_size = value;
+
+	return ret;
+}
+
+int remote_chsize(struct snapraid_remote* remote, data_off_t size)
+{
+	int ret;
+
+	remote_lock(remote);
+	ret = remote_call(remote, REMOTE_OP_CHSIZE, 0, size, 0, 0, 0);
+	remote_unlock(remote);
+
+	return ret;
+}
+
+ssize_t remote_pwrite(struct snapraid_remote* remote, const void* buf, size_t size, data_off_t offset)
+{
+	unsigned op;
+	size_t data_size;
+	int ret;
+
+	/* zero blocks are common in the parity of a partially filled array */
+	if (memiszero(buf, size)) {
+		op = REMOTE_OP_ZERO;
+		data_size = 0;
+	} else {
+		op = REMOTE_OP_WRITE;
+		data_size = size;
+	}
+
+	remote_lock(remote);
+
+	if (remote->error != 0) {
+		errno = remote->error;
+		remote_unlock(remote);
+		return -1;
+	}
+
+	/* extend the latest request, if it's of the same kind and contiguous */
+	if (remote->last != SIZE_MAX
+		&& remote->batch[remote->last] == op
+		&& remote->last_end == offset
+		&& remote->batch_size + data_size <= REMOTE_BATCH
+		&& remote_get32(remote->batch + remote->last + 4) + size <= REMOTE_BATCH) {
+		unsigned char* header = remote->batch + remote->last;
+
+		remote_put32(header + 4, remote_get32(header + 4) + size);
+		if (data_size != 0) {
+			memcpy(remote->batch + remote->batch_size, buf, data_size);
+			remote->batch_size += data_size;
+		}
+		ret = 0;
+	} else {
+		ret = remote_queue(remote, op, size, offset, buf, data_size);
+
+		/* a request sent directly cannot be extended */
+		if (ret == 0 && remote->batch_size != 0)
+			remote->last = remote->batch_size - REMOTE_HEADER - data_size;
+	}
+
+	remote->last_end = offset + size;
+
+	if (ret != 0 && remote->error == 0)
+		remote->error = errno;
+
+	remote_unlock(remote);
+
+	if (ret != 0)
+		return -1;
+
+	return size;
+}
+
+ssize_t remote_pread(struct snapraid_remote* remote, void* buf, size_t size, data_off_t offset)
+{
+	uint64_t value;
+	int ret;
+
+	remote_lock(remote);
+
+	ret = remote_call(remote, REMOTE_OP_READ, size, offset, 0, 0, &value);
+	if (ret == 0) {
+		if (value > size) {
+			/* LCOV_EXCL_START */
+			errno = EPROTO;
+			ret = -1;
+			/* LCOV_EXCL_STOP */
+		} else {
+			ret = remote_recv(remote->s, buf, value);
+		}
+	}
+
+	remote_unlock(remote);
+
+	if (ret != 0)
+		return -1;
+
+	return value;
+}
+
+int remote_sync(struct snapraid_remote* remote)
+{
+	int ret;
+
+	remote_lock(remote);
+
+	ret = remote_call(remote, REMOTE_OP_SYNC, 0, 0, 0, 0, 0);
+	if (ret == 0 && remote->error != 0) {
+		errno = remote->error;
+		ret = -1;
+	}
+
+	remote_unlock(remote);
+
+	return ret;
+}
+
+int remote_fsinfo(const char* path, uint64_t* total_space, uint64_t* free_space)
+{
+	struct snapraid_remote* remote;
+	char name[PATH_MAX];
+	unsigned char data[16];
+	uint64_t value;
+	int ret;
+	int s;
+
+	/* the info is of the directory of the agent, so the file doesn't need to exist */
+	s = remote_connect(path, name, sizeof(name));
+	if (s == -1)
+		return -1;
+
+	remote = remote_alloc(s);
+
+	ret = remote_call(remote, REMOTE_OP_FSINFO, 0, 0, 0, 0, &value);
+	if (ret == 0 && value != sizeof(data)) {
+		/* LCOV_EXCL_START */
+		errno = EPROTO;
+		ret = -1;
+		/* LCOV_EXCL_STOP */
+	}
+	if (ret == 0)
+		ret = remote_recv(remote->s, data, sizeof(data));
+	if (ret == 0) {
+		*total_space = remote_get64(data);
+		*free_space = remote_get64(data + 8);
+	}
+
+	if (remote_close(remote) != 0)
+		ret = -1;
+
+	return ret;
+}
+
+/****************************************************************************/
+/* agent */
+
+/**
+ * Check that the name is a plain file name, to not allow to access other directories.
+ */
+static int remote_name_is_valid(const char* name)
+{
+	if (name[0] == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return 0;
+
+	if (strchr(name, '/') != 0 || strchr(name, '\\') != 0)
+		return 0;
+
+	return 1;
+}
+
+static int remote_reply(int s, int status, int* pending, uint64_t value, const void* data, size_t data_size)
+{
+	unsigned char reply[REMOTE_HEADER];
+
+	remote_put32(reply, status);
+	remote_put32(reply + 4, *pending);
+	remote_put64(reply + 8, value);
+
+	/* the pending error is now reported */
+	*pending = 0;
+
+	if (data_size != 0)
+		return remote_send_data(s, reply, sizeof(reply), data, data_size);
+
+	return remote_send(s, reply, sizeof(reply));
+}
+
+/**
+ * Write all the data, retrying on partial writes.
+ */
+static int remote_write(int f, const unsigned char* data, size_t size, data_off_t offset)
+{
+	while (size > 0) {
+		ssize_t ret = pwrite(f, data, size, offset);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			if (errno == EINTR)
+				continue;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+		data += ret;
+		offset += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Check that the name is one of the files served.
+ */
+static int remote_name_is_served(const char* name, char** name_list, unsigned name_count)
+{
+	unsigned i;
+
+	for (i = 0; i < name_count; ++i)
+		if (strcmp(name, name_list[i]) == 0)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * Send the challenge, and check the answer with the shared key.
+ */
+static int remote_challenge(int s)
+{
+	unsigned char challenge[REMOTE_CHALLENGE];
+	unsigned char digest[SHA256_SIZE];
+	unsigned char expected[SHA256_SIZE];
+	struct timeval tv;
+	int pending = 0;
+	int ret;
+
+	/* a client not answering doesn't keep the process forever */
+	tv.tv_sec = REMOTE_LOGIN_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (void*)&tv, sizeof(tv));
+
+	if (randomize(challenge, sizeof(challenge)) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error generating the remote challenge.\n");
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (remote_send(s, challenge, sizeof(challenge)) != 0)
+		return -1;
+
+	if (remote_recv(s, digest, sizeof(digest)) != 0)
+		return -1;
+
+	hmac_sha256(expected, remote_secret, strlen(remote_secret), challenge, sizeof(challenge));
+
+	ret = memdiff(expected, digest, sizeof(digest)) != 0 ? EACCES : 0;
+
+	if (remote_reply(s, ret, &pending, 0, 0, 0) != 0)
+		return -1;
+
+	if (ret != 0) {
+		log_fatal("WARNING! Remote connection refused for a wrong key.\n");
+		return -1;
+	}
+
+	/* the requests can wait any time, as the client may be busy */
+	tv.tv_sec = 0;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (void*)&tv, sizeof(tv));
+
+	return 0;
+}
+
+/**
+ * Serve a single connection, until closed.
+ */
+static void remote_session(int s, char** name_list, unsigned name_count)
+{
+	unsigned char header[REMOTE_HEADER];
+	char name[REMOTE_NAME_MAX];
+	unsigned char* data;
+	size_t data_max;
+	int pending;
+	int f;
+
+	if (remote_challenge(s) != 0)
+		return;
+
+	f = -1;
+	pending = 0;
+	data_max = MEBI;
+	data = malloc_nofail(data_max);
+
+	while (remote_recv(s, header, sizeof(header)) == 0) {
+		unsigned op = header[0];
+		uint32_t size = remote_get32(header + 4);
+		uint64_t offset = remote_get64(header + 8);
+		struct stat st;
+		int ret;
+
+		if (size > REMOTE_DATA_MAX) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Too big remote request of %u bytes.\n", size);
+			break;
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (size > data_max) {
+			free(data);
+			data_max = size;
+			data = malloc_nofail(data_max);
+		}
+
+		/* all the requests except open and fsinfo need an open file */
+		if (f == -1 && op != REMOTE_OP_OPEN && op != REMOTE_OP_FSINFO && op != REMOTE_OP_CLOSE) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Remote request %u without an open file.\n", op);
+			break;
+			/* LCOV_EXCL_STOP */
+		}
+
+		switch (op) {
+		case REMOTE_OP_OPEN :
+			if (f != -1 || size >= sizeof(name) || remote_recv(s, name, size) != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("WARNING! Invalid remote open request.\n");
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			name[size] = 0;
+			log_tag("agent:open:%s\n", name);
+			if (!remote_name_is_served(name, name_list, name_count)) {
+				ret = EACCES;
+			} else {
+				if (offset & 1)
+					f = open(name, O_RDWR | O_CREAT | O_BINARY, 0600);
+				else
+					f = open(name, O_RDONLY | O_BINARY);
+				ret = f == -1 ? errno : 0;
+			}
+			if (remote_reply(s, ret, &pending, 0, 0, 0) != 0)
+				goto bail;
+			if (f == -1)
+				goto bail;
+			break;
+		case REMOTE_OP_STAT :
+			ret = fstat(f, &st) != 0 ? errno : 0;
+			if (remote_reply(s, ret, &pending, ret == 0 ? st.st_size : 0, 0, 0) != 0)
+				goto bail;
+			break;
+		case REMOTE_OP_READ : {
+			size_t count = 0;
+			ret = 0;
+			while (count < size) {
+				ssize_t read_ret = pread(f, data + count, size - count, offset + count);
+				if (read_ret < 0 && errno == EINTR)
+					continue;
+				if (read_ret < 0) {
+					/* LCOV_EXCL_START */
+					ret = errno;
+					break;
+					/* LCOV_EXCL_STOP */
+				}
+				if (read_ret == 0)
+					break;
+				count += read_ret;
+			}
+			if (ret != 0)
+				count = 0;
+			if (remote_reply(s, ret, &pending, count, data, count) != 0)
+				goto bail;
+			break;
+		}
+		case REMOTE_OP_WRITE :
+			if (remote_recv(s, data, size) != 0)
+				goto bail;
+			/* after an error, the next writes are ignored until it's reported */
+			if (pending == 0 && remote_write(f, data, size, offset) != 0)
+				pending = errno;
+			break;
+		case REMOTE_OP_ZERO :
+			if (pending == 0) {
+				memset(data, 0, size);
+				if (remote_write(f, data, size, offset) != 0)
+					pending = errno;
+			}
+			break;
+		case REMOTE_OP_CHSIZE :
+			ret = ftruncate(f, offset) != 0 ? errno : 0;
+			if (remote_reply(s, ret, &pending, 0, 0, 0) != 0)
+				goto bail;
+			break;
+		case REMOTE_OP_SYNC :
+			ret = fsync(f) != 0 ? errno : 0;
+			if (remote_reply(s, ret, &pending, 0, 0, 0) != 0)
+				goto bail;
+			break;
+		case REMOTE_OP_FSINFO : {
+			uint64_t total_space;
+			uint64_t free_space;
+			unsigned char info[16];
+			ret = fsinfo(".", 0, 0, &total_space, &free_space) != 0 ? errno : 0;
+			if (ret != 0) {
+				/* LCOV_EXCL_START */
+				if (remote_reply(s, ret, &pending, 0, 0, 0) != 0)
+					goto bail;
+				break;
+				/* LCOV_EXCL_STOP */
+			}
+			remote_put64(info, total_space);
+			remote_put64(info + 8, free_space);
+			if (remote_reply(s, 0, &pending, sizeof(info), info, sizeof(info)) != 0)
+				goto bail;
+			break;
+		}
+		case REMOTE_OP_CLOSE :
+			ret = 0;
+			if (f != -1 && close(f) != 0)
+				ret = errno;
+			f = -1;
+			remote_reply(s, ret, &pending, 0, 0, 0);
+			goto bail;
+		default :
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Unknown remote request %u.\n", op);
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+bail:
+	if (f != -1)
+		close(f);
+	free(data);
+}
+
+/**
+ * Read the shared key from the configuration file, ignoring all the other options.
+ */
+static int remote_agent_config(const char* path)
+{
+	STREAM* f;
+	unsigned line;
+
+	f = sopen_read(path);
+	if (!f) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening the configuration file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	line = 1;
+	while (1) {
+		char tag[PATH_MAX];
+		char buffer[PATH_MAX];
+		int c;
+
+		sgetspace(f);
+
+		if (sgettok(f, tag, sizeof(tag)) < 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error reading the configuration file '%s' at line %u\n", path, line);
+			sclose(f);
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		sgetspace(f);
+
+		if (strcmp(tag, "remotekey") == 0) {
+			if (sgetlasttok(f, buffer, sizeof(buffer)) < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'remotekey' specification in '%s' at line %u\n", path, line);
+				sclose(f);
+				return -1;
+				/* LCOV_EXCL_STOP */
+			}
+			remote_key(buffer);
+		} else if (sgetline(f, buffer, sizeof(buffer)) < 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error reading the configuration file '%s' at line %u\n", path, line);
+			sclose(f);
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		c = sgeteol(f);
+		if (c == EOF)
+			break;
+		++line;
+	}
+
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reading the configuration file '%s' at line %u\n", path, line);
+		sclose(f);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	sclose(f);
+
+	if (remote_secret[0] == 0) {
+		log_fatal("Missing 'remotekey' specification in '%s'\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int remote_agent(const char* conf, const char* listen_addr, char** name_list, unsigned name_count, unsigned pass)
+{
+	char host[REMOTE_NAME_MAX];
+	char service[32];
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	const char* port;
+	const char* colon;
+	struct addrinfo hints;
+	struct addrinfo* list;
+	struct addrinfo* i;
+	unsigned count;
+	int s;
+	int ret;
+
+	if (remote_agent_config(conf) != 0)
+		return EXIT_FAILURE;
+
+	if (name_count == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("The agent requires the names of the parity files to serve\n");
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	for (count = 0; count < name_count; ++count) {
+		if (!remote_name_is_valid(name_list[count])) {
+			/* LCOV_EXCL_START */
+			log_fatal("Invalid parity file name '%s'. Only plain file names are allowed.\n", name_list[count]);
+			return EXIT_FAILURE;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	/* a client disconnecting must not terminate the agent */
+	signal(SIGPIPE, SIG_IGN);
+
+	colon = strrchr(listen_addr, ':');
+	if (colon) {
+		const char* begin = listen_addr;
+		const char* end = colon;
+		if (*begin == '[' && end > begin && end[-1] == ']') {
+			++begin;
+			--end;
+		}
+		if ((size_t)(end - begin) + 1 > sizeof(host)) {
+			/* LCOV_EXCL_START */
+			log_fatal("Invalid listen address '%s'\n", listen_addr);
+			return EXIT_FAILURE;
+			/* LCOV_EXCL_STOP */
+		}
+		memcpy(host, begin, end - begin);
+		host[end - begin] = 0;
+		port = colon + 1;
+	} else {
+		/* without an explicit address, the agent is not reachable from the network */
+		pathcpy(host, sizeof(host), "localhost");
+		port = listen_addr;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	ret = getaddrinfo(host, port, &hints, &list);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error resolving the listen address '%s'. %s.\n", listen_addr, gai_strerror(ret));
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	s = -1;
+	for (i = list; i != 0; i = i->ai_next) {
+		int on = 1;
+
+		s = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+		if (s == -1)
+			continue;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (void*)&on, sizeof(on));
+		if (bind(s, i->ai_addr, i->ai_addrlen) == 0 && listen(s, 8) == 0)
+			break;
+		close(s);
+		s = -1;
+	}
+
+	freeaddrinfo(list);
+
+	if (s == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error listening on '%s'. %s.\n", listen_addr, strerror(errno));
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* report the port used, as with port 0 it's chosen by the system */
+	if (getsockname(s, (struct sockaddr*)&addr, &addr_len) != 0
+		|| getnameinfo((struct sockaddr*)&addr, addr_len, 0, 0, service, sizeof(service), NI_NUMERICSERV) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error getting the listen port of '%s'. %s.\n", listen_addr, strerror(errno));
+		close(s);
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	msg_progress("Serving the parity files of the current directory on '%s' at port %s...\n", host, service);
+
+	count = 0;
+	while (!global_interrupt) {
+		fd_set set;
+		struct timeval tv;
+		pid_t pid;
+		int f;
+
+		/* collect the terminated sessions */
+		while (waitpid(-1, 0, WNOHANG) > 0)
+			;
+
+		FD_ZERO(&set);
+		FD_SET(s, &set);
+		tv.tv_sec = REMOTE_WAIT;
+		tv.tv_usec = 0;
+
+		if (select(s + 1, &set, 0, 0, &tv) <= 0)
+			continue;
+
+		f = accept(s, 0, 0);
+		if (f == -1)
+			continue;
+
+		remote_socket(f);
+
+		/* each connection is a different parity file, served by its own process */
+		pid = fork();
+		if (pid == 0) {
+			close(s);
+			remote_session(f, name_list, name_count);
+			close(f);
+			_exit(EXIT_SUCCESS);
+		}
+		if (pid == -1) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Error creating the agent process. %s.\n", strerror(errno));
+			/* LCOV_EXCL_STOP */
+		}
+
+		close(f);
+
+		++count;
+		if (pass != 0 && count >= pass)
+			break;
+	}
+
+	close(s);
+
+	/* wait for the sessions still running */
+	while (waitpid(-1, 0, 0) > 0 || errno == EINTR)
+		;
+
+	return EXIT_SUCCESS;
+}
+#else
+struct snapraid_remote* remote_open(const char* path, int create)
+{
+	(void)create;
+
+	log_fatal("The remote parity '%s' is not supported in this platform\n", path);
+	errno = EOPNOTSUPP;
+
+	return 0;
+}
+
+int remote_close(struct snapraid_remote* remote)
+{
+	(void)remote;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int remote_size(struct snapraid_remote* remote, data_off_t* out_size)
+{
+	(void)remote;
+	(void)out_size;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int remote_chsize(struct snapraid_remote* remote, data_off_t size)
+{
+	(void)remote;
+	(void)size;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+ssize_t remote_pwrite(struct snapraid_remote* remote, const void* buf, size_t size, data_off_t offset)
+{
+	(void)remote;
+	(void)buf;
+	(void)size;
+	(void)offset;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+ssize_t remote_pread(struct snapraid_remote* remote, void* buf, size_t size, data_off_t offset)
+{
+	(void)remote;
+	(void)buf;
+	(void)size;
+	(void)offset;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int remote_sync(struct snapraid_remote* remote)
+{
+	(void)remote;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int remote_fsinfo(const char* path, uint64_t* total_space, uint64_t* free_space)
+{
+	(void)path;
+	(void)total_space;
+	(void)free_space;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+void remote_key(const char* key)
+{
+	(void)key;
+}
+
+int remote_agent(const char* conf, const char* listen_addr, char** name_list, unsigned name_count, unsigned pass)
+{
+	(void)conf;
+	(void)listen_addr;
+	(void)name_list;
+	(void)name_count;
+	(void)pass;
+
+	log_fatal("The agent is not supported in this platform\n");
+
+	return EXIT_FAILURE;
+}
+#endif
+
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2026 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REMOTE_H
+#define __REMOTE_H
+
+/****************************************************************************/
+/* remote */
+
+/**
+ * Prefix of the parity files kept by a remote agent.
+ * The full path is "tcp://HOST:PORT/NAME".
+ */
+#define REMOTE_PREFIX "tcp://"
+
+/**
+ * Connection to a parity file kept by a remote agent.
+ */
+struct snapraid_remote;
+
+/**
+ * If the path refers to a parity file kept by a remote agent.
+ */
+static inline int remote_is(const char* path)
+{
+	return strncmp(path, REMOTE_PREFIX, sizeof(REMOTE_PREFIX) - 1) == 0;
+}
+
+/**
+ * Open a remote parity file, optionally creating it.
+ * Return 0 on error, with errno set.
+ */
+struct snapraid_remote* remote_open(const char* path, int create);
+
+/**
+ * Close a remote parity file.
+ * It returns the errors of the writes not yet reported.
+ */
+int remote_close(struct snapraid_remote* remote);
+
+/**
+ * Get the size of a remote parity file.
+ */
+int remote_size(struct snapraid_remote* remote, data_off_t* out_size);
+
+/**
+ * Change the size of a remote parity file.
+ */
+int remote_chsize(struct snapraid_remote* remote, data_off_t size);
+
+/**
+ * Write a remote parity file.
+ *
+ * The write is queued and sent in batch with the following ones,
+ * without waiting for the agent. A failure is reported by the next
+ * operation waiting for the agent, usually remote_sync().
+ * Blocks of zeros are sent without their data.
+ */
+ssize_t remote_pwrite(struct snapraid_remote* remote, const void* buf, size_t size, data_off_t offset);
+
+/**
+ * Read a remote parity file.
+ */
+ssize_t remote_pread(struct snapraid_remote* remote, void* buf, size_t size, data_off_t offset);
+
+/**
+ * Send all the queued writes, and ensure that the agent wrote them on disk.
+ */
+int remote_sync(struct snapraid_remote* remote);
+
+/**
+ * Get the file-system info of a remote parity file.
+ */
+int remote_fsinfo(const char* path, uint64_t* total_space, uint64_t* free_space);
+
+/**
+ * Set the shared key used to login in the agents.
+ */
+void remote_key(const char* key);
+
+/**
+ * Serve the named parity files of the current directory on the specified [ADDR:]PORT.
+ * The shared key is read from the 'remotekey' option of the configuration file.
+ * Return the exit code.
+ */
+int remote_agent(const char* conf, const char* listen_addr, char** name_list, unsigned name_count, unsigned pass);
+
+#endif
+
@@ -22,9 +22,55 @@
 #include "state.h"
 #include "parity.h"
 
+/**
+ * New file found by the scan, waiting for the copy detection.
+ *
+ * The copy detection searches in the files of all the disks,
+ * and then it cannot run while other disks are still scanned.
+ * It's delayed after all the scans complete.
+ */
+struct snapraid_scan_new {
+	struct snapraid_file* file; /**< File to check for copy. */
+	int is_already_present; /**< If it replaces a file with the same name. */
+	data_off_t prev_size; /**< Size of the replaced file. */
+	int64_t prev_mtime_sec; /**< Modification time of the replaced file. */
+	int prev_mtime_nsec; /**< Modification time nanoseconds of the replaced file. */
+
+	/* nodes for data structures */
+	tommy_node node;
+};
+
+/**
+ * Directory reported by the file-system change journal.
+ */
+struct snapraid_scan_changed {
+	char* sub; /**< Path of the directory relative at the disk, terminated with a slash. Empty for the disk root. */
+
+	/* nodes for data structures */
+	tommy_hashdyn_node nodeset;
+	tommy_node nodelist;
+};
+
+/**
+ * Set of directories.
+ */
+struct snapraid_scan_changeset {
+	tommy_hashdyn set; /**< Hashtable by path of snapraid_scan_changed. */
+	tommy_list list; /**< List of snapraid_scan_changed. */
+};
+
 struct snapraid_scan {
 	struct snapraid_state* state; /**< State used. */
 	struct snapraid_disk* disk; /**< Disk used. */
+	int is_diff; /**< If we are running a diff, and we have to print the differences. */
+
+	/**
+	 * If the state is changed.
+	 *
+	 * It's a copy of ::need_write local at the scan, to allow
+	 * to update it from multiple threads.
+	 */
+	int need_write;
 
 	/**
 	 * Counters of changes.
@@ -36,32 +82,107 @@ struct snapraid_scan {
 	unsigned count_copy; /**< Files new, with same name size and timestamp of a file in a different disk. */
 	unsigned count_insert; /**< Files new. */
 	unsigned count_remove; /**< Files removed. */
+	unsigned count_relocate; /**< Files relocated in the parity by the compaction. */
+	block_off_t count_relocate_block; /**< Blocks relocated in the parity by the compaction. */
 
 	tommy_list file_insert_list; /**< Files to insert. */
 	tommy_list link_insert_list; /**< Links to insert. */
 	tommy_list dir_insert_list; /**< Dirs to insert. */
+	tommy_list file_new_list; /**< New files waiting for the copy detection. List of snapraid_scan_new. */
+
+	/**
+	 * Directories to scan, if not scanning the full disk.
+	 *
+	 * It contains the directories changed after the last scan,
+	 * as reported by the file-system change journal.
+	 */
+	struct snapraid_scan_changeset partial;
+
+	/**
+	 * If the directories with a stamp have to be skipped.
+	 *
+	 * Set when scanning only the directories changed after the
+	 * last scan, as reported by the stamps of the 'dircache' option.
+	 */
+	int is_shallow;
+
+	time_t start; /**< Time of the start of the scan. */
+
+	struct lstat_batch* batch; /**< Context for lstat_batch(), or 0 if not supported. */
+
+	/**
+	 * Differences found by the "diff" command, not yet printed.
+	 *
+	 * The disks are scanned in parallel, and the differences are
+	 * printed in the disk order by scan_diff_flush().
+	 */
+	struct snapraid_output diff;
 
 	/* nodes for data structures */
 	tommy_node node;
 };
 
+/**
+ * Print a difference found by the "diff" command.
+ *
+ * The ::from_disk and ::from path are set only for moved and copied files.
+ */
+static void scan_diff(struct snapraid_scan* scan, const char* type, struct snapraid_disk* disk, const char* sub, struct snapraid_disk* from_disk, const char* from)
+{
+	struct snapraid_output* out = &scan->diff;
+	char esc_buffer[ESC_MAX];
+	char esc_buffer_alt[ESC_MAX];
+
+	if (out->format == OUTPUT_TEXT) {
+		output_text(out, type);
+		output_text(out, " ");
+		if (from) {
+			output_text(out, fmt_term(from_disk, from, esc_buffer));
+			output_text(out, " -> ");
+		}
+		output_text(out, fmt_term(disk, sub, esc_buffer_alt));
+		output_text(out, "\n");
+		return;
+	}
+
+	output_begin(out);
+	output_field(out, "type", type);
+	output_field(out, "disk", disk->name);
+	output_field(out, "path", sub);
+	output_field(out, "from_disk", from ? from_disk->name : "");
+	output_field(out, "from", from ? from : "");
+	output_end(out);
+}
+
+/**
+ * Print the differences buffered by scan_diff().
+ */
+static void scan_diff_flush(struct snapraid_scan* scan)
+{
+	if (output_write(&scan->diff, stdout) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the output. %s.\n", strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
 /**
  * Remove the specified link from the data set.
  */
 static void scan_link_remove(struct snapraid_scan* scan, struct snapraid_link* slink)
 {
-	struct snapraid_state* state = scan->state;
 	struct snapraid_disk* disk = scan->disk;
 
 	/* state changed */
-	state->need_write = 1;
+	scan->need_write = 1;
 
 	/* remove the file from the link containers */
 	tommy_hashdyn_remove_existing(&disk->linkset, &slink->nodeset);
 	tommy_list_remove_existing(&disk->linklist, &slink->nodelist);
 
 	/* deallocate */
-	link_free(slink);
+	link_free(&disk->arena, slink);
 }
 
 /**
@@ -69,11 +190,10 @@ static void scan_link_remove(struct snapraid_scan* scan, struct snapraid_link* s
  */
 static void scan_link_insert(struct snapraid_scan* scan, struct snapraid_link* slink)
 {
-	struct snapraid_state* state = scan->state;
 	struct snapraid_disk* disk = scan->disk;
 
 	/* state changed */
-	state->need_write = 1;
+	scan->need_write = 1;
 
 	/* insert the link in the link containers */
 	tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
@@ -116,18 +236,17 @@ static void scan_link(struct snapraid_scan* scan, int is_diff, const char* sub,
 			/* it's an update */
 
 			/* we have to save the linkto/type */
-			state->need_write = 1;
+			scan->need_write = 1;
 
 			++scan->count_change;
 
 			log_tag("scan:update:%s:%s\n", disk->name, esc_tag(slink->sub, esc_buffer));
 			if (is_diff) {
-				printf("update %s\n", fmt_term(disk, slink->sub, esc_buffer));
+				scan_diff(scan, "update", disk, slink->sub, 0, 0);
 			}
 
 			/* update it */
-			free(slink->linkto);
-			slink->linkto = strdup_nofail(linkto);
+			link_relink(&disk->arena, slink, linkto);
 			link_flag_let(slink, link_flag, FILE_IS_LINK_MASK);
 		}
 
@@ -139,14 +258,14 @@ static void scan_link(struct snapraid_scan* scan, int is_diff, const char* sub,
 
 		log_tag("scan:add:%s:%s\n", disk->name, esc_tag(sub, esc_buffer));
 		if (is_diff) {
-			printf("add %s\n", fmt_term(disk, sub, esc_buffer));
+			scan_diff(scan, "add", disk, sub, 0, 0);
 		}
 
 		/* and continue to insert it */
 	}
 
 	/* insert it */
-	slink = link_alloc(sub, linkto, link_flag);
+	slink = link_alloc(&disk->arena, sub, linkto, link_flag);
 
 	/* mark it as present */
 	link_flag_set(slink, FILE_IS_PRESENT);
@@ -155,29 +274,193 @@ static void scan_link(struct snapraid_scan* scan, int is_diff, const char* sub,
 	tommy_list_insert_tail(&scan->link_insert_list, &slink->nodelist, slink);
 }
 
+/**
+ * Free runs of parity positions of a disk.
+ *
+ * Used to place each new file in a single run of free positions,
+ * to keep its blocks sequential in the parity.
+ * The runs are in parity order, and a segment tree over their lengths
+ * allows to find the first run large enough in logarithmic time.
+ */
+struct scan_free {
+	block_off_t* start; /**< First free position of each run. */
+	block_off_t* len; /**< Number of free positions of each run. */
+	block_off_t* tree; /**< Max length in each subtree. The leaves start at ::size. */
+	unsigned count; /**< Number of runs. */
+	unsigned size; /**< Number of leaves of the tree. A power of 2. */
+	block_off_t tail; /**< First position after the last used one. All the following ones are free. */
+};
+
+/**
+ * Walk the parity positions of the disk, and store the free runs if the arrays are allocated.
+ * Return the number of free runs.
+ */
+static unsigned scan_free_walk(struct scan_free* sf, struct snapraid_disk* disk)
+{
+	block_off_t parity_pos;
+	unsigned count;
+
+	count = 0;
+	parity_pos = 0;
+	while (parity_pos < sf->tail) {
+		block_off_t begin;
+
+		/* skip the used positions */
+		if (block_has_file(fs_par2block_find(disk, parity_pos))) {
+			++parity_pos;
+			continue;
+		}
+
+		/* get the full run of free positions */
+		begin = parity_pos;
+		while (parity_pos < sf->tail && !block_has_file(fs_par2block_find(disk, parity_pos)))
+			++parity_pos;
+
+		if (sf->start) {
+			sf->start[count] = begin;
+			sf->len[count] = parity_pos - begin;
+		}
+		++count;
+	}
+
+	return count;
+}
+
+static void scan_free_init(struct scan_free* sf, struct snapraid_disk* disk)
+{
+	unsigned i;
+
+	sf->start = 0;
+	sf->len = 0;
+	sf->tail = fs_size(disk);
+
+	/* count the runs, and then store them */
+	sf->count = scan_free_walk(sf, disk);
+	sf->start = malloc_nofail((sf->count + 1) * sizeof(block_off_t));
+	sf->len = malloc_nofail((sf->count + 1) * sizeof(block_off_t));
+	scan_free_walk(sf, disk);
+
+	sf->size = 1;
+	while (sf->size < sf->count)
+		sf->size *= 2;
+
+	sf->tree = malloc_nofail(2 * sf->size * sizeof(block_off_t));
+	memset(sf->tree, 0, 2 * sf->size * sizeof(block_off_t));
+	for (i = 0; i < sf->count; ++i)
+		sf->tree[sf->size + i] = sf->len[i];
+	for (i = sf->size - 1; i > 0; --i)
+		sf->tree[i] = sf->tree[2 * i] > sf->tree[2 * i + 1] ? sf->tree[2 * i] : sf->tree[2 * i + 1];
+}
+
+static void scan_free_done(struct scan_free* sf)
+{
+	free(sf->start);
+	free(sf->len);
+	free(sf->tree);
+}
+
+/**
+ * Find the first run with at least the specified length.
+ * Return ::count if none.
+ */
+static unsigned scan_free_find(struct scan_free* sf, block_off_t need)
+{
+	unsigned node;
+
+	if (sf->tree[1] < need)
+		return sf->count;
+
+	node = 1;
+	while (node < sf->size) {
+		if (sf->tree[2 * node] >= need)
+			node = 2 * node;
+		else
+			node = 2 * node + 1;
+	}
+
+	return node - sf->size;
+}
+
+/**
+ * Take free positions for the specified number of blocks.
+ *
+ * The positions are taken from the first run large enough to contain all of them.
+ * If there is no such run, the file is split, taking the first free run,
+ * as filling the holes left by deleted files is preferred to growing the parity.
+ * Only when all the holes are filled, the positions are taken at the end.
+ *
+ * Return the first position taken, and in ::count the number of sequential positions taken.
+ */
+static block_off_t scan_free_take(struct scan_free* sf, block_off_t need, block_off_t* count)
+{
+	block_off_t parity_pos;
+	unsigned run;
+	unsigned node;
+
+	run = scan_free_find(sf, need);
+	if (run == sf->count)
+		run = scan_free_find(sf, 1);
+
+	/* if no hole, take at the end */
+	if (run == sf->count) {
+		parity_pos = sf->tail;
+		*count = need;
+		sf->tail += need;
+		return parity_pos;
+	}
+
+	parity_pos = sf->start[run];
+	*count = sf->len[run] < need ? sf->len[run] : need;
+	sf->start[run] += *count;
+	sf->len[run] -= *count;
+
+	/* update the tree */
+	node = sf->size + run;
+	sf->tree[node] = sf->len[run];
+	for (node /= 2; node > 0; node /= 2)
+		sf->tree[node] = sf->tree[2 * node] > sf->tree[2 * node + 1] ? sf->tree[2 * node] : sf->tree[2 * node + 1];
+
+	return parity_pos;
+}
+
+/**
+ * Get the first free position.
+ */
+static block_off_t scan_free_first(struct scan_free* sf)
+{
+	unsigned run = scan_free_find(sf, 1);
+
+	if (run == sf->count)
+		return sf->tail;
+
+	return sf->start[run];
+}
+
 /**
  * Insert the specified file in the parity.
  */
-static void scan_file_allocate(struct snapraid_scan* scan, struct snapraid_file* file)
+static void scan_file_allocate(struct snapraid_scan* scan, struct scan_free* sf, struct snapraid_file* file)
 {
 	struct snapraid_state* state = scan->state;
 	struct snapraid_disk* disk = scan->disk;
 	block_off_t i;
 	block_off_t parity_pos;
+	block_off_t avail;
 
 	/* state changed */
-	state->need_write = 1;
+	scan->need_write = 1;
 
 	/* allocate the blocks of the file */
-	parity_pos = disk->first_free_block;
+	parity_pos = 0;
+	avail = 0;
 	for (i = 0; i < file->blockmax; ++i) {
 		struct snapraid_block* block;
 		struct snapraid_block* over_block;
 		snapraid_info info;
 
-		/* increment the position until the first really free block */
-		while (block_has_file(fs_par2block_find(disk, parity_pos)))
-			++parity_pos;
+		/* get the next free positions, if the previous ones are used */
+		if (avail == 0)
+			parity_pos = scan_free_take(sf, file->blockmax - i, &avail);
 
 		/* get block we are going to overwrite, if any */
 		over_block = fs_par2block_find(disk, parity_pos);
@@ -242,10 +525,13 @@ static void scan_file_allocate(struct snapraid_scan* scan, struct snapraid_file*
 		/* store in the disk map, after invalidating all the other blocks */
 		fs_allocate(disk, parity_pos, file, i);
 
-		/* set the new free position */
-		disk->first_free_block = parity_pos + 1;
+		++parity_pos;
+		--avail;
 	}
 
+	/* set the new free position */
+	disk->first_free_block = scan_free_first(sf);
+
 	/* insert in the list of contained files */
 	tommy_list_insert_tail(&disk->filelist, &file->nodelist, file);
 }
@@ -267,13 +553,14 @@ static void scan_file_deallocate(struct snapraid_scan* scan, struct snapraid_fil
 	tommy_list_remove_existing(&disk->filelist, &file->nodelist);
 
 	/* state changed */
-	state->need_write = 1;
+	scan->need_write = 1;
 
 	/* here we are supposed to adjust the ::first_free_block position */
 	/* with the parity position we are deleting */
 	/* but we also know that we do only delayed insert, after all the deletion, */
 	/* so at this point ::first_free_block is always at 0, and we don't need to update it */
-	if (disk->first_free_block != 0) {
+	/* the only exception is the compaction, that deletes only files after the first free position */
+	if (disk->first_free_block != 0 && !state->opt.compact) {
 		/* LCOV_EXCL_START */
 		log_fatal("Internal inconsistency for first free position at '%u' deallocating file '%s'\n", disk->first_free_block, file->sub);
 		os_abort();
@@ -333,24 +620,7 @@ static void scan_file_deallocate(struct snapraid_scan* scan, struct snapraid_fil
 
 static void scan_file_delayed_allocate(struct snapraid_scan* scan, struct snapraid_file* file)
 {
-	struct snapraid_state* state = scan->state;
-	struct snapraid_disk* disk = scan->disk;
-
-	/* if we sort for physical offsets we have to read them for new files */
-	if (state->opt.force_order == SORT_PHYSICAL
-		&& file->physical == FILEPHY_UNREAD_OFFSET
-	) {
-		char path_next[PATH_MAX];
-
-		pathprint(path_next, sizeof(path_next), "%s%s", disk->dir, file->sub);
-
-		if (filephy(path_next, file->size, &file->physical) != 0) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error in getting the physical offset of file '%s'. %s.\n", path_next, strerror(errno));
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
-		}
-	}
+	/* the physical offset of new files is read later by scan_physical(), all together */
 
 	/* insert in the delayed list */
 	tommy_list_insert_tail(&scan->file_insert_list, &file->nodelist, file);
@@ -554,9 +824,19 @@ static void scan_file_refresh(struct snapraid_scan* scan, const char* sub, struc
 }
 
 /**
- * Insert the file in the data set.
+ * Insert the file in the stamp set.
  */
-static void scan_file_insert(struct snapraid_scan* scan, struct snapraid_file* file)
+static void scan_file_insert_stamp(struct snapraid_scan* scan, struct snapraid_file* file)
+{
+	struct snapraid_disk* disk = scan->disk;
+
+	tommy_hashdyn_insert(&disk->stampset, &file->stampset, file, file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec));
+}
+
+/**
+ * Insert the file in the inode and path sets.
+ */
+static void scan_file_insert_set(struct snapraid_scan* scan, struct snapraid_file* file)
 {
 	struct snapraid_disk* disk = scan->disk;
 
@@ -564,12 +844,31 @@ static void scan_file_insert(struct snapraid_scan* scan, struct snapraid_file* f
 	if (!file_flag_has(file, FILE_IS_WITHOUT_INODE))
 		tommy_hashdyn_insert(&disk->inodeset, &file->nodeset, file, file_inode_hash(file->inode));
 	tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
-	tommy_hashdyn_insert(&disk->stampset, &file->stampset, file, file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec));
+}
+
+/**
+ * Insert a new file in the data set, excluding the stamp set.
+ *
+ * The insertion in the stamp set is delayed until the copy
+ * detection is done with scan_file_new().
+ */
+static void scan_file_insert_new(struct snapraid_scan* scan, struct snapraid_file* file)
+{
+	scan_file_insert_set(scan, file);
 
 	/* delayed allocation of the parity */
 	scan_file_delayed_allocate(scan, file);
 }
 
+/**
+ * Insert the file in the data set.
+ */
+static void scan_file_insert(struct snapraid_scan* scan, struct snapraid_file* file)
+{
+	scan_file_insert_new(scan, file);
+	scan_file_insert_stamp(scan, file);
+}
+
 /**
  * Remove the file from the data set.
  *
@@ -589,6 +888,122 @@ static void scan_file_remove(struct snapraid_scan* scan, struct snapraid_file* f
 	scan_file_deallocate(scan, file);
 }
 
+/**
+ * File to relocate in the compaction.
+ */
+struct scan_compact_entry {
+	struct snapraid_file* file;
+	block_off_t first; /**< Lowest parity position of the file. */
+	block_off_t last; /**< Highest parity position of the file. */
+};
+
+static int scan_compact_compare(const void* void_a, const void* void_b)
+{
+	const struct scan_compact_entry* a = void_a;
+	const struct scan_compact_entry* b = void_b;
+
+	/* files at the end of the parity first */
+	if (a->last > b->last)
+		return -1;
+	if (a->last < b->last)
+		return 1;
+	return 0;
+}
+
+/**
+ * Relocate the files in the free runs of the parity, to close the holes left by the deleted files.
+ *
+ * The files are processed starting from the end of the parity, and each one
+ * is moved to the first free run large enough to contain it, if the run is before it,
+ * or, for a fragmented file, if the run doesn't end after it.
+ *
+ * The file is replaced by a copy with REP blocks in the new positions,
+ * and the old positions become DELETED, as for a file moved from another disk.
+ * The following sync computes the parity of the new positions, and shrinks
+ * the parity files, if the end of the parity is now free.
+ *
+ * The positions released are not reused in the same run, but only in the next one.
+ */
+static void scan_compact(struct snapraid_scan* scan, struct scan_free* sf)
+{
+	struct snapraid_state* state = scan->state;
+	struct snapraid_disk* disk = scan->disk;
+	struct scan_compact_entry* map;
+	unsigned count;
+	unsigned j;
+	tommy_node* node;
+	block_off_t limit;
+
+	/* max number of blocks to relocate in this run */
+	limit = (uint64_t)sf->tail * state->opt.compact_plan / 100;
+
+	/* collect the files with hash, as their parity can be computed in the new positions */
+	map = malloc_nofail((tommy_list_count(&disk->filelist) + 1) * sizeof(struct scan_compact_entry));
+	count = 0;
+	for (node = disk->filelist; node != 0; node = node->next) {
+		struct snapraid_file* file = node->data;
+		block_off_t i;
+
+		if (!file_is_full_hashed_and_stable(state, disk, file))
+			continue;
+
+		map[count].file = file;
+		map[count].first = fs_file2par_get(disk, file, 0);
+		map[count].last = map[count].first;
+		for (i = 1; i < file->blockmax; ++i) {
+			block_off_t parity_pos = fs_file2par_get(disk, file, i);
+			if (map[count].first > parity_pos)
+				map[count].first = parity_pos;
+			if (map[count].last < parity_pos)
+				map[count].last = parity_pos;
+		}
+		++count;
+	}
+
+	qsort(map, count, sizeof(struct scan_compact_entry), scan_compact_compare);
+
+	for (j = 0; j < count; ++j) {
+		struct snapraid_file* file = map[j].file;
+		struct snapraid_file* copy;
+		block_off_t i;
+		unsigned run;
+		int is_fragmented;
+
+		if (scan->count_relocate_block + file->blockmax > limit)
+			continue;
+
+		run = scan_free_find(sf, file->blockmax);
+		if (run == sf->count)
+			continue;
+
+		is_fragmented = map[j].last - map[j].first + 1 != file->blockmax;
+
+		/* relocate only if the file moves back, or it becomes contiguous without moving forward */
+		if (sf->start[run] > map[j].first
+			&& (!is_fragmented || sf->start[run] + file->blockmax > map[j].last + 1))
+			continue;
+
+		copy = file_dup(&disk->arena, file);
+
+		/* the data is unchanged, but the parity has to be computed in the new positions */
+		for (i = 0; i < copy->blockmax; ++i)
+			block_state_set(fs_file2block_get(copy, i), BLOCK_STATE_REP);
+
+		/* remove the file */
+		scan_file_remove(scan, file);
+
+		/* reinsert the copy, in the first run large enough */
+		scan_file_insert_set(scan, copy);
+		scan_file_insert_stamp(scan, copy);
+		scan_file_allocate(scan, sf, copy);
+
+		++scan->count_relocate;
+		scan->count_relocate_block += copy->blockmax;
+	}
+
+	free(map);
+}
+
 /**
  * Keep the file as it's (or with only a name/inode modification).
  *
@@ -606,7 +1021,7 @@ static void scan_file_keep(struct snapraid_scan* scan, struct snapraid_file* fil
 
 	/* if the file is full invalid, schedule a reinsert at later stage */
 	if (file_is_full_invalid_parity_and_stable(scan->state, disk, file)) {
-		struct snapraid_file* copy = file_dup(file);
+		struct snapraid_file* copy = file_dup(&disk->arena, file);
 
 		/* remove the file */
 		scan_file_remove(scan, file);
@@ -624,13 +1039,12 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 	struct snapraid_state* state = scan->state;
 	struct snapraid_disk* disk = scan->disk;
 	struct snapraid_file* file;
-	tommy_node* i;
 	int is_original_file_size_different_than_zero;
 	int is_file_already_present;
 	data_off_t file_already_present_size;
 	int64_t file_already_present_mtime_sec;
 	int file_already_present_mtime_nsec;
-	int is_file_reported;
+	struct snapraid_scan_new* entry;
 	char esc_buffer[ESC_MAX];
 	char esc_buffer_alt[ESC_MAX];
 
@@ -706,7 +1120,7 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 				file->mtime_nsec = STAT_NSEC(st);
 
 				/* we have to save the new mtime */
-				state->need_write = 1;
+				scan->need_write = 1;
 			}
 
 			if (strcmp(file->sub, sub) != 0) {
@@ -715,20 +1129,20 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 
 				log_tag("scan:move:%s:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer), esc_tag(sub, esc_buffer_alt));
 				if (is_diff) {
-					printf("move %s -> %s\n", fmt_term(disk, file->sub, esc_buffer), fmt_term(disk, sub, esc_buffer_alt));
+					scan_diff(scan, "move", disk, sub, disk, file->sub);
 				}
 
 				/* remove from the name set */
 				tommy_hashdyn_remove_existing(&disk->pathset, &file->pathset);
 
 				/* save the new name */
-				file_rename(file, sub);
+				file_rename(&disk->arena, file, sub);
 
 				/* reinsert in the name set */
 				tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
 
 				/* we have to save the new name */
-				state->need_write = 1;
+				scan->need_write = 1;
 			} else {
 				/* otherwise it's equal */
 				++scan->count_equal;
@@ -805,7 +1219,6 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 	}
 
 	/* initialize for later overwrite */
-	is_file_reported = 0;
 	is_original_file_size_different_than_zero = 0;
 
 	/* then try finding it by name */
@@ -864,7 +1277,7 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 				file->mtime_nsec = STAT_NSEC(st);
 
 				/* we have to save the new mtime */
-				state->need_write = 1;
+				scan->need_write = 1;
 			}
 
 			/* if when processing the disk we used the past inodes values */
@@ -878,7 +1291,7 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 
 				log_tag("scan:restore:%s:%s\n", disk->name, esc_tag(sub, esc_buffer));
 				if (is_diff) {
-					printf("restore %s\n", fmt_term(disk, sub, esc_buffer));
+					scan_diff(scan, "restore", disk, sub, 0, 0);
 				}
 
 				/* remove from the inode set */
@@ -891,7 +1304,7 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 				tommy_hashdyn_insert(&disk->inodeset, &file->nodeset, file, file_inode_hash(file->inode));
 
 				/* we have to save the new inode */
-				state->need_write = 1;
+				scan->need_write = 1;
 			} else {
 				/* otherwise it's the case of not persistent inode, where doesn't */
 				/* matter if the inode is different or equal, because they have no */
@@ -958,11 +1371,43 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 #endif
 
 	/* insert it */
-	file = file_alloc(state->block_size, sub, st->st_size, st->st_mtime, STAT_NSEC(st), st->st_ino, physical);
+	file = file_alloc(&disk->arena, state->block_size, sub, st->st_size, st->st_mtime, STAT_NSEC(st), st->st_ino, physical);
 
 	/* mark it as present */
 	file_flag_set(file, FILE_IS_PRESENT);
 
+	/* delay the copy detection after all the disks are scanned */
+	entry = malloc_nofail(sizeof(struct snapraid_scan_new));
+	entry->file = file;
+	entry->is_already_present = is_file_already_present;
+	entry->prev_size = file_already_present_size;
+	entry->prev_mtime_sec = file_already_present_mtime_sec;
+	entry->prev_mtime_nsec = file_already_present_mtime_nsec;
+	tommy_list_insert_tail(&scan->file_new_list, &entry->node, entry);
+
+	/* insert the file in the delayed list */
+	scan_file_insert_new(scan, file);
+}
+
+/**
+ * Process a new file after all the disks are scanned.
+ *
+ * Detect if the file is a copy of another one, report it,
+ * and complete its insertion in the data set.
+ */
+static void scan_file_new(struct snapraid_scan* scan, struct snapraid_scan_new* entry)
+{
+	struct snapraid_state* state = scan->state;
+	struct snapraid_disk* disk = scan->disk;
+	struct snapraid_file* file = entry->file;
+	int is_diff = scan->is_diff;
+	int is_file_reported;
+	tommy_node* i;
+	char esc_buffer[ESC_MAX];
+	char esc_buffer_alt[ESC_MAX];
+
+	is_file_reported = 0;
+
 	/* if copy detection is enabled */
 	/* note that the copy detection is tried also for updated files */
 	/* this makes sense because it may happen to have two different copies */
@@ -988,12 +1433,24 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 				/* assume that the file is a copy, and reuse the hash */
 				file_copy(other_file, file);
 
+				/* in the same disk, check if the copy shares the data with the original */
+				if (other_disk == disk) {
+					char path[PATH_MAX];
+					char path_src[PATH_MAX];
+
+					pathprint(path, sizeof(path), "%s%s", disk->dir, file->sub);
+					pathprint(path_src, sizeof(path_src), "%s%s", disk->dir, other_file->sub);
+
+					if (fileclone(path, path_src) == 0)
+						file_flag_set(file, FILE_IS_CLONE);
+				}
+
 				/* revert old counter and use the copy one */
 				++scan->count_copy;
 
 				log_tag("scan:copy:%s:%s:%s:%s\n", other_disk->name, esc_tag(other_file->sub, esc_buffer), disk->name, esc_tag(file->sub, esc_buffer_alt));
 				if (is_diff) {
-					printf("copy %s -> %s\n", fmt_term(other_disk, other_file->sub, esc_buffer), fmt_term(disk, file->sub, esc_buffer_alt));
+					scan_diff(scan, "copy", disk, file->sub, other_disk, other_file->sub);
 				}
 
 				/* mark it as reported */
@@ -1008,29 +1465,29 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 	/* if not yet reported, do it now */
 	/* we postpone this to avoid to print two times the copied files */
 	if (!is_file_reported) {
-		if (is_file_already_present) {
+		if (entry->is_already_present) {
 			++scan->count_change;
 
-			log_tag("scan:update:%s:%s: %" PRIu64 " %" PRIu64 ".%d -> %" PRIu64 " %" PRIu64 ".%d\n", disk->name, esc_tag(sub, esc_buffer),
-				file_already_present_size, file_already_present_mtime_sec, file_already_present_mtime_nsec,
+			log_tag("scan:update:%s:%s: %" PRIu64 " %" PRIu64 ".%d -> %" PRIu64 " %" PRIu64 ".%d\n", disk->name, esc_tag(file->sub, esc_buffer),
+				entry->prev_size, entry->prev_mtime_sec, entry->prev_mtime_nsec,
 				file->size, file->mtime_sec, file->mtime_nsec
 			);
 
 			if (is_diff) {
-				printf("update %s\n", fmt_term(disk, sub, esc_buffer));
+				scan_diff(scan, "update", disk, file->sub, 0, 0);
 			}
 		} else {
 			++scan->count_insert;
 
-			log_tag("scan:add:%s:%s\n", disk->name, esc_tag(sub, esc_buffer));
+			log_tag("scan:add:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
 			if (is_diff) {
-				printf("add %s\n", fmt_term(disk, sub, esc_buffer));
+				scan_diff(scan, "add", disk, file->sub, 0, 0);
 			}
 		}
 	}
 
-	/* insert the file in the delayed list */
-	scan_file_insert(scan, file);
+	/* only now the file can be found by the copy detection of other files */
+	scan_file_insert_stamp(scan, file);
 }
 
 /**
@@ -1038,18 +1495,17 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
  */
 static void scan_emptydir_remove(struct snapraid_scan* scan, struct snapraid_dir* dir)
 {
-	struct snapraid_state* state = scan->state;
 	struct snapraid_disk* disk = scan->disk;
 
 	/* state changed */
-	state->need_write = 1;
+	scan->need_write = 1;
 
 	/* remove the file from the dir containers */
 	tommy_hashdyn_remove_existing(&disk->dirset, &dir->nodeset);
 	tommy_list_remove_existing(&disk->dirlist, &dir->nodelist);
 
 	/* deallocate */
-	dir_free(dir);
+	dir_free(&disk->arena, dir);
 }
 
 /**
@@ -1057,11 +1513,10 @@ static void scan_emptydir_remove(struct snapraid_scan* scan, struct snapraid_dir
  */
 static void scan_emptydir_insert(struct snapraid_scan* scan, struct snapraid_dir* dir)
 {
-	struct snapraid_state* state = scan->state;
 	struct snapraid_disk* disk = scan->disk;
 
 	/* state changed */
-	state->need_write = 1;
+	scan->need_write = 1;
 
 	/* insert the dir in the dir containers */
 	tommy_hashdyn_insert(&disk->dirset, &dir->nodeset, dir, dir_name_hash(dir->sub));
@@ -1097,7 +1552,7 @@ static void scan_emptydir(struct snapraid_scan* scan, const char* sub)
 	}
 
 	/* insert it */
-	dir = dir_alloc(sub);
+	dir = dir_alloc(&disk->arena, sub);
 
 	/* mark it as present */
 	dir_flag_set(dir, FILE_IS_PRESENT);
@@ -1106,27 +1561,113 @@ static void scan_emptydir(struct snapraid_scan* scan, const char* sub)
 	tommy_list_insert_tail(&scan->dir_insert_list, &dir->nodelist, dir);
 }
 
-struct dirent_sorted {
-	/* node for data structures */
-	tommy_node node;
-
-#if HAVE_STRUCT_DIRENT_D_INO
-	uint64_t d_ino; /**< Inode number. */
-#endif
-#if HAVE_STRUCT_DIRENT_D_TYPE
-	uint32_t d_type; /**< File type. */
-#endif
-#if HAVE_STRUCT_DIRENT_D_STAT
-	struct stat d_stat; /**< Stat result. */
-#endif
-	char d_name[]; /**< Variable length name. It must be the last field. */
-};
-
-#if HAVE_STRUCT_DIRENT_D_INO
-static int dd_ino_compare(const void* void_a, const void* void_b)
+/**
+ * Record the stamp of a directory.
+ *
+ * The stamp is taken before reading the directory, so any change
+ * made during the scan is detected by the next one.
+ */
+static void scan_dirstamp_record(struct snapraid_scan* scan, const char* sub, struct stat* st)
 {
-	const struct dirent_sorted* a = void_a;
-	const struct dirent_sorted* b = void_b;
+	struct snapraid_state* state = scan->state;
+	struct snapraid_disk* disk = scan->disk;
+	struct snapraid_dirstamp* dirstamp;
+	int64_t mtime_sec;
+	int mtime_nsec;
+
+	if (!state->dircache)
+		return;
+
+	mtime_sec = st->st_mtime;
+	mtime_nsec = STAT_NSEC(st);
+
+	/*
+	 * If the directory was modified too near to the scan start, a following
+	 * change may leave the same time, depending on the file-system time granularity.
+	 * In such case the stamp is stored as not reliable, to always scan it again.
+	 */
+	if (mtime_sec + 2 > scan->start) {
+		mtime_sec = 0;
+		mtime_nsec = STAT_NSEC_INVALID;
+	}
+
+	dirstamp = tommy_hashdyn_search(&disk->dirstampset, dirstamp_name_compare, sub, dirstamp_name_hash(sub));
+	if (dirstamp) {
+		if (dirstamp->inode != st->st_ino
+			|| dirstamp->mtime_sec != mtime_sec
+			|| dirstamp->mtime_nsec != mtime_nsec
+		) {
+			dirstamp->inode = st->st_ino;
+			dirstamp->mtime_sec = mtime_sec;
+			dirstamp->mtime_nsec = mtime_nsec;
+			scan->need_write = 1;
+		}
+	} else {
+		dirstamp = dirstamp_alloc(sub, st->st_ino, mtime_sec, mtime_nsec);
+		tommy_hashdyn_insert(&disk->dirstampset, &dirstamp->nodeset, dirstamp, dirstamp_name_hash(sub));
+		tommy_list_insert_tail(&disk->dirstamplist, &dirstamp->nodelist, dirstamp);
+		scan->need_write = 1;
+	}
+
+	dirstamp_flag_set(dirstamp, FILE_IS_PRESENT);
+}
+
+/**
+ * Record the stamp of a directory not reached by scan_dir().
+ */
+static void scan_dirstamp_record_path(struct snapraid_scan* scan, const char* path, const char* sub)
+{
+	struct stat st;
+
+	if (!scan->state->dircache)
+		return;
+
+	if (lstat(path, &st) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error in stat directory '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	scan_dirstamp_record(scan, sub, &st);
+}
+
+/**
+ * Check if a directory was already scanned, or it's going to be scanned.
+ */
+static int scan_dirstamp_skip(struct snapraid_scan* scan, const char* sub)
+{
+	struct snapraid_disk* disk = scan->disk;
+
+	if (!scan->is_shallow)
+		return 0;
+
+	return tommy_hashdyn_search(&disk->dirstampset, dirstamp_name_compare, sub, dirstamp_name_hash(sub)) != 0;
+}
+
+struct dirent_sorted {
+	/* node for data structures */
+	tommy_node node;
+
+#if HAVE_STRUCT_DIRENT_D_INO
+	uint64_t d_ino; /**< Inode number. */
+#endif
+#if HAVE_STRUCT_DIRENT_D_TYPE
+	uint32_t d_type; /**< File type. */
+#endif
+#if HAVE_STRUCT_DIRENT_D_STAT
+	struct stat d_stat; /**< Stat result. */
+#else
+	struct stat* d_batch; /**< Stat result read with lstat_batch(), or 0 if not read. */
+#endif
+	char d_name[]; /**< Variable length name. It must be the last field. */
+};
+
+#if HAVE_STRUCT_DIRENT_D_INO
+static int dd_ino_compare(const void* void_a, const void* void_b)
+{
+	const struct dirent_sorted* a = void_a;
+	const struct dirent_sorted* b = void_b;
 
 	if (a->d_ino < b->d_ino)
 		return -1;
@@ -1155,9 +1696,13 @@ struct stat* dstat(struct dirent_sorted* dd)
 	return &dd->d_stat;
 }
 #else
-#define DSTAT(file, dd, buf) dstat(file, buf)
-struct stat* dstat(const char* file, struct stat* st)
+#define DSTAT(file, dd, buf) dstat(file, dd, buf)
+struct stat* dstat(const char* file, struct dirent_sorted* dd, struct stat* st)
 {
+	/* use the result of lstat_batch(), if available */
+	if (dd->d_batch)
+		return dd->d_batch;
+
 	if (lstat(file, st) != 0) {
 		/* LCOV_EXCL_START */
 		log_fatal("Error in stat file/directory '%s'. %s.\n", file, strerror(errno));
@@ -1168,6 +1713,72 @@ struct stat* dstat(const char* file, struct stat* st)
 }
 #endif
 
+#if !HAVE_STRUCT_DIRENT_D_STAT
+/**
+ * Read the stat info of all the entries of a directory with lstat_batch().
+ *
+ * The entries are submitted in the inode order, to minimize the seeks.
+ * Return the array of the stat info to free after processing the entries,
+ * or 0 if nothing is read.
+ */
+static struct stat* scan_dir_batch(struct snapraid_scan* scan, const char* dir, tommy_list* list)
+{
+	struct dirent_sorted** map;
+	const char** name;
+	struct stat* st;
+	int* result;
+	unsigned count;
+	unsigned i;
+	tommy_node* node;
+
+	/* for a single entry there is nothing to gain */
+	if (!scan->batch || tommy_list_count(list) < 2)
+		return 0;
+
+	map = malloc_nofail(tommy_list_count(list) * sizeof(struct dirent_sorted*));
+
+	/* collect the entries that need the stat info */
+	count = 0;
+	for (node = tommy_list_head(list); node != 0; node = node->next) {
+		struct dirent_sorted* dd = node->data;
+
+#if HAVE_STRUCT_DIRENT_D_TYPE
+		/* links and special files don't need it */
+		if (dd->d_type != DT_UNKNOWN && dd->d_type != DT_REG && dd->d_type != DT_DIR)
+			continue;
+#endif
+
+		map[count++] = dd;
+	}
+
+	if (count < 2) {
+		free(map);
+		return 0;
+	}
+
+	name = malloc_nofail(count * sizeof(const char*));
+	st = malloc_nofail(count * sizeof(struct stat));
+	result = malloc_nofail(count * sizeof(int));
+
+	for (i = 0; i < count; ++i)
+		name[i] = map[i]->d_name;
+
+	/* on error, the entries are read one by one with lstat() */
+	if (lstat_batch(scan->batch, dir, count, name, st, result) == 0) {
+		for (i = 0; i < count; ++i) {
+			if (result[i] == 0)
+				map[i]->d_batch = &st[i];
+		}
+	}
+
+	free(result);
+	free(name);
+	free(map);
+
+	return st;
+}
+#endif
+
 /**
  * Process a directory.
  * Return != 0 if at least one file or link is processed.
@@ -1180,6 +1791,9 @@ static int scan_dir(struct snapraid_scan* scan, int level, int is_diff, const ch
 	DIR* d;
 	tommy_list list;
 	tommy_node* node;
+#if !HAVE_STRUCT_DIRENT_D_STAT
+	struct stat* batch_st;
+#endif
 
 	tommy_list_init(&list);
 
@@ -1229,242 +1843,1105 @@ static int scan_dir(struct snapraid_scan* scan, int level, int is_diff, const ch
 		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
 			continue;
 
-		pathprint(path_next, sizeof(path_next), "%s%s", dir, name);
-		pathprint(sub_next, sizeof(sub_next), "%s%s", sub, name);
+		pathprint(path_next, sizeof(path_next), "%s%s", dir, name);
+		pathprint(sub_next, sizeof(sub_next), "%s%s", sub, name);
+
+		/* check for not supported file names */
+		if (name[0] == 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Unsupported name '%s' in file '%s'.\n", name, path_next);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* exclude hidden files even before calling lstat() */
+		if (filter_hidden(state->filter_hidden, dd) != 0) {
+			msg_verbose("Excluding hidden '%s'\n", path_next);
+			continue;
+		}
+
+		/* exclude content files even before calling lstat() */
+		if (filter_content(&state->contentlist, path_next) != 0) {
+			msg_verbose("Excluding content '%s'\n", path_next);
+			continue;
+		}
+
+		name_len = strlen(dd->d_name);
+		entry = malloc_nofail(sizeof(struct dirent_sorted) + name_len + 1);
+
+		/* copy the dir entry */
+#if HAVE_STRUCT_DIRENT_D_INO
+		entry->d_ino = dd->d_ino;
+#endif
+#if HAVE_STRUCT_DIRENT_D_TYPE
+		entry->d_type = dd->d_type;
+#endif
+#if HAVE_STRUCT_DIRENT_D_STAT
+		/* convert dirent to lstat result */
+		dirent_lstat(dd, &entry->d_stat);
+
+		/* note that at this point the st_mode may be 0 */
+#else
+		entry->d_batch = 0;
+#endif
+		memcpy(entry->d_name, dd->d_name, name_len + 1);
+
+		/* insert in the list */
+		tommy_list_insert_tail(&list, &entry->node, entry);
+	}
+
+	if (closedir(d) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing directory '%s'. %s.\n", dir, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (state->opt.force_order == SORT_ALPHA) {
+		/* if requested sort alphabetically */
+		/* this is mainly done for testing to ensure to always */
+		/* process in the same way in different platforms */
+		tommy_list_sort(&list, dd_name_compare);
+	}
+#if HAVE_STRUCT_DIRENT_D_INO
+	else if (!disk->has_volatile_inodes) {
+		/* if inodes are persistent */
+		/* sort the list of dir entries by inodes */
+		tommy_list_sort(&list, dd_ino_compare);
+	}
+	/* otherwise just keep the insertion order */
+#endif
+
+#if !HAVE_STRUCT_DIRENT_D_STAT
+	/* read the stat info of all the entries at the same time */
+	batch_st = scan_dir_batch(scan, dir, &list);
+#endif
+
+	/* process the sorted dir entries */
+	node = list;
+	while (node != 0) {
+		char path_next[PATH_MAX];
+		char sub_next[PATH_MAX];
+		char out[PATH_MAX];
+		struct snapraid_filter* reason = 0;
+		struct dirent_sorted* dd = node->data;
+		const char* name = dd->d_name;
+		struct stat* st;
+		int type;
+#if !HAVE_STRUCT_DIRENT_D_STAT
+		struct stat st_buf;
+#endif
+
+		pathprint(path_next, sizeof(path_next), "%s%s", dir, name);
+		pathprint(sub_next, sizeof(sub_next), "%s%s", sub, name);
+
+		/* start with an unknown type */
+		type = -1;
+		st = 0;
+
+		/* if dirent has the type, use it */
+#if HAVE_STRUCT_DIRENT_D_TYPE
+		switch (dd->d_type) {
+		case DT_UNKNOWN : break;
+		case DT_REG : type = 0; break;
+		case DT_LNK : type = 1; break;
+		case DT_DIR : type = 2; break;
+		default : type = 3; break;
+		}
+#endif
+
+		/* if type is still unknown */
+		if (type < 0) {
+			/* get the type from stat */
+			st = DSTAT(path_next, dd, &st_buf);
+
+#if HAVE_STRUCT_DIRENT_D_STAT
+			/* if the st_mode field is missing, takes care to fill it using normal lstat() */
+			/* at now this can happen only in Windows (with HAVE_STRUCT_DIRENT_D_STAT defined), */
+			/* because we use a directory reading method that doesn't read info about ReparsePoint. */
+			/* Note that here we cannot call here lstat_sync(), because we don't know what kind */
+			/* of file is it, and lstat_sync() doesn't always work */
+			if (st->st_mode == 0) {
+				if (lstat(path_next, st) != 0) {
+					/* LCOV_EXCL_START */
+					log_fatal("Error in stat file/directory '%s'. %s.\n", path_next, strerror(errno));
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+			}
+#endif
+
+			if (S_ISREG(st->st_mode))
+				type = 0;
+			else if (S_ISLNK(st->st_mode))
+				type = 1;
+			else if (S_ISDIR(st->st_mode))
+				type = 2;
+			else
+				type = 3;
+		}
+
+		if (type == 0) { /* REG */
+			if (filter_path(&state->filterlist, &reason, disk->name, sub_next) == 0) {
+
+				/* late stat, if not yet called */
+				if (!st)
+					st = DSTAT(path_next, dd, &st_buf);
+
+#if HAVE_LSTAT_SYNC
+				/* if the st_ino field is missing, takes care to fill it using the extended lstat() */
+				/* this can happen only in Windows */
+				if (st->st_ino == 0 || st->st_nlink == 0) {
+					if (lstat_sync(path_next, st, 0) != 0) {
+						/* LCOV_EXCL_START */
+						log_fatal("Error in stat file '%s'. %s.\n", path_next, strerror(errno));
+						exit(EXIT_FAILURE);
+						/* LCOV_EXCL_STOP */
+					}
+				}
+#endif
+
+				scan_file(scan, is_diff, sub_next, st, FILEPHY_UNREAD_OFFSET);
+				processed = 1;
+			} else {
+				msg_verbose("Excluding file '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
+			}
+		} else if (type == 1) { /* LNK */
+			if (filter_path(&state->filterlist, &reason, disk->name, sub_next) == 0) {
+				char subnew[PATH_MAX];
+				int ret;
+
+				ret = readlink(path_next, subnew, sizeof(subnew));
+				if (ret >= PATH_MAX) {
+					/* LCOV_EXCL_START */
+					log_fatal("Error in readlink file '%s'. Symlink too long.\n", path_next);
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+				if (ret < 0) {
+					/* LCOV_EXCL_START */
+					log_fatal("Error in readlink file '%s'. %s.\n", path_next, strerror(errno));
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+				if (ret == 0)
+					log_fatal("WARNING! Empty symbolic link '%s'.\n", path_next);
+
+				/* readlink doesn't put the final 0 */
+				subnew[ret] = 0;
+
+				/* process as a symbolic link */
+				scan_link(scan, is_diff, sub_next, subnew, FILE_IS_SYMLINK);
+				processed = 1;
+			} else {
+				msg_verbose("Excluding link '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
+			}
+		} else if (type == 2) { /* DIR */
+			if (filter_subdir(&state->filterlist, &reason, disk->name, sub_next) == 0) {
+#ifndef _WIN32
+				/* late stat, if not yet called */
+				if (!st)
+					st = DSTAT(path_next, dd, &st_buf);
+
+				/* in Unix don't follow mount points in different devices */
+				/* in Windows we are already skipping them reporting them as special files */
+				if ((uint64_t)st->st_dev != disk->device) {
+					log_fatal("WARNING! Ignoring mount point '%s' because it appears to be in a different device\n", path_next);
+				} else
+#endif
+				{
+					char sub_dir[PATH_MAX];
+
+					pathcpy(sub_dir, sizeof(sub_dir), sub_next);
+					pathslash(sub_dir, sizeof(sub_dir));
+
+					if (scan_dirstamp_skip(scan, sub_dir)) {
+						/* already handled by its stamp */
+					} else {
+						if (state->dircache) {
+							/* late stat, if not yet called */
+							if (!st)
+								st = DSTAT(path_next, dd, &st_buf);
+
+							scan_dirstamp_record(scan, sub_dir, st);
+						}
+
+						/* recurse */
+						pathslash(path_next, sizeof(path_next));
+						if (scan_dir(scan, level + 1, is_diff, path_next, sub_dir) == 0) {
+							/* scan the directory as empty dir */
+							scan_emptydir(scan, sub_next);
+						}
+					}
+					/* or we processed something internally, or we have added the empty dir */
+					processed = 1;
+				}
+			} else {
+				msg_verbose("Excluding directory '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
+			}
+		} else {
+			if (filter_path(&state->filterlist, &reason, disk->name, sub_next) == 0) {
+				/* late stat, if not yet called */
+				if (!st)
+					st = DSTAT(path_next, dd, &st_buf);
+
+				log_fatal("WARNING! Ignoring special '%s' file '%s'\n", stat_desc(st), path_next);
+			} else {
+				msg_verbose("Excluding special file '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
+			}
+		}
+
+		/* next entry */
+		node = node->next;
+
+		/* free the present one */
+		free(dd);
+	}
+
+#if !HAVE_STRUCT_DIRENT_D_STAT
+	free(batch_st);
+#endif
+
+	return processed;
+}
+
+static void scan_changeset_init(struct snapraid_scan_changeset* changeset)
+{
+	tommy_hashdyn_init(&changeset->set);
+	tommy_list_init(&changeset->list);
+}
+
+static void scan_changed_free(struct snapraid_scan_changed* changed)
+{
+	free(changed->sub);
+	free(changed);
+}
+
+static void scan_changeset_done(struct snapraid_scan_changeset* changeset)
+{
+	tommy_list_foreach(&changeset->list, (tommy_foreach_func*)scan_changed_free);
+	tommy_hashdyn_done(&changeset->set);
+}
+
+static int scan_changed_compare(const void* void_arg, const void* void_data)
+{
+	const char* arg = void_arg;
+	const struct snapraid_scan_changed* changed = void_data;
+
+	return strcmp(arg, changed->sub);
+}
+
+static int scan_changeset_has(struct snapraid_scan_changeset* changeset, const char* sub)
+{
+	return tommy_hashdyn_search(&changeset->set, scan_changed_compare, sub, file_path_hash(sub)) != 0;
+}
+
+/**
+ * Insert a directory in the set.
+ * Return 0 if it was already present.
+ */
+static int scan_changeset_insert(struct snapraid_scan_changeset* changeset, const char* sub)
+{
+	struct snapraid_scan_changed* changed;
+
+	if (scan_changeset_has(changeset, sub))
+		return 0;
+
+	changed = malloc_nofail(sizeof(struct snapraid_scan_changed));
+	changed->sub = strdup_nofail(sub);
+
+	tommy_hashdyn_insert(&changeset->set, &changed->nodeset, changed, file_path_hash(changed->sub));
+	tommy_list_insert_tail(&changeset->list, &changed->nodelist, changed);
+
+	return 1;
+}
+
+static void scan_changeset_remove(struct snapraid_scan_changeset* changeset, struct snapraid_scan_changed* changed)
+{
+	tommy_hashdyn_remove_existing(&changeset->set, &changed->nodeset);
+	tommy_list_remove_existing(&changeset->list, &changed->nodelist);
+	scan_changed_free(changed);
+}
+
+/**
+ * Change the directory at its parent.
+ * Return 0 if it's already the disk root.
+ */
+static int scan_changed_up(char* sub)
+{
+	size_t len = strlen(sub);
+
+	if (len == 0)
+		return 0;
+
+	/* skip the final slash */
+	--len;
+
+	/* search the previous one */
+	while (len > 0 && sub[len - 1] != '/')
+		--len;
+
+	sub[len] = 0;
+
+	return 1;
+}
+
+/**
+ * Check if the directory, or any of its parents, is in the set.
+ * The specified directory is modified.
+ */
+static int scan_changeset_contains(struct snapraid_scan_changeset* changeset, char* sub)
+{
+	do {
+		if (scan_changeset_has(changeset, sub))
+			return 1;
+	} while (scan_changed_up(sub));
+
+	return 0;
+}
+
+/**
+ * Get the directory containing the specified file.
+ */
+static void scan_changed_of(char* dir, size_t size, const char* sub)
+{
+	char* slash;
+
+	pathcpy(dir, size, sub);
+
+	slash = strrchr(dir, '/');
+	if (slash)
+		slash[1] = 0;
+	else
+		dir[0] = 0;
+}
+
+/**
+ * Insert a directory, and all its parents, in the set.
+ * The specified directory is modified.
+ */
+static void scan_changeset_insert_all(struct snapraid_scan_changeset* changeset, char* sub)
+{
+	/* stop at the first one present, as all its parents are also present */
+	while (scan_changeset_insert(changeset, sub) && scan_changed_up(sub))
+		; /* nothing */
+}
+
+/**
+ * Function called by fsjournal() for each changed directory.
+ */
+static void scan_journal_changed(void* arg, const char* sub)
+{
+	struct snapraid_scan_changeset* changeset = arg;
+
+	scan_changeset_insert(changeset, sub);
+}
+
+/**
+ * Compute a checksum of all the options that select which files are scanned.
+ */
+static uint32_t scan_filter_crc(struct snapraid_state* state)
+{
+	tommy_node* i;
+	uint32_t crc;
+
+	crc = crc32c(CRC_IV, (const unsigned char*)&state->filter_hidden, sizeof(state->filter_hidden));
+
+	for (i = state->filterlist; i != 0; i = i->next) {
+		struct snapraid_filter* filter = i->data;
+		int flag[4];
+
+		flag[0] = filter->is_disk;
+		flag[1] = filter->is_path;
+		flag[2] = filter->is_dir;
+		flag[3] = filter->direction;
+
+		crc = crc32c(crc, (const unsigned char*)filter->pattern, strlen(filter->pattern) + 1);
+		crc = crc32c(crc, (const unsigned char*)flag, sizeof(flag));
+	}
+
+	return crc;
+}
+
+/**
+ * Prepare a partial scan using the file-system change journal.
+ *
+ * All the files, links and empty dirs not in the changed directories
+ * are marked as present, and the directories to scan are inserted in ::partial.
+ * Return 0 if a full scan is required.
+ */
+static int scan_journal(struct snapraid_scan* scan)
+{
+	struct snapraid_state* state = scan->state;
+	struct snapraid_disk* disk = scan->disk;
+	struct snapraid_scan_changeset journal;
+	struct snapraid_scan_changeset known;
+	uint64_t journal_id;
+	uint64_t journal_pos;
+	uint32_t journal_filter;
+	int ret;
+	tommy_node* i;
+	char dir[PATH_MAX];
+	char esc_buffer[ESC_MAX];
+
+	if (!state->journal) {
+		/* forget any previous position */
+		disk->journal_id = 0;
+		disk->journal_pos = 0;
+		disk->journal_filter = 0;
+		return 0;
+	}
+
+	journal_filter = scan_filter_crc(state);
+
+	/* use the previous position only if the scan result depends only by the directories changed */
+	journal_id = disk->journal_id;
+	journal_pos = disk->journal_pos;
+	if (disk->journal_filter != journal_filter
+		|| disk->has_volatile_inodes || disk->has_different_uuid || disk->has_unsupported_uuid
+	) {
+		journal_id = 0;
+	}
+
+	/*
+	 * Hardlinks are not supported, because changing a file
+	 * doesn't report a change in the directories of its other links.
+	 */
+	for (i = disk->linklist; i != 0; i = i->next) {
+		struct snapraid_link* slink = i->data;
+		if (link_flag_has(slink, FILE_IS_HARDLINK))
+			journal_id = 0;
+	}
+
+	scan_changeset_init(&journal);
+
+	/* note that this is called before scanning, and any change after this point */
+	/* is read again by the next scan */
+	ret = fsjournal(disk->dir, &journal_id, &journal_pos, scan_journal_changed, &journal);
+	if (ret < 0) {
+		msg_verbose("Change journal not available for disk '%s'. %s.\n", disk->name, strerror(errno));
+		disk->journal_id = 0;
+		disk->journal_pos = 0;
+		disk->journal_filter = 0;
+		scan_changeset_done(&journal);
+		return 0;
+	}
+
+	/* set the new position, saved in the content file with the result of this scan */
+	disk->journal_id = journal_id;
+	disk->journal_pos = journal_pos;
+	disk->journal_filter = journal_filter;
+
+	if (ret > 0) {
+		msg_verbose("Change journal of disk '%s' doesn't contain all the changes. Full scan.\n", disk->name);
+		scan_changeset_done(&journal);
+		return 0;
+	}
+
+	/* collect all the directories containing something */
+	scan_changeset_init(&known);
+	for (i = disk->filelist; i != 0; i = i->next) {
+		struct snapraid_file* file = i->data;
+		scan_changed_of(dir, sizeof(dir), file->sub);
+		scan_changeset_insert_all(&known, dir);
+	}
+	for (i = disk->linklist; i != 0; i = i->next) {
+		struct snapraid_link* slink = i->data;
+		scan_changed_of(dir, sizeof(dir), slink->sub);
+		scan_changeset_insert_all(&known, dir);
+	}
+	for (i = disk->dirlist; i != 0; i = i->next) {
+		struct snapraid_dir* emptydir = i->data;
+		pathprint(dir, sizeof(dir), "%s/", emptydir->sub);
+		scan_changeset_insert_all(&known, dir);
+	}
+
+	/*
+	 * Scan each changed directory from the nearest directory containing something.
+	 *
+	 * A changed directory not containing anything is a new directory, or an
+	 * excluded one. In both cases it's found, or excluded, scanning its parent.
+	 * The parent is also reported as changed, if the directory was created or
+	 * moved after the last scan, but this is not always true if it's an excluded one.
+	 */
+	scan_changeset_init(&scan->partial);
+	for (i = journal.list; i != 0; i = i->next) {
+		struct snapraid_scan_changed* changed = i->data;
+
+		pathcpy(dir, sizeof(dir), changed->sub);
+		while (!scan_changeset_has(&known, dir) && scan_changed_up(dir))
+			; /* nothing */
+
+		scan_changeset_insert(&scan->partial, dir);
+	}
+
+	scan_changeset_done(&known);
+	scan_changeset_done(&journal);
+
+	/* if the disk root has to be scanned, it's a full scan */
+	if (scan_changeset_has(&scan->partial, "")) {
+		scan_changeset_done(&scan->partial);
+		return 0;
+	}
+
+	/* remove directories inside other ones, as they are scanned recursively */
+	i = scan->partial.list;
+	while (i) {
+		struct snapraid_scan_changed* changed = i->data;
+
+		/* next node */
+		i = i->next;
+
+		pathcpy(dir, sizeof(dir), changed->sub);
+		if (scan_changed_up(dir) && scan_changeset_contains(&scan->partial, dir))
+			scan_changeset_remove(&scan->partial, changed);
+	}
+
+	/* mark as present all the files, links and empty dirs not changed */
+	i = disk->filelist;
+	while (i) {
+		struct snapraid_file* file = i->data;
+
+		/* next node, before scan_file_keep() that may remove the file */
+		i = i->next;
+
+		scan_changed_of(dir, sizeof(dir), file->sub);
+		if (!scan_changeset_contains(&scan->partial, dir)) {
+			file_flag_set(file, FILE_IS_PRESENT);
+
+			++scan->count_equal;
+
+			if (state->opt.gui) {
+				log_tag("scan:equal:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
+			}
+
+			/* mark the file as kept */
+			scan_file_keep(scan, file);
+		}
+	}
+	for (i = disk->linklist; i != 0; i = i->next) {
+		struct snapraid_link* slink = i->data;
+
+		scan_changed_of(dir, sizeof(dir), slink->sub);
+		if (!scan_changeset_contains(&scan->partial, dir)) {
+			link_flag_set(slink, FILE_IS_PRESENT);
+
+			++scan->count_equal;
+
+			if (state->opt.gui) {
+				log_tag("scan:equal:%s:%s\n", disk->name, esc_tag(slink->sub, esc_buffer));
+			}
+		}
+	}
+	for (i = disk->dirlist; i != 0; i = i->next) {
+		struct snapraid_dir* emptydir = i->data;
+
+		pathprint(dir, sizeof(dir), "%s/", emptydir->sub);
+		if (!scan_changeset_contains(&scan->partial, dir))
+			dir_flag_set(emptydir, FILE_IS_PRESENT);
+	}
+
+	/* keep the stamps of the directories not scanned */
+	for (i = disk->dirstamplist; i != 0; i = i->next) {
+		struct snapraid_dirstamp* dirstamp = i->data;
+
+		if (!scan_changeset_contains(&scan->partial, dirstamp->sub))
+			dirstamp_flag_set(dirstamp, FILE_IS_PRESENT);
+	}
+
+	return 1;
+}
+
+/**
+ * Check if the container directory of an entry has an unchanged stamp.
+ */
+static int scan_dirstamp_unchanged(struct snapraid_disk* disk, const char* dir)
+{
+	struct snapraid_dirstamp* dirstamp;
+
+	dirstamp = tommy_hashdyn_search(&disk->dirstampset, dirstamp_name_compare, dir, dirstamp_name_hash(dir));
+
+	return dirstamp != 0 && dirstamp_flag_has(dirstamp, FILE_IS_PRESENT);
+}
+
+/**
+ * Prepare a partial scan using the directory stamps.
+ *
+ * The modification time of a directory changes when an entry is
+ * added, removed or renamed, but not when the content of a file is modified.
+ * All the files, links and empty dirs in the unchanged directories
+ * are marked as present, and the changed directories are inserted in ::partial.
+ * Return 0 if a full scan is required.
+ */
+static int scan_dirstamp(struct snapraid_scan* scan)
+{
+	struct snapraid_state* state = scan->state;
+	struct snapraid_disk* disk = scan->disk;
+	uint32_t dirstamp_filter;
+	int is_valid;
+	tommy_node* i;
+	char dir[PATH_MAX];
+	char esc_buffer[ESC_MAX];
+
+	if (!state->dircache) {
+		/* the previous stamps are removed by scan_dirstamp_cleanup() */
+		disk->dirstamp_filter = 0;
+		return 0;
+	}
+
+	dirstamp_filter = scan_filter_crc(state);
+
+	/* use the stamps only if the scan result depends only by the directories changed */
+	is_valid = 1;
+	if (disk->dirstamp_filter != dirstamp_filter
+		|| disk->has_volatile_inodes || disk->has_different_uuid || disk->has_unsupported_uuid
+	) {
+		is_valid = 0;
+	}
+
+	if (disk->dirstamp_filter != dirstamp_filter) {
+		disk->dirstamp_filter = dirstamp_filter;
+		scan->need_write = 1;
+	}
+
+	/*
+	 * Hardlinks are not supported, because they are detected
+	 * only scanning all the links of the same inode.
+	 */
+	for (i = disk->linklist; i != 0 && is_valid; i = i->next) {
+		struct snapraid_link* slink = i->data;
+		if (link_flag_has(slink, FILE_IS_HARDLINK))
+			is_valid = 0;
+	}
+
+	/* all the directories containing something must have a stamp */
+	for (i = disk->filelist; i != 0 && is_valid; i = i->next) {
+		struct snapraid_file* file = i->data;
+		scan_changed_of(dir, sizeof(dir), file->sub);
+		if (!tommy_hashdyn_search(&disk->dirstampset, dirstamp_name_compare, dir, dirstamp_name_hash(dir)))
+			is_valid = 0;
+	}
+	for (i = disk->linklist; i != 0 && is_valid; i = i->next) {
+		struct snapraid_link* slink = i->data;
+		scan_changed_of(dir, sizeof(dir), slink->sub);
+		if (!tommy_hashdyn_search(&disk->dirstampset, dirstamp_name_compare, dir, dirstamp_name_hash(dir)))
+			is_valid = 0;
+	}
+	for (i = disk->dirlist; i != 0 && is_valid; i = i->next) {
+		struct snapraid_dir* emptydir = i->data;
+		pathprint(dir, sizeof(dir), "%s/", emptydir->sub);
+		if (!tommy_hashdyn_search(&disk->dirstampset, dirstamp_name_compare, dir, dirstamp_name_hash(dir)))
+			is_valid = 0;
+	}
+
+	if (!is_valid) {
+		msg_verbose("Directory stamps of disk '%s' not usable. Full scan.\n", disk->name);
+		return 0;
+	}
+
+	/* check all the stamps */
+	scan_changeset_init(&scan->partial);
+	for (i = disk->dirstamplist; i != 0; i = i->next) {
+		struct snapraid_dirstamp* dirstamp = i->data;
+		char path[PATH_MAX];
+		struct stat st;
+
+		pathprint(path, sizeof(path), "%s%s", disk->dir, dirstamp->sub);
+
+		/* if removed, or replaced by a file, it's found changed in the parent directory */
+		if (lstat(path, &st) != 0) {
+			if (errno == ENOENT || errno == ENOTDIR)
+				continue;
+
+			/* LCOV_EXCL_START */
+			log_fatal("Error in stat directory '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		if (!S_ISDIR(st.st_mode))
+			continue;
+
+		if (dirstamp->mtime_sec != 0
+			&& dirstamp->mtime_sec == st.st_mtime
+			&& dirstamp->mtime_nsec == STAT_NSEC(&st)
+			&& (dirstamp->inode == 0 || dirstamp->inode == st.st_ino)
+		) {
+			dirstamp_flag_set(dirstamp, FILE_IS_PRESENT);
+		} else {
+			scan_changeset_insert(&scan->partial, dirstamp->sub);
+		}
+	}
+
+	/* mark as present all the files, links and empty dirs in unchanged directories */
+	i = disk->filelist;
+	while (i) {
+		struct snapraid_file* file = i->data;
+
+		/* next node, before scan_file_keep() that may remove the file */
+		i = i->next;
+
+		scan_changed_of(dir, sizeof(dir), file->sub);
+		if (scan_dirstamp_unchanged(disk, dir)) {
+			file_flag_set(file, FILE_IS_PRESENT);
+
+			++scan->count_equal;
+
+			if (state->opt.gui) {
+				log_tag("scan:equal:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
+			}
+
+			/* mark the file as kept */
+			scan_file_keep(scan, file);
+		}
+	}
+	for (i = disk->linklist; i != 0; i = i->next) {
+		struct snapraid_link* slink = i->data;
+
+		scan_changed_of(dir, sizeof(dir), slink->sub);
+		if (scan_dirstamp_unchanged(disk, dir)) {
+			link_flag_set(slink, FILE_IS_PRESENT);
+
+			++scan->count_equal;
+
+			if (state->opt.gui) {
+				log_tag("scan:equal:%s:%s\n", disk->name, esc_tag(slink->sub, esc_buffer));
+			}
+		}
+	}
+	for (i = disk->dirlist; i != 0; i = i->next) {
+		struct snapraid_dir* emptydir = i->data;
+
+		pathprint(dir, sizeof(dir), "%s/", emptydir->sub);
+		if (scan_dirstamp_unchanged(disk, dir))
+			dir_flag_set(emptydir, FILE_IS_PRESENT);
+	}
+
+	/* skip the directories with a stamp, as they are already handled */
+	scan->is_shallow = 1;
+
+	return 1;
+}
+
+/**
+ * Remove the stamps of the directories not found.
+ */
+static void scan_dirstamp_cleanup(struct snapraid_scan* scan)
+{
+	struct snapraid_state* state = scan->state;
+	struct snapraid_disk* disk = scan->disk;
+	tommy_node* i;
+
+	i = disk->dirstamplist;
+	while (i) {
+		struct snapraid_dirstamp* dirstamp = i->data;
+
+		/* next node */
+		i = i->next;
+
+		if (!state->dircache || !dirstamp_flag_has(dirstamp, FILE_IS_PRESENT)) {
+			tommy_hashdyn_remove_existing(&disk->dirstampset, &dirstamp->nodeset);
+			tommy_list_remove_existing(&disk->dirstamplist, &dirstamp->nodelist);
+			dirstamp_free(dirstamp);
+			scan->need_write = 1;
+		}
+	}
+}
+
+/**
+ * Scan only the changed directories of a disk.
+ */
+static void scan_partial(struct snapraid_scan* scan)
+{
+	struct snapraid_disk* disk = scan->disk;
+	tommy_node* i;
+
+	msg_verbose("Scanning %u changed directories in disk %s\n", (unsigned)tommy_list_count(&scan->partial.list), disk->name);
+
+	for (i = scan->partial.list; i != 0; i = i->next) {
+		struct snapraid_scan_changed* changed = i->data;
+		char path[PATH_MAX];
+		char sub[PATH_MAX];
+		struct stat st;
+
+		pathprint(path, sizeof(path), "%s%s", disk->dir, changed->sub);
+
+		/* if removed, or replaced by a file, all its content is missing */
+		if (lstat(path, &st) != 0) {
+			if (errno == ENOENT || errno == ENOTDIR)
+				continue;
+
+			/* LCOV_EXCL_START */
+			log_fatal("Error in stat directory '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		if (!S_ISDIR(st.st_mode))
+			continue;
+
+		scan_dirstamp_record(scan, changed->sub, &st);
+
+		/* the disk root is never an empty dir */
+		if (changed->sub[0] == 0) {
+			scan_dir(scan, 0, scan->is_diff, disk->dir, "");
+			continue;
+		}
+
+		/* the empty dir name is without the final slash */
+		pathcpy(sub, sizeof(sub), changed->sub);
+		sub[strlen(sub) - 1] = 0;
+
+		if (scan_dir(scan, 1, scan->is_diff, path, changed->sub) == 0) {
+			/* scan the directory as empty dir */
+			scan_emptydir(scan, sub);
+		}
+	}
+
+	scan_changeset_done(&scan->partial);
+}
+
+/**
+ * Min number of files to read the physical offsets with multiple threads.
+ */
+#define SCAN_PHYSICAL_THREAD_MIN 256
+
+/**
+ * Max number of threads reading the physical offsets of a disk.
+ */
+#define SCAN_PHYSICAL_THREAD_MAX 8
+
+/**
+ * Files processed by a thread at each step.
+ */
+#define SCAN_PHYSICAL_STEP 64
+
+/**
+ * Context shared by the threads reading the physical offsets of a disk.
+ */
+struct snapraid_physical_pool {
+	struct snapraid_disk* disk;
+	struct snapraid_file** file_map; /**< Files to process. */
+	unsigned file_max; /**< Number of files to process. */
+#if HAVE_PTHREAD
+	pthread_mutex_t mutex; /**< Mutex protecting ::next. */
+#endif
+	unsigned next; /**< Next file to process. */
+};
+
+static void* scan_physical_thread(void* arg)
+{
+	struct snapraid_physical_pool* pool = arg;
+	struct snapraid_disk* disk = pool->disk;
+
+	while (1) {
+		unsigned begin;
+		unsigned end;
+
+		/* get the next files to process */
+#if HAVE_PTHREAD
+		thread_mutex_lock(&pool->mutex);
+#endif
+		begin = pool->next;
+		end = begin + SCAN_PHYSICAL_STEP;
+		if (end > pool->file_max)
+			end = pool->file_max;
+		pool->next = end;
+#if HAVE_PTHREAD
+		thread_mutex_unlock(&pool->mutex);
+#endif
+
+		/* if no more files, we are done */
+		if (begin == end)
+			break;
+
+		for (; begin < end; ++begin) {
+			struct snapraid_file* file = pool->file_map[begin];
+			char path_next[PATH_MAX];
+
+			pathprint(path_next, sizeof(path_next), "%s%s", disk->dir, file->sub);
+
+			if (filephy(path_next, file->size, &file->physical) != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error in getting the physical offset of file '%s'. %s.\n", path_next, strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Read the physical offsets of the new files of a disk.
+ *
+ * The files kept, or moved, already have the offset read by a previous scan,
+ * and only the new ones are read. After a large copy of files there are many
+ * of them, and they are read by multiple threads, to keep more requests queued
+ * in the file-system, like the lstat_batch() of the directory scan.
+ */
+static void scan_physical(struct snapraid_scan* scan)
+{
+	struct snapraid_state* state = scan->state;
+	struct snapraid_physical_pool pool;
+	tommy_node* node;
+	unsigned thread_max;
+
+	/* the offset is needed only to sort the new files */
+	if (state->opt.force_order != SORT_PHYSICAL || tommy_list_empty(&scan->file_insert_list))
+		return;
+
+	pool.disk = scan->disk;
+	pool.file_map = malloc_nofail(tommy_list_count(&scan->file_insert_list) * sizeof(struct snapraid_file*));
+	pool.file_max = 0;
+	pool.next = 0;
+
+	for (node = scan->file_insert_list; node != 0; node = node->next) {
+		struct snapraid_file* file = node->data;
+
+		if (file->physical == FILEPHY_UNREAD_OFFSET)
+			pool.file_map[pool.file_max++] = file;
+	}
+
+	thread_max = pool.file_max / SCAN_PHYSICAL_THREAD_MIN;
+	if (thread_max > SCAN_PHYSICAL_THREAD_MAX)
+		thread_max = SCAN_PHYSICAL_THREAD_MAX;
 
-		/* check for not supported file names */
-		if (name[0] == 0) {
-			/* LCOV_EXCL_START */
-			log_fatal("Unsupported name '%s' in file '%s'.\n", name, path_next);
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
-		}
+	log_tag("scan:physical:%s:%u:%u\n", scan->disk->name, pool.file_max, thread_max);
 
-		/* exclude hidden files even before calling lstat() */
-		if (filter_hidden(state->filter_hidden, dd) != 0) {
-			msg_verbose("Excluding hidden '%s'\n", path_next);
-			continue;
-		}
+#if HAVE_PTHREAD
+	/* the mutex is used also by a single thread */
+	thread_mutex_init(&pool.mutex, 0);
 
-		/* exclude content files even before calling lstat() */
-		if (filter_content(&state->contentlist, path_next) != 0) {
-			msg_verbose("Excluding content '%s'\n", path_next);
-			continue;
-		}
+	if (thread_max > 1) {
+		pthread_t thread_map[SCAN_PHYSICAL_THREAD_MAX];
+		unsigned j;
 
-		name_len = strlen(dd->d_name);
-		entry = malloc_nofail(sizeof(struct dirent_sorted) + name_len + 1);
+		for (j = 0; j < thread_max; ++j)
+			thread_create(&thread_map[j], 0, scan_physical_thread, &pool);
 
-		/* copy the dir entry */
-#if HAVE_STRUCT_DIRENT_D_INO
-		entry->d_ino = dd->d_ino;
-#endif
-#if HAVE_STRUCT_DIRENT_D_TYPE
-		entry->d_type = dd->d_type;
-#endif
-#if HAVE_STRUCT_DIRENT_D_STAT
-		/* convert dirent to lstat result */
-		dirent_lstat(dd, &entry->d_stat);
+		for (j = 0; j < thread_max; ++j)
+			thread_join(thread_map[j], 0);
+	} else {
+		scan_physical_thread(&pool);
+	}
 
-		/* note that at this point the st_mode may be 0 */
+	thread_mutex_destroy(&pool.mutex);
+#else
+	scan_physical_thread(&pool);
 #endif
-		memcpy(entry->d_name, dd->d_name, name_len + 1);
 
-		/* insert in the list */
-		tommy_list_insert_tail(&list, &entry->node, entry);
-	}
+	free(pool.file_map);
+}
 
-	if (closedir(d) != 0) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error closing directory '%s'. %s.\n", dir, strerror(errno));
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
+/**
+ * Scan a disk.
+ */
+static void scan_disk(struct snapraid_scan* scan)
+{
+	struct snapraid_disk* disk = scan->disk;
 
-	if (state->opt.force_order == SORT_ALPHA) {
-		/* if requested sort alphabetically */
-		/* this is mainly done for testing to ensure to always */
-		/* process in the same way in different platforms */
-		tommy_list_sort(&list, dd_name_compare);
-	}
-#if HAVE_STRUCT_DIRENT_D_INO
-	else if (!disk->has_volatile_inodes) {
-		/* if inodes are persistent */
-		/* sort the list of dir entries by inodes */
-		tommy_list_sort(&list, dd_ino_compare);
+	if (!scan->is_diff)
+		msg_progress("Scanning disk %s...\n", disk->name);
+
+	scan->batch = lstat_batch_alloc();
+
+	if (scan_journal(scan) || scan_dirstamp(scan)) {
+		scan_partial(scan);
+	} else {
+		scan_dirstamp_record_path(scan, disk->dir, "");
+		scan_dir(scan, 0, scan->is_diff, disk->dir, "");
 	}
-	/* otherwise just keep the insertion order */
-#endif
 
-	/* process the sorted dir entries */
-	node = list;
-	while (node != 0) {
-		char path_next[PATH_MAX];
-		char sub_next[PATH_MAX];
-		char out[PATH_MAX];
-		struct snapraid_filter* reason = 0;
-		struct dirent_sorted* dd = node->data;
-		const char* name = dd->d_name;
-		struct stat* st;
-		int type;
-#if !HAVE_STRUCT_DIRENT_D_STAT
-		struct stat st_buf;
-#endif
+	scan_dirstamp_cleanup(scan);
 
-		pathprint(path_next, sizeof(path_next), "%s%s", dir, name);
-		pathprint(sub_next, sizeof(sub_next), "%s%s", sub, name);
+	if (scan->batch)
+		lstat_batch_free(scan->batch);
 
-		/* start with an unknown type */
-		type = -1;
-		st = 0;
+	scan_physical(scan);
+}
 
-		/* if dirent has the type, use it */
-#if HAVE_STRUCT_DIRENT_D_TYPE
-		switch (dd->d_type) {
-		case DT_UNKNOWN : break;
-		case DT_REG : type = 0; break;
-		case DT_LNK : type = 1; break;
-		case DT_DIR : type = 2; break;
-		default : type = 3; break;
-		}
-#endif
+#if HAVE_PTHREAD
+/**
+ * Context shared by all the scan threads.
+ */
+struct snapraid_scan_pool {
+	pthread_mutex_t mutex; /**< Mutex protecting ::next. */
+	tommy_node* next; /**< Next scan to process. */
+};
 
-		/* if type is still unknown */
-		if (type < 0) {
-			/* get the type from stat */
-			st = DSTAT(path_next, dd, &st_buf);
+static void* scan_disk_thread(void* arg)
+{
+	struct snapraid_scan_pool* pool = arg;
 
-#if HAVE_STRUCT_DIRENT_D_STAT
-			/* if the st_mode field is missing, takes care to fill it using normal lstat() */
-			/* at now this can happen only in Windows (with HAVE_STRUCT_DIRENT_D_STAT defined), */
-			/* because we use a directory reading method that doesn't read info about ReparsePoint. */
-			/* Note that here we cannot call here lstat_sync(), because we don't know what kind */
-			/* of file is it, and lstat_sync() doesn't always work */
-			if (st->st_mode == 0) {
-				if (lstat(path_next, st) != 0) {
-					/* LCOV_EXCL_START */
-					log_fatal("Error in stat file/directory '%s'. %s.\n", path_next, strerror(errno));
-					exit(EXIT_FAILURE);
-					/* LCOV_EXCL_STOP */
-				}
-			}
-#endif
+	while (1) {
+		tommy_node* node;
 
-			if (S_ISREG(st->st_mode))
-				type = 0;
-			else if (S_ISLNK(st->st_mode))
-				type = 1;
-			else if (S_ISDIR(st->st_mode))
-				type = 2;
-			else
-				type = 3;
-		}
+		/* get the next disk to scan */
+		thread_mutex_lock(&pool->mutex);
+		node = pool->next;
+		if (node)
+			pool->next = node->next;
+		thread_mutex_unlock(&pool->mutex);
 
-		if (type == 0) { /* REG */
-			if (filter_path(&state->filterlist, &reason, disk->name, sub_next) == 0) {
+		/* if no more disk, we are done */
+		if (!node)
+			break;
 
-				/* late stat, if not yet called */
-				if (!st)
-					st = DSTAT(path_next, dd, &st_buf);
+		scan_disk(node->data);
+	}
 
-#if HAVE_LSTAT_SYNC
-				/* if the st_ino field is missing, takes care to fill it using the extended lstat() */
-				/* this can happen only in Windows */
-				if (st->st_ino == 0 || st->st_nlink == 0) {
-					if (lstat_sync(path_next, st, 0) != 0) {
-						/* LCOV_EXCL_START */
-						log_fatal("Error in stat file '%s'. %s.\n", path_next, strerror(errno));
-						exit(EXIT_FAILURE);
-						/* LCOV_EXCL_STOP */
-					}
-				}
+	return 0;
+}
 #endif
 
-				scan_file(scan, is_diff, sub_next, st, FILEPHY_UNREAD_OFFSET);
-				processed = 1;
-			} else {
-				msg_verbose("Excluding file '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
-			}
-		} else if (type == 1) { /* LNK */
-			if (filter_path(&state->filterlist, &reason, disk->name, sub_next) == 0) {
-				char subnew[PATH_MAX];
-				int ret;
+/**
+ * Scan all the disks.
+ *
+ * Each disk is scanned independently, and if threads are available,
+ * all the disks are scanned at the same time, limited by the
+ * number of threads specified with --scan-threads.
+ *
+ * Note that the scan of a disk only accesses the data of the same disk.
+ * Operations that need the data of other disks, like the copy detection,
+ * are delayed after all the scans complete.
+ */
+static void scan_all(struct snapraid_state* state, tommy_list* scanlist)
+{
+	tommy_node* i;
+#if HAVE_PTHREAD
+	unsigned thread_max;
 
-				ret = readlink(path_next, subnew, sizeof(subnew));
-				if (ret >= PATH_MAX) {
-					/* LCOV_EXCL_START */
-					log_fatal("Error in readlink file '%s'. Symlink too long.\n", path_next);
-					exit(EXIT_FAILURE);
-					/* LCOV_EXCL_STOP */
-				}
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					log_fatal("Error in readlink file '%s'. %s.\n", path_next, strerror(errno));
-					exit(EXIT_FAILURE);
-					/* LCOV_EXCL_STOP */
-				}
-				if (ret == 0)
-					log_fatal("WARNING! Empty symbolic link '%s'.\n", path_next);
+	thread_max = tommy_list_count(scanlist);
+	if (state->opt.scan_threads != 0 && state->opt.scan_threads < thread_max)
+		thread_max = state->opt.scan_threads;
 
-				/* readlink doesn't put the final 0 */
-				subnew[ret] = 0;
+	if (thread_max > 1) {
+		struct snapraid_scan_pool pool;
+		pthread_t* thread_map;
+		unsigned j;
 
-				/* process as a symbolic link */
-				scan_link(scan, is_diff, sub_next, subnew, FILE_IS_SYMLINK);
-				processed = 1;
-			} else {
-				msg_verbose("Excluding link '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
-			}
-		} else if (type == 2) { /* DIR */
-			if (filter_subdir(&state->filterlist, &reason, disk->name, sub_next) == 0) {
-#ifndef _WIN32
-				/* late stat, if not yet called */
-				if (!st)
-					st = DSTAT(path_next, dd, &st_buf);
+		thread_mutex_init(&pool.mutex, 0);
+		pool.next = tommy_list_head(scanlist);
 
-				/* in Unix don't follow mount points in different devices */
-				/* in Windows we are already skipping them reporting them as special files */
-				if ((uint64_t)st->st_dev != disk->device) {
-					log_fatal("WARNING! Ignoring mount point '%s' because it appears to be in a different device\n", path_next);
-				} else
-#endif
-				{
-					char sub_dir[PATH_MAX];
+		thread_map = malloc_nofail(thread_max * sizeof(pthread_t));
 
-					/* recurse */
-					pathslash(path_next, sizeof(path_next));
-					pathcpy(sub_dir, sizeof(sub_dir), sub_next);
-					pathslash(sub_dir, sizeof(sub_dir));
-					if (scan_dir(scan, level + 1, is_diff, path_next, sub_dir) == 0) {
-						/* scan the directory as empty dir */
-						scan_emptydir(scan, sub_next);
-					}
-					/* or we processed something internally, or we have added the empty dir */
-					processed = 1;
-				}
-			} else {
-				msg_verbose("Excluding directory '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
-			}
-		} else {
-			if (filter_path(&state->filterlist, &reason, disk->name, sub_next) == 0) {
-				/* late stat, if not yet called */
-				if (!st)
-					st = DSTAT(path_next, dd, &st_buf);
+		for (j = 0; j < thread_max; ++j)
+			thread_create(&thread_map[j], 0, scan_disk_thread, &pool);
 
-				log_fatal("WARNING! Ignoring special '%s' file '%s'\n", stat_desc(st), path_next);
-			} else {
-				msg_verbose("Excluding special file '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
-			}
-		}
+		for (j = 0; j < thread_max; ++j)
+			thread_join(thread_map[j], 0);
 
-		/* next entry */
-		node = node->next;
+		free(thread_map);
 
-		/* free the present one */
-		free(dd);
+		thread_mutex_destroy(&pool.mutex);
+		return;
 	}
+#else
+	(void)state;
+#endif
 
-	return processed;
+	for (i = tommy_list_head(scanlist); i != 0; i = i->next)
+		scan_disk(i->data);
 }
 
 static int state_diffscan(struct snapraid_state* state, int is_diff)
@@ -1480,6 +2957,9 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 
 	tommy_list_init(&scanlist);
 
+	/* the detection of moved and copied files needs the inode and stamp hashtables */
+	state_fileset(state);
+
 	if (is_diff)
 		msg_progress("Comparing...\n");
 
@@ -1495,6 +2975,12 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 		scan = malloc_nofail(sizeof(struct snapraid_scan));
 		scan->state = state;
 		scan->disk = disk;
+		scan->is_diff = is_diff;
+		scan->need_write = 0;
+		scan->is_shallow = 0;
+		scan->start = time(0);
+		scan->batch = 0;
+		output_init(&scan->diff, state->opt.output_format, ESC_MAX);
 		scan->count_equal = 0;
 		scan->count_move = 0;
 		scan->count_copy = 0;
@@ -1502,15 +2988,15 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 		scan->count_change = 0;
 		scan->count_remove = 0;
 		scan->count_insert = 0;
+		scan->count_relocate = 0;
+		scan->count_relocate_block = 0;
 		tommy_list_init(&scan->file_insert_list);
 		tommy_list_init(&scan->link_insert_list);
 		tommy_list_init(&scan->dir_insert_list);
+		tommy_list_init(&scan->file_new_list);
 
 		tommy_list_insert_tail(&scanlist, &scan->node, scan);
 
-		if (!is_diff)
-			msg_progress("Scanning disk %s...\n", disk->name);
-
 		/* check if the disk supports persistent inodes */
 		ret = fsinfo(disk->dir, &has_persistent_inodes, &has_syncronized_hardlinks, 0, 0);
 		if (ret < 0) {
@@ -1548,8 +3034,34 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 				file_flag_set(file, FILE_IS_WITHOUT_INODE);
 			}
 		}
+	}
+
+	/* scan all the disks */
+	scan_all(state, &scanlist);
+
+	/* print the differences found in the disk order */
+	for (i = scanlist; i != 0; i = i->next)
+		scan_diff_flush(i->data);
+
+	/* now that all the disks are scanned, search for copies */
+	/* processing disks and files in order for a stable result */
+	for (i = scanlist; i != 0; i = i->next) {
+		struct snapraid_scan* scan = i->data;
+		tommy_node* node;
+
+		node = scan->file_new_list;
+		while (node) {
+			struct snapraid_scan_new* entry = node->data;
+
+			/* next node */
+			node = node->next;
+
+			scan_file_new(scan, entry);
+
+			free(entry);
+		}
 
-		scan_dir(scan, 0, is_diff, disk->dir, "");
+		scan_diff_flush(scan);
 	}
 
 	/* we split the search in two phases because to detect files */
@@ -1565,6 +3077,8 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 		unsigned phy_dup;
 		uint64_t phy_last;
 		struct snapraid_file* phy_file_last;
+		struct scan_free sf;
+		int has_free;
 
 		/* check for removed files */
 		node = disk->filelist;
@@ -1580,7 +3094,7 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 
 				log_tag("scan:remove:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
 				if (is_diff) {
-					printf("remove %s\n", fmt_term(disk, file->sub, esc_buffer));
+					scan_diff(scan, "remove", disk, file->sub, 0, 0);
 				}
 
 				scan_file_remove(scan, file);
@@ -1601,13 +3115,15 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 
 				log_tag("scan:remove:%s:%s\n", disk->name, esc_tag(slink->sub, esc_buffer));
 				if (is_diff) {
-					printf("remove %s\n", fmt_term(disk, slink->sub, esc_buffer));
+					scan_diff(scan, "remove", disk, slink->sub, 0, 0);
 				}
 
 				scan_link_remove(scan, slink);
 			}
 		}
 
+		scan_diff_flush(scan);
+
 		/* check for removed dirs */
 		node = disk->dirlist;
 		while (node) {
@@ -1644,6 +3160,9 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 		/* to reuse the just freed space */
 		/* also check if the physical offset reported are fakes or not */
 		node = scan->file_insert_list;
+		has_free = node != 0 || state->opt.compact;
+		if (has_free)
+			scan_free_init(&sf, disk);
 		phy_count = 0;
 		phy_dup = 0;
 		phy_last = FILEPHY_UNREAD_OFFSET;
@@ -1673,9 +3192,16 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 			node = node->next;
 
 			/* insert in the parity */
-			scan_file_allocate(scan, file);
+			scan_file_allocate(scan, &sf, file);
 		}
 
+		/* relocate the files to close the holes in the parity */
+		if (state->opt.compact)
+			scan_compact(scan, &sf);
+
+		if (has_free)
+			scan_free_done(&sf);
+
 		/* mark the disk without reliable physical offset if it has duplicates */
 		/* here it should never happen because we already sorted out hardlinks */
 		if (state->opt.force_order == SORT_PHYSICAL && phy_dup > 0) {
@@ -1843,9 +3369,13 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 	total.count_change = 0;
 	total.count_remove = 0;
 	total.count_insert = 0;
+	total.count_relocate = 0;
+	total.count_relocate_block = 0;
 
 	for (i = scanlist; i != 0; i = i->next) {
 		struct snapraid_scan* scan = i->data;
+		if (scan->need_write)
+			state->need_write = 1;
 		total.count_equal += scan->count_equal;
 		total.count_move += scan->count_move;
 		total.count_copy += scan->count_copy;
@@ -1853,6 +3383,8 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 		total.count_change += scan->count_change;
 		total.count_remove += scan->count_remove;
 		total.count_insert += scan->count_insert;
+		total.count_relocate += scan->count_relocate;
+		total.count_relocate_block += scan->count_relocate_block;
 	}
 
 	if (is_diff) {
@@ -1878,6 +3410,11 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 	log_tag("summary:copied:%u\n", total.count_copy);
 	log_tag("summary:restored:%u\n", total.count_restore);
 
+	if (state->opt.compact) {
+		msg_progress("Relocated %u files, with %u blocks.\n", total.count_relocate, total.count_relocate_block);
+		log_tag("summary:relocated:%u:%u\n", total.count_relocate, total.count_relocate_block);
+	}
+
 	no_difference = !total.count_move && !total.count_copy && !total.count_restore
 		&& !total.count_change && !total.count_remove && !total.count_insert;
 
@@ -1896,6 +3433,10 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 	}
 	log_flush();
 
+	for (i = scanlist; i != 0; i = i->next) {
+		struct snapraid_scan* scan = i->data;
+		output_done(&scan->diff);
+	}
 	tommy_list_foreach(&scanlist, (tommy_foreach_func*)free);
 
 	/* check the file-system on all disks */
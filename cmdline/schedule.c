@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2026 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "portable.h"
+
+#include "support.h"
+#include "util.h"
+#include "elem.h"
+#include "state.h"
+#include "remote.h"
+
+/****************************************************************************/
+/* schedule */
+
+/*
+ * The arrays of the same host coordinate using lease files in a shared
+ * directory. A lease is a lock file taken with lock_lock(), and it's
+ * released when the process closes it, or terminates.
+ *
+ * A budget of N is a set of N lease files, and each process takes as many
+ * of them as it needs. To avoid deadlocks, all the processes take the
+ * leases in the same order: the controllers sorted by name, then the CPU.
+ */
+
+#define SCHEDULE_WAIT 1 /**< Seconds waited before retrying to take a lease. */
+#define SCHEDULE_CONTROLLER_MAX 64 /**< Max length of a controller name. */
+#define SCHEDULE_CONTROLLER_COUNT (SCHEDULE_LEASE_MAX / 2) /**< Max number of controllers, leaving the other leases for the CPU. */
+
+#if HAVE_LOCKFILE
+/**
+ * Take up to the specified number of leases of a budget.
+ * Wait until at least one is available.
+ * Return the number of leases taken.
+ */
+static unsigned schedule_take(struct snapraid_state* state, const char* name, unsigned budget, unsigned want)
+{
+	char path[PATH_MAX];
+	unsigned got;
+	int waiting;
+
+	waiting = 0;
+	while (1) {
+		unsigned i;
+
+		got = 0;
+		for (i = 0; i < budget && got < want; ++i) {
+			int f;
+
+			pathprint(path, sizeof(path), "%ssnapraid-%s-%u.lock", state->schedule_dir, name, i);
+
+			f = lock_lock(path);
+			if (f == -1) {
+				if (errno != EWOULDBLOCK) {
+					/* LCOV_EXCL_START */
+					log_fatal("Error creating the lease file '%s'. %s.\n", path, strerror(errno));
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+				continue;
+			}
+
+			state->schedule_lease[state->schedule_lease_mac++] = f;
+			++got;
+		}
+
+		if (got != 0)
+			break;
+
+		/* LCOV_EXCL_START */
+		if (!waiting) {
+			msg_progress("Waiting for the other arrays to release the '%s' lease...\n", name);
+			waiting = 1;
+		}
+
+		sleep(SCHEDULE_WAIT);
+		/* LCOV_EXCL_STOP */
+	}
+
+	log_tag("schedule:lease:%s:%u:%u\n", name, got, want);
+
+	return got;
+}
+
+/**
+ * Add the controller of a device to the sorted set of controllers.
+ */
+static void schedule_controller(char (*controller_map)[SCHEDULE_CONTROLLER_MAX], unsigned* controller_mac, uint64_t device)
+{
+	char name[SCHEDULE_CONTROLLER_MAX];
+	unsigned i;
+
+	if (*controller_mac == SCHEDULE_CONTROLLER_COUNT)
+		return;
+
+	if (devcontroller(device, name, sizeof(name)) != 0)
+		return;
+
+	for (i = 0; i < *controller_mac; ++i) {
+		int c = strcmp(controller_map[i], name);
+		if (c == 0)
+			return;
+		if (c > 0)
+			break;
+	}
+
+	memmove(controller_map + i + 1, controller_map + i, (*controller_mac - i) * sizeof(controller_map[0]));
+	pathcpy(controller_map[i], sizeof(controller_map[i]), name);
+	++*controller_mac;
+}
+
+void state_schedule(struct snapraid_state* state)
+{
+	if (state->schedule_dir[0] == 0)
+		return;
+
+	if (state->schedule_io != 0) {
+		char (*controller_map)[SCHEDULE_CONTROLLER_MAX];
+		unsigned controller_mac;
+		unsigned l, s;
+		unsigned i;
+		tommy_node* j;
+
+		controller_map = malloc_nofail(SCHEDULE_CONTROLLER_COUNT * sizeof(controller_map[0]));
+		controller_mac = 0;
+
+		for (j = state->disklist; j != 0; j = j->next) {
+			struct snapraid_disk* disk = j->data;
+			schedule_controller(controller_map, &controller_mac, disk->device);
+		}
+
+		for (l = 0; l < state->level; ++l) {
+			for (s = 0; s < state->parity[l].split_mac; ++s) {
+				if (remote_is(state->parity[l].split_map[s].path))
+					continue;
+				schedule_controller(controller_map, &controller_mac, state->parity[l].split_map[s].device);
+			}
+		}
+
+		for (i = 0; i < controller_mac; ++i) {
+			char name[SCHEDULE_CONTROLLER_MAX + 8];
+
+			pathprint(name, sizeof(name), "io-%s", controller_map[i]);
+
+			schedule_take(state, name, state->schedule_io, 1);
+		}
+
+		free(controller_map);
+	}
+
+	if (state->schedule_cpu != 0) {
+		unsigned raid = state->opt.raid_threads > 1 ? state->opt.raid_threads : 1;
+		unsigned hash = state->opt.hash_threads;
+		unsigned got;
+
+		got = schedule_take(state, "cpu", state->schedule_cpu, raid + hash);
+
+		/* share the threads obtained in proportion, with at least one for the parity */
+		if (got < raid + hash) {
+			unsigned hash_got = hash * got / (raid + hash);
+
+			state->opt.raid_threads = got - hash_got;
+			state->opt.hash_threads = hash_got;
+
+			msg_progress("Limiting the computing threads to %u to share the CPU with the other arrays.\n", got);
+		}
+	}
+}
+
+void state_unschedule(struct snapraid_state* state)
+{
+	unsigned i;
+
+	for (i = 0; i < state->schedule_lease_mac; ++i) {
+		if (lock_unlock(state->schedule_lease[i]) == -1) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error closing a lease file in '%s'. %s.\n", state->schedule_dir, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	state->schedule_lease_mac = 0;
+}
+
+void state_schedule_content(struct snapraid_state* state, int take)
+{
+	char path[PATH_MAX];
+
+	if (state->schedule_dir[0] == 0)
+		return;
+
+	if (!take) {
+		if (state->schedule_content != -1 && lock_unlock(state->schedule_content) == -1) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error closing a lease file in '%s'. %s.\n", state->schedule_dir, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		state->schedule_content = -1;
+		return;
+	}
+
+	pathprint(path, sizeof(path), "%ssnapraid-content.lock", state->schedule_dir);
+
+	while ((state->schedule_content = lock_lock(path)) == -1) {
+		/* LCOV_EXCL_START */
+		if (errno != EWOULDBLOCK) {
+			log_fatal("Error creating the lease file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		sleep(SCHEDULE_WAIT);
+		/* LCOV_EXCL_STOP */
+	}
+}
+#else
+void state_schedule(struct snapraid_state* state)
+{
+	(void)state;
+}
+
+void state_unschedule(struct snapraid_state* state)
+{
+	(void)state;
+}
+
+void state_schedule_content(struct snapraid_state* state, int take)
+{
+	(void)state;
+	(void)take;
+}
+#endif
+
@@ -36,6 +36,19 @@ struct snapraid_rehash {
 	struct snapraid_block* block;
 };
 
+/**
+ * Block read, waiting to be hashed.
+ *
+ * The hashes are computed after reading all the disks,
+ * to process more blocks at the same time with memhash_multi().
+ */
+struct snapraid_pending {
+	struct snapraid_task* task;
+	unsigned diskcur;
+	int file_is_unsynced;
+	unsigned char hash[HASH_MAX];
+};
+
 /**
  * Scrub plan to use.
  */
@@ -109,6 +122,7 @@ static void scrub_data_reader(struct snapraid_worker* worker, struct snapraid_ta
 	struct snapraid_handle* handle = worker->handle;
 	struct snapraid_disk* disk = handle->disk;
 	block_off_t blockcur = task->position;
+	block_off_t run;
 	unsigned char* buffer = task->buffer;
 	int ret;
 	char esc_buffer[ESC_MAX];
@@ -121,8 +135,11 @@ static void scrub_data_reader(struct snapraid_worker* worker, struct snapraid_ta
 		return;
 	}
 
+	/* get the file of this block, without locking as the index doesn't change */
+	task->file = fs_par2file_find_index(disk, blockcur, &task->file_pos);
+
 	/* get the block */
-	task->block = fs_par2block_find(disk, blockcur);
+	task->block = task->file ? fs_file2block_get(task->file, task->file_pos) : BLOCK_NULL;
 
 	/* if the block is not used */
 	if (!block_has_file(task->block)) {
@@ -132,14 +149,11 @@ static void scrub_data_reader(struct snapraid_worker* worker, struct snapraid_ta
 		return;
 	}
 
-	/* get the file of this block */
-	task->file = fs_par2file_get(disk, blockcur, &task->file_pos);
-
-	/* if the file is different than the current one, close it */
+	/* if the file is different than the current one, release it */
 	if (handle->file != 0 && handle->file != task->file) {
 		/* keep a pointer at the file we are going to close for error reporting */
 		struct snapraid_file* report = handle->file;
-		ret = handle_close(handle);
+		ret = handle_release(handle);
 		if (ret == -1) {
 			/* LCOV_EXCL_START */
 			/* This one is really an unexpected error, because we are only reading */
@@ -196,7 +210,10 @@ static void scrub_data_reader(struct snapraid_worker* worker, struct snapraid_ta
 	/* from the last sync, as we are expected to return errors if running */
 	/* in an unsynced array. This is just like the check command. */
 
-	task->read_size = handle_read(handle, task->file_pos, buffer, state->block_size, log_error, 0);
+	/* read together the next blocks of the file, if they follow in the parity */
+	run = handle->ahead_max > 1 ? fs_par2run_index(disk, blockcur) : 1;
+
+	task->read_size = handle_read_ahead(handle, task->file_pos, run, buffer, state->block_size, log_error, 0);
 	if (task->read_size == -1) {
 		if (errno == EIO) {
 			log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), task->file_pos, strerror(errno));
@@ -210,6 +227,11 @@ static void scrub_data_reader(struct snapraid_worker* worker, struct snapraid_ta
 		return;
 	}
 
+	/* with the hash threads, hash the block while the disk continues to read */
+	/* otherwise, all the blocks are hashed together later in the main thread */
+	if (io->hash_max != 0 && block_has_updated_hash(task->block))
+		io_task_hash(worker, task, state->hash, state->hashseed);
+
 	/* store the path of the opened file */
 	pathcpy(task->path, sizeof(task->path), handle->path);
 
@@ -250,6 +272,11 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 	struct snapraid_handle* handle;
 	void* rehandle_alloc;
 	struct snapraid_rehash* rehandle;
+	struct snapraid_pending* pending;
+	unsigned pending_count;
+	const void** pending_src;
+	void** pending_dst;
+	void** verify;
 	unsigned diskmax;
 	block_off_t blockcur;
 	unsigned j;
@@ -260,6 +287,9 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 	block_off_t autosavedone;
 	block_off_t autosavelimit;
 	block_off_t autosavemissing;
+	block_off_t autosavestart;
+	block_off_t autosaveend;
+	uint64_t autosavetick;
 	int ret;
 	unsigned error;
 	unsigned silent_error;
@@ -275,6 +305,14 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 	/* rehash buffers */
 	rehandle = malloc_nofail_align(diskmax * sizeof(struct snapraid_rehash), &rehandle_alloc);
 
+	/* blocks to hash */
+	pending = malloc_nofail(diskmax * sizeof(struct snapraid_pending));
+	pending_src = malloc_nofail(diskmax * sizeof(void*));
+	pending_dst = malloc_nofail(diskmax * sizeof(void*));
+
+	/* blocks to verify */
+	verify = malloc_nofail((diskmax + state->level) * sizeof(void*));
+
 	/* we need 1 * data + 2 * parity */
 	buffermax = diskmax + 2 * state->level;
 
@@ -304,6 +342,9 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 	autosavelimit = state->autosave / (diskmax * state->block_size);
 	autosavemissing = countmax; /* blocks to do */
 	autosavedone = 0; /* blocks done */
+	autosavestart = blockstart; /* first block not yet saved */
+	autosaveend = blockstart; /* last block not yet saved, plus one */
+	autosavetick = tick_ms() + state->autosave_time * 1000ULL; /* time of the next autosave */
 
 	/* drop until now */
 	state_usage_waste(state);
@@ -338,6 +379,11 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 		++autosavedone;
 		--autosavemissing;
 
+		/* the positions changed since the last save */
+		if (autosavestart == autosaveend)
+			autosavestart = blockcur;
+		autosaveend = blockcur + 1;
+
 		/* by default process the block, and skip it if something goes wrong */
 		error_on_this_block = 0;
 		silent_error_on_this_block = 0;
@@ -353,16 +399,17 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 		/* if we have to use the old hash */
 		rehash = info_get_rehash(info);
 
+		/* no block to hash */
+		pending_count = 0;
+
 		/* for each disk, process the block */
 		for (j = 0; j < diskmax; ++j) {
 			struct snapraid_task* task;
 			int read_size;
-			unsigned char hash[HASH_MAX];
 			struct snapraid_block* block;
 			int file_is_unsynced;
 			struct snapraid_disk* disk;
 			struct snapraid_file* file;
-			block_off_t file_pos;
 			unsigned diskcur;
 
 			/* if the file on this disk is synced */
@@ -382,7 +429,6 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 			disk = task->disk;
 			block = task->block;
 			file = task->file;
-			file_pos = task->file_pos;
 			read_size = task->read_size;
 
 			/* by default no rehash in case of "continue" */
@@ -456,19 +502,69 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 
 			countsize += read_size;
 
-			/* now compute the hash */
-			if (rehash) {
-				memhash(state->prevhash, state->prevhashseed, hash, buffer[diskcur], read_size);
+			/* without a rehash, the hash is used only if it can be compared */
+			if (!rehash && !block_has_updated_hash(block))
+				continue;
+
+			/* hash it later with the others */
+			pending[pending_count].task = task;
+			pending[pending_count].diskcur = diskcur;
+			pending[pending_count].file_is_unsynced = file_is_unsynced;
+			++pending_count;
+		}
+
+		/* now compute the hashes */
+		if (rehash) {
+			for (j = 0; j < pending_count; ++j) {
+				struct snapraid_task* task = pending[j].task;
+				unsigned diskcur = pending[j].diskcur;
+				int read_size = task->read_size;
+
+				memhash(state->prevhash, state->prevhashseed, pending[j].hash, buffer[diskcur], read_size);
 
 				/* compute the new hash, and store it */
-				rehandle[diskcur].block = block;
-				memhash(state->hash, state->hashseed, rehandle[diskcur].hash, buffer[diskcur], read_size);
-			} else {
-				memhash(state->hash, state->hashseed, hash, buffer[diskcur], read_size);
+				rehandle[diskcur].block = task->block;
+				if (task->is_hashed)
+					memcpy(rehandle[diskcur].hash, task->hash, HASH_MAX);
+				else
+					memhash(state->hash, state->hashseed, rehandle[diskcur].hash, buffer[diskcur], read_size);
+			}
+		} else {
+			unsigned multi_count = 0;
+
+			for (j = 0; j < pending_count; ++j) {
+				struct snapraid_task* task = pending[j].task;
+				unsigned diskcur = pending[j].diskcur;
+				int read_size = task->read_size;
+
+				if (task->is_hashed) {
+					/* already computed by the hash threads */
+					memcpy(pending[j].hash, task->hash, HASH_MAX);
+				} else if (read_size == (int)state->block_size) {
+					/* full blocks are hashed all together */
+					pending_src[multi_count] = buffer[diskcur];
+					pending_dst[multi_count] = pending[j].hash;
+					++multi_count;
+				} else {
+					memhash(state->hash, state->hashseed, pending[j].hash, buffer[diskcur], read_size);
+				}
 			}
 
-			/* until now is hash */
-			state_usage_hash(state);
+			memhash_multi(state->hash, state->hashseed, pending_dst, pending_src, multi_count, state->block_size);
+		}
+
+		/* until now is hash */
+		state_usage_hash(state);
+
+		/* compare the hashes */
+		for (j = 0; j < pending_count; ++j) {
+			struct snapraid_task* task = pending[j].task;
+			struct snapraid_block* block = task->block;
+			struct snapraid_disk* disk = task->disk;
+			struct snapraid_file* file = task->file;
+			block_off_t file_pos = task->file_pos;
+			int file_is_unsynced = pending[j].file_is_unsynced;
+			unsigned char* hash = pending[j].hash;
 
 			if (block_has_updated_hash(block)) {
 				/* compare the hash */
@@ -560,12 +656,23 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 		/* if we have read all the data required and it's correct, proceed with the parity check */
 		if (!error_on_this_block && !silent_error_on_this_block && !io_error_on_this_block) {
 
-			/* compute the parity */
-			raid_gen(diskmax, state->level, state->block_size, buffer);
+			int mismatch;
+
+			/* verify the parity, computing it and comparing with the read one on the fly */
+			/* all the parities are present, as a missing one is an error on this block */
+			for (j = 0; j < diskmax; ++j)
+				verify[j] = buffer[j];
+			for (l = 0; l < state->level; ++l)
+				verify[diskmax + l] = buffer_recov[l];
+			mismatch = raid_verify(diskmax, state->level, state->block_size, verify);
+
+			/* only if something is wrong, compute the full parity to report the differences */
+			if (mismatch != 0)
+				raid_gen(diskmax, state->level, state->block_size, buffer);
 
 			/* compare the parity */
 			for (l = 0; l < state->level; ++l) {
-				if (buffer_recov[l] && memcmp(buffer[diskmax + l], buffer_recov[l], state->block_size) != 0) {
+				if ((mismatch & (1 << l)) != 0) {
 					unsigned diff = memdiff(buffer[diskmax + l], buffer_recov[l], state->block_size);
 
 					log_tag("parity_error:%u:%s: Data error, diff bits %u/%u\n", blockcur, lev_config_name(l), diff, state->block_size * 8);
@@ -621,9 +728,11 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 		}
 
 		/* autosave */
-		if (state->autosave != 0
+		if ((state->autosave != 0
 			&& autosavedone >= autosavelimit /* if we have reached the limit */
-			&& autosavemissing >= autosavelimit /* if we have at least a full step to do */
+			&& autosavemissing >= autosavelimit) /* if we have at least a full step to do */
+			/* or if we have reached the time limit, and there is still something to do */
+			|| (state->autosave_time != 0 && autosavemissing != 0 && tick_ms() >= autosavetick)
 		) {
 			autosavedone = 0; /* restart the counter */
 
@@ -633,7 +742,9 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 			state_progress_stop(state);
 
 			msg_progress("Autosaving...\n");
-			state_write(state);
+			state_autosave(state, autosavestart, autosaveend);
+			autosavestart = autosaveend;
+			autosavetick = tick_ms() + state->autosave_time * 1000ULL;
 
 			state_progress_restart(state);
 
@@ -644,6 +755,13 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 
 	state_progress_end(state, countpos, countmax, countsize);
 
+	/* in daemon mode, the content files are written only at the exit */
+	/* so save the positions scrubbed at each pass */
+	if (state->opt.daemon && autosavestart != autosaveend) {
+		msg_progress("Autosaving...\n");
+		state_autosave(state, autosavestart, autosaveend);
+	}
+
 	state_usage_print(state);
 
 	if (error || silent_error || io_error) {
@@ -682,6 +800,8 @@ bail:
 	/* stop all the worker threads */
 	io_stop(&io);
 
+	state_usage_latency(state);
+
 	for (j = 0; j < diskmax; ++j) {
 		struct snapraid_file* file = handle[j].file;
 		struct snapraid_disk* disk = handle[j].disk;
@@ -696,8 +816,12 @@ bail:
 		}
 	}
 
-	free(handle);
+	handle_unmapping(handle, diskmax);
 	free(rehandle_alloc);
+	free(pending);
+	free(pending_src);
+	free(pending_dst);
+	free(verify);
 	free(waiting_map);
 	io_done(&io);
 
@@ -711,6 +835,463 @@ bail:
 	return 0;
 }
 
+/**
+ * Data-only scrub, used with --audit-only.
+ *
+ * The hashes of the data are verified reading each disk independently,
+ * in the order of the files, without reading the parity, that is left
+ * to the normal scrub.
+ */
+struct snapraid_scrub_audit {
+	struct snapraid_state* state;
+	const unsigned char* map; /**< Positions to scrub. */
+	block_off_t blockmax; /**< Number of positions in the map. */
+#if HAVE_PTHREAD
+	pthread_mutex_t mutex; /**< Mutex protecting the progress and the info. */
+#endif
+	block_off_t countpos; /**< Number of blocks processed. */
+	block_off_t countmax; /**< Number of blocks to process. */
+	data_off_t countsize; /**< Size of the data read. */
+	int stop; /**< If the scrub was interrupted. */
+	int changed; /**< If some position was marked as bad. */
+};
+
+/**
+ * Data-only scrub of a single disk.
+ */
+struct snapraid_scrub_audit_disk {
+	struct snapraid_scrub_audit* audit; /**< Parent pointer. */
+	struct snapraid_handle* handle; /**< Handle of the disk. */
+	struct snapraid_file** file_map; /**< Files to scrub, in physical order. */
+	unsigned file_max; /**< Number of files to scrub. */
+	unsigned error; /**< Number of generic errors. */
+	unsigned silent_error; /**< Number of data errors. */
+	unsigned io_error; /**< Number of input/output errors. */
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+static int scrub_audit_file_compare(const void* void_a, const void* void_b)
+{
+	const struct snapraid_file* const* file_a = void_a;
+	const struct snapraid_file* const* file_b = void_b;
+
+	return file_physical_compare(*file_a, *file_b);
+}
+
+/**
+ * Check if the block at the specified parity position has to be scrubbed.
+ */
+static inline int scrub_audit_is_enabled(struct snapraid_scrub_audit* audit, block_off_t parity_pos)
+{
+	return parity_pos < audit->blockmax && audit->map[parity_pos];
+}
+
+/**
+ * Update the progress with the block just processed.
+ * Return !=0 if the scrub has to stop.
+ */
+static int scrub_audit_progress(struct snapraid_scrub_audit* audit, block_off_t parity_pos, unsigned read_size)
+{
+	int stop;
+
+#if HAVE_PTHREAD
+	thread_mutex_lock(&audit->mutex);
+#endif
+
+	++audit->countpos;
+	audit->countsize += read_size;
+
+	if (!audit->stop && state_progress(audit->state, 0, parity_pos, audit->countpos, audit->countmax, audit->countsize))
+		audit->stop = 1;
+
+	stop = audit->stop;
+
+#if HAVE_PTHREAD
+	thread_mutex_unlock(&audit->mutex);
+#endif
+
+	return stop;
+}
+
+/**
+ * Mark the block at the specified parity position as bad.
+ */
+static void scrub_audit_bad(struct snapraid_scrub_audit* audit, block_off_t parity_pos)
+{
+	struct snapraid_state* state = audit->state;
+
+#if HAVE_PTHREAD
+	thread_mutex_lock(&audit->mutex);
+#endif
+
+	/* set the error status keeping other info */
+	info_set(&state->infoarr, parity_pos, info_set_bad(info_get(&state->infoarr, parity_pos)));
+	audit->changed = 1;
+
+#if HAVE_PTHREAD
+	thread_mutex_unlock(&audit->mutex);
+#endif
+}
+
+/**
+ * Scrub a file, reading all its blocks sequentially.
+ * Return -1 on fatal error, 1 if interrupted, 0 otherwise.
+ */
+static int scrub_audit_file(struct snapraid_scrub_audit_disk* audit_disk, struct snapraid_file* file, unsigned char* buffer)
+{
+	struct snapraid_scrub_audit* audit = audit_disk->audit;
+	struct snapraid_state* state = audit->state;
+	struct snapraid_handle* handle = audit_disk->handle;
+	struct snapraid_disk* disk = handle->disk;
+	block_off_t file_pos;
+	block_off_t parity_pos;
+	int opened;
+	int missing;
+	int file_is_unsynced;
+	int ret;
+	char esc_buffer[ESC_MAX];
+
+	opened = 0;
+	missing = 0;
+	file_is_unsynced = 0;
+	parity_pos = 0;
+	for (file_pos = 0; file_pos < file->blockmax; ++file_pos) {
+		struct snapraid_block* block = file_block(file, file_pos);
+		unsigned char hash[HASH_MAX];
+		int read_size;
+
+		parity_pos = fs_file2par_get(disk, file, file_pos);
+
+		if (!scrub_audit_is_enabled(audit, parity_pos))
+			continue;
+
+		/* open the file at the first block to scrub */
+		if (!opened) {
+			opened = 1;
+
+			ret = handle_open(handle, file, state->file_mode, log_error, 0);
+			if (ret == -1) {
+				log_tag("error:%u:%s:%s: Open error. %s\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+				missing = 1;
+			} else if (handle->st.st_size != file->size
+				|| handle->st.st_mtime != file->mtime_sec
+				|| STAT_NSEC(&handle->st) != file->mtime_nsec
+			        /* don't check the inode to support filesystem without persistent inodes */
+			) {
+				/* report that the file is not synced */
+				file_is_unsynced = 1;
+			}
+		}
+
+		/* if the file cannot be opened, all its blocks are in error */
+		if (missing) {
+			++audit_disk->error;
+			read_size = 0;
+			goto progress;
+		}
+
+		/* read together the next blocks of the file */
+		read_size = handle_read_ahead(handle, file_pos, file->blockmax - file_pos, buffer, state->block_size, log_error, 0);
+		if (read_size == -1) {
+			read_size = 0;
+
+			if (errno == EIO) {
+				log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
+				log_error("Input/Output error in file '%s' at position '%u'\n", handle->path, file_pos);
+				++audit_disk->io_error;
+				scrub_audit_bad(audit, parity_pos);
+
+				if (audit_disk->io_error >= state->opt.io_error_limit) {
+					/* LCOV_EXCL_START */
+					log_fatal("DANGER! Too many input/output read error in a data disk, it isn't possible to scrub.\n");
+					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle->path);
+					log_fatal("Stopping at block %u\n", parity_pos);
+					handle_close(handle);
+					return -1;
+					/* LCOV_EXCL_STOP */
+				}
+				goto progress;
+			}
+
+			log_tag("error:%u:%s:%s: Read error at position %u. %s\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
+			++audit_disk->error;
+			goto progress;
+		}
+
+		/* the hash is used only if it can be compared */
+		if (!block_has_updated_hash(block))
+			goto progress;
+
+		/* compute the hash of the block just read */
+		if (info_get_rehash(info_get(&state->infoarr, parity_pos))) {
+			memhash(state->prevhash, state->prevhashseed, hash, buffer, read_size);
+		} else {
+			memhash(state->hash, state->hashseed, hash, buffer, read_size);
+		}
+
+		/* compare the hash */
+		if (memcmp(hash, block->hash, BLOCK_HASH_SIZE) != 0) {
+			unsigned diff = memdiff(hash, block->hash, BLOCK_HASH_SIZE);
+
+			log_tag("error:%u:%s:%s: Data error at position %u, diff bits %u/%u\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), file_pos, diff, BLOCK_HASH_SIZE * 8);
+
+			/* it's a silent error only if we are dealing with synced files */
+			if (file_is_unsynced || block_has_invalid_parity(block)) {
+				++audit_disk->error;
+			} else {
+				log_error("Data error in file '%s' at position '%u', diff bits %u/%u\n", handle->path, file_pos, diff, BLOCK_HASH_SIZE * 8);
+				++audit_disk->silent_error;
+				scrub_audit_bad(audit, parity_pos);
+			}
+		}
+
+progress:
+		if (scrub_audit_progress(audit, parity_pos, read_size)) {
+			/* LCOV_EXCL_START */
+			handle_close(handle);
+			return 1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	if (handle->file == file) {
+		ret = handle_close(handle);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Close error. %s\n", parity_pos, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected close error in a data disk.\n");
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Scrub all the files of a disk.
+ * Return -1 on fatal error, 0 otherwise.
+ */
+static int scrub_audit_disk_process(struct snapraid_scrub_audit_disk* audit_disk)
+{
+	struct snapraid_state* state = audit_disk->audit->state;
+	unsigned char* buffer;
+	void* buffer_alloc;
+	unsigned i;
+	int ret;
+
+	buffer = malloc_nofail_direct(state->block_size, &buffer_alloc);
+
+	ret = 0;
+	for (i = 0; i < audit_disk->file_max; ++i) {
+		ret = scrub_audit_file(audit_disk, audit_disk->file_map[i], buffer);
+		if (ret != 0)
+			break;
+	}
+
+	free(buffer_alloc);
+
+	/* an interruption isn't an error */
+	return ret == -1 ? -1 : 0;
+}
+
+#if HAVE_PTHREAD
+static void* scrub_audit_disk_thread(void* arg)
+{
+	struct snapraid_scrub_audit_disk* audit_disk = arg;
+
+	if (scrub_audit_disk_process(audit_disk) != 0) {
+		/* LCOV_EXCL_START */
+		return audit_disk;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * Scrub the data of all the disks, each one independently from the others.
+ */
+static int state_scrub_audit(struct snapraid_state* state, block_off_t blockmax, struct snapraid_plan* plan)
+{
+	struct snapraid_scrub_audit audit;
+	struct snapraid_scrub_audit_disk* audit_map;
+	struct snapraid_handle* handle;
+	unsigned char* map;
+	unsigned diskmax;
+	block_off_t i;
+	unsigned error;
+	unsigned silent_error;
+	unsigned io_error;
+	unsigned j;
+	int ret;
+
+	/* maps the disks to handles */
+	handle = handle_mapping(state, &diskmax);
+
+	/* select the positions to scrub, in order, as required by the plan */
+	map = malloc_nofail(blockmax);
+	plan->countlast = 0;
+	for (i = 0; i < blockmax; ++i)
+		map[i] = block_is_enabled(plan, i);
+
+	audit.state = state;
+	audit.map = map;
+	audit.blockmax = blockmax;
+	audit.countpos = 0;
+	audit.countmax = 0;
+	audit.countsize = 0;
+	audit.stop = 0;
+	audit.changed = 0;
+
+	audit_map = malloc_nofail(diskmax * sizeof(struct snapraid_scrub_audit_disk));
+
+	/* collect the files to scrub, and count the blocks to process */
+	for (j = 0; j < diskmax; ++j) {
+		struct snapraid_scrub_audit_disk* audit_disk = &audit_map[j];
+		struct snapraid_disk* disk = handle[j].disk;
+		tommy_node* node;
+
+		audit_disk->audit = &audit;
+		audit_disk->handle = &handle[j];
+		audit_disk->file_map = 0;
+		audit_disk->file_max = 0;
+		audit_disk->error = 0;
+		audit_disk->silent_error = 0;
+		audit_disk->io_error = 0;
+
+		if (!disk)
+			continue;
+
+		audit_disk->file_map = malloc_nofail(tommy_list_count(&disk->filelist) * sizeof(struct snapraid_file*));
+
+		for (node = disk->filelist; node != 0; node = node->next) {
+			struct snapraid_file* file = node->data;
+			block_off_t file_pos;
+			block_off_t count;
+
+			count = 0;
+			for (file_pos = 0; file_pos < file->blockmax; ++file_pos) {
+				if (scrub_audit_is_enabled(&audit, fs_file2par_get(disk, file, file_pos)))
+					++count;
+			}
+
+			if (count == 0)
+				continue;
+
+			audit.countmax += count;
+			audit_disk->file_map[audit_disk->file_max++] = file;
+		}
+
+		/* read the files in the order they are stored in the disk */
+		qsort(audit_disk->file_map, audit_disk->file_max, sizeof(struct snapraid_file*), scrub_audit_file_compare);
+	}
+
+	ret = 0;
+	state_progress_begin(state, 0, blockmax, audit.countmax);
+
+#if HAVE_PTHREAD
+	thread_mutex_init(&audit.mutex, 0);
+
+	for (j = 0; j < diskmax; ++j) {
+		if (audit_map[j].file_max != 0)
+			thread_create(&audit_map[j].thread, 0, scrub_audit_disk_thread, &audit_map[j]);
+	}
+
+	for (j = 0; j < diskmax; ++j) {
+		void* retval;
+
+		if (audit_map[j].file_max == 0)
+			continue;
+
+		thread_join(audit_map[j].thread, &retval);
+		if (retval != 0) {
+			/* LCOV_EXCL_START */
+			ret = -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	thread_mutex_destroy(&audit.mutex);
+#else
+	for (j = 0; j < diskmax; ++j) {
+		if (scrub_audit_disk_process(&audit_map[j]) != 0) {
+			/* LCOV_EXCL_START */
+			ret = -1;
+			break;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+#endif
+
+	error = 0;
+	silent_error = 0;
+	io_error = 0;
+	for (j = 0; j < diskmax; ++j) {
+		error += audit_map[j].error;
+		silent_error += audit_map[j].silent_error;
+		io_error += audit_map[j].io_error;
+		free(audit_map[j].file_map);
+	}
+	free(audit_map);
+	free(map);
+
+	/* the scrub time is not updated, as the parity is not verified */
+	if (audit.changed)
+		state->need_write = 1;
+
+	state_progress_end(state, audit.countpos, audit.countmax, audit.countsize);
+
+	if (error || silent_error || io_error) {
+		msg_status("\n");
+		msg_status("%8u file errors\n", error);
+		msg_status("%8u io errors\n", io_error);
+		msg_status("%8u data errors\n", silent_error);
+	} else {
+		/* print the result only if processed something */
+		if (audit.countpos != 0)
+			msg_status("Everything OK\n");
+	}
+
+	if (error)
+		log_fatal("WARNING! Unexpected file errors!\n");
+	if (io_error)
+		log_fatal("DANGER! Unexpected input/output errors! The failing blocks are now marked as bad!\n");
+	if (silent_error)
+		log_fatal("DANGER! Unexpected data errors! The failing blocks are now marked as bad!\n");
+	if (io_error || silent_error) {
+		log_fatal("Use 'snapraid status' to list the bad blocks.\n");
+		log_fatal("Use 'snapraid -e fix' to recover them.\n");
+		log_fatal("Use 'snapraid -p bad scrub' to recheck after fixing.\n");
+	}
+
+	log_tag("summary:error_file:%u\n", error);
+	log_tag("summary:error_io:%u\n", io_error);
+	log_tag("summary:error_data:%u\n", silent_error);
+	if (error + silent_error + io_error == 0)
+		log_tag("summary:exit:ok\n");
+	else
+		log_tag("summary:exit:error\n");
+	log_flush();
+
+	handle_unmapping(handle, diskmax);
+
+	if (ret == -1)
+		return -1;
+
+	if (state->opt.expect_recoverable) {
+		if (error + silent_error + io_error == 0)
+			return -1;
+	} else {
+		if (error + silent_error + io_error != 0)
+			return -1;
+	}
+	return 0;
+}
+
 /**
  * Return a * b / c approximated to the upper value.
  */
@@ -725,18 +1306,195 @@ static uint32_t md(uint32_t a, uint32_t b, uint32_t c)
 	return v;
 }
 
+/**
+ * Number of block positions with the same time.
+ *
+ * There are only a few distinct times, one for each sync or scrub run,
+ * and counting them avoids to sort the time of every position.
+ */
+struct snapraid_age {
+	time_t time; /**< Time of the positions. */
+	block_off_t count; /**< Number of positions with such time. */
+
+	/* nodes for data structures */
+	tommy_hashdyn_node node;
+};
+
+static int age_compare_to_arg(const void* void_arg, const void* void_data)
+{
+	const time_t* arg = void_arg;
+	const struct snapraid_age* age = void_data;
+
+	return *arg != age->time;
+}
+
+static int age_compare(const void* void_a, const void* void_b)
+{
+	const struct snapraid_age* const* age_a = void_a;
+	const struct snapraid_age* const* age_b = void_b;
+
+	return time_compare(&(*age_a)->time, &(*age_b)->time);
+}
+
+static inline tommy_uint32_t age_hash(time_t time)
+{
+	return (tommy_uint32_t)tommy_inthash_u64((uint64_t)time);
+}
+
+struct age_collect_arg {
+	struct snapraid_age** map;
+	unsigned count;
+};
+
+static void age_collect(void* void_arg, void* void_age)
+{
+	struct age_collect_arg* arg = void_arg;
+
+	arg->map[arg->count++] = void_age;
+}
+
+/**
+ * Compute the limits of the SCRUB_AUTO plan.
+ * Return the number of blocks to scrub.
+ */
+static block_off_t scrub_limit(struct snapraid_state* state, struct snapraid_plan* ps, block_off_t blockmax, block_off_t countlimit, time_t recentlimit)
+{
+	block_off_t i;
+	block_off_t count;
+	tommy_hashdyn ageset;
+	struct snapraid_age** agemap;
+	struct snapraid_age* age;
+	struct age_collect_arg collect;
+	unsigned agemax;
+	unsigned a;
+
+	/* identify the time limit */
+	/* we count the blocks for each distinct time, and sort only the distinct times */
+	/* to identify the time limit for which we reach the quota */
+	/* this allow to process first the oldest blocks */
+	tommy_hashdyn_init(&ageset);
+
+	/* count the blocks of each time */
+	age = 0;
+	count = 0;
+	log_tag("block_count:%u\n", blockmax);
+	for (i = 0; i < blockmax; ++i) {
+		snapraid_info info = info_get(&state->infoarr, i);
+		time_t info_time;
+
+		/* skip unused blocks */
+		if (info == 0)
+			continue;
+
+		++count;
+
+		info_time = info_get_time(info);
+
+		/* consecutive blocks have likely the same time */
+		if (age == 0 || age->time != info_time) {
+			age = tommy_hashdyn_search(&ageset, age_compare_to_arg, &info_time, age_hash(info_time));
+			if (!age) {
+				age = malloc_nofail(sizeof(struct snapraid_age));
+				age->time = info_time;
+				age->count = 0;
+				tommy_hashdyn_insert(&ageset, &age->node, age, age_hash(info_time));
+			}
+		}
+
+		++age->count;
+	}
+
+	if (!count) {
+		/* LCOV_EXCL_START */
+		log_fatal("The array appears to be empty.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* sort the distinct times */
+	agemax = tommy_hashdyn_count(&ageset);
+	agemap = malloc_nofail(agemax * sizeof(struct snapraid_age*));
+	collect.map = agemap;
+	collect.count = 0;
+	tommy_hashdyn_foreach_arg(&ageset, age_collect, &collect);
+	qsort(agemap, agemax, sizeof(struct snapraid_age*), age_compare);
+
+	/* output the info map */
+	log_tag("info_count:%u\n", count);
+	for (a = 0; a < agemax; ++a)
+		log_tag("info_time:%" PRIu64 ":%u\n", (uint64_t)agemap[a]->time, agemap[a]->count);
+
+	/* compute the limits from count/recentlimit */
+	if (ps->plan == SCRUB_AUTO) {
+		block_off_t countprev;
+
+		/* no more than the full count */
+		if (countlimit > count)
+			countlimit = count;
+
+		/* decrease until we reach the specific recentlimit */
+		countprev = 0;
+		for (a = 0; a < agemax && agemap[a]->time <= recentlimit; ++a)
+			countprev += agemap[a]->count;
+		if (countlimit > countprev)
+			countlimit = countprev;
+
+		/* if there is something to scrub */
+		if (countlimit > 0) {
+			/* find the time of the last block to scrub, */
+			/* with countprev blocks with an older time */
+			countprev = 0;
+			a = 0;
+			while (countprev + agemap[a]->count < countlimit)
+				countprev += agemap[a++]->count;
+
+			/* get the most recent time we want to scrub */
+			ps->timelimit = agemap[a]->time;
+
+			/* count how many entries for this exact time we have to scrub */
+			/* if the blocks have all the same time, we end with countlimit == lastlimit */
+			ps->lastlimit = countlimit - countprev;
+		} else {
+			/* if nothing to scrub, disable also other limits */
+			ps->timelimit = 0;
+			ps->lastlimit = 0;
+		}
+
+		log_tag("count_limit:%u\n", countlimit);
+		log_tag("time_limit:%" PRIu64 "\n", (uint64_t)ps->timelimit);
+		log_tag("last_limit:%u\n", ps->lastlimit);
+	}
+
+	/* free the temp vectors */
+	free(agemap);
+	tommy_hashdyn_foreach(&ageset, free);
+	tommy_hashdyn_done(&ageset);
+
+	return countlimit;
+}
+
+/**
+ * Wait the specified number of seconds, or until interrupted.
+ */
+static void scrub_wait(unsigned seconds)
+{
+	while (seconds > 0 && !global_interrupt) {
+		sleep(1);
+		--seconds;
+	}
+}
+
 int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 {
 	block_off_t blockmax;
 	block_off_t countlimit;
-	block_off_t i;
-	block_off_t count;
-	time_t recentlimit;
+	block_off_t countdone;
+	time_t olderlimit;
 	int ret;
 	struct snapraid_parity_handle parity_handle[LEV_MAX];
 	struct snapraid_plan ps;
-	time_t* timemap;
 	unsigned error;
+	unsigned pass;
 	time_t now;
 	unsigned l;
 
@@ -745,6 +1503,8 @@ int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 
 	msg_progress("Initializing...\n");
 
+	state_index(state);
+
 	if ((plan == SCRUB_BAD || plan == SCRUB_NEW || plan == SCRUB_FULL)
 		&& olderthan >= 0) {
 		/* LCOV_EXCL_START */
@@ -753,11 +1513,26 @@ int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 		/* LCOV_EXCL_STOP */
 	}
 
+	if ((plan == SCRUB_BAD || plan == SCRUB_NEW || plan == SCRUB_FULL || state->opt.force_scrub_even)
+		&& state->opt.daemon) {
+		/* LCOV_EXCL_START */
+		log_fatal("You can specify --daemon only with a numeric percentage.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (state->opt.auditonly && state->opt.daemon) {
+		/* LCOV_EXCL_START */
+		log_fatal("You cannot use -a, --audit-only with --daemon, as the scrub time is not updated.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
 	blockmax = parity_allocated_size(state);
 
 	/* preinitialize to avoid warnings */
 	countlimit = 0;
-	recentlimit = 0;
+	olderlimit = 0;
 
 	ps.state = state;
 	if (state->opt.force_scrub_even) {
@@ -772,7 +1547,7 @@ int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 		/* scrub the specified amount of blocks */
 		ps.plan = SCRUB_AUTO;
 		countlimit = state->opt.force_scrub_at;
-		recentlimit = now;
+		olderlimit = 0;
 	} else {
 		ps.plan = SCRUB_AUTO;
 		if (plan >= 0) {
@@ -783,86 +1558,22 @@ int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 		}
 
 		if (olderthan >= 0) {
-			recentlimit = now - olderthan * 24 * 3600;
+			olderlimit = olderthan * 24 * 3600;
 		} else {
 			/* by default use a 10 day time limit */
-			recentlimit = now - 10 * 24 * 3600;
+			olderlimit = 10 * 24 * 3600;
 		}
 	}
 
-	/* identify the time limit */
-	/* we sort all the block times, and we identify the time limit for which we reach the quota */
-	/* this allow to process first the oldest blocks */
-	timemap = malloc_nofail(blockmax * sizeof(time_t));
+	/* in data-only mode the parity is not read */
+	if (state->opt.auditonly) {
+		scrub_limit(state, &ps, blockmax, countlimit, now - olderlimit);
 
-	/* copy the info in the temp vector */
-	count = 0;
-	log_tag("block_count:%u\n", blockmax);
-	for (i = 0; i < blockmax; ++i) {
-		snapraid_info info = info_get(&state->infoarr, i);
+		msg_progress("Scrubbing...\n");
 
-		/* skip unused blocks */
-		if (info == 0)
-			continue;
-
-		timemap[count++] = info_get_time(info);
-	}
-
-	if (!count) {
-		/* LCOV_EXCL_START */
-		log_fatal("The array appears to be empty.\n");
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
-
-	/* sort it */
-	qsort(timemap, count, sizeof(time_t), time_compare);
-
-	/* output the info map */
-	i = 0;
-	log_tag("info_count:%u\n", count);
-	while (i < count) {
-		unsigned j = i + 1;
-		while (j < count && timemap[i] == timemap[j])
-			++j;
-		log_tag("info_time:%" PRIu64 ":%u\n", (uint64_t)timemap[i], j - i);
-		i = j;
-	}
-
-	/* compute the limits from count/recentlimit */
-	if (ps.plan == SCRUB_AUTO) {
-		/* no more than the full count */
-		if (countlimit > count)
-			countlimit = count;
-
-		/* decrease until we reach the specific recentlimit */
-		while (countlimit > 0 && timemap[countlimit - 1] > recentlimit)
-			--countlimit;
-
-		/* if there is something to scrub */
-		if (countlimit > 0) {
-			/* get the most recent time we want to scrub */
-			ps.timelimit = timemap[countlimit - 1];
-
-			/* count how many entries for this exact time we have to scrub */
-			/* if the blocks have all the same time, we end with countlimit == lastlimit */
-			ps.lastlimit = 1;
-			while (countlimit > ps.lastlimit && timemap[countlimit - ps.lastlimit - 1] == ps.timelimit)
-				++ps.lastlimit;
-		} else {
-			/* if nothing to scrub, disable also other limits */
-			ps.timelimit = 0;
-			ps.lastlimit = 0;
-		}
-
-		log_tag("count_limit:%u\n", countlimit);
-		log_tag("time_limit:%" PRIu64 "\n", (uint64_t)ps.timelimit);
-		log_tag("last_limit:%u\n", ps.lastlimit);
+		return state_scrub_audit(state, blockmax, &ps);
 	}
 
-	/* free the temp vector */
-	free(timemap);
-
 	/* open the file for reading */
 	for (l = 0; l < state->level; ++l) {
 		ret = parity_open(&parity_handle[l], &state->parity[l], l, state->file_mode, state->block_size, state->opt.parity_limit_size);
@@ -874,14 +1585,36 @@ int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 		}
 	}
 
-	msg_progress("Scrubbing...\n");
-
 	error = 0;
 
-	ret = state_scrub_process(state, parity_handle, 0, blockmax, &ps, now);
-	if (ret == -1) {
-		++error;
-		/* continue, as we are already exiting */
+	pass = 0;
+	while (1) {
+		countdone = scrub_limit(state, &ps, blockmax, countlimit, now - olderlimit);
+
+		msg_progress("Scrubbing...\n");
+
+		ret = state_scrub_process(state, parity_handle, 0, blockmax, &ps, now);
+		if (ret == -1) {
+			++error;
+			/* continue, as we are already exiting */
+			break;
+		}
+
+		/* in daemon mode, continue with the next pass until interrupted */
+		if (!state->opt.daemon || global_interrupt)
+			break;
+
+		++pass;
+		if (state->opt.daemon_pass != 0 && pass >= state->opt.daemon_pass)
+			break;
+
+		/* if nothing was old enough, wait for the blocks to age */
+		if (countdone == 0) {
+			msg_progress("Waiting...\n");
+			scrub_wait(SCRUB_DAEMON_WAIT);
+		}
+
+		now = time(0);
 	}
 
 	for (l = 0; l < state->level; ++l) {
@@ -23,34 +23,91 @@
 /****************************************************************************/
 /* search */
 
-static void search_file(struct snapraid_state* state, const char* path, data_off_t size, int64_t mtime_sec, int mtime_nsec)
+static void search_file(tommy_list* list, const char* path, data_off_t size, int64_t mtime_sec, int mtime_nsec)
 {
 	struct snapraid_search_file* file;
-	tommy_uint32_t file_hash;
 
 	file = malloc_nofail(sizeof(struct snapraid_search_file));
 	file->path = strdup_nofail(path);
 	file->size = size;
 	file->mtime_sec = mtime_sec;
 	file->mtime_nsec = mtime_nsec;
+	file->f = -1;
+	file->hash_valid = 0;
+	file->hash = 0;
+	file->prevhash = 0;
 
-	file_hash = file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec);
-
-	tommy_hashdyn_insert(&state->searchset, &file->node, file, file_hash);
+	/* the node is moved to the searchset after the directory walk */
+	tommy_list_insert_tail(list, &file->node, file);
 }
 
 void search_file_free(struct snapraid_search_file* file)
 {
+	/* at this point we don't care about errors */
+	if (file->f != -1)
+		close(file->f);
 	free(file->path);
+	free(file->hash_valid);
+	free(file->hash);
+	free(file->prevhash);
 	free(file);
 }
 
+/**
+ * Read a block of a search file.
+ * The handle is kept open for the next blocks, closing the one of the previous file.
+ */
+static void search_file_read(struct snapraid_state* state, struct snapraid_search_file* file, unsigned char* buffer, unsigned read_size, data_off_t offset)
+{
+	const char* path = file->path;
+	ssize_t ret;
+
+	if (file->f == -1) {
+		struct snapraid_search_file* prev = state->search_open;
+
+		if (prev != 0) {
+			ret = close(prev->f);
+			if (ret != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error closing file '%s'. %s.\n", prev->path, strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			prev->f = -1;
+			state->search_open = 0;
+		}
+
+		file->f = open(path, O_RDONLY | O_BINARY);
+		if (file->f == -1) {
+			/* LCOV_EXCL_START */
+			if (errno == ENOENT) {
+				log_fatal("DANGER! file '%s' disappeared.\n", path);
+				log_fatal("If you moved it, please rerun the same command.\n");
+			} else {
+				log_fatal("Error opening file '%s'. %s.\n", path, strerror(errno));
+			}
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		state->search_open = file;
+	}
+
+	ret = pread(file->f, buffer, read_size, offset);
+	if (ret < 0 || (unsigned)ret != read_size) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reading file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
 struct search_file_compare_arg {
-	const struct snapraid_state* state;
+	struct snapraid_state* state;
 	const struct snapraid_block* block;
 	const struct snapraid_file* file;
 	unsigned char* buffer;
-	data_off_t offset;
+	block_off_t file_pos;
 	unsigned read_size;
 	int prevhash;
 };
@@ -58,12 +115,12 @@ struct search_file_compare_arg {
 int search_file_compare(const void* void_arg, const void* void_data)
 {
 	const struct search_file_compare_arg* arg = void_arg;
-	const struct snapraid_search_file* file = void_data;
-	const struct snapraid_state* state = arg->state;
-	unsigned char buffer_hash[HASH_MAX];
-	const char* path = file->path;
-	int f;
-	ssize_t ret;
+	/* the search file is updated with the hashes computed */
+	struct snapraid_search_file* file = (void*)void_data;
+	struct snapraid_state* state = arg->state;
+	block_off_t blockmax;
+	unsigned char* hash;
+	unsigned flag;
 
 	/* compare file info */
 	if (arg->file->size != file->size)
@@ -75,44 +132,40 @@ int search_file_compare(const void* void_arg, const void* void_data)
 	if (arg->file->mtime_nsec != file->mtime_nsec)
 		return -1;
 
-	/* read the block and compare the hash */
-	f = open(path, O_RDONLY | O_BINARY);
-	if (f == -1) {
-		/* LCOV_EXCL_START */
-		if (errno == ENOENT) {
-			log_fatal("DANGER! file '%s' disappeared.\n", path);
-			log_fatal("If you moved it, please rerun the same command.\n");
-		} else {
-			log_fatal("Error opening file '%s'. %s.\n", path, strerror(errno));
-		}
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
+	/* allocate the hashes only for the files really compared */
+	blockmax = (file->size + state->block_size - 1) / state->block_size;
+	if (!file->hash_valid)
+		file->hash_valid = calloc_nofail(blockmax, 1);
+
+	if (arg->prevhash) {
+		if (!file->prevhash)
+			file->prevhash = malloc_nofail((size_t)blockmax * HASH_MAX);
+		hash = file->prevhash + (size_t)arg->file_pos * HASH_MAX;
+		flag = SEARCH_PREVHASH;
+	} else {
+		if (!file->hash)
+			file->hash = malloc_nofail((size_t)blockmax * HASH_MAX);
+		hash = file->hash + (size_t)arg->file_pos * HASH_MAX;
+		flag = SEARCH_HASH;
 	}
 
-	ret = pread(f, arg->buffer, arg->read_size, arg->offset);
-	if (ret < 0 || (unsigned)ret != arg->read_size) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error reading file '%s'. %s.\n", path, strerror(errno));
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
+	/* if the hash is already known to differ, don't read the block again */
+	if ((file->hash_valid[arg->file_pos] & flag) != 0
+		&& memcmp(hash, arg->block->hash, BLOCK_HASH_SIZE) != 0)
+		return -1;
 
-	ret = close(f);
-	if (ret != 0) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error closing file '%s'. %s.\n", path, strerror(errno));
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
+	/* read the block and compare the hash */
+	search_file_read(state, file, arg->buffer, arg->read_size, state->block_size * (data_off_t)arg->file_pos);
 
 	/* compute the hash */
 	if (arg->prevhash)
-		memhash(state->prevhash, state->prevhashseed, buffer_hash, arg->buffer, arg->read_size);
+		memhash(state->prevhash, state->prevhashseed, hash, arg->buffer, arg->read_size);
 	else
-		memhash(state->hash, state->hashseed, buffer_hash, arg->buffer, arg->read_size);
+		memhash(state->hash, state->hashseed, hash, arg->buffer, arg->read_size);
+	file->hash_valid[arg->file_pos] |= flag;
 
 	/* check if the hash is matching */
-	if (memcmp(buffer_hash, arg->block->hash, BLOCK_HASH_SIZE) != 0)
+	if (memcmp(hash, arg->block->hash, BLOCK_HASH_SIZE) != 0)
 		return -1;
 
 	if (arg->read_size != state->block_size) {
@@ -133,10 +186,15 @@ int state_search_fetch(struct snapraid_state* state, int prevhash, struct snapra
 	arg.block = missing_block;
 	arg.file = missing_file;
 	arg.buffer = buffer;
-	arg.offset = state->block_size * (data_off_t)missing_file_pos;
+	arg.file_pos = missing_file_pos;
 	arg.read_size = file_block_size(missing_file, missing_file_pos, state->block_size);
 	arg.prevhash = prevhash;
 
+	/* try first the file already open, likely the one matching the previous block */
+	file = state->search_open;
+	if (file != 0 && search_file_compare(&arg, file) == 0)
+		return 0;
+
 	file_hash = file_stamp_hash(arg.file->size, arg.file->mtime_sec, arg.file->mtime_nsec);
 
 	/* search in the hashtable, and also check if the data matches the hash */
@@ -148,7 +206,7 @@ int state_search_fetch(struct snapraid_state* state, int prevhash, struct snapra
 	return 0;
 }
 
-static void search_dir(struct snapraid_state* state, struct snapraid_disk* disk, const char* dir, const char* sub)
+static void search_dir(struct snapraid_state* state, tommy_list* list, struct snapraid_disk* disk, const char* dir, const char* sub)
 {
 	DIR* d;
 
@@ -231,7 +289,7 @@ static void search_dir(struct snapraid_state* state, struct snapraid_disk* disk,
 
 		if (S_ISREG(st.st_mode)) {
 			if (disk == 0 || filter_path(&state->filterlist, &reason, disk->name, sub_next) == 0) {
-				search_file(state, path_next, st.st_size, st.st_mtime, STAT_NSEC(&st));
+				search_file(list, path_next, st.st_size, st.st_mtime, STAT_NSEC(&st));
 			} else {
 				msg_verbose("Excluding link '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
 			}
@@ -239,7 +297,7 @@ static void search_dir(struct snapraid_state* state, struct snapraid_disk* disk,
 			if (disk == 0 || filter_subdir(&state->filterlist, &reason, disk->name, sub_next) == 0) {
 				pathslash(path_next, sizeof(path_next));
 				pathslash(sub_next, sizeof(sub_next));
-				search_dir(state, disk, path_next, sub_next);
+				search_dir(state, list, disk, path_next, sub_next);
 			} else {
 				msg_verbose("Excluding directory '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
 			}
@@ -254,9 +312,28 @@ static void search_dir(struct snapraid_state* state, struct snapraid_disk* disk,
 	}
 }
 
+/**
+ * Move the files found in the searchset.
+ */
+static void search_insert(struct snapraid_state* state, tommy_list* list)
+{
+	tommy_node* i;
+
+	i = tommy_list_head(list);
+	while (i) {
+		struct snapraid_search_file* file = i->data;
+
+		/* the node is reused by the searchset, so get the next before */
+		i = i->next;
+
+		tommy_hashdyn_insert(&state->searchset, &file->node, file, file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec));
+	}
+}
+
 void state_search(struct snapraid_state* state, const char* dir)
 {
 	char path[PATH_MAX];
+	tommy_list list;
 
 	msg_progress("Importing...\n");
 
@@ -264,24 +341,79 @@ void state_search(struct snapraid_state* state, const char* dir)
 	pathimport(path, sizeof(path), dir);
 	pathslash(path, sizeof(path));
 
-	search_dir(state, 0, path, "");
+	tommy_list_init(&list);
+
+	search_dir(state, &list, 0, path, "");
+
+	search_insert(state, &list);
+}
+
+/**
+ * Search context of a data disk.
+ */
+struct snapraid_search_disk {
+	struct snapraid_state* state;
+	struct snapraid_disk* disk;
+	tommy_list list; /**< Files found in the disk. */
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+static void* search_disk_thread(void* arg)
+{
+	struct snapraid_search_disk* search_disk = arg;
+	struct snapraid_disk* disk = search_disk->disk;
+
+	search_dir(search_disk->state, &search_disk->list, disk, disk->dir, "");
+
+	return 0;
 }
 
 void state_search_array(struct snapraid_state* state)
 {
+	struct snapraid_search_disk* search_map;
+	unsigned diskmax;
+	unsigned d;
 	tommy_node* i;
 
+	diskmax = tommy_list_count(&state->disklist);
+	search_map = malloc_nofail(diskmax * sizeof(struct snapraid_search_disk));
+
 	/* import from all the disks */
-	for (i = state->disklist; i != 0; i = i->next) {
+	for (i = state->disklist, d = 0; i != 0; i = i->next, ++d) {
 		struct snapraid_disk* disk = i->data;
 
+		search_map[d].state = state;
+		search_map[d].disk = disk;
+		tommy_list_init(&search_map[d].list);
+
 		/* skip data disks that are not accessible */
 		if (disk->skip_access)
 			continue;
 
 		msg_progress("Searching disk %s...\n", disk->name);
 
-		search_dir(state, disk, disk->dir, "");
+#if HAVE_PTHREAD
+		thread_create(&search_map[d].thread, 0, search_disk_thread, &search_map[d]);
+#else
+		search_disk_thread(&search_map[d]);
+#endif
 	}
-}
 
+	/* insert the files in the same order of the disks */
+	for (i = state->disklist, d = 0; i != 0; i = i->next, ++d) {
+		struct snapraid_disk* disk = i->data;
+
+		if (disk->skip_access)
+			continue;
+
+#if HAVE_PTHREAD
+		thread_join(search_map[d].thread, 0);
+#endif
+
+		search_insert(state, &search_map[d].list);
+	}
+
+	free(search_map);
+}
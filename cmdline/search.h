@@ -24,6 +24,12 @@
 /****************************************************************************/
 /* search */
 
+/**
+ * Flags of the hashes already computed for a block of a search file.
+ */
+#define SEARCH_HASH 1
+#define SEARCH_PREVHASH 2
+
 /**
  * Search file.
  * File used to search for moved data.
@@ -34,6 +40,10 @@ struct snapraid_search_file {
 	data_off_t size;
 	int64_t mtime_sec;
 	int mtime_nsec;
+	int f; /**< Handle of the file kept open between reads. -1 if closed. */
+	unsigned char* hash_valid; /**< For each block, SEARCH_HASH_* flags of the hashes already computed. 0 if none. */
+	unsigned char* hash; /**< Hashes of the blocks already computed. */
+	unsigned char* prevhash; /**< Previous hashes of the blocks already computed. */
 
 	/* nodes for data structures */
 	tommy_node node;
@@ -57,6 +67,7 @@ void state_search(struct snapraid_state* state, const char* dir);
 
 /**
  * Import files from all the data disks.
+ * The disks are read in parallel, one thread for each disk.
  */
 void state_search_array(struct snapraid_state* state);
 
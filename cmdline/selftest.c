@@ -153,6 +153,23 @@ static struct hash_test_vector TEST_SPOOKY2[] = {
 	{ 0, 0, { 0 } }
 };
 
+/**
+ * Test vectors for XXH3_128bits_withSeed
+ */
+static struct hash_test_vector TEST_XXH3[] = {
+#include "xxh3test.c"
+	{ 0, 0, { 0 } }
+};
+
+/**
+ * Test vector for XXH3 with a buffer long enough to use the block loop.
+ * Buffer filled with i * 131 + i / 256.
+ */
+#define HASH_TEST_XXH3_LONG 5000
+static const unsigned char TEST_XXH3_LONG[HASH_MAX] = {
+	0xb6, 0xa4, 0x8d, 0xdf, 0x2c, 0x11, 0x02, 0x09, 0xa7, 0xdd, 0x35, 0x43, 0xda, 0x63, 0x79, 0xad
+};
+
 #define HASH_TEST_MAX 512 /* tests are never longer than 512 bytes */
 
 static void test_hash(void)
@@ -249,10 +266,91 @@ static void test_hash(void)
 		}
 	}
 
+	for (i = 0; TEST_XXH3[i].data; ++i) {
+		unsigned char digest[HASH_MAX];
+		memcpy(buffer_aligned, TEST_XXH3[i].data, TEST_XXH3[i].len);
+		memhash(HASH_XXH3, seed_aligned, digest, buffer_aligned, TEST_XXH3[i].len);
+		if (memcmp(digest, TEST_XXH3[i].digest, HASH_MAX) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed XXH3 test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(buffer_alloc);
+
+	buffer_aligned = malloc_nofail_align(HASH_TEST_XXH3_LONG, &buffer_alloc);
+	for (i = 0; i < HASH_TEST_XXH3_LONG; ++i)
+		buffer_aligned[i] = i * 131 + i / 256;
+
+	{
+		unsigned char digest[HASH_MAX];
+		memhash(HASH_XXH3, seed_aligned, digest, buffer_aligned, HASH_TEST_XXH3_LONG);
+		if (memcmp(digest, TEST_XXH3_LONG, HASH_MAX) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed XXH3 long test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
 	free(buffer_alloc);
 	free(seed_alloc);
 }
 
+#define HASH_MULTI_COUNT 9 /* more blocks than any multi block implementation */
+#define HASH_MULTI_SIZE 1024
+
+static void test_hash_multi(void)
+{
+	static const unsigned KIND[] = { HASH_MURMUR3, HASH_SPOOKY2, HASH_METRO, HASH_XXH3, 0 };
+	static const size_t SIZE[] = { 0, 1, 15, 16, 95, 96, 97, 200, HASH_MULTI_SIZE };
+	unsigned char* buffer_aligned;
+	void* buffer_alloc;
+	unsigned char seed[HASH_MAX];
+	unsigned char digest[HASH_MULTI_COUNT][HASH_MAX];
+	unsigned char digest_multi[HASH_MULTI_COUNT][HASH_MAX];
+	const void* src[HASH_MULTI_COUNT];
+	void* dst[HASH_MULTI_COUNT];
+	unsigned i, k, s, count;
+
+	buffer_aligned = malloc_nofail_align(HASH_MULTI_COUNT * HASH_MULTI_SIZE, &buffer_alloc);
+
+	for (i = 0; i < HASH_MULTI_COUNT * HASH_MULTI_SIZE; ++i)
+		buffer_aligned[i] = (i * 2654435761U) >> 24;
+	for (i = 0; i < HASH_MAX; ++i)
+		seed[i] = i * 17 + 5;
+
+	for (i = 0; i < HASH_MULTI_COUNT; ++i) {
+		src[i] = buffer_aligned + i * HASH_MULTI_SIZE;
+		dst[i] = digest_multi[i];
+	}
+
+	/* the multi block hash must be equal at the single block one */
+	for (k = 0; KIND[k] != 0; ++k) {
+		for (s = 0; s < sizeof(SIZE) / sizeof(SIZE[0]); ++s) {
+			for (i = 0; i < HASH_MULTI_COUNT; ++i)
+				memhash(KIND[k], seed, digest[i], src[i], SIZE[s]);
+
+			for (count = 1; count <= HASH_MULTI_COUNT; ++count) {
+				memset(digest_multi, 0, sizeof(digest_multi));
+
+				memhash_multi(KIND[k], seed, dst, src, count, SIZE[s]);
+
+				if (memcmp(digest, digest_multi, count * HASH_MAX) != 0) {
+					/* LCOV_EXCL_START */
+					log_fatal("Failed multi block %s test\n", hash_config_name(KIND[k]));
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+			}
+		}
+	}
+
+	free(buffer_alloc);
+}
+
 struct crc_test_vector {
 	const char* data;
 	int len;
@@ -283,9 +381,15 @@ static struct crc_test_vector TEST_CRC32C[] = {
 	{ 0, 0, 0 }
 };
 
+/**
+ * Size of the buffer used to test long CRC32C.
+ */
+#define CRC32C_LONG_SIZE (4 * 4096 + 3 * 256 + 13)
+
 static void test_crc32c(void)
 {
 	unsigned i;
+	unsigned char* buffer;
 
 	for (i = 0; TEST_CRC32C[i].data; ++i) {
 		uint32_t digest;
@@ -301,6 +405,28 @@ static void test_crc32c(void)
 			/* LCOV_EXCL_STOP */
 		}
 	}
+
+	/* long buffers exercise the multi stream implementation */
+	buffer = malloc_nofail(CRC32C_LONG_SIZE);
+	for (i = 0; i < CRC32C_LONG_SIZE; ++i)
+		buffer[i] = i * 131 + i / 256;
+
+	for (i = 0; i < CRC32C_LONG_SIZE; i += 1 + i / 16) {
+		uint32_t digest;
+		uint32_t digest_gen;
+
+		digest = crc32c(i, buffer + i % 8, CRC32C_LONG_SIZE - i);
+		digest_gen = crc32c_gen(i, buffer + i % 8, CRC32C_LONG_SIZE - i);
+
+		if (digest != digest_gen) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed CRC32C long test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(buffer);
 }
 
 /**
@@ -308,6 +434,298 @@ static void test_crc32c(void)
  */
 #define TOMMY_SIZE 256
 
+struct filter_test_vector {
+	const char* pattern;
+	const char* sub;
+	int result;
+};
+
+/**
+ * Filter test vectors.
+ *
+ * Each pattern is used as a single exclusion.
+ */
+static struct filter_test_vector TEST_FILTER[] = {
+	{ "*.tmp", "file.tmp", -1 },
+	{ "*.tmp", "dir/file.tmp", -1 },
+	{ "*.tmp", "file.tmpx", 0 },
+	{ "*.tmp", "file.tmp/file", 0 },
+	{ "tmp*", "tmpfile", -1 },
+	{ "tmp*", "dir/tmp", -1 },
+	{ "tmp*", "xtmp", 0 },
+	{ "*", "file", -1 },
+	{ "file", "dir/file", -1 },
+	{ "file", "dir/file2", 0 },
+	{ "f?le", "dir/file", -1 },
+	{ "f[aeiou]le", "dir/fxle", 0 },
+	{ "/file", "file", -1 },
+	{ "/file", "dir/file", 0 },
+	{ "/dir/file", "dir/file", -1 },
+	{ "/dir/file", "other/dir/file", 0 },
+	{ "/f*", "file", -1 },
+	{ "/f*", "f/file", 0 },
+	{ "/dir/f*", "dir/file", -1 },
+	{ "/*.tmp", "file.tmp", -1 },
+	{ "/*.tmp", "dir/file.tmp", 0 },
+	{ "dir/", "dir/file", -1 },
+	{ "dir/", "dir", 0 },
+	{ "d*/", "dir/file", -1 },
+	{ "*r/", "a/dir/file", -1 },
+	{ "*r/", "a/dirx/file", 0 },
+	{ "/dir/", "dir/file", -1 },
+	{ "/dir/", "a/dir/file", 0 },
+	{ "/a/d*/", "a/dir/file", -1 },
+	{ 0, 0, 0 }
+};
+
+#define MEMDIFF_SIZE (4096 + 3 * 32 + 7)
+
+static const char* test_hex(char* dst, const unsigned char* src, size_t size)
+{
+	static const char HEX[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		dst[i * 2] = HEX[src[i] >> 4];
+		dst[i * 2 + 1] = HEX[src[i] & 0xF];
+	}
+	dst[size * 2] = 0;
+
+	return dst;
+}
+
+static void test_sha256(void)
+{
+	static const char* TEST_SHA256[] = {
+		"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+		"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+		0, 0
+	};
+	unsigned char digest[SHA256_SIZE];
+	unsigned char key[131];
+	char hex[SHA256_SIZE * 2 + 1];
+	const char* data;
+	unsigned i;
+
+	for (i = 0; TEST_SHA256[i]; i += 2) {
+		sha256(digest, TEST_SHA256[i], strlen(TEST_SHA256[i]));
+		if (strcmp(test_hex(hex, digest, SHA256_SIZE), TEST_SHA256[i + 1]) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed SHA256 test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	/* RFC 4231, test case 2 */
+	data = "what do ya want for nothing?";
+	hmac_sha256(digest, "Jefe", 4, data, strlen(data));
+	if (strcmp(test_hex(hex, digest, SHA256_SIZE), "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843") != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed HMAC-SHA256 test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* RFC 4231, test case 6, with a key longer than the block */
+	memset(key, 0xaa, sizeof(key));
+	data = "Test Using Larger Than Block-Size Key - Hash Key First";
+	hmac_sha256(digest, key, sizeof(key), data, strlen(data));
+	if (strcmp(test_hex(hex, digest, SHA256_SIZE), "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54") != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed HMAC-SHA256 test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+static void test_memdiff(void)
+{
+	unsigned i;
+	unsigned char* data1;
+	unsigned char* data2;
+
+	data1 = malloc_nofail(MEMDIFF_SIZE);
+	data2 = malloc_nofail(MEMDIFF_SIZE);
+
+	memset(data1, 0, MEMDIFF_SIZE);
+	memset(data2, 0, MEMDIFF_SIZE);
+
+	/* different sizes and offsets exercise both the SIMD and the tail loops */
+	for (i = 0; i < MEMDIFF_SIZE; i += 1 + i / 8) {
+		unsigned size = MEMDIFF_SIZE - i;
+
+		if (!memiszero(data1 + i, size) || memdiff(data1 + i, data2 + i, size) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed MEMDIFF zero test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* a single bit set in the last byte */
+		data1[MEMDIFF_SIZE - 1] = 0x80;
+		if (memiszero(data1 + i, size) || memdiff(data1 + i, data2 + i, size) != 1) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed MEMDIFF bit test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		data1[MEMDIFF_SIZE - 1] = 0;
+	}
+
+	/* all the bits different */
+	memset(data2, 0xFF, MEMDIFF_SIZE);
+	for (i = 0; i < MEMDIFF_SIZE; i += 1 + i / 8) {
+		unsigned size = MEMDIFF_SIZE - i;
+
+		if (memdiff(data1 + i, data2 + i, size) != size * 8) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed MEMDIFF full test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(data1);
+	free(data2);
+}
+
+static void test_filter(void)
+{
+	unsigned i;
+
+	for (i = 0; TEST_FILTER[i].pattern; ++i) {
+		struct snapraid_filter* filter;
+		tommy_list filterlist;
+		int ret;
+
+		filter = filter_alloc_file(-1, TEST_FILTER[i].pattern);
+		if (!filter) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed FILTER test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		tommy_list_init(&filterlist);
+		tommy_list_insert_tail(&filterlist, &filter->node, filter);
+
+		ret = filter_path(&filterlist, 0, "disk", TEST_FILTER[i].sub);
+
+		filter_free(filter);
+
+		if (ret != TEST_FILTER[i].result) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed FILTER test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+}
+
+static void test_info(void)
+{
+	struct snapraid_infoarr infoarr;
+	time_t base = 1000000000;
+	unsigned i;
+
+	/* with a granularity of one second, only 8191 seconds fit in the packed info */
+	infoarr_init(&infoarr);
+	infoarr_granularity(&infoarr, 1);
+	infoarr_base(&infoarr, base);
+
+	for (i = 0; i < 64; ++i)
+		info_set(&infoarr, i, info_make(base + i * 8, i % 2, 0, i % 3 == 0));
+
+	if (infoarr.granularity != 1 || infoarr.array.element_size != sizeof(uint16_t)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed INFO pack test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* a bad block at a position never synced has no time, and it's stored without one */
+	info_set(&infoarr, 100, info_set_bad(info_get(&infoarr, 100)));
+
+	if (infoarr.granularity != 1
+		|| info_get(&infoarr, 100) != info_set_bad(0)
+		|| info_get_time(info_get(&infoarr, 100)) != 0
+		|| info_get(&infoarr, 99) != 0
+	) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed INFO bad test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* a time out of the range converts the array to the exact times */
+	info_set(&infoarr, 64, info_make(base + INFO_PACKED_MAX * 8, 0, 0, 0));
+
+	if (infoarr.granularity != 0 || infoarr.array.element_size != sizeof(snapraid_info)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed INFO unpack test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	for (i = 0; i < 64; ++i) {
+		if (info_get(&infoarr, i) != info_make(base + i * 8, i % 2, 0, i % 3 == 0)) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed INFO unpack test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	if (info_get(&infoarr, 64) != info_make(base + INFO_PACKED_MAX * 8, 0, 0, 0)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed INFO unpack test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	infoarr_done(&infoarr);
+
+	/* a bad block without time as first info doesn't set the base */
+	infoarr_init(&infoarr);
+	infoarr_granularity(&infoarr, 1);
+
+	info_set(&infoarr, 0, info_set_bad(0));
+	info_set(&infoarr, 1, info_make(base, 0, 0, 0));
+
+	if (infoarr.granularity != 1
+		|| info_get(&infoarr, 0) != info_set_bad(0)
+		|| info_get(&infoarr, 1) != info_make(base, 0, 0, 0)
+	) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed INFO bad test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	infoarr_done(&infoarr);
+
+	/* a time older than the base also converts the array */
+	infoarr_init(&infoarr);
+	infoarr_granularity(&infoarr, 1);
+
+	info_set(&infoarr, 0, info_make(base, 0, 0, 0));
+	info_set(&infoarr, 1, info_make(base - 8, 0, 0, 0));
+
+	if (infoarr.granularity != 0
+		|| info_get(&infoarr, 0) != info_make(base, 0, 0, 0)
+		|| info_get(&infoarr, 1) != info_make(base - 8, 0, 0, 0)
+	) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed INFO unpack test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	infoarr_done(&infoarr);
+}
+
 static int tommy_test_search(const void* arg, const void* obj)
 {
 	return arg != obj;
@@ -419,7 +837,13 @@ static void test_tommy(void)
 
 	tommy_hashdyn_init(&hashdyn);
 
-	for (i = 0; i < TOMMY_SIZE; ++i)
+	for (i = 0; i < TOMMY_SIZE / 4; ++i)
+		tommy_hashdyn_insert(&hashdyn, &node[i], &node[i], i % 64);
+
+	/* grow more than one step with elements already inside */
+	tommy_hashdyn_reserve(&hashdyn, TOMMY_SIZE * 8);
+
+	for (i = TOMMY_SIZE / 4; i < TOMMY_SIZE; ++i)
 		tommy_hashdyn_insert(&hashdyn, &node[i], &node[i], i % 64);
 
 	if (tommy_hashdyn_count(&hashdyn) != TOMMY_SIZE) {
@@ -580,7 +1004,12 @@ void selftest(void)
 	}
 
 	test_hash();
+	test_hash_multi();
 	test_crc32c();
+	test_sha256();
+	test_memdiff();
+	test_filter();
+	test_info();
 	test_tommy();
 	if (raid_selftest() != 0) {
 		/* LCOV_EXCL_START */
@@ -636,5 +1065,29 @@ void selftest(void)
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
+	if (raid_test_ext(8, 256) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed extended Cauchy test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+	if (raid_test_engine() != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed RAID engine test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+	if (raid_test_verify(RAID_MODE_VANDERMONDE, 8, 4096) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed VERIFY Vandermonde test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+	if (raid_test_verify(RAID_MODE_CAUCHY, 8, 4096) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed VERIFY Cauchy test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
 }
 
@@ -0,0 +1,478 @@
+/*
+ * Copyright (C) 2026 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "portable.h"
+
+#include "support.h"
+#include "util.h"
+#include "elem.h"
+#include "state.h"
+
+/****************************************************************************/
+/* serve */
+
+/*
+ * The protocol is a single exchange for each connection.
+ * The client sends the command name terminated by a newline.
+ * The daemon sends the output of the command, followed by a 0 byte
+ * and by the exit code of the command, and then closes the connection.
+ */
+
+#define SERVE_COMMAND_MAX 64 /**< Max length of a command. */
+#define SERVE_WAIT 1 /**< Seconds waited for a connection before checking for interruption. */
+#define SERVE_TIMEOUT 10 /**< Seconds waited for the command of a client before dropping it. */
+
+#if HAVE_SERVE
+/**
+ * Identity of a file, used to detect if it changed.
+ */
+struct serve_stamp {
+	uint64_t size;
+	int64_t mtime_sec;
+	int mtime_nsec;
+	uint64_t inode;
+};
+
+/**
+ * Context of the daemon.
+ */
+struct serve_context {
+	struct snapraid_state* state; /**< State kept in memory. */
+	const char* conf; /**< Configuration file. */
+	struct snapraid_option opt; /**< Options of the command line, used at each reload. */
+	tommy_list* filterlist_disk; /**< Disk filters of the command line, used at each reload. */
+	struct serve_stamp content; /**< Content file the state comes from. */
+	struct serve_stamp journal; /**< Journal of the content file the state comes from. */
+	int dirty; /**< If the state was changed by a command, and it has to be reloaded. */
+};
+
+static void serve_stamp_get(struct serve_stamp* stamp, const char* path)
+{
+	struct stat st;
+
+	/* clear also the padding, as the stamps are compared with memcmp() */
+	memset(stamp, 0, sizeof(*stamp));
+
+	if (stat(path, &st) != 0)
+		return;
+
+	stamp->size = st.st_size;
+	stamp->mtime_sec = st.st_mtime;
+	stamp->mtime_nsec = STAT_NSEC(&st);
+	stamp->inode = st.st_ino;
+}
+
+/**
+ * Get the identity of the first content file and of its journal.
+ */
+static void serve_stamp(struct snapraid_state* state, struct serve_stamp* content, struct serve_stamp* journal)
+{
+	char path[PATH_MAX];
+	const char* file = ((struct snapraid_content*)tommy_list_head(&state->contentlist)->data)->content;
+
+	serve_stamp_get(content, file);
+
+	pathprint(path, sizeof(path), "%s.journal", file);
+	serve_stamp_get(journal, path);
+}
+
+/**
+ * Reload the state from the content file.
+ */
+static void serve_reload(struct serve_context* ctx)
+{
+	struct snapraid_state* state = ctx->state;
+	const char* command;
+
+	command = state->command;
+
+	state_done(state);
+	state_init(state);
+	state_config(state, ctx->conf, command, &ctx->opt, ctx->filterlist_disk);
+	state_read(state);
+}
+
+/**
+ * Send all the data, retrying on partial writes.
+ */
+static int serve_send(int f, const void* data, size_t size)
+{
+	const char* ptr = data;
+
+	while (size > 0) {
+		ssize_t ret = write(f, ptr, size);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			if (errno == EINTR)
+				continue;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+		ptr += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Read the command line sent by the client.
+ * The client sends nothing after the newline, so it's read in chunks,
+ * usually with a single call.
+ */
+static int serve_recv(int f, char* command, size_t size)
+{
+	size_t len = 0;
+	char* eol;
+
+	while (len + 1 < size) {
+		ssize_t ret = recv(f, command + len, size - len - 1, 0);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			if (errno == EINTR)
+				continue;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+		if (ret == 0)
+			break;
+		len += ret;
+		if (memchr(command + len - ret, '\n', ret) != 0)
+			break;
+	}
+
+	command[len] = 0;
+
+	eol = strchr(command, '\n');
+	if (eol)
+		*eol = 0;
+
+	return 0;
+}
+
+/**
+ * Run a command with the output redirected to the client.
+ * Return the exit code of the command.
+ */
+static int serve_run(struct snapraid_state* state, const char* command, int f, int* dirty)
+{
+	int ret;
+	int out;
+	int err;
+
+	fflush(stdout);
+	fflush(stderr);
+	out = dup(1);
+	err = dup(2);
+	dup2(f, 1);
+	dup2(f, 2);
+
+	if (strcmp(command, "status") == 0) {
+		state_status(state);
+		ret = EXIT_SUCCESS;
+	} else if (strcmp(command, "list") == 0) {
+		state_list(state);
+		ret = EXIT_SUCCESS;
+	} else if (strcmp(command, "dup") == 0) {
+		state_dup(state);
+		ret = EXIT_SUCCESS;
+	} else if (strcmp(command, "diff") == 0) {
+		/* the scan updates the state with the changes found, reload it at the next command */
+		*dirty = 1;
+		ret = state_diff(state) > 0 ? EXIT_SYNC_NEEDED : EXIT_SUCCESS;
+	} else {
+		log_fatal("The daemon cannot run the '%s' command\n", command);
+		ret = EXIT_FAILURE;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(out, 1);
+	dup2(err, 2);
+	close(out);
+	close(err);
+
+	return ret;
+}
+
+/**
+ * Serve a single connection.
+ */
+static void serve_client(struct serve_context* ctx, int f)
+{
+	struct snapraid_state* state = ctx->state;
+	char command[SERVE_COMMAND_MAX];
+	unsigned char trailer[2];
+	struct serve_stamp content_now;
+	struct serve_stamp journal_now;
+	int lock = -1;
+	int ret;
+
+	if (serve_recv(f, command, sizeof(command)) != 0) {
+		/* LCOV_EXCL_START */
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			log_fatal("WARNING! Timeout reading from the client.\n");
+		else
+			log_fatal("WARNING! Error reading from the client. %s.\n", strerror(errno));
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	log_tag("serve:command:%s\n", command);
+
+#if HAVE_LOCKFILE
+	/* hold the lock only while running the command, to allow sync between commands */
+	if (state->lockfile[0]) {
+		lock = lock_lock(state->lockfile);
+		if (lock == -1) {
+			/* LCOV_EXCL_START */
+			static const char busy[] = "SnapRAID is already in use!\n";
+			trailer[0] = 0;
+			trailer[1] = EXIT_FAILURE;
+			serve_send(f, busy, sizeof(busy) - 1);
+			serve_send(f, trailer, 2);
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+#endif
+
+	/* reload the state if the content file was updated by another process */
+	serve_stamp(state, &content_now, &journal_now);
+	if (ctx->dirty || memcmp(&content_now, &ctx->content, sizeof(content_now)) != 0 || memcmp(&journal_now, &ctx->journal, sizeof(journal_now)) != 0) {
+		serve_reload(ctx);
+		ctx->content = content_now;
+		ctx->journal = journal_now;
+		ctx->dirty = 0;
+	}
+
+	ret = serve_run(state, command, f, &ctx->dirty);
+
+#if HAVE_LOCKFILE
+	if (lock != -1 && lock_unlock(lock) == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing the lock file '%s'. %s.\n", state->lockfile, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+#else
+	(void)lock;
+#endif
+
+	trailer[0] = 0;
+	trailer[1] = ret;
+	if (serve_send(f, trailer, 2) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error writing to the client. %s.\n", strerror(errno));
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+static int serve_address(struct sockaddr_un* addr, const char* path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) + 1 > sizeof(addr->sun_path)) {
+		/* LCOV_EXCL_START */
+		log_fatal("The socket path '%s' is too long\n", path);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+	pathcpy(addr->sun_path, sizeof(addr->sun_path), path);
+	return 0;
+}
+
+int state_serve(struct snapraid_state* state, const char* conf, struct snapraid_option* opt, tommy_list* filterlist_disk)
+{
+	struct sockaddr_un addr;
+	struct serve_context ctx;
+	const char* path = state->opt.serve_socket;
+	unsigned count;
+	int s;
+
+	if (serve_address(&addr, path) != 0)
+		return -1;
+
+	/* a client disconnecting must not terminate the daemon */
+	signal(SIGPIPE, SIG_IGN);
+
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error creating the socket. %s.\n", strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* remove a stale socket of a previous daemon, the lock file ensures that it's not running */
+	remove(path);
+
+	if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0
+		|| chmod(path, 0600) != 0
+		|| listen(s, 8) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error listening on the socket '%s'. %s.\n", path, strerror(errno));
+		close(s);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	ctx.state = state;
+	ctx.conf = conf;
+	ctx.opt = *opt;
+	ctx.filterlist_disk = filterlist_disk;
+	ctx.dirty = 0;
+
+	/* the state was already read, record the content file it comes from */
+	serve_stamp(state, &ctx.content, &ctx.journal);
+
+	msg_progress("Serving on '%s'...\n", path);
+
+	count = 0;
+	while (!global_interrupt) {
+		fd_set set;
+		struct timeval tv;
+		int f;
+
+		FD_ZERO(&set);
+		FD_SET(s, &set);
+		tv.tv_sec = SERVE_WAIT;
+		tv.tv_usec = 0;
+
+		if (select(s + 1, &set, 0, 0, &tv) <= 0)
+			continue;
+
+		f = accept(s, 0, 0);
+		if (f == -1)
+			continue;
+
+		/* a client not sending its command must not block the daemon */
+		tv.tv_sec = SERVE_TIMEOUT;
+		tv.tv_usec = 0;
+		setsockopt(f, SOL_SOCKET, SO_RCVTIMEO, (void*)&tv, sizeof(tv));
+
+		serve_client(&ctx, f);
+
+		close(f);
+
+		++count;
+		if (state->opt.daemon_pass != 0 && count >= state->opt.daemon_pass)
+			break;
+	}
+
+	close(s);
+	remove(path);
+
+	return 0;
+}
+
+int serve_command(const char* path, const char* command)
+{
+	struct sockaddr_un addr;
+	char buffer[4096];
+	int trailer;
+	int ret;
+	int s;
+
+	if (serve_address(&addr, path) != 0)
+		return EXIT_FAILURE;
+
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error creating the socket. %s.\n", strerror(errno));
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error connecting to the daemon at '%s'. %s.\n", path, strerror(errno));
+		close(s);
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	snprintf(buffer, sizeof(buffer), "%s\n", command);
+	if (serve_send(s, buffer, strlen(buffer)) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing to the daemon at '%s'. %s.\n", path, strerror(errno));
+		close(s);
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* copy the output until the 0 byte, the next one is the exit code */
+	ret = -1;
+	trailer = 0;
+	while (ret < 0) {
+		ssize_t len = read(s, buffer, sizeof(buffer));
+		ssize_t i;
+
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		for (i = 0; i < len && ret < 0; ++i) {
+			if (trailer) {
+				ret = (unsigned char)buffer[i];
+			} else if (buffer[i] == 0) {
+				trailer = 1;
+				fwrite(buffer, i, 1, stdout);
+			}
+		}
+
+		if (!trailer)
+			fwrite(buffer, len, 1, stdout);
+	}
+
+	fflush(stdout);
+	close(s);
+
+	if (ret < 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("The daemon at '%s' closed the connection before completing the command\n", path);
+		return EXIT_FAILURE;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return ret;
+}
+#else
+int state_serve(struct snapraid_state* state, const char* conf, struct snapraid_option* opt, tommy_list* filterlist_disk)
+{
+	(void)state;
+	(void)conf;
+	(void)opt;
+	(void)filterlist_disk;
+
+	log_fatal("The daemon is not supported in this platform\n");
+
+	return -1;
+}
+
+int serve_command(const char* path, const char* command)
+{
+	(void)path;
+	(void)command;
+
+	log_fatal("The daemon is not supported in this platform\n");
+
+	return EXIT_FAILURE;
+}
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2026 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SHA-256 as defined in FIPS 180-4, and HMAC as defined in RFC 2104.
+ *
+ * It's used only to authenticate the remote agent, and it's not optimized.
+ */
+
+struct sha256_ctx {
+	uint32_t state[8];
+	unsigned char buf[64];
+	uint64_t count;
+};
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROR(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+static void sha256_block(uint32_t* state, const unsigned char* p)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+	unsigned i;
+
+	for (i = 0; i < 16; ++i)
+		w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+	for (i = 16; i < 64; ++i) {
+		uint32_t s0 = SHA256_ROR(w[i - 15], 7) ^ SHA256_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = SHA256_ROR(w[i - 2], 17) ^ SHA256_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	for (i = 0; i < 64; ++i) {
+		uint32_t s1 = SHA256_ROR(e, 6) ^ SHA256_ROR(e, 11) ^ SHA256_ROR(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+		uint32_t s0 = SHA256_ROR(a, 2) ^ SHA256_ROR(a, 13) ^ SHA256_ROR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = s0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+static void sha256_init(struct sha256_ctx* ctx)
+{
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+	ctx->count = 0;
+}
+
+static void sha256_update(struct sha256_ctx* ctx, const void* void_src, size_t size)
+{
+	const unsigned char* src = void_src;
+	unsigned pos = ctx->count % 64;
+
+	ctx->count += size;
+
+	while (size > 0) {
+		unsigned run = 64 - pos;
+		if (run > size)
+			run = size;
+		memcpy(ctx->buf + pos, src, run);
+		pos += run;
+		src += run;
+		size -= run;
+		if (pos == 64) {
+			sha256_block(ctx->state, ctx->buf);
+			pos = 0;
+		}
+	}
+}
+
+static void sha256_final(struct sha256_ctx* ctx, unsigned char* digest)
+{
+	uint64_t bits = ctx->count * 8;
+	unsigned pos = ctx->count % 64;
+	unsigned i;
+
+	ctx->buf[pos++] = 0x80;
+	if (pos > 56) {
+		memset(ctx->buf + pos, 0, 64 - pos);
+		sha256_block(ctx->state, ctx->buf);
+		pos = 0;
+	}
+	memset(ctx->buf + pos, 0, 56 - pos);
+	for (i = 0; i < 8; ++i)
+		ctx->buf[56 + i] = bits >> (56 - i * 8);
+	sha256_block(ctx->state, ctx->buf);
+
+	for (i = 0; i < 8; ++i) {
+		digest[i * 4] = ctx->state[i] >> 24;
+		digest[i * 4 + 1] = ctx->state[i] >> 16;
+		digest[i * 4 + 2] = ctx->state[i] >> 8;
+		digest[i * 4 + 3] = ctx->state[i];
+	}
+}
+
+void sha256(void* digest, const void* src, size_t size)
+{
+	struct sha256_ctx ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, src, size);
+	sha256_final(&ctx, digest);
+}
+
+void hmac_sha256(void* digest, const void* key, size_t key_size, const void* src, size_t size)
+{
+	struct sha256_ctx ctx;
+	unsigned char pad[64];
+	unsigned char inner[SHA256_SIZE];
+	unsigned i;
+
+	/* keys longer than the block are hashed */
+	memset(pad, 0, sizeof(pad));
+	if (key_size > sizeof(pad))
+		sha256(pad, key, key_size);
+	else
+		memcpy(pad, key, key_size);
+
+	for (i = 0; i < sizeof(pad); ++i)
+		pad[i] ^= 0x36;
+	sha256_init(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, src, size);
+	sha256_final(&ctx, inner);
+
+	for (i = 0; i < sizeof(pad); ++i)
+		pad[i] ^= 0x36 ^ 0x5c;
+	sha256_init(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, inner, sizeof(inner));
+	sha256_final(&ctx, digest);
+}
@@ -24,6 +24,7 @@
 #include "search.h"
 #include "state.h"
 #include "io.h"
+#include "remote.h"
 #include "raid/raid.h"
 
 /****************************************************************************/
@@ -76,8 +77,25 @@ void usage(void)
 	printf("  " SWITCH_GETOPT_LONG("-v, --verbose         ", "-v") "  Verbose\n");
 }
 
-void memory(void)
+void memory(struct snapraid_state* state)
 {
+	uint64_t count_file;
+	uint64_t count_block;
+	tommy_node* i;
+
+	count_file = 0;
+	count_block = 0;
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+		tommy_node* j;
+
+		for (j = disk->filelist; j != 0; j = j->next) {
+			struct snapraid_file* file = j->data;
+			++count_file;
+			count_block += file->blockmax;
+		}
+	}
+
 	log_tag("memory:used:%" PRIu64 "\n", (uint64_t)malloc_counter_get());
 
 	/* size of the block */
@@ -86,6 +104,13 @@ void memory(void)
 	log_tag("memory:file:%" PRIu64 "\n", (uint64_t)(sizeof(struct snapraid_file)));
 	log_tag("memory:link:%" PRIu64 "\n", (uint64_t)(sizeof(struct snapraid_link)));
 	log_tag("memory:dir:%" PRIu64 "\n", (uint64_t)(sizeof(struct snapraid_dir)));
+	log_tag("memory:block_stored:%" PRIu64 "\n", (uint64_t)block_sizeof());
+
+	/* average memory used for each file, including its blocks and extents */
+	log_tag("memory:files:%" PRIu64 "\n", count_file);
+	log_tag("memory:blocks:%" PRIu64 "\n", count_block);
+	if (count_file != 0)
+		log_tag("memory:per_file:%" PRIu64 "\n", (uint64_t)malloc_counter_get() / count_file);
 
 	msg_progress("Using %u MiB of memory for the file-system.\n", (unsigned)(malloc_counter_get() / MEBI));
 }
@@ -300,6 +325,38 @@ void config(char* conf, size_t conf_size, const char* argv0)
 #define OPT_TEST_SKIP_CONTENT_WRITE 302
 #define OPT_TEST_SKIP_SPACE_HOLDER 303
 #define OPT_TEST_FORMAT 304
+#define OPT_SCAN_THREADS 305
+#define OPT_RAID_THREADS 306
+#define OPT_TUNE_FILE 307
+#define OPT_TEST_FORCE_XXH3 308
+#define OPT_HASH_THREADS 309
+#define OPT_IO_URING 310
+#define OPT_IO_MEMORY 311
+#define OPT_DISK_THREADS 312
+#define OPT_IO_RATE 313
+#define OPT_IO_IDLE 314
+#define OPT_IO_HUGE 315
+#define OPT_FILE_CACHE 316
+#define OPT_IO_AHEAD 317
+#define OPT_IO_NUMA 318
+#define OPT_PRE_HASH_WINDOW 319
+#define OPT_DAEMON 320
+#define OPT_TEST_DAEMON_PASS 321
+#define OPT_LAZY_SPINUP 322
+#define OPT_OUTPUT_FORMAT 323
+#define OPT_METRICS_FILE 324
+#define OPT_TRACE_FILE 325
+#define OPT_BENCH_DIR 326
+#define OPT_BENCH_DISKS 327
+#define OPT_BENCH_SIZE 328
+#define OPT_BENCH_BLOCK 329
+#define OPT_BENCH_LATENCY 330
+#define OPT_SPEED_THREADS 331
+#define OPT_BENCH_FILES 332
+#define OPT_SOCKET 333
+#define OPT_REHASH_NOW 334
+#define OPT_TEST_DRY_ISOLATE 335
+#define OPT_LISTEN 336
 
 #if HAVE_GETOPT_LONG
 struct option long_options[] = {
@@ -362,6 +419,9 @@ struct option long_options[] = {
 	/* Force Spooky2 hash */
 	{ "test-force-spooky2", 0, 0, OPT_TEST_FORCE_SPOOKY2 },
 
+	/* Force XXH3 hash */
+	{ "test-force-xxh3", 0, 0, OPT_TEST_FORCE_XXH3 },
+
 	/* Skip the use of lock file */
 	{ "test-skip-lock", 0, 0, OPT_TEST_SKIP_LOCK },
 
@@ -467,6 +527,89 @@ struct option long_options[] = {
 	/* Set the output format */
 	{ "test-fmt", 1, 0, OPT_TEST_FORMAT },
 
+	/* Stop the daemon after the specified number of passes or commands */
+	{ "test-daemon-pass", 1, 0, OPT_TEST_DAEMON_PASS },
+
+	/* Read each disk alone in the dry profile */
+	{ "test-dry-isolate", 0, 0, OPT_TEST_DRY_ISOLATE },
+
+	/* Number of threads used to scan the disks */
+	{ "scan-threads", 1, 0, OPT_SCAN_THREADS },
+
+	/* Number of threads used to compute the parity */
+	{ "raid-threads", 1, 0, OPT_RAID_THREADS },
+
+	/* Number of threads used to compute the hashes */
+	{ "hash-threads", 1, 0, OPT_HASH_THREADS },
+
+	/* Use io_uring for the parity disks */
+	{ "io-uring", 0, 0, OPT_IO_URING },
+
+	/* Memory shared by the data disks for the read-ahead */
+	{ "io-memory", 1, 0, OPT_IO_MEMORY },
+
+	/* Number of threads reading each data disk */
+	{ "disk-threads", 1, 0, OPT_DISK_THREADS },
+
+	/* Max rate of each disk */
+	{ "io-rate", 1, 0, OPT_IO_RATE },
+
+	/* Idle IO priority */
+	{ "io-idle", 0, 0, OPT_IO_IDLE },
+
+	/* Huge pages for the IO buffers */
+	{ "io-huge", 0, 0, OPT_IO_HUGE },
+
+	/* Number of files kept open for each data disk */
+	{ "file-cache", 1, 0, OPT_FILE_CACHE },
+
+	/* Number of blocks of a file read together */
+	{ "io-ahead", 1, 0, OPT_IO_AHEAD },
+
+	/* Place the disk threads and buffers on the NUMA node of the controller */
+	{ "io-numa", 0, 0, OPT_IO_NUMA },
+
+	/* Pre-hash concurrently with the sync */
+	{ "pre-hash-window", 1, 0, OPT_PRE_HASH_WINDOW },
+
+	/* Scrub continuously */
+	{ "daemon", 0, 0, OPT_DAEMON },
+
+	/* Spin up only the disks used */
+	{ "lazy-spinup", 0, 0, OPT_LAZY_SPINUP },
+
+	/* Machine-readable output of list and diff */
+	{ "output-format", 1, 0, OPT_OUTPUT_FORMAT },
+
+	/* Metrics file updated during the process */
+	{ "metrics-file", 1, 0, OPT_METRICS_FILE },
+
+	/* Trace of the events of the threads */
+	{ "trace-file", 1, 0, OPT_TRACE_FILE },
+
+	/* Synthetic array of the bench */
+	{ "bench-dir", 1, 0, OPT_BENCH_DIR },
+	{ "bench-disks", 1, 0, OPT_BENCH_DISKS },
+	{ "bench-size", 1, 0, OPT_BENCH_SIZE },
+	{ "bench-block", 1, 0, OPT_BENCH_BLOCK },
+	{ "bench-latency", 1, 0, OPT_BENCH_LATENCY },
+	{ "bench-files", 1, 0, OPT_BENCH_FILES },
+
+	/* File with the tuned RAID functions */
+	{ "tune-file", 1, 0, OPT_TUNE_FILE },
+
+	/* Threads of the multi-core scaling in the speed test */
+	{ "speed-threads", 1, 0, OPT_SPEED_THREADS },
+
+	/* Local socket of the daemon */
+	{ "socket", 1, 0, OPT_SOCKET },
+
+	/* Complete the rehash now */
+	{ "now", 0, 0, OPT_REHASH_NOW },
+
+	/* Address of the agent of the remote parity */
+	{ "listen", 1, 0, OPT_LISTEN },
+
 	{ 0, 0, 0, 0 }
 };
 #endif
@@ -523,6 +666,10 @@ void signal_init(void)
 #define OPERATION_SPINDOWN 15
 #define OPERATION_DEVICES 16
 #define OPERATION_SMART 17
+#define OPERATION_BENCH 18
+#define OPERATION_SERVE 19
+#define OPERATION_COMPACT 20
+#define OPERATION_AGENT 21
 
 int main(int argc, char* argv[])
 {
@@ -550,6 +697,9 @@ int main(int argc, char* argv[])
 	const char* run;
 	int speedtest;
 	int period;
+	const char* tune_file;
+	unsigned speed_threads;
+	const char* trace_file;
 	time_t t;
 	struct tm* tm;
 	int i;
@@ -577,6 +727,9 @@ int main(int argc, char* argv[])
 	lock = 0;
 	gen_conf = 0;
 	speedtest = 0;
+	tune_file = 0;
+	speed_threads = 0;
+	trace_file = 0;
 	run = 0;
 
 	opterr = 0;
@@ -788,6 +941,9 @@ int main(int argc, char* argv[])
 		case OPT_TEST_FORCE_SPOOKY2 :
 			opt.force_spooky2 = 1;
 			break;
+		case OPT_TEST_FORCE_XXH3 :
+			opt.force_xxh3 = 1;
+			break;
 		case OPT_TEST_SKIP_LOCK :
 			opt.skip_lock = 1;
 			break;
@@ -910,6 +1066,201 @@ int main(int argc, char* argv[])
 				/* LCOV_EXCL_STOP */
 			}
 			break;
+		case OPT_SCAN_THREADS :
+			opt.scan_threads = strtoul(optarg, &e, 0);
+			if (!e || *e) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid number of scan threads '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_TUNE_FILE :
+			tune_file = optarg;
+			break;
+		case OPT_SPEED_THREADS :
+			speed_threads = strtoul(optarg, &e, 0);
+			if (!e || *e || speed_threads == 0 || speed_threads > 1024) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid number of speed threads '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_RAID_THREADS :
+			opt.raid_threads = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.raid_threads > 64) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid number of raid threads '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_HASH_THREADS :
+			opt.hash_threads = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.hash_threads > 64) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid number of hash threads '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_IO_URING :
+			opt.io_uring = 1;
+			break;
+		case OPT_IO_MEMORY :
+			opt.io_memory = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.io_memory == 0 || opt.io_memory > 1024 * 1024) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid read-ahead memory '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_DISK_THREADS :
+			opt.disk_threads = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.disk_threads == 0 || opt.disk_threads > 16) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid number of disk threads '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_IO_RATE :
+			opt.io_rate = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.io_rate == 0 || opt.io_rate > 1024 * 1024) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid disk rate '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_IO_IDLE :
+			opt.io_idle = 1;
+			break;
+		case OPT_IO_HUGE :
+			opt.io_huge = 1;
+			break;
+		case OPT_FILE_CACHE :
+			opt.file_cache = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.file_cache > HANDLE_CACHE_MAX) {
+				/* LCOV_EXCL_START */
+				log_fatal("The number of files kept open should be between 0 and %u.\n", HANDLE_CACHE_MAX);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_IO_AHEAD :
+			opt.io_ahead = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.io_ahead == 0 || opt.io_ahead > HANDLE_AHEAD_MAX) {
+				/* LCOV_EXCL_START */
+				log_fatal("The number of blocks read together should be between 1 and %u.\n", HANDLE_AHEAD_MAX);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_IO_NUMA :
+			opt.io_numa = 1;
+			break;
+		case OPT_PRE_HASH_WINDOW :
+			opt.prehash_window = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.prehash_window == 0 || opt.prehash_window > 1024 * 1024) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid pre-hash window '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			opt.prehash = 1;
+			break;
+		case OPT_DAEMON :
+			opt.daemon = 1;
+			break;
+		case OPT_LAZY_SPINUP :
+			opt.lazy_spinup = 1;
+			break;
+		case OPT_OUTPUT_FORMAT :
+			if (strcmp(optarg, "text") == 0) {
+				opt.output_format = OUTPUT_TEXT;
+			} else if (strcmp(optarg, "json") == 0) {
+				opt.output_format = OUTPUT_JSON;
+			} else if (strcmp(optarg, "tsv") == 0) {
+				opt.output_format = OUTPUT_TSV;
+			} else {
+				/* LCOV_EXCL_START */
+				log_fatal("Unknown output format '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_METRICS_FILE :
+			opt.metrics_file = optarg;
+			break;
+		case OPT_TRACE_FILE :
+			trace_file = optarg;
+			break;
+		case OPT_BENCH_DIR :
+			opt.bench_dir = optarg;
+			break;
+		case OPT_BENCH_DISKS :
+			opt.bench_disks = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.bench_disks == 0 || opt.bench_disks > 64) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid number of bench disks '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_BENCH_SIZE :
+			opt.bench_size = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.bench_size == 0 || opt.bench_size > 1024 * 1024) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid bench size '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_BENCH_BLOCK :
+			opt.bench_block = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.bench_block == 0 || opt.bench_block > 16 * 1024) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid bench block size '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_BENCH_FILES :
+			opt.bench_files = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.bench_files == 0 || opt.bench_files > 1000000000) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid number of bench files '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_BENCH_LATENCY :
+			opt.bench_latency = strtoul(optarg, &e, 0);
+			if (!e || *e || opt.bench_latency > 1000) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid bench latency '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
+		case OPT_TEST_DAEMON_PASS :
+			opt.daemon_pass = atoi(optarg);
+			break;
+		case OPT_TEST_DRY_ISOLATE :
+			opt.dry_isolate = 1;
+			break;
+		case OPT_SOCKET :
+			opt.serve_socket = optarg;
+			break;
+		case OPT_REHASH_NOW :
+			opt.rehash_now = 1;
+			break;
+		case OPT_LISTEN :
+			opt.agent_listen = optarg;
+			break;
 		default :
 			/* LCOV_EXCL_START */
 			log_fatal("Unknown option '%c'\n", (char)c);
@@ -921,20 +1272,36 @@ int main(int argc, char* argv[])
 	os_init(opt.force_scan_winfind);
 	raid_init();
 	crc32c_init();
+	memhash_init();
+
+	if (speed_threads != 0 && speedtest == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("You can use --speed-threads only with -T, --speed-test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
 
 	if (speedtest != 0) {
 		speed(period);
+		if (speed_threads)
+			speed_scale(period, speed_threads);
+		if (tune_file)
+			tune(period / 4, tune_file);
 		os_done();
 		exit(EXIT_SUCCESS);
 	}
 
+	/* use the tuned functions, that are then verified by the selftest */
+	if (tune_file)
+		tune_load(tune_file);
+
 	if (gen_conf != 0) {
 		generate_configuration(gen_conf);
 		os_done();
 		exit(EXIT_SUCCESS);
 	}
 
-	if (optind + 1 != argc) {
+	if (optind >= argc) {
 		/* LCOV_EXCL_START */
 		usage();
 		exit(EXIT_FAILURE);
@@ -978,6 +1345,14 @@ int main(int argc, char* argv[])
 		operation = OPERATION_DEVICES;
 	} else if (strcmp(argv[optind], "smart") == 0) {
 		operation = OPERATION_SMART;
+	} else if (strcmp(argv[optind], "bench") == 0) {
+		operation = OPERATION_BENCH;
+	} else if (strcmp(argv[optind], "serve") == 0) {
+		operation = OPERATION_SERVE;
+	} else if (strcmp(argv[optind], "compact") == 0) {
+		operation = OPERATION_COMPACT;
+	} else if (strcmp(argv[optind], "agent") == 0) {
+		operation = OPERATION_AGENT;
 	} else {
 		/* LCOV_EXCL_START */
 		log_fatal("Unknown command '%s'\n", argv[optind]);
@@ -988,6 +1363,7 @@ int main(int argc, char* argv[])
 	/* check options compatibility */
 	switch (operation) {
 	case OPERATION_CHECK :
+	case OPERATION_SCRUB :
 		break;
 	default :
 		if (opt.auditonly) {
@@ -998,6 +1374,178 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	switch (operation) {
+	case OPERATION_SCRUB :
+		break;
+	default :
+		if (opt.daemon) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --daemon with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_SYNC :
+	case OPERATION_FIX :
+	case OPERATION_CHECK :
+		break;
+	default :
+		if (opt.lazy_spinup) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --lazy-spinup with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_AGENT :
+		if (!opt.agent_listen) {
+			/* LCOV_EXCL_START */
+			log_fatal("The '%s' command requires the --listen option\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* the agent serves only the parity files named in the command line */
+		ret = remote_agent(conf, opt.agent_listen, argv + optind + 1, argc - optind - 1, opt.daemon_pass);
+		os_done();
+		lock_done();
+		return ret;
+	default :
+		if (optind + 1 != argc) {
+			/* LCOV_EXCL_START */
+			usage();
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		if (opt.agent_listen) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --listen with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_SERVE :
+		if (!opt.serve_socket) {
+			/* LCOV_EXCL_START */
+			log_fatal("The '%s' command requires the --socket option\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		break;
+	case OPERATION_DIFF :
+	case OPERATION_STATUS :
+	case OPERATION_LIST :
+	case OPERATION_DUP :
+		/* forward the command to the daemon, without reading the configuration and the content file */
+		if (opt.serve_socket) {
+			ret = serve_command(opt.serve_socket, command);
+			os_done();
+			lock_done();
+			return ret;
+		}
+		break;
+	default :
+		if (opt.serve_socket) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --socket with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_REHASH :
+		break;
+	default :
+		if (opt.rehash_now) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --now with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_COMPACT :
+		if (plan == SCRUB_BAD || plan == SCRUB_NEW) {
+			/* LCOV_EXCL_START */
+			log_fatal("You can use only a percentage or full as -p, --plan with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		opt.compact = 1;
+		opt.compact_plan = plan >= 0 ? plan : 100;
+		break;
+	}
+
+	switch (operation) {
+	case OPERATION_BENCH :
+		break;
+	default :
+		if (opt.bench_dir || opt.bench_disks || opt.bench_size || opt.bench_block || opt.bench_latency || opt.bench_files) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use the --bench options with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_SYNC :
+	case OPERATION_COMPACT :
+	case OPERATION_SCRUB :
+	case OPERATION_DRY :
+	case OPERATION_BENCH :
+		break;
+	default :
+		if (trace_file) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --trace-file with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_SYNC :
+	case OPERATION_COMPACT :
+	case OPERATION_SCRUB :
+	case OPERATION_FIX :
+	case OPERATION_CHECK :
+	case OPERATION_DRY :
+	case OPERATION_BENCH :
+		break;
+	default :
+		if (opt.metrics_file) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --metrics-file with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	switch (operation) {
+	case OPERATION_LIST :
+	case OPERATION_DIFF :
+		/* only the entries are printed in the standard output */
+		if (opt.output_format != OUTPUT_TEXT && msg_level >= MSG_STATUS)
+			msg_level = MSG_STATUS - 1;
+		break;
+	default :
+		if (opt.output_format != OUTPUT_TEXT) {
+			/* LCOV_EXCL_START */
+			log_fatal("You cannot use --output-format with the '%s' command\n", command);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
 	switch (operation) {
 	case OPERATION_FIX :
 	case OPERATION_CHECK :
@@ -1040,16 +1588,22 @@ int main(int argc, char* argv[])
 			/* LCOV_EXCL_STOP */
 		}
 
-		if (opt.force_full) {
+		if (opt.force_realloc) {
 			/* LCOV_EXCL_START */
-			log_fatal("You cannot use -F, --force-full with the '%s' command\n", command);
+			log_fatal("You cannot use -R, --force-realloc with the '%s' command\n", command);
 			exit(EXIT_FAILURE);
 			/* LCOV_EXCL_STOP */
 		}
+	}
 
-		if (opt.force_realloc) {
+	switch (operation) {
+	case OPERATION_SYNC :
+	case OPERATION_POOL :
+		break;
+	default :
+		if (opt.force_full) {
 			/* LCOV_EXCL_START */
-			log_fatal("You cannot use -R, --force-realloc with the '%s' command\n", command);
+			log_fatal("You cannot use -F, --force-full with the '%s' command\n", command);
 			exit(EXIT_FAILURE);
 			/* LCOV_EXCL_STOP */
 		}
@@ -1146,11 +1700,15 @@ int main(int argc, char* argv[])
 	case OPERATION_STATUS :
 	case OPERATION_REWRITE :
 	case OPERATION_READ :
-	case OPERATION_REHASH :
 	case OPERATION_SPINUP : /* we want to do it in different threads to avoid blocking */
 		/* avoid to check and access data disks if not needed */
 		opt.skip_disk_access = 1;
 		break;
+	case OPERATION_REHASH :
+		/* the data disks are read only to complete the rehash now */
+		if (!opt.rehash_now)
+			opt.skip_disk_access = 1;
+		break;
 	}
 
 	switch (operation) {
@@ -1163,12 +1721,22 @@ int main(int argc, char* argv[])
 	case OPERATION_READ :
 	case OPERATION_REHASH :
 	case OPERATION_TOUCH :
+	case OPERATION_SERVE :
 	case OPERATION_SPINUP : /* we want to do it in different threads to avoid blocking */
 		/* avoid to check and access parity disks if not needed */
 		opt.skip_parity_access = 1;
 		break;
 	}
 
+	switch (operation) {
+	case OPERATION_LIST :
+	case OPERATION_POOL :
+	case OPERATION_STATUS :
+		/* avoid to load the block hashes if not needed */
+		opt.skip_block_hash = 1;
+		break;
+	}
+
 	switch (operation) {
 	case OPERATION_FIX :
 	case OPERATION_CHECK :
@@ -1194,8 +1762,10 @@ int main(int argc, char* argv[])
 	switch (operation) {
 #if HAVE_DIRECT_IO
 	case OPERATION_SYNC :
+	case OPERATION_COMPACT :
 	case OPERATION_SCRUB :
 	case OPERATION_DRY :
+	case OPERATION_BENCH :
 		break;
 #endif
 	default:
@@ -1211,6 +1781,10 @@ int main(int argc, char* argv[])
 		/* we may need to use these commands during operations */
 		opt.skip_lock = 1;
 		break;
+	case OPERATION_SERVE :
+		/* the daemon takes the lock only while running a command */
+		opt.skip_lock = 1;
+		break;
 	}
 
 	switch (operation) {
@@ -1223,6 +1797,10 @@ int main(int argc, char* argv[])
 	/* open the log file */
 	log_open(log_file);
 
+	/* start recording the events */
+	if (trace_file)
+		trace_init(TRACE_MAX);
+
 	/* print generic info into the log */
 	t = time(0);
 	tm = localtime(&t);
@@ -1241,6 +1819,10 @@ int main(int argc, char* argv[])
 	if (!opt.skip_self)
 		selftest();
 
+	/* the bench uses its own array */
+	if (operation == OPERATION_BENCH)
+		bench_create(&opt, conf, sizeof(conf));
+
 	state_init(&state);
 
 	/* read the configuration file */
@@ -1249,6 +1831,13 @@ int main(int argc, char* argv[])
 	/* set the raid mode */
 	raid_mode(state.raid_mode);
 
+	/* lower the IO priority, before starting any thread */
+	if (state.opt.io_idle && ioprio_idle() != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Failed to set the idle IO priority. %s.\n", strerror(errno));
+		/* LCOV_EXCL_STOP */
+	}
+
 #if HAVE_LOCKFILE
 	/* create the lock file */
 	if (!opt.skip_lock && state.lockfile[0]) {
@@ -1269,6 +1858,12 @@ int main(int argc, char* argv[])
 	(void)lock;
 #endif
 
+	/* coordinate with the other arrays of the host before the heavy commands */
+	if (operation == OPERATION_SYNC || operation == OPERATION_COMPACT
+		|| operation == OPERATION_CHECK || operation == OPERATION_FIX
+		|| operation == OPERATION_SCRUB || operation == OPERATION_DRY)
+		state_schedule(&state);
+
 	if (operation == OPERATION_DIFF) {
 		state_read(&state);
 
@@ -1277,7 +1872,7 @@ int main(int argc, char* argv[])
 		/* abort if sync needed */
 		if (ret > 0)
 			exit(EXIT_SYNC_NEEDED);
-	} else if (operation == OPERATION_SYNC) {
+	} else if (operation == OPERATION_SYNC || operation == OPERATION_COMPACT) {
 
 		/* in the next state read ensures to clear all the past hashes in case */
 		/* we are reading from an incomplete sync */
@@ -1314,7 +1909,7 @@ int main(int argc, char* argv[])
 		/* refresh the size info before the content write */
 		state_refresh(&state);
 
-		memory();
+		memory(&state);
 
 		/* intercept signals while operating */
 		signal_init();
@@ -1363,7 +1958,7 @@ int main(int argc, char* argv[])
 		state_skip(&state);
 		state_filter(&state, &filterlist_file, &filterlist_disk, filter_missing, filter_error);
 
-		memory();
+		memory(&state);
 
 		/* intercept signals while operating */
 		signal_init();
@@ -1375,15 +1970,25 @@ int main(int argc, char* argv[])
 		/* intercept signals while operating */
 		signal_init();
 
-		state_rehash(&state);
+		if (opt.rehash_now)
+			memory(&state);
+
+		ret = state_rehash(&state);
 
 		/* save the new state if required */
 		if (state.need_write)
 			state_write(&state);
+
+		/* abort if required */
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
 	} else if (operation == OPERATION_SCRUB) {
 		state_read(&state);
 
-		memory();
+		memory(&state);
 
 		/* intercept signals while operating */
 		signal_init();
@@ -1408,11 +2013,11 @@ int main(int argc, char* argv[])
 
 		state_write(&state);
 
-		memory();
+		memory(&state);
 	} else if (operation == OPERATION_READ) {
 		state_read(&state);
 
-		memory();
+		memory(&state);
 	} else if (operation == OPERATION_TOUCH) {
 		state_read(&state);
 
@@ -1423,7 +2028,7 @@ int main(int argc, char* argv[])
 
 		state_write(&state);
 
-		memory();
+		memory(&state);
 	} else if (operation == OPERATION_SPINUP) {
 		state_device(&state, DEVICE_UP, &filterlist_disk);
 	} else if (operation == OPERATION_SPINDOWN) {
@@ -1432,12 +2037,46 @@ int main(int argc, char* argv[])
 		state_device(&state, DEVICE_LIST, 0);
 	} else if (operation == OPERATION_SMART) {
 		state_device(&state, DEVICE_SMART, 0);
-	} else if (operation == OPERATION_STATUS) {
+	} else if (operation == OPERATION_BENCH) {
+		/* intercept signals while operating */
+		signal_init();
+
+		if (opt.bench_files != 0)
+			ret = state_bench_content(&state, conf);
+		else
+			ret = state_bench(&state);
+
+		/* abort if required */
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	} else if (operation == OPERATION_SERVE) {
 		state_read(&state);
 
-		memory();
+		memory(&state);
+
+		/* intercept signals while operating */
+		signal_init();
+
+		ret = state_serve(&state, conf, &opt, &filterlist_disk);
+
+		/* abort if required */
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	} else if (operation == OPERATION_STATUS) {
+		/* use the summary if up to date, without reading the content file */
+		if (!state.status_summary || state.opt.gui || state_status_summary(&state) != 0) {
+			state_read(&state);
 
-		state_status(&state);
+			memory(&state);
+
+			state_status(&state);
+		}
 	} else if (operation == OPERATION_DUP) {
 		state_read(&state);
 
@@ -1470,7 +2109,7 @@ int main(int argc, char* argv[])
 		state_skip(&state);
 		state_filter(&state, &filterlist_file, &filterlist_disk, filter_missing, filter_error);
 
-		memory();
+		memory(&state);
 
 		/* intercept signals while operating */
 		signal_init();
@@ -1489,6 +2128,21 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	/* save the latest events recorded */
+	if (trace_file) {
+		if (trace_write(trace_file) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Error writing the trace file '%s'. %s.\n", trace_file, strerror(errno));
+			/* LCOV_EXCL_STOP */
+		}
+		trace_done();
+	}
+
+	/* complete the replication of the content files before releasing the lock */
+	state_write_wait(&state);
+
+	state_unschedule(&state);
+
 	/* close log file */
 	log_close(log_file);
 
@@ -1507,6 +2161,10 @@ int main(int argc, char* argv[])
 	tommy_list_foreach(&filterlist_file, (tommy_foreach_func*)filter_free);
 	tommy_list_foreach(&filterlist_disk, (tommy_foreach_func*)filter_free);
 
+	/* remove the synthetic array */
+	if (operation == OPERATION_BENCH)
+		bench_clear(&opt);
+
 	os_done();
 	lock_done();
 
@@ -22,6 +22,9 @@
 /* snapraid */
 
 void speed(int period);
+void speed_scale(int period, unsigned thread_max);
+void tune(int period, const char* path);
+int tune_load(const char* path);
 void selftest(void);
 
 #endif
@@ -83,6 +83,8 @@ void speed(int period)
 	int64_t dt;
 	int i, j;
 	unsigned char digest[HASH_MAX];
+	unsigned char digest_vector[TEST_COUNT][HASH_MAX];
+	void* digest_multi[TEST_COUNT];
 	unsigned char seed[HASH_MAX];
 	int id[RAID_PARITY_MAX];
 	int ip[RAID_PARITY_MAX];
@@ -130,15 +132,24 @@ void speed(int period)
 
 		raid_cpu_info(vendor, &family, &model);
 
-		printf("CPU %s, family %u, model %u, flags%s%s%s%s%s%s\n", vendor, family, model,
+		printf("CPU %s, family %u, model %u, flags%s%s%s%s%s%s%s\n", vendor, family, model,
 			raid_cpu_has_sse2() ? " sse2" : "",
 			raid_cpu_has_ssse3() ? " ssse3" : "",
 			raid_cpu_has_crc32() ? " crc32" : "",
 			raid_cpu_has_avx2() ? " avx2" : "",
+			raid_cpu_has_avx512gfni() ? " avx512gfni" : "",
 			raid_cpu_has_slowmult() ? " slowmult" : "",
 			raid_cpu_has_slowextendedreg() ? " slowext" : ""
 		);
 	}
+#elif defined(CONFIG_NEON)
+	printf("CPU aarch64, flags neon%s\n",
+#if HAVE_ARM64_CRC32
+		crc_arm64 ? " crc32" : ""
+#else
+		""
+#endif
+	);
 #else
 	printf("CPU is not a x86/x64\n");
 #endif
@@ -207,6 +218,36 @@ void speed(int period)
 	}
 #endif
 	printf("\n");
+
+#if HAVE_SSE42 && defined(CONFIG_X86_64)
+	printf("%8s", "intel3");
+	fflush(stdout);
+
+	if (raid_cpu_has_crc32() && raid_cpu_has_pclmul()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				side_effect += crc32c_x86x3(0, v[j], size);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+	printf("\n");
+#endif
+
+#if HAVE_ARM64_CRC32
+	printf("%8s", "arm64");
+	fflush(stdout);
+
+	if (crc_arm64) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				side_effect += crc32c_arm64(0, v[j], size);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+	printf("\n");
+#endif
 	printf("\n");
 
 	/* hash table */
@@ -217,6 +258,7 @@ void speed(int period)
 	printf("%8s", "murmur3");
 	printf("%8s", "spooky2");
 	printf("%8s", "metro");
+	printf("%8s", "xxh3");
 	printf("\n");
 
 	printf("%8s", "hash");
@@ -254,6 +296,50 @@ void speed(int period)
 			memhash(HASH_METRO, seed, digest, v[j], size);
 	} SPEED_STOP
 
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
+
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			memhash(HASH_XXH3, seed, digest, v[j], size);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	printf("\n");
+
+	/* multi block hash, like when hashing all the data blocks of a stripe */
+	printf("%8s", "multi");
+	printf("%8s", "");
+	fflush(stdout);
+
+	for (j = 0; j < nd; ++j)
+		digest_multi[j] = digest_vector[j];
+
+	SPEED_START {
+		memhash_multi(HASH_MURMUR3, seed, digest_multi, (const void**)v, nd, size);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
+
+	SPEED_START {
+		memhash_multi(HASH_SPOOKY2, seed, digest_multi, (const void**)v, nd, size);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
+
+	SPEED_START {
+		memhash_multi(HASH_METRO, seed, digest_multi, (const void**)v, nd, size);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
+
+	SPEED_START {
+		memhash_multi(HASH_XXH3, seed, digest_multi, (const void**)v, nd, size);
+	} SPEED_STOP
+
 	printf("%8" PRIu64, ds / dt);
 	printf("\n");
 	printf("\n");
@@ -277,7 +363,13 @@ void speed(int period)
 	printf("%8s", "avx2");
 #ifdef CONFIG_X86_64
 	printf("%8s", "avx2e");
+#ifdef CONFIG_AVX512GFNI
+	printf("%8s", "avx512g");
 #endif
+#endif
+#endif
+#ifdef CONFIG_NEON
+	printf("%8s", "neon");
 #endif
 	printf("\n");
 
@@ -331,6 +423,14 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		raid_gen1_neon(nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
 #endif
 	printf("\n");
 
@@ -390,6 +490,14 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		raid_gen2_neon(nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
 #endif
 	printf("\n");
 
@@ -515,7 +623,25 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512GFNI
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			raid_gen3_avx512gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		raid_gen3_neon(nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
 #endif
 	printf("\n");
 
@@ -580,7 +706,25 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512GFNI
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			raid_gen4_avx512gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
+#endif
 #endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		raid_gen4_neon(nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
 #endif
 	printf("\n");
 
@@ -645,7 +789,25 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512GFNI
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			raid_gen5_avx512gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		raid_gen5_neon(nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
 #endif
 	printf("\n");
 
@@ -710,7 +872,25 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512GFNI
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			raid_gen6_avx512gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
 #endif
+#endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		raid_gen6_neon(nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
 #endif
 	printf("\n");
 	printf("\n");
@@ -723,6 +903,12 @@ void speed(int period)
 #ifdef CONFIG_X86
 	printf("%8s", "ssse3");
 	printf("%8s", "avx2");
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+	printf("%8s", "avx512g");
+#endif
+#endif
+#ifdef CONFIG_NEON
+	printf("%8s", "neon");
 #endif
 	printf("\n");
 
@@ -762,6 +948,15 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			/* +1 to avoid GEN1 optimized case */
+			raid_rec1_neon(1, id, ip + 1, nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
 #endif
 	printf("\n");
 
@@ -801,6 +996,15 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			/* +1 to avoid GEN2 optimized case */
+			raid_rec2_neon(2, id, ip + 1, nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
 #endif
 	printf("\n");
 
@@ -837,6 +1041,24 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512gfni(3, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			raid_recX_neon(3, id, ip, nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
 #endif
 	printf("\n");
 
@@ -873,6 +1095,24 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512gfni(4, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			raid_recX_neon(4, id, ip, nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
 #endif
 	printf("\n");
 
@@ -909,6 +1149,24 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512gfni(5, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			raid_recX_neon(5, id, ip, nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
 #endif
 	printf("\n");
 
@@ -945,6 +1203,24 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+	if (raid_cpu_has_avx512gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512gfni(6, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#endif
+#ifdef CONFIG_NEON
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			raid_recX_neon(6, id, ip, nd, size, v);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
 #endif
 	printf("\n");
 	printf("\n");
@@ -955,3 +1231,451 @@ void speed(int period)
 	free(v);
 }
 
+
+/****************************************************************************/
+/* scale */
+
+#if HAVE_PTHREAD
+/**
+ * Kernels measured in the scaling test.
+ */
+static const char* SCALE_FUNC[] = {
+	"memset", "memcpy", "crc32c", "hash", "gen1", "gen2", "gen3",
+	0
+};
+
+/**
+ * Context of a thread of the scaling test.
+ */
+struct scale_thread {
+	pthread_t thread;
+	const char* func; /**< Kernel to run. */
+	int hash; /**< Hash kind to use. */
+	int size; /**< Size of each buffer. */
+	int nd; /**< Number of data buffers. */
+	void* v_alloc;
+	void** v; /**< Buffers, separated for each thread. */
+	int64_t ds; /**< Bytes processed. */
+	int64_t dt; /**< Microseconds used. */
+};
+
+/**
+ * Set by the main thread to stop the measure.
+ */
+static volatile int scale_stop;
+
+static void* scale_thread(void* arg)
+{
+	struct scale_thread* st = arg;
+	struct timeval start;
+	struct timeval stop;
+	unsigned char seed[HASH_MAX];
+	unsigned char digest[HASH_MAX];
+	void** v = st->v;
+	int size = st->size;
+	int nd = st->nd;
+	int64_t count = 0;
+	unsigned effect = 0;
+	int j;
+
+	memset(seed, 0, sizeof(seed));
+
+	gettimeofday(&start, 0);
+
+	while (!scale_stop) {
+		if (strcmp(st->func, "memset") == 0) {
+			for (j = 0; j < nd; ++j)
+				memset(v[j], j, size);
+		} else if (strcmp(st->func, "memcpy") == 0) {
+			/* copy in the buffers of the parity */
+			for (j = 0; j < nd; ++j)
+				memcpy(v[nd + j % RAID_PARITY_MAX], v[j], size);
+		} else if (strcmp(st->func, "crc32c") == 0) {
+			for (j = 0; j < nd; ++j)
+				effect += crc32c(0, v[j], size);
+		} else if (strcmp(st->func, "hash") == 0) {
+			for (j = 0; j < nd; ++j)
+				memhash(st->hash, seed, digest, v[j], size);
+			effect += digest[0];
+		} else {
+			raid_gen(nd, st->func[3] - '0', size, v);
+		}
+		++count;
+	}
+
+	gettimeofday(&stop, 0);
+
+	st->ds = size * (int64_t)count * nd;
+	st->dt = diffgettimeofday(&start, &stop);
+
+	side_effect += effect;
+
+	return 0;
+}
+
+/**
+ * Measure the aggregate speed in MB/s of the kernel run by the specified number of threads.
+ */
+static int64_t scale_measure(struct scale_thread* thread_map, unsigned thread_max, const char* func, int period)
+{
+	int64_t speed;
+	unsigned i;
+
+	scale_stop = 0;
+
+	for (i = 0; i < thread_max; ++i) {
+		thread_map[i].func = func;
+		thread_create(&thread_map[i].thread, 0, scale_thread, &thread_map[i]);
+	}
+
+	sleep_ms(period);
+
+	scale_stop = 1;
+
+	speed = 0;
+	for (i = 0; i < thread_max; ++i) {
+		void* retval;
+
+		thread_join(thread_map[i].thread, &retval);
+
+		if (thread_map[i].dt != 0)
+			speed += thread_map[i].ds / thread_map[i].dt;
+	}
+
+	return speed;
+}
+#endif
+
+void speed_scale(int period, unsigned thread_max)
+{
+#if HAVE_PTHREAD
+	struct scale_thread* thread_map;
+	unsigned count_map[32];
+	unsigned count_max;
+	unsigned t;
+	unsigned i, j;
+	int size = TEST_SIZE;
+	int nd = TEST_COUNT;
+	int hash;
+
+	/* the hash selected as best in the speed test */
+#ifdef CONFIG_X86
+	if (sizeof(void *) == 4 && !raid_cpu_has_slowmult())
+		hash = HASH_MURMUR3;
+	else
+		hash = HASH_SPOOKY2;
+#else
+	if (sizeof(void *) == 4)
+		hash = HASH_MURMUR3;
+	else
+		hash = HASH_SPOOKY2;
+#endif
+
+	/* number of threads to test, doubling them up to the maximum */
+	count_max = 0;
+	for (t = 1; t < thread_max && count_max + 1 < sizeof(count_map) / sizeof(count_map[0]); t *= 2)
+		count_map[count_max++] = t;
+	count_map[count_max++] = thread_max;
+
+	/* each thread has its own buffers, as the disk threads */
+	thread_map = malloc_nofail(thread_max * sizeof(struct scale_thread));
+	for (i = 0; i < thread_max; ++i) {
+		struct scale_thread* st = &thread_map[i];
+		int nv = nd + RAID_PARITY_MAX + 1;
+
+		st->hash = hash;
+		st->size = size;
+		st->nd = nd;
+		st->v = malloc_nofail_vector_align(nd, nv, size, &st->v_alloc);
+
+		for (j = 0; j < (unsigned)nd; ++j)
+			memset(st->v[j], j, size);
+		memset(st->v[nd + RAID_PARITY_MAX], 0, size);
+	}
+
+	printf("Multi-core scaling using up to %u threads, each one with its own buffers.\n", thread_max);
+	printf("The reported values are the aggregate bandwidth of all threads in MB/s,\n");
+	printf("and in parenthesis the efficiency of each thread compared to a single one.\n");
+	printf("The memcpy row measures the memory bandwidth, counting the copied bytes once.\n");
+	printf("\n");
+
+	printf("%8s", "");
+	for (t = 0; t < count_max; ++t)
+		printf("%14u", count_map[t]);
+	printf("\n");
+
+	for (i = 0; SCALE_FUNC[i] != 0; ++i) {
+		const char* func = SCALE_FUNC[i];
+		int64_t single = 0;
+
+		printf("%8s", func);
+		fflush(stdout);
+
+		for (t = 0; t < count_max; ++t) {
+			int64_t speed = scale_measure(thread_map, count_map[t], func, period);
+			unsigned efficiency;
+
+			if (t == 0)
+				single = speed;
+
+			efficiency = 0;
+			if (single != 0)
+				efficiency = speed * 100 / (single * count_map[t]);
+
+			printf("%8" PRIu64 " (%3u%%)", speed, efficiency);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+	printf("\n");
+
+	for (i = 0; i < thread_max; ++i) {
+		free(thread_map[i].v_alloc);
+		free(thread_map[i].v);
+	}
+	free(thread_map);
+#else
+	(void)period;
+	(void)thread_max;
+
+	printf("Multi-core scaling is not supported without threads.\n");
+	printf("\n");
+#endif
+}
+
+
+/****************************************************************************/
+/* tune */
+
+/**
+ * Functions to tune.
+ *
+ * The extended ones for more than six parities are not tuned,
+ * as they are not used by sync.
+ */
+static const char* TUNE_FUNC[] = {
+	"gen1", "gen2", "genz", "gen3", "gen4", "gen5", "gen6",
+	"rec1", "rec2", "rec3", "rec4", "rec5", "rec6",
+	0
+};
+
+/**
+ * Implementations to try.
+ */
+static const char* TUNE_TAG[] = {
+	"int8", "int32", "int64",
+	"sse2", "sse2e", "sse2p", "ssse3", "ssse3e", "avx2", "avx2e", "avx2p", "avx512g",
+	"neon",
+	0
+};
+
+/**
+ * Fingerprint of the CPU and program version.
+ *
+ * A tuning file is used only if the fingerprint matches.
+ */
+static void tune_fingerprint(char* buffer, size_t size)
+{
+#ifdef CONFIG_X86
+	char vendor[CPU_VENDOR_MAX];
+	unsigned family;
+	unsigned model;
+
+	raid_cpu_info(vendor, &family, &model);
+
+	snprintf(buffer, size, "%s/%s/%u/%u%s%s%s%s%s%s", VERSION, vendor, family, model,
+		raid_cpu_has_sse2() ? ",sse2" : "",
+		raid_cpu_has_ssse3() ? ",ssse3" : "",
+		raid_cpu_has_avx2() ? ",avx2" : "",
+		raid_cpu_has_avx512gfni() ? ",avx512gfni" : "",
+		raid_cpu_has_slowmult() ? ",slowmult" : "",
+		raid_cpu_has_slowextendedreg() ? ",slowext" : ""
+	);
+#else
+	snprintf(buffer, size, "%s/%d", VERSION, (int)sizeof(void *) * 8);
+#endif
+}
+
+/**
+ * Measure the speed of the function in use.
+ */
+static int64_t tune_measure(const char* func, int period, int nd, int size, void** v)
+{
+	struct timeval start;
+	struct timeval stop;
+	int64_t ds;
+	int64_t dt;
+	int ir[RAID_PARITY_MAX];
+	int i, n;
+	int count;
+	int delta = 1;
+
+	for (i = 0; i < RAID_PARITY_MAX; ++i)
+		ir[i] = i;
+
+	if (strcmp(func, "genz") == 0) {
+		raid_mode(RAID_MODE_VANDERMONDE);
+
+		SPEED_START {
+			raid_gen(nd, 3, size, v);
+		} SPEED_STOP
+
+		raid_mode(RAID_MODE_CAUCHY);
+	} else if (func[0] == 'g') {
+		n = func[3] - '0';
+
+		SPEED_START {
+			raid_gen(nd, n, size, v);
+		} SPEED_STOP
+	} else {
+		n = func[3] - '0';
+
+		/* recover the first data blocks using the first parities */
+		SPEED_START {
+			raid_rec(n, ir, nd, n, size, v);
+		} SPEED_STOP
+	}
+
+	return ds / dt;
+}
+
+void tune(int period, const char* path)
+{
+	char fingerprint[128];
+	int i, j;
+	int size = TEST_SIZE;
+	int nd = TEST_COUNT;
+	int nv;
+	void *v_alloc;
+	void **v;
+	FILE* f;
+
+	nv = nd + RAID_PARITY_MAX + 1;
+
+	v = malloc_nofail_vector_align(nd, nv, size, &v_alloc);
+
+	/* initialize disks with fixed data */
+	for (i = 0; i < nd; ++i)
+		memset(v[i], i, size);
+
+	/* zero buffer */
+	memset(v[nd + RAID_PARITY_MAX], 0, size);
+	raid_zero(v[nd + RAID_PARITY_MAX]);
+
+	printf("Tuning the RAID functions:\n");
+
+	for (i = 0; TUNE_FUNC[i] != 0; ++i) {
+		const char* func = TUNE_FUNC[i];
+		const char* best = raid_selected(func);
+		int64_t best_speed = 0;
+
+		printf("%8s", func);
+		fflush(stdout);
+
+		for (j = 0; TUNE_TAG[j] != 0; ++j) {
+			const char* tag = TUNE_TAG[j];
+			int64_t speed;
+
+			if (raid_select(func, tag) != 0)
+				continue;
+
+			speed = tune_measure(func, period, nd, size, v);
+			if (speed > best_speed) {
+				best = tag;
+				best_speed = speed;
+			}
+		}
+
+		/* keep the best one */
+		raid_select(func, best);
+
+		printf("%8s%8" PRIu64 "\n", best, best_speed);
+	}
+	printf("\n");
+
+	free(v_alloc);
+	free(v);
+
+	tune_fingerprint(fingerprint, sizeof(fingerprint));
+
+	f = fopen(path, "w");
+	if (!f) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error creating the tuning file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	fprintf(f, "# SnapRAID tuning file, created by 'snapraid -T --tune-file'\n");
+	fprintf(f, "cpu %s\n", fingerprint);
+	for (i = 0; TUNE_FUNC[i] != 0; ++i)
+		fprintf(f, "%s %s\n", TUNE_FUNC[i], raid_selected(TUNE_FUNC[i]));
+
+	if (fclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the tuning file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	printf("Tuning saved in '%s'\n", path);
+}
+
+int tune_load(const char* path)
+{
+	char fingerprint[128];
+	char line[256];
+	int matching;
+	FILE* f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		/* if missing, just use the default functions */
+		if (errno == ENOENT)
+			return -1;
+
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening the tuning file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	tune_fingerprint(fingerprint, sizeof(fingerprint));
+
+	/* the first non comment line must be the matching fingerprint */
+	matching = 0;
+	while (fgets(line, sizeof(line), f) != 0) {
+		char name[32];
+		char value[128];
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%31s %127s", name, value) != 2)
+			continue;
+
+		if (strcmp(name, "cpu") == 0) {
+			matching = strcmp(value, fingerprint) == 0;
+			if (!matching)
+				break;
+			continue;
+		}
+
+		/* ignore everything without a matching fingerprint */
+		if (!matching)
+			break;
+
+		if (raid_select(name, value) != 0)
+			msg_verbose("Ignoring unsupported tuning '%s %s' in '%s'\n", name, value, path);
+	}
+
+	fclose(f);
+
+	if (!matching) {
+		log_error("WARNING! Ignoring the tuning file '%s' made for another CPU or version.\n", path);
+		log_error("Run again 'snapraid -T --tune-file %s' to update it.\n", path);
+		return -1;
+	}
+
+	return 0;
+}
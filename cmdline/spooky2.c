@@ -108,15 +108,41 @@
 //
 #define sc_const 0xdeadbeefdeadbeefLL
 
+/*
+ * Tail and finalization, shared by the single and multi buffer versions.
+ */
+static inline void SpookyHash128_end(uint64_t* h, const void* end, size_t size_remainder, uint8_t* digest)
+{
+	uint64_t buf[sc_numVars];
+#if WORDS_BIGENDIAN
+	unsigned i;
+#endif
+
+	/* tail */
+	memcpy(buf, end, size_remainder);
+	memset(((uint8_t*)buf) + size_remainder, 0, sc_blockSize - size_remainder);
+	((uint8_t*)buf)[sc_blockSize - 1] = size_remainder;
+
+	/* finalization */
+#if WORDS_BIGENDIAN
+	for (i = 0; i < sc_numVars; ++i)
+		buf[i] = util_swap64(buf[i]);
+#endif
+	End(buf, h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7], h[8], h[9], h[10], h[11]);
+
+	util_write64(digest + 0, h[0]);
+	util_write64(digest + 8, h[1]);
+}
+
 void SpookyHash128(const void* data, size_t size, const uint8_t* seed, uint8_t* digest)
 {
 	uint64_t h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11;
-	uint64_t buf[sc_numVars];
+	uint64_t h[sc_numVars];
 	size_t nblocks;
 	const uint64_t* blocks;
 	const uint64_t* end;
-	size_t size_remainder;
 #if WORDS_BIGENDIAN
+	uint64_t buf[sc_numVars];
 	unsigned i;
 #endif
 
@@ -143,20 +169,122 @@ void SpookyHash128(const void* data, size_t size, const uint8_t* seed, uint8_t*
 		blocks += sc_numVars;
 	}
 
-	/* tail */
-	size_remainder = (size - ((const uint8_t*)end - (const uint8_t*)data));
-	memcpy(buf, end, size_remainder);
-	memset(((uint8_t*)buf) + size_remainder, 0, sc_blockSize - size_remainder);
-	((uint8_t*)buf)[sc_blockSize - 1] = size_remainder;
+	h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3;
+	h[4] = h4; h[5] = h5; h[6] = h6; h[7] = h7;
+	h[8] = h8; h[9] = h9; h[10] = h10; h[11] = h11;
 
-	/* finalization */
-#if WORDS_BIGENDIAN
-	for (i = 0; i < sc_numVars; ++i)
-		buf[i] = util_swap64(buf[i]);
-#endif
-	End(buf, h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
-
-	util_write64(digest + 0, h0);
-	util_write64(digest + 8, h1);
+	SpookyHash128_end(h, end, size - ((const uint8_t*)end - (const uint8_t*)data), digest);
 }
 
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+/* rotate left the ymm register s, using ymm15 as temporary */
+#define SPOOKY_AVX2_ROTL(s, r) \
+	asm volatile ("vpsllq $" #r ",%ymm" #s ",%ymm15"); \
+	asm volatile ("vpsrlq $(64-" #r "),%ymm" #s ",%ymm" #s); \
+	asm volatile ("vpor %ymm15,%ymm" #s ",%ymm" #s);
+
+/* one line of Mix(), with the data in ymm "d" */
+#define SPOOKY_AVX2_MIX(d, a, b, c, e, f, r) \
+	asm volatile ("vpaddq %ymm" #d ",%ymm" #a ",%ymm" #a); \
+	asm volatile ("vpxor %ymm" #c ",%ymm" #b ",%ymm" #b); \
+	asm volatile ("vpxor %ymm" #a ",%ymm" #e ",%ymm" #e); \
+	SPOOKY_AVX2_ROTL(a, r) \
+	asm volatile ("vpaddq %ymm" #f ",%ymm" #e ",%ymm" #e);
+
+/* load two words of each buffer, the first one in ymm14, the second in ymm13 */
+#define SPOOKY_AVX2_LOAD(o) \
+	asm volatile ("vmovdqu %0,%%xmm12" : : "m" (p0[i + o])); \
+	asm volatile ("vmovdqu %0,%%xmm13" : : "m" (p1[i + o])); \
+	asm volatile ("vinserti128 $1,%0,%%ymm12,%%ymm12" : : "m" (p2[i + o])); \
+	asm volatile ("vinserti128 $1,%0,%%ymm13,%%ymm13" : : "m" (p3[i + o])); \
+	asm volatile ("vpunpcklqdq %ymm13,%ymm12,%ymm14"); \
+	asm volatile ("vpunpckhqdq %ymm13,%ymm12,%ymm13");
+
+/*
+ * Computes the hash of four buffers of the same size at the same time.
+ *
+ * Each 64 bits lane of the ymm registers processes a different buffer,
+ * with the same exact operations of SpookyHash128().
+ * The state is in ymm0-11.
+ */
+void SpookyHash128_avx2x4(const void* const* data, size_t size, const uint8_t* seed, uint8_t* const* digest)
+{
+	const uint8_t* p0 = data[0];
+	const uint8_t* p1 = data[1];
+	const uint8_t* p2 = data[2];
+	const uint8_t* p3 = data[3];
+	uint64_t seed64[3];
+	uint64_t h[sc_numVars][4];
+	uint64_t lane[sc_numVars];
+	size_t body;
+	size_t i;
+	unsigned j, k;
+
+	seed64[0] = util_read64(seed + 0);
+	seed64[1] = util_read64(seed + 8);
+	seed64[2] = sc_const;
+
+	body = size / sc_blockSize * sc_blockSize;
+
+	raid_avx_begin();
+
+	asm volatile ("vpbroadcastq %0,%%ymm0" : : "m" (seed64[0]));
+	asm volatile ("vpbroadcastq %0,%%ymm1" : : "m" (seed64[1]));
+	asm volatile ("vpbroadcastq %0,%%ymm2" : : "m" (seed64[2]));
+	asm volatile ("vmovdqa %ymm0,%ymm3");
+	asm volatile ("vmovdqa %ymm1,%ymm4");
+	asm volatile ("vmovdqa %ymm2,%ymm5");
+	asm volatile ("vmovdqa %ymm0,%ymm6");
+	asm volatile ("vmovdqa %ymm1,%ymm7");
+	asm volatile ("vmovdqa %ymm2,%ymm8");
+	asm volatile ("vmovdqa %ymm0,%ymm9");
+	asm volatile ("vmovdqa %ymm1,%ymm10");
+	asm volatile ("vmovdqa %ymm2,%ymm11");
+
+	for (i = 0; i < body; i += sc_blockSize) {
+		SPOOKY_AVX2_LOAD(0)
+		SPOOKY_AVX2_MIX(14, 0, 2, 10, 11, 1, 11)
+		SPOOKY_AVX2_MIX(13, 1, 3, 11, 0, 2, 32)
+		SPOOKY_AVX2_LOAD(16)
+		SPOOKY_AVX2_MIX(14, 2, 4, 0, 1, 3, 43)
+		SPOOKY_AVX2_MIX(13, 3, 5, 1, 2, 4, 31)
+		SPOOKY_AVX2_LOAD(32)
+		SPOOKY_AVX2_MIX(14, 4, 6, 2, 3, 5, 17)
+		SPOOKY_AVX2_MIX(13, 5, 7, 3, 4, 6, 28)
+		SPOOKY_AVX2_LOAD(48)
+		SPOOKY_AVX2_MIX(14, 6, 8, 4, 5, 7, 39)
+		SPOOKY_AVX2_MIX(13, 7, 9, 5, 6, 8, 57)
+		SPOOKY_AVX2_LOAD(64)
+		SPOOKY_AVX2_MIX(14, 8, 10, 6, 7, 9, 55)
+		SPOOKY_AVX2_MIX(13, 9, 11, 7, 8, 10, 54)
+		SPOOKY_AVX2_LOAD(80)
+		SPOOKY_AVX2_MIX(14, 10, 0, 8, 9, 11, 22)
+		SPOOKY_AVX2_MIX(13, 11, 1, 9, 10, 0, 46)
+	}
+
+	asm volatile ("vmovdqu %%ymm0,%0" : "=m" (h[0]));
+	asm volatile ("vmovdqu %%ymm1,%0" : "=m" (h[1]));
+	asm volatile ("vmovdqu %%ymm2,%0" : "=m" (h[2]));
+	asm volatile ("vmovdqu %%ymm3,%0" : "=m" (h[3]));
+	asm volatile ("vmovdqu %%ymm4,%0" : "=m" (h[4]));
+	asm volatile ("vmovdqu %%ymm5,%0" : "=m" (h[5]));
+	asm volatile ("vmovdqu %%ymm6,%0" : "=m" (h[6]));
+	asm volatile ("vmovdqu %%ymm7,%0" : "=m" (h[7]));
+	asm volatile ("vmovdqu %%ymm8,%0" : "=m" (h[8]));
+	asm volatile ("vmovdqu %%ymm9,%0" : "=m" (h[9]));
+	asm volatile ("vmovdqu %%ymm10,%0" : "=m" (h[10]));
+	asm volatile ("vmovdqu %%ymm11,%0" : "=m" (h[11]));
+
+	raid_avx_end();
+
+	for (j = 0; j < 4; ++j) {
+		const uint8_t* p = data[j];
+
+		for (k = 0; k < sc_numVars; ++k)
+			lane[k] = h[k][j];
+
+		SpookyHash128_end(lane, p + body, size - body, digest[j]);
+	}
+}
+#endif
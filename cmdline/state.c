@@ -26,9 +26,22 @@
 #include "stream.h"
 #include "handle.h"
 #include "io.h"
+#include "remote.h"
 #include "raid/raid.h"
 #include "raid/cpu.h"
 
+/**
+ * Alignment of the hash arrays in the content file.
+ */
+#define CONTENT_ALIGN 64
+
+/**
+ * Kinds of run in the compressed hash arrays of the content file.
+ */
+#define CONTENT_RUN_INVALID 0 /**< Unused positions, or invalid hashes. All the bytes at 0x00. */
+#define CONTENT_RUN_ZERO 1 /**< Zero hashes. All the bytes at 0xFF. */
+#define CONTENT_RUN_HASH 2 /**< Unique hashes, stored after the run. */
+
 /**
  * Configure the multithread support.
  *
@@ -43,10 +56,18 @@
  *
  * Multi thread for verify is instead always generally faster,
  * so we enable it if possible.
+ *
+ * Multi thread for read is used only for content files with sections,
+ * where each disk is read independently, so we enable it if possible.
+ *
+ * Multi thread for the file hashtables is always faster, as each disk
+ * has its own, so we enable it if possible.
  */
 #if HAVE_PTHREAD
 /* #define HAVE_MT_WRITE 1 */
 #define HAVE_MT_VERIFY 1
+#define HAVE_MT_READ 1
+#define HAVE_MT_FILESET 1
 #endif
 
 const char* lev_name(unsigned l)
@@ -142,7 +163,22 @@ void state_init(struct snapraid_state* state)
 
 	memset(&state->opt, 0, sizeof(state->opt));
 	state->filter_hidden = 0;
+	state->journal = 0;
+	state->dircache = 0;
 	state->autosave = 0;
+	state->autosave_time = 0;
+	state->smart_cache = 0;
+	state->content_format = 3;
+	state->confighash = HASH_UNDEFINED;
+	state->content_journal = 0;
+	state->content_compress = 0;
+	state->status_summary = 0;
+	state->content_sync = 0;
+	state->content_replica = 0;
+	state->journal_ready = 0;
+	state->journal_base = 0;
+	state->journal_crc = 0;
+	state->journal_count = 0;
 	state->need_write = 0;
 	state->checked_read = 0;
 	state->block_size = 256 * KIBI; /* default 256 KiB */
@@ -155,12 +191,15 @@ void state_init(struct snapraid_state* state)
 			state->parity[l].split_map[s].uuid[0] = 0;
 			state->parity[l].split_map[s].size = PARITY_SIZE_INVALID;
 			state->parity[l].split_map[s].device = 0;
+			state->parity[l].split_map[s].device_uuid[0] = 0;
 		}
 		state->parity[l].smartctl[0] = 0;
 		state->parity[l].total_blocks = 0;
 		state->parity[l].free_blocks = 0;
 		state->parity[l].skip_access = 0;
 		state->parity[l].tick = 0;
+		histo_init(&state->parity[l].histo_io);
+		histo_init(&state->parity[l].histo_wait);
 		state->parity[l].cached_blocks = 0;
 		state->parity[l].is_excluded_by_filter = 0;
 	}
@@ -169,11 +208,22 @@ void state_init(struct snapraid_state* state)
 	state->tick_sched = 0;
 	state->tick_raid = 0;
 	state->tick_hash = 0;
+	histo_init(&state->histo_raid);
+	histo_init(&state->histo_hash);
 	state->tick_last = tick();
+	state->tick_content_parse = 0;
+	state->tick_content_map = 0;
+	state->tick_content_serialize = 0;
+	state->tick_content_verify = 0;
 	state->share[0] = 0;
 	state->pool[0] = 0;
 	state->pool_device = 0;
 	state->lockfile[0] = 0;
+	state->schedule_dir[0] = 0;
+	state->schedule_cpu = 0;
+	state->schedule_io = 0;
+	state->schedule_lease_mac = 0;
+	state->schedule_content = -1;
 	state->level = 1; /* default is the lowest protection */
 	state->clear_past_hash = 0;
 	state->no_conf = 0;
@@ -186,11 +236,15 @@ void state_init(struct snapraid_state* state)
 	tommy_hashdyn_init(&state->importset);
 	tommy_hashdyn_init(&state->previmportset);
 	tommy_hashdyn_init(&state->searchset);
-	tommy_arrayblkof_init(&state->infoarr, sizeof(snapraid_info));
+	state->search_open = 0;
+	infoarr_init(&state->infoarr);
 }
 
 void state_done(struct snapraid_state* state)
 {
+	/* the replication uses the list of content files */
+	state_write_wait(state);
+
 	tommy_list_foreach(&state->disklist, (tommy_foreach_func*)disk_free);
 	tommy_list_foreach(&state->maplist, (tommy_foreach_func*)map_free);
 	tommy_list_foreach(&state->contentlist, (tommy_foreach_func*)content_free);
@@ -200,7 +254,7 @@ void state_done(struct snapraid_state* state)
 	tommy_hashdyn_done(&state->importset);
 	tommy_hashdyn_done(&state->previmportset);
 	tommy_hashdyn_done(&state->searchset);
-	tommy_arrayblkof_done(&state->infoarr);
+	infoarr_done(&state->infoarr);
 }
 
 /**
@@ -237,6 +291,13 @@ static void state_config_check(struct snapraid_state* state, const char* path, t
 		/* LCOV_EXCL_STOP */
 	}
 
+	if (state->content_compress && state->content_format < 4) {
+		/* LCOV_EXCL_START */
+		log_fatal("The 'contentcompress' option requires 'contentformat 4' in '%s'\n", path);
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
 	/* check for equal paths */
 	for (i = state->contentlist; i != 0; i = i->next) {
 		struct snapraid_content* content = i->data;
@@ -309,6 +370,8 @@ static void state_config_check(struct snapraid_state* state, const char* path, t
 			if (!state->opt.skip_parity_access) {
 				for (l = 0; l < state->level; ++l) {
 					for (s = 0; s < state->parity[l].split_mac; ++s) {
+						if (remote_is(state->parity[l].split_map[s].path))
+							continue;
 						if (disk->device == state->parity[l].split_map[s].device) {
 							if (state->opt.force_device) {
 								/* note that we just ignore the issue */
@@ -356,6 +419,10 @@ static void state_config_check(struct snapraid_state* state, const char* path, t
 				if (state->parity[l].skip_access)
 					continue;
 
+				/* skip remote parities, as they have no local device */
+				if (remote_is(state->parity[l].split_map[s].path))
+					continue;
+
 #ifdef _WIN32
 				if (state->parity[l].split_map[s].device == 0) {
 					/* LCOV_EXCL_START */
@@ -370,6 +437,8 @@ static void state_config_check(struct snapraid_state* state, const char* path, t
 
 				for (j = l + 1; j < state->level; ++j) {
 					for (t = 0; t < state->parity[j].split_mac; ++t) {
+						if (remote_is(state->parity[j].split_map[t].path))
+							continue;
 						if (state->parity[l].split_map[s].device == state->parity[j].split_map[t].device) {
 							if (state->opt.force_device) {
 								/* note that we just ignore the issue */
@@ -527,12 +596,161 @@ static int validate_smartctl(const char* custom)
 	return 0;
 }
 
+/**
+ * Probe of the device of a data or parity disk.
+ *
+ * The probes of all the disks are done at the same time, because on
+ * spun down disks each one may take seconds.
+ */
+struct state_probe {
+	char device[PATH_MAX]; /**< Directory to probe. */
+	unsigned line; /**< Line in the configuration file. */
+	struct snapraid_disk* disk; /**< Data disk, or 0 for a parity split. */
+	unsigned level; /**< Parity level. */
+	unsigned split; /**< Parity split. */
+	int ret; /**< Result of stat(). */
+	uint64_t dev; /**< Device of the directory. */
+	char uuid[UUID_MAX]; /**< UUID of the device. Empty if unsupported. */
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+static void state_probe_add(tommy_array* probearr, const char* device, unsigned line, struct snapraid_disk* disk, unsigned level, unsigned split)
+{
+	struct state_probe* probe;
+
+	probe = malloc_nofail(sizeof(struct state_probe));
+	pathcpy(probe->device, sizeof(probe->device), device);
+	probe->line = line;
+	probe->disk = disk;
+	probe->level = level;
+	probe->split = split;
+
+	tommy_array_insert(probearr, probe);
+}
+
+static void* state_probe_thread(void* arg)
+{
+	struct state_probe* probe = arg;
+	struct stat st;
+
+	probe->ret = stat(probe->device, &st);
+	if (probe->ret != 0) {
+		probe->dev = 0;
+		probe->uuid[0] = 0;
+		return 0;
+	}
+
+	probe->dev = st.st_dev;
+
+	/* read the uuid, if unsupported use an empty one */
+	if (devuuid(probe->dev, probe->uuid, sizeof(probe->uuid)) != 0)
+		probe->uuid[0] = 0;
+
+	return 0;
+}
+
+/**
+ * Read the devices of all the disks, and apply them in the configuration order.
+ */
+static void state_probe(struct snapraid_state* state, const char* path, tommy_array* probearr)
+{
+	unsigned count = tommy_array_size(probearr);
+	unsigned i;
+
+#if HAVE_PTHREAD
+	for (i = 0; i < count; ++i) {
+		struct state_probe* probe = tommy_array_get(probearr, i);
+		thread_create(&probe->thread, 0, state_probe_thread, probe);
+	}
+
+	for (i = 0; i < count; ++i) {
+		struct state_probe* probe = tommy_array_get(probearr, i);
+		void* retval;
+		thread_join(probe->thread, &retval);
+	}
+#else
+	for (i = 0; i < count; ++i)
+		state_probe_thread(tommy_array_get(probearr, i));
+#endif
+
+	for (i = 0; i < count; ++i) {
+		struct state_probe* probe = tommy_array_get(probearr, i);
+		struct snapraid_disk* disk = probe->disk;
+
+		if (disk) {
+			char uuid[UUID_MAX];
+
+			if (probe->ret == 0) {
+				pathcpy(uuid, sizeof(uuid), probe->uuid);
+
+				/* fake a different UUID when testing */
+				if (state->opt.fake_uuid) {
+					snprintf(uuid, sizeof(uuid), "fake-uuid-%d", state->opt.fake_uuid);
+					--state->opt.fake_uuid;
+				}
+
+				disk->device = probe->dev;
+				pathcpy(disk->uuid, sizeof(disk->uuid), uuid);
+				disk->has_unsupported_uuid = *uuid == 0; /* empty UUID means unsupported */
+			} else {
+				/* if the disk can be skipped */
+				if (state->opt.force_device) {
+					/* use a fake device, and mark the disk to be skipped */
+					disk->skip_access = 1;
+					log_fatal("DANGER! Skipping inaccessible data disk '%s'...\n", disk->name);
+				} else {
+					/* LCOV_EXCL_START */
+					log_fatal("Error accessing 'disk' '%s' specification in '%s' at line %u\n", disk->dir, path, probe->line);
+
+					/* in "fix" we allow to continue anyway */
+					if (strcmp(state->command, "fix") == 0) {
+						log_fatal("You can '%s' anyway, using 'snapraid --force-device %s'.\n", state->command, state->command);
+					}
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+			}
+		} else {
+			struct snapraid_split* split = &state->parity[probe->level].split_map[probe->split];
+
+			if (probe->ret == 0) {
+				split->device = probe->dev;
+				pathcpy(split->device_uuid, sizeof(split->device_uuid), probe->uuid);
+			} else {
+				/* if the disk can be skipped */
+				if (state->opt.force_device) {
+					/* use a fake device, and mark the disk to be skipped */
+					state->parity[probe->level].skip_access = 1;
+					log_fatal("DANGER! Skipping inaccessible parity disk '%s'...\n", lev_config_name(probe->level));
+				} else {
+					/* LCOV_EXCL_START */
+					log_fatal("Error accessing 'parity' dir '%s' specification in '%s' at line %u\n", probe->device, path, probe->line);
+
+					/* in "fix" we allow to continue anyway */
+					if (strcmp(state->command, "fix") == 0) {
+						log_fatal("You can '%s' anyway, using 'snapraid --force-device %s'.\n", state->command, state->command);
+					}
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < count; ++i)
+		free(tommy_array_get(probearr, i));
+	tommy_array_done(probearr);
+}
+
 void state_config(struct snapraid_state* state, const char* path, const char* command, struct snapraid_option* opt, tommy_list* filterlist_disk)
 {
 	STREAM* f;
 	unsigned line;
 	tommy_node* i;
 	unsigned l, s;
+	tommy_array probearr;
 
 	/* copy the options */
 	state->opt = *opt;
@@ -576,6 +794,8 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 		/* LCOV_EXCL_STOP */
 	}
 
+	tommy_array_init(&probearr);
+
 	line = 1;
 	while (1) {
 		char tag[PATH_MAX];
@@ -668,8 +888,6 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 			char* split_map[SPLIT_MAX + 1];
 			unsigned split_mac;
 			char* slash;
-			uint64_t dev;
-			int skip_access;
 
 			if (state->parity[level].split_mac != 0) {
 				/* LCOV_EXCL_START */
@@ -702,14 +920,17 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 				/* LCOV_EXCL_STOP */
 			}
 
-			skip_access = 0;
 			state->parity[level].split_mac = split_mac;
 			for (s = 0; s < split_mac; ++s) {
+				/* a remote parity is kept by its agent, and it has no local device */
+				if (remote_is(split_map[s])) {
+					pathcpy(state->parity[level].split_map[s].path, sizeof(state->parity[level].split_map[s].path), split_map[s]);
+					continue;
+				}
+
 				pathimport(state->parity[level].split_map[s].path, sizeof(state->parity[level].split_map[s].path), split_map[s]);
 
 				if (!state->opt.skip_parity_access) {
-					struct stat st;
-
 					/* get the device of the directory containing the parity file */
 					pathimport(device, sizeof(device), split_map[s]);
 					slash = strrchr(device, '/');
@@ -718,38 +939,11 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 					else
 						pathcpy(device, sizeof(device), ".");
 
-					if (stat(device, &st) == 0) {
-						dev = st.st_dev;
-					} else {
-						/* if the disk can be skipped */
-						if (state->opt.force_device) {
-							/* use a fake device, and mark the disk to be skipped */
-							dev = 0;
-							skip_access = 1;
-							log_fatal("DANGER! Skipping inaccessible parity disk '%s'...\n", tag);
-						} else {
-							/* LCOV_EXCL_START */
-							log_fatal("Error accessing 'parity' dir '%s' specification in '%s' at line %u\n", device, path, line);
-
-							/* in "fix" we allow to continue anyway */
-							if (strcmp(state->command, "fix") == 0) {
-								log_fatal("You can '%s' anyway, using 'snapraid --force-device %s'.\n", state->command, state->command);
-							}
-							exit(EXIT_FAILURE);
-							/* LCOV_EXCL_STOP */
-						}
-					}
-				} else {
-					/* use a fake device */
-					dev = 0;
+					/* the device is read later, at the same time of the other disks */
+					state_probe_add(&probearr, device, line, 0, level, s);
 				}
-
-				state->parity[level].split_map[s].device = dev;
 			}
 
-			/* store the global parity skip_access */
-			state->parity[level].skip_access = skip_access;
-
 			/* adjust the level */
 			if (state->level < level + 1)
 				state->level = level + 1;
@@ -890,10 +1084,7 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 			/* "disk" is the deprecated name up to SnapRAID 9.x */
 			char dir[PATH_MAX];
 			char device[PATH_MAX];
-			char uuid[UUID_MAX];
 			struct snapraid_disk* disk;
-			uint64_t dev;
-			int skip_access;
 
 			ret = sgettok(f, buffer, sizeof(buffer));
 			if (ret < 0) {
@@ -943,51 +1134,11 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 				/* LCOV_EXCL_STOP */
 			}
 
-			/* if the disk has to be present */
-			skip_access = 0;
-			if (!state->opt.skip_disk_access) {
-				struct stat st;
-
-				if (stat(device, &st) == 0) {
-					dev = st.st_dev;
-
-					/* read the uuid, if unsupported use an empty one */
-					if (devuuid(dev, uuid, sizeof(uuid)) != 0) {
-						*uuid = 0;
-					}
-
-					/* fake a different UUID when testing */
-					if (state->opt.fake_uuid) {
-						snprintf(uuid, sizeof(uuid), "fake-uuid-%d", state->opt.fake_uuid);
-						--state->opt.fake_uuid;
-					}
-				} else {
-					/* if the disk can be skipped */
-					if (state->opt.force_device) {
-						/* use a fake device, and mark the disk to be skipped */
-						dev = 0;
-						*uuid = 0;
-						skip_access = 1;
-						log_fatal("DANGER! Skipping inaccessible data disk '%s'...\n", buffer);
-					} else {
-						/* LCOV_EXCL_START */
-						log_fatal("Error accessing 'disk' '%s' specification in '%s' at line %u\n", dir, device, line);
-
-						/* in "fix" we allow to continue anyway */
-						if (strcmp(state->command, "fix") == 0) {
-							log_fatal("You can '%s' anyway, using 'snapraid --force-device %s'.\n", state->command, state->command);
-						}
-						exit(EXIT_FAILURE);
-						/* LCOV_EXCL_STOP */
-					}
-				}
-			} else {
-				/* use a fake device */
-				dev = 0;
-				*uuid = 0;
-			}
+			/* the device is read later, at the same time of the other disks */
+			disk = disk_alloc(buffer, dir, 0, "", 0);
 
-			disk = disk_alloc(buffer, dir, dev, uuid, skip_access);
+			if (!state->opt.skip_disk_access)
+				state_probe_add(&probearr, device, line, disk, 0, 0);
 
 			tommy_list_insert_tail(&state->disklist, &disk->node, disk);
 		} else if (strcmp(tag, "smartctl") == 0) {
@@ -1069,6 +1220,65 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 			}
 		} else if (strcmp(tag, "nohidden") == 0) {
 			state->filter_hidden = 1;
+		} else if (strcmp(tag, "journal") == 0) {
+#ifdef _WIN32
+			state->journal = 1;
+#else
+			/* the change journal is available only in Windows */
+			if (!state->opt.no_warnings)
+				log_fatal("WARNING! The 'journal' option in '%s' at line %u is supported only in Windows. Ignoring it.\n", path, line);
+#endif
+		} else if (strcmp(tag, "dircache") == 0) {
+			state->dircache = 1;
+		} else if (strcmp(tag, "contentjournal") == 0) {
+			state->content_journal = 1;
+		} else if (strcmp(tag, "contentcompress") == 0) {
+			state->content_compress = 1;
+		} else if (strcmp(tag, "contentsync") == 0) {
+			char* e;
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'contentsync' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'contentsync' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			state->content_sync = strtoul(buffer, &e, 0);
+
+			if (!e || *e || state->content_sync == 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'contentsync' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		} else if (strcmp(tag, "remotekey") == 0) {
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'remotekey' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'remotekey' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			remote_key(buffer);
+		} else if (strcmp(tag, "statussummary") == 0) {
+			state->status_summary = 1;
 		} else if (strcmp(tag, "exclude") == 0) {
 			struct snapraid_filter* filter;
 
@@ -1152,85 +1362,318 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 
 			/* convert to GB */
 			state->autosave *= GIGA;
-		} else if (tag[0] == 0) {
-			/* allow empty lines */
-		} else if (tag[0] == '#') {
-			ret = sgetline(f, buffer, sizeof(buffer));
+		} else if (strcmp(tag, "autosavetime") == 0) {
+			char* e;
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
 			if (ret < 0) {
 				/* LCOV_EXCL_START */
-				log_fatal("Invalid comment in '%s' at line %u\n", path, line);
+				log_fatal("Invalid 'autosavetime' specification in '%s' at line %u\n", path, line);
 				exit(EXIT_FAILURE);
 				/* LCOV_EXCL_STOP */
 			}
-		} else {
-			/* LCOV_EXCL_START */
-			log_fatal("Invalid command '%s' in '%s' at line %u\n", tag, path, line);
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
-		}
-
-		/* skip final spaces */
-		sgetspace(f);
 
-		/* next line */
-		c = sgeteol(f);
-		if (c == EOF) {
-			break;
-		}
-		if (c != '\n') {
-			/* LCOV_EXCL_START */
-			log_fatal("Extra data in '%s' at line %u\n", path, line);
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
-		}
-		++line;
-	}
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'autosavetime' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
 
-	if (serror(f)) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error reading the configuration file '%s' at line %u\n", path, line);
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
+			state->autosave_time = strtoul(buffer, &e, 0);
 
-	sclose(f);
+			if (!e || *e) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'autosavetime' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		} else if (strcmp(tag, "infogranularity") == 0) {
+			unsigned hours;
+			char* e;
 
-	state_config_check(state, path, filterlist_disk);
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'infogranularity' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
 
-	/* select the default hash */
-	if (state->opt.force_murmur3) {
-		state->besthash = HASH_MURMUR3;
-	} else if (state->opt.force_spooky2) {
-		state->besthash = HASH_SPOOKY2;
-	} else {
-#ifdef CONFIG_X86
-		if (sizeof(void*) == 4 && !raid_cpu_has_slowmult())
-			state->besthash = HASH_MURMUR3;
-		else
-			state->besthash = HASH_SPOOKY2;
-#else
-		if (sizeof(void*) == 4)
-			state->besthash = HASH_MURMUR3;
-		else
-			state->besthash = HASH_SPOOKY2;
-#endif
-	}
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'infogranularity' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
 
-	/* by default use the best hash */
-	state->hash = state->besthash;
+			hours = strtoul(buffer, &e, 0);
 
-	/* by default use a random hash seed */
-	if (randomize(state->hashseed, HASH_MAX) != 0) {
-		/* LCOV_EXCL_START */
-		log_fatal("Failed to get random values.\n");
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
+			if (!e || *e || hours > 24 * 7) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'infogranularity' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
 
-	/* no previous hash by default */
-	state->prevhash = HASH_UNDEFINED;
+			/* the info array is still empty, as the content file is read later */
+			infoarr_granularity(&state->infoarr, hours * 3600);
+		} else if (strcmp(tag, "schedule") == 0) {
+			struct stat st;
 
-	/* intentionally not set the prevhashseed, if used valgrind will warn about it */
+			if (*state->schedule_dir) {
+				/* LCOV_EXCL_START */
+				log_fatal("Multiple 'schedule' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'schedule' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'schedule' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (stat(buffer, &st) != 0 || !S_ISDIR(st.st_mode)) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error accessing 'schedule' dir '%s' specification in '%s' at line %u\n", buffer, path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			pathimport(state->schedule_dir, sizeof(state->schedule_dir), buffer);
+			pathslash(state->schedule_dir, sizeof(state->schedule_dir));
+		} else if (strcmp(tag, "schedulecpu") == 0 || strcmp(tag, "scheduleio") == 0) {
+			unsigned value;
+			char* e;
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid '%s' specification in '%s' at line %u\n", tag, path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty '%s' specification in '%s' at line %u\n", tag, path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			value = strtoul(buffer, &e, 0);
+
+			if (!e || *e || value == 0 || value > 128) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid '%s' specification in '%s' at line %u\n", tag, path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (strcmp(tag, "schedulecpu") == 0)
+				state->schedule_cpu = value;
+			else
+				state->schedule_io = value;
+		} else if (strcmp(tag, "smartcache") == 0) {
+			char* e;
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'smartcache' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'smartcache' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			state->smart_cache = strtoul(buffer, &e, 0);
+
+			if (!e || *e) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'smartcache' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		} else if (strcmp(tag, "iorate") == 0) {
+			unsigned rate;
+			char* e;
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'iorate' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'iorate' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			rate = strtoul(buffer, &e, 0);
+
+			if (!e || *e || rate == 0 || rate > 1024 * 1024) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'iorate' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* the command line option has precedence */
+			if (state->opt.io_rate == 0)
+				state->opt.io_rate = rate;
+		} else if (strcmp(tag, "ioidle") == 0) {
+			state->opt.io_idle = 1;
+		} else if (strcmp(tag, "contentformat") == 0) {
+			char* e;
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'contentformat' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'contentformat' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			state->content_format = strtoul(buffer, &e, 0);
+
+			if (!e || *e || (state->content_format != 3 && state->content_format != 4)) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'contentformat' specification in '%s' at line %u\n", path, line);
+				log_fatal("Valid values are 3 and 4.\n");
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		} else if (strcmp(tag, "hash") == 0) {
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'hash' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			state->confighash = hash_config_kind(buffer);
+
+			if (state->confighash == HASH_UNDEFINED) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'hash' specification '%s' in '%s' at line %u\n", buffer, path, line);
+				log_fatal("Valid values are murmur3, spooky2, metro and xxh3.\n");
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		} else if (tag[0] == 0) {
+			/* allow empty lines */
+		} else if (tag[0] == '#') {
+			ret = sgetline(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid comment in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		} else {
+			/* LCOV_EXCL_START */
+			log_fatal("Invalid command '%s' in '%s' at line %u\n", tag, path, line);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* skip final spaces */
+		sgetspace(f);
+
+		/* next line */
+		c = sgeteol(f);
+		if (c == EOF) {
+			break;
+		}
+		if (c != '\n') {
+			/* LCOV_EXCL_START */
+			log_fatal("Extra data in '%s' at line %u\n", path, line);
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		++line;
+	}
+
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reading the configuration file '%s' at line %u\n", path, line);
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	sclose(f);
+
+	/* read the devices of all the disks */
+	state_probe(state, path, &probearr);
+
+	state_config_check(state, path, filterlist_disk);
+
+	/* select the default hash */
+	if (state->opt.force_murmur3) {
+		state->besthash = HASH_MURMUR3;
+	} else if (state->opt.force_spooky2) {
+		state->besthash = HASH_SPOOKY2;
+	} else if (state->opt.force_xxh3) {
+		state->besthash = HASH_XXH3;
+	} else if (state->confighash != HASH_UNDEFINED) {
+		state->besthash = state->confighash;
+	} else {
+#ifdef CONFIG_X86
+		if (sizeof(void*) == 4 && !raid_cpu_has_slowmult())
+			state->besthash = HASH_MURMUR3;
+		else
+			state->besthash = HASH_SPOOKY2;
+#else
+		if (sizeof(void*) == 4)
+			state->besthash = HASH_MURMUR3;
+		else
+			state->besthash = HASH_SPOOKY2;
+#endif
+	}
+
+	/* by default use the best hash */
+	state->hash = state->besthash;
+
+	/* by default use a random hash seed */
+	if (randomize(state->hashseed, HASH_MAX) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed to get random values.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* no previous hash by default */
+	state->prevhash = HASH_UNDEFINED;
+
+	/* intentionally not set the prevhashseed, if used valgrind will warn about it */
 
 	log_tag("blocksize:%u\n", state->block_size);
 	for (i = state->disklist; i != 0; i = i->next) {
@@ -1248,6 +1691,18 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 		log_tag("share:%s\n", state->share);
 	if (state->autosave != 0)
 		log_tag("autosave:%" PRIu64 "\n", state->autosave);
+	if (state->autosave_time != 0)
+		log_tag("autosavetime:%u\n", state->autosave_time);
+	if (state->smart_cache != 0)
+		log_tag("smartcache:%u\n", state->smart_cache);
+	if (state->content_sync != 0)
+		log_tag("contentsync:%u\n", state->content_sync);
+	if (state->schedule_dir[0] != 0)
+		log_tag("schedule:%s:%u:%u\n", state->schedule_dir, state->schedule_cpu, state->schedule_io);
+	if (state->opt.io_rate != 0)
+		log_tag("iorate:%u\n", state->opt.io_rate);
+	if (state->opt.io_idle)
+		log_tag("ioidle:\n");
 	for (i = tommy_list_head(&state->filterlist); i != 0; i = i->next) {
 		char out[PATH_MAX];
 		struct snapraid_filter* filter = i->data;
@@ -1451,11 +1906,10 @@ static void state_map(struct snapraid_state* state)
 	if (!state->opt.skip_parity_access) {
 		for (l = 0; l < state->level; ++l) {
 			for (s = 0; s < state->parity[l].split_mac; ++s) {
-				char uuid[UUID_MAX];
-				int ret;
+				const char* uuid = state->parity[l].split_map[s].device_uuid;
 
-				ret = devuuid(state->parity[l].split_map[s].device, uuid, sizeof(uuid));
-				if (ret != 0) {
+				/* the uuid is read by state_config() */
+				if (uuid[0] == 0) {
 					/* uuid not available, just ignore */
 					continue;
 				}
@@ -1576,7 +2030,10 @@ void state_refresh(struct snapraid_state* state)
 			uint64_t free_space;
 			int ret;
 
-			ret = fsinfo(state->parity[l].split_map[s].path, 0, 0, &total_space, &free_space);
+			if (remote_is(state->parity[l].split_map[s].path))
+				ret = remote_fsinfo(state->parity[l].split_map[s].path, &total_space, &free_space);
+			else
+				ret = fsinfo(state->parity[l].split_map[s].path, 0, 0, &total_space, &free_space);
 			if (ret != 0) {
 				/* LCOV_EXCL_START */
 				log_fatal("Error accessing file '%s' to get file-system info. %s.\n", state->parity[l].split_map[s].path, strerror(errno));
@@ -1753,95 +2210,282 @@ static void decoding_error(const char* path, STREAM* f)
 	}
 }
 
-static void state_read_content(struct snapraid_state* state, const char* path, STREAM* f)
+/**
+ * Adjust a block of a file just read from the content file.
+ */
+/**
+ * Read the hash of a block.
+ *
+ * If the hashes are not stored in memory, the hash is read and discarded.
+ */
+static int state_read_hash(STREAM* f, struct snapraid_block* block)
+{
+	unsigned char hash[HASH_MAX];
+
+	if (BLOCK_HASH_STORED)
+		return sread(f, block->hash, BLOCK_HASH_SIZE);
+
+	return sread(f, hash, BLOCK_HASH_SIZE);
+}
+
+static void state_read_block(struct snapraid_state* state, struct snapraid_block* block)
 {
+	/* if the block contains a hash of past data */
+	/* and we are clearing such indeterminate hashes */
+	if (state->clear_past_hash
+		&& block_has_past_hash(block)
+	) {
+		/* set the hash value to INVALID */
+		hash_invalid_set(block->hash);
+	}
+
+	/* if we are disabling the copy optimization */
+	/* we want also to clear any already previously stored information */
+	/* in other sync commands */
+	/* note that this is required only in sync, and we detect */
+	/* this using the clear_past_hash flag */
+	if (state->clear_past_hash
+		&& state->opt.force_nocopy
+		&& block_state_get(block) == BLOCK_STATE_REP
+	) {
+		/* set the hash value to INVALID */
+		hash_invalid_set(block->hash);
+		/* convert from REP to CHG block */
+		block_state_set(block, BLOCK_STATE_CHG);
+	}
+
+	/* if we want a full reallocation, marks block as invalid parity */
+	/* note that we do this after the force_nocopy option */
+	/* to avoid to mixup the two things */
+	if (state->opt.force_realloc
+		&& block_state_get(block) == BLOCK_STATE_BLK) {
+		/* convert from BLK to REP */
+		block_state_set(block, BLOCK_STATE_REP);
+	}
+}
+
+/**
+ * Offsets of a disk section in the content file.
+ */
+struct state_read_section {
+	int64_t disk_offset; /**< Offset of the 'S' command, or -1 if not yet read. */
+	int64_t hash_offset; /**< Offset of the hash array. */
+	int64_t end_offset; /**< Offset of the end of the section. */
+};
+
+/**
+ * Context for reading the entries of the disks.
+ *
+ * With sections, each one can be read by a different thread,
+ * because the entries of a section refer only to its disk.
+ */
+struct state_read_context {
+	struct snapraid_state* state;
+	const char* path;
 	block_off_t blockmax;
+	tommy_array* disk_mapping;
+	uint32_t mapping_max;
+	int version;
+	struct snapraid_disk* section_disk; /**< Disk of the section in progress, or 0. */
+	struct state_read_section* section; /**< Offsets of the sections, indexed by mapping. */
+	char sub_prev[PATH_MAX]; /**< Previous path read in the section, for the prefix compression. */
+	size_t sub_prev_len; /**< Length of the previous path. */
+#if HAVE_MT_READ
+	pthread_t thread;
+	STREAM* f; /**< Stream of the thread. */
+	int64_t end_offset; /**< End of the section read by the thread. */
+#endif
+	/* output */
 	unsigned count_file;
 	unsigned count_hardlink;
 	unsigned count_symlink;
 	unsigned count_dir;
-	int crc_checked;
-	char buffer[PATH_MAX];
-	int ret;
-	tommy_array disk_mapping;
-	uint32_t mapping_max;
+};
 
-	blockmax = 0;
-	count_file = 0;
-	count_hardlink = 0;
-	count_symlink = 0;
-	count_dir = 0;
-	crc_checked = 0;
-	mapping_max = 0;
-	tommy_array_init(&disk_mapping);
+/**
+ * Read the mapping of a disk entry, and return its disk.
+ */
+static struct snapraid_disk* state_read_mapping(struct state_read_context* ctx, STREAM* f, uint32_t* mapping)
+{
+	struct snapraid_disk* disk;
+	int ret;
 
-	ret = sread(f, buffer, 12);
-	if (ret < 0) {
+	ret = sgetb32(f, mapping);
+	if (ret < 0 || *mapping >= ctx->mapping_max) {
 		/* LCOV_EXCL_START */
-		decoding_error(path, f);
-		log_fatal("Invalid header!\n");
+		decoding_error(ctx->path, f);
+		log_fatal("Internal inconsistency in mapping index!\n");
 		os_abort();
 		/* LCOV_EXCL_STOP */
 	}
+	disk = tommy_array_get(ctx->disk_mapping, *mapping);
 
-	/*
-	 * File format versions:
-	 *  - SNAPCNT1/SnapRAID 4.0 First version.
-	 *  - SNAPCNT2/SnapRAID 7.0 Adds entries 'M' and 'P', to add free_blocks support.
-	 *    The previous 'm' entry is now deprecated, but supported for importing.
-	 *    Similarly for text file, we add 'mapping' and 'parity' deprecating 'map'.
-	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'y' for hash size.
-	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'Q' for multi parity file.
-	 *    The previous 'P' entry is now deprecated, but supported for importing.
-	 */
-	if (memcmp(buffer, "SNAPCNT1\n\3\0\0", 12) != 0
-		&& memcmp(buffer, "SNAPCNT2\n\3\0\0", 12) != 0
-		&& memcmp(buffer, "SNAPCNT3\n\3\0\0", 12) != 0
-	) {
+	/* a section contains only the entries of its disk */
+	if (ctx->section_disk != 0 && disk != ctx->section_disk) {
 		/* LCOV_EXCL_START */
-		if (memcmp(buffer, "SNAPCNT", 7) != 0) {
+		decoding_error(ctx->path, f);
+		log_fatal("Internal inconsistency for disk '%s' in the section of disk '%s'!\n", disk->name, ctx->section_disk->name);
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	return disk;
+}
+
+/**
+ * Read the path of a file, link, dir or dir stamp.
+ *
+ * From version 4, the paths are stored with the length of the prefix
+ * in common with the previous path of the section, followed by the rest.
+ */
+static int state_read_sub(struct state_read_context* ctx, STREAM* f, char* sub, int size)
+{
+	uint32_t prefix;
+	size_t len;
+	int ret;
+
+	if (ctx->version < 4)
+		return sgetbs(f, sub, size);
+
+	ret = sgetb32(f, &prefix);
+	if (ret < 0 || prefix > ctx->sub_prev_len) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	ret = sgetbs(f, sub + prefix, size - prefix);
+	if (ret < 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	memcpy(sub, ctx->sub_prev, prefix);
+
+	len = prefix + strlen(sub + prefix);
+	memcpy(ctx->sub_prev, sub, len + 1);
+	ctx->sub_prev_len = len;
+
+	return 0;
+}
+
+/**
+ * Read an entry of a disk.
+ * Return -1 if the command is not a disk entry.
+ */
+static int state_read_disk_entry(struct state_read_context* ctx, STREAM* f, int c)
+{
+	struct snapraid_state* state = ctx->state;
+	const char* path = ctx->path;
+	block_off_t blockmax = ctx->blockmax;
+	tommy_array* disk_mapping = ctx->disk_mapping;
+	uint32_t mapping_max = ctx->mapping_max;
+	int version = ctx->version;
+	int ret;
+
+	if (c == 'f') {
+		/* file */
+		char sub[PATH_MAX];
+		uint64_t v_size;
+		uint64_t v_mtime_sec;
+		uint32_t v_mtime_nsec;
+		uint64_t v_inode;
+		uint32_t v_idx;
+		struct snapraid_file* file;
+		struct snapraid_disk* disk;
+		uint32_t mapping;
+
+		disk = state_read_mapping(ctx, f, &mapping);
+
+		ret = sgetb64(f, &v_size);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
 			decoding_error(path, f);
-			log_fatal("Invalid header!\n");
 			os_abort();
-		} else {
-			log_fatal("The content file '%s' was generated with a newer version of SnapRAID!\n", path);
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (state->block_size == 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency due zero blocksize!\n");
 			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
 		}
-		/* LCOV_EXCL_STOP */
-	}
 
-	while (1) {
-		int c;
+		/* check for impossible file size to avoid to crash for a too big allocation */
+		if (v_size / state->block_size > blockmax) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency in file size too big!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-		/* read the command */
-		c = sgetc(f);
-		if (c == EOF) {
-			break;
+		ret = sgetb64(f, &v_mtime_sec);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
 		}
 
-		if (c == 'f') {
-			/* file */
-			char sub[PATH_MAX];
-			uint64_t v_size;
-			uint64_t v_mtime_sec;
-			uint32_t v_mtime_nsec;
-			uint64_t v_inode;
-			uint32_t v_idx;
-			struct snapraid_file* file;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
+		ret = sgetb32(f, &v_mtime_nsec);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			disk = tommy_array_get(&disk_mapping, mapping);
+		/* STAT_NSEC_INVALID is encoded as 0 */
+		if (v_mtime_nsec == 0)
+			v_mtime_nsec = STAT_NSEC_INVALID;
+		else
+			--v_mtime_nsec;
+
+		ret = sgetb64(f, &v_inode);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		ret = state_read_sub(ctx, f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null file!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* allocate the file */
+		file = file_alloc(&disk->arena, state->block_size, sub, v_size, v_mtime_sec, v_mtime_nsec, v_inode, 0);
+
+		/* insert the file in the file containers */
+		/* the inode and stamp containers are filled later by state_fileset(), only if needed */
+		tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
+		tommy_list_insert_tail(&disk->filelist, &file->nodelist, file);
 
-			ret = sgetb64(f, &v_size);
+		/* read all the blocks */
+		v_idx = 0;
+		while (v_idx < file->blockmax) {
+			block_off_t v_pos;
+			uint32_t v_count;
+
+			/* get the "subcommand */
+			c = sgetc(f);
+
+			ret = sgetb32(f, &v_pos);
 			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -1849,203 +2493,926 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				/* LCOV_EXCL_STOP */
 			}
 
-			if (state->block_size == 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency due zero blocksize!\n");
-				exit(EXIT_FAILURE);
-				/* LCOV_EXCL_STOP */
-			}
-
-			/* check for impossible file size to avoid to crash for a too big allocation */
-			if (v_size / state->block_size > blockmax) {
+			ret = sgetb32(f, &v_count);
+			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
-				log_fatal("Internal inconsistency in file size too big!\n");
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
 
-			ret = sgetb64(f, &v_mtime_sec);
-			if (ret < 0) {
+			if (v_idx + v_count > file->blockmax) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
+				log_fatal("Internal inconsistency in block number!\n");
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
 
-			ret = sgetb32(f, &v_mtime_nsec);
-			if (ret < 0) {
+			if (v_pos + v_count > blockmax) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
+				log_fatal("Internal inconsistency in block size %u/%u!\n", blockmax, v_pos + v_count);
 				os_abort();
-				/* LCOV_EXCL_STOP */
+				/* LCOV_EXCL_START */
 			}
 
-			/* STAT_NSEC_INVALID is encoded as 0 */
-			if (v_mtime_nsec == 0)
-				v_mtime_nsec = STAT_NSEC_INVALID;
-			else
-				--v_mtime_nsec;
+			/* fill the blocks in the run */
+			while (v_count) {
+				struct snapraid_block* block = fs_file2block_get(file, v_idx);
 
-			ret = sgetb64(f, &v_inode);
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
+				switch (c) {
+				case 'b' :
+					block_state_set(block, BLOCK_STATE_BLK);
+					break;
+				case 'n' :
+					/* deprecated NEW blocks are converted to CHG ones */
+					block_state_set(block, BLOCK_STATE_CHG);
+					break;
+				case 'g' :
+					block_state_set(block, BLOCK_STATE_CHG);
+					break;
+				case 'p' :
+					block_state_set(block, BLOCK_STATE_REP);
+					break;
+				default :
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					log_fatal("Invalid block type!\n");
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+
+				/* in version 4 the hash is read later from the hash array */
+				if (version < 4) {
+					/* read the hash only for 'blk/chg/rep', and not for 'new' */
+					if (c != 'n') {
+						ret = state_read_hash(f, block);
+						if (ret < 0) {
+							/* LCOV_EXCL_START */
+							decoding_error(path, f);
+							os_abort();
+							/* LCOV_EXCL_STOP */
+						}
+					} else if (BLOCK_HASH_STORED) {
+						/* set the ZERO hash for deprecated NEW blocks */
+						hash_zero_set(block->hash);
+					}
+
+					state_read_block(state, block);
+				}
+
+				/* set the parity association */
+				fs_allocate(disk, v_pos, file, v_idx);
+
+				/* go to the next block */
+				++v_idx;
+				++v_pos;
+				--v_count;
 			}
+		}
 
-			ret = sgetbs(f, sub, sizeof(sub));
+		/* stat */
+		++ctx->count_file;
+	} else if (c == 'h') {
+		/* hole */
+		uint32_t v_pos;
+		struct snapraid_disk* disk;
+		uint32_t mapping;
+
+		disk = state_read_mapping(ctx, f, &mapping);
+
+		v_pos = 0;
+		while (v_pos < blockmax) {
+			uint32_t v_idx;
+			uint32_t v_count;
+			struct snapraid_file* deleted;
+
+			ret = sgetb32(f, &v_count);
 			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
-			if (!*sub) {
+
+			if (v_pos + v_count > blockmax) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null file!\n");
+				log_fatal("Internal inconsistency in hole size %u/%u!\n", blockmax, v_pos + v_count);
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
 
-			/* allocate the file */
-			file = file_alloc(state->block_size, sub, v_size, v_mtime_sec, v_mtime_nsec, v_inode, 0);
-
-			/* insert the file in the file containers */
-			tommy_hashdyn_insert(&disk->inodeset, &file->nodeset, file, file_inode_hash(file->inode));
-			tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
-			tommy_hashdyn_insert(&disk->stampset, &file->stampset, file, file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec));
-			tommy_list_insert_tail(&disk->filelist, &file->nodelist, file);
-
-			/* read all the blocks */
-			v_idx = 0;
-			while (v_idx < file->blockmax) {
-				block_off_t v_pos;
-				uint32_t v_count;
-
-				/* get the "subcommand */
-				c = sgetc(f);
+			/* get the sub-command */
+			c = sgetc(f);
 
-				ret = sgetb32(f, &v_pos);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+			switch (c) {
+			case 'o' :
+				/* if it's a run of deleted blocks */
 
-				ret = sgetb32(f, &v_count);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+				/* allocate a fake deleted file */
+				deleted = file_alloc(&disk->arena, state->block_size, "<deleted>", v_count * (data_off_t)state->block_size, 0, 0, 0, 0);
 
-				if (v_idx + v_count > file->blockmax) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Internal inconsistency in block number!\n");
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+				/* mark the file as deleted */
+				file_flag_set(deleted, FILE_IS_DELETED);
 
-				if (v_pos + v_count > blockmax) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Internal inconsistency in block size %u/%u!\n", blockmax, v_pos + v_count);
-					os_abort();
-					/* LCOV_EXCL_START */
-				}
+				/* insert it in the list of deleted files */
+				tommy_list_insert_tail(&disk->deletedlist, &deleted->nodelist, deleted);
 
-				/* fill the blocks in the run */
+				/* process all blocks */
+				v_idx = 0;
 				while (v_count) {
-					struct snapraid_block* block = fs_file2block_get(file, v_idx);
+					struct snapraid_block* block = fs_file2block_get(deleted, v_idx);
 
-					switch (c) {
-					case 'b' :
-						block_state_set(block, BLOCK_STATE_BLK);
-						break;
-					case 'n' :
-						/* deprecated NEW blocks are converted to CHG ones */
-						block_state_set(block, BLOCK_STATE_CHG);
-						break;
-					case 'g' :
-						block_state_set(block, BLOCK_STATE_CHG);
-						break;
-					case 'p' :
-						block_state_set(block, BLOCK_STATE_REP);
-						break;
-					default :
-						/* LCOV_EXCL_START */
-						decoding_error(path, f);
-						log_fatal("Invalid block type!\n");
-						os_abort();
-						/* LCOV_EXCL_STOP */
-					}
+					/* set the block as deleted */
+					block_state_set(block, BLOCK_STATE_DELETED);
 
-					/* read the hash only for 'blk/chg/rep', and not for 'new' */
-					if (c != 'n') {
-						ret = sread(f, block->hash, BLOCK_HASH_SIZE);
+					/* in version 4 the hash is read later from the hash array */
+					if (version < 4) {
+						/* read the hash */
+						ret = state_read_hash(f, block);
 						if (ret < 0) {
 							/* LCOV_EXCL_START */
 							decoding_error(path, f);
 							os_abort();
 							/* LCOV_EXCL_STOP */
 						}
-					} else {
-						/* set the ZERO hash for deprecated NEW blocks */
-						hash_zero_set(block->hash);
-					}
-
-					/* if the block contains a hash of past data */
-					/* and we are clearing such indeterminate hashes */
-					if (state->clear_past_hash
-						&& block_has_past_hash(block)
-					) {
-						/* set the hash value to INVALID */
-						hash_invalid_set(block->hash);
-					}
-
-					/* if we are disabling the copy optimization */
-					/* we want also to clear any already previously stored information */
-					/* in other sync commands */
-					/* note that this is required only in sync, and we detect */
-					/* this using the clear_past_hash flag */
-					if (state->clear_past_hash
-						&& state->opt.force_nocopy
-						&& block_state_get(block) == BLOCK_STATE_REP
-					) {
-						/* set the hash value to INVALID */
-						hash_invalid_set(block->hash);
-						/* convert from REP to CHG block */
-						block_state_set(block, BLOCK_STATE_CHG);
-					}
 
-					/* if we want a full reallocation, marks block as invalid parity */
-					/* note that we do this after the force_nocopy option */
-					/* to avoid to mixup the two things */
-					if (state->opt.force_realloc
-						&& block_state_get(block) == BLOCK_STATE_BLK) {
-						/* convert from BLK to REP */
-						block_state_set(block, BLOCK_STATE_REP);
+						/* if we are clearing indeterminate hashes */
+						if (state->clear_past_hash) {
+							/* set the hash value to INVALID */
+							hash_invalid_set(block->hash);
+						}
 					}
 
-					/* set the parity association */
-					fs_allocate(disk, v_pos, file, v_idx);
+					/* insert the block in the block array */
+					fs_allocate(disk, v_pos, deleted, v_idx);
 
-					/* go to the next block */
-					++v_idx;
+					/* go to next block */
 					++v_pos;
+					++v_idx;
 					--v_count;
 				}
+				break;
+			case 'O' :
+				/* go to the next run */
+				v_pos += v_count;
+				break;
+			default :
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				log_fatal("Invalid hole type!\n");
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+		}
+	} else if (c == 's') {
+		/* symlink */
+		char sub[PATH_MAX];
+		char linkto[PATH_MAX];
+		struct snapraid_link* slink;
+		struct snapraid_disk* disk;
+		uint32_t mapping;
+
+		disk = state_read_mapping(ctx, f, &mapping);
+
+		ret = state_read_sub(ctx, f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null symlink!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		ret = sgetbs(f, linkto, sizeof(linkto));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* allocate the link as symbolic link */
+		slink = link_alloc(&disk->arena, sub, linkto, FILE_IS_SYMLINK);
+
+		/* insert the link in the link containers */
+		tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
+		tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
+
+		/* stat */
+		++ctx->count_symlink;
+	} else if (c == 'a') {
+		/* hardlink */
+		char sub[PATH_MAX];
+		char linkto[PATH_MAX];
+		struct snapraid_link* slink;
+		struct snapraid_disk* disk;
+		uint32_t mapping;
+
+		disk = state_read_mapping(ctx, f, &mapping);
+
+		ret = state_read_sub(ctx, f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null hardlink!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		ret = sgetbs(f, linkto, sizeof(linkto));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (!*linkto) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for empty hardlink '%s'!\n", sub);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* allocate the link as hard link */
+		slink = link_alloc(&disk->arena, sub, linkto, FILE_IS_HARDLINK);
+
+		/* insert the link in the link containers */
+		tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
+		tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
+
+		/* stat */
+		++ctx->count_hardlink;
+	} else if (c == 'r') {
+		/* dir */
+		char sub[PATH_MAX];
+		struct snapraid_dir* dir;
+		struct snapraid_disk* disk;
+		uint32_t mapping;
+
+		disk = state_read_mapping(ctx, f, &mapping);
+
+		ret = state_read_sub(ctx, f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null dir!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* allocate the dir */
+		dir = dir_alloc(&disk->arena, sub);
+
+		/* insert the dir in the dir containers */
+		tommy_hashdyn_insert(&disk->dirset, &dir->nodeset, dir, dir_name_hash(dir->sub));
+		tommy_list_insert_tail(&disk->dirlist, &dir->nodelist, dir);
+
+		/* stat */
+		++ctx->count_dir;
+	} else if (c == 'D') {
+		/* from SnapRAID 12.0 the 'D' command stores the dir stamps */
+		struct snapraid_disk* disk;
+		uint32_t mapping;
+		uint32_t v_filter;
+		uint32_t v_count;
+		uint32_t k;
+
+		disk = state_read_mapping(ctx, f, &mapping);
+
+		ret = sgetb32(f, &v_filter);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		ret = sgetb32(f, &v_count);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		disk->dirstamp_filter = v_filter;
+
+		for (k = 0; k < v_count; ++k) {
+			char sub[PATH_MAX];
+			struct snapraid_dirstamp* dirstamp;
+			uint64_t v_inode;
+			uint64_t v_mtime_sec;
+			uint32_t v_mtime_nsec;
+
+			ret = sgetb64(f, &v_inode);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetb64(f, &v_mtime_sec);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetb32(f, &v_mtime_nsec);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = state_read_sub(ctx, f, sub, sizeof(sub));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* STAT_NSEC_INVALID is encoded as 0 */
+			if (v_mtime_nsec == 0)
+				v_mtime_nsec = STAT_NSEC_INVALID;
+			else
+				--v_mtime_nsec;
+
+			dirstamp = dirstamp_alloc(sub, v_inode, v_mtime_sec, v_mtime_nsec);
+
+			tommy_hashdyn_insert(&disk->dirstampset, &dirstamp->nodeset, dirstamp, dirstamp_name_hash(dirstamp->sub));
+			tommy_list_insert_tail(&disk->dirstamplist, &dirstamp->nodelist, dirstamp);
+		}
+	} else if (c == 'S') {
+		/* from SnapRAID 12.0 the 'S' command starts the section of a disk */
+		uint32_t mapping;
+		uint32_t count[4];
+		unsigned i;
+		int64_t section_offset;
+
+		/* offset of the command */
+		section_offset = stell(f) - 1;
+
+		ret = sgetb32(f, &mapping);
+		if (ret < 0 || mapping >= mapping_max) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency in mapping index!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+		ctx->section_disk = tommy_array_get(disk_mapping, mapping);
+
+		/* the number of files, links, dirs and dir stamps of the section */
+		for (i = 0; i < 4; ++i) {
+			ret = sgetb32(f, &count[i]);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+		}
+
+		/* size the hashtables only once, and not at each insertion */
+		tommy_hashdyn_reserve(&ctx->section_disk->pathset, count[0]);
+		tommy_hashdyn_reserve(&ctx->section_disk->linkset, count[1]);
+		tommy_hashdyn_reserve(&ctx->section_disk->dirset, count[2]);
+		tommy_hashdyn_reserve(&ctx->section_disk->dirstampset, count[3]);
+
+		if (ctx->section[mapping].disk_offset != -1) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for duplicate disk section!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		ctx->section[mapping].disk_offset = section_offset;
+
+		/* the prefix compression of the paths restarts in each section */
+		ctx->sub_prev[0] = 0;
+		ctx->sub_prev_len = 0;
+	} else if (c == 'H' || c == 'Z') {
+		/* from SnapRAID 12.0 the 'H' command stores the hash array of a disk */
+		/* and the 'Z' command stores the same array run-length encoded */
+		struct snapraid_disk* disk;
+		uint32_t mapping;
+		uint32_t v_count;
+		uint32_t v_pos;
+		int pad;
+
+		disk = state_read_mapping(ctx, f, &mapping);
+
+		if (disk != ctx->section_disk) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for hash array outside its section!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		ret = sgetb32(f, &v_count);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* all the used positions must have a hash */
+		if (v_count < fs_size(disk)) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency in hash array size %u/%u!\n", v_count, fs_size(disk));
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (c == 'Z') {
+			ctx->section[mapping].hash_offset = stell(f);
+
+			v_pos = 0;
+			while (v_pos < v_count) {
+				uint32_t v_run;
+				uint32_t j;
+				int kind;
+
+				ret = sgetb32(f, &v_run);
+				if (ret < 0) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+
+				kind = sgetc(f);
+				if (v_run == 0 || v_run > v_count - v_pos
+					|| (kind != CONTENT_RUN_INVALID && kind != CONTENT_RUN_ZERO && kind != CONTENT_RUN_HASH)) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					log_fatal("Internal inconsistency in hash run!\n");
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+
+				for (j = 0; j < v_run; ++j) {
+					unsigned char hash[HASH_MAX];
+					struct snapraid_block* block;
+
+					if (kind == CONTENT_RUN_HASH) {
+						ret = sread(f, hash, BLOCK_HASH_SIZE);
+						if (ret < 0) {
+							/* LCOV_EXCL_START */
+							decoding_error(path, f);
+							os_abort();
+							/* LCOV_EXCL_STOP */
+						}
+					}
+
+					block = fs_par2block_find(disk, v_pos + j);
+					if (block == BLOCK_NULL)
+						continue;
+
+					if (BLOCK_HASH_STORED) {
+						if (kind == CONTENT_RUN_HASH)
+							memcpy(block->hash, hash, BLOCK_HASH_SIZE);
+						else if (kind == CONTENT_RUN_ZERO)
+							hash_zero_set(block->hash);
+						else
+							hash_invalid_set(block->hash);
+					}
+
+					state_read_block(state, block);
+				}
+
+				v_pos += v_run;
+			}
+
+			/* end of the section */
+			ctx->section[mapping].end_offset = stell(f);
+			ctx->section_disk = 0;
+			return 0;
+		}
+
+		/* skip the alignment */
+		pad = sgetc(f);
+		if (pad < 0 || pad >= CONTENT_ALIGN) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+		while (pad--)
+			sgetc(f);
+
+		ctx->section[mapping].hash_offset = stell(f);
+
+		for (v_pos = 0; v_pos < v_count; ++v_pos) {
+			unsigned char hash[HASH_MAX];
+			struct snapraid_block* block;
+
+			ret = sread(f, hash, BLOCK_HASH_SIZE);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* unused positions have a zero hash */
+			block = fs_par2block_find(disk, v_pos);
+			if (block == BLOCK_NULL)
+				continue;
+
+			if (BLOCK_HASH_STORED)
+				memcpy(block->hash, hash, BLOCK_HASH_SIZE);
+
+			state_read_block(state, block);
+		}
+
+		/* end of the section */
+		ctx->section[mapping].end_offset = stell(f);
+		ctx->section_disk = 0;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+#if HAVE_MT_READ
+static void* state_read_section_thread(void* arg)
+{
+	struct state_read_context* ctx = arg;
+	STREAM* f = ctx->f;
+	int c;
+
+	/* the section starts with its 'S' command */
+	c = sgetc(f);
+	if (c != 'S') {
+		/* LCOV_EXCL_START */
+		decoding_error(ctx->path, f);
+		log_fatal("Missing start of section!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	while (1) {
+		if (state_read_disk_entry(ctx, f, c) != 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(ctx->path, f);
+			log_fatal("Invalid command '%c' in section!\n", (char)c);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* the section ends with its hash array */
+		if (ctx->section_disk == 0)
+			break;
+
+		c = sgetc(f);
+
+		/* a new section cannot start before the end of this one */
+		if (c == 'S') {
+			/* LCOV_EXCL_START */
+			decoding_error(ctx->path, f);
+			log_fatal("Missing hash array for disk '%s'!\n", ctx->section_disk->name);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reading the content file '%s' at offset %" PRIi64 "\n", ctx->path, stell(f));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (stell(f) != ctx->end_offset) {
+		/* LCOV_EXCL_START */
+		decoding_error(ctx->path, f);
+		log_fatal("Internal inconsistency in section size!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+}
+
+/**
+ * Read all the sections in parallel, one thread for each disk.
+ *
+ * The sections are located with the index at the end of the file.
+ * The main stream skips all the sections, still computing the CRC of the whole file.
+ * Note that the 'S' command of the first section was already read.
+ */
+static void state_read_parallel(struct state_read_context* ctx, STREAM* f)
+{
+	struct state_read_context* context;
+	STREAM* g;
+	struct stat st;
+	uint32_t index_low;
+	uint32_t index_high;
+	int64_t index_offset;
+	int64_t offset;
+	uint32_t v_count;
+	uint32_t k;
+	int ret;
+
+	offset = stell(f) - 1;
+
+	g = sopen_read(ctx->path);
+	if (g == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reopening the content file '%s'. %s.\n", ctx->path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	ret = fstat(shandle(g), &st);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error stating the content file '%s'. %s.\n", ctx->path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* the index position is stored before the final 'N' command and its CRC */
+	if (st.st_size < offset + 13
+		|| sseek(g, st.st_size - 13) != 0
+		|| sgetble32(g, &index_low) < 0
+		|| sgetble32(g, &index_high) < 0
+		|| sgetc(g) != 'N'
+	) {
+		/* LCOV_EXCL_START */
+		decoding_error(ctx->path, f);
+		log_fatal("Missing the section index!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	index_offset = index_low + ((int64_t)index_high << 32);
+
+	if (index_offset <= offset
+		|| sseek(g, index_offset) != 0
+		|| sgetc(g) != 'X'
+		|| sgetb32(g, &v_count) < 0
+		|| v_count == 0
+		|| v_count > ctx->mapping_max
+	) {
+		/* LCOV_EXCL_START */
+		decoding_error(ctx->path, f);
+		log_fatal("Invalid section index!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	context = malloc_nofail(v_count * sizeof(struct state_read_context));
+
+	for (k = 0; k < v_count; ++k) {
+		uint32_t mapping;
+		uint64_t v_disk_offset;
+		uint64_t v_hash_offset;
+		uint64_t v_end_offset;
+
+		if (sgetb32(g, &mapping) < 0
+			|| mapping >= ctx->mapping_max
+			|| sgetb64(g, &v_disk_offset) < 0
+			|| sgetb64(g, &v_hash_offset) < 0
+			|| sgetb64(g, &v_end_offset) < 0
+			|| (int64_t)v_disk_offset != offset /* the sections are contiguous */
+			|| v_end_offset <= v_disk_offset
+			|| (int64_t)v_end_offset > index_offset
+		) {
+			/* LCOV_EXCL_START */
+			decoding_error(ctx->path, f);
+			log_fatal("Invalid section index!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		context[k] = *ctx;
+		context[k].end_offset = v_end_offset;
+
+		offset = v_end_offset;
+	}
+
+	sclose(g);
+
+	/* start all reading threads */
+	for (k = 0; k < v_count; ++k) {
+		g = sopen_read(ctx->path);
+		if (g == 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error reopening the content file '%s'. %s.\n", ctx->path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		context[k].f = g;
+
+		/* the section starts at the end of the previous one */
+		if (sseek(g, k == 0 ? stell(f) - 1 : context[k - 1].end_offset) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error seeking the content file '%s'. %s.\n", ctx->path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		thread_create(&context[k].thread, 0, state_read_section_thread, &context[k]);
+	}
+
+	/* skip all the sections, but include them in the CRC */
+	while (stell(f) < offset) {
+		unsigned char buffer[4096];
+		int64_t size = offset - stell(f);
+
+		if (size > (int64_t)sizeof(buffer))
+			size = sizeof(buffer);
+
+		ret = sread(f, buffer, size);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(ctx->path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	/* join all threads */
+	for (k = 0; k < v_count; ++k) {
+		void* retval;
+
+		thread_join(context[k].thread, &retval);
+
+		sclose(context[k].f);
+
+		ctx->count_file += context[k].count_file;
+		ctx->count_hardlink += context[k].count_hardlink;
+		ctx->count_symlink += context[k].count_symlink;
+		ctx->count_dir += context[k].count_dir;
+	}
+
+	free(context);
+}
+#endif
+
+static void state_read_content(struct snapraid_state* state, const char* path, STREAM* f)
+{
+	block_off_t blockmax;
+	struct state_read_context ctx;
+	int crc_checked;
+	char buffer[PATH_MAX];
+	int ret;
+	tommy_array disk_mapping;
+	uint32_t mapping_max;
+	int version;
+
+	blockmax = 0;
+	crc_checked = 0;
+	mapping_max = 0;
+	tommy_array_init(&disk_mapping);
+
+	ret = sread(f, buffer, 12);
+	if (ret < 0) {
+		/* LCOV_EXCL_START */
+		decoding_error(path, f);
+		log_fatal("Invalid header!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	/*
+	 * File format versions:
+	 *  - SNAPCNT1/SnapRAID 4.0 First version.
+	 *  - SNAPCNT2/SnapRAID 7.0 Adds entries 'M' and 'P', to add free_blocks support.
+	 *    The previous 'm' entry is now deprecated, but supported for importing.
+	 *    Similarly for text file, we add 'mapping' and 'parity' deprecating 'map'.
+	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'y' for hash size.
+	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'Q' for multi parity file.
+	 *    The previous 'P' entry is now deprecated, but supported for importing.
+	 *  - SNAPCNT3/SnapRAID 12.0 Adds entry 'J' for the change journal position.
+	 *    It's written only if the 'journal' option is used.
+	 *  - SNAPCNT3/SnapRAID 12.0 Adds entry 'D' for the dir stamps.
+	 *    It's written only if the 'dircache' option is used.
+	 *  - SNAPCNT4/SnapRAID 12.0 Adds entries 'S', 'H' and 'X'.
+	 *    The entries of each disk are grouped in a section starting with 'S',
+	 *    with the number of files, links, dirs and dir stamps of the disk.
+	 *    The block hashes are not stored anymore in the 'b/g/p' and 'o' entries,
+	 *    but in the 'H' array of the disk, with fixed size and aligned, indexed
+	 *    by parity position. The 'X' index, at a fixed offset from the file end,
+	 *    has the offsets of all the sections and hash arrays, allowing to read
+	 *    the sections in parallel.
+	 *    The paths of files, links, dirs and dir stamps are stored as the
+	 *    length of the prefix in common with the previous path of the section,
+	 *    followed by the rest of the path.
+	 *    It's written only if the 'contentformat 4' option is used.
+	 *  - SNAPCNT4/SnapRAID 12.0 Adds entry 'Z'' for the run-length encoded hash array.
+	 *    It replaces 'H', and it's written only if the 'contentcompress' option is used.
+	 */
+	if (memcmp(buffer, "SNAPCNT1\n\3\0\0", 12) != 0
+		&& memcmp(buffer, "SNAPCNT2\n\3\0\0", 12) != 0
+		&& memcmp(buffer, "SNAPCNT3\n\3\0\0", 12) != 0
+		&& memcmp(buffer, "SNAPCNT4\n\3\0\0", 12) != 0
+	) {
+		/* LCOV_EXCL_START */
+		if (memcmp(buffer, "SNAPCNT", 7) != 0) {
+			decoding_error(path, f);
+			log_fatal("Invalid header!\n");
+			os_abort();
+		} else {
+			log_fatal("The content file '%s' was generated with a newer version of SnapRAID!\n", path);
+			exit(EXIT_FAILURE);
+		}
+		/* LCOV_EXCL_STOP */
+	}
+
+	version = buffer[7] - '0';
+
+	ctx.state = state;
+	ctx.path = path;
+	ctx.disk_mapping = &disk_mapping;
+	ctx.version = version;
+	ctx.section_disk = 0;
+	ctx.sub_prev[0] = 0;
+	ctx.sub_prev_len = 0;
+	ctx.section = 0;
+	ctx.count_file = 0;
+	ctx.count_hardlink = 0;
+	ctx.count_symlink = 0;
+	ctx.count_dir = 0;
+
+	while (1) {
+		int c;
+
+		/* read the command */
+		c = sgetc(f);
+		if (c == EOF) {
+			break;
+		}
+
+		/* in version 4 each disk section must end with its hash array */
+		if (ctx.section_disk != 0 && c != 'f' && c != 'a' && c != 's' && c != 'r' && c != 'D' && c != 'h' && c != 'H' && c != 'Z') {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Missing hash array for disk '%s'!\n", ctx.section_disk->name);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (c == 'f' || c == 'a' || c == 's' || c == 'r' || c == 'D' || c == 'h' || c == 'S' || c == 'H' || c == 'Z') {
+			uint32_t k;
+
+			/* the entries of the disks use the data read until now */
+			ctx.blockmax = blockmax;
+			ctx.mapping_max = mapping_max;
+
+			/* the mapping is complete before the first section */
+			if (c == 'S' && !ctx.section) {
+				ctx.section = malloc_nofail((mapping_max + 1) * sizeof(struct state_read_section));
+				for (k = 0; k < mapping_max; ++k)
+					ctx.section[k].disk_offset = -1;
+
+#if HAVE_MT_READ
+				/* read all the sections in parallel */
+				state_read_parallel(&ctx, f);
+				continue;
+#endif
 			}
 
-			/* stat */
-			++count_file;
+			state_read_disk_entry(&ctx, f, c);
 		} else if (c == 'i') {
 			/* "inf" command */
 			snapraid_info info;
@@ -2060,6 +3427,9 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				/* LCOV_EXCL_STOP */
 			}
 
+			/* all the times stored are newer than the oldest */
+			infoarr_base(&state->infoarr, v_oldest);
+
 			v_pos = 0;
 			while (v_pos < blockmax) {
 				int bad;
@@ -2145,256 +3515,6 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 					--v_count;
 				}
 			}
-		} else if (c == 'h') {
-			/* hole */
-			uint32_t v_pos;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
-
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			disk = tommy_array_get(&disk_mapping, mapping);
-
-			v_pos = 0;
-			while (v_pos < blockmax) {
-				uint32_t v_idx;
-				uint32_t v_count;
-				struct snapraid_file* deleted;
-
-				ret = sgetb32(f, &v_count);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
-
-				if (v_pos + v_count > blockmax) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Internal inconsistency in hole size %u/%u!\n", blockmax, v_pos + v_count);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
-
-				/* get the sub-command */
-				c = sgetc(f);
-
-				switch (c) {
-				case 'o' :
-					/* if it's a run of deleted blocks */
-
-					/* allocate a fake deleted file */
-					deleted = file_alloc(state->block_size, "<deleted>", v_count * (data_off_t)state->block_size, 0, 0, 0, 0);
-
-					/* mark the file as deleted */
-					file_flag_set(deleted, FILE_IS_DELETED);
-
-					/* insert it in the list of deleted files */
-					tommy_list_insert_tail(&disk->deletedlist, &deleted->nodelist, deleted);
-
-					/* process all blocks */
-					v_idx = 0;
-					while (v_count) {
-						struct snapraid_block* block = fs_file2block_get(deleted, v_idx);
-
-						/* set the block as deleted */
-						block_state_set(block, BLOCK_STATE_DELETED);
-
-						/* read the hash */
-						ret = sread(f, block->hash, BLOCK_HASH_SIZE);
-						if (ret < 0) {
-							/* LCOV_EXCL_START */
-							decoding_error(path, f);
-							os_abort();
-							/* LCOV_EXCL_STOP */
-						}
-
-						/* if we are clearing indeterminate hashes */
-						if (state->clear_past_hash) {
-							/* set the hash value to INVALID */
-							hash_invalid_set(block->hash);
-						}
-
-						/* insert the block in the block array */
-						fs_allocate(disk, v_pos, deleted, v_idx);
-
-						/* go to next block */
-						++v_pos;
-						++v_idx;
-						--v_count;
-					}
-					break;
-				case 'O' :
-					/* go to the next run */
-					v_pos += v_count;
-					break;
-				default :
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Invalid hole type!\n");
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
-			}
-		} else if (c == 's') {
-			/* symlink */
-			char sub[PATH_MAX];
-			char linkto[PATH_MAX];
-			struct snapraid_link* slink;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
-
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			disk = tommy_array_get(&disk_mapping, mapping);
-
-			ret = sgetbs(f, sub, sizeof(sub));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			if (!*sub) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null symlink!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			ret = sgetbs(f, linkto, sizeof(linkto));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			/* allocate the link as symbolic link */
-			slink = link_alloc(sub, linkto, FILE_IS_SYMLINK);
-
-			/* insert the link in the link containers */
-			tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
-			tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
-
-			/* stat */
-			++count_symlink;
-		} else if (c == 'a') {
-			/* hardlink */
-			char sub[PATH_MAX];
-			char linkto[PATH_MAX];
-			struct snapraid_link* slink;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
-
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			disk = tommy_array_get(&disk_mapping, mapping);
-
-			ret = sgetbs(f, sub, sizeof(sub));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			if (!*sub) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null hardlink!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			ret = sgetbs(f, linkto, sizeof(linkto));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			if (!*linkto) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency for empty hardlink '%s'!\n", sub);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			/* allocate the link as hard link */
-			slink = link_alloc(sub, linkto, FILE_IS_HARDLINK);
-
-			/* insert the link in the link containers */
-			tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
-			tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
-
-			/* stat */
-			++count_hardlink;
-		} else if (c == 'r') {
-			/* dir */
-			char sub[PATH_MAX];
-			struct snapraid_dir* dir;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
-
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			disk = tommy_array_get(&disk_mapping, mapping);
-
-			ret = sgetbs(f, sub, sizeof(sub));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			if (!*sub) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null dir!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-
-			/* allocate the dir */
-			dir = dir_alloc(sub);
-
-			/* insert the dir in the dir containers */
-			tommy_hashdyn_insert(&disk->dirset, &dir->nodeset, dir, dir_name_hash(dir->sub));
-			tommy_list_insert_tail(&disk->dirlist, &dir->nodelist, dir);
-
-			/* stat */
-			++count_dir;
 		} else if (c == 'c') {
 			/* get the subcommand */
 			c = sgetc(f);
@@ -2409,6 +3529,9 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 			case 'm' :
 				state->hash = HASH_METRO;
 				break;
+			case 'x' :
+				state->hash = HASH_XXH3;
+				break;
 			default :
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -2439,6 +3562,9 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 			case 'm' :
 				state->prevhash = HASH_METRO;
 				break;
+			case 'x' :
+				state->prevhash = HASH_XXH3;
+				break;
 			default :
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -2795,13 +3921,153 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 						pathcpy(state->parity[v_level].split_map[s].uuid, sizeof(state->parity[v_level].split_map[s].uuid), v_uuid);
 						state->parity[v_level].split_map[s].size = v_size;
 
-						/* log the info read from the content file */
-						log_tag("content:%s:%u:%s:%s:%" PRIi64 "\n", lev_config_name(v_level), s,
-							state->parity[v_level].split_map[s].path,
-							state->parity[v_level].split_map[s].uuid,
-							state->parity[v_level].split_map[s].size);
-					}
-				}
+						/* log the info read from the content file */
+						log_tag("content:%s:%u:%s:%s:%" PRIi64 "\n", lev_config_name(v_level), s,
+							state->parity[v_level].split_map[s].path,
+							state->parity[v_level].split_map[s].uuid,
+							state->parity[v_level].split_map[s].size);
+					}
+				}
+			}
+		} else if (c == 'J') {
+			/* from SnapRAID 12.0 the 'J' command stores the change journal position */
+			uint64_t v_journal_id;
+			uint64_t v_journal_pos;
+			uint32_t v_journal_filter;
+			struct snapraid_disk* disk;
+
+			ret = sgetbs(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetb64(f, &v_journal_id);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetb64(f, &v_journal_pos);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetb32(f, &v_journal_filter);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* if the disk is not found, just ignore the journal */
+			/* the next scan will be a full one */
+			disk = find_disk_by_name(state, buffer);
+			if (disk) {
+				disk->journal_id = v_journal_id;
+				disk->journal_pos = v_journal_pos;
+				disk->journal_filter = v_journal_filter;
+			}
+		} else if (c == 'X') {
+			/* from SnapRAID 12.0 the 'X' command stores the index of the sections */
+			uint32_t v_count;
+			uint32_t k;
+			uint32_t index_low;
+			uint32_t index_high;
+			int64_t index_offset;
+
+			index_offset = stell(f) - 1;
+
+			ret = sgetb32(f, &v_count);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			for (k = 0; k < v_count; ++k) {
+				uint32_t mapping;
+				uint64_t v_disk_offset;
+				uint64_t v_hash_offset;
+				uint64_t v_end_offset;
+
+				ret = sgetb32(f, &mapping);
+				if (ret < 0 || mapping >= mapping_max || !ctx.section) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					log_fatal("Internal inconsistency in mapping index!\n");
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+
+				ret = sgetb64(f, &v_disk_offset);
+				if (ret < 0) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+
+				ret = sgetb64(f, &v_hash_offset);
+				if (ret < 0) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+
+				ret = sgetb64(f, &v_end_offset);
+				if (ret < 0) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+
+				/* the index must match the sections read */
+				if ((int64_t)v_disk_offset != ctx.section[mapping].disk_offset
+					|| (int64_t)v_hash_offset != ctx.section[mapping].hash_offset
+					|| (int64_t)v_end_offset != ctx.section[mapping].end_offset
+				) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					log_fatal("Internal inconsistency in section index!\n");
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
+			}
+
+			ret = sgetble32(f, &index_low);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetble32(f, &index_high);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (index_low + ((int64_t)index_high << 32) != index_offset) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				log_fatal("Internal inconsistency in section index position!\n");
+				os_abort();
+				/* LCOV_EXCL_STOP */
 			}
 		} else if (c == 'N') {
 			uint32_t crc_stored;
@@ -2830,6 +4096,9 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 			}
 
 			crc_checked = 1;
+
+			/* the journal, if present, must refer to this content file */
+			state->journal_base = crc_stored;
 		} else {
 			/* LCOV_EXCL_START */
 			decoding_error(path, f);
@@ -2840,6 +4109,7 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 	}
 
 	tommy_array_done(&disk_mapping);
+	free(ctx.section);
 
 	if (serror(f)) {
 		/* LCOV_EXCL_START */
@@ -2872,10 +4142,10 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 		/* LCOV_EXCL_STOP */
 	}
 
-	msg_verbose("%8u files\n", count_file);
-	msg_verbose("%8u hardlinks\n", count_hardlink);
-	msg_verbose("%8u symlinks\n", count_symlink);
-	msg_verbose("%8u empty dirs\n", count_dir);
+	msg_verbose("%8u files\n", ctx.count_file);
+	msg_verbose("%8u hardlinks\n", ctx.count_hardlink);
+	msg_verbose("%8u symlinks\n", ctx.count_symlink);
+	msg_verbose("%8u empty dirs\n", ctx.count_dir);
 }
 
 struct state_write_thread_context {
@@ -2897,6 +4167,47 @@ struct state_write_thread_context {
 	unsigned count_dir;
 };
 
+/**
+ * Kind of run of the hash at the specified parity position.
+ */
+static int state_write_hash_kind(struct snapraid_disk* disk, block_off_t pos)
+{
+	struct snapraid_block* block = fs_par2block_find(disk, pos);
+
+	if (block == BLOCK_NULL || hash_is_invalid(block->hash))
+		return CONTENT_RUN_INVALID;
+	if (hash_is_zero(block->hash))
+		return CONTENT_RUN_ZERO;
+	return CONTENT_RUN_HASH;
+}
+
+/**
+ * Write the path of a file, link, dir or dir stamp.
+ *
+ * From version 4, only the part not in common with the previous path is stored.
+ */
+static void state_write_sub(STREAM* f, int version, char* prev, size_t* prev_len, const char* sub)
+{
+	size_t prefix;
+	size_t len;
+
+	if (version < 4) {
+		sputbs(sub, f);
+		return;
+	}
+
+	prefix = 0;
+	while (prefix < *prev_len && prev[prefix] == sub[prefix])
+		++prefix;
+
+	sputb32(prefix, f);
+	sputbs(sub + prefix, f);
+
+	len = prefix + strlen(sub + prefix);
+	memcpy(prev + prefix, sub + prefix, len - prefix + 1);
+	*prev_len = len;
+}
+
 static void* state_write_thread(void* arg)
 {
 	struct state_write_thread_context* context = arg;
@@ -2916,6 +4227,14 @@ static void* state_write_thread(void* arg)
 	block_off_t begin;
 	unsigned l, s;
 	int version;
+	uint32_t* section_mapping;
+	int64_t* section_disk;
+	int64_t* section_hash;
+	int64_t* section_end;
+	unsigned section_count;
+	int64_t index_offset;
+	char sub_prev[PATH_MAX];
+	size_t sub_prev_len;
 
 	count_file = 0;
 	count_hardlink = 0;
@@ -2930,9 +4249,20 @@ static void* state_write_thread(void* arg)
 	}
 	if (BLOCK_HASH_SIZE != 16)
 		version = 3;
+	if (state->content_format >= 4)
+		version = 4;
+
+	/* offsets of the disk sections, saved in the index of version 4 */
+	section_count = 0;
+	section_mapping = malloc_nofail((tommy_list_count(&state->disklist) + 1) * sizeof(uint32_t));
+	section_disk = malloc_nofail((tommy_list_count(&state->disklist) + 1) * sizeof(int64_t));
+	section_hash = malloc_nofail((tommy_list_count(&state->disklist) + 1) * sizeof(int64_t));
+	section_end = malloc_nofail((tommy_list_count(&state->disklist) + 1) * sizeof(int64_t));
 
 	/* write header */
-	if (version == 3)
+	if (version == 4)
+		swrite("SNAPCNT4\n\3\0\0", 12, f);
+	else if (version == 3)
 		swrite("SNAPCNT3\n\3\0\0", 12, f);
 	else
 		swrite("SNAPCNT2\n\3\0\0", 12, f);
@@ -2944,7 +4274,7 @@ static void* state_write_thread(void* arg)
 	sputb32(blockmax, f);
 
 	/* hash size */
-	if (version == 3) {
+	if (version >= 3) {
 		sputc('y', f);
 		sputb32(BLOCK_HASH_SIZE, f);
 	}
@@ -2963,6 +4293,8 @@ static void* state_write_thread(void* arg)
 		sputc('k', f);
 	} else if (state->hash == HASH_METRO) {
 		sputc('m', f);
+	} else if (state->hash == HASH_XXH3) {
+		sputc('x', f);
 	} else {
 		/* LCOV_EXCL_START */
 		log_fatal("Unexpected hash when writing the content file '%s'.\n", serrorfile(f));
@@ -2988,6 +4320,8 @@ static void* state_write_thread(void* arg)
 				sputc('k', f);
 			} else if (state->prevhash == HASH_METRO) {
 				sputc('m', f);
+			} else if (state->prevhash == HASH_XXH3) {
+				sputc('x', f);
 			} else {
 				/* LCOV_EXCL_START */
 				log_fatal("Unexpected prevhash when writing the content file '%s'.\n", serrorfile(f));
@@ -3037,7 +4371,7 @@ static void* state_write_thread(void* arg)
 
 	/* for each parity */
 	for (l = 0; l < state->level; ++l) {
-		if (version == 3) {
+		if (version >= 3) {
 			sputc('Q', f);
 			sputb32(l, f);
 			sputb32(state->parity[l].total_blocks, f);
@@ -3063,6 +4397,26 @@ static void* state_write_thread(void* arg)
 		}
 	}
 
+	/* for each disk with a change journal position */
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+
+		/* save it only if known */
+		if (disk->journal_id != 0) {
+			sputc('J', f);
+			sputbs(disk->name, f);
+			sputb64(disk->journal_id, f);
+			sputb64(disk->journal_pos, f);
+			sputb32(disk->journal_filter, f);
+			if (serror(f)) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+				return context;
+				/* LCOV_EXCL_STOP */
+			}
+		}
+	}
+
 	/* for each disk */
 	for (i = state->disklist; i != 0; i = i->next) {
 		tommy_node* j;
@@ -3072,6 +4426,22 @@ static void* state_write_thread(void* arg)
 		if (disk->mapping_idx < 0)
 			continue;
 
+		/* start the section of the disk */
+		if (version >= 4) {
+			section_mapping[section_count] = disk->mapping_idx;
+			section_disk[section_count] = stell(f);
+			sputc('S', f);
+			sputb32(disk->mapping_idx, f);
+			sputb32(tommy_hashdyn_count(&disk->pathset), f);
+			sputb32(tommy_hashdyn_count(&disk->linkset), f);
+			sputb32(tommy_hashdyn_count(&disk->dirset), f);
+			sputb32(tommy_hashdyn_count(&disk->dirstampset), f);
+		}
+
+		/* the prefix compression of the paths restarts in each section */
+		sub_prev[0] = 0;
+		sub_prev_len = 0;
+
 		/* for each file */
 		for (j = disk->filelist; j != 0; j = j->next) {
 			struct snapraid_file* file = j->data;
@@ -3095,7 +4465,7 @@ static void* state_write_thread(void* arg)
 			else
 				sputb32(mtime_nsec + 1, f);
 			sputb64(inode, f);
-			sputbs(file->sub, f);
+			state_write_sub(f, version, sub_prev, &sub_prev_len, file->sub);
 			if (serror(f)) {
 				/* LCOV_EXCL_START */
 				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
@@ -3144,8 +4514,8 @@ static void* state_write_thread(void* arg)
 				v_count = end - begin;
 				sputb32(v_count, f);
 
-				/* write hashes */
-				for (idx = begin; idx < end; ++idx) {
+				/* write hashes, in version 4 they are in the hash array of the disk */
+				for (idx = begin; idx < end && version < 4; ++idx) {
 					struct snapraid_block* block = fs_file2block_get(file, idx);
 
 					swrite(block->hash, BLOCK_HASH_SIZE, f);
@@ -3181,7 +4551,7 @@ static void* state_write_thread(void* arg)
 			}
 
 			sputb32(disk->mapping_idx, f);
-			sputbs(slink->sub, f);
+			state_write_sub(f, version, sub_prev, &sub_prev_len, slink->sub);
 			sputbs(slink->linkto, f);
 			if (serror(f)) {
 				/* LCOV_EXCL_START */
@@ -3197,7 +4567,7 @@ static void* state_write_thread(void* arg)
 
 			sputc('r', f);
 			sputb32(disk->mapping_idx, f);
-			sputbs(dir->sub, f);
+			state_write_sub(f, version, sub_prev, &sub_prev_len, dir->sub);
 			if (serror(f)) {
 				/* LCOV_EXCL_START */
 				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
@@ -3208,6 +4578,32 @@ static void* state_write_thread(void* arg)
 			++count_dir;
 		}
 
+		/* dir stamps of the disk */
+		if (!tommy_list_empty(&disk->dirstamplist)) {
+			sputc('D', f);
+			sputb32(disk->mapping_idx, f);
+			sputb32(disk->dirstamp_filter, f);
+			sputb32(tommy_list_count(&disk->dirstamplist), f);
+			for (j = disk->dirstamplist; j != 0; j = j->next) {
+				struct snapraid_dirstamp* dirstamp = j->data;
+
+				sputb64(dirstamp->inode, f);
+				sputb64(dirstamp->mtime_sec, f);
+				/* encode STAT_NSEC_INVALID as 0 */
+				if (dirstamp->mtime_nsec == STAT_NSEC_INVALID)
+					sputb32(0, f);
+				else
+					sputb32(dirstamp->mtime_nsec + 1, f);
+				state_write_sub(f, version, sub_prev, &sub_prev_len, dirstamp->sub);
+			}
+			if (serror(f)) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+				return context;
+				/* LCOV_EXCL_STOP */
+			}
+		}
+
 		/* deleted blocks of the disk */
 		sputc('h', f);
 		sputb32(disk->mapping_idx, f);
@@ -3238,7 +4634,9 @@ static void* state_write_thread(void* arg)
 				/* write the run of deleted blocks with hash */
 				sputc('o', f);
 
-				/* write all the hash */
+				/* write all the hash, in version 4 they are in the hash array of the disk */
+				if (version >= 4)
+					begin = end;
 				while (begin < end) {
 					struct snapraid_block* block = fs_par2block_get(disk, begin);
 
@@ -3262,6 +4660,89 @@ static void* state_write_thread(void* arg)
 				/* LCOV_EXCL_STOP */
 			}
 		}
+
+		/* write the hash array of the disk, run-length encoded */
+		if (version >= 4 && state->content_compress) {
+			block_off_t disk_size = fs_size(disk);
+
+			sputc('Z', f);
+			sputb32(disk->mapping_idx, f);
+			sputb32(disk_size, f);
+
+			section_hash[section_count] = stell(f);
+			idx = 0;
+			while (idx < disk_size) {
+				block_off_t run;
+				int kind;
+
+				kind = state_write_hash_kind(disk, idx);
+
+				run = 1;
+				while (idx + run < disk_size && state_write_hash_kind(disk, idx + run) == kind)
+					++run;
+
+				sputb32(run, f);
+				sputc(kind, f);
+
+				/* only the unique hashes are stored */
+				if (kind == CONTENT_RUN_HASH) {
+					block_off_t k;
+					for (k = 0; k < run; ++k) {
+						struct snapraid_block* block = fs_par2block_find(disk, idx + k);
+						swrite(block->hash, BLOCK_HASH_SIZE, f);
+					}
+				}
+
+				idx += run;
+			}
+			section_end[section_count] = stell(f);
+
+			if (serror(f)) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+				return context;
+				/* LCOV_EXCL_STOP */
+			}
+
+			++section_count;
+		} else if (version >= 4) {
+			block_off_t disk_size = fs_size(disk);
+			unsigned char zero[HASH_MAX];
+			unsigned pad;
+
+			memset(zero, 0, sizeof(zero));
+
+			sputc('H', f);
+			sputb32(disk->mapping_idx, f);
+			sputb32(disk_size, f);
+
+			/* align the array, to allow to map it in memory */
+			pad = (CONTENT_ALIGN - (stell(f) + 1) % CONTENT_ALIGN) % CONTENT_ALIGN;
+			sputc(pad, f);
+			while (pad--)
+				sputc(0, f);
+
+			/* the hash of each parity position, or zero if not used */
+			section_hash[section_count] = stell(f);
+			for (idx = 0; idx < disk_size; ++idx) {
+				struct snapraid_block* block = fs_par2block_find(disk, idx);
+
+				if (block != BLOCK_NULL)
+					swrite(block->hash, BLOCK_HASH_SIZE, f);
+				else
+					swrite(zero, BLOCK_HASH_SIZE, f);
+			}
+			section_end[section_count] = stell(f);
+
+			if (serror(f)) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+				return context;
+				/* LCOV_EXCL_STOP */
+			}
+
+			++section_count;
+		}
 	}
 
 	/* write the info for each block */
@@ -3327,6 +4808,35 @@ static void* state_write_thread(void* arg)
 		begin = end;
 	}
 
+	/* write the index of the sections */
+	if (version >= 4) {
+		index_offset = stell(f);
+		sputc('X', f);
+		sputb32(section_count, f);
+		for (s = 0; s < section_count; ++s) {
+			sputb32(section_mapping[s], f);
+			sputb64(section_disk[s], f);
+			sputb64(section_hash[s], f);
+			sputb64(section_end[s], f);
+		}
+
+		/* the index position is at a fixed offset from the end of the file */
+		sputble32(index_offset & 0xFFFFFFFF, f);
+		sputble32(index_offset >> 32, f);
+
+		if (serror(f)) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+			return context;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(section_mapping);
+	free(section_disk);
+	free(section_hash);
+	free(section_end);
+
 	sputc('N', f);
 
 	/* flush data written to the disk */
@@ -3691,15 +5201,282 @@ static void state_write_content(struct snapraid_state* state, uint32_t* out_crc)
 	*out_crc = crc;
 }
 
+/**
+ * Journal of the changes saved at autosave points.
+ *
+ * The journal is written next to each content file, with the ".journal" extension,
+ * and it's removed when the content file is fully rewritten.
+ *
+ * It starts with the header "SNAPJRN1\n\3\0\0" followed by the CRC of the
+ * content file it applies to. Then it contains a sequence of records,
+ * each one appended at an autosave point:
+ *
+ * 'J' start count disks
+ *   for each disk: name, and for each position: state, [hash if not empty]
+ *   for each position: info
+ *   and the CRC of the journal from the start of the file
+ *
+ * A record not complete, or with a wrong CRC, is ignored with all the following ones.
+ */
+static int state_read_journal_record(struct snapraid_state* state, STREAM* f, block_off_t blockmax, int apply)
+{
+	uint32_t v_start;
+	uint32_t v_count;
+	uint32_t v_disk;
+	uint32_t crc_stored;
+	uint32_t crc_computed;
+	uint32_t d;
+	block_off_t idx;
+	int ret;
+
+	ret = sgetb32(f, &v_start);
+	if (ret < 0)
+		return -1;
+	ret = sgetb32(f, &v_count);
+	if (ret < 0)
+		return -1;
+	if (v_start > blockmax || v_count > blockmax - v_start)
+		return -1;
+
+	ret = sgetb32(f, &v_disk);
+	if (ret < 0)
+		return -1;
+
+	for (d = 0; d < v_disk; ++d) {
+		struct snapraid_disk* disk;
+		char buffer[PATH_MAX];
+
+		ret = sgetbs(f, buffer, sizeof(buffer));
+		if (ret < 0)
+			return -1;
+
+		disk = 0;
+		if (apply)
+			disk = find_disk_by_name(state, buffer);
+
+		for (idx = v_start; idx < v_start + v_count; ++idx) {
+			unsigned char hash[HASH_MAX];
+			struct snapraid_block* block;
+			int c;
+
+			c = sgetc(f);
+			if (c < BLOCK_STATE_EMPTY || c > BLOCK_STATE_DELETED)
+				return -1;
+
+			if (c != BLOCK_STATE_EMPTY) {
+				ret = sread(f, hash, BLOCK_HASH_SIZE);
+				if (ret < 0)
+					return -1;
+			}
+
+			if (!disk)
+				continue;
+
+			block = fs_par2block_find(disk, idx);
+
+			if (c == BLOCK_STATE_EMPTY) {
+				/* a deleted block cleared from the parity */
+				if (block_state_get(block) == BLOCK_STATE_DELETED) {
+					fs_deallocate(disk, idx);
+				} else if (block != BLOCK_NULL) {
+					/* LCOV_EXCL_START */
+					log_fatal("Internal inconsistency in journal for disk '%s' at position %u\n", disk->name, idx);
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+				continue;
+			}
+
+			/* the block must keep its kind */
+			if (block == BLOCK_NULL
+				|| (c == BLOCK_STATE_DELETED) != (block_state_get(block) == BLOCK_STATE_DELETED)
+			) {
+				/* LCOV_EXCL_START */
+				log_fatal("Internal inconsistency in journal for disk '%s' at position %u\n", disk->name, idx);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			block_state_set(block, c);
+			if (BLOCK_HASH_STORED)
+				memcpy(block->hash, hash, BLOCK_HASH_SIZE);
+
+			state_read_block(state, block);
+		}
+	}
+
+	for (idx = v_start; idx < v_start + v_count; ++idx) {
+		uint32_t info;
+
+		ret = sgetb32(f, &info);
+		if (ret < 0)
+			return -1;
+
+		if (apply)
+			info_set(&state->infoarr, idx, info);
+	}
+
+	crc_computed = scrc(f);
+
+	ret = sgetble32(f, &crc_stored);
+	if (ret < 0)
+		return -1;
+
+	if (crc_stored != crc_computed)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Open the journal and skip the header.
+ * Return 0 if the journal is missing or it doesn't apply to the content file read.
+ */
+static STREAM* state_open_journal(struct snapraid_state* state, const char* path)
+{
+	STREAM* f;
+	unsigned char header[12];
+	uint32_t base;
+	int ret;
+
+	f = sopen_read(path);
+	if (f == 0) {
+		if (errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error opening the journal file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		return 0;
+	}
+
+	ret = sread(f, header, 12);
+	if (ret < 0 || memcmp(header, "SNAPJRN1\n\3\0\0", 12) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Ignoring the invalid journal file '%s'.\n", path);
+		sclose(f);
+		return 0;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* a journal of a different content file is stale */
+	ret = sgetble32(f, &base);
+	if (ret < 0 || base != state->journal_base) {
+		sclose(f);
+		return 0;
+	}
+
+	return f;
+}
+
+static void state_read_journal(struct snapraid_state* state, const char* content)
+{
+	char path[PATH_MAX];
+	STREAM* f;
+	block_off_t blockmax;
+	unsigned count;
+	unsigned k;
+
+	pathprint(path, sizeof(path), "%s.journal", content);
+
+	/* the journal can only refer to positions of the parity read */
+	blockmax = parity_allocated_size(state);
+
+	/* first pass, checks the complete records */
+	f = state_open_journal(state, path);
+	if (!f)
+		return;
+
+	count = 0;
+	while (sgetc(f) == 'J' && state_read_journal_record(state, f, blockmax, 0) == 0)
+		++count;
+
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reading the journal file '%s' at offset %" PRIi64 "\n", path, stell(f));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (!seof(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Ignoring the incomplete tail of the journal file '%s' at offset %" PRIi64 ".\n", path, stell(f));
+		/* LCOV_EXCL_STOP */
+	}
+
+	sclose(f);
+
+	if (!count)
+		return;
+
+	msg_progress("Loading journal from %s...\n", path);
+
+	/* second pass, applies the complete records */
+	f = state_open_journal(state, path);
+	if (!f) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reopening the journal file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	for (k = 0; k < count; ++k) {
+		if (sgetc(f) != 'J' || state_read_journal_record(state, f, blockmax, 1) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error reading the journal file '%s' at offset %" PRIi64 "\n", path, stell(f));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	sclose(f);
+
+	/* the journal is compacted at the next write */
+	state->need_write = 1;
+}
+
+/**
+ * Read the CRC stored at the end of a content file.
+ * All the copies of the same write have the same CRC.
+ * Return !=0 on error.
+ */
+static int state_content_crc(const char* path, uint32_t* crc)
+{
+	unsigned char buf[4];
+	int f;
+
+	f = open(path, O_RDONLY | O_BINARY);
+	if (f == -1)
+		return -1;
+
+	if (lseek(f, -4, SEEK_END) < 0 || read(f, buf, 4) != 4) {
+		/* LCOV_EXCL_START */
+		close(f);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	close(f);
+
+	*crc = buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+
+	return 0;
+}
+
 void state_read(struct snapraid_state* state)
 {
 	STREAM* f;
 	char path[PATH_MAX];
 	struct stat st;
 	tommy_node* node;
+	uint64_t start;
 	int ret;
 	int c;
 
+	/* load only the block states, if the hashes are not needed */
+	if (state->opt.skip_block_hash)
+		BLOCK_HASH_STORED = 0;
+
 	/* iterate over all the available content files and load the first one present */
 	f = 0;
 	node = tommy_list_head(&state->contentlist);
@@ -3761,6 +5538,8 @@ void state_read(struct snapraid_state* state)
 	while (node) {
 		char other_path[PATH_MAX];
 		struct stat other_st;
+		uint32_t crc;
+		uint32_t other_crc;
 		struct snapraid_content* content = node->data;
 		pathcpy(other_path, sizeof(other_path), content->content);
 
@@ -3782,6 +5561,13 @@ void state_read(struct snapraid_state* state)
 				log_fatal("WARNING! Content files '%s' and '%s' have a different size!\n", path, other_path);
 				log_fatal("Likely one of the two is broken!\n");
 
+				/* ensure to rewrite all the content files */
+				state->need_write = 1;
+			} else if (state_content_crc(path, &crc) == 0 && state_content_crc(other_path, &other_crc) == 0 && crc != other_crc) {
+				/* the stored CRC identifies each write, a different one is from an older write */
+				log_fatal("WARNING! Content files '%s' and '%s' are from different writes!\n", path, other_path);
+				log_fatal("Likely the replication of the second one was interrupted.\n");
+
 				/* ensure to rewrite all the content files */
 				state->need_write = 1;
 			}
@@ -3803,6 +5589,8 @@ void state_read(struct snapraid_state* state)
 
 	/* intentionally not set the prevhashseed, if used valgrind will warn about it */
 
+	start = tick();
+
 	/* get the first char to detect the file type */
 	c = sgetc(f);
 	sungetc(c, f);
@@ -3820,6 +5608,9 @@ void state_read(struct snapraid_state* state)
 
 	sclose(f);
 
+	/* apply the changes saved after the content file */
+	state_read_journal(state, path);
+
 	if (state->hash == HASH_UNDEFINED) {
 		/* LCOV_EXCL_START */
 		log_fatal("The checksum to use is not specified.\n");
@@ -3830,11 +5621,16 @@ void state_read(struct snapraid_state* state)
 		/* LCOV_EXCL_STOP */
 	}
 
+	state->tick_content_parse = tick() - start;
+	start = tick();
+
 	/* update the mapping */
 	state_map(state);
 
 	state_content_check(state, path);
 
+	state->tick_content_map = tick() - start;
+
 	/* mark that we read the content file, and it passed all the checks */
 	state->checked_read = 1;
 }
@@ -3970,110 +5766,586 @@ static void state_verify_content(struct snapraid_state* state, uint32_t crc)
 			}
 		}
 
-		free(context);
+		free(context);
+
+		i = i->next;
+	}
+
+	/* abort on failure */
+	if (fail) {
+		/* LCOV_EXCL_START */
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+static void state_rename_content(struct snapraid_state* state)
+{
+	tommy_node* i;
+
+#if defined(_linux) /* this sequence is linux specific */
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		char tmp[PATH_MAX];
+		char dir[PATH_MAX];
+		char* slash;
+		int handle;
+
+		pathcpy(dir, sizeof(dir), content->content);
+
+		slash = strrchr(tmp, '/');
+		if (slash)
+			*slash = 0;
+		else
+			pathcpy(dir, sizeof(dir), ".");
+
+		/* open the directory to get the handle */
+		handle = open(dir, O_RDONLY | O_DIRECTORY);
+		if (handle < 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error opening the directory '%s'. %s.\n", dir, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* now rename the just written copy with the correct name */
+		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
+		if (rename(tmp, content->content) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error renaming the content file '%s' to '%s'. %s.\n", tmp, content->content, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* sync the directory */
+		if (fsync(handle) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error syncing the directory '%s'. %s.\n", dir, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (close(handle) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error closing the directory '%s'. %s.\n", dir, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		i = i->next;
+	}
+#else
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		char tmp[PATH_MAX];
+
+		/* now renames the just written copy with the correct name */
+		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
+		if (rename(tmp, content->content) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error renaming the content file '%s' to '%s' in rename(). %s.\n", tmp, content->content, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		i = i->next;
+	}
+#endif
+}
+
+static void state_remove_journal(struct snapraid_state* state)
+{
+	tommy_node* i;
+
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		char path[PATH_MAX];
+
+		pathprint(path, sizeof(path), "%s.journal", content->content);
+		if (remove(path) != 0) {
+			if (errno != ENOENT) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error removing the journal file '%s'. %s.\n", path, strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		}
+
+		i = i->next;
+	}
+}
+
+#define STATE_REPLICA_BUFFER (1024 * 1024) /**< Size of the buffer used to copy the content files. */
+
+/**
+ * Background replication of the content files not written directly.
+ */
+struct state_replica_context {
+	struct snapraid_state* state;
+	pthread_t thread;
+	uint32_t crc; /**< CRC of the content files written. */
+	int fail; /**< If a replication failed. */
+};
+
+/**
+ * Copy the first content file over another one, verifying the copy.
+ * Return !=0 on error.
+ */
+static int state_replica_copy(struct state_replica_context* context, const char* source, struct snapraid_content* content, unsigned char* buf)
+{
+	struct state_verify_thread_context verify;
+	char tmp[PATH_MAX];
+	int in;
+	int out;
+	STREAM* f;
+
+	msg_progress("Replicating %s...\n", content->content);
+
+	pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
+
+	/* ensure to delete a previous stale file */
+	if (remove(tmp) != 0 && errno != ENOENT) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error removing the stale content file '%s'. %s.\n", tmp, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	in = open(source, O_RDONLY | O_BINARY | O_SEQUENTIAL);
+	if (in == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening the content file '%s'. %s.\n", source, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	out = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_BINARY | O_SEQUENTIAL, 0600);
+	if (out == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening the temporary content file '%s'. %s.\n", tmp, strerror(errno));
+		close(in);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	while (1) {
+		ssize_t len = read(in, buf, STATE_REPLICA_BUFFER);
+		ssize_t done;
+
+		if (len < 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error reading the content file '%s'. %s.\n", source, strerror(errno));
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+		if (len == 0)
+			break;
+
+		done = 0;
+		while (done < len) {
+			ssize_t ret = write(out, buf + done, len - done);
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error writing the content file '%s'. %s.\n", tmp, strerror(errno));
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			done += ret;
+		}
+	}
+
+#if HAVE_FSYNC
+	if (fsync(out) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the content file '%s' in sync(). %s.\n", tmp, strerror(errno));
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+#endif
+
+	close(in);
+	if (close(out) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing the content file '%s'. %s.\n", tmp, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* verify the copy as the directly written files */
+	f = sopen_read(tmp);
+	if (f == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reopening the temporary content file '%s'. %s.\n", tmp, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	verify.state = context->state;
+	verify.content = content;
+	verify.crc = context->crc;
+	verify.f = f;
+
+	if (state_verify_thread(&verify) != 0) {
+		/* LCOV_EXCL_START */
+		sclose(f);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (sclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing the content file. %s.\n", strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (rename(tmp, content->content) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error renaming the content file '%s' to '%s' in rename(). %s.\n", tmp, content->content, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	close(in);
+	close(out);
+	return -1;
+	/* LCOV_EXCL_STOP */
+}
+
+static void* state_replica_thread(void* arg)
+{
+	struct state_replica_context* context = arg;
+	struct snapraid_state* state = context->state;
+	struct snapraid_content* source = tommy_list_head(&state->contentlist)->data;
+	unsigned char* buf;
+	unsigned k;
+	tommy_node* i;
+
+	buf = malloc_nofail(STATE_REPLICA_BUFFER);
+
+	k = 0;
+	for (i = tommy_list_head(&state->contentlist); i != 0; i = i->next) {
+		struct snapraid_content* content = i->data;
+
+		/* skip the content files written directly */
+		if (k++ < state->content_sync)
+			continue;
+
+		if (state_replica_copy(context, source->content, content, buf) != 0) {
+			/* LCOV_EXCL_START */
+			context->fail = 1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(buf);
+
+	return 0;
+}
+
+void state_write_wait(struct snapraid_state* state)
+{
+	struct state_replica_context* context = state->content_replica;
+	void* retval;
+	int fail;
+
+	if (!context)
+		return;
+
+	thread_join(context->thread, &retval);
+
+	fail = context->fail;
+
+	free(context);
+	state->content_replica = 0;
+
+	if (fail) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed to replicate the content files. They will be written again at the next command.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+void state_write(struct snapraid_state* state)
+{
+	tommy_list replica;
+	tommy_node* i;
+	uint64_t start;
+	uint32_t crc;
+	int has_replica;
+
+	if (!BLOCK_HASH_STORED) {
+		/* LCOV_EXCL_START */
+		log_fatal("Internal inconsistency for writing the content file without the block hashes!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* the previous replication must complete before writing again */
+	state_write_wait(state);
+
+	/* wait for the other arrays sharing the schedule directory to complete their write */
+	state_schedule_content(state, 1);
+
+	/* write only the first content files, the others are replicated later copying them */
+	tommy_list_init(&replica);
+	if (state->content_sync != 0) {
+		unsigned k = 0;
+
+		i = tommy_list_head(&state->contentlist);
+		while (i) {
+			tommy_node* next = i->next;
+			if (k++ >= state->content_sync) {
+				tommy_list_remove_existing(&state->contentlist, i);
+				tommy_list_insert_tail(&replica, i, i->data);
+			}
+			i = next;
+		}
+	}
+	has_replica = tommy_list_head(&replica) != 0;
+
+	start = tick();
+
+	/* write all the content files */
+	state_write_content(state, &crc);
+
+	state->tick_content_serialize = tick() - start;
+	start = tick();
+
+	/* verify the just written files */
+	state_verify_content(state, crc);
+
+	state->tick_content_verify = tick() - start;
+
+	/* rename the new files, over the old ones */
+	state_rename_content(state);
+
+	/* restore the full list of content files */
+	tommy_list_concat(&state->contentlist, &replica);
 
-		i = i->next;
-	}
+	/* the previous journal doesn't apply anymore */
+	state_remove_journal(state);
 
-	/* abort on failure */
-	if (fail) {
-		/* LCOV_EXCL_START */
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
+	state_schedule_content(state, 0);
+
+	/* replicate the other content files in background */
+	if (has_replica) {
+		struct state_replica_context* context;
+
+		context = malloc_nofail(sizeof(struct state_replica_context));
+		context->state = state;
+		context->crc = crc;
+		context->fail = 0;
+		state->content_replica = context;
+
+		thread_create(&context->thread, 0, state_replica_thread, context);
 	}
+
+	/* save the summary of the just written state */
+	if (state->status_summary)
+		state_status_summary_write(state);
+
+	state->need_write = 0; /* no write needed anymore */
+	state->checked_read = 0; /* what we wrote is not checked in read */
+
+	/* the journal can now be appended to the content files written */
+	state->journal_ready = 1;
+	state->journal_base = crc;
+	state->journal_count = 0;
 }
 
-static void state_rename_content(struct snapraid_state* state)
+static void state_write_journal(struct snapraid_state* state, block_off_t blockstart, block_off_t blockend)
 {
+	STREAM* f;
 	tommy_node* i;
+	block_off_t idx;
+	unsigned k;
+	int ret;
 
-#if defined(_linux) /* this sequence is linux specific */
+	/* the journal is appended also to the replicated content files */
+	state_write_wait(state);
+
+	f = sopen_multi_write(tommy_list_count(&state->contentlist));
+
+	k = 0;
 	i = tommy_list_head(&state->contentlist);
 	while (i) {
 		struct snapraid_content* content = i->data;
-		char tmp[PATH_MAX];
-		char dir[PATH_MAX];
-		char* slash;
-		int handle;
+		char path[PATH_MAX];
+		pathprint(path, sizeof(path), "%s.journal", content->content);
 
-		pathcpy(dir, sizeof(dir), content->content);
+		msg_progress("Saving journal to %s...\n", path);
 
-		slash = strrchr(tmp, '/');
-		if (slash)
-			*slash = 0;
-		else
-			pathcpy(dir, sizeof(dir), ".");
+		/* the first record creates a new journal */
+		if (state->journal_count == 0) {
+			/* ensure to delete a previous stale file */
+			if (remove(path) != 0) {
+				if (errno != ENOENT) {
+					/* LCOV_EXCL_START */
+					log_fatal("Error removing the stale journal file '%s'. %s.\n", path, strerror(errno));
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+			}
 
-		/* open the directory to get the handle */
-		handle = open(dir, O_RDONLY | O_DIRECTORY);
-		if (handle < 0) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error opening the directory '%s'. %s.\n", dir, strerror(errno));
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
+			ret = sopen_multi_file(f, k, path);
+		} else {
+			ret = sopen_multi_append(f, k, path);
 		}
-
-		/* now rename the just written copy with the correct name */
-		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
-		if (rename(tmp, content->content) != 0) {
+		if (ret != 0) {
 			/* LCOV_EXCL_START */
-			log_fatal("Error renaming the content file '%s' to '%s'. %s.\n", tmp, content->content, strerror(errno));
+			log_fatal("Error opening the journal file '%s'. %s.\n", path, strerror(errno));
 			exit(EXIT_FAILURE);
 			/* LCOV_EXCL_STOP */
 		}
 
-		/* sync the directory */
-		if (fsync(handle) != 0) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error syncing the directory '%s'. %s.\n", dir, strerror(errno));
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
-		}
+		++k;
+		i = i->next;
+	}
 
-		if (close(handle) != 0) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error closing the directory '%s'. %s.\n", dir, strerror(errno));
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
+	if (state->journal_count == 0) {
+		swrite("SNAPJRN1\n\3\0\0", 12, f);
+		sputble32(state->journal_base, f);
+	} else {
+		/* continue the CRC of the journal */
+		scrc_set(f, state->journal_crc);
+	}
+
+	sputc('J', f);
+	sputb32(blockstart, f);
+	sputb32(blockend - blockstart, f);
+	sputb32(tommy_list_count(&state->disklist), f);
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+
+		sputbs(disk->name, f);
+		for (idx = blockstart; idx < blockend; ++idx) {
+			struct snapraid_block* block = fs_par2block_find(disk, idx);
+			unsigned block_state = block_state_get(block);
+
+			sputc(block_state, f);
+			if (block_state != BLOCK_STATE_EMPTY)
+				swrite(block->hash, BLOCK_HASH_SIZE, f);
 		}
+	}
+	for (idx = blockstart; idx < blockend; ++idx)
+		sputb32(info_get(&state->infoarr, idx), f);
 
-		i = i->next;
+	sputble32(scrc(f), f);
+
+	state->journal_crc = scrc(f);
+
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the journal file '%s'. %s.\n", serrorfile(f), strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
 	}
-#else
-	i = tommy_list_head(&state->contentlist);
-	while (i) {
-		struct snapraid_content* content = i->data;
-		char tmp[PATH_MAX];
 
-		/* now renames the just written copy with the correct name */
-		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
-		if (rename(tmp, content->content) != 0) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error renaming the content file '%s' to '%s' in rename(). %s.\n", tmp, content->content, strerror(errno));
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
-		}
+	if (sflush(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the journal file '%s', in flush(). %s.\n", serrorfile(f), strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
 
-		i = i->next;
+#if HAVE_FSYNC
+	if (ssync(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the journal file '%s' in sync(). %s.\n", serrorfile(f), strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
 	}
 #endif
+
+	if (sclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing the journal file. %s.\n", strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	state->journal_count += blockend - blockstart;
 }
 
-void state_write(struct snapraid_state* state)
+void state_autosave(struct snapraid_state* state, block_off_t blockstart, block_off_t blockend)
 {
-	uint32_t crc;
+	/* nothing changed */
+	if (blockstart >= blockend)
+		return;
 
-	/* write all the content files */
-	state_write_content(state, &crc);
+	/* rewrite the content files if the journal is disabled, */
+	/* not yet possible, or if it's becoming as big as the content files */
+	if (!state->content_journal
+		|| !state->journal_ready
+		|| state->journal_count + (blockend - blockstart) > parity_allocated_size(state)
+	) {
+		state_write(state);
+		return;
+	}
 
-	/* verify the just written files */
-	state_verify_content(state, crc);
+	state_write_journal(state, blockstart, blockend);
+}
 
-	/* rename the new files, over the old ones */
-	state_rename_content(state);
+void state_index(struct snapraid_state* state)
+{
+	tommy_node* i;
 
-	state->need_write = 0; /* no write needed anymore */
-	state->checked_read = 0; /* what we wrote is not checked in read */
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+
+		fs_index_build(disk);
+	}
+}
+
+#if HAVE_MT_FILESET
+static void* state_fileset_thread(void* arg)
+{
+	struct snapraid_disk* disk = arg;
+
+	disk_fileset_build(disk);
+
+	return 0;
+}
+#endif
+
+void state_fileset(struct snapraid_state* state)
+{
+	tommy_node* i;
+#if HAVE_MT_FILESET
+	tommy_size_t count;
+	tommy_size_t k;
+	pthread_t* thread;
+
+	count = tommy_list_count(&state->disklist);
+	thread = malloc_nofail(count * sizeof(pthread_t));
+
+	/* each disk has its own hashtables, so fill them in parallel */
+	for (i = state->disklist, k = 0; i != 0; i = i->next, ++k) {
+		struct snapraid_disk* disk = i->data;
+
+		thread_create(&thread[k], 0, state_fileset_thread, disk);
+	}
+
+	for (k = 0; k < count; ++k)
+		thread_join(thread[k], 0);
+
+	free(thread);
+#else
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+
+		disk_fileset_build(disk);
+	}
+#endif
 }
 
 void state_skip(struct snapraid_state* state)
@@ -4200,6 +6472,144 @@ void state_filter(struct snapraid_state* state, tommy_list* filterlist_file, tom
 	}
 }
 
+/**
+ * Seconds between the updates of the metrics file.
+ */
+#define PROGRESS_METRICS_INTERVAL 10
+
+/**
+ * Write a label value, escaped as required by the Prometheus text format.
+ */
+static void metrics_label(FILE* f, const char* value)
+{
+	for (; *value; ++value) {
+		if (*value == '\\' || *value == '"')
+			fputc('\\', f);
+		if (*value == '\n')
+			fputs("\\n", f);
+		else
+			fputc(*value, f);
+	}
+}
+
+static void metrics_disk(FILE* f, const char* metric, const char* name, const char* kind, const char* value)
+{
+	fprintf(f, "%s{disk=\"", metric);
+	metrics_label(f, name);
+	fprintf(f, "\",kind=\"%s\"} %s\n", kind, value);
+}
+
+/**
+ * Write the progress metrics, in the Prometheus text format.
+ *
+ * The file is replaced atomically, to be read at any time, like by the
+ * textfile collector of the node exporter.
+ *
+ * \param io The io to get the cached blocks. 0 if not available.
+ * \param eta Estimated remaining time in minutes. -1 if not yet known.
+ */
+static void state_progress_metrics(struct snapraid_state* state, struct snapraid_io* io, block_off_t countpos, block_off_t countmax, data_off_t countsize, unsigned size_speed, int eta, int running)
+{
+	char path[PATH_MAX];
+	char value[64];
+	double freq = tick_freq();
+	FILE* f;
+	tommy_node* i;
+	unsigned l;
+
+	pathprint(path, sizeof(path), "%s.tmp", state->opt.metrics_file);
+
+	f = fopen(path, "w");
+	if (!f)
+		goto bail;
+
+	fprintf(f, "# HELP snapraid_running If the operation is in progress.\n");
+	fprintf(f, "# TYPE snapraid_running gauge\n");
+	fprintf(f, "snapraid_running %d\n", running);
+	fprintf(f, "# HELP snapraid_positions_done Number of block positions processed.\n");
+	fprintf(f, "# TYPE snapraid_positions_done gauge\n");
+	fprintf(f, "snapraid_positions_done %u\n", countpos);
+	fprintf(f, "# HELP snapraid_positions_total Number of block positions to process.\n");
+	fprintf(f, "# TYPE snapraid_positions_total gauge\n");
+	fprintf(f, "snapraid_positions_total %u\n", countmax);
+	fprintf(f, "# HELP snapraid_bytes_done Bytes of data processed.\n");
+	fprintf(f, "# TYPE snapraid_bytes_done counter\n");
+	fprintf(f, "snapraid_bytes_done %" PRIu64 "\n", (uint64_t)countsize);
+	fprintf(f, "# HELP snapraid_speed_bytes_per_second Recent speed of the data processed.\n");
+	fprintf(f, "# TYPE snapraid_speed_bytes_per_second gauge\n");
+	fprintf(f, "snapraid_speed_bytes_per_second %" PRIu64 "\n", size_speed * (uint64_t)MEGA);
+	if (eta >= 0) {
+		fprintf(f, "# HELP snapraid_eta_seconds Estimated time to complete.\n");
+		fprintf(f, "# TYPE snapraid_eta_seconds gauge\n");
+		fprintf(f, "snapraid_eta_seconds %u\n", eta * 60U);
+	}
+
+	fprintf(f, "# HELP snapraid_cpu_seconds_total Time used by the main thread in each stage.\n");
+	fprintf(f, "# TYPE snapraid_cpu_seconds_total counter\n");
+	fprintf(f, "snapraid_cpu_seconds_total{stage=\"raid\"} %.3f\n", state->tick_raid / freq);
+	fprintf(f, "snapraid_cpu_seconds_total{stage=\"hash\"} %.3f\n", state->tick_hash / freq);
+	fprintf(f, "snapraid_cpu_seconds_total{stage=\"sched\"} %.3f\n", state->tick_sched / freq);
+	fprintf(f, "snapraid_cpu_seconds_total{stage=\"misc\"} %.3f\n", state->tick_misc / freq);
+	fprintf(f, "# HELP snapraid_io_wait_seconds_total Time the main thread waited for the disks.\n");
+	fprintf(f, "# TYPE snapraid_io_wait_seconds_total counter\n");
+	fprintf(f, "snapraid_io_wait_seconds_total %.3f\n", state->tick_io / freq);
+
+	/* the disk the main thread waits the most is the bottleneck */
+	fprintf(f, "# HELP snapraid_disk_wait_seconds_total Time the main thread waited for each disk.\n");
+	fprintf(f, "# TYPE snapraid_disk_wait_seconds_total counter\n");
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+		snprintf(value, sizeof(value), "%.3f", disk->tick / freq);
+		metrics_disk(f, "snapraid_disk_wait_seconds_total", disk->name, "data", value);
+	}
+	for (l = 0; l < state->level; ++l) {
+		snprintf(value, sizeof(value), "%.3f", state->parity[l].tick / freq);
+		metrics_disk(f, "snapraid_disk_wait_seconds_total", lev_config_name(l), "parity", value);
+	}
+
+	if (io) {
+		/* refresh the cached blocks info */
+		io_refresh(io);
+
+		fprintf(f, "# HELP snapraid_disk_cached_blocks Blocks read ahead and queued for each disk.\n");
+		fprintf(f, "# TYPE snapraid_disk_cached_blocks gauge\n");
+		for (i = state->disklist; i != 0; i = i->next) {
+			struct snapraid_disk* disk = i->data;
+			snprintf(value, sizeof(value), "%u", disk->cached_blocks);
+			metrics_disk(f, "snapraid_disk_cached_blocks", disk->name, "data", value);
+		}
+		for (l = 0; l < state->level; ++l) {
+			snprintf(value, sizeof(value), "%u", state->parity[l].cached_blocks);
+			metrics_disk(f, "snapraid_disk_cached_blocks", lev_config_name(l), "parity", value);
+		}
+	}
+
+	fprintf(f, "# HELP snapraid_update_timestamp_seconds Time of the update of the metrics.\n");
+	fprintf(f, "# TYPE snapraid_update_timestamp_seconds gauge\n");
+	fprintf(f, "snapraid_update_timestamp_seconds %" PRIu64 "\n", (uint64_t)time(0));
+
+	if (ferror(f) != 0) {
+		fclose(f);
+		goto bail;
+	}
+
+	if (fclose(f) != 0)
+		goto bail;
+
+	if (rename(path, state->opt.metrics_file) != 0)
+		goto bail;
+
+	return;
+
+bail:
+	/* report the error only one time, without stopping the process */
+	if (!state->progress_metrics_error) {
+		log_fatal("WARNING! Error writing the metrics file '%s'. %s.\n", state->opt.metrics_file, strerror(errno));
+		state->progress_metrics_error = 1;
+	}
+	remove(path);
+}
+
 int state_progress_begin(struct snapraid_state* state, block_off_t blockstart, block_off_t blockmax, block_off_t countmax)
 {
 	time_t now;
@@ -4216,6 +6626,8 @@ int state_progress_begin(struct snapraid_state* state, block_off_t blockstart, b
 	state->progress_tick = 0;
 	state->progress_ptr = 0;
 	state->progress_wasted = 0;
+	state->progress_metrics = 0;
+	state->progress_metrics_error = 0;
 
 	/* stop if requested */
 	if (global_interrupt) {
@@ -4234,6 +6646,10 @@ int state_progress_begin(struct snapraid_state* state, block_off_t blockstart, b
 
 void state_progress_end(struct snapraid_state* state, block_off_t countpos, block_off_t countmax, data_off_t countsize)
 {
+	/* the last metrics, with the process completed */
+	if (state->opt.metrics_file)
+		state_progress_metrics(state, 0, countpos, countmax, countsize, 0, 0, 0);
+
 	if (state->opt.gui) {
 		log_tag("run:end\n");
 		log_flush();
@@ -4401,6 +6817,10 @@ static void state_progress_graph(struct snapraid_state* state, struct snapraid_i
 		printc(' ', 5 + pad + 1 + bar / 2 - strlen(legend) / 2);
 		printf("%s", legend);
 		printf("\n");
+
+		/* report the pages backing the buffers */
+		if (io->huge_alloc != 0)
+			printf("Buffers in huge pages: %u of %u allocations\n", io->huge_count, io->huge_alloc);
 	}
 
 	printf("\n");
@@ -4492,6 +6912,7 @@ int state_progress(struct snapraid_state* state, struct snapraid_io* io, block_o
 		unsigned out_cpu = 0;
 		unsigned out_eta = 0;
 		int out_computed = 0;
+		int out_eta_computed = 0;
 
 		/* store the new measure */
 		state->progress_time[state->progress_ptr] = now;
@@ -4582,6 +7003,17 @@ int state_progress(struct snapraid_state* state, struct snapraid_io* io, block_o
 
 			/* we have the output value */
 			out_computed = 1;
+		} else if (state->opt.io_rate != 0) {
+			/* until the speed is measured, estimate the remaining time from the */
+			/* throttled rate, as if the busiest disk has all the blocks to process */
+			out_eta = (unsigned)((countmax - countpos) * (uint64_t)state->block_size / (state->opt.io_rate * (uint64_t)MEBI) / 60);
+			out_eta_computed = 1;
+		}
+
+		/* update the metrics file, if requested */
+		if (state->opt.metrics_file && now >= state->progress_metrics + PROGRESS_METRICS_INTERVAL) {
+			state->progress_metrics = now;
+			state_progress_metrics(state, io, countpos, countmax, countsize, out_size_speed, out_computed || out_eta_computed ? (int)out_eta : -1, 1);
 		}
 
 		if (state->opt.gui) {
@@ -4594,6 +7026,8 @@ int state_progress(struct snapraid_state* state, struct snapraid_io* io, block_o
 				msg_bar(", %u offset/s", out_block_speed);
 				msg_bar(", CPU %u%%", out_cpu);
 				msg_bar(", %u:%02u ETA", out_eta / 60, out_eta % 60);
+			} else if (out_eta_computed) {
+				msg_bar(", %u:%02u ETA", out_eta / 60, out_eta % 60);
 			}
 			msg_bar("%s\r", PROGRESS_CLEAR);
 			msg_flush();
@@ -4660,6 +7094,8 @@ void state_usage_raid(struct snapraid_state* state)
 
 	/* increment the time spent in computations */
 	state->tick_raid += delta;
+	histo_add(&state->histo_raid, delta);
+	trace_event(0, "main", "raid", state->tick_last, now, 0);
 
 	state->tick_last = now;
 }
@@ -4671,6 +7107,8 @@ void state_usage_hash(struct snapraid_state* state)
 
 	/* increment the time spent in computations */
 	state->tick_hash += delta;
+	histo_add(&state->histo_hash, delta);
+	trace_event(0, "main", "hash", state->tick_last, now, 0);
 
 	state->tick_last = now;
 }
@@ -4728,6 +7166,74 @@ void state_usage_print(struct snapraid_state* state)
 	state_progress_graph(state, 0, state->progress_ptr, PROGRESS_MAX);
 }
 
+/**
+ * Convert ticks in microseconds.
+ */
+static uint64_t tick_to_us(uint64_t ticks, uint64_t freq)
+{
+	if (ticks > ~(uint64_t)0 / 1000000)
+		return ticks / freq * 1000000;
+
+	return ticks * 1000000 / freq;
+}
+
+/**
+ * Log and print the percentiles of a latency histogram.
+ */
+static void state_latency_print(const char* kind, const char* name, const struct snapraid_histo* histo, uint64_t freq, int print)
+{
+	uint64_t p50, p90, p99, max;
+
+	if (histo->count == 0)
+		return;
+
+	p50 = tick_to_us(histo_percentile(histo, 500), freq);
+	p90 = tick_to_us(histo_percentile(histo, 900), freq);
+	p99 = tick_to_us(histo_percentile(histo, 990), freq);
+	max = tick_to_us(histo->max, freq);
+
+	log_tag("latency:%s:%s:%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n", kind, name, histo->count, p50, p90, p99, max);
+
+	if (print)
+		printf("%8s %-8s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", name, kind, histo->count, p50, p90, p99, max);
+}
+
+void state_usage_latency(struct snapraid_state* state)
+{
+	uint64_t freq = tick_freq();
+	tommy_node* i;
+	unsigned l;
+	int print;
+
+	/* print the table only if requested, the tags are always logged */
+	print = state->opt.force_stats || msg_level >= MSG_VERBOSE;
+
+	if (print) {
+		printf("\n");
+		printf("%8s %-8s %10s %10s %10s %10s %10s\n", "", "", "count", "p50 us", "p90 us", "p99 us", "max us");
+	}
+
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+
+		state_latency_print("io", disk->name, &disk->histo_io, freq, print);
+		state_latency_print("wait", disk->name, &disk->histo_wait, freq, print);
+	}
+
+	for (l = 0; l < state->level; ++l) {
+		state_latency_print("io", lev_config_name(l), &state->parity[l].histo_io, freq, print);
+		state_latency_print("wait", lev_config_name(l), &state->parity[l].histo_wait, freq, print);
+	}
+
+	state_latency_print("cpu", "raid", &state->histo_raid, freq, print);
+	state_latency_print("cpu", "hash", &state->histo_hash, freq, print);
+
+	if (print)
+		printf("\n");
+
+	log_flush();
+}
+
 void state_fscheck(struct snapraid_state* state, const char* ope)
 {
 	tommy_node* i;
@@ -76,6 +76,7 @@ struct snapraid_option {
 	int badonly; /**< In fix, fixes only the blocks marked as bad. */
 	int syncedonly; /**< In fix, fixes only files that are synced. */
 	int prehash; /**< Enables the prehash mode for sync. */
+	int daemon; /**< In scrub, repeats the scrub continuously until interrupted. */
 	unsigned io_error_limit; /**< Max number of input/output errors before aborting. */
 	int force_zero; /**< Forced dangerous operations of syncing files now with zero size. */
 	int force_empty; /**< Forced dangerous operations of syncing disks now empty. */
@@ -100,11 +101,14 @@ struct snapraid_option {
 	int kill_after_sync; /**< Kill the process after sync without saving the final state. */
 	int force_murmur3; /**< Force Murmur3 choice. */
 	int force_spooky2; /**< Force Spooky2 choice. */
+	int force_xxh3; /**< Force XXH3 choice. */
 	int force_order; /**< Force sorting order. One of the SORT_* defines. */
 	unsigned force_scrub_at; /**< Force scrub for the specified number of blocks. */
 	int force_scrub_even; /**< Force scrub of all the even blocks. */
+	unsigned daemon_pass; /**< Stop the daemon after the specified number of passes or commands. 0 for no limit. */
 	int force_content_write; /**< Force the update of the content file. */
 	int skip_content_write; /**< Skip the update of the content file. */
+	int skip_block_hash; /**< Skip the load of the block hashes for commands that don't need them. */
 	int force_scan_winfind; /**< Force the use of FindFirst/Next in Windows to list directories. */
 	int force_progress; /**< Force the use of the progress status. */
 	unsigned force_autosave_at; /**< Force autosave at the specified block. */
@@ -118,12 +122,59 @@ struct snapraid_option {
 	int auto_conf; /**< Allow to run without configuration file. */
 	int force_stats; /**< Force stats print during process. */
 	uint64_t parity_limit_size; /**< Test limit for parity files. */
+	unsigned scan_threads; /**< Number of threads used to scan the disks. 0 for one for each disk. */
+	unsigned raid_threads; /**< Number of threads used to compute the parity. 0 or 1 for the main thread only. */
+	unsigned hash_threads; /**< Number of threads used to compute the hashes. 0 to use the disk threads. */
+	int io_uring; /**< Use io_uring for the parity reads and writes. */
+	unsigned io_memory; /**< MiB of memory shared by the data disks for the read-ahead. 0 for a fixed read-ahead. */
+	unsigned disk_threads; /**< Number of threads reading each data disk. 0 for one. */
+	unsigned io_rate; /**< Max MiB/s read or written in each disk. 0 for no limit. */
+	int io_idle; /**< Use the idle IO priority class. */
+	int io_huge; /**< Use huge pages for the IO buffers. */
+	unsigned file_cache; /**< Number of files kept open for each data disk. 0 to close them at each change. */
+	unsigned io_ahead; /**< Max number of blocks of a file read together. 0 or 1 to read one block at time. */
+	int io_numa; /**< Place the disk threads and buffers on the NUMA node of the disk controller. */
+	int lazy_spinup; /**< Spin up in advance only the disks used by the positions to process. */
+	int output_format; /**< Format of the list and diff output. One of the OUTPUT_* values. */
+	unsigned prehash_window; /**< MiB of each disk hashed ahead of the sync, concurrently. 0 for a preliminary hashing phase. */
+	const char* metrics_file; /**< File updated with the progress metrics. 0 for none. */
+	const char* bench_dir; /**< Directory of the synthetic array of the bench. */
+	unsigned bench_disks; /**< Number of data disks of the bench. 0 for default. */
+	unsigned bench_size; /**< MiB of data in each disk of the bench. 0 for default. */
+	unsigned bench_block; /**< Block size in KiB of the bench. 0 for default. */
+	unsigned bench_latency; /**< Milliseconds added to each read and write of the disks. */
+	unsigned bench_files; /**< Number of files of the content bench. 0 to bench sync and scrub. */
+	const char* serve_socket; /**< Local socket of the daemon keeping the state in memory. */
+	const char* agent_listen; /**< Address and port where the agent serves the remote parity files. */
+	int rehash_now; /**< Complete the rehash now, reading the data disks, instead of in the next sync and scrub. */
+	int compact; /**< Relocate the files in the parity to close the holes, before the sync. */
+	unsigned compact_plan; /**< Max percentage of the parity blocks relocated by the compaction. */
+	int dry_isolate; /**< Read each disk alone in the dry, instead of all together. */
 };
 
+/**
+ * Max number of lease files held in the schedule directory.
+ */
+#define SCHEDULE_LEASE_MAX 256
+
 struct snapraid_state {
 	struct snapraid_option opt; /**< Setup options. */
 	int filter_hidden; /**< Filter out hidden files. */
+	int journal; /**< Use the file-system change journal to scan only the changed directories. */
+	int dircache; /**< Use the directory modification time to skip the files in unchanged directories. */
 	uint64_t autosave; /**< Autosave after the specified amount of data. 0 to disable. */
+	unsigned autosave_time; /**< Autosave after the specified number of seconds. 0 to disable. */
+	unsigned smart_cache; /**< Reuse the SMART attributes read in the specified number of seconds. 0 to disable. */
+	unsigned content_format; /**< Format of the content file to write. 3 for SNAPCNT2/3, 4 for SNAPCNT4. */
+	int content_journal; /**< Save the autosave changes in a journal, without rewriting the content files. */
+	int content_compress; /**< Run-length encode the hash arrays of the content file. Requires content_format 4. */
+	int status_summary; /**< Save the summary reported by the status when writing the content files. */
+	unsigned content_sync; /**< Number of content files written before completing the write. The others are replicated in background. 0 for all. */
+	void* content_replica; /**< Context of the background replication of the content files. 0 if not running. */
+	int journal_ready; /**< If the content files match the state, apart the positions saved in the journal. */
+	uint32_t journal_base; /**< CRC of the content files the journal applies to. */
+	uint32_t journal_crc; /**< CRC of the journal written until now. */
+	block_off_t journal_count; /**< Number of positions saved in the journal. */
 	int need_write; /**< If the state is changed. */
 	int checked_read; /**< If the state was read and checked. */
 	uint32_t block_size; /**< Block size in bytes. */
@@ -136,10 +187,17 @@ struct snapraid_state {
 	unsigned char hashseed[HASH_MAX]; /**< Hash seed. Just after a uint64 to provide a minimal alignment. */
 	unsigned char prevhashseed[HASH_MAX]; /**< Previous hash seed. In case of rehash. */
 	char lockfile[PATH_MAX]; /**< Path of the lock file to use. */
+	char schedule_dir[PATH_MAX]; /**< Directory shared with the other arrays of the host to coordinate with them. Empty to disable. */
+	unsigned schedule_cpu; /**< Max number of computing threads of all the arrays together. 0 for no limit. */
+	unsigned schedule_io; /**< Max number of arrays using the same disk controller at the same time. 0 for no limit. */
+	int schedule_lease[SCHEDULE_LEASE_MAX]; /**< Lease files held in the schedule directory. */
+	unsigned schedule_lease_mac; /**< Number of lease files held. */
+	int schedule_content; /**< Lease file held to write the content files. -1 if not held. */
 	unsigned level; /**< Number of parity levels. 1 for PAR1, 2 for PAR2. */
 	unsigned hash; /**< Hash kind used. */
 	unsigned prevhash; /**< Previous hash kind used.  In case of rehash. */
 	unsigned besthash; /**< Best hash suggested. */
+	unsigned confighash; /**< Hash selected in the configuration file. HASH_UNDEFINED for the automatic choice. */
 	const char* command; /**< Command running. */
 	tommy_list contentlist; /**< List of content files. */
 	tommy_list disklist; /**< List of all the disks. */
@@ -149,7 +207,8 @@ struct snapraid_state {
 	tommy_hashdyn importset; /**< Hashtable by hash of all the import blocks. */
 	tommy_hashdyn previmportset; /**< Hashtable by prevhash of all the import blocks. Valid only if we are in a rehash state. */
 	tommy_hashdyn searchset; /**< Hashtable by timestamp of all the search files. */
-	tommy_arrayblkof infoarr; /**< Block information array. */
+	struct snapraid_search_file* search_open; /**< Search file with the handle open. */
+	struct snapraid_infoarr infoarr; /**< Block information array. */
 
 	/**
 	 * Cumulative time used for computations.
@@ -164,11 +223,25 @@ struct snapraid_state {
 	 */
 	uint64_t tick_io;
 
+	/**
+	 * Distribution of the time used for each raid and hash computation.
+	 */
+	struct snapraid_histo histo_raid;
+	struct snapraid_histo histo_hash;
+
 	/**
 	 * Last time used for time measure.
 	 */
 	uint64_t tick_last;
 
+	/**
+	 * Time used by the last read and write of the content file.
+	 */
+	uint64_t tick_content_parse; /**< Decoding, including the building of the file sets and trees. */
+	uint64_t tick_content_map; /**< Mapping of the disks and checking of the content. */
+	uint64_t tick_content_serialize;
+	uint64_t tick_content_verify;
+
 	int clear_past_hash; /**< Clear all the hash from CHG and DELETED blocks when reading the state from an incomplete sync. */
 
 	time_t progress_whole_start; /**< Initial start of the whole process. */
@@ -187,6 +260,9 @@ struct snapraid_state {
 	int progress_ptr; /**< Pointer to the next position to fill. Rolling over. */
 	int progress_tick; /**< Number of measures done. */
 
+	time_t progress_metrics; /**< Time of the latest update of the metrics file. */
+	int progress_metrics_error; /**< If the metrics file failed to be written. */
+
 	int no_conf; /**< Automatically add missing info. Used to load content without a configuration file. */
 };
 
@@ -215,6 +291,20 @@ void state_read(struct snapraid_state* state);
  */
 void state_write(struct snapraid_state* state);
 
+/**
+ * Wait for the background replication of the content files.
+ * Exit on failure.
+ */
+void state_write_wait(struct snapraid_state* state);
+
+/**
+ * Save the state during a long operation.
+ * The caller must ensure that the state is changed only in the range of positions
+ * specified, since the previous save.
+ * If possible the changes are appended to the journal, otherwise the state is fully written.
+ */
+void state_autosave(struct snapraid_state* state, block_off_t blockstart, block_off_t blockend);
+
 /**
  * Diff all the disks.
  */
@@ -235,6 +325,12 @@ void state_touch(struct snapraid_state* state);
  */
 void state_device(struct snapraid_state* state, int operation, tommy_list* filterlist_disk);
 
+/**
+ * Spin up in parallel the specified data disks, and all the parity disks if ::parity is set.
+ * The ::disk_map entries set to 0 are not spun up.
+ */
+void state_device_spinup(struct snapraid_state* state, struct snapraid_disk** disk_map, unsigned disk_max, int parity);
+
 /**
  * Sync the parity data.
  */
@@ -253,8 +349,10 @@ void state_dry(struct snapraid_state* state, block_off_t blockstart, block_off_t
 
 /**
  * Rehash the files.
+ * With the ::rehash_now option, the rehash is also completed reading all the data.
+ * Return 0 on success, -1 on error.
  */
-void state_rehash(struct snapraid_state* state);
+int state_rehash(struct snapraid_state* state);
 
 /**
  * Scrub levels.
@@ -265,16 +363,85 @@ void state_rehash(struct snapraid_state* state);
 #define SCRUB_FULL -4 /**< Scrub everything. */
 #define SCRUB_EVEN -5 /**< Even blocks. */
 
+/**
+ * Seconds waited by the scrub daemon when no block is old enough to scrub.
+ */
+#define SCRUB_DAEMON_WAIT 600
+
 /**
  * Scrub the files.
+ * With the daemon option, the scrub is repeated until interrupted.
  */
 int state_scrub(struct snapraid_state* state, int plan, int olderthan);
 
+/**
+ * Create the synthetic array of the bench in the --bench-dir directory.
+ * The path of its configuration file is stored in ::conf.
+ */
+void bench_create(struct snapraid_option* opt, char* conf, size_t conf_size);
+
+/**
+ * Remove the synthetic array of the bench.
+ */
+void bench_clear(struct snapraid_option* opt);
+
+/**
+ * Run the sync and the scrub of the synthetic array, reporting their speed.
+ */
+int state_bench(struct snapraid_state* state);
+
+/**
+ * Write and read the content file of a synthetic array, reporting the time of each phase.
+ */
+int state_bench_content(struct snapraid_state* state, const char* conf);
+
+/**
+ * Keep the state in memory and run the commands received on the --socket local socket.
+ * The state must be already read. The options and the disk filters of the
+ * command line are used again when the state is reloaded.
+ */
+int state_serve(struct snapraid_state* state, const char* conf, struct snapraid_option* opt, tommy_list* filterlist_disk);
+
+/**
+ * Send a command to the daemon listening on the specified local socket, and print its output.
+ * Return the exit code of the command.
+ */
+int serve_command(const char* path, const char* command);
+
+/**
+ * Take the leases of the schedule directory needed to run a command,
+ * waiting until the other arrays release them.
+ * The computing threads are limited to the leases obtained.
+ */
+void state_schedule(struct snapraid_state* state);
+
+/**
+ * Release all the leases of the schedule directory.
+ */
+void state_unschedule(struct snapraid_state* state);
+
+/**
+ * Take or release the lease to write the content files.
+ * Only one array at a time writes its content files.
+ */
+void state_schedule_content(struct snapraid_state* state, int take);
+
 /**
  * Print the status.
  */
 int state_status(struct snapraid_state* state);
 
+/**
+ * Save the summary reported by the status next to the first content file.
+ */
+void state_status_summary_write(struct snapraid_state* state);
+
+/**
+ * Report the status using the saved summary, without reading the content file.
+ * Return 0 on success, or -1 if the summary is missing or stale.
+ */
+int state_status_summary(struct snapraid_state* state);
+
 /**
  * Find duplicates.
  */
@@ -297,6 +464,21 @@ void state_pool(struct snapraid_state* state);
  */
 void state_refresh(struct snapraid_state* state);
 
+/**
+ * Build the read optimized index of the extents of all the disks.
+ *
+ * Call it before processing the blocks, after any scan.
+ */
+void state_index(struct snapraid_state* state);
+
+/**
+ * Fill the inode and stamp hashtables of the files of all the disks.
+ *
+ * Call it before any use of them, like when detecting moved and copied files.
+ * They are not filled when loading the content file.
+ */
+void state_fileset(struct snapraid_state* state);
+
 /**
  * Skip files, symlinks and dirs.
  * Apply any skip access disk.
@@ -367,6 +549,13 @@ void state_usage_parity(struct snapraid_state* state, unsigned* waiting_map, uns
  */
 void state_usage_print(struct snapraid_state* state);
 
+/**
+ * Print the latency distributions of the disks and of the computations.
+ *
+ * It's called after io_stop(), when the latency of the workers is collected.
+ */
+void state_usage_latency(struct snapraid_state* state);
+
 /**
  * Check the file-system on all disks.
  * On error it aborts.
@@ -22,6 +22,8 @@
 #include "state.h"
 #include "parity.h"
 #include "handle.h"
+#include "io.h"
+#include "stream.h"
 #include "raid/raid.h"
 
 /****************************************************************************/
@@ -47,31 +49,482 @@ static unsigned perc(uint64_t part, uint64_t total)
 	return (unsigned)(part * 100 / total);
 }
 
+/**
+ * Block sizes in KiB for which the memory usage is projected.
+ */
+static const unsigned memory_plan_size[] = { 64, 128, 256, 512, 1024, 4096 };
+
+#define MEMORY_PLAN_MAX (sizeof(memory_plan_size) / sizeof(memory_plan_size[0]))
+
+/**
+ * Max number of files with zero sub-second timestamp logged for each disk.
+ */
+#define STATUS_ZERO_MAX 50
+
+/**
+ * Max number of bad blocks printed.
+ */
+#define STATUS_BAD_MAX 101
+
 /**
  * Bit used to mark unscrubbed time info.
  */
 #define TIME_NEW 1
 
-int state_status(struct snapraid_state* state)
+/**
+ * Status of a data disk.
+ */
+struct snapraid_status_disk {
+	char name[PATH_MAX]; /**< Name of the disk. */
+	unsigned file_count; /**< Number of files. */
+	unsigned file_fragmented; /**< Number of fragmented files. */
+	unsigned extra_fragment; /**< Number of fragments in excess. */
+	unsigned file_zerosubsecond; /**< Number of files with zero sub-second timestamp. */
+	unsigned zero_max; /**< Number of files in ::zero_sub. */
+	char* zero_sub[STATUS_ZERO_MAX]; /**< First files with zero sub-second timestamp. */
+	block_off_t block_count; /**< Number of blocks used by files. */
+	uint64_t file_size; /**< Size of the files. */
+	block_off_t block_latest_used; /**< Latest parity position used. */
+	block_off_t total_blocks; /**< Total blocks in the disk. */
+	block_off_t free_blocks; /**< Free blocks in the disk. */
+	uint64_t memory_files; /**< Memory used by files, links and dirs. */
+	uint64_t memory_extents; /**< Memory used by the extents. */
+	uint64_t memory_tables; /**< Memory used by the hashtables. */
+	uint64_t plan_blocks[MEMORY_PLAN_MAX]; /**< Number of blocks for each projected block size. */
+};
+
+/**
+ * Run of blocks with the same scrub time.
+ */
+struct snapraid_status_run {
+	int64_t time; /**< Scrub time, with the TIME_NEW bit. */
+	block_off_t count; /**< Number of blocks. */
+};
+
+/**
+ * Everything reported by the status.
+ *
+ * It's computed from the state, or read from the summary saved
+ * with the content file.
+ */
+struct snapraid_status {
+	uint32_t block_size;
+	block_off_t blockmax;
+	unsigned level;
+	block_off_t parity_total_blocks[LEV_MAX];
+	block_off_t parity_free_blocks[LEV_MAX];
+	unsigned hash;
+	unsigned prevhash;
+	unsigned disk_max;
+	struct snapraid_status_disk* disk;
+	uint64_t info_memory; /**< Memory used by the info array. */
+	unsigned info_element_size; /**< Memory used by the info of each block. */
+	block_off_t unsynced_blocks;
+	block_off_t unscrubbed_blocks;
+	block_off_t rehash;
+	block_off_t bad;
+	block_off_t bad_first;
+	block_off_t bad_last;
+	unsigned bad_max; /**< Number of positions in ::bad_pos. */
+	block_off_t bad_pos[STATUS_BAD_MAX]; /**< First positions with errors. */
+	block_off_t count; /**< Number of blocks with info. */
+	unsigned run_max; /**< Number of runs in ::run. */
+	struct snapraid_status_run* run; /**< Runs of scrub times, sorted. */
+};
+
+static void status_done(struct snapraid_status* status)
+{
+	unsigned d;
+	unsigned k;
+
+	for (d = 0; d < status->disk_max; ++d) {
+		for (k = 0; k < status->disk[d].zero_max; ++k)
+			free(status->disk[d].zero_sub[k]);
+	}
+
+	free(status->disk);
+	free(status->run);
+}
+
+static double mebi(uint64_t size)
+{
+	return (double)size / MEBI;
+}
+
+/**
+ * Compute the memory used by a disk, and how it changes with the block size.
+ *
+ * The blocks are accounted with their hash, as used by sync and scrub,
+ * even if when running status the hashes are not loaded.
+ * The inode and stamp hashtables are accounted as big as the path one,
+ * even if not yet filled.
+ */
+static void status_memory_disk(struct snapraid_disk* disk, struct snapraid_status_disk* sdisk)
+{
+	tommy_node* k;
+	uint64_t disk_block_count;
+	unsigned j;
+
+	disk_block_count = 0;
+	for (j = 0; j < MEMORY_PLAN_MAX; ++j)
+		sdisk->plan_blocks[j] = 0;
+
+	for (k = disk->filelist; k != 0; k = k->next) {
+		struct snapraid_file* file = k->data;
+		disk_block_count += file->blockmax;
+		for (j = 0; j < MEMORY_PLAN_MAX; ++j) {
+			uint64_t size = memory_plan_size[j] * (uint64_t)KIBI;
+			sdisk->plan_blocks[j] += (file->size + size - 1) / size;
+		}
+	}
+
+	/* files, links and dirs, with the blocks with their hash */
+	sdisk->memory_files = disk->arena.used - disk_block_count * block_sizeof() + disk_block_count * (1 + BLOCK_HASH_SIZE);
+
+	/* extents, with the index of all of them */
+	sdisk->memory_extents = disk->fs_arena.used + tommy_tree_count(&disk->fs_parity) * (sizeof(block_off_t) + sizeof(struct snapraid_index_entry));
+
+	/* hashtables, with the inode and stamp ones, maybe not yet filled */
+	sdisk->memory_tables = tommy_hashdyn_memory_usage(&disk->pathset)
+		+ tommy_hashdyn_memory_usage(&disk->linkset)
+		+ tommy_hashdyn_memory_usage(&disk->dirset)
+		+ tommy_hashdyn_memory_usage(&disk->dirstampset);
+	if (disk->has_fileset)
+		sdisk->memory_tables += tommy_hashdyn_memory_usage(&disk->inodeset) + tommy_hashdyn_memory_usage(&disk->stampset);
+	else
+		sdisk->memory_tables += 2 * tommy_hashdyn_memory_usage(&disk->pathset);
+}
+
+/**
+ * Compute the status of the array.
+ */
+static void status_compute(struct snapraid_state* state, struct snapraid_status* status)
 {
 	block_off_t blockmax;
 	block_off_t i;
 	time_t* timemap;
+	block_off_t count;
+	unsigned l;
+	unsigned d;
+	tommy_node* node_disk;
+
+	blockmax = parity_allocated_size(state);
+
+	status->block_size = state->block_size;
+	status->blockmax = blockmax;
+	status->level = state->level;
+	for (l = 0; l < state->level; ++l) {
+		status->parity_total_blocks[l] = state->parity[l].total_blocks;
+		status->parity_free_blocks[l] = state->parity[l].free_blocks;
+	}
+	status->hash = state->hash;
+	status->prevhash = state->prevhash;
+
+	status->disk_max = tommy_list_count(&state->disklist);
+	status->disk = calloc_nofail(status->disk_max, sizeof(struct snapraid_status_disk));
+
+	/* count fragments */
+	for (node_disk = state->disklist, d = 0; node_disk != 0; node_disk = node_disk->next, ++d) {
+		struct snapraid_disk* disk = node_disk->data;
+		struct snapraid_status_disk* sdisk = &status->disk[d];
+		tommy_node* node;
+		block_off_t j;
+
+		pathcpy(sdisk->name, sizeof(sdisk->name), disk->name);
+
+		/* for each file in the disk */
+		node = disk->filelist;
+		while (node) {
+			struct snapraid_file* file;
+
+			file = node->data;
+			node = node->next; /* next node */
+
+			if (file->mtime_nsec == STAT_NSEC_INVALID
+				|| file->mtime_nsec == 0
+			) {
+				++sdisk->file_zerosubsecond;
+				if (sdisk->zero_max < STATUS_ZERO_MAX)
+					sdisk->zero_sub[sdisk->zero_max++] = strdup_nofail(file->sub);
+			}
+
+			/* check fragmentation */
+			if (file->blockmax != 0) {
+				block_off_t prev_pos;
+				block_off_t last_pos;
+				int fragmented;
+
+				fragmented = 0;
+				prev_pos = fs_file2par_get(disk, file, 0);
+				for (j = 1; j < file->blockmax; ++j) {
+					block_off_t parity_pos = fs_file2par_get(disk, file, j);
+					if (prev_pos + 1 != parity_pos) {
+						fragmented = 1;
+						++sdisk->extra_fragment;
+					}
+					prev_pos = parity_pos;
+				}
+
+				/* keep track of latest block used */
+				last_pos = fs_file2par_get(disk, file, file->blockmax - 1);
+				if (last_pos > sdisk->block_latest_used) {
+					sdisk->block_latest_used = last_pos;
+				}
+
+				if (fragmented)
+					++sdisk->file_fragmented;
+
+				sdisk->block_count += file->blockmax;
+			}
+
+			/* count files */
+			++sdisk->file_count;
+			sdisk->file_size += file->size;
+		}
+
+		sdisk->total_blocks = disk->total_blocks;
+		sdisk->free_blocks = disk->free_blocks;
+
+		status_memory_disk(disk, sdisk);
+	}
+
+	status->info_memory = tommy_arrayblkof_memory_usage(&state->infoarr.array);
+	status->info_element_size = state->infoarr.array.element_size;
+
+	/* copy the info a temp vector, and count bad/rehash/unsynced blocks */
+	timemap = malloc_nofail(blockmax * sizeof(time_t));
+	count = 0;
+	for (i = 0; i < blockmax; ++i) {
+		int one_invalid;
+		int one_valid;
+
+		snapraid_info info = info_get(&state->infoarr, i);
+
+		/* for each disk */
+		one_invalid = 0;
+		one_valid = 0;
+		for (node_disk = state->disklist; node_disk != 0; node_disk = node_disk->next) {
+			struct snapraid_disk* disk = node_disk->data;
+			struct snapraid_block* block = fs_par2block_find(disk, i);
+
+			if (block_has_file(block))
+				one_valid = 1;
+			if (block_has_invalid_parity(block))
+				one_invalid = 1;
+		}
+
+		/* if both valid and invalid, we need to update */
+		if (one_invalid && one_valid) {
+			++status->unsynced_blocks;
+		}
+
+		/* skip unused blocks */
+		if (info != 0) {
+			time_t scrub_time;
+
+			if (info_get_bad(info)) {
+				if (status->bad == 0)
+					status->bad_first = i;
+				status->bad_last = i;
+				++status->bad;
+				if (status->bad_max < STATUS_BAD_MAX)
+					status->bad_pos[status->bad_max++] = i;
+			}
+
+			if (info_get_rehash(info))
+				++status->rehash;
+
+			scrub_time = info_get_time(info);
+
+			if (info_get_justsynced(info)) {
+				++status->unscrubbed_blocks;
+
+				/* mark the time as not scrubbed */
+				scrub_time |= TIME_NEW;
+			}
+
+			timemap[count++] = scrub_time;
+		}
+	}
+
+	status->count = count;
+
+	/* sort the info to get the time info */
+	qsort(timemap, count, sizeof(time_t), time_compare);
+
+	/* group the equal times */
+	status->run = malloc_nofail((count + 1) * sizeof(struct snapraid_status_run));
+	i = 0;
+	while (i < count) {
+		block_off_t j = i + 1;
+		while (j < count && timemap[i] == timemap[j])
+			++j;
+		status->run[status->run_max].time = timemap[i];
+		status->run[status->run_max].count = j - i;
+		++status->run_max;
+		i = j;
+	}
+
+	/* free the temp vector */
+	free(timemap);
+}
+
+/**
+ * Report the memory used by the array, and project it for other block sizes.
+ */
+static void status_memory(struct snapraid_state* state, struct snapraid_status* status)
+{
+	uint64_t all_files;
+	uint64_t all_blocks;
+	uint64_t all_extents;
+	uint64_t all_tables;
+	uint64_t info;
+	uint64_t io;
+	uint64_t total;
+	uint64_t plan_base;
+	uint64_t plan_blocks[MEMORY_PLAN_MAX];
+	uint64_t plan_parity[MEMORY_PLAN_MAX];
+	unsigned buffer_max;
+	unsigned j;
+	unsigned d;
+
+	all_files = 0;
+	all_blocks = 0;
+	all_extents = 0;
+	all_tables = 0;
+	plan_base = 0;
+	for (j = 0; j < MEMORY_PLAN_MAX; ++j) {
+		plan_blocks[j] = 0;
+		plan_parity[j] = 0;
+	}
+
+	printf("\n");
+	printf("   Files    Blocks   Files Extents  Tables Name\n");
+	printf("                       MiB     MiB     MiB\n");
+
+	for (d = 0; d < status->disk_max; ++d) {
+		struct snapraid_status_disk* sdisk = &status->disk[d];
+		uint64_t disk_file_count = sdisk->file_count;
+		uint64_t disk_block_count = sdisk->block_count;
+		uint64_t disk_files = sdisk->memory_files;
+		uint64_t disk_extents = sdisk->memory_extents;
+		uint64_t disk_tables = sdisk->memory_tables;
+
+		printf("%8" PRIu64, disk_file_count);
+		printf("%10" PRIu64, disk_block_count);
+		printf("%8.1f", mebi(disk_files));
+		printf("%8.1f", mebi(disk_extents));
+		printf("%8.1f", mebi(disk_tables));
+		printf(" %s\n", sdisk->name);
+
+		log_tag("memory:disk:%s:%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 "\n", sdisk->name, disk_file_count, disk_block_count, disk_files, disk_extents, disk_tables);
+
+		all_files += disk_files;
+		all_blocks += disk_block_count;
+		all_extents += disk_extents;
+		all_tables += disk_tables;
+
+		/* the projection changes only the blocks, and the parity size */
+		plan_base += disk_files - disk_block_count * (1 + BLOCK_HASH_SIZE) + disk_extents + disk_tables;
+		for (j = 0; j < MEMORY_PLAN_MAX; ++j) {
+			plan_blocks[j] += sdisk->plan_blocks[j];
+			if (plan_parity[j] < sdisk->plan_blocks[j])
+				plan_parity[j] = sdisk->plan_blocks[j];
+		}
+	}
+
+	/* the buffers used by scrub, the command using more of them */
+	buffer_max = status->disk_max + 2 * status->level;
+
+	info = status->info_memory;
+	io = io_cache_max(status->block_size, state->opt.io_cache) * (uint64_t)buffer_max * status->block_size;
+	total = all_files + all_extents + all_tables + info + io;
+
+	printf(" --------------------------------------------------------------------------\n");
+	printf("%18" PRIu64, all_blocks);
+	printf("%8.1f", mebi(all_files));
+	printf("%8.1f", mebi(all_extents));
+	printf("%8.1f", mebi(all_tables));
+	printf("\n");
+	printf("\n");
+	printf("Using %.1f MiB for the info and %.1f MiB for the IO buffers, %.1f MiB in total.\n", mebi(info), mebi(io), mebi(total));
+	printf("\n");
+	printf("Memory projected for block size:\n");
+	for (j = 0; j < MEMORY_PLAN_MAX; ++j) {
+		unsigned size = memory_plan_size[j] * KIBI;
+		uint64_t plan;
+
+		plan = plan_base
+			+ plan_blocks[j] * (1 + BLOCK_HASH_SIZE)
+			+ plan_parity[j] * status->info_element_size
+			+ io_cache_max(size, state->opt.io_cache) * (uint64_t)buffer_max * size;
+
+		printf("%8u KiB %10.1f MiB%s\n", memory_plan_size[j], mebi(plan), size == status->block_size ? " (current)" : "");
+
+		log_tag("memory:plan:%u:%" PRIu64 "\n", size, plan);
+	}
+
+	log_tag("memory:info:%" PRIu64 "\n", info);
+	log_tag("memory:io:%" PRIu64 "\n", io);
+	log_tag("memory:total:%" PRIu64 "\n", total);
+}
+
+/**
+ * Log the state of each block for the GUI.
+ */
+static void status_gui(struct snapraid_state* state, block_off_t blockmax)
+{
+	block_off_t i;
+
+	for (i = 0; i < blockmax; ++i) {
+		tommy_node* node_disk;
+		int one_invalid;
+		int one_valid;
+
+		snapraid_info info = info_get(&state->infoarr, i);
+
+		one_invalid = 0;
+		one_valid = 0;
+		for (node_disk = state->disklist; node_disk != 0; node_disk = node_disk->next) {
+			struct snapraid_disk* disk = node_disk->data;
+			struct snapraid_block* block = fs_par2block_find(disk, i);
+
+			if (block_has_file(block))
+				one_valid = 1;
+			if (block_has_invalid_parity(block))
+				one_invalid = 1;
+		}
+
+		if (info != 0)
+			log_tag("block:%u:%" PRIu64 ":%s:%s:%s:%s\n", i, (uint64_t)info_get_time(info), one_valid ? "used" : "", one_invalid ? "unsynced" : "", info_get_bad(info) ? "bad" : "", info_get_rehash(info) ? "rehash" : "");
+		else
+			log_tag("block_noinfo:%u:%s:%s\n", i, one_valid ? "used" : "", one_invalid ? "unsynced" : "");
+	}
+}
+
+/**
+ * Print the status report.
+ *
+ * The ::gui flag logs also the state of each block, that requires the full state.
+ */
+static void status_print(struct snapraid_state* state, struct snapraid_status* status, int gui)
+{
+	block_off_t blockmax;
+	block_off_t i;
 	time_t now;
 	block_off_t bad;
-	block_off_t bad_first;
-	block_off_t bad_last;
 	block_off_t rehash;
 	block_off_t count;
 	unsigned l;
+	unsigned d;
 	unsigned dayoldest, daymedian, daynewest;
 	unsigned bar_scrubbed[GRAPH_COLUMN];
 	unsigned bar_new[GRAPH_COLUMN];
-	unsigned barpos;
+	unsigned runpos;
+	block_off_t runused;
 	unsigned barmax;
 	time_t oldest, newest, median;
 	unsigned x, y;
-	tommy_node* node_disk;
 	unsigned file_count;
 	unsigned file_fragmented;
 	unsigned extra_fragment;
@@ -91,19 +544,19 @@ int state_status(struct snapraid_state* state)
 	/* keep track if at least a free info is available */
 	free_not_zero = 0;
 
-	blockmax = parity_allocated_size(state);
+	blockmax = status->blockmax;
 
-	log_tag("summary:block_size:%u\n", state->block_size);
+	log_tag("summary:block_size:%u\n", status->block_size);
 	log_tag("summary:parity_block_count:%u\n", blockmax);
 
 	/* get the minimum parity free space */
-	parity_block_free = state->parity[0].free_blocks;
-	for (l = 0; l < state->level; ++l) {
-		log_tag("summary:parity_block_total:%s:%u\n", lev_config_name(l), state->parity[l].total_blocks);
-		log_tag("summary:parity_block_free:%s:%u\n", lev_config_name(l), state->parity[l].free_blocks);
-		if (state->parity[l].free_blocks < parity_block_free)
-			parity_block_free = state->parity[l].free_blocks;
-		if (state->parity[l].free_blocks != 0)
+	parity_block_free = status->parity_free_blocks[0];
+	for (l = 0; l < status->level; ++l) {
+		log_tag("summary:parity_block_total:%s:%u\n", lev_config_name(l), status->parity_total_blocks[l]);
+		log_tag("summary:parity_block_free:%s:%u\n", lev_config_name(l), status->parity_free_blocks[l]);
+		if (status->parity_free_blocks[l] < parity_block_free)
+			parity_block_free = status->parity_free_blocks[l];
+		if (status->parity_free_blocks[l] != 0)
 			free_not_zero = 1;
 	}
 	log_tag("summary:parity_block_free_min:%u\n", parity_block_free);
@@ -113,7 +566,6 @@ int state_status(struct snapraid_state* state)
 	printf("   Files Fragmented Excess  Wasted  Used    Free  Use Name\n");
 	printf("            Files  Fragments  GB      GB      GB\n");
 
-	/* count fragments */
 	file_count = 0;
 	file_size = 0;
 	file_block_count = 0;
@@ -122,86 +574,34 @@ int state_status(struct snapraid_state* state)
 	extra_fragment = 0;
 	file_zerosubsecond = 0;
 	all_wasted = 0;
-	for (node_disk = state->disklist; node_disk != 0; node_disk = node_disk->next) {
-		struct snapraid_disk* disk = node_disk->data;
-		tommy_node* node;
-		block_off_t j;
-		unsigned disk_file_count = 0;
-		unsigned disk_file_fragmented = 0;
-		unsigned disk_extra_fragment = 0;
-		unsigned disk_file_zerosubsecond = 0;
-		block_off_t disk_block_count = 0;
-		uint64_t disk_file_size = 0;
-		block_off_t disk_block_latest_used = 0;
+	for (d = 0; d < status->disk_max; ++d) {
+		struct snapraid_status_disk* sdisk = &status->disk[d];
+		block_off_t disk_block_count = sdisk->block_count;
 		block_off_t disk_block_max_by_space;
 		block_off_t disk_block_max_by_parity;
 		block_off_t disk_block_max;
 		int64_t wasted;
+		unsigned k;
 
-		/* for each file in the disk */
-		node = disk->filelist;
-		while (node) {
-			struct snapraid_file* file;
-
-			file = node->data;
-			node = node->next; /* next node */
-
-			if (file->mtime_nsec == STAT_NSEC_INVALID
-				|| file->mtime_nsec == 0
-			) {
-				++file_zerosubsecond;
-				++disk_file_zerosubsecond;
-				if (disk_file_zerosubsecond < 50)
-					log_tag("zerosubsecond:%s:%s: \n", disk->name, file->sub);
-				if (disk_file_zerosubsecond == 50)
-					log_tag("zerosubsecond:%s:%s: (more follow)\n", disk->name, file->sub);
-			}
-
-			/* check fragmentation */
-			if (file->blockmax != 0) {
-				block_off_t prev_pos;
-				block_off_t last_pos;
-				int fragmented;
-
-				fragmented = 0;
-				prev_pos = fs_file2par_get(disk, file, 0);
-				for (j = 1; j < file->blockmax; ++j) {
-					block_off_t parity_pos = fs_file2par_get(disk, file, j);
-					if (prev_pos + 1 != parity_pos) {
-						fragmented = 1;
-						++extra_fragment;
-						++disk_extra_fragment;
-					}
-					prev_pos = parity_pos;
-				}
-
-				/* keep track of latest block used */
-				last_pos = fs_file2par_get(disk, file, file->blockmax - 1);
-				if (last_pos > disk_block_latest_used) {
-					disk_block_latest_used = last_pos;
-				}
-
-				if (fragmented) {
-					++file_fragmented;
-					++disk_file_fragmented;
-				}
-
-				disk_block_count += file->blockmax;
-			}
-
-			/* count files */
-			++file_count;
-			++disk_file_count;
-			file_size += file->size;
-			file_block_count += file->blockmax;
-			disk_file_size += file->size;
+		for (k = 0; k < sdisk->zero_max; ++k) {
+			if (k < STATUS_ZERO_MAX - 1)
+				log_tag("zerosubsecond:%s:%s: \n", sdisk->name, sdisk->zero_sub[k]);
+			else
+				log_tag("zerosubsecond:%s:%s: (more follow)\n", sdisk->name, sdisk->zero_sub[k]);
 		}
 
-		if (disk->free_blocks != 0)
+		file_count += sdisk->file_count;
+		file_fragmented += sdisk->file_fragmented;
+		extra_fragment += sdisk->extra_fragment;
+		file_zerosubsecond += sdisk->file_zerosubsecond;
+		file_size += sdisk->file_size;
+		file_block_count += sdisk->block_count;
+
+		if (sdisk->free_blocks != 0)
 			free_not_zero = 1;
 
 		/* get the free block info */
-		disk_block_max_by_space = disk_block_count + disk->free_blocks;
+		disk_block_max_by_space = disk_block_count + sdisk->free_blocks;
 		disk_block_max_by_parity = blockmax + parity_block_free;
 
 		/* the maximum usable space in a disk is limited by the smallest */
@@ -217,45 +617,45 @@ int state_status(struct snapraid_state* state)
 		/* wasted space is the difference of the two maximum size */
 		/* if negative, it's extra space available in parity */
 		wasted = (int64_t)disk_block_max_by_space - (int64_t)disk_block_max_by_parity;
-		wasted *= state->block_size;
+		wasted *= status->block_size;
 
 		if (wasted > 0)
 			all_wasted += wasted;
 		file_block_free += disk_block_max - disk_block_count;
 
-		printf("%8u", disk_file_count);
-		printf("%8u", disk_file_fragmented);
-		printf("%8u", disk_extra_fragment);
+		printf("%8u", sdisk->file_count);
+		printf("%8u", sdisk->file_fragmented);
+		printf("%8u", sdisk->extra_fragment);
 		if (wasted < -100LL * GIGA) {
 			printf("       -");
 		} else {
 			printf("%8.1f", (double)wasted / GIGA);
 		}
-		printf("%8" PRIu64, disk_file_size / GIGA);
+		printf("%8" PRIu64, sdisk->file_size / GIGA);
 
 		if (disk_block_max == 0 && disk_block_count == 0) {
 			/* if the disk is empty and we don't have the free space info */
 			printf("       -");
 			printf("   - ");
 		} else {
-			printf("%8" PRIu64, (disk_block_max - disk_block_count) * (uint64_t)state->block_size / GIGA);
+			printf("%8" PRIu64, (disk_block_max - disk_block_count) * (uint64_t)status->block_size / GIGA);
 			printf(" %3u%%", perc(disk_block_count, disk_block_max));
 		}
-		printf(" %s\n", disk->name);
-
-		log_tag("summary:disk_file_count:%s:%u\n", disk->name, disk_file_count);
-		log_tag("summary:disk_block_count:%s:%u\n", disk->name, disk_block_count);
-		log_tag("summary:disk_fragmented_file_count:%s:%u\n", disk->name, disk_file_fragmented);
-		log_tag("summary:disk_excess_fragment_count:%s:%u\n", disk->name, disk_extra_fragment);
-		log_tag("summary:disk_zerosubsecond_file_count:%s:%u\n", disk->name, disk_file_zerosubsecond);
-		log_tag("summary:disk_file_size:%s:%" PRIu64 "\n", disk->name, disk_file_size);
-		log_tag("summary:disk_block_allocated:%s:%u\n", disk->name, disk_block_latest_used + 1);
-		log_tag("summary:disk_block_total:%s:%u\n", disk->name, disk->total_blocks);
-		log_tag("summary:disk_block_free:%s:%u\n", disk->name, disk->free_blocks);
-		log_tag("summary:disk_block_max_by_space:%s:%u\n", disk->name, disk_block_max_by_space);
-		log_tag("summary:disk_block_max_by_parity:%s:%u\n", disk->name, disk_block_max_by_parity);
-		log_tag("summary:disk_block_max:%s:%u\n", disk->name, disk_block_max);
-		log_tag("summary:disk_space_wasted:%s:%" PRId64 "\n", disk->name, wasted);
+		printf(" %s\n", sdisk->name);
+
+		log_tag("summary:disk_file_count:%s:%u\n", sdisk->name, sdisk->file_count);
+		log_tag("summary:disk_block_count:%s:%u\n", sdisk->name, disk_block_count);
+		log_tag("summary:disk_fragmented_file_count:%s:%u\n", sdisk->name, sdisk->file_fragmented);
+		log_tag("summary:disk_excess_fragment_count:%s:%u\n", sdisk->name, sdisk->extra_fragment);
+		log_tag("summary:disk_zerosubsecond_file_count:%s:%u\n", sdisk->name, sdisk->file_zerosubsecond);
+		log_tag("summary:disk_file_size:%s:%" PRIu64 "\n", sdisk->name, sdisk->file_size);
+		log_tag("summary:disk_block_allocated:%s:%u\n", sdisk->name, sdisk->block_latest_used + 1);
+		log_tag("summary:disk_block_total:%s:%u\n", sdisk->name, sdisk->total_blocks);
+		log_tag("summary:disk_block_free:%s:%u\n", sdisk->name, sdisk->free_blocks);
+		log_tag("summary:disk_block_max_by_space:%s:%u\n", sdisk->name, disk_block_max_by_space);
+		log_tag("summary:disk_block_max_by_parity:%s:%u\n", sdisk->name, disk_block_max_by_parity);
+		log_tag("summary:disk_block_max:%s:%u\n", sdisk->name, disk_block_max);
+		log_tag("summary:disk_space_wasted:%s:%" PRId64 "\n", sdisk->name, wasted);
 	}
 
 	/* totals */
@@ -265,7 +665,7 @@ int state_status(struct snapraid_state* state)
 	printf("%8u", extra_fragment);
 	printf("%8.1f", (double)all_wasted / GIGA);
 	printf("%8" PRIu64, file_size / GIGA);
-	printf("%8" PRIu64, file_block_free * state->block_size / GIGA);
+	printf("%8" PRIu64, file_block_free * status->block_size / GIGA);
 	printf(" %3u%%", perc(file_block_count, file_block_count + file_block_free));
 	printf("\n");
 
@@ -273,126 +673,72 @@ int state_status(struct snapraid_state* state)
 	if (!free_not_zero)
 		printf("\nWARNING! Free space info will be valid after the first sync.\n");
 
+	/* report the memory, and how it changes with the block size */
+	status_memory(state, status);
+
 	log_tag("summary:file_count:%u\n", file_count);
 	log_tag("summary:file_block_count:%" PRIu64 "\n", file_block_count);
 	log_tag("summary:fragmented_file_count:%u\n", file_fragmented);
 	log_tag("summary:excess_fragment_count:%u\n", extra_fragment);
 	log_tag("summary:zerosubsecond_file_count:%u\n", file_zerosubsecond);
 	log_tag("summary:file_size:%" PRIu64 "\n", file_size);
-	log_tag("summary:parity_size:%" PRIu64 "\n", blockmax * (uint64_t)state->block_size);
-	log_tag("summary:parity_size_max:%" PRIu64 "\n", (blockmax + parity_block_free) * (uint64_t)state->block_size);
-	log_tag("summary:hash:%s\n", hash_config_name(state->hash));
-	log_tag("summary:prev_hash:%s\n", hash_config_name(state->prevhash));
+	log_tag("summary:parity_size:%" PRIu64 "\n", blockmax * (uint64_t)status->block_size);
+	log_tag("summary:parity_size_max:%" PRIu64 "\n", (blockmax + parity_block_free) * (uint64_t)status->block_size);
+	log_tag("summary:hash:%s\n", hash_config_name(status->hash));
+	log_tag("summary:prev_hash:%s\n", hash_config_name(status->prevhash));
 	log_tag("summary:best_hash:%s\n", hash_config_name(state->besthash));
 	log_flush();
 
-	/* copy the info a temp vector, and count bad/rehash/unsynced blocks */
-	timemap = malloc_nofail(blockmax * sizeof(time_t));
-	bad = 0;
-	bad_first = 0;
-	bad_last = 0;
-	count = 0;
-	rehash = 0;
-	unsynced_blocks = 0;
-	unscrubbed_blocks = 0;
-	log_tag("block_count:%u\n", blockmax);
-	for (i = 0; i < blockmax; ++i) {
-		int one_invalid;
-		int one_valid;
-
-		snapraid_info info = info_get(&state->infoarr, i);
-
-		/* for each disk */
-		one_invalid = 0;
-		one_valid = 0;
-		for (node_disk = state->disklist; node_disk != 0; node_disk = node_disk->next) {
-			struct snapraid_disk* disk = node_disk->data;
-			struct snapraid_block* block = fs_par2block_find(disk, i);
-
-			if (block_has_file(block))
-				one_valid = 1;
-			if (block_has_invalid_parity(block))
-				one_invalid = 1;
-		}
-
-		/* if both valid and invalid, we need to update */
-		if (one_invalid && one_valid) {
-			++unsynced_blocks;
-		}
-
-		/* skip unused blocks */
-		if (info != 0) {
-			time_t scrub_time;
-
-			if (info_get_bad(info)) {
-				if (bad == 0)
-					bad_first = i;
-				bad_last = i;
-				++bad;
-			}
-
-			if (info_get_rehash(info))
-				++rehash;
-
-			scrub_time = info_get_time(info);
-
-			if (info_get_justsynced(info)) {
-				++unscrubbed_blocks;
-
-				/* mark the time as not scrubbed */
-				scrub_time |= TIME_NEW;
-			}
-
-			timemap[count++] = scrub_time;
-		}
+	bad = status->bad;
+	rehash = status->rehash;
+	count = status->count;
+	unsynced_blocks = status->unsynced_blocks;
+	unscrubbed_blocks = status->unscrubbed_blocks;
 
-		if (state->opt.gui) {
-			if (info != 0)
-				log_tag("block:%u:%" PRIu64 ":%s:%s:%s:%s\n", i, (uint64_t)info_get_time(info), one_valid ? "used" : "", one_invalid ? "unsynced" : "", info_get_bad(info) ? "bad" : "", info_get_rehash(info) ? "rehash" : "");
-			else
-				log_tag("block_noinfo:%u:%s:%s\n", i, one_valid ? "used" : "", one_invalid ? "unsynced" : "");
-		}
-	}
+	log_tag("block_count:%u\n", blockmax);
+	if (gui)
+		status_gui(state, blockmax);
 
 	log_tag("summary:has_unsynced:%u\n", unsynced_blocks);
 	log_tag("summary:has_unscrubbed:%u\n", unscrubbed_blocks);
 	log_tag("summary:has_rehash:%u\n", rehash);
-	log_tag("summary:has_bad:%u:%u:%u\n", bad, bad_first, bad_last);
+	log_tag("summary:has_bad:%u:%u:%u\n", bad, status->bad_first, status->bad_last);
 	log_flush();
 
 	if (!count) {
 		log_fatal("The array is empty.\n");
-		free(timemap);
-		return 0;
+		return;
 	}
 
-	/* sort the info to get the time info */
-	qsort(timemap, count, sizeof(time_t), time_compare);
-
 	/* output the info map */
-	i = 0;
 	log_tag("info_count:%u\n", count);
-	while (i < count) {
-		unsigned j = i + 1;
-		while (j < count && timemap[i] == timemap[j])
-			++j;
-		if ((timemap[i] & TIME_NEW) == 0) {
-			log_tag("info_time:%" PRIu64 ":%u:scrubbed\n", (uint64_t)timemap[i], j - i);
+	for (i = 0; i < status->run_max; ++i) {
+		struct snapraid_status_run* run = &status->run[i];
+		if ((run->time & TIME_NEW) == 0) {
+			log_tag("info_time:%" PRIu64 ":%u:scrubbed\n", (uint64_t)run->time, run->count);
 		} else {
-			log_tag("info_time:%" PRIu64 ":%u:new\n", (uint64_t)(timemap[i] & ~TIME_NEW), j - i);
+			log_tag("info_time:%" PRIu64 ":%u:new\n", (uint64_t)(run->time & ~TIME_NEW), run->count);
 		}
-		i = j;
 	}
 
-	oldest = timemap[0];
-	median = timemap[count / 2];
-	newest = timemap[count - 1];
+	/* get the time of the median block */
+	oldest = status->run[0].time;
+	newest = status->run[status->run_max - 1].time;
+	median = newest;
+	runused = 0;
+	for (i = 0; i < status->run_max; ++i) {
+		runused += status->run[i].count;
+		if (runused > count / 2) {
+			median = status->run[i].time;
+			break;
+		}
+	}
 	dayoldest = day_ago(oldest, now);
 	daymedian = day_ago(median, now);
 	daynewest = day_ago(newest, now);
 
 	/* compute graph limits */
-	barpos = 0;
+	runpos = 0;
 	barmax = 0;
 	for (i = 0; i < GRAPH_COLUMN; ++i) {
 		time_t limit;
@@ -402,12 +748,12 @@ int state_status(struct snapraid_state* state)
 
 		step_scrubbed = 0;
 		step_new = 0;
-		while (barpos < count && timemap[barpos] <= limit) {
-			if ((timemap[barpos] & TIME_NEW) != 0)
-				++step_new;
+		while (runpos < status->run_max && status->run[runpos].time <= limit) {
+			if ((status->run[runpos].time & TIME_NEW) != 0)
+				step_new += status->run[runpos].count;
 			else
-				++step_scrubbed;
-			++barpos;
+				step_scrubbed += status->run[runpos].count;
+			++runpos;
 		}
 
 		if (step_new + step_scrubbed > barmax)
@@ -489,7 +835,7 @@ int state_status(struct snapraid_state* state)
 	if (rehash) {
 		printf("You have a rehash in progress at %u%%.\n", (count - rehash) * 100 / count);
 	} else {
-		if (state->besthash != state->hash) {
+		if (state->besthash != status->hash) {
 			printf("No rehash is in progress, but for optimal performance one is recommended.\n");
 		} else {
 			printf("No rehash is in progress or needed.\n");
@@ -501,21 +847,13 @@ int state_status(struct snapraid_state* state)
 
 		printf("DANGER! In the array there are %u errors!\n\n", bad);
 
-		printf("They are from block %u to %u, specifically at blocks:", bad_first, bad_last);
+		printf("They are from block %u to %u, specifically at blocks:", status->bad_first, status->bad_last);
 
 		/* print some of the errors */
 		bad_print = 0;
-		for (i = 0; i < blockmax; ++i) {
-			snapraid_info info = info_get(&state->infoarr, i);
-
-			/* skip unused blocks */
-			if (info == 0)
-				continue;
-
-			if (info_get_bad(info)) {
-				printf(" %u", i);
-				++bad_print;
-			}
+		for (i = 0; i < status->bad_max; ++i) {
+			printf(" %u", status->bad_pos[i]);
+			++bad_print;
 
 			if (bad_print > 100) {
 				printf(" and %u more...", bad - bad_print);
@@ -530,10 +868,359 @@ int state_status(struct snapraid_state* state)
 	} else {
 		printf("No error detected.\n");
 	}
+}
 
-	/* free the temp vector */
-	free(timemap);
+int state_status(struct snapraid_state* state)
+{
+	struct snapraid_status status;
+
+	memset(&status, 0, sizeof(status));
+
+	state_index(state);
+
+	status_compute(state, &status);
+
+	status_print(state, &status, state->opt.gui);
+
+	status_done(&status);
 
 	return 0;
 }
 
+/****************************************************************************/
+/* summary */
+
+/**
+ * Get the path of the summary, and the stat of the content file it refers to.
+ */
+static int summary_content(struct snapraid_state* state, char* path, size_t size, struct stat* st)
+{
+	struct snapraid_content* content;
+
+	/* the summary is stored next to the first content file */
+	content = tommy_list_head(&state->contentlist)->data;
+	pathprint(path, size, "%s.status", content->content);
+
+	return stat(content->content, st);
+}
+
+void state_status_summary_write(struct snapraid_state* state)
+{
+	struct snapraid_status status;
+	struct stat st;
+	STREAM* f;
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	unsigned l;
+	unsigned d;
+	unsigned k;
+
+	if (summary_content(state, path, sizeof(path), &st) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error accessing the content file for the status summary. %s.\n", strerror(errno));
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	pathprint(tmp, sizeof(tmp), "%s.tmp", path);
+
+	/* ensure to delete a previous stale file */
+	if (remove(tmp) != 0 && errno != ENOENT) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error removing the stale status summary '%s'. %s.\n", tmp, strerror(errno));
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	memset(&status, 0, sizeof(status));
+
+	status_compute(state, &status);
+
+	f = sopen_write(tmp);
+	if (f == 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error creating the status summary '%s'. %s.\n", tmp, strerror(errno));
+		status_done(&status);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	swrite("SNAPSUM1\n\3\0\0", 12, f);
+
+	/* the content file the summary refers to */
+	sputb64(st.st_size, f);
+	sputb64(st.st_mtime, f);
+	sputb32(STAT_NSEC(&st), f);
+	sputb64(st.st_ino, f);
+
+	sputb32(status.block_size, f);
+	sputb32(status.blockmax, f);
+	sputb32(status.level, f);
+	for (l = 0; l < status.level; ++l) {
+		sputb32(status.parity_total_blocks[l], f);
+		sputb32(status.parity_free_blocks[l], f);
+	}
+	sputb32(status.hash, f);
+	sputb32(status.prevhash, f);
+
+	sputb32(status.disk_max, f);
+	for (d = 0; d < status.disk_max; ++d) {
+		struct snapraid_status_disk* sdisk = &status.disk[d];
+
+		sputbs(sdisk->name, f);
+		sputb32(sdisk->file_count, f);
+		sputb32(sdisk->file_fragmented, f);
+		sputb32(sdisk->extra_fragment, f);
+		sputb32(sdisk->file_zerosubsecond, f);
+		sputb32(sdisk->zero_max, f);
+		for (k = 0; k < sdisk->zero_max; ++k)
+			sputbs(sdisk->zero_sub[k], f);
+		sputb32(sdisk->block_count, f);
+		sputb64(sdisk->file_size, f);
+		sputb32(sdisk->block_latest_used, f);
+		sputb32(sdisk->total_blocks, f);
+		sputb32(sdisk->free_blocks, f);
+		sputb64(sdisk->memory_files, f);
+		sputb64(sdisk->memory_extents, f);
+		sputb64(sdisk->memory_tables, f);
+		for (k = 0; k < MEMORY_PLAN_MAX; ++k)
+			sputb64(sdisk->plan_blocks[k], f);
+	}
+
+	sputb64(status.info_memory, f);
+	sputb32(status.info_element_size, f);
+	sputb32(status.unsynced_blocks, f);
+	sputb32(status.unscrubbed_blocks, f);
+	sputb32(status.rehash, f);
+	sputb32(status.bad, f);
+	sputb32(status.bad_first, f);
+	sputb32(status.bad_last, f);
+	sputb32(status.bad_max, f);
+	for (k = 0; k < status.bad_max; ++k)
+		sputb32(status.bad_pos[k], f);
+	sputb32(status.count, f);
+	sputb32(status.run_max, f);
+	for (k = 0; k < status.run_max; ++k) {
+		sputb64(status.run[k].time, f);
+		sputb32(status.run[k].count, f);
+	}
+
+	sputble32(scrc(f), f);
+
+	status_done(&status);
+
+	if (serror(f) || sflush(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error writing the status summary '%s'. %s.\n", tmp, strerror(errno));
+		sclose(f);
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (sclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error closing the status summary '%s'. %s.\n", tmp, strerror(errno));
+		remove(tmp);
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if (rename(tmp, path) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Error renaming the status summary '%s' to '%s'. %s.\n", tmp, path, strerror(errno));
+		remove(tmp);
+		/* LCOV_EXCL_STOP */
+	}
+}
+
+/**
+ * Read the summary.
+ *
+ * Return 0 on success, or -1 if missing, invalid or stale.
+ */
+static int summary_read(struct snapraid_state* state, struct snapraid_status* status)
+{
+	struct stat st;
+	STREAM* f;
+	char path[PATH_MAX];
+	char journal[PATH_MAX];
+	unsigned char header[12];
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint32_t mtime_nsec;
+	uint64_t inode;
+	uint32_t value;
+	uint32_t crc_computed;
+	uint32_t crc;
+	tommy_node* node_disk;
+	unsigned l;
+	unsigned d;
+	unsigned k;
+
+	if (summary_content(state, path, sizeof(path), &st) != 0)
+		return -1;
+
+	/* the changes in the journal are not in the summary */
+	pathprint(journal, sizeof(journal), "%s.journal", ((struct snapraid_content*)tommy_list_head(&state->contentlist)->data)->content);
+	if (access(journal, F_OK) == 0)
+		return -1;
+
+	f = sopen_read(path);
+	if (f == 0) {
+		if (errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Error opening the status summary '%s'. %s.\n", path, strerror(errno));
+			/* LCOV_EXCL_STOP */
+		}
+		return -1;
+	}
+
+	if (sread(f, header, 12) < 0 || memcmp(header, "SNAPSUM1\n\3\0\0", 12) != 0)
+		goto bail;
+
+	if (sgetb64(f, &size) < 0
+		|| sgetb64(f, &mtime_sec) < 0
+		|| sgetb32(f, &mtime_nsec) < 0
+		|| sgetb64(f, &inode) < 0)
+		goto bail;
+
+	/* if the content file changed, the summary is stale */
+	if (size != (uint64_t)st.st_size
+		|| mtime_sec != (uint64_t)st.st_mtime
+		|| (int)mtime_nsec != STAT_NSEC(&st)
+		|| inode != (uint64_t)st.st_ino)
+		goto stale;
+
+	if (sgetb32(f, &status->block_size) < 0
+		|| sgetb32(f, &status->blockmax) < 0
+		|| sgetb32(f, &status->level) < 0)
+		goto bail;
+
+	/* if the configuration changed, the summary is stale */
+	if (status->block_size != state->block_size || status->level != state->level)
+		goto stale;
+
+	for (l = 0; l < status->level; ++l) {
+		if (sgetb32(f, &status->parity_total_blocks[l]) < 0
+			|| sgetb32(f, &status->parity_free_blocks[l]) < 0)
+			goto bail;
+	}
+
+	if (sgetb32(f, &status->hash) < 0
+		|| sgetb32(f, &status->prevhash) < 0
+		|| sgetb32(f, &value) < 0)
+		goto bail;
+
+	if (value != tommy_list_count(&state->disklist))
+		goto stale;
+
+	status->disk_max = value;
+	status->disk = calloc_nofail(status->disk_max, sizeof(struct snapraid_status_disk));
+	for (node_disk = state->disklist, d = 0; node_disk != 0; node_disk = node_disk->next, ++d) {
+		struct snapraid_disk* disk = node_disk->data;
+		struct snapraid_status_disk* sdisk = &status->disk[d];
+
+		if (sgetbs(f, sdisk->name, sizeof(sdisk->name)) < 0)
+			goto bail;
+
+		/* the disks must be the same, and in the same order */
+		if (strcmp(sdisk->name, disk->name) != 0)
+			goto stale;
+
+		if (sgetb32(f, &sdisk->file_count) < 0
+			|| sgetb32(f, &sdisk->file_fragmented) < 0
+			|| sgetb32(f, &sdisk->extra_fragment) < 0
+			|| sgetb32(f, &sdisk->file_zerosubsecond) < 0
+			|| sgetb32(f, &value) < 0
+			|| value > STATUS_ZERO_MAX)
+			goto bail;
+
+		for (k = 0; k < value; ++k) {
+			char sub[PATH_MAX];
+			if (sgetbs(f, sub, sizeof(sub)) < 0)
+				goto bail;
+			sdisk->zero_sub[sdisk->zero_max++] = strdup_nofail(sub);
+		}
+
+		if (sgetb32(f, &sdisk->block_count) < 0
+			|| sgetb64(f, &sdisk->file_size) < 0
+			|| sgetb32(f, &sdisk->block_latest_used) < 0
+			|| sgetb32(f, &sdisk->total_blocks) < 0
+			|| sgetb32(f, &sdisk->free_blocks) < 0
+			|| sgetb64(f, &sdisk->memory_files) < 0
+			|| sgetb64(f, &sdisk->memory_extents) < 0
+			|| sgetb64(f, &sdisk->memory_tables) < 0)
+			goto bail;
+
+		for (k = 0; k < MEMORY_PLAN_MAX; ++k) {
+			if (sgetb64(f, &sdisk->plan_blocks[k]) < 0)
+				goto bail;
+		}
+	}
+
+	if (sgetb64(f, &status->info_memory) < 0
+		|| sgetb32(f, &status->info_element_size) < 0
+		|| sgetb32(f, &status->unsynced_blocks) < 0
+		|| sgetb32(f, &status->unscrubbed_blocks) < 0
+		|| sgetb32(f, &status->rehash) < 0
+		|| sgetb32(f, &status->bad) < 0
+		|| sgetb32(f, &status->bad_first) < 0
+		|| sgetb32(f, &status->bad_last) < 0
+		|| sgetb32(f, &status->bad_max) < 0
+		|| status->bad_max > STATUS_BAD_MAX)
+		goto bail;
+
+	for (k = 0; k < status->bad_max; ++k) {
+		if (sgetb32(f, &status->bad_pos[k]) < 0)
+			goto bail;
+	}
+
+	if (sgetb32(f, &status->count) < 0
+		|| sgetb32(f, &status->run_max) < 0
+		|| status->run_max > status->count)
+		goto bail;
+
+	status->run = malloc_nofail((status->run_max + 1) * sizeof(struct snapraid_status_run));
+	for (k = 0; k < status->run_max; ++k) {
+		uint64_t time;
+		if (sgetb64(f, &time) < 0
+			|| sgetb32(f, &status->run[k].count) < 0)
+			goto bail;
+		status->run[k].time = time;
+	}
+
+	crc_computed = scrc(f);
+
+	if (sgetble32(f, &crc) < 0 || crc != crc_computed)
+		goto bail;
+
+	sclose(f);
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	log_fatal("WARNING! Ignoring the invalid status summary '%s'.\n", path);
+	/* LCOV_EXCL_STOP */
+stale:
+	sclose(f);
+	return -1;
+}
+
+int state_status_summary(struct snapraid_state* state)
+{
+	struct snapraid_status status;
+
+	memset(&status, 0, sizeof(status));
+
+	if (summary_read(state, &status) != 0) {
+		status_done(&status);
+		return -1;
+	}
+
+	status_print(state, &status, 0);
+
+	status_done(&status);
+
+	return 0;
+}
@@ -26,6 +26,386 @@
 
 unsigned STREAM_SIZE = 64 * 1024;
 
+#if HAVE_PTHREAD
+/**
+ * Number of buffers used by the asynchronous writers and reader.
+ *
+ * One buffer is filled by the stream, while the others
+ * are written to all the files.
+ * In reading, one buffer is decoded by the stream, while the
+ * others are read ahead from the file.
+ */
+#define STREAM_ASYNC_MAX 4
+
+struct stream_writer {
+	struct stream_async* async;
+	unsigned index; /**< Index of the handle to write. */
+	pthread_t thread;
+};
+
+struct stream_async {
+	STREAM* s;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_write; /**< Signaled when a new buffer is ready to write, or free to read. */
+	pthread_cond_t cond_done; /**< Signaled when a buffer is written in all the files, or read. */
+	unsigned char* buffer[STREAM_ASYNC_MAX];
+	ssize_t size[STREAM_ASYNC_MAX]; /**< Size of the data to write in each buffer, or of the data read. 0 on EOF, -1 on error. */
+	unsigned pending[STREAM_ASYNC_MAX]; /**< Number of writers still to write each buffer. */
+	uint32_t crc[STREAM_ASYNC_MAX]; /**< CRC of the file up to the end of each buffer read. */
+	unsigned head; /**< Number of buffers queued, or read, until now. */
+	unsigned taken; /**< Number of buffers read and taken by the stream. */
+	uint32_t crc_start; /**< CRC of the file at the start of the read ahead. */
+	int quit; /**< Set to stop the writers or the reader. */
+	int error; /**< If a write error happened. */
+	unsigned error_index; /**< Index of the handle with the error. */
+	int error_errno; /**< Error code of the write or read. */
+	struct stream_writer* writer; /**< Writers, or 0 if reading. */
+	pthread_t reader;
+};
+
+static void* stream_writer_thread(void* arg)
+{
+	struct stream_writer* writer = arg;
+	struct stream_async* async = writer->async;
+	int f = async->s->handle[writer->index].f;
+	unsigned next = 0;
+
+	thread_mutex_lock(&async->mutex);
+
+	while (1) {
+		unsigned slot;
+		unsigned char* buffer;
+		ssize_t size;
+		ssize_t ret;
+		int skip;
+
+		while (!async->quit && next == async->head)
+			thread_cond_wait(&async->cond_write, &async->mutex);
+
+		/* stop only when all the buffers are written */
+		if (next == async->head)
+			break;
+
+		slot = next % STREAM_ASYNC_MAX;
+		buffer = async->buffer[slot];
+		size = async->size[slot];
+
+		/* after an error don't write anymore */
+		skip = async->error;
+
+		thread_mutex_unlock(&async->mutex);
+
+		ret = size;
+		if (!skip)
+			ret = write(f, buffer, size);
+
+		thread_mutex_lock(&async->mutex);
+
+		if (ret != size && !async->error) {
+			/* LCOV_EXCL_START */
+			async->error = 1;
+			async->error_index = writer->index;
+			async->error_errno = errno;
+			/* LCOV_EXCL_STOP */
+		}
+
+		--async->pending[slot];
+		if (async->pending[slot] == 0)
+			thread_cond_broadcast(&async->cond_done);
+
+		++next;
+	}
+
+	thread_mutex_unlock(&async->mutex);
+
+	return 0;
+}
+
+static void stream_async_start(STREAM* s)
+{
+	struct stream_async* async;
+	unsigned i;
+
+	async = malloc_nofail(sizeof(struct stream_async));
+	async->s = s;
+	thread_mutex_init(&async->mutex, 0);
+	thread_cond_init(&async->cond_write, 0);
+	thread_cond_init(&async->cond_done, 0);
+
+	/* the first buffer is the one already in use */
+	async->buffer[0] = s->buffer;
+	for (i = 1; i < STREAM_ASYNC_MAX; ++i)
+		async->buffer[i] = malloc_nofail_test(STREAM_SIZE);
+	for (i = 0; i < STREAM_ASYNC_MAX; ++i) {
+		async->size[i] = 0;
+		async->pending[i] = 0;
+	}
+	async->head = 0;
+	async->taken = 0;
+	async->crc_start = 0;
+	async->quit = 0;
+	async->error = 0;
+	async->error_index = 0;
+	async->error_errno = 0;
+
+	async->writer = malloc_nofail(s->handle_size * sizeof(struct stream_writer));
+	for (i = 0; i < s->handle_size; ++i) {
+		async->writer[i].async = async;
+		async->writer[i].index = i;
+		thread_create(&async->writer[i].thread, 0, stream_writer_thread, &async->writer[i]);
+	}
+
+	s->async = async;
+}
+
+/**
+ * Report the write error of the asynchronous writers.
+ * Call it with the mutex locked.
+ */
+static int stream_async_error(STREAM* s)
+{
+	struct stream_async* async = s->async;
+
+	if (!async->error)
+		return 0;
+
+	/* LCOV_EXCL_START */
+	s->state = STREAM_STATE_ERROR;
+	s->state_index = async->error_index;
+	errno = async->error_errno;
+	return -1;
+	/* LCOV_EXCL_STOP */
+}
+
+/**
+ * Queue the buffer for writing, and get the next free one.
+ */
+static int stream_async_queue(STREAM* s, ssize_t size)
+{
+	struct stream_async* async = s->async;
+	unsigned slot;
+	int ret;
+
+	thread_mutex_lock(&async->mutex);
+
+	slot = async->head % STREAM_ASYNC_MAX;
+	async->size[slot] = size;
+	async->pending[slot] = s->handle_size;
+	++async->head;
+
+	thread_cond_broadcast(&async->cond_write);
+
+	/* wait until the next buffer is written by all the writers */
+	slot = async->head % STREAM_ASYNC_MAX;
+	while (async->pending[slot] != 0)
+		thread_cond_wait(&async->cond_done, &async->mutex);
+
+	ret = stream_async_error(s);
+
+	thread_mutex_unlock(&async->mutex);
+
+	s->buffer = async->buffer[slot];
+
+	return ret;
+}
+
+/**
+ * Wait until all the queued buffers are written.
+ */
+static int stream_async_drain(STREAM* s)
+{
+	struct stream_async* async = s->async;
+	unsigned i;
+	int ret;
+
+	thread_mutex_lock(&async->mutex);
+
+	for (i = 0; i < STREAM_ASYNC_MAX; ++i) {
+		while (async->pending[i] != 0)
+			thread_cond_wait(&async->cond_done, &async->mutex);
+	}
+
+	ret = stream_async_error(s);
+
+	thread_mutex_unlock(&async->mutex);
+
+	return ret;
+}
+
+static void* stream_reader_thread(void* arg)
+{
+	struct stream_async* async = arg;
+	int f = async->s->handle[0].f;
+	uint32_t crc = async->crc_start;
+
+	thread_mutex_lock(&async->mutex);
+
+	while (1) {
+		unsigned slot;
+		unsigned char* buffer;
+		unsigned released;
+		ssize_t ret;
+
+		/* the buffer in use by the stream is the last taken */
+		released = async->taken > 0 ? async->taken - 1 : 0;
+
+		while (!async->quit && async->head - released >= STREAM_ASYNC_MAX) {
+			thread_cond_wait(&async->cond_write, &async->mutex);
+			released = async->taken > 0 ? async->taken - 1 : 0;
+		}
+
+		if (async->quit)
+			break;
+
+		slot = async->head % STREAM_ASYNC_MAX;
+		buffer = async->buffer[slot];
+
+		thread_mutex_unlock(&async->mutex);
+
+		ret = read(f, buffer, STREAM_SIZE);
+
+		/* compute the crc while the stream decodes the previous buffers */
+		if (ret > 0)
+			crc = crc32c(crc, buffer, ret);
+
+		thread_mutex_lock(&async->mutex);
+
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			async->error_errno = errno;
+			/* LCOV_EXCL_STOP */
+		}
+
+		async->size[slot] = ret;
+		async->crc[slot] = crc;
+		++async->head;
+
+		thread_cond_broadcast(&async->cond_done);
+
+		/* stop at the end of the file, or at the first error */
+		if (ret <= 0)
+			break;
+	}
+
+	thread_mutex_unlock(&async->mutex);
+
+	return 0;
+}
+
+/**
+ * Start to read ahead the file from the current position.
+ */
+static void stream_async_start_read(STREAM* s)
+{
+	struct stream_async* async;
+	unsigned i;
+
+	async = malloc_nofail(sizeof(struct stream_async));
+	async->s = s;
+	thread_mutex_init(&async->mutex, 0);
+	thread_cond_init(&async->cond_write, 0);
+	thread_cond_init(&async->cond_done, 0);
+
+	/* the buffer in use is already decoded, and it can be reused */
+	async->buffer[0] = s->buffer;
+	for (i = 1; i < STREAM_ASYNC_MAX; ++i)
+		async->buffer[i] = malloc_nofail_test(STREAM_SIZE);
+	for (i = 0; i < STREAM_ASYNC_MAX; ++i) {
+		async->size[i] = 0;
+		async->pending[i] = 0;
+		async->crc[i] = 0;
+	}
+	async->head = 0;
+	async->taken = 0;
+	async->crc_start = s->crc;
+	async->quit = 0;
+	async->error = 0;
+	async->error_index = 0;
+	async->error_errno = 0;
+	async->writer = 0;
+
+	s->async = async;
+
+	thread_create(&async->reader, 0, stream_reader_thread, async);
+}
+
+/**
+ * Take the next buffer read ahead.
+ * \return The size of the data read, 0 on EOF, or -1 on error.
+ */
+static ssize_t stream_async_take(STREAM* s)
+{
+	struct stream_async* async = s->async;
+	unsigned slot;
+	ssize_t ret;
+
+	thread_mutex_lock(&async->mutex);
+
+	while (async->head == async->taken)
+		thread_cond_wait(&async->cond_done, &async->mutex);
+
+	slot = async->taken % STREAM_ASYNC_MAX;
+	ret = async->size[slot];
+	if (ret < 0) {
+		/* LCOV_EXCL_START */
+		errno = async->error_errno;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* keep the EOF or error buffer as the last one */
+	if (ret > 0) {
+		++async->taken;
+
+		/* the previous buffer is now free for the reader */
+		thread_cond_broadcast(&async->cond_write);
+
+		/* update the crc, already computed by the reader */
+		s->crc_uncached = s->crc;
+		s->crc = async->crc[slot];
+		s->buffer = async->buffer[slot];
+	}
+
+	thread_mutex_unlock(&async->mutex);
+
+	return ret;
+}
+
+static void stream_async_stop(STREAM* s)
+{
+	struct stream_async* async = s->async;
+	unsigned i;
+
+	thread_mutex_lock(&async->mutex);
+	async->quit = 1;
+	thread_cond_broadcast(&async->cond_write);
+	thread_mutex_unlock(&async->mutex);
+
+	if (async->writer) {
+		for (i = 0; i < s->handle_size; ++i) {
+			void* retval;
+			thread_join(async->writer[i].thread, &retval);
+		}
+	} else {
+		void* retval;
+		thread_join(async->reader, &retval);
+	}
+
+	/* the buffer in use is freed with the stream */
+	for (i = 0; i < STREAM_ASYNC_MAX; ++i) {
+		if (async->buffer[i] != s->buffer)
+			free(async->buffer[i]);
+	}
+
+	thread_cond_destroy(&async->cond_done);
+	thread_cond_destroy(&async->cond_write);
+	thread_mutex_destroy(&async->mutex);
+	free(async->writer);
+	free(async);
+
+	s->async = 0;
+}
+#endif
+
 STREAM* sopen_read(const char* file)
 {
 #if HAVE_POSIX_FADVISE
@@ -73,6 +453,7 @@ STREAM* sopen_read(const char* file)
 	s->crc = 0;
 	s->crc_uncached = 0;
 	s->crc_stream = CRC_IV;
+	s->async = 0;
 
 	return s;
 }
@@ -99,6 +480,7 @@ STREAM* sopen_multi_write(unsigned count)
 	s->crc = 0;
 	s->crc_uncached = 0;
 	s->crc_stream = CRC_IV;
+	s->async = 0;
 
 	return s;
 }
@@ -141,6 +523,24 @@ int sopen_multi_file(STREAM* s, unsigned i, const char* file)
 	return 0;
 }
 
+int sopen_multi_append(STREAM* s, unsigned i, const char* file)
+{
+	int f;
+
+	pathcpy(s->handle[i].path, sizeof(s->handle[i].path), file);
+
+	f = open(file, O_WRONLY | O_APPEND | O_BINARY);
+	if (f == -1) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	s->handle[i].f = f;
+
+	return 0;
+}
+
 STREAM* sopen_write(const char* file)
 {
 	STREAM* s = sopen_multi_write(1);
@@ -166,6 +566,12 @@ int sclose(STREAM* s)
 		}
 	}
 
+#if HAVE_PTHREAD
+	/* stop the writers before closing the files */
+	if (s->async)
+		stream_async_stop(s);
+#endif
+
 	for (i = 0; i < s->handle_size; ++i) {
 		if (close(s->handle[i].f) != 0) {
 			/* LCOV_EXCL_START */
@@ -212,6 +618,36 @@ static int sfill(STREAM* s)
 		/* LCOV_EXCL_STOP */
 	}
 
+#if HAVE_PTHREAD
+	/* if the file doesn't fit in a single buffer, start to read ahead */
+	if (!s->async && s->offset != 0)
+		stream_async_start_read(s);
+
+	if (s->async) {
+		ret = stream_async_take(s);
+
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			s->state = STREAM_STATE_ERROR;
+			return EOF;
+			/* LCOV_EXCL_STOP */
+		}
+		if (ret == 0) {
+			s->state = STREAM_STATE_EOF;
+			return EOF;
+		}
+
+		/* update the offset */
+		s->offset_uncached = s->offset;
+		s->offset += ret;
+
+		s->pos = s->buffer;
+		s->end = s->buffer + ret;
+
+		return 0;
+	}
+#endif
+
 	ret = read(s->handle[0].f, s->buffer, STREAM_SIZE);
 
 	if (ret < 0) {
@@ -278,6 +714,25 @@ int sdeplete(STREAM* s, unsigned char* last)
 }
 
 int sflush(STREAM* s)
+{
+	if (sflush_buffer(s) != 0) {
+		/* LCOV_EXCL_START */
+		return EOF;
+		/* LCOV_EXCL_STOP */
+	}
+
+#if HAVE_PTHREAD
+	if (s->async && stream_async_drain(s) != 0) {
+		/* LCOV_EXCL_START */
+		return EOF;
+		/* LCOV_EXCL_STOP */
+	}
+#endif
+
+	return 0;
+}
+
+int sflush_buffer(STREAM* s)
 {
 	ssize_t ret;
 	ssize_t size;
@@ -293,6 +748,40 @@ int sflush(STREAM* s)
 	if (!size)
 		return 0;
 
+#if HAVE_PTHREAD
+	/* with multiple files, write all of them at the same time */
+	if (!s->async && s->handle_size > 1)
+		stream_async_start(s);
+
+	if (s->async) {
+		/*
+		 * Update the crc *before* queuing the data.
+		 *
+		 * The writers may still use the buffer after the return.
+		 * Memory errors on the buffer during the write are anyway
+		 * detected when verifying the files written.
+		 */
+		s->crc = crc32c(s->crc, s->buffer, size);
+		s->crc_uncached = s->crc;
+
+		/* update the offset */
+		s->offset += size;
+		s->offset_uncached = s->offset;
+
+		if (stream_async_queue(s, size) != 0) {
+			/* LCOV_EXCL_START */
+			return EOF;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* continue in the next buffer */
+		s->pos = s->buffer;
+		s->end = s->buffer + STREAM_SIZE;
+
+		return 0;
+	}
+#endif
+
 	for (i = 0; i < s->handle_size; ++i) {
 		ret = write(s->handle[i].f, s->buffer, size);
 
@@ -324,6 +813,38 @@ int sflush(STREAM* s)
 	return 0;
 }
 
+int sseek(STREAM* s, int64_t offset)
+{
+	if (s->state != STREAM_STATE_READ && s->state != STREAM_STATE_EOF) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+#if HAVE_PTHREAD
+	/* the read ahead doesn't apply anymore */
+	if (s->async)
+		stream_async_stop(s);
+#endif
+
+	if (lseek(s->handle[0].f, offset, SEEK_SET) != offset) {
+		/* LCOV_EXCL_START */
+		s->state = STREAM_STATE_ERROR;
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	s->pos = s->buffer;
+	s->end = s->buffer;
+	s->state = STREAM_STATE_READ;
+	s->offset = offset;
+	s->offset_uncached = offset;
+	s->crc = 0;
+	s->crc_uncached = 0;
+
+	return 0;
+}
+
 int64_t stell(STREAM* s)
 {
 	return s->offset_uncached + (s->pos - s->buffer);
@@ -339,6 +860,13 @@ uint32_t scrc_stream(STREAM*s)
 	return s->crc_stream ^ CRC_IV;
 }
 
+void scrc_set(STREAM* s, uint32_t crc)
+{
+	s->crc = crc;
+	s->crc_uncached = crc;
+	s->crc_stream = crc ^ CRC_IV;
+}
+
 int sgetc_uncached(STREAM* s)
 {
 	/* if at the end of the buffer, fill it */
@@ -742,6 +1270,15 @@ int ssync(STREAM* s)
 {
 	unsigned i;
 
+#if HAVE_PTHREAD
+	/* ensure that all the data is written */
+	if (s->async && stream_async_drain(s) != 0) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+#endif
+
 	for (i = 0; i < s->handle_size; ++i) {
 		if (fsync(s->handle[i].f) != 0) {
 			/* LCOV_EXCL_START */
@@ -40,6 +40,8 @@ struct stream_handle {
 	char path[PATH_MAX]; /**< Path of the file. */
 };
 
+struct stream_async;
+
 struct stream {
 	unsigned char* buffer; /**< Buffer of the stream. */
 	unsigned char* pos; /**< Current position in the buffer. */
@@ -90,6 +92,16 @@ struct stream {
 	 * In writing, it's all the data wrote calling sput() functions.
 	 */
 	uint32_t crc_stream;
+
+	/**
+	 * Asynchronous writers of a multi file stream, or reader, or 0 if not used.
+	 *
+	 * The same buffers are written to all the files at the same time,
+	 * while the stream continues to fill the next one.
+	 * In reading, the next buffers are read ahead, and their CRC computed,
+	 * while the stream decodes the current one.
+	 */
+	struct stream_async* async;
 };
 
 /**
@@ -117,6 +129,12 @@ STREAM* sopen_multi_write(unsigned count);
  */
 int sopen_multi_file(STREAM* s, unsigned i, const char* file);
 
+/**
+ * Specify the file to open in append mode.
+ * Use scrc_set() to continue the CRC of the data already present.
+ */
+int sopen_multi_append(STREAM* s, unsigned i, const char* file);
+
 /**
  * Close a stream. Like fclose().
  */
@@ -137,10 +155,27 @@ int sdeplete(STREAM* s, unsigned char* last);
 
 /**
  * Flush the write stream buffer.
+ * It waits until all the data is written in all the files.
  * \return 0 on success, or EOF on error.
  */
 int sflush(STREAM* s);
 
+/**
+ * Write the stream buffer, and get a new one to fill.
+ * With multiple files the write may be still in progress at the return.
+ * \internal Used by sputc().
+ * \note Don't call this directly, but use sputc() or sflush().
+ * \return 0 on success, or EOF on error.
+ */
+int sflush_buffer(STREAM* s);
+
+/**
+ * Move the read stream at the specified position.
+ * After it, the CRC of the stream doesn't refer anymore to the whole file.
+ * \return 0 on success, or -1 on error.
+ */
+int sseek(STREAM* s, int64_t offset);
+
 /**
  * Get the file pointer.
  */
@@ -156,6 +191,12 @@ uint32_t scrc(STREAM* s);
  */
 uint32_t scrc_stream(STREAM* s);
 
+/**
+ * Set the CRC of the processed data.
+ * It must be called before processing any data.
+ */
+void scrc_set(STREAM* s, uint32_t crc);
+
 /**
  * Check if the buffer has enough data loaded.
  */
@@ -348,7 +389,7 @@ int sgetbs(STREAM* f, char* str, int size);
 static inline int sputc(int c, STREAM* s)
 {
 	if (s->pos == s->end) {
-		if (sflush(s) != 0)
+		if (sflush_buffer(s) != 0)
 			return -1;
 	}
 
@@ -28,6 +28,7 @@
 #if HAVE_PTHREAD
 static pthread_mutex_t msg_lock;
 static pthread_mutex_t memory_lock;
+static pthread_mutex_t trace_lock;
 #endif
 
 void lock_msg(void)
@@ -64,6 +65,7 @@ void lock_init(void)
 	/* initialize the locks as first operation as log_fatal depends on them */
 	thread_mutex_init(&msg_lock, 0);
 	thread_mutex_init(&memory_lock, 0);
+	thread_mutex_init(&trace_lock, 0);
 #endif
 }
 
@@ -72,6 +74,7 @@ void lock_done(void)
 #if HAVE_PTHREAD
 	thread_mutex_destroy(&msg_lock);
 	thread_mutex_destroy(&memory_lock);
+	thread_mutex_destroy(&trace_lock);
 #endif
 }
 
@@ -631,6 +634,450 @@ unsigned strsplit(char** split_map, unsigned split_max, char* str, const char* d
 	return mac;
 }
 
+/****************************************************************************/
+/* output */
+
+void output_init(struct snapraid_output* out, int format, size_t alloc)
+{
+	out->format = format;
+	out->data = malloc_nofail(alloc);
+	out->size = 0;
+	out->alloc = alloc;
+	out->field = 0;
+}
+
+void output_done(struct snapraid_output* out)
+{
+	free(out->data);
+}
+
+/**
+ * Ensure to have space for the specified number of chars.
+ */
+static char* output_reserve(struct snapraid_output* out, size_t count)
+{
+	if (out->size + count > out->alloc) {
+		size_t alloc = out->alloc * 2;
+		char* data;
+
+		if (alloc < out->size + count)
+			alloc = out->size + count;
+
+		data = malloc_nofail(alloc);
+		memcpy(data, out->data, out->size);
+		free(out->data);
+
+		out->data = data;
+		out->alloc = alloc;
+	}
+
+	return out->data + out->size;
+}
+
+static void output_str(struct snapraid_output* out, const char* str)
+{
+	size_t len = strlen(str);
+
+	memcpy(output_reserve(out, len), str, len);
+	out->size += len;
+}
+
+/**
+ * Output a string escaped as required by the format.
+ *
+ * In JSON it's a quoted string with the control chars, '"' and '\' escaped.
+ * In TSV the '\t', '\n', '\r' and '\' chars are escaped as "\t", "\n", "\r" and "\\".
+ */
+static void output_esc(struct snapraid_output* out, const char* str)
+{
+	static const char hex[] = "0123456789abcdef";
+	/* the worst case is a control char escaped in JSON as \u00XX */
+	char* p = output_reserve(out, strlen(str) * 6 + 2);
+	char* begin = p;
+
+	if (out->format == OUTPUT_JSON)
+		*p++ = '"';
+
+	while (*str) {
+		unsigned char c = *str++;
+
+		switch (c) {
+		case '\\' :
+			*p++ = '\\';
+			*p++ = '\\';
+			break;
+		case '\t' :
+			*p++ = '\\';
+			*p++ = 't';
+			break;
+		case '\n' :
+			*p++ = '\\';
+			*p++ = 'n';
+			break;
+		case '\r' :
+			*p++ = '\\';
+			*p++ = 'r';
+			break;
+		case '"' :
+			if (out->format == OUTPUT_JSON)
+				*p++ = '\\';
+			*p++ = c;
+			break;
+		default :
+			if (c < 0x20 && out->format == OUTPUT_JSON) {
+				*p++ = '\\';
+				*p++ = 'u';
+				*p++ = '0';
+				*p++ = '0';
+				*p++ = hex[c >> 4];
+				*p++ = hex[c & 0xF];
+			} else {
+				*p++ = c;
+			}
+		}
+	}
+
+	if (out->format == OUTPUT_JSON)
+		*p++ = '"';
+
+	out->size += p - begin;
+}
+
+/**
+ * Output the separator and the key of a field.
+ */
+static void output_key(struct snapraid_output* out, const char* key)
+{
+	if (out->format == OUTPUT_JSON) {
+		if (out->field != 0)
+			output_str(out, ",");
+		output_str(out, "\"");
+		output_str(out, key);
+		output_str(out, "\":");
+	} else {
+		if (out->field != 0)
+			output_str(out, "\t");
+	}
+
+	++out->field;
+}
+
+void output_begin(struct snapraid_output* out)
+{
+	out->field = 0;
+
+	if (out->format == OUTPUT_JSON)
+		output_str(out, "{");
+}
+
+void output_field(struct snapraid_output* out, const char* key, const char* value)
+{
+	output_key(out, key);
+	output_esc(out, value);
+}
+
+void output_field_u64(struct snapraid_output* out, const char* key, uint64_t value)
+{
+	char buffer[32];
+
+	output_key(out, key);
+	snprintf(buffer, sizeof(buffer), "%" PRIu64, value);
+	output_str(out, buffer);
+}
+
+void output_field_i64(struct snapraid_output* out, const char* key, int64_t value)
+{
+	char buffer[32];
+
+	output_key(out, key);
+	snprintf(buffer, sizeof(buffer), "%" PRIi64, value);
+	output_str(out, buffer);
+}
+
+void output_text(struct snapraid_output* out, const char* text)
+{
+	output_str(out, text);
+}
+
+void output_end(struct snapraid_output* out)
+{
+	if (out->format == OUTPUT_JSON)
+		output_str(out, "}\n");
+	else
+		output_str(out, "\n");
+}
+
+int output_write(struct snapraid_output* out, FILE* f)
+{
+	size_t size = out->size;
+
+	out->size = 0;
+
+	if (size != 0 && fwrite(out->data, size, 1, f) != 1)
+		return -1;
+
+	return 0;
+}
+
+/****************************************************************************/
+/* histogram */
+
+void histo_init(struct snapraid_histo* histo)
+{
+	memset(histo, 0, sizeof(struct snapraid_histo));
+}
+
+/**
+ * Get the bucket of the value.
+ */
+static unsigned histo_index(uint64_t value)
+{
+	unsigned shift;
+
+	/* the lowest values have a bucket each */
+	if (value < (1U << HISTO_SUB))
+		return value;
+
+	/* position of the most significant bit, over the sub-bucket bits */
+	shift = 0;
+	if (value >> (32 + HISTO_SUB + 1)) {
+		value >>= 32;
+		shift += 32;
+	}
+	if (value >> (16 + HISTO_SUB + 1)) {
+		value >>= 16;
+		shift += 16;
+	}
+	if (value >> (8 + HISTO_SUB + 1)) {
+		value >>= 8;
+		shift += 8;
+	}
+	while (value >= (2U << HISTO_SUB)) {
+		value >>= 1;
+		++shift;
+	}
+
+	return ((shift + 1) << HISTO_SUB) + (value & ((1U << HISTO_SUB) - 1));
+}
+
+/**
+ * Get the highest value stored in the bucket.
+ */
+static uint64_t histo_upper(unsigned index)
+{
+	unsigned shift;
+	uint64_t base;
+
+	if (index < (1U << HISTO_SUB))
+		return index;
+
+	shift = (index >> HISTO_SUB) - 1;
+	base = (uint64_t)((1U << HISTO_SUB) + (index & ((1U << HISTO_SUB) - 1))) << shift;
+
+	return base + (((uint64_t)1 << shift) - 1);
+}
+
+void histo_add(struct snapraid_histo* histo, uint64_t value)
+{
+	++histo->count;
+	histo->sum += value;
+	if (histo->max < value)
+		histo->max = value;
+	++histo->bucket[histo_index(value)];
+}
+
+void histo_merge(struct snapraid_histo* histo, const struct snapraid_histo* other)
+{
+	unsigned i;
+
+	histo->count += other->count;
+	histo->sum += other->sum;
+	if (histo->max < other->max)
+		histo->max = other->max;
+	for (i = 0; i < HISTO_MAX; ++i)
+		histo->bucket[i] += other->bucket[i];
+}
+
+uint64_t histo_percentile(const struct snapraid_histo* histo, unsigned per_mille)
+{
+	uint64_t target;
+	uint64_t count;
+	uint64_t value;
+	unsigned i;
+
+	if (histo->count == 0)
+		return 0;
+
+	/* number of values to include, at least one */
+	target = (histo->count * per_mille + 999) / 1000;
+	if (target == 0)
+		target = 1;
+
+	count = 0;
+	for (i = 0; i < HISTO_MAX; ++i) {
+		count += histo->bucket[i];
+		if (count >= target)
+			break;
+	}
+
+	value = histo_upper(i);
+	if (value > histo->max)
+		value = histo->max;
+
+	return value;
+}
+
+/****************************************************************************/
+/* trace */
+
+struct trace_entry {
+	const void* thread;
+	const char* thread_name;
+	const char* name;
+	uint64_t begin;
+	uint64_t end;
+	unsigned position;
+};
+
+static struct trace_entry* trace_map; /**< Ring of the events. */
+static unsigned trace_max; /**< Size of the ring. 0 if not recording. */
+static uint64_t trace_count; /**< Number of events recorded, including the ones overwritten. */
+
+void trace_init(unsigned max)
+{
+	trace_map = malloc_nofail(max * sizeof(struct trace_entry));
+	trace_max = max;
+	trace_count = 0;
+}
+
+void trace_done(void)
+{
+	free(trace_map);
+	trace_map = 0;
+	trace_max = 0;
+}
+
+void trace_event(const void* thread, const char* thread_name, const char* name, uint64_t begin, uint64_t end, unsigned position)
+{
+	struct trace_entry* entry;
+
+	if (trace_max == 0)
+		return;
+
+#if HAVE_PTHREAD
+	thread_mutex_lock(&trace_lock);
+#endif
+
+	/* overwrite the oldest event */
+	entry = &trace_map[trace_count % trace_max];
+	++trace_count;
+
+	entry->thread = thread;
+	entry->thread_name = thread_name;
+	entry->name = name;
+	entry->begin = begin;
+	entry->end = end;
+	entry->position = position;
+
+#if HAVE_PTHREAD
+	thread_mutex_unlock(&trace_lock);
+#endif
+}
+
+/**
+ * Write a JSON string.
+ */
+static void trace_str(FILE* f, const char* str)
+{
+	fputc('"', f);
+	for (; *str; ++str) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+int trace_write(const char* path)
+{
+	const void** thread_map;
+	unsigned thread_mac;
+	unsigned count;
+	unsigned first;
+	uint64_t origin;
+	double freq;
+	unsigned i;
+	FILE* f;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	/* the ring is full after trace_max events */
+	if (trace_count > trace_max) {
+		count = trace_max;
+		first = trace_count % trace_max;
+	} else {
+		count = trace_count;
+		first = 0;
+	}
+
+	/* times are relative to the first event, in microseconds */
+	origin = ~(uint64_t)0;
+	for (i = 0; i < count; ++i) {
+		if (origin > trace_map[i].begin)
+			origin = trace_map[i].begin;
+	}
+	freq = tick_freq() / 1000000.0;
+
+	/* each thread gets the index of its first event */
+	thread_map = malloc_nofail((count + 1) * sizeof(const void*));
+	thread_mac = 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (i = 0; i < count; ++i) {
+		struct trace_entry* entry = &trace_map[(first + i) % trace_max];
+		unsigned tid;
+
+		for (tid = 0; tid < thread_mac; ++tid)
+			if (thread_map[tid] == entry->thread)
+				break;
+
+		/* name the new thread */
+		if (tid == thread_mac) {
+			thread_map[thread_mac++] = entry->thread;
+			fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", tid);
+			trace_str(f, entry->thread_name);
+			fprintf(f, "}},\n");
+		}
+
+		fprintf(f, "{\"name\":");
+		trace_str(f, entry->name);
+		fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"position\":%u}},\n",
+			tid, (entry->begin - origin) / freq, (entry->end - entry->begin) / freq, entry->position);
+	}
+
+	/* a last entry without comma */
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"snapraid\"}}\n");
+	fprintf(f, "]}\n");
+
+	free(thread_map);
+
+	if (ferror(f) != 0) {
+		fclose(f);
+		return -1;
+	}
+
+	if (fclose(f) != 0)
+		return -1;
+
+	return 0;
+}
+
 /****************************************************************************/
 /* path */
 
@@ -250,6 +250,115 @@ char* strpolish(char* s);
  */
 unsigned strsplit(char** split_map, unsigned split_max, char* line, const char* delimiters);
 
+/****************************************************************************/
+/* output */
+
+#define OUTPUT_TEXT 0 /**< Text for the terminal. */
+#define OUTPUT_JSON 1 /**< JSON Lines, with an object for each entry. */
+#define OUTPUT_TSV 2 /**< Tab separated values, with a line for each entry. */
+
+/**
+ * Buffer of machine-readable output, growing as needed.
+ *
+ * Each entry is started with output_begin(), filled with the output_field*()
+ * functions, and terminated with output_end().
+ */
+struct snapraid_output {
+	int format; /**< One of the OUTPUT_* formats. */
+	char* data; /**< Output data. */
+	size_t size; /**< Size of the data. */
+	size_t alloc; /**< Size of the allocated data. */
+	unsigned field; /**< Number of fields in the current entry. */
+};
+
+void output_init(struct snapraid_output* out, int format, size_t alloc);
+void output_done(struct snapraid_output* out);
+void output_begin(struct snapraid_output* out);
+void output_field(struct snapraid_output* out, const char* key, const char* value);
+void output_field_u64(struct snapraid_output* out, const char* key, uint64_t value);
+void output_field_i64(struct snapraid_output* out, const char* key, int64_t value);
+void output_end(struct snapraid_output* out);
+
+/**
+ * Add a text as is, without any formatting.
+ * Used to buffer the lines of the terminal output.
+ */
+void output_text(struct snapraid_output* out, const char* text);
+
+/**
+ * Write the output data to the file, and clear it.
+ * Return 0 on success, -1 on error.
+ */
+int output_write(struct snapraid_output* out, FILE* f);
+
+/****************************************************************************/
+/* histogram */
+
+#define HISTO_SUB 3 /**< Bits of the linear sub-buckets for each power of two. */
+#define HISTO_MAX ((64 - HISTO_SUB + 1) << HISTO_SUB) /**< Number of buckets. */
+
+/**
+ * Histogram of values with logarithmic buckets, in the HDR style.
+ *
+ * Each power of two is split in 2^HISTO_SUB linear sub-buckets, so the
+ * values are stored with a relative precision of 1/2^HISTO_SUB.
+ * Adding a value costs only a few instructions, without allocations.
+ */
+struct snapraid_histo {
+	uint64_t count; /**< Number of values. */
+	uint64_t sum; /**< Sum of the values. */
+	uint64_t max; /**< Maximum value. */
+	uint32_t bucket[HISTO_MAX]; /**< Count of values for each bucket. */
+};
+
+void histo_init(struct snapraid_histo* histo);
+void histo_add(struct snapraid_histo* histo, uint64_t value);
+
+/**
+ * Add all the values of a histogram into another.
+ */
+void histo_merge(struct snapraid_histo* histo, const struct snapraid_histo* other);
+
+/**
+ * Get the value at the specified percentile, expressed in 1/1000.
+ *
+ * The returned value is the upper bound of the bucket, limited to the maximum.
+ * Return 0 if the histogram is empty.
+ */
+uint64_t histo_percentile(const struct snapraid_histo* histo, unsigned per_mille);
+
+/****************************************************************************/
+/* trace */
+
+#define TRACE_MAX 524288 /**< Number of events kept in the trace, using about 24 MB. */
+
+/**
+ * Trace of timed events, saved in the Chrome trace format.
+ *
+ * The events are kept in a ring, that retains only the latest ones
+ * to limit the memory used. Nothing is recorded before trace_init().
+ */
+void trace_init(unsigned max);
+void trace_done(void);
+
+/**
+ * Record an event.
+ *
+ * \param thread Identifier of the thread, with 0 for the main thread.
+ * \param thread_name Name of the thread. It must be valid until trace_write().
+ * \param name Name of the event. It must be a static string.
+ * \param begin Tick at the begin of the event.
+ * \param end Tick at the end of the event.
+ * \param position Block position processed, or 0.
+ */
+void trace_event(const void* thread, const char* thread_name, const char* name, uint64_t begin, uint64_t end, unsigned position);
+
+/**
+ * Write the recorded events in the specified file.
+ * Return 0 on success, -1 on error.
+ */
+int trace_write(const char* path);
+
 /****************************************************************************/
 /* path */
 
@@ -28,7 +28,207 @@
 /****************************************************************************/
 /* hash */
 
-static int state_hash_process(struct snapraid_state* state, block_off_t blockstart, block_off_t blockmax, int* skip_sync)
+/**
+ * Open the file of the block, and read the block for hashing it.
+ *
+ * Return 0 if the block was read, 1 if it has to be skipped, or -1 to stop.
+ * The skipped blocks are counted in ::error, as the file was modified.
+ */
+static int state_hash_read(struct snapraid_state* state, struct snapraid_handle* handle, block_off_t i, struct snapraid_file* file, block_off_t file_pos, void* buffer, int* out_size, unsigned* error, unsigned* io_error)
+{
+	struct snapraid_disk* disk = handle->disk;
+	block_off_t run;
+	int read_size;
+	int ret;
+	char esc_buffer[ESC_MAX];
+
+	/* if the file is different than the current one, close it */
+	if (handle->file != 0 && handle->file != file) {
+		/* keep a pointer at the file we are going to close for error reporting */
+		struct snapraid_file* report = handle->file;
+		ret = handle_close(handle);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			/* This one is really an unexpected error, because we are only reading */
+			/* and closing a descriptor should never fail */
+			if (errno == EIO) {
+				log_tag("error:%u:%s:%s: Close EIO error. %s\n", i, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
+				log_fatal("DANGER! Unexpected input/output close error in a data disk, it isn't possible to sync.\n");
+				log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle->path);
+				log_fatal("Stopping at block %u\n", i);
+				++*io_error;
+				return -1;
+			}
+
+			log_tag("error:%u:%s:%s: Close error. %s\n", i, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
+			log_fatal("WARNING! Unexpected close error in a data disk, it isn't possible to sync.\n");
+			log_fatal("Ensure that file '%s' can be accessed.\n", handle->path);
+			log_fatal("Stopping at block %u\n", i);
+			++*error;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	ret = handle_open(handle, file, state->file_mode, log_error, 0);
+	if (ret == -1) {
+		if (errno == EIO) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Open EIO error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected input/output open error in a data disk, it isn't possible to sync.\n");
+			log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle->path);
+			log_fatal("Stopping at block %u\n", i);
+			++*io_error;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		if (errno == ENOENT) {
+			log_tag("error:%u:%s:%s: Open ENOENT error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+			log_error("Missing file '%s'.\n", handle->path);
+			log_error("WARNING! You cannot modify data disk during a sync.\n");
+			log_error("Rerun the sync command when finished.\n");
+			++*error;
+			/* if the file is missing, it means that it was removed during sync */
+			/* this isn't a serious error, so we skip this block, and continue with others */
+			return 1;
+		}
+
+		if (errno == EACCES) {
+			log_tag("error:%u:%s:%s: Open EACCES error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+			log_error("No access at file '%s'.\n", handle->path);
+			log_error("WARNING! Please fix the access permission in the data disk.\n");
+			log_error("Rerun the sync command when finished.\n");
+			++*error;
+			/* this isn't a serious error, so we skip this block, and continue with others */
+			return 1;
+		}
+
+		/* LCOV_EXCL_START */
+		log_tag("error:%u:%s:%s: Open error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+		log_fatal("WARNING! Unexpected open error in a data disk, it isn't possible to sync.\n");
+		log_fatal("Ensure that file '%s' can be accessed.\n", handle->path);
+		log_fatal("Stopping to allow recovery. Try with 'snapraid check -f /%s'\n", fmt_poll(disk, file->sub, esc_buffer));
+		++*error;
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* check if the file is changed */
+	if (handle->st.st_size != file->size
+		|| handle->st.st_mtime != file->mtime_sec
+		|| STAT_NSEC(&handle->st) != file->mtime_nsec
+		|| handle->st.st_ino != file->inode
+	) {
+		log_tag("error:%u:%s:%s: Unexpected attribute change\n", i, disk->name, esc_tag(file->sub, esc_buffer));
+		if (handle->st.st_size != file->size) {
+			log_error("Unexpected size change at file '%s' from %" PRIu64 " to %" PRIu64 ".\n", handle->path, file->size, (uint64_t)handle->st.st_size);
+		} else if (handle->st.st_mtime != file->mtime_sec
+			|| STAT_NSEC(&handle->st) != file->mtime_nsec) {
+			log_error("Unexpected time change at file '%s' from %" PRIu64 ".%d to %" PRIu64 ".%d.\n", handle->path, file->mtime_sec, file->mtime_nsec, (uint64_t)handle->st.st_mtime, STAT_NSEC(&handle->st));
+		} else {
+			log_error("Unexpected inode change from %" PRIu64 " to %" PRIu64 " at file '%s'.\n", file->inode, (uint64_t)handle->st.st_ino, handle->path);
+		}
+		log_error("WARNING! You cannot modify files during a sync.\n");
+		log_error("Rerun the sync command when finished.\n");
+		++*error;
+		/* if the file is changed, it means that it was modified during sync */
+		/* this isn't a serious error, so we skip this block, and continue with others */
+		return 1;
+	}
+
+	/* read together the next blocks of the file, if they follow in the parity */
+	run = handle->ahead_max > 1 ? fs_par2run_index(disk, i) : 1;
+
+	read_size = handle_read_ahead(handle, file_pos, run, buffer, state->block_size, log_fatal, 0);
+	if (read_size == -1) {
+		/* LCOV_EXCL_START */
+		if (errno == EIO) {
+			log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
+			log_fatal("DANGER! Unexpected input/output read error in a data disk, it isn't possible to sync.\n");
+			log_fatal("Ensure that disk '%s' is sane and that file '%s' can be read.\n", disk->dir, handle->path);
+			log_fatal("Stopping at block %u\n", i);
+			++*io_error;
+			return -1;
+		}
+
+		log_tag("error:%u:%s:%s: Read error at position %u. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
+		log_fatal("WARNING! Unexpected read error in a data disk, it isn't possible to sync.\n");
+		log_fatal("Ensure that file '%s' can be read.\n", handle->path);
+		log_fatal("Stopping to allow recovery. Try with 'snapraid check -f /%s'\n", fmt_poll(disk, file->sub, esc_buffer));
+		++*error;
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	*out_size = read_size;
+
+	return 0;
+}
+
+/**
+ * Compute the hash of the block read at the parity position ::i.
+ */
+static void state_hash_compute(struct snapraid_state* state, block_off_t i, unsigned char* hash, void* buffer, int read_size)
+{
+	snapraid_info info;
+
+	/* get block specific info */
+	info = info_get(&state->infoarr, i);
+
+	/* if we have to use the old hash */
+	if (info_get_rehash(info)) {
+		memhash(state->prevhash, state->prevhashseed, hash, buffer, read_size);
+	} else {
+		memhash(state->hash, state->hashseed, hash, buffer, read_size);
+	}
+}
+
+/**
+ * Close the files left open after hashing.
+ *
+ * Return -1 if it isn't possible to continue with the sync.
+ */
+static int state_hash_close(struct snapraid_handle* handle, block_off_t blockmax, unsigned* error, unsigned* io_error)
+{
+	struct snapraid_disk* disk = handle->disk;
+	char esc_buffer[ESC_MAX];
+	int ret;
+
+	if (handle->file != 0) {
+		/* keep a pointer at the file we are going to close for error reporting */
+		struct snapraid_file* report = handle->file;
+		ret = handle_close(handle);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			/* This one is really an unexpected error, because we are only reading */
+			/* and closing a descriptor should never fail */
+			if (errno == EIO) {
+				log_tag("error:%u:%s:%s: Close EIO error. %s\n", blockmax, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
+				log_fatal("DANGER! Unexpected input/output close error in a data disk, it isn't possible to sync.\n");
+				log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle->path);
+				log_fatal("Stopping at block %u\n", blockmax);
+				++*io_error;
+				return -1;
+			}
+
+			log_tag("error:%u:%s:%s: Close error. %s\n", blockmax, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
+			log_fatal("WARNING! Unexpected close error in a data disk, it isn't possible to sync.\n");
+			log_fatal("Ensure that file '%s' can be accessed.\n", handle->path);
+			log_fatal("Stopping at block %u\n", blockmax);
+			++*error;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Hash the REP blocks, checking them, and the CHG blocks if ::chg is set, storing their hash.
+ */
+static int state_hash_process(struct snapraid_state* state, block_off_t blockstart, block_off_t blockmax, int chg, int* skip_sync)
 {
 	struct snapraid_handle* handle;
 	unsigned diskmax;
@@ -76,7 +276,11 @@ static int state_hash_process(struct snapraid_state* state, block_off_t blocksta
 			block_state = block_state_get(block);
 
 			/* process REP and CHG blocks */
-			if (block_state != BLOCK_STATE_REP && block_state != BLOCK_STATE_CHG)
+			if (block_state != BLOCK_STATE_REP && (!chg || block_state != BLOCK_STATE_CHG))
+				continue;
+
+			/* the copies sharing the data with the original don't need a check */
+			if (block_state == BLOCK_STATE_REP && file_flag_has(fs_par2file_get(disk, i, 0), FILE_IS_CLONE))
 				continue;
 
 			++countmax;
@@ -99,8 +303,6 @@ static int state_hash_process(struct snapraid_state* state, block_off_t blocksta
 			continue;
 
 		for (i = blockstart; i < blockmax; ++i) {
-			snapraid_info info;
-			int rehash;
 			struct snapraid_block* block;
 			int read_size;
 			unsigned char hash[HASH_MAX];
@@ -114,136 +316,27 @@ static int state_hash_process(struct snapraid_state* state, block_off_t blocksta
 			block_state = block_state_get(block);
 
 			/* process REP and CHG blocks */
-			if (block_state != BLOCK_STATE_REP && block_state != BLOCK_STATE_CHG)
+			if (block_state != BLOCK_STATE_REP && (!chg || block_state != BLOCK_STATE_CHG))
 				continue;
 
 			/* get the file of this block */
 			file = fs_par2file_get(disk, i, &file_pos);
 
-			/* get block specific info */
-			info = info_get(&state->infoarr, i);
-
-			/* if we have to use the old hash */
-			rehash = info_get_rehash(info);
+			/* the copies sharing the data with the original don't need a check */
+			if (block_state == BLOCK_STATE_REP && file_flag_has(file, FILE_IS_CLONE))
+				continue;
 
 			/* until now is misc */
 			state_usage_misc(state);
 
-			/* if the file is different than the current one, close it */
-			if (handle[j].file != 0 && handle[j].file != file) {
-				/* keep a pointer at the file we are going to close for error reporting */
-				struct snapraid_file* report = handle[j].file;
-				ret = handle_close(&handle[j]);
-				if (ret == -1) {
-					/* LCOV_EXCL_START */
-					/* This one is really an unexpected error, because we are only reading */
-					/* and closing a descriptor should never fail */
-					if (errno == EIO) {
-						log_tag("error:%u:%s:%s: Close EIO error. %s\n", i, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-						log_fatal("DANGER! Unexpected input/output close error in a data disk, it isn't possible to sync.\n");
-						log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle[j].path);
-						log_fatal("Stopping at block %u\n", i);
-						++io_error;
-						goto bail;
-					}
-
-					log_tag("error:%u:%s:%s: Close error. %s\n", i, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-					log_fatal("WARNING! Unexpected close error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that file '%s' can be accessed.\n", handle[j].path);
-					log_fatal("Stopping at block %u\n", i);
-					++error;
-					goto bail;
-					/* LCOV_EXCL_STOP */
-				}
-			}
-
-			ret = handle_open(&handle[j], file, state->file_mode, log_error, 0);
+			ret = state_hash_read(state, &handle[j], i, file, file_pos, buffer, &read_size, &error, &io_error);
 			if (ret == -1) {
-				if (errno == EIO) {
-					/* LCOV_EXCL_START */
-					log_tag("error:%u:%s:%s: Open EIO error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-					log_fatal("DANGER! Unexpected input/output open error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle[j].path);
-					log_fatal("Stopping at block %u\n", i);
-					++io_error;
-					goto bail;
-					/* LCOV_EXCL_STOP */
-				}
-
-				if (errno == ENOENT) {
-					log_tag("error:%u:%s:%s: Open ENOENT error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-					log_error("Missing file '%s'.\n", handle[j].path);
-					log_error("WARNING! You cannot modify data disk during a sync.\n");
-					log_error("Rerun the sync command when finished.\n");
-					++error;
-					/* if the file is missing, it means that it was removed during sync */
-					/* this isn't a serious error, so we skip this block, and continue with others */
-					continue;
-				}
-
-				if (errno == EACCES) {
-					log_tag("error:%u:%s:%s: Open EACCES error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-					log_error("No access at file '%s'.\n", handle[j].path);
-					log_error("WARNING! Please fix the access permission in the data disk.\n");
-					log_error("Rerun the sync command when finished.\n");
-					++error;
-					/* this isn't a serious error, so we skip this block, and continue with others */
-					continue;
-				}
-
 				/* LCOV_EXCL_START */
-				log_tag("error:%u:%s:%s: Open error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-				log_fatal("WARNING! Unexpected open error in a data disk, it isn't possible to sync.\n");
-				log_fatal("Ensure that file '%s' can be accessed.\n", handle[j].path);
-				log_fatal("Stopping to allow recovery. Try with 'snapraid check -f /%s'\n", fmt_poll(disk, file->sub, esc_buffer));
-				++error;
 				goto bail;
 				/* LCOV_EXCL_STOP */
 			}
-
-			/* check if the file is changed */
-			if (handle[j].st.st_size != file->size
-				|| handle[j].st.st_mtime != file->mtime_sec
-				|| STAT_NSEC(&handle[j].st) != file->mtime_nsec
-				|| handle[j].st.st_ino != file->inode
-			) {
-				log_tag("error:%u:%s:%s: Unexpected attribute change\n", i, disk->name, esc_tag(file->sub, esc_buffer));
-				if (handle[j].st.st_size != file->size) {
-					log_error("Unexpected size change at file '%s' from %" PRIu64 " to %" PRIu64 ".\n", handle[j].path, file->size, (uint64_t)handle[j].st.st_size);
-				} else if (handle[j].st.st_mtime != file->mtime_sec
-					|| STAT_NSEC(&handle[j].st) != file->mtime_nsec) {
-					log_error("Unexpected time change at file '%s' from %" PRIu64 ".%d to %" PRIu64 ".%d.\n", handle[j].path, file->mtime_sec, file->mtime_nsec, (uint64_t)handle[j].st.st_mtime, STAT_NSEC(&handle[j].st));
-				} else {
-					log_error("Unexpected inode change from %" PRIu64 " to %" PRIu64 " at file '%s'.\n", file->inode, (uint64_t)handle[j].st.st_ino, handle[j].path);
-				}
-				log_error("WARNING! You cannot modify files during a sync.\n");
-				log_error("Rerun the sync command when finished.\n");
-				++error;
-				/* if the file is changed, it means that it was modified during sync */
-				/* this isn't a serious error, so we skip this block, and continue with others */
+			if (ret == 1)
 				continue;
-			}
-
-			read_size = handle_read(&handle[j], file_pos, buffer, state->block_size, log_fatal, 0);
-			if (read_size == -1) {
-				/* LCOV_EXCL_START */
-				if (errno == EIO) {
-					log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
-					log_fatal("DANGER! Unexpected input/output read error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be read.\n", disk->dir, handle[j].path);
-					log_fatal("Stopping at block %u\n", i);
-					++io_error;
-					goto bail;
-				}
-
-				log_tag("error:%u:%s:%s: Read error at position %u. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
-				log_fatal("WARNING! Unexpected read error in a data disk, it isn't possible to sync.\n");
-				log_fatal("Ensure that file '%s' can be read.\n", handle[j].path);
-				log_fatal("Stopping to allow recovery. Try with 'snapraid check -f /%s'\n", fmt_poll(disk, file->sub, esc_buffer));
-				++error;
-				goto bail;
-				/* LCOV_EXCL_STOP */
-			}
 
 			/* until now is disk */
 			state_usage_disk(state, handle, &j, 1);
@@ -253,11 +346,7 @@ static int state_hash_process(struct snapraid_state* state, block_off_t blocksta
 			countsize += read_size;
 
 			/* now compute the hash */
-			if (rehash) {
-				memhash(state->prevhash, state->prevhashseed, hash, buffer, read_size);
-			} else {
-				memhash(state->hash, state->hashseed, hash, buffer, read_size);
-			}
+			state_hash_compute(state, i, hash, buffer, read_size);
 
 			/* until now is hash */
 			state_usage_hash(state);
@@ -312,31 +401,11 @@ static int state_hash_process(struct snapraid_state* state, block_off_t blocksta
 		}
 
 		/* close the last file in the disk */
-		if (handle[j].file != 0) {
-			/* keep a pointer at the file we are going to close for error reporting */
-			struct snapraid_file* report = handle[j].file;
-			ret = handle_close(&handle[j]);
-			if (ret == -1) {
-				/* LCOV_EXCL_START */
-				/* This one is really an unexpected error, because we are only reading */
-				/* and closing a descriptor should never fail */
-				if (errno == EIO) {
-					log_tag("error:%u:%s:%s: Close EIO error. %s\n", blockmax, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-					log_fatal("DANGER! Unexpected input/output close error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle[j].path);
-					log_fatal("Stopping at block %u\n", blockmax);
-					++io_error;
-					goto bail;
-				}
-
-				log_tag("error:%u:%s:%s: Close error. %s\n", blockmax, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-				log_fatal("WARNING! Unexpected close error in a data disk, it isn't possible to sync.\n");
-				log_fatal("Ensure that file '%s' can be accessed.\n", handle[j].path);
-				log_fatal("Stopping at block %u\n", blockmax);
-				++error;
-				goto bail;
-				/* LCOV_EXCL_STOP */
-			}
+		ret = state_hash_close(&handle[j], blockmax, &error, &io_error);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
 		}
 	}
 
@@ -384,7 +453,7 @@ bail:
 	}
 
 finish:
-	free(handle);
+	handle_unmapping(handle, diskmax);
 	free(buffer_alloc);
 
 	if (error + io_error + silent_error != 0)
@@ -392,6 +461,234 @@ finish:
 	return 0;
 }
 
+#if HAVE_PTHREAD
+/**
+ * Hashing of the CHG blocks running concurrently with the sync.
+ *
+ * The hashing thread goes ahead of the sync up to ::window positions,
+ * and the sync processes a position only after it's hashed.
+ */
+struct snapraid_prehash {
+	struct snapraid_state* state;
+	struct snapraid_handle* handle; /**< Handles used by the hashing thread. */
+	unsigned diskmax; /**< Number of handles. */
+	block_off_t blockstart; /**< First position to hash. */
+	block_off_t blockmax; /**< Last position to hash, excluded. */
+	block_off_t window; /**< Number of positions hashed ahead of the sync. */
+	pthread_t thread;
+	pthread_mutex_t mutex; /**< Protects the fields below, and the hashes of the blocks. */
+	pthread_cond_t cond; /**< Signaled when ::done, ::limit or ::exit change. */
+	block_off_t done; /**< All the positions before this one are hashed. */
+	block_off_t limit; /**< The positions from this one are not yet to hash. */
+	int exit; /**< Request to the hashing thread to exit. */
+	int failed; /**< The hashing thread stopped for an error. */
+	unsigned error; /**< Number of file errors. */
+	unsigned io_error; /**< Number of input/output errors. */
+	unsigned count; /**< Number of blocks hashed. */
+};
+
+static void* sync_prehash_thread(void* arg)
+{
+	struct snapraid_prehash* prehash = arg;
+	struct snapraid_state* state = prehash->state;
+	block_off_t i;
+	unsigned j;
+	void* buffer;
+	void* buffer_alloc;
+	int ret;
+
+	/* buffer for reading */
+	buffer = malloc_nofail_direct(state->block_size, &buffer_alloc);
+
+	for (i = prehash->blockstart; i < prehash->blockmax; ++i) {
+		/* wait for the sync to come close */
+		thread_mutex_lock(&prehash->mutex);
+		while (i >= prehash->limit && !prehash->exit)
+			thread_cond_wait(&prehash->cond, &prehash->mutex);
+		if (prehash->exit) {
+			thread_mutex_unlock(&prehash->mutex);
+			break;
+		}
+		thread_mutex_unlock(&prehash->mutex);
+
+		for (j = 0; j < prehash->diskmax; ++j) {
+			struct snapraid_disk* disk = prehash->handle[j].disk;
+			struct snapraid_file* file;
+			struct snapraid_block* block;
+			block_off_t file_pos;
+			unsigned char hash[HASH_MAX];
+			int read_size;
+
+			/* if no disk, nothing to hash */
+			if (!disk)
+				continue;
+
+			/* get the file of this block, without locking as the index doesn't change */
+			file = fs_par2file_find_index(disk, i, &file_pos);
+			if (!file)
+				continue;
+
+			block = fs_file2block_get(file, file_pos);
+
+			/* hash only the CHG blocks, the REP ones are already checked */
+			if (block_state_get(block) != BLOCK_STATE_CHG)
+				continue;
+
+			ret = state_hash_read(state, &prehash->handle[j], i, file, file_pos, buffer, &read_size, &prehash->error, &prehash->io_error);
+			if (ret == -1) {
+				/* LCOV_EXCL_START */
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			if (ret == 1)
+				continue;
+
+			state_hash_compute(state, i, hash, buffer, read_size);
+
+			/* the content file may be written at the same time by the autosave */
+			thread_mutex_lock(&prehash->mutex);
+
+			/* copy the hash in the block */
+			memcpy(block->hash, hash, BLOCK_HASH_SIZE);
+
+			/* and mark the block as hashed */
+			block_state_set(block, BLOCK_STATE_REP);
+
+			++prehash->count;
+
+			thread_mutex_unlock(&prehash->mutex);
+		}
+
+		/* the sync can now process this position */
+		thread_mutex_lock(&prehash->mutex);
+		prehash->done = i + 1;
+		thread_cond_broadcast_and_unlock(&prehash->cond, &prehash->mutex);
+	}
+
+	for (j = 0; j < prehash->diskmax; ++j) {
+		/* close the last file in the disk */
+		ret = state_hash_close(&prehash->handle[j], prehash->blockmax, &prehash->error, &prehash->io_error);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(buffer_alloc);
+
+	return 0;
+
+bail:
+	/* close files left open */
+	for (j = 0; j < prehash->diskmax; ++j)
+		handle_close(&prehash->handle[j]);
+
+	free(buffer_alloc);
+
+	/* stop the sync, unblocking it if waiting */
+	thread_mutex_lock(&prehash->mutex);
+	prehash->failed = 1;
+	prehash->done = prehash->blockmax;
+	thread_cond_broadcast_and_unlock(&prehash->cond, &prehash->mutex);
+
+	return 0;
+}
+
+/**
+ * Start the hashing thread of the CHG blocks.
+ */
+static struct snapraid_prehash* sync_prehash_start(struct snapraid_state* state, block_off_t blockstart, block_off_t blockmax)
+{
+	struct snapraid_prehash* prehash;
+	uint64_t window;
+
+	prehash = malloc_nofail(sizeof(struct snapraid_prehash));
+
+	prehash->state = state;
+	prehash->handle = handle_mapping(state, &prehash->diskmax);
+	prehash->blockstart = blockstart;
+	prehash->blockmax = blockmax;
+
+	/* the window is the size hashed ahead in each disk */
+	window = state->opt.prehash_window * (uint64_t)MEBI / state->block_size;
+	if (window == 0)
+		window = 1;
+	if (window > blockmax - blockstart)
+		window = blockmax - blockstart;
+	prehash->window = window;
+
+	thread_mutex_init(&prehash->mutex, 0);
+	thread_cond_init(&prehash->cond, 0);
+	prehash->done = blockstart;
+	prehash->limit = blockstart + prehash->window;
+	prehash->exit = 0;
+	prehash->failed = 0;
+	prehash->error = 0;
+	prehash->io_error = 0;
+	prehash->count = 0;
+
+	thread_create(&prehash->thread, 0, sync_prehash_thread, prehash);
+
+	return prehash;
+}
+
+/**
+ * Wait until the position ::i is hashed, allowing to hash the next window.
+ *
+ * Return -1 if the hashing stopped for an error.
+ */
+static int sync_prehash_wait(struct snapraid_prehash* prehash, block_off_t i)
+{
+	int ret;
+
+	thread_mutex_lock(&prehash->mutex);
+
+	/* move forward the window */
+	if (prehash->limit < prehash->blockmax && prehash->limit < i + prehash->window) {
+		prehash->limit = i + prehash->window;
+		if (prehash->limit > prehash->blockmax)
+			prehash->limit = prehash->blockmax;
+		thread_cond_broadcast(&prehash->cond);
+	}
+
+	while (prehash->done <= i)
+		thread_cond_wait(&prehash->cond, &prehash->mutex);
+
+	ret = prehash->failed ? -1 : 0;
+
+	thread_mutex_unlock(&prehash->mutex);
+
+	return ret;
+}
+
+/**
+ * Stop the hashing thread, and collect its results.
+ */
+static void sync_prehash_stop(struct snapraid_prehash* prehash, unsigned* error, unsigned* io_error)
+{
+	struct snapraid_state* state = prehash->state;
+
+	thread_mutex_lock(&prehash->mutex);
+	prehash->exit = 1;
+	thread_cond_broadcast_and_unlock(&prehash->cond, &prehash->mutex);
+
+	thread_join(prehash->thread, 0);
+
+	*error += prehash->error;
+	*io_error += prehash->io_error;
+
+	/* the new hashes have to be saved */
+	if (prehash->count != 0)
+		state->need_write = 1;
+
+	handle_unmapping(prehash->handle, prehash->diskmax);
+	thread_cond_destroy(&prehash->cond);
+	thread_mutex_destroy(&prehash->mutex);
+	free(prehash);
+}
+#endif
+
 /****************************************************************************/
 /* sync */
 
@@ -399,11 +696,20 @@ finish:
  * Sync plan to use.
  */
 struct snapraid_plan {
+	struct snapraid_state* state;
 	unsigned handle_max;
 	struct snapraid_handle* handle_map;
 	int force_full;
+	unsigned char* invalid_map; /**< Bitmap of the positions with invalid parity, or 0 if not used. */
+	struct snapraid_prehash* prehash; /**< Hashing running concurrently, or 0 if not used. */
 };
 
+/**
+ * How to update the parity of a block position.
+ */
+#define SYNC_PLAN_FULL 1 /**< Read all the data and recompute the parity. */
+#define SYNC_PLAN_DELTA 2 /**< Read only the changed data and the old parity, and update it. */
+
 /**
  * A block that failed the hash check, or that was deleted.
  */
@@ -439,20 +745,38 @@ struct snapraid_rehash {
 
 /**
  * Check if we have to process the specified block index ::i.
+ *
+ * Return 0 if not, otherwise one of the SYNC_PLAN_* values.
  */
 static int block_is_enabled(void* void_plan, block_off_t i)
 {
 	struct snapraid_plan* plan = void_plan;
+	snapraid_info info;
 	unsigned j;
 	int one_invalid;
 	int one_valid;
+	int can_delta;
+	unsigned count_blk;
+
+	/* skip without searching the blocks the positions with a valid parity */
+	if (plan->invalid_map && (plan->invalid_map[i / 8] & (1 << (i % 8))) == 0)
+		return 0;
+
+#if HAVE_PTHREAD
+	/* the position can be processed only after it's hashed */
+	if (plan->prehash && sync_prehash_wait(plan->prehash, i) != 0)
+		return 0;
+#endif
 
 	/* for each disk */
 	one_invalid = 0;
 	one_valid = 0;
+	can_delta = 1;
+	count_blk = 0;
 	for (j = 0; j < plan->handle_max; ++j) {
 		struct snapraid_block* block;
 		struct snapraid_disk* disk = plan->handle_map[j].disk;
+		unsigned block_state;
 
 		/* if no disk, nothing to check */
 		if (!disk)
@@ -465,13 +789,38 @@ static int block_is_enabled(void* void_plan, block_off_t i)
 
 		if (block_has_invalid_parity(block) || plan->force_full)
 			one_invalid = 1;
+
+		/* the delta update is possible only if the old content of */
+		/* all the changed blocks is known, and this happens only */
+		/* for CHG blocks written over an empty space, where the old */
+		/* content included in the parity is all 0 */
+		block_state = block_state_get(block);
+		if (block_state == BLOCK_STATE_BLK)
+			++count_blk;
+		else if (block_state == BLOCK_STATE_CHG && hash_is_zero(block->hash))
+			; /* changed block with old content at 0 */
+		else if (block_state != BLOCK_STATE_EMPTY)
+			can_delta = 0;
 	}
 
 	/* if none valid or none invalid, we don't need to update */
 	if (!one_invalid || !one_valid)
 		return 0;
 
-	return 1;
+	/* with a full update we read all the BLK and CHG blocks, */
+	/* with a delta update we read all the CHG blocks and all the parity, */
+	/* so the delta update is convenient only if we have more BLK than parity */
+	/* at least one BLK also ensures that the parity was already computed */
+	if (!can_delta || plan->force_full || count_blk <= plan->state->level)
+		return SYNC_PLAN_FULL;
+
+	/* the old hash is needed for all the blocks, and a bad block */
+	/* requires to recompute the parity from scratch */
+	info = info_get(&plan->state->infoarr, i);
+	if (info_get_rehash(info) || info_get_bad(info))
+		return SYNC_PLAN_FULL;
+
+	return SYNC_PLAN_DELTA;
 }
 
 static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_task* task)
@@ -481,6 +830,7 @@ static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_tas
 	struct snapraid_handle* handle = worker->handle;
 	struct snapraid_disk* disk = handle->disk;
 	block_off_t blockcur = task->position;
+	block_off_t run;
 	unsigned char* buffer = task->buffer;
 	int ret;
 	char esc_buffer[ESC_MAX];
@@ -489,30 +839,42 @@ static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_tas
 	if (!disk) {
 		/* use an empty block */
 		memset(buffer, 0, state->block_size);
+		task->is_zero = 1;
 		task->state = TASK_STATE_DONE;
 		return;
 	}
 
+	/* get the file of this block, without locking as the index doesn't change */
+	task->file = fs_par2file_find_index(disk, blockcur, &task->file_pos);
+
 	/* get the block */
-	task->block = fs_par2block_find(disk, blockcur);
+	task->block = task->file ? fs_file2block_get(task->file, task->file_pos) : BLOCK_NULL;
 
 	/* if the block has no file, meaning that it's EMPTY or DELETED, */
 	/* it doesn't participate in the new parity computation */
 	if (!block_has_file(task->block)) {
 		/* use an empty block */
 		memset(buffer, 0, state->block_size);
+		task->is_zero = 1;
 		task->state = TASK_STATE_DONE;
 		return;
 	}
 
-	/* get the file of this block */
-	task->file = fs_par2file_get(disk, blockcur, &task->file_pos);
+	/* in a delta update the unchanged blocks are not read, */
+	/* as they are already included in the old parity */
+	if (task->plan == SYNC_PLAN_DELTA && block_state_get(task->block) == BLOCK_STATE_BLK) {
+		/* use an empty block */
+		memset(buffer, 0, state->block_size);
+		task->is_zero = 1;
+		task->state = TASK_STATE_DONE;
+		return;
+	}
 
-	/* if the file is different than the current one, close it */
+	/* if the file is different than the current one, release it */
 	if (handle->file != 0 && handle->file != task->file) {
 		/* keep a pointer at the file we are going to close for error reporting */
 		struct snapraid_file* report = handle->file;
-		ret = handle_close(handle);
+		ret = handle_release(handle);
 		if (ret == -1) {
 			/* LCOV_EXCL_START */
 			/* This one is really an unexpected error, because we are only reading */
@@ -603,7 +965,10 @@ static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_tas
 		return;
 	}
 
-	task->read_size = handle_read(handle, task->file_pos, buffer, state->block_size, log_error, 0);
+	/* read together the next blocks of the file, if they follow in the parity */
+	run = handle->ahead_max > 1 ? fs_par2run_index(disk, blockcur) : 1;
+
+	task->read_size = handle_read_ahead(handle, task->file_pos, run, buffer, state->block_size, log_error, 0);
 	if (task->read_size == -1) {
 		/* LCOV_EXCL_START */
 		if (errno == EIO) {
@@ -622,6 +987,12 @@ static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_tas
 		/* LCOV_EXCL_STOP */
 	}
 
+	/* compute the hash now that the data is still in the cache */
+	/* this saves a later pass over the memory in the main thread, */
+	/* that then has only to compute the parity, */
+	/* and also spreads the hashing over the disk or hash threads */
+	io_task_hash(worker, task, state->hash, state->hashseed);
+
 	/* store the path of the opened file */
 	pathcpy(task->path, sizeof(task->path), handle->path);
 
@@ -635,11 +1006,13 @@ static void sync_parity_writer(struct snapraid_worker* worker, struct snapraid_t
 	struct snapraid_parity_handle* parity_handle = worker->parity_handle;
 	unsigned level = parity_handle->level;
 	block_off_t blockcur = task->position;
-	unsigned char* buffer = task->buffer;
+	unsigned char* buffer_map[PARITY_WRITE_VECTOR_MAX];
+	unsigned count;
 	int ret;
 
-	/* write parity */
-	ret = parity_write(parity_handle, blockcur, buffer, state->block_size);
+	/* write parity, together with the following blocks queued */
+	count = io_writer_batch(worker, task, buffer_map);
+	ret = parity_write_vector(parity_handle, blockcur, buffer_map, count, state->block_size);
 	if (ret == -1) {
 		/* LCOV_EXCL_START */
 		if (errno == EIO) {
@@ -675,13 +1048,19 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	void** zero;
 	void* copy_alloc;
 	void** copy;
+	void* delta_alloc;
+	void** delta;
+	void** delta_vector;
 	unsigned buffermax;
 	data_off_t countsize;
 	block_off_t countpos;
 	block_off_t countmax;
+	struct snapraid_disk** spinup_map;
 	block_off_t autosavedone;
 	block_off_t autosavelimit;
 	block_off_t autosavemissing;
+	block_off_t autosavestart;
+	uint64_t autosavetick;
 	int ret;
 	unsigned error;
 	unsigned silent_error;
@@ -716,6 +1095,10 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	/* allocate the copy buffer */
 	copy = malloc_nofail_vector_align(diskmax, diskmax, state->block_size, &copy_alloc);
 
+	/* allocate the delta buffers, for the old parity and for the parity of the changes */
+	delta = malloc_nofail_vector_align(2 * state->level, 2 * state->level, state->block_size, &delta_alloc);
+	delta_vector = malloc_nofail((diskmax + state->level) * sizeof(void*));
+
 	/* allocate and fill the zero buffer */
 	zero = malloc_nofail_align(state->block_size, &zero_alloc);
 	memset(zero, 0, state->block_size);
@@ -734,13 +1117,46 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 
 	/* first count the number of blocks to process */
 	countmax = 0;
+	plan.state = state;
 	plan.handle_max = diskmax;
 	plan.handle_map = handle;
 	plan.force_full = state->opt.force_full;
+	plan.invalid_map = 0;
+	plan.prehash = 0;
+
+	/* with a full update all the positions with a file are processed, */
+	/* otherwise only the ones with a block with invalid parity */
+	if (!plan.force_full) {
+		plan.invalid_map = malloc_nofail(blockmax / 8 + 1);
+		memset(plan.invalid_map, 0, blockmax / 8 + 1);
+		for (j = 0; j < diskmax; ++j) {
+			if (handle[j].disk)
+				fs_invalid_map(handle[j].disk, blockmax, plan.invalid_map);
+		}
+	}
+
+	spinup_map = 0;
+	if (state->opt.lazy_spinup)
+		spinup_map = calloc_nofail(diskmax, sizeof(struct snapraid_disk*));
+
 	for (blockcur = blockstart; blockcur < blockmax; ++blockcur) {
 		if (!block_is_enabled(&plan, blockcur))
 			continue;
 		++countmax;
+
+		/* mark the disks with a block to read */
+		if (spinup_map) {
+			for (j = 0; j < diskmax; ++j) {
+				if (handle[j].disk && !spinup_map[j] && block_has_file(fs_par2block_find(handle[j].disk, blockcur)))
+					spinup_map[j] = handle[j].disk;
+			}
+		}
+	}
+
+	/* spin up together only the disks used, before starting to read them */
+	if (spinup_map) {
+		state_device_spinup(state, spinup_map, diskmax, countmax != 0);
+		free(spinup_map);
 	}
 
 	/* compute the autosave size for all disk, even if not read */
@@ -749,6 +1165,8 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	autosavelimit = state->autosave / (diskmax * state->block_size);
 	autosavemissing = countmax; /* blocks to do */
 	autosavedone = 0; /* blocks done */
+	autosavestart = blockstart; /* first block not yet saved */
+	autosavetick = tick_ms() + state->autosave_time * 1000ULL; /* time of the next autosave */
 
 	/* drop until now */
 	state_usage_waste(state);
@@ -756,6 +1174,12 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	countsize = 0;
 	countpos = 0;
 
+#if HAVE_PTHREAD
+	/* hash the new data concurrently, before starting the workers using it */
+	if (state->opt.prehash_window != 0)
+		plan.prehash = sync_prehash_start(state, blockstart, blockmax);
+#endif
+
 	/* start all the worker threads */
 	io_start(&io, blockstart, blockmax, &block_is_enabled, &plan);
 
@@ -770,6 +1194,9 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 		int fixed_error_on_this_block;
 		int parity_needs_to_be_updated;
 		int parity_going_to_be_updated;
+		int parity_delta;
+		int data_is_zero;
+		int parity_is_zero;
 		snapraid_info info;
 		int rehash;
 		void** buffer;
@@ -814,6 +1241,13 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 		/* if the parity is going to be updated */
 		parity_going_to_be_updated = 0;
 
+		/* if the parity is updated with only the changed blocks */
+		parity_delta = 0;
+
+		/* if all the data is zero, and then the parity also */
+		data_is_zero = 1;
+		parity_is_zero = 0;
+
 		/* if the block is marked as bad, we force the parity update */
 		/* because the bad block may be the result of a wrong parity */
 		if (info_get_bad(info))
@@ -845,6 +1279,9 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 			file = task->file;
 			file_pos = task->file_pos;
 			read_size = task->read_size;
+			parity_delta = task->plan == SYNC_PLAN_DELTA;
+			if (!task->is_zero)
+				data_is_zero = 0;
 
 			/* by default no rehash in case of "continue" */
 			rehandle[diskcur].block = 0;
@@ -926,17 +1363,21 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 				/* LCOV_EXCL_STOP */
 			}
 
+			/* in a delta update the unchanged blocks are not read */
+			if (parity_delta && block_state == BLOCK_STATE_BLK)
+				continue;
+
 			countsize += read_size;
 
-			/* now compute the hash */
+			/* now get the hash, the new one is already computed by the worker */
 			if (rehash) {
 				memhash(state->prevhash, state->prevhashseed, hash, buffer[diskcur], read_size);
 
-				/* compute the new hash, and store it */
+				/* store the new hash */
 				rehandle[diskcur].block = block;
-				memhash(state->hash, state->hashseed, rehandle[diskcur].hash, buffer[diskcur], read_size);
+				memcpy(rehandle[diskcur].hash, task->hash, BLOCK_HASH_SIZE);
 			} else {
-				memhash(state->hash, state->hashseed, hash, buffer[diskcur], read_size);
+				memcpy(hash, task->hash, BLOCK_HASH_SIZE);
 			}
 
 			/* until now is hash */
@@ -1154,17 +1595,78 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 			}
 		}
 
+		/* in a delta update, read the old parity to update */
+		/* we are sure that parity exists because */
+		/* we have at least one BLK block */
+		if (parity_delta && parity_needs_to_be_updated
+			&& !error_on_this_block && !io_error_on_this_block
+		) {
+			/* until now is misc */
+			state_usage_misc(state);
+
+			for (l = 0; l < state->level; ++l) {
+				ret = parity_read(&parity_handle[l], blockcur, delta[l], state->block_size, log_error);
+				if (ret == -1) {
+					/* LCOV_EXCL_START */
+					if (errno == EIO) {
+						log_tag("parity_error:%u:%s: Read EIO error. %s\n", blockcur, lev_config_name(l), strerror(errno));
+						if (io_error >= state->opt.io_error_limit) {
+							log_fatal("DANGER! Unexpected input/output read error in the %s disk, it isn't possible to sync.\n", lev_name(l));
+							log_fatal("Ensure that disk '%s' is sane and can be read.\n", lev_config_name(l));
+							log_fatal("Stopping at block %u\n", blockcur);
+							++io_error;
+							goto bail;
+						}
+
+						log_error("Input/Output error in parity '%s' at position '%u'\n", lev_config_name(l), blockcur);
+						++io_error;
+						io_error_on_this_block = 1;
+						continue;
+					}
+
+					log_tag("parity_error:%u:%s: Read error. %s\n", blockcur, lev_config_name(l), strerror(errno));
+					log_fatal("WARNING! Unexpected read error in the %s disk, it isn't possible to sync.\n", lev_name(l));
+					log_fatal("Ensure that disk '%s' can be read.\n", lev_config_name(l));
+					log_fatal("Stopping at block %u\n", blockcur);
+					++error;
+					goto bail;
+					/* LCOV_EXCL_STOP */
+				}
+
+				/* until now is parity */
+				state_usage_parity(state, &l, 1);
+			}
+		}
+
 		/* if we have read all the data required and it's correct, proceed with the parity */
 		if (!error_on_this_block && !io_error_on_this_block
 			&& (!silent_error_on_this_block || fixed_error_on_this_block)
 		) {
 			/* update the parity only if really needed */
-			if (parity_needs_to_be_updated) {
-				/* compute the parity */
-				raid_gen(diskmax, state->level, state->block_size, buffer);
+			/* the parity is computed by the parity threads while the blocks are marked */
+			if (parity_needs_to_be_updated && parity_delta) {
+				/* compute the parity of the changed blocks only */
+				/* as the unchanged ones are read as 0, */
+				/* and add it to the old parity, with the old content at 0 */
+				for (j = 0; j < diskmax; ++j)
+					delta_vector[j] = buffer[j];
+				for (l = 0; l < state->level; ++l)
+					delta_vector[diskmax + l] = delta[state->level + l];
+				io_raid_begin(&io, diskmax, state->level, state->block_size, delta_vector, delta, buffer + diskmax);
 
-				/* until now is raid */
-				state_usage_raid(state);
+				/* mark that the parity is going to be written */
+				parity_going_to_be_updated = 1;
+			} else if (parity_needs_to_be_updated && data_is_zero && !silent_error_on_this_block) {
+				/* the parity of all zero data is zero, no need to compute it */
+				for (l = 0; l < state->level; ++l)
+					memset(buffer[diskmax + l], 0, state->block_size);
+
+				/* mark that the parity is going to be written */
+				parity_going_to_be_updated = 1;
+				parity_is_zero = 1;
+			} else if (parity_needs_to_be_updated) {
+				/* compute the parity */
+				io_raid_begin(&io, diskmax, state->level, state->block_size, buffer, 0, 0);
 
 				/* mark that the parity is going to be written */
 				parity_going_to_be_updated = 1;
@@ -1216,6 +1718,17 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 				/* we are also clearing any previous bad and rehash flag */
 				info_set(&state->infoarr, blockcur, info_make(now, 0, 0, 1));
 			}
+
+			/* complete the parity computation */
+			if (parity_going_to_be_updated && !parity_is_zero) {
+				/* until now is misc */
+				state_usage_misc(state);
+
+				io_raid_end(&io);
+
+				/* until now is raid */
+				state_usage_raid(state);
+			}
 		}
 
 		/* if a silent (even if corrected) or input/output error was found */
@@ -1296,6 +1809,8 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 		if ((state->autosave != 0
 			&& autosavedone >= autosavelimit /* if we have reached the limit */
 			&& autosavemissing >= autosavelimit) /* if we have at least a full step to do */
+			/* or if we have reached the time limit, and there is still something to do */
+			|| (state->autosave_time != 0 && autosavemissing != 0 && tick_ms() >= autosavetick)
 		        /* or if we have a forced autosave at the specified block */
 			|| (state->opt.force_autosave_at != 0 && state->opt.force_autosave_at == blockcur)
 		) {
@@ -1325,7 +1840,18 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 			}
 
 			/* now we can safely write the content file */
-			state_write(state);
+#if HAVE_PTHREAD
+			/* the hashing thread is updating the next blocks */
+			if (plan.prehash)
+				thread_mutex_lock(&plan.prehash->mutex);
+#endif
+			state_autosave(state, autosavestart, blockcur + 1);
+#if HAVE_PTHREAD
+			if (plan.prehash)
+				thread_mutex_unlock(&plan.prehash->mutex);
+#endif
+			autosavestart = blockcur + 1;
+			autosavetick = tick_ms() + state->autosave_time * 1000ULL;
 
 			state_progress_restart(state);
 
@@ -1335,6 +1861,13 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	}
 
 end:
+#if HAVE_PTHREAD
+	if (plan.prehash) {
+		sync_prehash_stop(plan.prehash, &error, &io_error);
+		plan.prehash = 0;
+	}
+#endif
+
 	state_progress_end(state, countpos, countmax, countsize);
 
 	state_usage_print(state);
@@ -1387,9 +1920,18 @@ end:
 	log_flush();
 
 bail:
+#if HAVE_PTHREAD
+	if (plan.prehash) {
+		sync_prehash_stop(plan.prehash, &error, &io_error);
+		plan.prehash = 0;
+	}
+#endif
+
 	/* stop all the worker threads */
 	io_stop(&io);
 
+	state_usage_latency(state);
+
 	for (j = 0; j < diskmax; ++j) {
 		struct snapraid_file* file = handle[j].file;
 		struct snapraid_disk* disk = handle[j].disk;
@@ -1404,14 +1946,18 @@ bail:
 		}
 	}
 
-	free(handle);
+	handle_unmapping(handle, diskmax);
 	free(zero_alloc);
 	free(copy_alloc);
 	free(copy);
+	free(delta_alloc);
+	free(delta);
+	free(delta_vector);
 	free(rehandle_alloc);
 	free(failed);
 	free(failed_map);
 	free(waiting_map);
+	free(plan.invalid_map);
 	io_done(&io);
 
 	if (state->opt.expect_recoverable) {
@@ -1432,12 +1978,17 @@ int state_sync(struct snapraid_state* state, block_off_t blockstart, block_off_t
 	data_off_t size;
 	int ret;
 	struct snapraid_parity_handle parity_handle[LEV_MAX];
+	struct snapraid_parity_resize resize[LEV_MAX];
 	unsigned unrecoverable_error;
 	unsigned l;
 	int skip_sync = 0;
+	int prehash_chg;
 
 	msg_progress("Initializing...\n");
 
+	/* the extents don't change anymore, except for the blocks released */
+	state_index(state);
+
 	blockmax = parity_allocated_size(state);
 	size = blockmax * (data_off_t)state->block_size;
 
@@ -1508,10 +2059,17 @@ int state_sync(struct snapraid_state* state, block_off_t blockstart, block_off_t
 
 	unrecoverable_error = 0;
 
+	/* with a window the CHG blocks are hashed concurrently with the sync */
+	prehash_chg = 1;
+#if HAVE_PTHREAD
+	if (state->opt.prehash_window != 0)
+		prehash_chg = 0;
+#endif
+
 	if (state->opt.prehash) {
 		msg_progress("Hashing...\n");
 
-		ret = state_hash_process(state, blockstart, blockmax, &skip_sync);
+		ret = state_hash_process(state, blockstart, blockmax, prehash_chg, &skip_sync);
 		if (ret == -1) {
 			/* LCOV_EXCL_START */
 			++unrecoverable_error;
@@ -1523,15 +2081,22 @@ int state_sync(struct snapraid_state* state, block_off_t blockstart, block_off_t
 	if (!skip_sync) {
 		msg_progress("Resizing...\n");
 
-		/* now change the size of all parities */
+		/* now change the size of all parities, all the levels at the same time */
+		/* from this point all the DELETED blocks after the end of the parity are invalid */
+		/* and they are automatically removed when we save the new content file */
 		for (l = 0; l < state->level; ++l) {
-			int is_modified;
+			resize[l].handle = &parity_handle[l];
+			resize[l].parity = &state->parity[l];
+			resize[l].size = size;
+			resize[l].block_size = state->block_size;
+			resize[l].skip_fallocate = state->opt.skip_fallocate;
+			resize[l].skip_space_holder = state->opt.skip_space_holder;
+		}
 
-			/* change the size of the parity file, truncating or extending it */
-			/* from this point all the DELETED blocks after the end of the parity are invalid */
-			/* and they are automatically removed when we save the new content file */
-			ret = parity_chsize(&parity_handle[l], &state->parity[l], &is_modified, size, state->block_size, state->opt.skip_fallocate, state->opt.skip_space_holder);
-			if (ret == -1) {
+		parity_chsize_multi(resize, state->level);
+
+		for (l = 0; l < state->level; ++l) {
+			if (resize[l].ret == -1) {
 				/* LCOV_EXCL_START */
 				data_off_t out_size;
 				parity_size(&parity_handle[l], &out_size);
@@ -1541,7 +2106,7 @@ int state_sync(struct snapraid_state* state, block_off_t blockstart, block_off_t
 				/* LCOV_EXCL_STOP */
 			}
 
-			if (is_modified)
+			if (resize[l].is_modified)
 				state->need_write = 1;
 		}
 
@@ -22,125 +22,395 @@
 #include "state.h"
 #include "handle.h"
 
+/*
+ * Set the timestamps relative to the directory of the file, with the
+ * directory kept open for the next files, to avoid to resolve the whole
+ * path for each file.
+ */
+#if HAVE_UTIMENSAT && HAVE_FSTATAT && defined(AT_SYMLINK_NOFOLLOW) && defined(O_DIRECTORY)
+#define TOUCH_AT 1
+#endif
+
+/**
+ * Touch of all the disks.
+ */
+struct snapraid_touch {
+	struct snapraid_state* state;
+#if HAVE_PTHREAD
+	pthread_mutex_t mutex; /**< Mutex protecting the progress. */
+#endif
+	block_off_t countpos; /**< Number of files processed. */
+	block_off_t countmax; /**< Number of files to process. */
+	int stop; /**< If the touch was interrupted. */
+};
+
+/**
+ * Touch of a single disk.
+ */
+struct snapraid_touch_disk {
+	struct snapraid_touch* touch; /**< Parent pointer. */
+	struct snapraid_disk* disk;
+	struct snapraid_file** file_map; /**< Files to touch, sorted by path. */
+	unsigned file_max; /**< Number of files to touch. */
+	uint64_t seed; /**< State of the generator of the nanoseconds. */
+	int is_modified; /**< If at least one file was touched. */
+#if TOUCH_AT
+	int dir_f; /**< Directory of the latest file, or -1. */
+	char dir_path[PATH_MAX]; /**< Path of ::dir_f. */
+#endif
+#if HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+static int touch_file_compare(const void* void_a, const void* void_b)
+{
+	const struct snapraid_file* const* file_a = void_a;
+	const struct snapraid_file* const* file_b = void_b;
+
+	return strcmp((*file_a)->sub, (*file_b)->sub);
+}
+
+/**
+ * Get a random nanosecond value different than 0.
+ *
+ * It's a SplitMix64 generator, seeded once for each disk, as reading
+ * the system random source for each file is too slow with millions of files.
+ */
+static int touch_nsec(struct snapraid_touch_disk* touch_disk)
+{
+	uint64_t z;
+
+	do {
+		z = (touch_disk->seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z = z ^ (z >> 31);
+	} while (z % 1000000000 == 0);
+
+	return z % 1000000000;
+}
+
+/**
+ * Update the progress with the file just processed.
+ * Return !=0 if the touch has to stop.
+ */
+static int touch_progress(struct snapraid_touch* touch)
+{
+	int stop;
+
+#if HAVE_PTHREAD
+	thread_mutex_lock(&touch->mutex);
+#endif
+
+	++touch->countpos;
+
+	if (!touch->stop && state_progress(touch->state, 0, 0, touch->countpos, touch->countmax, 0))
+		touch->stop = 1;
+
+	stop = touch->stop;
+
+#if HAVE_PTHREAD
+	thread_mutex_unlock(&touch->mutex);
+#endif
+
+	return stop;
+}
+
+#if TOUCH_AT
+/**
+ * Set the new nanosecond timestamp of a file.
+ * Return the stat info of the file after the change.
+ * Return -1 on error, with the message already printed.
+ */
+static int touch_file(struct snapraid_touch_disk* touch_disk, struct snapraid_file* file, int nsec, struct stat* st)
+{
+	struct snapraid_disk* disk = touch_disk->disk;
+	char path[PATH_MAX];
+	char dir[PATH_MAX];
+	const char* name;
+	const char* slash;
+	struct timespec tv[2];
+
+	pathprint(path, sizeof(path), "%s%s", disk->dir, file->sub);
+
+	slash = strrchr(file->sub, '/');
+	if (slash) {
+		name = slash + 1;
+		pathprint(dir, sizeof(dir), "%s%.*s", disk->dir, (int)(slash + 1 - file->sub), file->sub);
+	} else {
+		name = file->sub;
+		pathcpy(dir, sizeof(dir), disk->dir);
+	}
+
+	/* open the directory, if different than the previous one */
+	if (touch_disk->dir_f == -1 || strcmp(dir, touch_disk->dir_path) != 0) {
+		if (touch_disk->dir_f != -1)
+			close(touch_disk->dir_f);
+
+		touch_disk->dir_f = open(dir, O_RDONLY | O_DIRECTORY);
+		if (touch_disk->dir_f == -1) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error opening directory '%s'. %s.\n", dir, strerror(errno));
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		pathcpy(touch_disk->dir_path, sizeof(touch_disk->dir_path), dir);
+	}
+
+	/* get the present timestamp, that may be different than the one */
+	/* in the content file */
+	if (fstatat(touch_disk->dir_f, name, st, AT_SYMLINK_NOFOLLOW) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error accessing file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* process only the real file, like opening it with O_NOFOLLOW */
+	if (!S_ISREG(st->st_mode)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening file '%s'. %s.\n", path, strerror(ELOOP));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* set the tweaked modification time, with new nano seconds */
+	tv[0].tv_sec = st->st_mtime;
+	tv[0].tv_nsec = nsec;
+	tv[1].tv_sec = tv[0].tv_sec;
+	tv[1].tv_nsec = tv[0].tv_nsec;
+
+	if (utimensat(touch_disk->dir_f, name, tv, AT_SYMLINK_NOFOLLOW) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error timing file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* uses fstatat again to get the present timestamp */
+	/* this is needed because the value read */
+	/* may be different than the written one */
+	if (fstatat(touch_disk->dir_f, name, st, AT_SYMLINK_NOFOLLOW) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error accessing file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+}
+#else
+static int touch_file(struct snapraid_touch_disk* touch_disk, struct snapraid_file* file, int nsec, struct stat* st)
+{
+	struct snapraid_disk* disk = touch_disk->disk;
+	char path[PATH_MAX];
+	int f;
+	int ret;
+	int flags;
+
+	pathprint(path, sizeof(path), "%s%s", disk->dir, file->sub);
+
+	/* O_BINARY: open as binary file (Windows only) */
+	/* O_NOFOLLOW: do not follow links to ensure to open the real file */
+	flags = O_BINARY | O_NOFOLLOW;
+#ifdef _WIN32
+	/* in Windows we must have write access at the file */
+	flags |= O_RDWR;
+#else
+	/* in all others platforms, read access is enough */
+	flags |= O_RDONLY;
+#endif
+
+	/* open it */
+	f = open(path, flags);
+	if (f == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* get the present timestamp, that may be different than the one */
+	/* in the content file */
+	ret = fstat(f, st);
+	if (ret == -1) {
+		/* LCOV_EXCL_START */
+		close(f);
+		log_fatal("Error accessing file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* set the tweaked modification time, with new nano seconds */
+	ret = fmtime(f, st->st_mtime, nsec);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		close(f);
+		log_fatal("Error timing file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* uses fstat again to get the present timestamp */
+	/* this is needed because the value read */
+	/* may be different than the written one */
+	ret = fstat(f, st);
+	if (ret == -1) {
+		/* LCOV_EXCL_START */
+		close(f);
+		log_fatal("Error accessing file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* close it */
+	ret = close(f);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing file '%s'. %s.\n", path, strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+}
+#endif
+
+static void touch_disk_process(struct snapraid_touch_disk* touch_disk)
+{
+	struct snapraid_disk* disk = touch_disk->disk;
+	unsigned i;
+	char esc_buffer[ESC_MAX];
+
+	for (i = 0; i < touch_disk->file_max; ++i) {
+		struct snapraid_file* file = touch_disk->file_map[i];
+		struct stat st;
+
+		/* set a new nanosecond timestamp different than 0 */
+		if (touch_file(touch_disk, file, touch_nsec(touch_disk), &st) == 0) {
+			/* set the same nanosecond value in the content file */
+			/* note that if the seconds value is already matching */
+			/* the file won't be synced because the content file will */
+			/* contain the new updated timestamp */
+			file->mtime_nsec = STAT_NSEC(&st);
+
+			/* state changed, we need to update it */
+			touch_disk->is_modified = 1;
+
+			log_tag("touch:%s:%s: %" PRIu64 ".%d\n", disk->name, esc_tag(file->sub, esc_buffer), (uint64_t)st.st_mtime, STAT_NSEC(&st));
+			msg_info("touch %s\n", fmt_term(disk, file->sub, esc_buffer));
+		}
+
+		if (touch_progress(touch_disk->touch))
+			break;
+	}
+
+#if TOUCH_AT
+	if (touch_disk->dir_f != -1) {
+		close(touch_disk->dir_f);
+		touch_disk->dir_f = -1;
+	}
+#endif
+}
+
+#if HAVE_PTHREAD
+static void* touch_disk_thread(void* arg)
+{
+	touch_disk_process(arg);
+
+	return 0;
+}
+#endif
+
 void state_touch(struct snapraid_state* state)
 {
+	struct snapraid_touch touch;
+	struct snapraid_touch_disk* touch_map;
+	unsigned diskmax;
+	unsigned j;
 	tommy_node* i;
-	char esc_buffer[ESC_MAX];
 
 	msg_progress("Setting sub-second timestamps...\n");
 
-	/* for all disks */
-	for (i = state->disklist; i != 0; i = i->next) {
+	touch.state = state;
+	touch.countpos = 0;
+	touch.countmax = 0;
+	touch.stop = 0;
+
+	diskmax = tommy_list_count(&state->disklist);
+	touch_map = malloc_nofail(diskmax * sizeof(struct snapraid_touch_disk));
+
+	/* collect the files of each disk */
+	for (i = state->disklist, j = 0; i != 0; i = i->next, ++j) {
+		struct snapraid_touch_disk* touch_disk = &touch_map[j];
 		struct snapraid_disk* disk = i->data;
-		tommy_node* j;
+		tommy_node* k;
 
-		/* for all files */
-		for (j = disk->filelist; j != 0; j = j->next) {
-			struct snapraid_file* file = j->data;
+		touch_disk->touch = &touch;
+		touch_disk->disk = disk;
+		touch_disk->file_map = malloc_nofail(tommy_list_count(&disk->filelist) * sizeof(struct snapraid_file*));
+		touch_disk->file_max = 0;
+		touch_disk->is_modified = 0;
+#if TOUCH_AT
+		touch_disk->dir_f = -1;
+#endif
+
+		if (randomize(&touch_disk->seed, sizeof(touch_disk->seed)) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed to get random values.\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		for (k = disk->filelist; k != 0; k = k->next) {
+			struct snapraid_file* file = k->data;
 
 			/* if the file has a zero nanosecond timestamp */
 			/* note that symbolic links are not in the file list */
 			/* and then are not processed */
-			if (file->mtime_nsec == 0) {
-				char path[PATH_MAX];
-				struct stat st;
-				int f;
-				int ret;
-				int nsec;
-				int flags;
-
-				pathprint(path, sizeof(path), "%s%s", disk->dir, file->sub);
-
-				/* set a new nanosecond timestamp different than 0 */
-				do {
-					uint32_t nano;
-
-					/* get a random nanosecond value */
-					if (randomize(&nano, sizeof(nano)) != 0) {
-						/* LCOV_EXCL_START */
-						log_fatal("Failed to get random values.\n");
-						exit(EXIT_FAILURE);
-						/* LCOV_EXCL_STOP */
-					}
-
-					nsec = nano % 1000000000;
-				} while (nsec == 0);
-
-				/* O_BINARY: open as binary file (Windows only) */
-				/* O_NOFOLLOW: do not follow links to ensure to open the real file */
-				flags = O_BINARY | O_NOFOLLOW;
-#ifdef _WIN32
-				/* in Windows we must have write access at the file */
-				flags |= O_RDWR;
+			if (file->mtime_nsec == 0)
+				touch_disk->file_map[touch_disk->file_max++] = file;
+		}
+
+		/* process the files of the same directory together */
+		qsort(touch_disk->file_map, touch_disk->file_max, sizeof(struct snapraid_file*), touch_file_compare);
+
+		touch.countmax += touch_disk->file_max;
+	}
+
+	state_progress_begin(state, 0, 0, touch.countmax);
+
+	/* each disk is processed by a different thread */
+#if HAVE_PTHREAD
+	thread_mutex_init(&touch.mutex, 0);
+
+	for (j = 0; j < diskmax; ++j) {
+		if (touch_map[j].file_max != 0)
+			thread_create(&touch_map[j].thread, 0, touch_disk_thread, &touch_map[j]);
+	}
+
+	for (j = 0; j < diskmax; ++j) {
+		void* retval;
+
+		if (touch_map[j].file_max != 0)
+			thread_join(touch_map[j].thread, &retval);
+	}
+
+	thread_mutex_destroy(&touch.mutex);
 #else
-				/* in all others platforms, read access is enough */
-				flags |= O_RDONLY;
+	for (j = 0; j < diskmax; ++j)
+		touch_disk_process(&touch_map[j]);
 #endif
 
-				/* open it */
-				f = open(path, flags);
-				if (f == -1) {
-					/* LCOV_EXCL_START */
-					log_fatal("Error opening file '%s'. %s.\n", path, strerror(errno));
-					continue;
-					/* LCOV_EXCL_STOP */
-				}
-
-				/* get the present timestamp, that may be different than the one */
-				/* in the content file */
-				ret = fstat(f, &st);
-				if (ret == -1) {
-					/* LCOV_EXCL_START */
-					close(f);
-					log_fatal("Error accessing file '%s'. %s.\n", path, strerror(errno));
-					continue;
-					/* LCOV_EXCL_STOP */
-				}
-
-				/* set the tweaked modification time, with new nano seconds */
-				ret = fmtime(f, st.st_mtime, nsec);
-				if (ret != 0) {
-					/* LCOV_EXCL_START */
-					close(f);
-					log_fatal("Error timing file '%s'. %s.\n", path, strerror(errno));
-					continue;
-					/* LCOV_EXCL_STOP */
-				}
-
-				/* uses fstat again to get the present timestamp */
-				/* this is needed because the value read */
-				/* may be different than the written one */
-				ret = fstat(f, &st);
-				if (ret == -1) {
-					/* LCOV_EXCL_START */
-					close(f);
-					log_fatal("Error accessing file '%s'. %s.\n", path, strerror(errno));
-					continue;
-					/* LCOV_EXCL_STOP */
-				}
-
-				/* close it */
-				ret = close(f);
-				if (ret != 0) {
-					/* LCOV_EXCL_START */
-					log_fatal("Error closing file '%s'. %s.\n", path, strerror(errno));
-					continue;
-					/* LCOV_EXCL_STOP */
-				}
-
-				/* set the same nanosecond value in the content file */
-				/* note that if the seconds value is already matching */
-				/* the file won't be synced because the content file will */
-				/* contain the new updated timestamp */
-				file->mtime_nsec = STAT_NSEC(&st);
-
-				/* state changed, we need to update it */
-				state->need_write = 1;
-
-				log_tag("touch:%s:%s: %" PRIu64 ".%d\n", disk->name, esc_tag(file->sub, esc_buffer), (uint64_t)st.st_mtime, STAT_NSEC(&st));
-				msg_info("touch %s\n", fmt_term(disk, file->sub, esc_buffer));
-			}
-		}
+	state_progress_end(state, touch.countpos, touch.countmax, 0);
+
+	for (j = 0; j < diskmax; ++j) {
+		if (touch_map[j].is_modified)
+			state->need_write = 1;
+		free(touch_map[j].file_map);
 	}
-}
 
+	free(touch_map);
+}
@@ -404,6 +404,9 @@ static int devresolve(uint64_t device, char* path, size_t path_size)
  */
 #if HAVE_BLKID
 static blkid_cache cache = 0;
+#if HAVE_PTHREAD
+static pthread_mutex_t cache_mutex; /**< The cache is shared by the threads probing the disks. */
+#endif
 #endif
 
 /**
@@ -494,7 +497,13 @@ static int devuuid_blkid(uint64_t device, char* uuid, size_t uuid_size)
 		return -1;
 	}
 
+#if HAVE_PTHREAD
+	thread_mutex_lock(&cache_mutex);
+#endif
 	uuidname = blkid_get_tag_value(cache, "UUID", devname);
+#if HAVE_PTHREAD
+	thread_mutex_unlock(&cache_mutex);
+#endif
 	if (!uuidname) {
 		log_tag("uuid:blkid:%u:%u: blkid_get_tag_value(UUID,%s) failed, %s\n", major(device), minor(device), devname, strerror(errno));
 		/* uuid mapping failed */
@@ -644,6 +653,104 @@ int filephy(const char* path, uint64_t size, uint64_t* physical)
 	return 0;
 }
 
+#if HAVE_LINUX_FIEMAP_H
+#define FILECLONE_EXTENT_MAX 64 /**< Extents compared for each FIEMAP call. */
+
+struct fileclone_map {
+	struct fiemap fiemap;
+	struct fiemap_extent extent[FILECLONE_EXTENT_MAX];
+};
+
+static int fileclone_extent(int f, uint64_t start, struct fileclone_map* fm)
+{
+	memset(fm, 0, sizeof(*fm));
+	fm->fiemap.fm_start = start;
+	fm->fiemap.fm_length = ~0ULL;
+	fm->fiemap.fm_flags = FIEMAP_FLAG_SYNC; /* required to ensure that just created files report a valid address */
+	fm->fiemap.fm_extent_count = FILECLONE_EXTENT_MAX;
+
+	return ioctl(f, FS_IOC_FIEMAP, fm);
+}
+#endif
+
+int fileclone(const char* path, const char* path_src)
+{
+#if HAVE_LINUX_FIEMAP_H
+	struct fileclone_map fa;
+	struct fileclone_map fb;
+	uint64_t start;
+	int ret;
+	int f;
+	int g;
+
+	f = open(path, O_RDONLY);
+	if (f == -1)
+		return -1;
+
+	g = open(path_src, O_RDONLY);
+	if (g == -1) {
+		close(f);
+		return -1;
+	}
+
+	/* the files are clones if they map the same physical extents */
+	/* at the same logical offsets, and all of them are shared */
+	ret = -1;
+	start = 0;
+	while (1) {
+		unsigned i;
+
+		if (fileclone_extent(f, start, &fa) == -1 || fileclone_extent(g, start, &fb) == -1)
+			break;
+
+		/* empty files, or with only holes, don't share anything */
+		if (fa.fiemap.fm_mapped_extents == 0 || fa.fiemap.fm_mapped_extents != fb.fiemap.fm_mapped_extents)
+			break;
+
+		for (i = 0; i < fa.fiemap.fm_mapped_extents; ++i) {
+			struct fiemap_extent* ea = &fa.fiemap.fm_extents[i];
+			struct fiemap_extent* eb = &fb.fiemap.fm_extents[i];
+
+			if (ea->fe_logical != eb->fe_logical
+				|| ea->fe_physical != eb->fe_physical
+				|| ea->fe_length != eb->fe_length
+				|| ea->fe_flags != eb->fe_flags)
+				break;
+
+			/* the offset has to be real and the data shared */
+			if (ea->fe_physical == 0
+				|| (ea->fe_flags & FIEMAP_EXTENT_SHARED) == 0
+				|| (ea->fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_DATA_INLINE)) != 0)
+				break;
+
+			if (ea->fe_flags & FIEMAP_EXTENT_LAST) {
+				ret = 0;
+				break;
+			}
+		}
+
+		/* stop if a difference was found, or at the last extent */
+		if (ret == 0 || i < fa.fiemap.fm_mapped_extents)
+			break;
+
+		/* continue after the last extent returned */
+		start = fa.fiemap.fm_extents[i - 1].fe_logical + fa.fiemap.fm_extents[i - 1].fe_length;
+	}
+
+	if (close(g) == -1)
+		ret = -1;
+	if (close(f) == -1)
+		ret = -1;
+
+	return ret;
+#else
+	(void)path;
+	(void)path_src;
+
+	return -1;
+#endif
+}
+
 int fsinfo(const char* path, int* has_persistent_inode, int* has_syncronized_hardlinks, uint64_t* total_space, uint64_t* free_space)
 {
 	char type[64];
@@ -766,6 +873,534 @@ int fsinfo(const char* path, int* has_persistent_inode, int* has_syncronized_har
 	return 0;
 }
 
+int fsjournal(const char* dir, uint64_t* journal_id, uint64_t* journal_pos, void (*func)(void* arg, const char* sub), void* arg)
+{
+	(void)dir;
+	(void)func;
+	(void)arg;
+
+	/*
+	 * Unix file-systems don't have a persistent change journal.
+	 *
+	 * Linux inotify and fanotify report changes only to a process
+	 * running when the change happens, and they cannot tell what
+	 * changed between two different runs.
+	 */
+	*journal_id = 0;
+	*journal_pos = 0;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+#if HAVE_IO_URING
+/**
+ * Mapping of an io_uring instance.
+ */
+struct uring {
+	int fd; /**< Ring file descriptor. */
+	unsigned entries; /**< Number of submission entries. */
+	void* sq_ptr; /**< Submission ring mapping. */
+	size_t sq_size; /**< Size of the submission ring mapping. */
+	void* cq_ptr; /**< Completion ring mapping. It may be equal at ::sq_ptr. */
+	size_t cq_size; /**< Size of the completion ring mapping. */
+	struct io_uring_sqe* sqe; /**< Submission entries. */
+	size_t sqe_size; /**< Size of the submission entries mapping. */
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqe;
+};
+
+/**
+ * Create and map an io_uring instance.
+ * Return -1 if not supported, or disabled.
+ */
+static int uring_open(struct uring* ring, unsigned entries)
+{
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+
+	fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0)
+		return -1; /* not supported, or disabled */
+
+	ring->fd = fd;
+	ring->entries = p.sq_entries;
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		if (ring->cq_size > ring->sq_size)
+			ring->sq_size = ring->cq_size;
+		ring->cq_size = ring->sq_size;
+	}
+	ring->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ptr = mmap(0, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		/* LCOV_EXCL_START */
+		close(fd);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(0, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			/* LCOV_EXCL_START */
+			munmap(ring->sq_ptr, ring->sq_size);
+			close(fd);
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	ring->sqe = mmap(0, ring->sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqe == MAP_FAILED) {
+		/* LCOV_EXCL_START */
+		if (ring->cq_ptr != ring->sq_ptr)
+			munmap(ring->cq_ptr, ring->cq_size);
+		munmap(ring->sq_ptr, ring->sq_size);
+		close(fd);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	ring->sq_tail = (unsigned*)((char*)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned*)((char*)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)((char*)ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned*)((char*)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned*)((char*)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned*)((char*)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqe = (struct io_uring_cqe*)((char*)ring->cq_ptr + p.cq_off.cqes);
+
+	return 0;
+}
+
+/**
+ * Unmap and close an io_uring instance.
+ */
+static void uring_close(struct uring* ring)
+{
+	munmap(ring->sqe, ring->sqe_size);
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+#endif
+
+#if HAVE_IO_URING_STATX
+/**
+ * Number of requests submitted at the same time.
+ */
+#define LSTAT_BATCH_MAX 64
+
+/**
+ * Fields of statx() required.
+ */
+#define LSTAT_BATCH_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_MTIME)
+
+struct lstat_batch {
+	struct uring ring; /**< Ring used to submit the requests. */
+	struct statx stx[LSTAT_BATCH_MAX]; /**< Results of statx(). */
+};
+
+struct lstat_batch* lstat_batch_alloc(void)
+{
+	struct lstat_batch* batch;
+
+	batch = malloc_nofail(sizeof(struct lstat_batch));
+
+	if (uring_open(&batch->ring, LSTAT_BATCH_MAX) != 0) {
+		free(batch);
+		return 0;
+	}
+
+	return batch;
+}
+
+void lstat_batch_free(struct lstat_batch* batch)
+{
+	uring_close(&batch->ring);
+	free(batch);
+}
+
+/**
+ * Convert the statx() result to the stat one.
+ */
+static int lstat_batch_convert(struct statx* stx, struct stat* st)
+{
+	/* some file-systems may not report all the fields */
+	if ((stx->stx_mask & LSTAT_BATCH_MASK) != LSTAT_BATCH_MASK)
+		return ENODATA;
+
+	memset(st, 0, sizeof(struct stat));
+	st->st_mode = stx->stx_mode;
+	st->st_ino = stx->stx_ino;
+	st->st_nlink = stx->stx_nlink;
+	st->st_size = stx->stx_size;
+	st->st_mtime = stx->stx_mtime.tv_sec;
+#if HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+#endif
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+
+	return 0;
+}
+
+/**
+ * Submit and wait the completion of a group of statx() requests.
+ */
+static int lstat_batch_group(struct lstat_batch* batch, int dir_fd, unsigned count, const char** name, struct stat* st, int* result)
+{
+	unsigned tail;
+	unsigned mask;
+	unsigned submitted;
+	unsigned completed;
+	unsigned i;
+
+	tail = *batch->ring.sq_tail;
+	mask = *batch->ring.sq_mask;
+	for (i = 0; i < count; ++i) {
+		unsigned index = (tail + i) & mask;
+		struct io_uring_sqe* sqe = &batch->ring.sqe[index];
+
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = dir_fd;
+		sqe->addr = (uintptr_t)name[i];
+		sqe->len = LSTAT_BATCH_MASK;
+		sqe->off = (uintptr_t)&batch->stx[i];
+		sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+		sqe->user_data = i;
+
+		batch->ring.sq_array[index] = index;
+	}
+
+	/* publish the entries to the kernel */
+	__atomic_store_n(batch->ring.sq_tail, tail + count, __ATOMIC_RELEASE);
+
+	submitted = 0;
+	completed = 0;
+	while (completed < count) {
+		unsigned head;
+		int ret;
+
+		ret = syscall(__NR_io_uring_enter, batch->ring.fd, count - submitted, 1, IORING_ENTER_GETEVENTS, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* if nothing is submitted, we can still give up */
+			if (submitted == 0) {
+				/* remove the entries not seen by the kernel */
+				__atomic_store_n(batch->ring.sq_tail, tail, __ATOMIC_RELEASE);
+				return -1;
+			}
+
+			/* LCOV_EXCL_START */
+			log_fatal("Error waiting io_uring completion. %s.\n", strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		submitted += ret;
+
+		/* collect the completions */
+		head = *batch->ring.cq_head;
+		while (head != __atomic_load_n(batch->ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe* cqe = &batch->ring.cqe[head & *batch->ring.cq_mask];
+			unsigned j = cqe->user_data;
+
+			if (cqe->res < 0)
+				result[j] = -cqe->res;
+			else
+				result[j] = lstat_batch_convert(&batch->stx[j], &st[j]);
+
+			++head;
+			++completed;
+		}
+		__atomic_store_n(batch->ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+int lstat_batch(struct lstat_batch* batch, const char* dir, unsigned count, const char** name, struct stat* st, int* result)
+{
+	int dir_fd;
+	unsigned i;
+
+	dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (dir_fd < 0)
+		return -1;
+
+	for (i = 0; i < count; i += LSTAT_BATCH_MAX) {
+		unsigned run = count - i;
+		if (run > LSTAT_BATCH_MAX)
+			run = LSTAT_BATCH_MAX;
+
+		if (lstat_batch_group(batch, dir_fd, run, name + i, st + i, result + i) != 0) {
+			close(dir_fd);
+			return -1;
+		}
+	}
+
+	close(dir_fd);
+	return 0;
+}
+#else
+struct lstat_batch* lstat_batch_alloc(void)
+{
+	return 0;
+}
+
+void lstat_batch_free(struct lstat_batch* batch)
+{
+	(void)batch;
+}
+
+int lstat_batch(struct lstat_batch* batch, const char* dir, unsigned count, const char** name, struct stat* st, int* result)
+{
+	(void)batch;
+	(void)dir;
+	(void)count;
+	(void)name;
+	(void)st;
+	(void)result;
+
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+#if HAVE_IO_URING
+struct aio_ring {
+	struct uring ring; /**< Ring used to submit the requests. */
+	unsigned queued; /**< Requests queued, and not yet submitted. */
+	unsigned pending; /**< Requests queued or submitted, and not yet completed. */
+	int fixed; /**< If the buffers are registered in the kernel. */
+	struct iovec* iov; /**< Buffers usable for the requests. */
+	unsigned iov_max; /**< Number of buffers. */
+};
+
+struct aio_ring* aio_ring_alloc(unsigned depth)
+{
+	struct aio_ring* aio;
+
+	aio = malloc_nofail(sizeof(struct aio_ring));
+
+	if (uring_open(&aio->ring, depth) != 0) {
+		free(aio);
+		return 0;
+	}
+
+	aio->queued = 0;
+	aio->pending = 0;
+	aio->fixed = 0;
+	aio->iov = 0;
+	aio->iov_max = 0;
+
+	return aio;
+}
+
+void aio_ring_free(struct aio_ring* aio)
+{
+	/* the registered buffers are released with the ring */
+	uring_close(&aio->ring);
+	free(aio->iov);
+	free(aio);
+}
+
+int aio_ring_register(struct aio_ring* aio, void** buffer, unsigned count, size_t size)
+{
+	unsigned i;
+	int ret;
+
+	free(aio->iov);
+	aio->iov = malloc_nofail(count * sizeof(struct iovec));
+	aio->iov_max = count;
+	for (i = 0; i < count; ++i) {
+		aio->iov[i].iov_base = buffer[i];
+		aio->iov[i].iov_len = size;
+	}
+
+	/* registering pins the memory, and it may fail for the locked memory limit */
+	ret = syscall(__NR_io_uring_register, aio->ring.fd, IORING_REGISTER_BUFFERS, aio->iov, count);
+	if (ret < 0) {
+		/* use not registered buffers */
+		aio->fixed = 0;
+		return -1;
+	}
+
+	aio->fixed = 1;
+	return 0;
+}
+
+int aio_ring_queue(struct aio_ring* aio, int write, int f, unsigned index, data_off_t offset, uint64_t user_data)
+{
+	unsigned tail;
+	unsigned slot;
+	struct io_uring_sqe* sqe;
+
+	assert(index < aio->iov_max);
+
+	/* the completion ring is always larger, so checking the submission one is enough */
+	if (aio->pending >= aio->ring.entries)
+		return -1;
+
+	tail = *aio->ring.sq_tail;
+	slot = tail & *aio->ring.sq_mask;
+	sqe = &aio->ring.sqe[slot];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	if (aio->fixed) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->addr = (uintptr_t)aio->iov[index].iov_base;
+		sqe->len = aio->iov[index].iov_len;
+		sqe->buf_index = index;
+	} else {
+		sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr = (uintptr_t)&aio->iov[index];
+		sqe->len = 1;
+	}
+	sqe->fd = f;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+
+	aio->ring.sq_array[slot] = slot;
+
+	/* publish the entry to the kernel */
+	__atomic_store_n(aio->ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	++aio->queued;
+	++aio->pending;
+
+	return 0;
+}
+
+/**
+ * Submit the queued requests, and optionally wait for one completion.
+ */
+static void aio_ring_enter(struct aio_ring* aio, int wait)
+{
+	while (aio->queued != 0 || wait) {
+		unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+		int ret;
+
+		ret = syscall(__NR_io_uring_enter, aio->ring.fd, aio->queued, wait ? 1 : 0, flags, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+
+			/* LCOV_EXCL_START */
+			log_fatal("Error submitting io_uring requests. %s.\n", strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		aio->queued -= ret;
+
+		/* waiting is completed when the kernel processed the submission */
+		if (aio->queued == 0)
+			break;
+	}
+}
+
+void aio_ring_submit(struct aio_ring* aio)
+{
+	aio_ring_enter(aio, 0);
+}
+
+int aio_ring_wait(struct aio_ring* aio, int wait, uint64_t* user_data, int* result)
+{
+	unsigned head;
+	struct io_uring_cqe* cqe;
+
+	if (aio->pending == 0)
+		return 0;
+
+	head = *aio->ring.cq_head;
+	if (head == __atomic_load_n(aio->ring.cq_tail, __ATOMIC_ACQUIRE)) {
+		if (!wait) {
+			/* submit anyway, to not delay the requests */
+			aio_ring_enter(aio, 0);
+			return 0;
+		}
+
+		do {
+			aio_ring_enter(aio, 1);
+		} while (head == __atomic_load_n(aio->ring.cq_tail, __ATOMIC_ACQUIRE));
+	}
+
+	cqe = &aio->ring.cqe[head & *aio->ring.cq_mask];
+	*user_data = cqe->user_data;
+	*result = cqe->res;
+
+	__atomic_store_n(aio->ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+	--aio->pending;
+
+	return 1;
+}
+#else
+struct aio_ring* aio_ring_alloc(unsigned depth)
+{
+	(void)depth;
+
+	return 0;
+}
+
+void aio_ring_free(struct aio_ring* aio)
+{
+	(void)aio;
+}
+
+int aio_ring_register(struct aio_ring* aio, void** buffer, unsigned count, size_t size)
+{
+	(void)aio;
+	(void)buffer;
+	(void)count;
+	(void)size;
+
+	return -1;
+}
+
+int aio_ring_queue(struct aio_ring* aio, int write, int f, unsigned index, data_off_t offset, uint64_t user_data)
+{
+	(void)aio;
+	(void)write;
+	(void)f;
+	(void)index;
+	(void)offset;
+	(void)user_data;
+
+	return -1;
+}
+
+void aio_ring_submit(struct aio_ring* aio)
+{
+	(void)aio;
+}
+
+int aio_ring_wait(struct aio_ring* aio, int wait, uint64_t* user_data, int* result)
+{
+	(void)aio;
+	(void)wait;
+	(void)user_data;
+	(void)result;
+
+	return 0;
+}
+#endif
+
 uint64_t tick(void)
 {
 #if HAVE_MACH_ABSOLUTE_TIME
@@ -798,6 +1433,25 @@ uint64_t tick(void)
 #endif
 }
 
+uint64_t tick_freq(void)
+{
+#if HAVE_MACH_ABSOLUTE_TIME
+	/* for Mac OS X */
+	mach_timebase_info_data_t info;
+
+	if (mach_timebase_info(&info) != 0 || info.numer == 0)
+		return 1000000000ULL;
+
+	return 1000000000ULL * info.denom / info.numer;
+#elif HAVE_CLOCK_GETTIME && (defined(CLOCK_MONOTONIC) || defined(CLOCK_MONOTONIC_RAW))
+	/* for Linux */
+	return 1000000000ULL;
+#else
+	/* other platforms */
+	return 1000000ULL;
+#endif
+}
+
 uint64_t tick_ms(void)
 {
 	struct timeval tv;
@@ -808,6 +1462,277 @@ uint64_t tick_ms(void)
 	return tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
 }
 
+void sleep_ms(unsigned ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+
+	/* restart if interrupted by a signal */
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		;
+}
+
+int ioprio_idle(void)
+{
+#if defined(__NR_ioprio_set)
+	/* values from the kernel include/uapi/linux/ioprio.h */
+	const int ioprio_who_process = 1;
+	const int ioprio_class_idle = 3;
+	const int ioprio_class_shift = 13;
+
+	/* the pid 0 is the calling thread, and the new threads inherit it */
+	if (syscall(__NR_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift) != 0)
+		return -1;
+
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int madvise_huge(void* ptr, size_t size)
+{
+#if defined(MADV_HUGEPAGE)
+	/* transparent huge pages, used only if enabled in the kernel */
+	return madvise(ptr, size, MADV_HUGEPAGE);
+#else
+	(void)ptr;
+	(void)size;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+unsigned open_max(void)
+{
+#if HAVE_GETRLIMIT && defined(RLIMIT_NOFILE)
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY)
+		return 0;
+
+	if (rl.rlim_cur > UINT_MAX)
+		return UINT_MAX;
+
+	return rl.rlim_cur;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Max number of NUMA nodes and CPUs supported.
+ */
+#define NUMA_MASK_MAX 1024
+
+/**
+ * Read a small file of sysfs, removing the trailing newline.
+ * Return !=0 on error.
+ */
+#if HAVE_LINUX_DEVICE
+static int sysread(const char* path, char* buf, size_t size)
+{
+	int f;
+	int len;
+
+	f = open(path, O_RDONLY);
+	if (f == -1)
+		return -1;
+
+	len = read(f, buf, size - 1);
+
+	close(f);
+
+	if (len < 0)
+		return -1;
+
+	while (len > 0 && isspace((unsigned char)buf[len - 1]))
+		--len;
+	buf[len] = 0;
+
+	return 0;
+}
+#endif
+
+int devnuma(uint64_t device)
+{
+#if HAVE_LINUX_DEVICE
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+	char buf[32];
+	char* slash;
+	int node;
+
+	pathprint(path, sizeof(path), "/sys/dev/block/%u:%u", major(device), minor(device));
+
+	if (realpath(path, real) == 0) {
+		log_tag("numa:%u:%u: failed to resolve '%s'\n", major(device), minor(device), path);
+		return -1;
+	}
+
+	/* the first parent with a NUMA node is the controller of the device */
+	while ((slash = strrchr(real, '/')) != 0 && slash != real) {
+		pathprint(path, sizeof(path), "%s/numa_node", real);
+
+		if (sysread(path, buf, sizeof(buf)) == 0) {
+			node = atoi(buf);
+
+			log_tag("numa:%u:%u: node %d from '%s'\n", major(device), minor(device), node, path);
+
+			/* -1 if the system is not NUMA */
+			if (node < 0 || node >= NUMA_MASK_MAX)
+				return -1;
+
+			return node;
+		}
+
+		*slash = 0;
+	}
+
+	log_tag("numa:%u:%u: no node for '%s'\n", major(device), minor(device), real);
+	return -1;
+#else
+	(void)device;
+	return -1;
+#endif
+}
+
+int devcontroller(uint64_t device, char* name, size_t size)
+{
+#if HAVE_LINUX_DEVICE
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+	char subsystem[PATH_MAX];
+	char* slash;
+
+	pathprint(path, sizeof(path), "/sys/dev/block/%u:%u", major(device), minor(device));
+
+	if (realpath(path, real) == 0) {
+		log_tag("controller:%u:%u: failed to resolve '%s'\n", major(device), minor(device), path);
+		return -1;
+	}
+
+	/* the first parent on the PCI bus is the controller of the device */
+	while ((slash = strrchr(real, '/')) != 0 && slash != real) {
+		pathprint(path, sizeof(path), "%s/subsystem", real);
+
+		if (realpath(path, subsystem) != 0 && strcmp(strrchr(subsystem, '/'), "/pci") == 0) {
+			pathcpy(name, size, slash + 1);
+
+			log_tag("controller:%u:%u: %s\n", major(device), minor(device), name);
+
+			return 0;
+		}
+
+		*slash = 0;
+	}
+
+	log_tag("controller:%u:%u: no controller\n", major(device), minor(device));
+	return -1;
+#else
+	(void)device;
+	(void)name;
+	(void)size;
+	return -1;
+#endif
+}
+
+int numa_thread(int node)
+{
+#if HAVE_LINUX_DEVICE && defined(__NR_sched_setaffinity)
+	const unsigned bits = sizeof(unsigned long) * 8;
+	unsigned long mask[NUMA_MASK_MAX / (sizeof(unsigned long) * 8)];
+	char path[PATH_MAX];
+	char buf[4096];
+	char* p;
+
+	pathprint(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+	if (sysread(path, buf, sizeof(buf)) != 0)
+		return -1;
+
+	/* the list is in the format 0-7,16-23 */
+	memset(mask, 0, sizeof(mask));
+	p = buf;
+	while (*p) {
+		char* e;
+		unsigned long first;
+		unsigned long last;
+		unsigned long i;
+
+		first = strtoul(p, &e, 10);
+		if (e == p)
+			break;
+
+		last = first;
+		if (*e == '-') {
+			p = e + 1;
+			last = strtoul(p, &e, 10);
+			if (e == p)
+				break;
+		}
+
+		for (i = first; i <= last && i < NUMA_MASK_MAX; ++i)
+			mask[i / bits] |= 1UL << (i % bits);
+
+		if (*e == ',')
+			++e;
+		p = e;
+	}
+
+	/* the pid 0 is the calling thread */
+	if (syscall(__NR_sched_setaffinity, 0, sizeof(mask), mask) != 0)
+		return -1;
+
+	return 0;
+#else
+	(void)node;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int numa_memory(void* ptr, size_t size, int node)
+{
+#if defined(__NR_mbind)
+	/* values from the kernel include/uapi/linux/mempolicy.h */
+	const int mpol_preferred = 1;
+	const unsigned mpol_mf_move = 1 << 1;
+	const unsigned bits = sizeof(unsigned long) * 8;
+	unsigned long mask[NUMA_MASK_MAX / (sizeof(unsigned long) * 8)];
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t begin = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+	uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+
+	if (node < 0 || node >= NUMA_MASK_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* nothing to move, if smaller than a page */
+	if (begin >= end)
+		return 0;
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / bits] |= 1UL << (node % bits);
+
+	/* the kernel uses one bit less than the one specified */
+	if (syscall(__NR_mbind, begin, end - begin, mpol_preferred, mask, NUMA_MASK_MAX + 1, mpol_mf_move) != 0)
+		return -1;
+
+	return 0;
+#else
+	(void)ptr;
+	(void)size;
+	(void)node;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 int randomize(void* ptr, size_t size)
 {
 	int f;
@@ -1320,33 +2245,67 @@ static void* thread_smart(void* arg)
 #endif
 }
 
-static int device_thread(tommy_list* list, void* (*func)(void* arg))
+/**
+ * Run the function for each device in a separate thread.
+ * If max is not 0, at most max threads are running at the same time.
+ */
+static int device_thread(tommy_list* list, void* (*func)(void* arg), unsigned max)
 {
 	int fail = 0;
 	tommy_node* i;
 
 #if HAVE_PTHREAD
-	/* start all threads */
+	tommy_node* j;
+	unsigned running;
+
+	/* start all threads, waiting for the oldest one when too many are running */
+	running = 0;
+	j = tommy_list_head(list);
 	for (i = tommy_list_head(list); i != 0; i = i->next) {
 		devinfo_t* devinfo = i->data;
 
+		if (devinfo->skip)
+			continue;
+
+		if (max != 0 && running == max) {
+			void* retval;
+
+			while (((devinfo_t*)j->data)->skip)
+				j = j->next;
+
+			thread_join(((devinfo_t*)j->data)->thread, &retval);
+			if (retval != 0)
+				++fail;
+
+			j = j->next;
+			--running;
+		}
+
 		thread_create(&devinfo->thread, 0, func, devinfo);
+		++running;
 	}
 
-	/* join all threads */
-	for (i = tommy_list_head(list); i != 0; i = i->next) {
-		devinfo_t* devinfo = i->data;
+	/* join the remaining threads */
+	for (; j != 0; j = j->next) {
+		devinfo_t* devinfo = j->data;
 		void* retval;
 
+		if (devinfo->skip)
+			continue;
+
 		thread_join(devinfo->thread, &retval);
 
 		if (retval != 0)
 			++fail;
 	}
 #else
+	(void)max;
 	for (i = tommy_list_head(list); i != 0; i = i->next) {
 		devinfo_t* devinfo = i->data;
 
+		if (devinfo->skip)
+			continue;
+
 		if (func(devinfo) != 0)
 			++fail;
 	}
@@ -1363,7 +2322,6 @@ static int device_thread(tommy_list* list, void* (*func)(void* arg))
 int devquery(tommy_list* high, tommy_list* low, int operation, int others)
 {
 	tommy_node* i;
-	void* (*func)(void* arg) = 0;
 
 #if HAVE_LINUX_DEVICE
 	if (operation != DEVICE_UP) {
@@ -1442,16 +2400,18 @@ int devquery(tommy_list* high, tommy_list* low, int operation, int others)
 	(void)others;
 #endif
 
+	return devoperate(low, operation);
+}
+
+int devoperate(tommy_list* low, int operation)
+{
 	switch (operation) {
-	case DEVICE_UP : func = thread_spinup; break;
-	case DEVICE_DOWN : func = thread_spindown; break;
-	case DEVICE_SMART : func = thread_smart; break;
+	case DEVICE_UP : return device_thread(low, thread_spinup, 0);
+	case DEVICE_DOWN : return device_thread(low, thread_spindown, 0);
+	case DEVICE_SMART : return device_thread(low, thread_smart, DEVICE_SMART_MAX);
 	}
 
-	if (!func)
-		return 0;
-
-	return device_thread(low, func);
+	return 0;
 }
 
 void os_init(int opt)
@@ -1464,6 +2424,9 @@ void os_init(int opt)
 		log_fatal("WARNING Failed to get blkid cache\n");
 		/* LCOV_EXCL_STOP */
 	}
+#if HAVE_PTHREAD
+	thread_mutex_init(&cache_mutex, 0);
+#endif
 #endif
 
 	(void)opt;
@@ -1474,6 +2437,9 @@ void os_done(void)
 #if HAVE_BLKID
 	if (cache != 0)
 		blkid_put_cache(cache);
+#if HAVE_PTHREAD
+	thread_mutex_destroy(&cache_mutex);
+#endif
 #endif
 }
 
@@ -23,6 +23,14 @@
 #define HAVE_DIRECT_IO 1 /**< Support O_DIRECT in open(). */
 #endif
 
+#if HAVE_LINUX_IO_URING_H && HAVE_SYS_MMAN_H && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1 /**< Support io_uring. */
+#endif
+
+#if HAVE_IO_URING && HAVE_DECL_IORING_OP_STATX && HAVE_STRUCT_STATX
+#define HAVE_IO_URING_STATX 1 /**< Support statx() with io_uring. */
+#endif
+
 #define O_BINARY 0 /**< Not used in Unix. */
 #define O_SEQUENTIAL 0 /**< In Unix posix_fadvise() shall be used. */
 
@@ -20,6 +20,7 @@
 #include "support.h"
 #include "util.h"
 #include "raid/cpu.h"
+#include "raid/internal.h"
 #include "raid/memory.h"
 
 /****************************************************************************/
@@ -89,6 +90,41 @@ void** malloc_nofail_vector_direct(int nd, int n, size_t size, void** freeptr)
 	return ptr;
 }
 
+void** malloc_nofail_vector_huge(int nd, int n, size_t size, int direct, void** freeptr, int* huge)
+{
+	void** ptr;
+	size_t displacement;
+	unsigned char* base;
+	size_t len;
+	int i;
+
+	/* the direct io doesn't allow the displacement */
+	displacement = direct ? 0 : RAID_MALLOC_DISPLACEMENT;
+
+	ptr = raid_malloc_vector_align(nd, n, size, RAID_MALLOC_HUGE, displacement, freeptr);
+
+	if (!ptr) {
+		/* LCOV_EXCL_START */
+		malloc_fail(n * size);
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* the start of the memory, as the data blocks are in reverse order */
+	base = ptr[0];
+	for (i = 1; i < n; ++i)
+		if ((unsigned char*)ptr[i] < base)
+			base = ptr[i];
+
+	/* advise only the full huge pages, as the tail is not aligned */
+	len = n * (size + displacement);
+	len -= len % RAID_MALLOC_HUGE;
+
+	*huge = len != 0 && madvise_huge(base, len) == 0;
+
+	return ptr;
+}
+
 void* malloc_nofail_test(size_t size)
 {
 	void* ptr;
@@ -141,6 +177,164 @@ void mtest_vector(int n, size_t size, void** vv)
 	}
 }
 
+/****************************************************************************/
+/* arena */
+
+/**
+ * Size of the chunks of the arena.
+ */
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * Header of the chunks, keeping the data aligned.
+ */
+#define ARENA_CHUNK_HEADER ((sizeof(void*) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/**
+ * Header of the big allocations.
+ */
+struct snapraid_arena_large {
+	struct snapraid_arena_large* next;
+	struct snapraid_arena_large* prev;
+};
+
+#define ARENA_LARGE_HEADER ((sizeof(struct snapraid_arena_large) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static inline size_t arena_size(size_t size)
+{
+	if (size == 0)
+		size = 1;
+
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(struct snapraid_arena* arena)
+{
+	unsigned i;
+
+	arena->chunk = 0;
+	arena->pos = 0;
+	arena->end = 0;
+	for (i = 0; i < sizeof(arena->freelist) / sizeof(arena->freelist[0]); ++i)
+		arena->freelist[i] = 0;
+	arena->large = 0;
+	arena->used = 0;
+	arena->reserved = 0;
+}
+
+void arena_done(struct snapraid_arena* arena)
+{
+	while (arena->chunk) {
+		void* next = *(void**)arena->chunk;
+		free(arena->chunk);
+		arena->chunk = next;
+	}
+
+	while (arena->large) {
+		struct snapraid_arena_large* next = arena->large->next;
+		free(arena->large);
+		arena->large = next;
+	}
+
+	arena_init(arena);
+}
+
+void* arena_alloc(struct snapraid_arena* arena, size_t size)
+{
+	unsigned char* ptr;
+
+	size = arena_size(size);
+
+	if (size > ARENA_SMALL_MAX) {
+		struct snapraid_arena_large* large;
+
+		arena->used += size;
+		arena->reserved += ARENA_LARGE_HEADER + size;
+
+		large = malloc_nofail(ARENA_LARGE_HEADER + size);
+		large->prev = 0;
+		large->next = arena->large;
+		if (arena->large)
+			arena->large->prev = large;
+		arena->large = large;
+
+		return (unsigned char*)large + ARENA_LARGE_HEADER;
+	}
+
+	arena->used += size;
+
+	/* reuse a released object of the same size */
+	ptr = arena->freelist[size / ARENA_ALIGN];
+	if (ptr) {
+		arena->freelist[size / ARENA_ALIGN] = *(void**)ptr;
+		return ptr;
+	}
+
+	/* if not enough space, get a new chunk, wasting the rest of the current one */
+	if (arena->pos + size > arena->end) {
+		void* chunk = malloc_nofail(ARENA_CHUNK_SIZE);
+
+		*(void**)chunk = arena->chunk;
+		arena->chunk = chunk;
+		arena->pos = (unsigned char*)chunk + ARENA_CHUNK_HEADER;
+		arena->end = (unsigned char*)chunk + ARENA_CHUNK_SIZE;
+		arena->reserved += ARENA_CHUNK_SIZE;
+	}
+
+	ptr = arena->pos;
+	arena->pos += size;
+
+	return ptr;
+}
+
+void arena_free(struct snapraid_arena* arena, void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	size = arena_size(size);
+
+	arena->used -= size;
+
+	if (size > ARENA_SMALL_MAX) {
+		struct snapraid_arena_large* large = (void*)((unsigned char*)ptr - ARENA_LARGE_HEADER);
+
+		arena->reserved -= ARENA_LARGE_HEADER + size;
+
+		if (large->prev)
+			large->prev->next = large->next;
+		else
+			arena->large = large->next;
+		if (large->next)
+			large->next->prev = large->prev;
+
+		free(large);
+		return;
+	}
+
+	/* keep it for the next allocation of the same size */
+	*(void**)ptr = arena->freelist[size / ARENA_ALIGN];
+	arena->freelist[size / ARENA_ALIGN] = ptr;
+}
+
+char* arena_strdup(struct snapraid_arena* arena, const char* str)
+{
+	size_t size = strlen(str) + 1;
+	char* ptr = arena_alloc(arena, size);
+
+	memcpy(ptr, str, size);
+
+	return ptr;
+}
+
+void arena_strfree(struct snapraid_arena* arena, char* str)
+{
+	if (!str)
+		return;
+
+	arena_free(arena, str, strlen(str) + 1);
+}
+
 /****************************************************************************/
 /* crc */
 
@@ -416,6 +610,10 @@ uint32_t CRC32C_3[256] = {
 int crc_x86;
 #endif
 
+#if HAVE_ARM64_CRC32
+int crc_arm64;
+#endif
+
 uint32_t crc32c_gen(uint32_t crc, const unsigned char* ptr, unsigned size)
 {
 	crc ^= CRC_IV;
@@ -440,6 +638,124 @@ uint32_t crc32c_x86(uint32_t crc, const unsigned char* ptr, unsigned size)
 }
 #endif
 
+#if HAVE_SSE42 && defined(CONFIG_X86_64)
+/**
+ * Lengths of the blocks computed in three interleaved streams.
+ *
+ * The crc32 instruction has a latency of three cycles but a throughput of one
+ * per cycle, so three independent streams keep the unit busy.
+ */
+#define CRC_X86X3_LONG 4096
+#define CRC_X86X3_SHORT 256
+
+/**
+ * Constants to shift a CRC over one and two blocks.
+ *
+ * Index 0/1 are for the long block, 2/3 for the short one.
+ */
+static uint32_t crc_x86x3_k[4];
+
+/**
+ * Compute x^n mod P in the reflected representation.
+ */
+static uint32_t crc32c_xpow(unsigned n)
+{
+	uint32_t v = 0x80000000; /* x^0 */
+
+	while (n) {
+		if (v & 1)
+			v = (v >> 1) ^ 0x82F63B78;
+		else
+			v >>= 1;
+		--n;
+	}
+
+	return v;
+}
+
+/**
+ * Get the constant to shift a CRC over the specified number of bytes.
+ *
+ * The carry-less product of two reflected 32 bits values is shifted by
+ * one bit, and the final crc32q adds another x^32, hence the -33.
+ */
+static uint32_t crc32c_x86x3_constant(unsigned size)
+{
+	return crc32c_xpow(size * 8 - 33);
+}
+
+/**
+ * Shift the CRC as if the specified constant number of zero bytes were processed.
+ */
+static inline uint32_t crc32c_x86x3_shift(uint32_t crc, uint32_t k)
+{
+	uint64_t v;
+	uint64_t r = 0;
+
+	asm ("movd %1, %%xmm0\n\tmovd %2, %%xmm1\n\tpclmulqdq $0x00, %%xmm1, %%xmm0\n\tmovq %%xmm0, %0\n" : "=r" (v) : "r" (crc), "r" (k) : "xmm0", "xmm1");
+	asm ("crc32q %1, %0\n" : "+r" (r) : "r" (v));
+
+	return r;
+}
+
+/**
+ * Process three consecutive blocks of the specified size as independent streams.
+ */
+static inline uint32_t crc32c_x86x3_block(uint32_t crc, const unsigned char* ptr, unsigned size, uint32_t k1, uint32_t k2)
+{
+	uint64_t a = crc;
+	uint64_t b = 0;
+	uint64_t c = 0;
+	const unsigned char* end = ptr + size;
+
+	while (ptr < end) {
+		asm ("crc32q %1, %0\n" : "+r" (a) : "m" (*(const uint64_t*)ptr));
+		asm ("crc32q %1, %0\n" : "+r" (b) : "m" (*(const uint64_t*)(ptr + size)));
+		asm ("crc32q %1, %0\n" : "+r" (c) : "m" (*(const uint64_t*)(ptr + 2 * size)));
+		ptr += 8;
+	}
+
+	/* combine the streams, the first is shifted over two blocks, the second over one */
+	return crc32c_x86x3_shift(a, k2) ^ crc32c_x86x3_shift(b, k1) ^ (uint32_t)c;
+}
+
+uint32_t crc32c_x86x3(uint32_t crc, const unsigned char* ptr, unsigned size)
+{
+	crc ^= CRC_IV;
+
+	while (size >= 3 * CRC_X86X3_LONG) {
+		crc = crc32c_x86x3_block(crc, ptr, CRC_X86X3_LONG, crc_x86x3_k[0], crc_x86x3_k[1]);
+		ptr += 3 * CRC_X86X3_LONG;
+		size -= 3 * CRC_X86X3_LONG;
+	}
+
+	while (size >= 3 * CRC_X86X3_SHORT) {
+		crc = crc32c_x86x3_block(crc, ptr, CRC_X86X3_SHORT, crc_x86x3_k[2], crc_x86x3_k[3]);
+		ptr += 3 * CRC_X86X3_SHORT;
+		size -= 3 * CRC_X86X3_SHORT;
+	}
+
+	crc = crc32c_x86_plain(crc, ptr, size);
+
+	crc ^= CRC_IV;
+
+	return crc;
+}
+#endif
+
+#if HAVE_ARM64_CRC32
+uint32_t crc32c_arm64(uint32_t crc, const unsigned char* ptr, unsigned size)
+{
+	crc ^= CRC_IV;
+
+	crc = crc32c_arm64_plain(crc, ptr, size);
+
+	crc ^= CRC_IV;
+
+	return crc;
+}
+#endif
+
 uint32_t (*crc32c)(uint32_t crc, const unsigned char* ptr, unsigned size);
 
 void crc32c_init(void)
@@ -451,6 +767,21 @@ void crc32c_init(void)
 		crc32c = crc32c_x86;
 	}
 #endif
+#if HAVE_SSE42 && defined(CONFIG_X86_64)
+	crc_x86x3_k[0] = crc32c_x86x3_constant(CRC_X86X3_LONG);
+	crc_x86x3_k[1] = crc32c_x86x3_constant(2 * CRC_X86X3_LONG);
+	crc_x86x3_k[2] = crc32c_x86x3_constant(CRC_X86X3_SHORT);
+	crc_x86x3_k[3] = crc32c_x86x3_constant(2 * CRC_X86X3_SHORT);
+	if (crc_x86 && raid_cpu_has_pclmul()) {
+		crc32c = crc32c_x86x3;
+	}
+#endif
+#if HAVE_ARM64_CRC32
+	if ((getauxval(AT_HWCAP) & HWCAP_CRC32) != 0) {
+		crc_arm64 = 1;
+		crc32c = crc32c_arm64;
+	}
+#endif
 }
 
 /****************************************************************************/
@@ -572,6 +903,12 @@ static inline void util_write64(void* ptr, uint64_t v)
 #include "murmur3.c"
 #include "spooky2.c"
 #include "metro.c"
+#include "xxh3.c"
+#include "sha256.c"
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+static int hash_avx2;
+#endif
 
 void memhash(unsigned kind, const unsigned char* seed, void* digest, const void* src, size_t size)
 {
@@ -585,6 +922,15 @@ void memhash(unsigned kind, const unsigned char* seed, void* digest, const void*
 	case HASH_METRO :
 		MetroHash128(src, size, seed, digest);
 		break;
+	case HASH_XXH3 :
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+		if (hash_avx2) {
+			XXH3_128_avx2(src, size, seed, digest);
+			break;
+		}
+#endif
+		XXH3_128(src, size, seed, digest);
+		break;
 	default :
 		/* LCOV_EXCL_START */
 		log_fatal("Internal inconsistency in hash function %u\n", kind);
@@ -594,6 +940,38 @@ void memhash(unsigned kind, const unsigned char* seed, void* digest, const void*
 	}
 }
 
+void memhash_init(void)
+{
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+	if (raid_cpu_has_avx2())
+		hash_avx2 = 1;
+#endif
+}
+
+void memhash_multi(unsigned kind, const unsigned char* seed, void** digest, const void** src, unsigned count, size_t size)
+{
+	unsigned i = 0;
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+	if (hash_avx2) {
+		switch (kind) {
+		case HASH_MURMUR3 :
+			for (; i + 8 <= count; i += 8)
+				MurmurHash3_x86_128_avx2x8(src + i, size, seed, digest + i);
+			break;
+		case HASH_SPOOKY2 :
+			for (; i + 4 <= count; i += 4)
+				SpookyHash128_avx2x4(src + i, size, seed, (uint8_t* const*)digest + i);
+			break;
+		}
+	}
+#endif
+
+	/* process the remaining blocks one at time */
+	for (; i < count; ++i)
+		memhash(kind, seed, digest[i], src[i], size);
+}
+
 const char* hash_config_name(unsigned kind)
 {
 	switch (kind) {
@@ -601,6 +979,7 @@ const char* hash_config_name(unsigned kind)
 	case HASH_MURMUR3 : return "murmur3";
 	case HASH_SPOOKY2 : return "spooky2";
 	case HASH_METRO : return "metro";
+	case HASH_XXH3 : return "xxh3";
 	default :
 		/* LCOV_EXCL_START */
 		return "unknown";
@@ -608,25 +987,169 @@ const char* hash_config_name(unsigned kind)
 	}
 }
 
-unsigned memdiff(const unsigned char* data1, const unsigned char* data2, size_t size)
+unsigned hash_config_kind(const char* name)
 {
+	if (strcmp(name, "murmur3") == 0)
+		return HASH_MURMUR3;
+	if (strcmp(name, "spooky2") == 0)
+		return HASH_SPOOKY2;
+	if (strcmp(name, "metro") == 0)
+		return HASH_METRO;
+	if (strcmp(name, "xxh3") == 0)
+		return HASH_XXH3;
+	return HASH_UNDEFINED;
+}
+
+/**
+ * Count the bits set in a 64 bits word.
+ */
+static inline unsigned popcount64(uint64_t v)
+{
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (v * 0x0101010101010101ULL) >> 56;
+}
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+/* bits set in each nibble, replicated for the two lanes of vpshufb */
+static const unsigned char memdiff_avx2_nibble[32] = {
+	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
+
+static const unsigned char memdiff_avx2_mask[32] = {
+	0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+	0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F
+};
+
+/*
+ * Count the different bits of the 32 bytes chunks with AVX2.
+ *
+ * The bits of each nibble are counted with a vpshufb lookup in ymm7,
+ * and the byte counts are summed in the four 64 bits lanes of ymm5.
+ */
+static size_t memdiff_avx2(const unsigned char* data1, const unsigned char* data2, size_t size, unsigned* count)
+{
+	uint64_t acc[4];
 	size_t i;
-	unsigned count;
-
-	count = 0;
-	for (i = 0; i < size; ++i) {
-		unsigned j;
-		unsigned char diff = data1[i] ^ data2[i];
-		for (j = 0; j < 8; ++j) {
-			if ((diff & 1) != 0)
-				++count;
-			diff >>= 1;
-		}
+
+	raid_avx_begin();
+
+	asm volatile ("vmovdqu %0,%%ymm7" : : "m" (memdiff_avx2_nibble[0]));
+	asm volatile ("vmovdqu %0,%%ymm6" : : "m" (memdiff_avx2_mask[0]));
+	asm volatile ("vpxor %ymm5,%ymm5,%ymm5");
+	asm volatile ("vpxor %ymm4,%ymm4,%ymm4");
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		asm volatile ("vmovdqu %0,%%ymm0" : : "m" (data1[i]));
+		asm volatile ("vpxor %0,%%ymm0,%%ymm0" : : "m" (data2[i]));
+		asm volatile ("vpsrlw $4,%ymm0,%ymm1");
+		asm volatile ("vpand %ymm6,%ymm0,%ymm0");
+		asm volatile ("vpand %ymm6,%ymm1,%ymm1");
+		asm volatile ("vpshufb %ymm0,%ymm7,%ymm0");
+		asm volatile ("vpshufb %ymm1,%ymm7,%ymm1");
+		asm volatile ("vpaddb %ymm1,%ymm0,%ymm0");
+		asm volatile ("vpsadbw %ymm4,%ymm0,%ymm0");
+		asm volatile ("vpaddq %ymm0,%ymm5,%ymm5");
+	}
+
+	asm volatile ("vmovdqu %%ymm5,%0" : "=m" (acc));
+
+	raid_avx_end();
+
+	*count = acc[0] + acc[1] + acc[2] + acc[3];
+
+	return i;
+}
+
+/*
+ * Check if the 128 bytes chunks are all zero with AVX2.
+ *
+ * Return the size checked, stopping at the first chunk not zero.
+ */
+static size_t memiszero_avx2(const unsigned char* data, size_t size)
+{
+	unsigned char nonzero = 0;
+	size_t i;
+
+	raid_avx_begin();
+
+	for (i = 0; i + 128 <= size; i += 128) {
+		asm volatile ("vmovdqu %0,%%ymm0" : : "m" (data[i]));
+		asm volatile ("vpor %0,%%ymm0,%%ymm0" : : "m" (data[i + 32]));
+		asm volatile ("vpor %0,%%ymm0,%%ymm0" : : "m" (data[i + 64]));
+		asm volatile ("vpor %0,%%ymm0,%%ymm0" : : "m" (data[i + 96]));
+		asm volatile ("vptest %%ymm0,%%ymm0\n\tsetnz %0" : "=q" (nonzero) : : "cc");
+		if (nonzero)
+			break;
+	}
+
+	raid_avx_end();
+
+	return i;
+}
+#endif
+
+unsigned memdiff(const unsigned char* data1, const unsigned char* data2, size_t size)
+{
+	size_t i = 0;
+	unsigned count = 0;
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+	if (hash_avx2 && size >= 32) {
+		/* the asm code reads the buffers as a whole, ensure they are stored */
+		asm volatile ("" : : : "memory");
+
+		i = memdiff_avx2(data1, data2, size, &count);
+	}
+#endif
+
+	for (; i + 8 <= size; i += 8) {
+		uint64_t v1;
+		uint64_t v2;
+		memcpy(&v1, data1 + i, 8);
+		memcpy(&v2, data2 + i, 8);
+		count += popcount64(v1 ^ v2);
 	}
 
+	for (; i < size; ++i)
+		count += popcount64(data1[i] ^ data2[i]);
+
 	return count;
 }
 
+int memiszero(const void* void_data, size_t size)
+{
+	const unsigned char* data = void_data;
+	size_t i = 0;
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+	if (hash_avx2 && size >= 128) {
+		/* the asm code reads the buffer as a whole, ensure it's stored */
+		asm volatile ("" : : : "memory");
+
+		i = memiszero_avx2(data, size);
+		if (i + 128 <= size)
+			return 0;
+	}
+#endif
+
+	/* without SIMD, OR words in a simple loop that the compiler can vectorize */
+	for (; i + 64 <= size; i += 64) {
+		uint64_t v[8];
+		memcpy(v, data + i, 64);
+		if ((v[0] | v[1] | v[2] | v[3] | v[4] | v[5] | v[6] | v[7]) != 0)
+			return 0;
+	}
+
+	for (; i < size; ++i)
+		if (data[i] != 0)
+			return 0;
+
+	return 1;
+}
+
 /****************************************************************************/
 /* lock */
 
@@ -44,6 +44,14 @@ void** malloc_nofail_vector_align(int nd, int n, size_t size, void** freeptr);
  */
 void** malloc_nofail_vector_direct(int nd, int n, size_t size, void** freeptr);
 
+/**
+ * Safe vector allocation backed by huge pages, if available.
+ * If direct is set, it's usable for direct io.
+ * The huge flag is set if the memory is advised to use huge pages.
+ * If no memory is available, it aborts.
+ */
+void** malloc_nofail_vector_huge(int nd, int n, size_t size, int direct, void** freeptr, int* huge);
+
 /**
  * Safe allocation with memory test.
  */
@@ -55,6 +63,74 @@ void* malloc_nofail_test(size_t size);
  */
 void mtest_vector(int n, size_t size, void** vv);
 
+/****************************************************************************/
+/* arena */
+
+/**
+ * Alignment of the arena allocations.
+ */
+#define ARENA_ALIGN 8
+
+/**
+ * Max size of the allocations served by the arena chunks.
+ * Bigger ones are allocated individually, but still released with the arena.
+ */
+#define ARENA_SMALL_MAX 512
+
+struct snapraid_arena_large;
+
+/**
+ * Arena allocator.
+ *
+ * Allocates the objects bump-allocating from big chunks of memory,
+ * without the overhead of a malloc() for each one, and it releases
+ * all of them at once with arena_done().
+ * The released objects are kept in a free list by size, and reused.
+ *
+ * It's not thread safe. Use a different arena for each thread.
+ */
+struct snapraid_arena {
+	void* chunk; /**< List of the allocated chunks. */
+	unsigned char* pos; /**< Free space in the current chunk. */
+	unsigned char* end; /**< End of the current chunk. */
+	void* freelist[ARENA_SMALL_MAX / ARENA_ALIGN + 1]; /**< Free objects indexed by size / ARENA_ALIGN. */
+	struct snapraid_arena_large* large; /**< List of the big allocations. */
+	size_t used; /**< Memory used by the objects not released. */
+	size_t reserved; /**< Memory taken from the system, including the free space. */
+};
+
+/**
+ * Initialize an empty arena.
+ */
+void arena_init(struct snapraid_arena* arena);
+
+/**
+ * Release all the memory of the arena.
+ */
+void arena_done(struct snapraid_arena* arena);
+
+/**
+ * Allocate memory from the arena.
+ * If no memory is available, it aborts.
+ */
+void* arena_alloc(struct snapraid_arena* arena, size_t size);
+
+/**
+ * Release memory to the arena.
+ * The size must be the same used to allocate it.
+ */
+void arena_free(struct snapraid_arena* arena, void* ptr, size_t size);
+
+/**
+ * Duplicate a string in the arena.
+ */
+char* arena_strdup(struct snapraid_arena* arena, const char* str);
+
+/**
+ * Release a string duplicated with arena_strdup().
+ */
+void arena_strfree(struct snapraid_arena* arena, char* str);
+
 /****************************************************************************/
 /* crc */
 
@@ -72,12 +148,25 @@ extern uint32_t CRC32C_1[256];
 extern uint32_t CRC32C_2[256];
 extern uint32_t CRC32C_3[256];
 
+/**
+ * If the aarch64 CRC instructions can be detected at runtime.
+ */
+#if defined(__aarch64__) && HAVE_GETAUXVAL && HAVE_SYS_AUXV_H
+#define HAVE_ARM64_CRC32 1
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
 /**
  * If the CPU support the CRC instructions.
  */
 #if HAVE_SSE42
 extern int crc_x86;
 #endif
+#if HAVE_ARM64_CRC32
+extern int crc_arm64;
+#endif
 
 /**
  * Compute CRC-32 (Castagnoli) for a single byte without the IV.
@@ -89,6 +178,12 @@ static inline uint32_t crc32c_plain_char(uint32_t crc, unsigned char c)
 		asm ("crc32b %1, %0\n" : "+r" (crc) : "m" (c));
 		return crc;
 	}
+#endif
+#if HAVE_ARM64_CRC32
+	if (tommy_likely(crc_arm64)) {
+		asm (".arch_extension crc\n\tcrc32cb %w0, %w0, %w1\n" : "+r" (crc) : "r" ((uint32_t)c));
+		return crc;
+	}
 #endif
 	return CRC32C_0[(crc ^ c) & 0xff] ^ (crc >> 8);
 }
@@ -145,6 +240,31 @@ static inline uint32_t crc32c_x86_plain(uint32_t crc, const unsigned char* ptr,
 }
 #endif
 
+/**
+ * Compute the CRC-32 (Castagnoli) without the IV.
+ */
+#if HAVE_ARM64_CRC32
+static inline uint32_t crc32c_arm64_plain(uint32_t crc, const unsigned char* ptr, unsigned size)
+{
+	/* the .arch_extension allows to use the CRC instructions */
+	/* without compiling all the program for a CPU that has them */
+	while (size >= 8) {
+		uint64_t v;
+		memcpy(&v, ptr, 8);
+		asm (".arch_extension crc\n\tcrc32cx %w0, %w0, %x1\n" : "+r" (crc) : "r" (v));
+		ptr += 8;
+		size -= 8;
+	}
+	while (size) {
+		asm (".arch_extension crc\n\tcrc32cb %w0, %w0, %w1\n" : "+r" (crc) : "r" ((uint32_t)*ptr));
+		++ptr;
+		--size;
+	}
+
+	return crc;
+}
+#endif
+
 /**
  * Compute CRC-32 (Castagnoli) without the IV.
  */
@@ -154,6 +274,11 @@ static inline uint32_t crc32c_plain(uint32_t crc, const unsigned char* ptr, unsi
 	if (tommy_likely(crc_x86)) {
 		return crc32c_x86_plain(crc, ptr, size);
 	}
+#endif
+#if HAVE_ARM64_CRC32
+	if (tommy_likely(crc_arm64)) {
+		return crc32c_arm64_plain(crc, ptr, size);
+	}
 #endif
 	return crc32c_gen_plain(crc, ptr, size);
 }
@@ -168,6 +293,8 @@ extern uint32_t (*crc32c)(uint32_t crc, const unsigned char* ptr, unsigned size)
  */
 uint32_t crc32c_gen(uint32_t crc, const unsigned char* ptr, unsigned size);
 uint32_t crc32c_x86(uint32_t crc, const unsigned char* ptr, unsigned size);
+uint32_t crc32c_x86x3(uint32_t crc, const unsigned char* ptr, unsigned size);
+uint32_t crc32c_arm64(uint32_t crc, const unsigned char* ptr, unsigned size);
 
 /**
  * Initialize the CRC-32 (Castagnoli) support.
@@ -189,6 +316,7 @@ void crc32c_init(void);
 #define HASH_MURMUR3 1
 #define HASH_SPOOKY2 2
 #define HASH_METRO 3
+#define HASH_XXH3 4
 
 /**
  * Compute the HASH of a memory block.
@@ -196,16 +324,55 @@ void crc32c_init(void);
  */
 void memhash(unsigned kind, const unsigned char* seed, void* digest, const void* src, size_t size);
 
+/**
+ * Compute the HASH of multiple memory blocks of the same size.
+ * The result is the same of calling memhash() for each block, but
+ * when supported by the CPU, more blocks are processed at the same time.
+ */
+void memhash_multi(unsigned kind, const unsigned char* seed, void** digest, const void** src, unsigned count, size_t size);
+
+/**
+ * Initialize the HASH functions, selecting the multi block implementations.
+ */
+void memhash_init(void);
+
 /**
  * Return the hash name.
  */
 const char* hash_config_name(unsigned kind);
 
+/**
+ * Return the hash kind from its name.
+ * Return HASH_UNDEFINED if the name is not recognized.
+ */
+unsigned hash_config_kind(const char* name);
+
+/**
+ * Size of the SHA-256 digest.
+ */
+#define SHA256_SIZE 32
+
+/**
+ * Compute the SHA-256 of a memory block.
+ */
+void sha256(void* digest, const void* src, size_t size);
+
+/**
+ * Compute the HMAC-SHA256 of a memory block.
+ */
+void hmac_sha256(void* digest, const void* key, size_t key_size, const void* src, size_t size);
+
 /**
  * Count the number of different bits in the two buffers.
  */
 unsigned memdiff(const unsigned char* data1, const unsigned char* data2, size_t size);
 
+/**
+ * Check if the buffer contains only zero bytes.
+ * Return 1 if all zero, 0 otherwise.
+ */
+int memiszero(const void* data, size_t size);
+
 /****************************************************************************/
 /* lock */
 
@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2024 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Derivative work from xxhash.h
+ *
+ * xxHash - Extremely Fast Hash algorithm
+ * Header File
+ * Copyright (C) 2012-2023 Yann Collet
+ *
+ * BSD 2-Clause License (https://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This is XXH3_128bits_withSeed(), with the 64 bits seed obtained
+ * xoring the two halves of the 128 bits seed.
+ * The digest is stored as the low and high 64 bits, in little endian.
+ */
+
+#define XXH3_PRIME32_1 0x9E3779B1U
+#define XXH3_PRIME32_2 0x85EBCA77U
+#define XXH3_PRIME32_3 0xC2B2AE3DU
+#define XXH3_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH3_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH3_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH3_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH3_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH3_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH3_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH3_SECRET_SIZE 192
+#define XXH3_SECRET_SIZE_MIN 136
+#define XXH3_STRIPE_LEN 64
+#define XXH3_STRIPE_PER_BLOCK ((XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / 8)
+#define XXH3_BLOCK_LEN (XXH3_STRIPE_LEN * XXH3_STRIPE_PER_BLOCK)
+
+static const uint8_t XXH3_kSecret[XXH3_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline void XXH3_mult64to128(uint64_t lhs, uint64_t rhs, uint64_t* low, uint64_t* high)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t product = (__uint128_t)lhs * rhs;
+	*low = (uint64_t)product;
+	*high = (uint64_t)(product >> 64);
+#else
+	uint64_t lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+	uint64_t hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+	uint64_t lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+	uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	*high = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	*low = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+}
+
+static inline uint64_t XXH3_mul128_fold64(uint64_t lhs, uint64_t rhs)
+{
+	uint64_t low, high;
+
+	XXH3_mult64to128(lhs, rhs, &low, &high);
+
+	return low ^ high;
+}
+
+static inline uint64_t XXH3_xxh64_avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= XXH3_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH3_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t XXH3_avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= XXH3_PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t XXH3_mix16B(const uint8_t* input, const uint8_t* secret, uint64_t seed)
+{
+	return XXH3_mul128_fold64(
+		util_read64(input) ^ (util_read64(secret) + seed),
+		util_read64(input + 8) ^ (util_read64(secret + 8) - seed));
+}
+
+static inline void XXH3_mix32B(uint64_t* acc, const uint8_t* input_1, const uint8_t* input_2, const uint8_t* secret, uint64_t seed)
+{
+	acc[0] += XXH3_mix16B(input_1, secret, seed);
+	acc[0] ^= util_read64(input_2) + util_read64(input_2 + 8);
+	acc[1] += XXH3_mix16B(input_2, secret + 16, seed);
+	acc[1] ^= util_read64(input_1) + util_read64(input_1 + 8);
+}
+
+static void XXH3_len_0to16(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	if (len > 8) {
+		uint64_t bitflipl = (util_read64(secret + 32) ^ util_read64(secret + 40)) - seed;
+		uint64_t bitfliph = (util_read64(secret + 48) ^ util_read64(secret + 56)) + seed;
+		uint64_t input_lo = util_read64(input);
+		uint64_t input_hi = util_read64(input + len - 8);
+		uint64_t m_lo, m_hi;
+		uint64_t r_lo, r_hi;
+
+		XXH3_mult64to128(input_lo ^ input_hi ^ bitflipl, XXH3_PRIME64_1, &m_lo, &m_hi);
+		m_lo += (uint64_t)(len - 1) << 54;
+		input_hi ^= bitfliph;
+		m_hi += (input_hi & 0xFFFFFFFF00000000ULL) + (uint64_t)(uint32_t)input_hi * XXH3_PRIME32_2;
+		m_lo ^= util_swap64(m_hi);
+
+		XXH3_mult64to128(m_lo, XXH3_PRIME64_2, &r_lo, &r_hi);
+		r_hi += m_hi * XXH3_PRIME64_2;
+
+		h[0] = XXH3_avalanche(r_lo);
+		h[1] = XXH3_avalanche(r_hi);
+	} else if (len >= 4) {
+		uint64_t input_64;
+		uint64_t keyed;
+		uint64_t m_lo, m_hi;
+
+		seed ^= (uint64_t)util_swap32((uint32_t)seed) << 32;
+		input_64 = util_read32(input) + ((uint64_t)util_read32(input + len - 4) << 32);
+		keyed = input_64 ^ ((util_read64(secret + 16) ^ util_read64(secret + 24)) + seed);
+
+		XXH3_mult64to128(keyed, XXH3_PRIME64_1 + (len << 2), &m_lo, &m_hi);
+		m_hi += m_lo << 1;
+		m_lo ^= m_hi >> 3;
+
+		m_lo ^= m_lo >> 35;
+		m_lo *= XXH3_PRIME_MX2;
+		m_lo ^= m_lo >> 28;
+
+		h[0] = m_lo;
+		h[1] = XXH3_avalanche(m_hi);
+	} else if (len > 0) {
+		uint32_t first = input[0];
+		uint32_t middle = input[len >> 1];
+		uint32_t last = input[len - 1];
+		uint32_t combinedl = (first << 16) | (middle << 24) | (last << 0) | ((uint32_t)len << 8);
+		uint32_t combinedh = util_rotl32(util_swap32(combinedl), 13);
+		uint64_t bitflipl = (util_read32(secret) ^ util_read32(secret + 4)) + seed;
+		uint64_t bitfliph = (util_read32(secret + 8) ^ util_read32(secret + 12)) - seed;
+
+		h[0] = XXH3_xxh64_avalanche(combinedl ^ bitflipl);
+		h[1] = XXH3_xxh64_avalanche(combinedh ^ bitfliph);
+	} else {
+		h[0] = XXH3_xxh64_avalanche(seed ^ util_read64(secret + 64) ^ util_read64(secret + 72));
+		h[1] = XXH3_xxh64_avalanche(seed ^ util_read64(secret + 80) ^ util_read64(secret + 88));
+	}
+}
+
+static void XXH3_len_17to240(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	uint64_t acc[2];
+
+	acc[0] = len * XXH3_PRIME64_1;
+	acc[1] = 0;
+
+	if (len <= 128) {
+		if (len > 32) {
+			if (len > 64) {
+				if (len > 96)
+					XXH3_mix32B(acc, input + 48, input + len - 64, secret + 96, seed);
+				XXH3_mix32B(acc, input + 32, input + len - 48, secret + 64, seed);
+			}
+			XXH3_mix32B(acc, input + 16, input + len - 32, secret + 32, seed);
+		}
+		XXH3_mix32B(acc, input, input + len - 16, secret, seed);
+	} else {
+		size_t i;
+
+		for (i = 32; i < 160; i += 32)
+			XXH3_mix32B(acc, input + i - 32, input + i - 16, secret + i - 32, seed);
+
+		acc[0] = XXH3_avalanche(acc[0]);
+		acc[1] = XXH3_avalanche(acc[1]);
+
+		/* the last 32 bytes are processed twice if len % 32 == 0 */
+		for (i = 160; i <= len; i += 32)
+			XXH3_mix32B(acc, input + i - 32, input + i - 16, secret + 3 + i - 160, seed);
+
+		XXH3_mix32B(acc, input + len - 16, input + len - 32, secret + XXH3_SECRET_SIZE_MIN - 17 - 16, 0 - seed);
+	}
+
+	h[0] = XXH3_avalanche(acc[0] + acc[1]);
+	h[1] = 0 - XXH3_avalanche((acc[0] * XXH3_PRIME64_1) + (acc[1] * XXH3_PRIME64_4) + ((len - seed) * XXH3_PRIME64_2));
+}
+
+static inline void XXH3_accumulate_512(uint64_t* acc, const uint8_t* input, const uint8_t* secret)
+{
+	unsigned i;
+
+	for (i = 0; i < 8; ++i) {
+		uint64_t data_val = util_read64(input + i * 8);
+		uint64_t data_key = data_val ^ util_read64(secret + i * 8);
+		acc[i ^ 1] += data_val;
+		acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+	}
+}
+
+static inline void XXH3_scramble(uint64_t* acc, const uint8_t* secret)
+{
+	unsigned i;
+
+	for (i = 0; i < 8; ++i) {
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= util_read64(secret + i * 8);
+		a *= XXH3_PRIME32_1;
+		acc[i] = a;
+	}
+}
+
+static inline uint64_t XXH3_merge(const uint64_t* acc, const uint8_t* secret, uint64_t start)
+{
+	unsigned i;
+
+	for (i = 0; i < 4; ++i)
+		start += XXH3_mul128_fold64(acc[2 * i] ^ util_read64(secret + 16 * i), acc[2 * i + 1] ^ util_read64(secret + 16 * i + 8));
+
+	return XXH3_avalanche(start);
+}
+
+static inline void XXH3_long_init(uint64_t* acc, uint8_t* secret, uint64_t seed)
+{
+	unsigned i;
+
+	for (i = 0; i < XXH3_SECRET_SIZE; i += 16) {
+		util_write64(secret + i, util_read64(XXH3_kSecret + i) + seed);
+		util_write64(secret + i + 8, util_read64(XXH3_kSecret + i + 8) - seed);
+	}
+
+	acc[0] = XXH3_PRIME32_3;
+	acc[1] = XXH3_PRIME64_1;
+	acc[2] = XXH3_PRIME64_2;
+	acc[3] = XXH3_PRIME64_3;
+	acc[4] = XXH3_PRIME64_4;
+	acc[5] = XXH3_PRIME32_2;
+	acc[6] = XXH3_PRIME64_5;
+	acc[7] = XXH3_PRIME32_1;
+}
+
+static inline void XXH3_long_end(uint64_t* acc, const uint8_t* input, size_t len, const uint8_t* secret, size_t done, uint8_t* digest)
+{
+	size_t stripes;
+	size_t i;
+
+	/* stripes of the last partial block */
+	stripes = ((len - 1) - done) / XXH3_STRIPE_LEN;
+	for (i = 0; i < stripes; ++i)
+		XXH3_accumulate_512(acc, input + done + i * XXH3_STRIPE_LEN, secret + i * 8);
+
+	/* last stripe, with a secret not aligned to 8 */
+	XXH3_accumulate_512(acc, input + len - XXH3_STRIPE_LEN, secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - 7);
+
+	util_write64(digest, XXH3_merge(acc, secret + 11, len * XXH3_PRIME64_1));
+	util_write64(digest + 8, XXH3_merge(acc, secret + XXH3_SECRET_SIZE - 64 - 11, ~(len * XXH3_PRIME64_2)));
+}
+
+static inline uint64_t XXH3_seed(const uint8_t* seed)
+{
+	return util_read64(seed) ^ util_read64(seed + 8);
+}
+
+void XXH3_128(const void* data, size_t size, const uint8_t* seed, uint8_t* digest)
+{
+	const uint8_t* input = data;
+	uint64_t seed64 = XXH3_seed(seed);
+	uint8_t secret[XXH3_SECRET_SIZE];
+	uint64_t acc[8];
+	size_t blocks;
+	size_t i, j;
+
+	if (size <= 240) {
+		uint64_t h[2];
+		if (size <= 16)
+			XXH3_len_0to16(input, size, XXH3_kSecret, seed64, h);
+		else
+			XXH3_len_17to240(input, size, XXH3_kSecret, seed64, h);
+		util_write64(digest, h[0]);
+		util_write64(digest + 8, h[1]);
+		return;
+	}
+
+	XXH3_long_init(acc, secret, seed64);
+
+	blocks = (size - 1) / XXH3_BLOCK_LEN;
+	for (i = 0; i < blocks; ++i) {
+		for (j = 0; j < XXH3_STRIPE_PER_BLOCK; ++j)
+			XXH3_accumulate_512(acc, input + i * XXH3_BLOCK_LEN + j * XXH3_STRIPE_LEN, secret + j * 8);
+		XXH3_scramble(acc, secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+	}
+
+	XXH3_long_end(acc, input, size, secret, blocks * XXH3_BLOCK_LEN, digest);
+}
+
+#if HAVE_AVX2 && defined(CONFIG_X86_64)
+static const uint64_t xxh3_avx2_prime32_1 = XXH3_PRIME32_1;
+
+/*
+ * Same as XXH3_128(), with the full blocks accumulated with AVX2.
+ *
+ * The eight accumulators are in ymm0-1, and the prime to scramble in ymm15.
+ */
+void XXH3_128_avx2(const void* data, size_t size, const uint8_t* seed, uint8_t* digest)
+{
+	const uint8_t* input = data;
+	uint8_t secret[XXH3_SECRET_SIZE];
+	uint64_t acc[8];
+	size_t blocks;
+	size_t i, j;
+
+	if (size <= XXH3_BLOCK_LEN) {
+		XXH3_128(data, size, seed, digest);
+		return;
+	}
+
+	XXH3_long_init(acc, secret, XXH3_seed(seed));
+
+	blocks = (size - 1) / XXH3_BLOCK_LEN;
+
+	/* the asm code reads acc[] and secret[] as a whole, ensure they are stored */
+	asm volatile ("" : : : "memory");
+
+	raid_avx_begin();
+
+	asm volatile ("vmovdqu %0,%%ymm0" : : "m" (acc[0]));
+	asm volatile ("vmovdqu %0,%%ymm1" : : "m" (acc[4]));
+	asm volatile ("vpbroadcastq %0,%%ymm15" : : "m" (xxh3_avx2_prime32_1));
+
+	for (i = 0; i < blocks; ++i) {
+		const uint8_t* block = input + i * XXH3_BLOCK_LEN;
+
+		for (j = 0; j < XXH3_STRIPE_PER_BLOCK; ++j) {
+			const uint8_t* stripe = block + j * XXH3_STRIPE_LEN;
+
+			asm volatile ("vmovdqu %0,%%ymm2" : : "m" (stripe[0]));
+			asm volatile ("vmovdqu %0,%%ymm3" : : "m" (stripe[32]));
+			asm volatile ("vmovdqu %0,%%ymm4" : : "m" (secret[j * 8]));
+			asm volatile ("vmovdqu %0,%%ymm5" : : "m" (secret[j * 8 + 32]));
+
+			/* data_key = data_val ^ secret */
+			asm volatile ("vpxor %ymm2,%ymm4,%ymm4");
+			asm volatile ("vpxor %ymm3,%ymm5,%ymm5");
+
+			/* low 32 bits of data_key multiplied by the high 32 bits */
+			asm volatile ("vpshufd $0x31,%ymm4,%ymm6");
+			asm volatile ("vpshufd $0x31,%ymm5,%ymm7");
+			asm volatile ("vpmuludq %ymm6,%ymm4,%ymm4");
+			asm volatile ("vpmuludq %ymm7,%ymm5,%ymm5");
+
+			/* data_val with the adjacent lanes swapped */
+			asm volatile ("vpshufd $0x4e,%ymm2,%ymm2");
+			asm volatile ("vpshufd $0x4e,%ymm3,%ymm3");
+
+			asm volatile ("vpaddq %ymm2,%ymm0,%ymm0");
+			asm volatile ("vpaddq %ymm3,%ymm1,%ymm1");
+			asm volatile ("vpaddq %ymm4,%ymm0,%ymm0");
+			asm volatile ("vpaddq %ymm5,%ymm1,%ymm1");
+		}
+
+		/* scramble, acc = (acc ^ (acc >> 47) ^ secret) * PRIME32_1 */
+		asm volatile ("vpsrlq $47,%ymm0,%ymm2");
+		asm volatile ("vpsrlq $47,%ymm1,%ymm3");
+		asm volatile ("vpxor %ymm2,%ymm0,%ymm0");
+		asm volatile ("vpxor %ymm3,%ymm1,%ymm1");
+		asm volatile ("vpxor %0,%%ymm0,%%ymm0" : : "m" (secret[XXH3_SECRET_SIZE - XXH3_STRIPE_LEN]));
+		asm volatile ("vpxor %0,%%ymm1,%%ymm1" : : "m" (secret[XXH3_SECRET_SIZE - XXH3_STRIPE_LEN + 32]));
+		asm volatile ("vpsrlq $32,%ymm0,%ymm2");
+		asm volatile ("vpsrlq $32,%ymm1,%ymm3");
+		asm volatile ("vpmuludq %ymm15,%ymm0,%ymm0");
+		asm volatile ("vpmuludq %ymm15,%ymm1,%ymm1");
+		asm volatile ("vpmuludq %ymm15,%ymm2,%ymm2");
+		asm volatile ("vpmuludq %ymm15,%ymm3,%ymm3");
+		asm volatile ("vpsllq $32,%ymm2,%ymm2");
+		asm volatile ("vpsllq $32,%ymm3,%ymm3");
+		asm volatile ("vpaddq %ymm2,%ymm0,%ymm0");
+		asm volatile ("vpaddq %ymm3,%ymm1,%ymm1");
+	}
+
+	asm volatile ("vmovdqu %%ymm0,%0" : "=m" (acc[0]));
+	asm volatile ("vmovdqu %%ymm1,%0" : "=m" (acc[4]));
+
+	raid_avx_end();
+
+	XXH3_long_end(acc, input, size, secret, blocks * XXH3_BLOCK_LEN, digest);
+}
+#endif
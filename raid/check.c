@@ -183,3 +183,58 @@ int raid_scan(int *ir, int nd, int np, size_t size, void **v)
 	return -1;
 }
 
+
+/**
+ * Size of the chunks in which raid_verify() splits the blocks.
+ *
+ * The parity computed for a chunk is compared while it's still in the
+ * L1 cache, and it's never written in the main memory.
+ */
+#define RAID_VERIFY_CHUNK 1024
+
+int raid_verify(int nd, int np, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t buf[RAID_PARITY_MAX * RAID_VERIFY_CHUNK + 64];
+	void *w[RAID_DATA_MAX + RAID_PARITY_MAX];
+	uint8_t *p;
+	size_t i, step;
+	int mask;
+	int all;
+	int j;
+
+	/* enforce limit on size */
+	BUG_ON(size % 64 != 0);
+
+	/* enforce limit on number of failures */
+	BUG_ON(np < 1);
+	BUG_ON(np > RAID_PARITY_MAX);
+
+	/* enforce limit on number of data disks */
+	BUG_ON(nd > RAID_DATA_MAX);
+
+	/* the computed parity goes in the aligned temporary buffer */
+	p = __align_ptr(buf, 64);
+	for (j = 0; j < np; ++j)
+		w[nd + j] = p + j * RAID_VERIFY_CHUNK;
+
+	all = (1 << np) - 1;
+	mask = 0;
+	for (i = 0; i < size && mask != all; i += step) {
+		step = size - i;
+		if (step > RAID_VERIFY_CHUNK)
+			step = RAID_VERIFY_CHUNK;
+
+		for (j = 0; j < nd; ++j)
+			w[j] = v[j] + i;
+
+		/* always use the CPU, as the chunks are too small for an engine */
+		raid_gen_ptr[np - 1](nd, step, w);
+
+		for (j = 0; j < np; ++j)
+			if (memcmp(p + j * RAID_VERIFY_CHUNK, v[nd + j] + i, step) != 0)
+				mask |= 1 << j;
+	}
+
+	return mask;
+}
@@ -167,6 +167,21 @@ static inline int raid_cpu_has_crc32(void)
 		0);
 }
 
+static inline int raid_cpu_has_pclmul(void)
+{
+	/*
+	 * Intel 64 and IA-32 Architectures Software Developer's Manual
+	 * 325462-048US September 2013
+	 *
+	 * PCLMULQDQ - Carry-Less Multiplication Quadword
+	 * ...
+	 * CPUID.01H:ECX.PCLMULQDQ[bit 1] = 1
+	 */
+	return raid_cpu_match_sse(
+		1 << 1, /* PCLMULQDQ */
+		0);
+}
+
 static inline int raid_cpu_has_avx2(void)
 {
 	/*
@@ -212,6 +227,28 @@ static inline int raid_cpu_has_avx512bw(void)
 		(3 << 1) | (7 << 5)); /* OS saves XMM, YMM and ZMM registers */
 }
 
+static inline int raid_cpu_has_avx512gfni(void)
+{
+	uint32_t reg[4];
+
+	/*
+	 * Intel Architecture Instruction Set Extensions Programming Reference
+	 * 319433-030 October 2017
+	 *
+	 * 1.5 Detection of the GFNI instructions
+	 * Galois Field instructions are supported if CPUID.(EAX=07H, ECX=0H):ECX.GFNI[bit 8] = 1.
+	 * The 512-bit forms require also the detection of AVX512F.
+	 */
+	if (!raid_cpu_has_avx512bw())
+		return 0;
+
+	raid_cpuid(7, 0, reg);
+	if ((reg[2] & (1 << 8)) == 0)
+		return 0;
+
+	return 1;
+}
+
 /**
  * Check if it's an Intel Atom CPU.
  */
@@ -554,3 +554,92 @@ void raid_recX_int8(int nr, int *id, int *ip, int nd, size_t size, void **vv)
 	}
 }
 
+
+/*
+ * GENEXT (generic parity with the extended Cauchy matrix) 8bit C implementation
+ */
+void raid_genext_int8(int np, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p[RAID_PARITY_EXT_MAX];
+	int d, j;
+	size_t i;
+
+	for (j = 0; j < np; ++j)
+		p[j] = v[nd + j];
+
+	for (i = 0; i < size; ++i) {
+		uint8_t a[RAID_PARITY_EXT_MAX];
+		uint8_t b;
+
+		/* first disk */
+		b = v[0][i];
+		a[0] = b;
+		for (j = 1; j < np; ++j)
+			a[j] = mul(gfcauchyext[j][0], b);
+
+		/* next disks */
+		for (d = 1; d < nd; ++d) {
+			b = v[d][i];
+			a[0] ^= b;
+			for (j = 1; j < np; ++j)
+				a[j] ^= mul(gfcauchyext[j][d], b);
+		}
+
+		for (j = 0; j < np; ++j)
+			p[j][i] = a[j];
+	}
+}
+
+/*
+ * RAID recovering with the extended Cauchy matrix 8bit C implementation
+ */
+void raid_recext_int8(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p[RAID_PARITY_EXT_MAX];
+	uint8_t *pa[RAID_PARITY_EXT_MAX];
+	const uint8_t *T[RAID_PARITY_EXT_MAX][RAID_PARITY_EXT_MAX];
+	uint8_t G[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+	uint8_t V[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+	size_t i;
+	int j, k;
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < nr; ++j)
+		for (k = 0; k < nr; ++k)
+			G[j * nr + k] = gfcauchyext[ip[j]][id[k]];
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, nr);
+
+	/* get multiplication tables */
+	for (j = 0; j < nr; ++j)
+		for (k = 0; k < nr; ++k)
+			T[j][k] = table(V[j * nr + k]);
+
+	/* compute delta parity */
+	raid_delta_gen_ext(nr, id, ip, nd, size, vv);
+
+	for (j = 0; j < nr; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	for (i = 0; i < size; ++i) {
+		uint8_t PD[RAID_PARITY_EXT_MAX];
+
+		/* delta */
+		for (j = 0; j < nr; ++j)
+			PD[j] = p[j][i] ^ pa[j][i];
+
+		/* reconstruct */
+		for (j = 0; j < nr; ++j) {
+			uint8_t b = 0;
+
+			for (k = 0; k < nr; ++k)
+				b ^= T[j][k][PD[k]];
+			pa[j][i] = b;
+		}
+	}
+}
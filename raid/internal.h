@@ -43,7 +43,7 @@
 #endif
 #endif
 
-/* Enables SSE2, SSSE3, AVX2 only if the assembler supports it */
+/* Enables SSE2, SSSE3, AVX2, AVX512 with GFNI only if the assembler supports it */
 #if HAVE_SSE2
 #define CONFIG_SSE2 1
 #endif
@@ -53,6 +53,15 @@
 #if HAVE_AVX2
 #define CONFIG_AVX2 1
 #endif
+#if HAVE_AVX512GFNI
+#define CONFIG_AVX512GFNI 1
+#endif
+
+/* NEON is part of the base aarch64 architecture, and it uses intrinsics */
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define CONFIG_ARM64 1
+#define CONFIG_NEON 1
+#endif
 
 #else /* if HAVE_CONFIG_H is not defined */
 
@@ -73,6 +82,15 @@
 #define CONFIG_SSSE3 1
 #define CONFIG_AVX2 1
 #endif
+#ifdef CONFIG_X86_64
+#define CONFIG_AVX512GFNI 1
+#endif
+
+/* NEON is part of the base aarch64 architecture, and it uses intrinsics */
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define CONFIG_ARM64 1
+#define CONFIG_NEON 1
+#endif
 #endif
 
 /*
@@ -95,6 +113,13 @@
 #define __always_inline inline __attribute__((always_inline))
 #endif
 
+/*
+ * Thread local storage.
+ */
+#if defined(__GNUC__) && !defined(RAID_THREAD_LOCAL)
+#define RAID_THREAD_LOCAL __thread
+#endif
+
 /*
  * Forced alignment.
  */
@@ -129,17 +154,24 @@ int raid_selftest(void);
 void raid_gen_ref(int nd, int np, size_t size, void **vv);
 void raid_invert(uint8_t *M, uint8_t *V, int n);
 void raid_delta_gen(int nr, int *id, int *ip, int nd, size_t size, void **v);
+void raid_delta_gen_ext(int nr, int *id, int *ip, int nd, size_t size, void **v);
 void raid_rec1of1(int *id, int nd, size_t size, void **v);
 void raid_rec2of2_int8(int *id, int *ip, int nd, size_t size, void **vv);
 void raid_gen1_int32(int nd, size_t size, void **vv);
 void raid_gen1_int64(int nd, size_t size, void **vv);
 void raid_gen1_sse2(int nd, size_t size, void **vv);
+void raid_gen1_sse2p(int nd, size_t size, void **vv);
 void raid_gen1_avx2(int nd, size_t size, void **vv);
+void raid_gen1_avx2p(int nd, size_t size, void **vv);
+void raid_gen1_neon(int nd, size_t size, void **vv);
 void raid_gen2_int32(int nd, size_t size, void **vv);
 void raid_gen2_int64(int nd, size_t size, void **vv);
 void raid_gen2_sse2(int nd, size_t size, void **vv);
+void raid_gen2_sse2p(int nd, size_t size, void **vv);
 void raid_gen2_avx2(int nd, size_t size, void **vv);
+void raid_gen2_avx2p(int nd, size_t size, void **vv);
 void raid_gen2_sse2ext(int nd, size_t size, void **vv);
+void raid_gen2_neon(int nd, size_t size, void **vv);
 void raid_genz_int32(int nd, size_t size, void **vv);
 void raid_genz_int64(int nd, size_t size, void **vv);
 void raid_genz_sse2(int nd, size_t size, void **vv);
@@ -149,18 +181,26 @@ void raid_gen3_int8(int nd, size_t size, void **vv);
 void raid_gen3_ssse3(int nd, size_t size, void **vv);
 void raid_gen3_ssse3ext(int nd, size_t size, void **vv);
 void raid_gen3_avx2ext(int nd, size_t size, void **vv);
+void raid_gen3_avx512gfni(int nd, size_t size, void **vv);
+void raid_gen3_neon(int nd, size_t size, void **vv);
 void raid_gen4_int8(int nd, size_t size, void **vv);
 void raid_gen4_ssse3(int nd, size_t size, void **vv);
 void raid_gen4_ssse3ext(int nd, size_t size, void **vv);
 void raid_gen4_avx2ext(int nd, size_t size, void **vv);
+void raid_gen4_avx512gfni(int nd, size_t size, void **vv);
+void raid_gen4_neon(int nd, size_t size, void **vv);
 void raid_gen5_int8(int nd, size_t size, void **vv);
 void raid_gen5_ssse3(int nd, size_t size, void **vv);
 void raid_gen5_ssse3ext(int nd, size_t size, void **vv);
 void raid_gen5_avx2ext(int nd, size_t size, void **vv);
+void raid_gen5_avx512gfni(int nd, size_t size, void **vv);
+void raid_gen5_neon(int nd, size_t size, void **vv);
 void raid_gen6_int8(int nd, size_t size, void **vv);
 void raid_gen6_ssse3(int nd, size_t size, void **vv);
 void raid_gen6_ssse3ext(int nd, size_t size, void **vv);
 void raid_gen6_avx2ext(int nd, size_t size, void **vv);
+void raid_gen6_avx512gfni(int nd, size_t size, void **vv);
+void raid_gen6_neon(int nd, size_t size, void **vv);
 void raid_rec1_int8(int nr, int *id, int *ip, int nd, size_t size, void **vv);
 void raid_rec2_int8(int nr, int *id, int *ip, int nd, size_t size, void **vv);
 void raid_recX_int8(int nr, int *id, int *ip, int nd, size_t size, void **vv);
@@ -170,6 +210,17 @@ void raid_recX_ssse3(int nr, int *id, int *ip, int nd, size_t size, void **vv);
 void raid_rec1_avx2(int nr, int *id, int *ip, int nd, size_t size, void **vv);
 void raid_rec2_avx2(int nr, int *id, int *ip, int nd, size_t size, void **vv);
 void raid_recX_avx2(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+void raid_recX_avx512gfni(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+void raid_rec1_neon(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+void raid_rec2_neon(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+void raid_recX_neon(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+void raid_genext_int8(int np, int nd, size_t size, void **vv);
+void raid_genext_ssse3(int np, int nd, size_t size, void **vv);
+void raid_genext_avx2(int np, int nd, size_t size, void **vv);
+void raid_genext_avx2ext(int np, int nd, size_t size, void **vv);
+void raid_recext_int8(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+void raid_recext_ssse3(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+void raid_recext_avx2(int nr, int *id, int *ip, int nd, size_t size, void **vv);
 
 /*
  * Internal naming.
@@ -186,6 +237,26 @@ const char *raid_gen6_tag(void);
 const char *raid_rec1_tag(void);
 const char *raid_rec2_tag(void);
 const char *raid_recX_tag(void);
+const char *raid_genext_tag(void);
+const char *raid_recext_tag(void);
+
+/*
+ * Internal selection.
+ *
+ * These are intended to override the implementation chosen by raid_init(),
+ * like after measuring the speed of all of them.
+ *
+ * The @func name is one of "gen1", "gen2", "genz", "gen3", ... "gen6",
+ * "rec1", ... "rec6", "genext" and "recext".
+ * The @tag is the name of the implementation, like "ssse3" or "avx2e".
+ *
+ * raid_select() returns 0 on success, or -1 if the implementation is not
+ * available in this build or in this CPU.
+ * raid_selected() returns the tag of the implementation in use, or 0
+ * for an unknown @func.
+ */
+int raid_select(const char *func, const char *tag);
+const char *raid_selected(const char *func);
 
 /*
  * Internal forwarders.
@@ -196,6 +267,10 @@ extern void (*raid_gen_ptr[RAID_PARITY_MAX])(
 	int nd, size_t size, void **vv);
 extern void (*raid_rec_ptr[RAID_PARITY_MAX])(
 	int nr, int *id, int *ip, int nd, size_t size, void **vv);
+extern void (*raid_genext_ptr)(int np, int nd, size_t size, void **vv);
+extern const struct raid_engine *raid_engine_ptr;
+extern void (*raid_recext_ptr)(
+	int nr, int *id, int *ip, int nd, size_t size, void **vv);
 
 /*
  * Tables.
@@ -205,16 +280,20 @@ extern const uint8_t raid_gfexp[256] __aligned(256);
 extern const uint8_t raid_gfinv[256] __aligned(256);
 extern const uint8_t raid_gfvandermonde[3][256] __aligned(256);
 extern const uint8_t raid_gfcauchy[6][256] __aligned(256);
+extern const uint8_t raid_gfcauchyext[8][256] __aligned(256);
 extern const uint8_t raid_gfcauchypshufb[251][4][2][16] __aligned(256);
 extern const uint8_t raid_gfmulpshufb[256][2][16] __aligned(256);
+extern const uint64_t raid_gfmulgfni[256] __aligned(256);
 extern const uint8_t (*raid_gfgen)[256];
 #define gfmul raid_gfmul
 #define gfexp raid_gfexp
 #define gfinv raid_gfinv
 #define gfvandermonde raid_gfvandermonde
 #define gfcauchy raid_gfcauchy
+#define gfcauchyext raid_gfcauchyext
 #define gfgenpshufb raid_gfcauchypshufb
 #define gfmulpshufb raid_gfmulpshufb
+#define gfmulgfni raid_gfmulgfni
 #define gfgen raid_gfgen
 
 /*
@@ -56,6 +56,16 @@
  */
 #define RAID_MALLOC_DISPLACEMENT (7*256)
 
+/**
+ * Size of the huge pages, used as alignment by raid_malloc_vector_align()
+ * for memory that is going to be backed by huge pages.
+ *
+ * It's the x86 and ARM 2 MB page, the most common huge page size.
+ * Blocks accessed in parallel from the raid and hash functions span a lot
+ * of normal pages, and using huge pages reduces the TLB misses.
+ */
+#define RAID_MALLOC_HUGE (2*1024*1024)
+
 /**
  * Aligned malloc.
  * Use an alignment suitable for the raid functions.
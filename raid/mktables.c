@@ -57,10 +57,26 @@ uint8_t gfinv[256];
  */
 #define DISK (257 - PARITY)
 
+/**
+ * Number of parities of the extended matrix.
+ * This is the number of rows of the extended generator matrix.
+ */
+#define PARITY_EXT 8
+
+/**
+ * Number of disks of the extended matrix.
+ * This is the number of columns of the extended generator matrix.
+ */
+#define DISK_EXT (257 - PARITY_EXT)
+
 /**
  * Setup the Cauchy matrix used to generate the parity.
+ *
+ * The matrix has @parity rows and @disk columns.
+ * For the same disk, the rows don't depend on the number of parities,
+ * meaning that a larger matrix is an extension of a smaller one.
  */
-static void set_cauchy(uint8_t *matrix)
+static void set_cauchy(uint8_t *matrix, int parity, int disk)
 {
 	int i, j;
 	uint8_t inv_x, y;
@@ -81,8 +97,8 @@ static void set_cauchy(uint8_t *matrix)
 	 *   -   -   -   -   -   -
 	 *   -   -   -   -   -   -
 	 */
-	for (i = 0; i < DISK; ++i)
-		matrix[0 * DISK + i] = 1;
+	for (i = 0; i < disk; ++i)
+		matrix[0 * disk + i] = 1;
 
 	/*
 	 * Second row is formed with powers 2^i, and it's the first
@@ -116,8 +132,8 @@ static void set_cauchy(uint8_t *matrix)
 	 *   -   -   -   -   -   -
 	 */
 	inv_x = 1;
-	for (i = 0; i < DISK; ++i) {
-		matrix[1 * DISK + i] = inv_x;
+	for (i = 0; i < disk; ++i) {
+		matrix[1 * disk + i] = inv_x;
 		inv_x = gfmul(2, inv_x);
 	}
 
@@ -143,12 +159,12 @@ static void set_cauchy(uint8_t *matrix)
 	 * 167  39 213  59 153  82
 	 */
 	y = 2;
-	for (j = 0; j < PARITY - 2; ++j) {
+	for (j = 0; j < parity - 2; ++j) {
 		inv_x = 1;
-		for (i = 0; i < DISK; ++i) {
+		for (i = 0; i < disk; ++i) {
 			uint8_t x = gfinv[inv_x];
 
-			matrix[(j + 2) * DISK + i] = gfinv[y ^ x];
+			matrix[(j + 2) * disk + i] = gfinv[y ^ x];
 			inv_x = gfmul(2, inv_x);
 		}
 
@@ -168,11 +184,11 @@ static void set_cauchy(uint8_t *matrix)
 	 *   1 245 210 196 154 113
 	 *   1 187 166 215   7 106
 	 */
-	for (j = 0; j < PARITY - 2; ++j) {
-		uint8_t f = gfinv[matrix[(j + 2) * DISK]];
+	for (j = 0; j < parity - 2; ++j) {
+		uint8_t f = gfinv[matrix[(j + 2) * disk]];
 
-		for (i = 0; i < DISK; ++i)
-			matrix[(j + 2) * DISK + i] = gfmul(matrix[(j + 2) * DISK + i], f);
+		for (i = 0; i < disk; ++i)
+			matrix[(j + 2) * disk + i] = gfmul(matrix[(j + 2) * disk + i], f);
 	}
 }
 
@@ -222,6 +238,7 @@ int main(void)
 	uint8_t v;
 	int i, j, k, p;
 	uint8_t matrix[PARITY * 256];
+	uint8_t matrix_ext[PARITY_EXT * 256];
 
 	printf("/*\n");
 	printf(" * Copyright (C) 2013 Andrea Mazzoleni\n");
@@ -331,7 +348,7 @@ int main(void)
 	printf("};\n\n");
 
 	/* cauchy matrix */
-	set_cauchy(matrix);
+	set_cauchy(matrix, PARITY, DISK);
 
 	printf("/**\n");
 	printf(" * Cauchy matrix used to generate parity.\n");
@@ -363,6 +380,33 @@ int main(void)
 	}
 	printf("};\n\n");
 
+	/* extended cauchy matrix */
+	set_cauchy(matrix_ext, PARITY_EXT, DISK_EXT);
+
+	printf("/**\n");
+	printf(" * Extended Cauchy matrix used to generate parity with the generic functions.\n");
+	printf(" * This matrix is valid for up to %u parity with %u data disks.\n", PARITY_EXT, DISK_EXT);
+	printf(" * The first %u rows are equal at the ones of the Cauchy matrix.\n", PARITY);
+	printf(" */\n");
+	printf("const uint8_t __aligned(256) raid_gfcauchyext[%u][256] =\n", PARITY_EXT);
+	printf("{\n");
+	for (p = 0; p < PARITY_EXT; ++p) {
+		printf("\t{\n");
+		for (i = 0; i < DISK_EXT; ++i) {
+			if (i % 8 == 0)
+				printf("\t\t");
+			printf("0x%02x,", matrix_ext[p * DISK_EXT + i]);
+			if (i != DISK_EXT - 1) {
+				if (i % 8 == 7)
+					printf("\n");
+				else
+					printf(" ");
+			}
+		}
+		printf("\n\t},\n");
+	}
+	printf("};\n\n");
+
 	printf("#ifdef CONFIG_X86\n");
 	printf("/**\n");
 	printf(" * PSHUFB tables for the Cauchy matrix.\n");
@@ -395,7 +439,7 @@ int main(void)
 	printf("};\n");
 	printf("#endif\n\n");
 
-	printf("#ifdef CONFIG_X86\n");
+	printf("#if defined(CONFIG_X86) || defined(CONFIG_NEON)\n");
 	printf("/**\n");
 	printf(" * PSHUFB tables for generic multiplication.\n");
 	printf(" *\n");
@@ -423,6 +467,38 @@ int main(void)
 	printf("};\n");
 	printf("#endif\n\n");
 
+	printf("#ifdef CONFIG_X86\n");
+	printf("/**\n");
+	printf(" * GF2P8AFFINEQB matrices for generic multiplication.\n");
+	printf(" *\n");
+	printf(" * Indexes are [MULTIPLIER].\n");
+	printf(" * Where MULTIPLIER is from 0 to 255.\n");
+	printf(" * The byte 7-b of each matrix selects the bits of the input\n");
+	printf(" * to xor to get the bit b of the product.\n");
+	printf(" */\n");
+	printf("const uint64_t __aligned(256) raid_gfmulgfni[256] =\n");
+	printf("{\n");
+	for (i = 0; i < 256; ++i) {
+		uint64_t m = 0;
+		for (j = 0; j < 8; ++j) {
+			uint8_t row = 0;
+			for (k = 0; k < 8; ++k) {
+				if ((gfmul(i, 1 << k) >> j) & 1)
+					row |= 1 << k;
+			}
+			m |= (uint64_t)row << (8 * (7 - j));
+		}
+		if (i % 4 == 0)
+			printf("\t");
+		printf("0x%016llxULL,", (unsigned long long)m);
+		if (i % 4 == 3)
+			printf("\n");
+		else
+			printf(" ");
+	}
+	printf("};\n");
+	printf("#endif\n\n");
+
 	return 0;
 }
 
@@ -43,6 +43,9 @@ void raid_init(void)
 	raid_rec_ptr[4] = raid_recX_int8;
 	raid_rec_ptr[5] = raid_recX_int8;
 
+	raid_genext_ptr = raid_genext_int8;
+	raid_recext_ptr = raid_recext_int8;
+
 #ifdef CONFIG_X86
 #ifdef CONFIG_SSE2
 	if (raid_cpu_has_sse2()) {
@@ -88,6 +91,8 @@ void raid_init(void)
 		raid_rec_ptr[3] = raid_recX_ssse3;
 		raid_rec_ptr[4] = raid_recX_ssse3;
 		raid_rec_ptr[5] = raid_recX_ssse3;
+		raid_genext_ptr = raid_genext_ssse3;
+		raid_recext_ptr = raid_recext_ssse3;
 	}
 #endif
 
@@ -101,6 +106,7 @@ void raid_init(void)
 		raid_gen_ptr[3] = raid_gen4_avx2ext;
 		raid_gen_ptr[4] = raid_gen5_avx2ext;
 		raid_gen_ptr[5] = raid_gen6_avx2ext;
+		raid_genext_ptr = raid_genext_avx2ext;
 #endif
 		raid_rec_ptr[0] = raid_rec1_avx2;
 		raid_rec_ptr[1] = raid_rec2_avx2;
@@ -108,10 +114,42 @@ void raid_init(void)
 		raid_rec_ptr[3] = raid_recX_avx2;
 		raid_rec_ptr[4] = raid_recX_avx2;
 		raid_rec_ptr[5] = raid_recX_avx2;
+#ifndef CONFIG_X86_64
+		raid_genext_ptr = raid_genext_avx2;
+#endif
+		raid_recext_ptr = raid_recext_avx2;
+	}
+#endif
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+	if (raid_cpu_has_avx512gfni()) {
+		raid_gen3_ptr = raid_gen3_avx512gfni;
+		raid_gen_ptr[3] = raid_gen4_avx512gfni;
+		raid_gen_ptr[4] = raid_gen5_avx512gfni;
+		raid_gen_ptr[5] = raid_gen6_avx512gfni;
+		raid_rec_ptr[2] = raid_recX_avx512gfni;
+		raid_rec_ptr[3] = raid_recX_avx512gfni;
+		raid_rec_ptr[4] = raid_recX_avx512gfni;
+		raid_rec_ptr[5] = raid_recX_avx512gfni;
 	}
 #endif
 #endif /* CONFIG_X86 */
 
+#ifdef CONFIG_NEON
+	raid_gen_ptr[0] = raid_gen1_neon;
+	raid_gen_ptr[1] = raid_gen2_neon;
+	raid_gen3_ptr = raid_gen3_neon;
+	raid_gen_ptr[3] = raid_gen4_neon;
+	raid_gen_ptr[4] = raid_gen5_neon;
+	raid_gen_ptr[5] = raid_gen6_neon;
+	raid_rec_ptr[0] = raid_rec1_neon;
+	raid_rec_ptr[1] = raid_rec2_neon;
+	raid_rec_ptr[2] = raid_recX_neon;
+	raid_rec_ptr[3] = raid_recX_neon;
+	raid_rec_ptr[4] = raid_recX_neon;
+	raid_rec_ptr[5] = raid_recX_neon;
+#endif
+
 	/* set the default mode */
 	raid_mode(RAID_MODE_CAUCHY);
 }
@@ -471,3 +509,26 @@ bail:
 	return ret;
 }
 
+
+int raid_engine(const struct raid_engine *engine)
+{
+	const struct raid_engine *old = raid_engine_ptr;
+
+	raid_engine_ptr = engine;
+
+	/* verify the engine with the current mode */
+	if (engine && raid_selftest() != 0) {
+		raid_engine_ptr = old;
+		return -1;
+	}
+
+	return 0;
+}
+
+const char *raid_engine_tag(void)
+{
+	if (!raid_engine_ptr)
+		return "cpu";
+
+	return raid_engine_ptr->name;
+}
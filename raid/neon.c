@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) 2013 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "internal.h"
+#include "gf.h"
+
+/*
+ * ARM NEON implementations.
+ *
+ * NEON is part of the base aarch64 architecture, so these functions
+ * don't need any run-time detection.
+ *
+ * The multiplication in GF(2^8) uses the same nibble tables of the SSSE3
+ * implementation, with TBL in place of PSHUFB. Differently than PSHUFB,
+ * TBL returns 0 for indexes over 15, and it doesn't look at the high bit,
+ * but we always mask the nibbles, so the result is the same.
+ */
+
+#ifdef CONFIG_NEON
+#include <arm_neon.h>
+
+/*
+ * Multiplies all the bytes of a vector by the constant
+ * represented by the low and high nibble tables.
+ */
+static __always_inline uint8x16_t raid_neon_mul(uint8x16_t x, uint8x16_t low, uint8x16_t high)
+{
+	uint8x16_t mask = vdupq_n_u8(0x0f);
+
+	return veorq_u8(vqtbl1q_u8(low, vandq_u8(x, mask)), vqtbl1q_u8(high, vshrq_n_u8(x, 4)));
+}
+
+/*
+ * Multiplies all the bytes of a vector by 2.
+ */
+static __always_inline uint8x16_t raid_neon_x2(uint8x16_t x)
+{
+	/* the arithmetic shift replicates the high bit in all the byte */
+	uint8x16_t mask = vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(x), 7));
+
+	return veorq_u8(vaddq_u8(x, x), vandq_u8(mask, vdupq_n_u8(0x1d)));
+}
+
+/*
+ * GEN1 (RAID5 with xor) NEON implementation
+ */
+void raid_gen1_neon(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	int d, l;
+	size_t i;
+
+	uint8x16_t p0, p1, p2, p3;
+
+	l = nd - 1;
+	p = v[nd];
+
+	for (i = 0; i < size; i += 64) {
+		p0 = vld1q_u8(&v[l][i]);
+		p1 = vld1q_u8(&v[l][i + 16]);
+		p2 = vld1q_u8(&v[l][i + 32]);
+		p3 = vld1q_u8(&v[l][i + 48]);
+		for (d = l - 1; d >= 0; --d) {
+			p0 = veorq_u8(p0, vld1q_u8(&v[d][i]));
+			p1 = veorq_u8(p1, vld1q_u8(&v[d][i + 16]));
+			p2 = veorq_u8(p2, vld1q_u8(&v[d][i + 32]));
+			p3 = veorq_u8(p3, vld1q_u8(&v[d][i + 48]));
+		}
+		vst1q_u8(&p[i], p0);
+		vst1q_u8(&p[i + 16], p1);
+		vst1q_u8(&p[i + 32], p2);
+		vst1q_u8(&p[i + 48], p3);
+	}
+}
+
+/*
+ * GEN2 (RAID6 with powers of 2) NEON implementation
+ */
+void raid_gen2_neon(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	int d, l;
+	size_t i;
+
+	uint8x16_t d0, p0, q0;
+	uint8x16_t d1, p1, q1;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+
+	for (i = 0; i < size; i += 32) {
+		q0 = p0 = vld1q_u8(&v[l][i]);
+		q1 = p1 = vld1q_u8(&v[l][i + 16]);
+		for (d = l - 1; d >= 0; --d) {
+			d0 = vld1q_u8(&v[d][i]);
+			d1 = vld1q_u8(&v[d][i + 16]);
+
+			p0 = veorq_u8(p0, d0);
+			p1 = veorq_u8(p1, d1);
+
+			q0 = veorq_u8(raid_neon_x2(q0), d0);
+			q1 = veorq_u8(raid_neon_x2(q1), d1);
+		}
+		vst1q_u8(&p[i], p0);
+		vst1q_u8(&p[i + 16], p1);
+		vst1q_u8(&q[i], q0);
+		vst1q_u8(&q[i + 16], q1);
+	}
+}
+
+/*
+ * GENz (triple parity with powers of 2^-1) is not implemented,
+ * as the Vandermonde mode is only used for compatibility.
+ */
+
+/*
+ * GEN3/GEN4/GEN5/GEN6 (multiple parity with Cauchy matrix) NEON implementation
+ *
+ * All the parities, except the first one, are computed with the
+ * multiplication tables, processing the disks in order with the
+ * Cauchy coefficients. This avoids the Horner rule for the second parity.
+ */
+static __always_inline void raid_genN_neon(int np, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p[RAID_PARITY_MAX];
+	uint8x16_t a[RAID_PARITY_MAX][2];
+	uint8x16_t d0, d1;
+	int d, j;
+	size_t i;
+
+	for (j = 0; j < np; ++j)
+		p[j] = v[nd + j];
+
+	for (i = 0; i < size; i += 32) {
+		/* first disk */
+		d0 = vld1q_u8(&v[0][i]);
+		d1 = vld1q_u8(&v[0][i + 16]);
+		a[0][0] = d0;
+		a[0][1] = d1;
+		for (j = 1; j < np; ++j) {
+			const uint8_t *t = gfmulpshufb[gfcauchy[j][0]][0];
+			uint8x16_t low = vld1q_u8(t);
+			uint8x16_t high = vld1q_u8(t + 16);
+
+			a[j][0] = raid_neon_mul(d0, low, high);
+			a[j][1] = raid_neon_mul(d1, low, high);
+		}
+
+		/* next disks */
+		for (d = 1; d < nd; ++d) {
+			d0 = vld1q_u8(&v[d][i]);
+			d1 = vld1q_u8(&v[d][i + 16]);
+			a[0][0] = veorq_u8(a[0][0], d0);
+			a[0][1] = veorq_u8(a[0][1], d1);
+			for (j = 1; j < np; ++j) {
+				const uint8_t *t = gfmulpshufb[gfcauchy[j][d]][0];
+				uint8x16_t low = vld1q_u8(t);
+				uint8x16_t high = vld1q_u8(t + 16);
+
+				a[j][0] = veorq_u8(a[j][0], raid_neon_mul(d0, low, high));
+				a[j][1] = veorq_u8(a[j][1], raid_neon_mul(d1, low, high));
+			}
+		}
+
+		for (j = 0; j < np; ++j) {
+			vst1q_u8(&p[j][i], a[j][0]);
+			vst1q_u8(&p[j][i + 16], a[j][1]);
+		}
+	}
+}
+
+/*
+ * GEN3 (triple parity with Cauchy matrix) NEON implementation
+ */
+void raid_gen3_neon(int nd, size_t size, void **vv)
+{
+	raid_genN_neon(3, nd, size, vv);
+}
+
+/*
+ * GEN4 (quad parity with Cauchy matrix) NEON implementation
+ */
+void raid_gen4_neon(int nd, size_t size, void **vv)
+{
+	raid_genN_neon(4, nd, size, vv);
+}
+
+/*
+ * GEN5 (penta parity with Cauchy matrix) NEON implementation
+ */
+void raid_gen5_neon(int nd, size_t size, void **vv)
+{
+	raid_genN_neon(5, nd, size, vv);
+}
+
+/*
+ * GEN6 (hexa parity with Cauchy matrix) NEON implementation
+ */
+void raid_gen6_neon(int nd, size_t size, void **vv)
+{
+	raid_genN_neon(6, nd, size, vv);
+}
+
+/*
+ * RAID recovering for one disk NEON implementation
+ */
+void raid_rec1_neon(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *pa;
+	uint8_t G;
+	uint8_t V;
+	uint8x16_t low, high;
+	size_t i;
+
+	(void)nr; /* unused, it's always 1 */
+
+	/* if it's RAID5 uses the faster function */
+	if (ip[0] == 0) {
+		raid_rec1of1(id, nd, size, vv);
+		return;
+	}
+
+	/* setup the coefficients matrix */
+	G = A(ip[0], id[0]);
+
+	/* invert it to solve the system of linear equations */
+	V = inv(G);
+
+	/* compute delta parity */
+	raid_delta_gen(1, id, ip, nd, size, vv);
+
+	p = v[nd + ip[0]];
+	pa = v[id[0]];
+
+	low = vld1q_u8(gfmulpshufb[V][0]);
+	high = vld1q_u8(gfmulpshufb[V][1]);
+
+	for (i = 0; i < size; i += 16) {
+		uint8x16_t x = veorq_u8(vld1q_u8(&p[i]), vld1q_u8(&pa[i]));
+
+		vst1q_u8(&pa[i], raid_neon_mul(x, low, high));
+	}
+}
+
+/*
+ * RAID recovering for two disks NEON implementation
+ */
+void raid_rec2_neon(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	const int N = 2;
+	uint8_t *p[N];
+	uint8_t *pa[N];
+	uint8_t G[N * N];
+	uint8_t V[N * N];
+	uint8x16_t t[N * N][2];
+	size_t i;
+	int j, k;
+
+	(void)nr; /* unused, it's always 2 */
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = A(ip[j], id[k]);
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	/* the tables are constant for all the block */
+	for (j = 0; j < N * N; ++j) {
+		t[j][0] = vld1q_u8(gfmulpshufb[V[j]][0]);
+		t[j][1] = vld1q_u8(gfmulpshufb[V[j]][1]);
+	}
+
+	for (i = 0; i < size; i += 16) {
+		uint8x16_t x0 = veorq_u8(vld1q_u8(&p[0][i]), vld1q_u8(&pa[0][i]));
+		uint8x16_t x1 = veorq_u8(vld1q_u8(&p[1][i]), vld1q_u8(&pa[1][i]));
+
+		vst1q_u8(&pa[0][i], veorq_u8(raid_neon_mul(x0, t[0][0], t[0][1]), raid_neon_mul(x1, t[1][0], t[1][1])));
+		vst1q_u8(&pa[1][i], veorq_u8(raid_neon_mul(x0, t[2][0], t[2][1]), raid_neon_mul(x1, t[3][0], t[3][1])));
+	}
+}
+
+/*
+ * RAID recovering NEON implementation
+ */
+void raid_recX_neon(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	int N = nr;
+	uint8_t *p[RAID_PARITY_MAX];
+	uint8_t *pa[RAID_PARITY_MAX];
+	uint8_t G[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8_t V[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8x16_t pd[RAID_PARITY_MAX];
+	size_t i;
+	int j, k;
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = A(ip[j], id[k]);
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	for (i = 0; i < size; i += 16) {
+		/* delta */
+		for (j = 0; j < N; ++j)
+			pd[j] = veorq_u8(vld1q_u8(&p[j][i]), vld1q_u8(&pa[j][i]));
+
+		/* reconstruct */
+		for (j = 0; j < N; ++j) {
+			uint8x16_t b = vdupq_n_u8(0);
+
+			for (k = 0; k < N; ++k) {
+				uint8_t m = V[j * N + k];
+
+				b = veorq_u8(b, raid_neon_mul(pd[k], vld1q_u8(gfmulpshufb[m][0]), vld1q_u8(gfmulpshufb[m][1])));
+			}
+
+			vst1q_u8(&pa[j][i], b);
+		}
+	}
+}
+#endif
@@ -217,6 +217,18 @@ void raid_zero(void *zero)
  *   Each block has @size bytes.
  */
 void (*raid_gen_ptr[RAID_PARITY_MAX])(int nd, size_t size, void **vv);
+
+/*
+ * External engine, tried before the CPU functions.
+ */
+const struct raid_engine *raid_engine_ptr;
+
+static int raid_engine_mode(void)
+{
+	if (raid_gfgen == gfvandermonde)
+		return RAID_MODE_VANDERMONDE;
+	return RAID_MODE_CAUCHY;
+}
 void (*raid_gen3_ptr)(int nd, size_t size, void **vv);
 void (*raid_genz_ptr)(int nd, size_t size, void **vv);
 
@@ -229,6 +241,10 @@ void raid_gen(int nd, int np, size_t size, void **v)
 	BUG_ON(np < 1);
 	BUG_ON(np > RAID_PARITY_MAX);
 
+	if (raid_engine_ptr && raid_engine_ptr->gen
+		&& raid_engine_ptr->gen(raid_engine_ptr->context, raid_engine_mode(), nd, np, size, v) == 0)
+		return;
+
 	raid_gen_ptr[np - 1](nd, size, v);
 }
 
@@ -243,7 +259,7 @@ void raid_gen(int nd, int np, size_t size, void **v)
  * @V Destination matrix where the result is put.
  * @n Number of rows and columns of the matrix.
  */
-void raid_invert(uint8_t *M, uint8_t *V, int n)
+static void raid_invert_gauss(uint8_t *M, uint8_t *V, int n)
 {
 	int i, j, k;
 
@@ -282,16 +298,80 @@ void raid_invert(uint8_t *M, uint8_t *V, int n)
 	}
 }
 
+#ifdef RAID_THREAD_LOCAL
+/*
+ * Cache of the latest inverted matrices.
+ *
+ * When recovering, the set of failed blocks is usually the same for
+ * a lot of consecutive positions, and then the same matrix is inverted
+ * again and again.
+ *
+ * The cache is thread local, to keep the library usable by multiple
+ * threads at the same time.
+ */
+#define RAID_INVERT_CACHE_MAX 8
+
+struct raid_invert_cache {
+	int n;
+	uint8_t M[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+	uint8_t V[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+};
+
+static RAID_THREAD_LOCAL struct raid_invert_cache raid_invert_cache_map[RAID_INVERT_CACHE_MAX];
+static RAID_THREAD_LOCAL unsigned raid_invert_cache_next;
+#endif
+
+/**
+ * Inverts the square matrix M of size nxn into V.
+ *
+ * Like raid_invert_gauss(), but reusing the latest results, if possible.
+ * Note that the M matrix may be left unchanged.
+ */
+void raid_invert(uint8_t *M, uint8_t *V, int n)
+{
+#ifdef RAID_THREAD_LOCAL
+	struct raid_invert_cache *c;
+	size_t nn = n * n;
+	int i;
+
+	BUG_ON(n > RAID_PARITY_EXT_MAX);
+
+	/* search for the same matrix */
+	for (i = 0; i < RAID_INVERT_CACHE_MAX; ++i) {
+		c = &raid_invert_cache_map[i];
+		if (c->n == n && memcmp(c->M, M, nn) == 0) {
+			memcpy(V, c->V, nn);
+			return;
+		}
+	}
+
+	/* replace the oldest entry */
+	c = &raid_invert_cache_map[raid_invert_cache_next];
+	raid_invert_cache_next = (raid_invert_cache_next + 1) % RAID_INVERT_CACHE_MAX;
+
+	c->n = n;
+	memcpy(c->M, M, nn);
+
+	raid_invert_gauss(M, V, n);
+
+	memcpy(c->V, V, nn);
+#else
+	raid_invert_gauss(M, V, n);
+#endif
+}
+
 /**
  * Computes the parity without the missing data blocks
  * and store it in the buffers of such data blocks.
  *
  * This is the parity expressed as Pa,Qa,Ra,Sa,Ta,Ua in the equations.
+ *
+ * The parity is computed with the specified @gen function.
  */
-void raid_delta_gen(int nr, int *id, int *ip, int nd, size_t size, void **v)
+static __always_inline void raid_delta_gen_with(void (*gen)(int nd, int np, size_t size, void **v), int nr, int *id, int *ip, int nd, size_t size, void **v)
 {
-	void *p[RAID_PARITY_MAX];
-	void *pa[RAID_PARITY_MAX];
+	void *p[RAID_PARITY_EXT_MAX];
+	void *pa[RAID_PARITY_EXT_MAX];
 	int i, j;
 	int np;
 	void *latest;
@@ -360,7 +440,7 @@ void raid_delta_gen(int nr, int *id, int *ip, int nd, size_t size, void **v)
 
 	/* recompute the parity, note that np may be smaller than the */
 	/* total number of parities available */
-	raid_gen(nd, np, size, v);
+	gen(nd, np, size, v);
 
 	/* restore data buffers as before */
 	for (j = 0; j < nr; ++j)
@@ -371,6 +451,16 @@ void raid_delta_gen(int nr, int *id, int *ip, int nd, size_t size, void **v)
 		v[nd + i] = p[i];
 }
 
+void raid_delta_gen(int nr, int *id, int *ip, int nd, size_t size, void **v)
+{
+	raid_delta_gen_with(raid_gen, nr, id, ip, nd, size, v);
+}
+
+void raid_delta_gen_ext(int nr, int *id, int *ip, int nd, size_t size, void **v)
+{
+	raid_delta_gen_with(raid_gen_ext, nr, id, ip, nd, size, v);
+}
+
 /**
  * Recover failure of one data block for PAR1.
  *
@@ -492,6 +582,18 @@ void raid_rec2of2_int8(int *id, int *ip, int nd, size_t size, void **vv)
 void (*raid_rec_ptr[RAID_PARITY_MAX])(
 	int nr, int *id, int *ip, int nd, size_t size, void **vv);
 
+/*
+ * Recovers data blocks, trying first the external engine.
+ */
+static void raid_rec_data(int nr, int *id, int *ip, int nd, size_t size, void **v)
+{
+	if (raid_engine_ptr && raid_engine_ptr->data
+		&& raid_engine_ptr->data(raid_engine_ptr->context, raid_engine_mode(), nr, id, ip, nd, size, v) == 0)
+		return;
+
+	raid_rec_ptr[nr - 1](nr, id, ip, nd, size, v);
+}
+
 void raid_rec(int nr, int *ir, int nd, int np, size_t size, void **v)
 {
 	int nrd; /* number of data blocks to recover */
@@ -545,7 +647,7 @@ void raid_rec(int nr, int *ir, int nd, int np, size_t size, void **v)
 
 		/* recover the nrd data blocks specified in ir[], */
 		/* using the first nrd parity in ip[] for recovering */
-		raid_rec_ptr[nrd - 1](nrd, ir, ip, nd, size, v);
+		raid_rec_data(nrd, ir, ip, nd, size, v);
 	}
 
 	/* recompute all the parities up to the last bad one */
@@ -553,6 +655,83 @@ void raid_rec(int nr, int *ir, int nd, int np, size_t size, void **v)
 		raid_gen(nd, ir[nr - 1] - nd + 1, size, v);
 }
 
+/*
+ * Forwarders for the extended parity computation and recovering.
+ *
+ * Differently than the other forwarders, the number of parities
+ * is an explicit argument, as the same function handles all of them.
+ */
+void (*raid_genext_ptr)(int np, int nd, size_t size, void **vv);
+void (*raid_recext_ptr)(int nr, int *id, int *ip, int nd, size_t size, void **vv);
+
+void raid_gen_ext(int nd, int np, size_t size, void **v)
+{
+	/* enforce limit on size */
+	BUG_ON(size % 64 != 0);
+
+	/* enforce limit on number of parities and disks */
+	BUG_ON(np < 1);
+	BUG_ON(np > RAID_PARITY_EXT_MAX);
+	BUG_ON(nd > RAID_DATA_EXT_MAX);
+
+	raid_genext_ptr(np, nd, size, v);
+}
+
+void raid_rec_ext(int nr, int *ir, int nd, int np, size_t size, void **v)
+{
+	int nrd; /* number of data blocks to recover */
+	int nrp; /* number of parity blocks to recover */
+	int i;
+
+	/* enforce limit on size */
+	BUG_ON(size % 64 != 0);
+
+	/* enforce limit on number of failures */
+	BUG_ON(nr > np);
+	BUG_ON(np > RAID_PARITY_EXT_MAX);
+
+	/* enforce order in index vector */
+	for (i = 1; i < nr; ++i)
+		BUG_ON(ir[i - 1] >= ir[i]);
+
+	/* enforce limit on index vector */
+	BUG_ON(nr > 0 && ir[nr-1] >= nd + np);
+
+	/* count the number of data blocks to recover */
+	nrd = 0;
+	while (nrd < nr && ir[nrd] < nd)
+		++nrd;
+
+	/* all the remaining are parity */
+	nrp = nr - nrd;
+
+	/* if failed data is present */
+	if (nrd != 0) {
+		int ip[RAID_PARITY_EXT_MAX];
+		int j, k;
+
+		/* setup the vector of parities to use */
+		for (i = 0, j = 0, k = 0; i < np; ++i) {
+			if (j < nrp && ir[nrd + j] == nd + i) {
+				/* this parity has to be recovered */
+				++j;
+			} else {
+				/* this parity is used for recovering */
+				ip[k] = i;
+				++k;
+			}
+		}
+
+		/* recover the nrd data blocks specified in ir[], */
+		/* using the first nrd parity in ip[] for recovering */
+		raid_recext_ptr(nrd, ir, ip, nd, size, v);
+	}
+
+	/* recompute all the parities up to the last bad one */
+	if (nrp != 0)
+		raid_gen_ext(nd, ir[nr - 1] - nd + 1, size, v);
+}
+
 void raid_data(int nr, int *id, int *ip, int nd, size_t size, void **v)
 {
 	/* enforce limit on size */
@@ -581,6 +760,6 @@ void raid_data(int nr, int *id, int *ip, int nd, size_t size, void **v)
 
 	/* if failed data is present */
 	if (nr != 0)
-		raid_rec_ptr[nr - 1](nr, id, ip, nd, size, v);
+		raid_rec_data(nr, id, ip, nd, size, v);
 }
 
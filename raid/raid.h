@@ -44,6 +44,16 @@
  */
 #define RAID_DATA_MAX 251
 
+/**
+ * Maximum number of parity disks supported by the extended functions.
+ */
+#define RAID_PARITY_EXT_MAX 8
+
+/**
+ * Maximum number of data disks supported by the extended functions.
+ */
+#define RAID_DATA_EXT_MAX 249
+
 /**
  * Initializes the RAID system.
  *
@@ -84,6 +94,46 @@ void raid_mode(int mode);
  */
 void raid_zero(void *zero);
 
+/**
+ * External engine for parity generation and recovering.
+ *
+ * It allows to offload the computation to a different device, like a GPU,
+ * keeping the CPU functions as fallback.
+ *
+ * The functions receive the RAID_MODE_* in use, and the same arguments
+ * of raid_gen() and raid_data(). They return 0 if the operation was done,
+ * or a not zero value to fallback to the CPU implementation for this call.
+ */
+struct raid_engine {
+	const char *name; /**< Name of the engine. */
+	void *context; /**< Context passed to all the functions. */
+	int (*gen)(void *context, int mode, int nd, int np, size_t size, void **v);
+	int (*data)(void *context, int mode, int nr, int *id, int *ip, int nd, size_t size, void **v);
+};
+
+/**
+ * Sets the external engine to use.
+ *
+ * The engine is verified with raid_selftest() before being used, and
+ * it's rejected if the test fails. The test is done with the current mode,
+ * so call raid_mode() before this function.
+ *
+ * Use 0 to return to the CPU implementation.
+ *
+ * The @engine structure must remain valid until it's in use.
+ *
+ * Like raid_selftest(), it resets the zero buffer, so call raid_zero()
+ * after it.
+ *
+ * It returns 0 on success.
+ */
+int raid_engine(const struct raid_engine *engine);
+
+/**
+ * Gets the name of the engine in use, or "cpu" if none.
+ */
+const char *raid_engine_tag(void);
+
 /**
  * Computes parity blocks.
  *
@@ -123,6 +173,10 @@ void raid_gen(int nd, int np, size_t size, void **v);
  * This happens even in the case you have more parities blocks than needed,
  * and some form of integrity verification would be possible.
  *
+ * The latest inverted recovery matrices are cached for each thread,
+ * so recovering many blocks with the same set of failures doesn't
+ * repeat the matrix inversion at every call.
+ *
  * @nr Number of failed data and parity blocks to recover.
  * @ir[] Vector of @nr indexes of the failed data and parity blocks.
  *   The indexes start from 0. They must be in order.
@@ -225,5 +279,66 @@ int raid_check(int nr, int *ir, int nd, int np, size_t size, void **v);
  */
 int raid_scan(int *ir, int nd, int np, size_t size, void **v);
 
+/**
+ * Verifies parity blocks.
+ *
+ * This function computes the parity blocks like raid_gen(), and it
+ * compares them with the provided ones.
+ *
+ * The parity is computed in small chunks, and each one is compared while
+ * it's still in the CPU cache, without writing the computed parity in
+ * memory, and without reading it again for the comparison.
+ *
+ * Like raid_check(), it always uses the CPU functions, and not
+ * the external engine.
+ *
+ * No data or parity blocks are modified.
+ *
+ * @nd Number of data blocks.
+ * @np Number of parity blocks to verify.
+ * @size Size of the blocks pointed by @v. It must be a multiplier of 64.
+ * @v Vector of pointers to the blocks of data and parity.
+ *   It has (@nd + @np) elements. The starting elements are the blocks
+ *   for data, following with the parity blocks to verify.
+ *   Each block has @size bytes.
+ * @return Mask of the parity blocks not matching, with bit 0 for the
+ *   first parity. 0 if all the parities match.
+ */
+int raid_verify(int nd, int np, size_t size, void **v);
+
+/**
+ * Computes parity blocks with the extended Cauchy matrix.
+ *
+ * Like raid_gen(), but supporting up to RAID_PARITY_EXT_MAX parities
+ * and RAID_DATA_EXT_MAX data blocks.
+ *
+ * It uses a generic table-driven implementation for any number of parities,
+ * and it always uses the extended Cauchy matrix, ignoring the raid_mode().
+ * The first RAID_PARITY_MAX rows of the extended matrix are equal
+ * at the ones of RAID_MODE_CAUCHY, so the first parities are compatible
+ * with raid_gen() in such mode.
+ *
+ * @nd Number of data blocks. No more than RAID_DATA_EXT_MAX.
+ * @np Number of parities blocks to compute. No more than RAID_PARITY_EXT_MAX.
+ * @size Size of the blocks pointed by @v. It must be a multiplier of 64.
+ * @v Vector of pointers to the blocks of data and parity.
+ */
+void raid_gen_ext(int nd, int np, size_t size, void **v);
+
+/**
+ * Recovers failures in data and parity blocks with the extended Cauchy matrix.
+ *
+ * Like raid_rec(), but for parities computed with raid_gen_ext().
+ *
+ * @nr Number of failed data and parity blocks to recover.
+ * @ir[] Vector of @nr indexes of the failed data and parity blocks.
+ *   The indexes start from 0. They must be in order.
+ * @nd Number of data blocks. No more than RAID_DATA_EXT_MAX.
+ * @np Number of parity blocks. No more than RAID_PARITY_EXT_MAX.
+ * @size Size of the blocks pointed by @v. It must be a multiplier of 64.
+ * @v Vector of pointers to the blocks of data and parity.
+ */
+void raid_rec_ext(int nr, int *ir, int nd, int np, size_t size, void **v);
+
 #endif
 
@@ -9128,6 +9128,287 @@ const uint8_t __aligned(256) raid_gfcauchy[6][256] =
 	},
 };
 
+/**
+ * Extended Cauchy matrix used to generate parity with the generic functions.
+ * This matrix is valid for up to 8 parity with 249 data disks.
+ * The first 6 rows are equal at the ones of the Cauchy matrix.
+ */
+const uint8_t __aligned(256) raid_gfcauchyext[8][256] =
+{
+	{
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01,
+	},
+	{
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+		0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26,
+		0x4c, 0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9,
+		0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0,
+		0x9d, 0x27, 0x4e, 0x9c, 0x25, 0x4a, 0x94, 0x35,
+		0x6a, 0xd4, 0xb5, 0x77, 0xee, 0xc1, 0x9f, 0x23,
+		0x46, 0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0,
+		0x5d, 0xba, 0x69, 0xd2, 0xb9, 0x6f, 0xde, 0xa1,
+		0x5f, 0xbe, 0x61, 0xc2, 0x99, 0x2f, 0x5e, 0xbc,
+		0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0,
+		0xfd, 0xe7, 0xd3, 0xbb, 0x6b, 0xd6, 0xb1, 0x7f,
+		0xfe, 0xe1, 0xdf, 0xa3, 0x5b, 0xb6, 0x71, 0xe2,
+		0xd9, 0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88,
+		0x0d, 0x1a, 0x34, 0x68, 0xd0, 0xbd, 0x67, 0xce,
+		0x81, 0x1f, 0x3e, 0x7c, 0xf8, 0xed, 0xc7, 0x93,
+		0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc,
+		0x85, 0x17, 0x2e, 0x5c, 0xb8, 0x6d, 0xda, 0xa9,
+		0x4f, 0x9e, 0x21, 0x42, 0x84, 0x15, 0x2a, 0x54,
+		0xa8, 0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa,
+		0x49, 0x92, 0x39, 0x72, 0xe4, 0xd5, 0xb7, 0x73,
+		0xe6, 0xd1, 0xbf, 0x63, 0xc6, 0x91, 0x3f, 0x7e,
+		0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff,
+		0xe3, 0xdb, 0xab, 0x4b, 0x96, 0x31, 0x62, 0xc4,
+		0x95, 0x37, 0x6e, 0xdc, 0xa5, 0x57, 0xae, 0x41,
+		0x82, 0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e,
+		0x1c, 0x38, 0x70, 0xe0, 0xdd, 0xa7, 0x53, 0xa6,
+		0x51, 0xa2, 0x59, 0xb2, 0x79, 0xf2, 0xf9, 0xef,
+		0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09,
+		0x12, 0x24, 0x48, 0x90, 0x3d, 0x7a, 0xf4, 0xf5,
+		0xf7, 0xf3, 0xfb, 0xeb, 0xcb, 0x8b, 0x0b, 0x16,
+		0x2c, 0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83,
+		0x1b,
+	},
+	{
+		0x01, 0xf5, 0xd2, 0xc4, 0x9a, 0x71, 0xf1, 0x7f,
+		0xfc, 0x87, 0xc1, 0xc6, 0x19, 0x2f, 0x40, 0x55,
+		0x3d, 0xba, 0x53, 0x04, 0x9c, 0x61, 0x34, 0x8c,
+		0x46, 0x68, 0x70, 0x3e, 0xcc, 0x7d, 0x74, 0x75,
+		0xb5, 0xdb, 0x0c, 0xdf, 0x9e, 0x6d, 0x79, 0xeb,
+		0x63, 0x9f, 0x38, 0xd0, 0x94, 0xa5, 0x24, 0x89,
+		0x5c, 0x65, 0x5b, 0xae, 0x37, 0x33, 0x4c, 0xdd,
+		0x47, 0xf4, 0x02, 0xa6, 0x39, 0xd8, 0x9d, 0x2d,
+		0x62, 0xb9, 0x2e, 0x0f, 0x2b, 0x60, 0x58, 0xe4,
+		0xf8, 0x6c, 0x72, 0xb0, 0x85, 0x4d, 0x95, 0x41,
+		0x1c, 0x23, 0x05, 0x99, 0x32, 0xc5, 0x0e, 0x82,
+		0x91, 0x14, 0xd1, 0xaf, 0xf9, 0xb3, 0x07, 0x97,
+		0x6e, 0x0b, 0x67, 0x3b, 0x78, 0xe6, 0x28, 0x22,
+		0x4f, 0xa3, 0xca, 0x48, 0xde, 0x1d, 0xa8, 0x17,
+		0x6f, 0x90, 0xaa, 0x31, 0x5a, 0xf3, 0xe9, 0xa9,
+		0x44, 0x30, 0x56, 0x09, 0x59, 0x6a, 0x42, 0xcd,
+		0xe5, 0xd6, 0x86, 0xd9, 0xbf, 0xcb, 0x26, 0x66,
+		0x7c, 0xd5, 0xbe, 0x25, 0x1f, 0xe0, 0x98, 0x27,
+		0x92, 0x51, 0xc7, 0x45, 0x2c, 0xc0, 0xad, 0xa7,
+		0x69, 0xf7, 0xb4, 0xe8, 0x84, 0xe1, 0x18, 0x88,
+		0x3c, 0x76, 0x20, 0x5e, 0x9b, 0x1e, 0x0d, 0x81,
+		0x4a, 0xbd, 0x16, 0x8a, 0xac, 0x93, 0xce, 0x1a,
+		0xc2, 0x0a, 0x3f, 0xfd, 0xe3, 0x77, 0x6b, 0xd7,
+		0xef, 0xa4, 0x80, 0xa1, 0x36, 0xed, 0xa2, 0x12,
+		0x57, 0xb6, 0x29, 0x8d, 0x7b, 0xc8, 0x52, 0xc3,
+		0xbc, 0xb8, 0x21, 0xd4, 0xea, 0xd3, 0x06, 0xab,
+		0x2a, 0x1b, 0x5f, 0xb7, 0x10, 0xec, 0x64, 0xf6,
+		0xe2, 0x11, 0x50, 0x83, 0x54, 0x3a, 0xfa, 0xfb,
+		0xf2, 0x43, 0xb1, 0xff, 0xe7, 0xc9, 0x03, 0xbb,
+		0xee, 0x13, 0x8b, 0xdc, 0x35, 0xb2, 0xda, 0xcf,
+		0xa0, 0x96, 0x49, 0x4e, 0x08, 0x73, 0xf0, 0x7e,
+		0xfe,
+	},
+	{
+		0x01, 0xbb, 0xa6, 0xd7, 0xc7, 0x07, 0xce, 0x82,
+		0x4a, 0x2f, 0xa5, 0x9b, 0xb6, 0x60, 0xf1, 0xad,
+		0xe7, 0xf4, 0x06, 0xd2, 0xdf, 0x2e, 0xca, 0x65,
+		0x5c, 0x48, 0x21, 0xaa, 0xcd, 0x4e, 0xc1, 0x61,
+		0x38, 0x0a, 0x3e, 0xd1, 0xd5, 0xcb, 0x10, 0xdc,
+		0x5e, 0x24, 0xb8, 0xde, 0x79, 0x36, 0x43, 0x72,
+		0xd9, 0xf8, 0xf9, 0xa2, 0xa4, 0x6a, 0x3d, 0xea,
+		0x8e, 0x03, 0xf5, 0xab, 0xb4, 0x5d, 0xb5, 0x53,
+		0x6b, 0x39, 0x86, 0xb0, 0x50, 0x74, 0x96, 0x84,
+		0x5a, 0x4b, 0xe8, 0x49, 0xe5, 0x51, 0xef, 0x12,
+		0xbc, 0x89, 0x5b, 0x2b, 0x29, 0x09, 0xc3, 0x57,
+		0x1e, 0x37, 0x76, 0x0b, 0x64, 0x8a, 0x52, 0x59,
+		0x80, 0xda, 0xa8, 0x44, 0x95, 0x3c, 0x33, 0xe6,
+		0x7c, 0xaf, 0x6c, 0xb1, 0x9d, 0xfc, 0x92, 0xd6,
+		0xd8, 0xff, 0xa7, 0x77, 0x04, 0x13, 0x73, 0x66,
+		0x28, 0x7d, 0x83, 0xfb, 0x5f, 0x63, 0x25, 0x19,
+		0xbd, 0xc5, 0x3b, 0x6e, 0x20, 0x35, 0x55, 0x42,
+		0x31, 0xe1, 0xb9, 0x9e, 0x90, 0xd4, 0xba, 0xdb,
+		0xf7, 0x2a, 0xe9, 0x3a, 0xa0, 0x75, 0x7a, 0xd3,
+		0x02, 0xee, 0x9c, 0xc6, 0x1f, 0x14, 0xcc, 0x22,
+		0x4d, 0x30, 0x71, 0x58, 0x11, 0x85, 0x4f, 0x6f,
+		0x6d, 0x1d, 0xcf, 0xfa, 0x54, 0xa9, 0x17, 0xa3,
+		0x0f, 0xae, 0x0d, 0x1c, 0xc2, 0xd0, 0x32, 0x16,
+		0xf6, 0xc0, 0x7f, 0x2d, 0x15, 0xf3, 0x1b, 0xf2,
+		0xed, 0xb3, 0x45, 0xc8, 0xac, 0x7b, 0x2c, 0xe2,
+		0xe4, 0xbf, 0xbe, 0x9f, 0x34, 0x05, 0x70, 0x3f,
+		0x98, 0xfe, 0x62, 0x18, 0x9a, 0x56, 0x8d, 0x93,
+		0x97, 0x78, 0x4c, 0x7e, 0x27, 0x87, 0x08, 0x8b,
+		0xec, 0x67, 0x0e, 0x1a, 0x23, 0x8c, 0x68, 0x99,
+		0x94, 0x40, 0xb2, 0xa1, 0xeb, 0xb7, 0x26, 0xf0,
+		0xdd, 0xe3, 0x69, 0x0c, 0xc4, 0x88, 0x41, 0x81,
+		0x91,
+	},
+	{
+		0x01, 0x97, 0x7f, 0x9c, 0x7c, 0x18, 0xbd, 0xa2,
+		0x58, 0x1a, 0xda, 0x74, 0x70, 0xa3, 0xe5, 0x47,
+		0x29, 0x07, 0xf5, 0x80, 0x23, 0xe9, 0xfa, 0x46,
+		0x54, 0xa0, 0x99, 0x95, 0x53, 0x9b, 0x0b, 0xc7,
+		0x09, 0xc0, 0x78, 0x89, 0x92, 0xe3, 0x0d, 0xb0,
+		0x2a, 0x8c, 0xfb, 0x17, 0x3f, 0x26, 0x65, 0x87,
+		0x27, 0x5c, 0x66, 0x61, 0x79, 0x4d, 0x32, 0xb3,
+		0x8d, 0x52, 0xe2, 0x82, 0x3d, 0xf9, 0xc5, 0x02,
+		0xbc, 0x4c, 0x73, 0x48, 0x62, 0xaf, 0xba, 0x41,
+		0xd9, 0xc4, 0x2f, 0xb1, 0x33, 0xb8, 0x15, 0x7d,
+		0xcf, 0x3a, 0xa9, 0x5f, 0x84, 0x6d, 0x34, 0x1b,
+		0x44, 0x94, 0x72, 0x81, 0x42, 0xbe, 0xcc, 0x4b,
+		0x0a, 0x6f, 0x5a, 0x22, 0x36, 0xb5, 0x3c, 0x9d,
+		0x13, 0x7e, 0x08, 0xdd, 0xd6, 0x5e, 0x04, 0xfc,
+		0x5b, 0xec, 0xef, 0xf1, 0x6e, 0x1e, 0x77, 0x24,
+		0xe6, 0xc6, 0xaa, 0xcb, 0xfd, 0x51, 0x67, 0x06,
+		0x6a, 0x4a, 0x88, 0xdb, 0xb2, 0xc2, 0x5d, 0x43,
+		0x40, 0xf7, 0x50, 0xa8, 0xf2, 0x7a, 0x71, 0xa4,
+		0xd2, 0xbf, 0x31, 0x90, 0x19, 0x9a, 0x8e, 0xf6,
+		0xc3, 0xa6, 0xe7, 0x60, 0x12, 0xee, 0x2d, 0xde,
+		0x38, 0xe8, 0xb7, 0x98, 0xc1, 0x28, 0xf3, 0x05,
+		0x96, 0x63, 0xd1, 0xb9, 0x14, 0x9f, 0x1d, 0x83,
+		0x68, 0x75, 0xed, 0x16, 0x03, 0xce, 0xe4, 0xdf,
+		0xe0, 0x10, 0xae, 0x69, 0x55, 0x91, 0x2e, 0x4e,
+		0xfe, 0x21, 0x1f, 0x9e, 0xe1, 0xd5, 0xcd, 0xca,
+		0xf0, 0x8b, 0x2b, 0xc9, 0x8a, 0x93, 0xbb, 0x57,
+		0x20, 0x86, 0x1c, 0xa1, 0x4f, 0x3e, 0x25, 0xd4,
+		0x6c, 0xa5, 0x6b, 0xa7, 0x37, 0xff, 0x39, 0x35,
+		0x0c, 0xf8, 0xea, 0x56, 0x45, 0x8f, 0x2c, 0x59,
+		0xab, 0x85, 0xeb, 0x49, 0x0f, 0xdc, 0xd8, 0x76,
+		0xb6, 0xf4, 0x0e, 0x11, 0xb4, 0xd0, 0x30, 0xd3,
+		0x3b,
+	},
+	{
+		0x01, 0x2b, 0x3f, 0xcf, 0x73, 0x2c, 0xd6, 0xed,
+		0xcb, 0x74, 0x15, 0x78, 0x8a, 0xc1, 0x17, 0xc9,
+		0x89, 0x68, 0x21, 0xab, 0x76, 0x3b, 0x4b, 0x5a,
+		0x6e, 0x0e, 0xb9, 0xd3, 0xb6, 0x3e, 0x36, 0x86,
+		0xbf, 0xa2, 0xa7, 0x30, 0x14, 0xeb, 0xc7, 0x2d,
+		0x96, 0x67, 0x20, 0xb5, 0x9a, 0xe0, 0xa8, 0xc6,
+		0x80, 0x04, 0x8d, 0xfe, 0x75, 0x5e, 0x23, 0xca,
+		0x8f, 0x48, 0x99, 0x0d, 0xdf, 0x8e, 0xb8, 0x70,
+		0x29, 0x9c, 0x44, 0x69, 0x3d, 0xa5, 0xc2, 0x90,
+		0xd2, 0x1c, 0x9b, 0x02, 0x1d, 0x98, 0x93, 0xec,
+		0x84, 0xe8, 0x64, 0x4c, 0x3a, 0x8b, 0x97, 0xf3,
+		0xe5, 0xc0, 0x7d, 0x26, 0xc8, 0x08, 0xa0, 0x62,
+		0x82, 0x55, 0xf7, 0x33, 0xf6, 0x51, 0x63, 0x4d,
+		0x77, 0xda, 0xfd, 0xc3, 0x38, 0x6d, 0xee, 0x09,
+		0x47, 0xa3, 0x05, 0xde, 0xa6, 0xf1, 0x22, 0x25,
+		0x6a, 0x0c, 0x81, 0xb2, 0x6b, 0x58, 0xd5, 0xb3,
+		0xfc, 0xfb, 0x28, 0x7f, 0x07, 0xdc, 0x7a, 0x9e,
+		0xd0, 0x37, 0xb4, 0xe1, 0x1a, 0x24, 0x03, 0xae,
+		0x94, 0xba, 0x88, 0x2f, 0xea, 0x2e, 0x8c, 0x5b,
+		0xbb, 0x79, 0xd1, 0x11, 0xff, 0xa4, 0x19, 0x3c,
+		0x2a, 0x4e, 0x52, 0xe3, 0x95, 0xbd, 0x31, 0x5d,
+		0x35, 0x4a, 0x41, 0xc4, 0xdb, 0x42, 0xc5, 0x0b,
+		0x49, 0x1b, 0x7c, 0xe4, 0xb0, 0x9d, 0x45, 0xf0,
+		0xa9, 0x61, 0x57, 0x06, 0xd4, 0x40, 0x91, 0x56,
+		0x13, 0xfa, 0x87, 0xac, 0x27, 0x54, 0xdd, 0x59,
+		0x1f, 0x71, 0x39, 0x43, 0x6c, 0xf9, 0xbe, 0x4f,
+		0xf4, 0x1e, 0x32, 0xcd, 0xe9, 0x7e, 0x7b, 0x66,
+		0x5f, 0xef, 0xe7, 0x6f, 0x0a, 0x60, 0xd7, 0xb7,
+		0x83, 0x92, 0xe2, 0xaf, 0x72, 0xf8, 0xb1, 0x50,
+		0x10, 0xce, 0x18, 0x53, 0xa1, 0xcc, 0xad, 0x12,
+		0x34, 0x0f, 0xf5, 0xaa, 0x16, 0xe6, 0xf2, 0xd8,
+		0x85,
+	},
+	{
+		0x01, 0xe0, 0x18, 0xc8, 0xea, 0xec, 0x39, 0x2d,
+		0x23, 0xab, 0x7c, 0x10, 0xd3, 0x3f, 0xb9, 0xce,
+		0xa8, 0xff, 0xef, 0xb7, 0xd5, 0xc3, 0x5d, 0x09,
+		0xcb, 0xaf, 0x93, 0x2e, 0xaa, 0xc0, 0x4f, 0x0e,
+		0xcf, 0xb0, 0x61, 0xe1, 0x98, 0x72, 0xa0, 0x9b,
+		0x29, 0xb5, 0xf0, 0xc4, 0x2c, 0x31, 0x38, 0xee,
+		0x35, 0xfb, 0x33, 0x69, 0x68, 0x6b, 0x67, 0x6f,
+		0x1d, 0x1a, 0x15, 0xcc, 0x25, 0xe5, 0x16, 0x95,
+		0x65, 0x42, 0xe2, 0x74, 0x24, 0x0d, 0x3a, 0xd9,
+		0x8b, 0x8e, 0x94, 0xc1, 0x50, 0xe4, 0x73, 0xdb,
+		0x46, 0xf7, 0x28, 0x9f, 0x5a, 0xd1, 0x26, 0x53,
+		0x99, 0x03, 0x14, 0xf3, 0x6a, 0x5b, 0x56, 0x7a,
+		0xdc, 0x13, 0xbf, 0x59, 0xe9, 0x1c, 0x62, 0xfd,
+		0xb3, 0xed, 0x47, 0x0b, 0xd7, 0xe7, 0x20, 0x9c,
+		0x85, 0x7f, 0x86, 0xfa, 0xb2, 0x21, 0xca, 0x3c,
+		0x5f, 0xa4, 0x1b, 0x76, 0xc9, 0x32, 0x51, 0xa7,
+		0x4c, 0xdf, 0x97, 0xeb, 0x12, 0xe8, 0xf1, 0x4d,
+		0x8a, 0xba, 0x66, 0x2a, 0x80, 0xde, 0x90, 0x0f,
+		0x71, 0x84, 0x34, 0xd2, 0x7e, 0xb1, 0x17, 0x3b,
+		0x36, 0x07, 0x9e, 0x79, 0x6e, 0xf4, 0x3e, 0x4b,
+		0xbc, 0x37, 0xf2, 0x45, 0x9a, 0x2b, 0xb6, 0x1e,
+		0x89, 0x3d, 0xac, 0xf9, 0xe3, 0xe6, 0xb4, 0x57,
+		0x60, 0x49, 0x19, 0x8f, 0x2f, 0x08, 0xf8, 0x7b,
+		0x88, 0x48, 0xa1, 0x78, 0x77, 0x70, 0x02, 0x0a,
+		0x06, 0x05, 0x04, 0x5e, 0x96, 0x58, 0x83, 0x55,
+		0x5c, 0x41, 0xa9, 0x9d, 0xd8, 0x44, 0xf6, 0xcd,
+		0x1f, 0xf5, 0x8c, 0x0c, 0xdd, 0xa2, 0x63, 0x22,
+		0xad, 0xc7, 0x43, 0xfe, 0xc2, 0xa6, 0x64, 0x30,
+		0xae, 0xb8, 0xda, 0x82, 0x92, 0xc5, 0xa3, 0xd4,
+		0x52, 0xbe, 0x7d, 0x11, 0xc6, 0x4e, 0x40, 0x54,
+		0x81, 0x87, 0xa5, 0x75, 0x8d, 0x6c, 0x27, 0x91,
+		0xbb,
+	},
+	{
+		0x01, 0xfd, 0x1b, 0x89, 0xf1, 0x53, 0x5e, 0x86,
+		0xf4, 0x7e, 0x5d, 0xda, 0x2b, 0x81, 0x63, 0xc8,
+		0x90, 0xcd, 0x59, 0xa2, 0x87, 0xd0, 0xb4, 0x27,
+		0xa4, 0xb3, 0x62, 0xe0, 0xbb, 0xa5, 0xd8, 0x77,
+		0x35, 0xc7, 0x15, 0x2f, 0xa6, 0x68, 0x13, 0x0e,
+		0x71, 0x5c, 0xeb, 0x4a, 0xf3, 0x47, 0xd9, 0xa3,
+		0xc0, 0xdb, 0x67, 0x73, 0x4f, 0xbf, 0x1f, 0xb9,
+		0xd5, 0x19, 0x4b, 0xfe, 0x45, 0x25, 0xcb, 0x97,
+		0x41, 0x29, 0xde, 0xea, 0xe4, 0x6f, 0x52, 0x4e,
+		0x0a, 0xdf, 0xaf, 0x34, 0x51, 0xb2, 0x7a, 0x11,
+		0x30, 0x1a, 0x43, 0xbc, 0xf2, 0xc2, 0x08, 0x3b,
+		0x3c, 0x0d, 0x60, 0x5b, 0xa8, 0x4c, 0x06, 0x16,
+		0x61, 0xf9, 0x80, 0xb5, 0xad, 0xfb, 0xb8, 0x09,
+		0xe5, 0x05, 0x9c, 0x8a, 0x6d, 0xba, 0x7f, 0x96,
+		0x42, 0xaa, 0xd4, 0x1d, 0xae, 0x33, 0x17, 0xf8,
+		0x38, 0xc1, 0xf6, 0x0f, 0xcf, 0x20, 0x04, 0x99,
+		0x2a, 0xe3, 0x9d, 0x75, 0xa1, 0x48, 0x8d, 0x5a,
+		0xbd, 0xab, 0x32, 0xd2, 0x3e, 0x8f, 0xcc, 0x9a,
+		0x82, 0xb7, 0xce, 0x56, 0x21, 0x31, 0x7b, 0x9f,
+		0x6c, 0x57, 0x3a, 0x0b, 0x0c, 0x3f, 0xf5, 0xc5,
+		0x8b, 0x74, 0x2d, 0x07, 0x26, 0x4d, 0x85, 0x66,
+		0x03, 0x98, 0xe8, 0x3d, 0x79, 0x65, 0x58, 0xd3,
+		0xdd, 0xe9, 0x1e, 0x76, 0xa0, 0xfc, 0x12, 0x72,
+		0xc9, 0x7c, 0x2e, 0xe2, 0x8e, 0x28, 0x88, 0x78,
+		0x44, 0x50, 0xec, 0xf7, 0x94, 0xee, 0x70, 0xc4,
+		0x7d, 0xdc, 0x6b, 0x46, 0x39, 0x24, 0x5f, 0x91,
+		0x18, 0x22, 0xf0, 0x02, 0x40, 0xef, 0x92, 0x8c,
+		0xd7, 0x55, 0x84, 0x93, 0x10, 0x83, 0xe7, 0xb0,
+		0x95, 0x6e, 0xfa, 0xa7, 0xff, 0x54, 0xb6, 0x1c,
+		0xed, 0x6a, 0x49, 0xc3, 0xb1, 0x69, 0x64, 0xc6,
+		0xbe, 0x2c, 0xca, 0x36, 0x23, 0xd6, 0x9b, 0xa9,
+		0xe6,
+	},
+};
+
 #ifdef CONFIG_X86
 /**
  * PSHUFB tables for the Cauchy matrix.
@@ -13658,7 +13939,7 @@ const uint8_t __aligned(256) raid_gfcauchypshufb[251][4][2][16] =
 };
 #endif
 
-#ifdef CONFIG_X86
+#if defined(CONFIG_X86) || defined(CONFIG_NEON)
 /**
  * PSHUFB tables for generic multiplication.
  *
@@ -14694,3 +14975,81 @@ const uint8_t __aligned(256) raid_gfmulpshufb[256][2][16] =
 };
 #endif
 
+#ifdef CONFIG_X86
+/**
+ * GF2P8AFFINEQB matrices for generic multiplication.
+ *
+ * Indexes are [MULTIPLIER].
+ * Where MULTIPLIER is from 0 to 255.
+ * The byte 7-b of each matrix selects the bits of the input
+ * to xor to get the bit b of the product.
+ */
+const uint64_t __aligned(256) raid_gfmulgfni[256] =
+{
+	0x0000000000000000ULL, 0x0102040810204080ULL, 0x8001828488102040ULL, 0x8103868c983060c0ULL,
+	0x408041c2c4881020ULL, 0x418245cad4a850a0ULL, 0xc081c3464c983060ULL, 0xc183c74e5cb870e0ULL,
+	0x2040a061e2c48810ULL, 0x2142a469f2e4c890ULL, 0xa04122e56ad4a850ULL, 0xa14326ed7af4e8d0ULL,
+	0x60c0e1a3264c9830ULL, 0x61c2e5ab366cd8b0ULL, 0xe0c16327ae5cb870ULL, 0xe1c3672fbe7cf8f0ULL,
+	0x102050b071e2c488ULL, 0x112254b861c28408ULL, 0x9021d234f9f2e4c8ULL, 0x9123d63ce9d2a448ULL,
+	0x50a01172b56ad4a8ULL, 0x51a2157aa54a9428ULL, 0xd0a193f63d7af4e8ULL, 0xd1a397fe2d5ab468ULL,
+	0x3060f0d193264c98ULL, 0x3162f4d983060c18ULL, 0xb06172551b366cd8ULL, 0xb163765d0b162c58ULL,
+	0x70e0b11357ae5cb8ULL, 0x71e2b51b478e1c38ULL, 0xf0e13397dfbe7cf8ULL, 0xf1e3379fcf9e3c78ULL,
+	0x8810a8d83871e2c4ULL, 0x8912acd02851a244ULL, 0x08112a5cb061c284ULL, 0x09132e54a0418204ULL,
+	0xc890e91afcf9f2e4ULL, 0xc992ed12ecd9b264ULL, 0x48916b9e74e9d2a4ULL, 0x49936f9664c99224ULL,
+	0xa85008b9dab56ad4ULL, 0xa9520cb1ca952a54ULL, 0x28518a3d52a54a94ULL, 0x29538e3542850a14ULL,
+	0xe8d0497b1e3d7af4ULL, 0xe9d24d730e1d3a74ULL, 0x68d1cbff962d5ab4ULL, 0x69d3cff7860d1a34ULL,
+	0x9830f8684993264cULL, 0x9932fc6059b366ccULL, 0x18317aecc183060cULL, 0x19337ee4d1a3468cULL,
+	0xd8b0b9aa8d1b366cULL, 0xd9b2bda29d3b76ecULL, 0x58b13b2e050b162cULL, 0x59b33f26152b56acULL,
+	0xb8705809ab57ae5cULL, 0xb9725c01bb77eedcULL, 0x3871da8d23478e1cULL, 0x3973de853367ce9cULL,
+	0xf8f019cb6fdfbe7cULL, 0xf9f21dc37ffffefcULL, 0x78f19b4fe7cf9e3cULL, 0x79f39f47f7efdebcULL,
+	0xc488d46c1c3871e2ULL, 0xc58ad0640c183162ULL, 0x448956e8942851a2ULL, 0x458b52e084081122ULL,
+	0x840895aed8b061c2ULL, 0x850a91a6c8902142ULL, 0x0409172a50a04182ULL, 0x050b132240800102ULL,
+	0xe4c8740dfefcf9f2ULL, 0xe5ca7005eedcb972ULL, 0x64c9f68976ecd9b2ULL, 0x65cbf28166cc9932ULL,
+	0xa44835cf3a74e9d2ULL, 0xa54a31c72a54a952ULL, 0x2449b74bb264c992ULL, 0x254bb343a2448912ULL,
+	0xd4a884dc6ddab56aULL, 0xd5aa80d47dfaf5eaULL, 0x54a90658e5ca952aULL, 0x55ab0250f5ead5aaULL,
+	0x9428c51ea952a54aULL, 0x952ac116b972e5caULL, 0x1429479a2142850aULL, 0x152b43923162c58aULL,
+	0xf4e824bd8f1e3d7aULL, 0xf5ea20b59f3e7dfaULL, 0x74e9a639070e1d3aULL, 0x75eba231172e5dbaULL,
+	0xb468657f4b962d5aULL, 0xb56a61775bb66ddaULL, 0x3469e7fbc3860d1aULL, 0x356be3f3d3a64d9aULL,
+	0x4c987cb424499326ULL, 0x4d9a78bc3469d3a6ULL, 0xcc99fe30ac59b366ULL, 0xcd9bfa38bc79f3e6ULL,
+	0x0c183d76e0c18306ULL, 0x0d1a397ef0e1c386ULL, 0x8c19bff268d1a346ULL, 0x8d1bbbfa78f1e3c6ULL,
+	0x6cd8dcd5c68d1b36ULL, 0x6ddad8ddd6ad5bb6ULL, 0xecd95e514e9d3b76ULL, 0xeddb5a595ebd7bf6ULL,
+	0x2c589d1702050b16ULL, 0x2d5a991f12254b96ULL, 0xac591f938a152b56ULL, 0xad5b1b9b9a356bd6ULL,
+	0x5cb82c0455ab57aeULL, 0x5dba280c458b172eULL, 0xdcb9ae80ddbb77eeULL, 0xddbbaa88cd9b376eULL,
+	0x1c386dc69123478eULL, 0x1d3a69ce8103070eULL, 0x9c39ef42193367ceULL, 0x9d3beb4a0913274eULL,
+	0x7cf88c65b76fdfbeULL, 0x7dfa886da74f9f3eULL, 0xfcf90ee13f7ffffeULL, 0xfdfb0ae92f5fbf7eULL,
+	0x3c78cda773e7cf9eULL, 0x3d7ac9af63c78f1eULL, 0xbc794f23fbf7efdeULL, 0xbd7b4b2bebd7af5eULL,
+	0xe2c46a368e1c3871ULL, 0xe3c66e3e9e3c78f1ULL, 0x62c5e8b2060c1831ULL, 0x63c7ecba162c58b1ULL,
+	0xa2442bf44a942851ULL, 0xa3462ffc5ab468d1ULL, 0x2245a970c2840811ULL, 0x2347ad78d2a44891ULL,
+	0xc284ca576cd8b061ULL, 0xc386ce5f7cf8f0e1ULL, 0x428548d3e4c89021ULL, 0x43874cdbf4e8d0a1ULL,
+	0x82048b95a850a041ULL, 0x83068f9db870e0c1ULL, 0x0205091120408001ULL, 0x03070d193060c081ULL,
+	0xf2e43a86fffefcf9ULL, 0xf3e63e8eefdebc79ULL, 0x72e5b80277eedcb9ULL, 0x73e7bc0a67ce9c39ULL,
+	0xb2647b443b76ecd9ULL, 0xb3667f4c2b56ac59ULL, 0x3265f9c0b366cc99ULL, 0x3367fdc8a3468c19ULL,
+	0xd2a49ae71d3a74e9ULL, 0xd3a69eef0d1a3469ULL, 0x52a51863952a54a9ULL, 0x53a71c6b850a1429ULL,
+	0x9224db25d9b264c9ULL, 0x9326df2dc9922449ULL, 0x122559a151a24489ULL, 0x13275da941820409ULL,
+	0x6ad4c2eeb66ddab5ULL, 0x6bd6c6e6a64d9a35ULL, 0xead5406a3e7dfaf5ULL, 0xebd744622e5dba75ULL,
+	0x2a54832c72e5ca95ULL, 0x2b56872462c58a15ULL, 0xaa5501a8faf5ead5ULL, 0xab5705a0ead5aa55ULL,
+	0x4a94628f54a952a5ULL, 0x4b96668744891225ULL, 0xca95e00bdcb972e5ULL, 0xcb97e403cc993265ULL,
+	0x0a14234d90214285ULL, 0x0b16274580010205ULL, 0x8a15a1c9183162c5ULL, 0x8b17a5c108112245ULL,
+	0x7af4925ec78f1e3dULL, 0x7bf69656d7af5ebdULL, 0xfaf510da4f9f3e7dULL, 0xfbf714d25fbf7efdULL,
+	0x3a74d39c03070e1dULL, 0x3b76d79413274e9dULL, 0xba7551188b172e5dULL, 0xbb7755109b376eddULL,
+	0x5ab4323f254b962dULL, 0x5bb63637356bd6adULL, 0xdab5b0bbad5bb66dULL, 0xdbb7b4b3bd7bf6edULL,
+	0x1a3473fde1c3860dULL, 0x1b3677f5f1e3c68dULL, 0x9a35f17969d3a64dULL, 0x9b37f57179f3e6cdULL,
+	0x264cbe5a92244993ULL, 0x274eba5282040913ULL, 0xa64d3cde1a3469d3ULL, 0xa74f38d60a142953ULL,
+	0x66ccff9856ac59b3ULL, 0x67cefb90468c1933ULL, 0xe6cd7d1cdebc79f3ULL, 0xe7cf7914ce9c3973ULL,
+	0x060c1e3b70e0c183ULL, 0x070e1a3360c08103ULL, 0x860d9cbff8f0e1c3ULL, 0x870f98b7e8d0a143ULL,
+	0x468c5ff9b468d1a3ULL, 0x478e5bf1a4489123ULL, 0xc68ddd7d3c78f1e3ULL, 0xc78fd9752c58b163ULL,
+	0x366ceeeae3c68d1bULL, 0x376eeae2f3e6cd9bULL, 0xb66d6c6e6bd6ad5bULL, 0xb76f68667bf6eddbULL,
+	0x76ecaf28274e9d3bULL, 0x77eeab20376eddbbULL, 0xf6ed2dacaf5ebd7bULL, 0xf7ef29a4bf7efdfbULL,
+	0x162c4e8b0102050bULL, 0x172e4a831122458bULL, 0x962dcc0f8912254bULL, 0x972fc807993265cbULL,
+	0x56ac0f49c58a152bULL, 0x57ae0b41d5aa55abULL, 0xd6ad8dcd4d9a356bULL, 0xd7af89c55dba75ebULL,
+	0xae5c1682aa55ab57ULL, 0xaf5e128aba75ebd7ULL, 0x2e5d940622458b17ULL, 0x2f5f900e3265cb97ULL,
+	0xeedc57406eddbb77ULL, 0xefde53487efdfbf7ULL, 0x6eddd5c4e6cd9b37ULL, 0x6fdfd1ccf6eddbb7ULL,
+	0x8e1cb6e348912347ULL, 0x8f1eb2eb58b163c7ULL, 0x0e1d3467c0810307ULL, 0x0f1f306fd0a14387ULL,
+	0xce9cf7218c193367ULL, 0xcf9ef3299c3973e7ULL, 0x4e9d75a504091327ULL, 0x4f9f71ad142953a7ULL,
+	0xbe7c4632dbb76fdfULL, 0xbf7e423acb972f5fULL, 0x3e7dc4b653a74f9fULL, 0x3f7fc0be43870f1fULL,
+	0xfefc07f01f3f7fffULL, 0xfffe03f80f1f3f7fULL, 0x7efd8574972f5fbfULL, 0x7fff817c870f1f3fULL,
+	0x9e3ce6533973e7cfULL, 0x9f3ee25b2953a74fULL, 0x1e3d64d7b163c78fULL, 0x1f3f60dfa143870fULL,
+	0xdebca791fdfbf7efULL, 0xdfbea399eddbb76fULL, 0x5ebd251575ebd7afULL, 0x5fbf211d65cb972fULL,
+};
+#endif
+
@@ -13,69 +13,101 @@
  */
 
 #include "internal.h"
+#include "cpu.h"
 
 static struct raid_func {
 	const char *name;
+	const char *kind;
 	void (*p)();
 } RAID_FUNC[] = {
-	{ "int8", raid_gen3_int8 },
-	{ "int8", raid_gen4_int8 },
-	{ "int8", raid_gen5_int8 },
-	{ "int8", raid_gen6_int8 },
-	{ "int32", raid_gen1_int32 },
-	{ "int64", raid_gen1_int64 },
-	{ "int32", raid_gen2_int32 },
-	{ "int64", raid_gen2_int64 },
-	{ "int32", raid_genz_int32 },
-	{ "int64", raid_genz_int64 },
-	{ "int8", raid_rec1_int8 },
-	{ "int8", raid_rec2_int8 },
-	{ "int8", raid_recX_int8 },
+	{ "int8", "gen3", raid_gen3_int8 },
+	{ "int8", "gen4", raid_gen4_int8 },
+	{ "int8", "gen5", raid_gen5_int8 },
+	{ "int8", "gen6", raid_gen6_int8 },
+	{ "int32", "gen1", raid_gen1_int32 },
+	{ "int64", "gen1", raid_gen1_int64 },
+	{ "int32", "gen2", raid_gen2_int32 },
+	{ "int64", "gen2", raid_gen2_int64 },
+	{ "int32", "genz", raid_genz_int32 },
+	{ "int64", "genz", raid_genz_int64 },
+	{ "int8", "rec1", raid_rec1_int8 },
+	{ "int8", "rec2", raid_rec2_int8 },
+	{ "int8", "recX", raid_recX_int8 },
+	{ "int8", "genext", raid_genext_int8 },
+	{ "int8", "recext", raid_recext_int8 },
 
 #ifdef CONFIG_X86
 #ifdef CONFIG_SSE2
-	{ "sse2", raid_gen1_sse2 },
-	{ "sse2", raid_gen2_sse2 },
-	{ "sse2", raid_genz_sse2 },
+	{ "sse2", "gen1", raid_gen1_sse2 },
+	{ "sse2", "gen2", raid_gen2_sse2 },
+	{ "sse2", "genz", raid_genz_sse2 },
+	{ "sse2p", "gen1", raid_gen1_sse2p },
+	{ "sse2p", "gen2", raid_gen2_sse2p },
 #endif
 #ifdef CONFIG_SSSE3
-	{ "ssse3", raid_gen3_ssse3 },
-	{ "ssse3", raid_gen4_ssse3 },
-	{ "ssse3", raid_gen5_ssse3 },
-	{ "ssse3", raid_gen6_ssse3 },
-	{ "ssse3", raid_rec1_ssse3 },
-	{ "ssse3", raid_rec2_ssse3 },
-	{ "ssse3", raid_recX_ssse3 },
+	{ "ssse3", "gen3", raid_gen3_ssse3 },
+	{ "ssse3", "gen4", raid_gen4_ssse3 },
+	{ "ssse3", "gen5", raid_gen5_ssse3 },
+	{ "ssse3", "gen6", raid_gen6_ssse3 },
+	{ "ssse3", "rec1", raid_rec1_ssse3 },
+	{ "ssse3", "rec2", raid_rec2_ssse3 },
+	{ "ssse3", "recX", raid_recX_ssse3 },
+	{ "ssse3", "genext", raid_genext_ssse3 },
+	{ "ssse3", "recext", raid_recext_ssse3 },
 #endif
 #ifdef CONFIG_AVX2
-	{ "avx2", raid_gen1_avx2 },
-	{ "avx2", raid_gen2_avx2 },
-	{ "avx2", raid_rec1_avx2 },
-	{ "avx2", raid_rec2_avx2 },
-	{ "avx2", raid_recX_avx2 },
+	{ "avx2", "gen1", raid_gen1_avx2 },
+	{ "avx2", "gen2", raid_gen2_avx2 },
+	{ "avx2", "rec1", raid_rec1_avx2 },
+	{ "avx2", "rec2", raid_rec2_avx2 },
+	{ "avx2", "recX", raid_recX_avx2 },
+	{ "avx2", "genext", raid_genext_avx2 },
+	{ "avx2", "recext", raid_recext_avx2 },
+	{ "avx2p", "gen1", raid_gen1_avx2p },
+	{ "avx2p", "gen2", raid_gen2_avx2p },
 #endif
 #endif
 
 #ifdef CONFIG_X86_64
 #ifdef CONFIG_SSE2
-	{ "sse2e", raid_gen2_sse2ext },
-	{ "sse2e", raid_genz_sse2ext },
+	{ "sse2e", "gen2", raid_gen2_sse2ext },
+	{ "sse2e", "genz", raid_genz_sse2ext },
 #endif
 #ifdef CONFIG_SSSE3
-	{ "ssse3e", raid_gen3_ssse3ext },
-	{ "ssse3e", raid_gen4_ssse3ext },
-	{ "ssse3e", raid_gen5_ssse3ext },
-	{ "ssse3e", raid_gen6_ssse3ext },
+	{ "ssse3e", "gen3", raid_gen3_ssse3ext },
+	{ "ssse3e", "gen4", raid_gen4_ssse3ext },
+	{ "ssse3e", "gen5", raid_gen5_ssse3ext },
+	{ "ssse3e", "gen6", raid_gen6_ssse3ext },
 #endif
 #ifdef CONFIG_AVX2
-	{ "avx2e", raid_gen3_avx2ext },
-	{ "avx2e", raid_genz_avx2ext },
-	{ "avx2e", raid_gen4_avx2ext },
-	{ "avx2e", raid_gen5_avx2ext },
-	{ "avx2e", raid_gen6_avx2ext },
+	{ "avx2e", "gen3", raid_gen3_avx2ext },
+	{ "avx2e", "genz", raid_genz_avx2ext },
+	{ "avx2e", "gen4", raid_gen4_avx2ext },
+	{ "avx2e", "gen5", raid_gen5_avx2ext },
+	{ "avx2e", "gen6", raid_gen6_avx2ext },
+	{ "avx2e", "genext", raid_genext_avx2ext },
 #endif
+#ifdef CONFIG_AVX512GFNI
+	{ "avx512g", "gen3", raid_gen3_avx512gfni },
+	{ "avx512g", "gen4", raid_gen4_avx512gfni },
+	{ "avx512g", "gen5", raid_gen5_avx512gfni },
+	{ "avx512g", "gen6", raid_gen6_avx512gfni },
+	{ "avx512g", "recX", raid_recX_avx512gfni },
 #endif
-	{ 0, 0 }
+#endif
+
+#ifdef CONFIG_NEON
+	{ "neon", "gen1", raid_gen1_neon },
+	{ "neon", "gen2", raid_gen2_neon },
+	{ "neon", "gen3", raid_gen3_neon },
+	{ "neon", "gen4", raid_gen4_neon },
+	{ "neon", "gen5", raid_gen5_neon },
+	{ "neon", "gen6", raid_gen6_neon },
+	{ "neon", "rec1", raid_rec1_neon },
+	{ "neon", "rec2", raid_rec2_neon },
+	{ "neon", "recX", raid_recX_neon },
+#endif
+	{ 0, 0, 0 }
 };
 
 static const char *raid_tag(void (*func)())
@@ -143,3 +175,110 @@ const char *raid_recX_tag(void)
 	return raid_tag(raid_rec_ptr[2]);
 }
 
+const char *raid_genext_tag(void)
+{
+	return raid_tag(raid_genext_ptr);
+}
+
+const char *raid_recext_tag(void)
+{
+	return raid_tag(raid_recext_ptr);
+}
+
+/*
+ * Functions that can be selected, with the kind of implementation to use.
+ */
+static struct raid_slot {
+	const char *name;
+	const char *kind;
+	void (**p)();
+} RAID_SLOT[] = {
+	{ "gen1", "gen1", (void (**)()) &raid_gen_ptr[0] },
+	{ "gen2", "gen2", (void (**)()) &raid_gen_ptr[1] },
+	{ "genz", "genz", (void (**)()) &raid_genz_ptr },
+	{ "gen3", "gen3", (void (**)()) &raid_gen3_ptr },
+	{ "gen4", "gen4", (void (**)()) &raid_gen_ptr[3] },
+	{ "gen5", "gen5", (void (**)()) &raid_gen_ptr[4] },
+	{ "gen6", "gen6", (void (**)()) &raid_gen_ptr[5] },
+	{ "rec1", "rec1", (void (**)()) &raid_rec_ptr[0] },
+	{ "rec2", "rec2", (void (**)()) &raid_rec_ptr[1] },
+	{ "rec3", "recX", (void (**)()) &raid_rec_ptr[2] },
+	{ "rec4", "recX", (void (**)()) &raid_rec_ptr[3] },
+	{ "rec5", "recX", (void (**)()) &raid_rec_ptr[4] },
+	{ "rec6", "recX", (void (**)()) &raid_rec_ptr[5] },
+	{ "genext", "genext", (void (**)()) &raid_genext_ptr },
+	{ "recext", "recext", (void (**)()) &raid_recext_ptr },
+	{ 0, 0, 0 }
+};
+
+/*
+ * Checks if the CPU supports the implementation with the specified tag.
+ */
+static int raid_tag_supported(const char *tag)
+{
+#ifdef CONFIG_X86
+	if (strcmp(tag, "sse2") == 0 || strcmp(tag, "sse2e") == 0 || strcmp(tag, "sse2p") == 0)
+		return raid_cpu_has_sse2();
+	if (strcmp(tag, "ssse3") == 0 || strcmp(tag, "ssse3e") == 0)
+		return raid_cpu_has_ssse3();
+	if (strcmp(tag, "avx2") == 0 || strcmp(tag, "avx2e") == 0 || strcmp(tag, "avx2p") == 0)
+		return raid_cpu_has_avx2();
+	if (strcmp(tag, "avx512g") == 0)
+		return raid_cpu_has_avx512gfni();
+#else
+	(void)tag;
+#endif
+	return 1;
+}
+
+static struct raid_slot *raid_slot(const char *func)
+{
+	struct raid_slot *i = RAID_SLOT;
+
+	while (i->name != 0) {
+		if (strcmp(i->name, func) == 0)
+			return i;
+		++i;
+	}
+
+	return 0;
+}
+
+int raid_select(const char *func, const char *tag)
+{
+	struct raid_slot *slot = raid_slot(func);
+	struct raid_func *i = RAID_FUNC;
+
+	if (!slot)
+		return -1;
+
+	if (!raid_tag_supported(tag))
+		return -1;
+
+	while (i->name != 0) {
+		if (strcmp(i->kind, slot->kind) == 0 && strcmp(i->name, tag) == 0) {
+			*slot->p = i->p;
+
+			/* refresh the triple parity function, that depends on the mode */
+			if (raid_gfgen == gfvandermonde)
+				raid_gen_ptr[2] = raid_genz_ptr;
+			else
+				raid_gen_ptr[2] = raid_gen3_ptr;
+
+			return 0;
+		}
+		++i;
+	}
+
+	return -1;
+}
+
+const char *raid_selected(const char *func)
+{
+	struct raid_slot *slot = raid_slot(func);
+
+	if (!slot)
+		return 0;
+
+	return raid_tag(*slot->p);
+}
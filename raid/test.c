@@ -208,6 +208,9 @@ int raid_test_rec(int mode, int nd, size_t size)
 			if (raid_cpu_has_avx2())
 				f[i][nf[i]++] = raid_rec1_avx2;
 #endif
+#endif
+#ifdef CONFIG_NEON
+			f[i][nf[i]++] = raid_rec1_neon;
 #endif
 		} else if (i == 1) {
 			f[i][nf[i]++] = raid_rec2_int8;
@@ -220,6 +223,9 @@ int raid_test_rec(int mode, int nd, size_t size)
 			if (raid_cpu_has_avx2())
 				f[i][nf[i]++] = raid_rec2_avx2;
 #endif
+#endif
+#ifdef CONFIG_NEON
+			f[i][nf[i]++] = raid_rec2_neon;
 #endif
 		} else {
 			f[i][nf[i]++] = raid_recX_int8;
@@ -232,6 +238,13 @@ int raid_test_rec(int mode, int nd, size_t size)
 			if (raid_cpu_has_avx2())
 				f[i][nf[i]++] = raid_recX_avx2;
 #endif
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+			if (raid_cpu_has_avx512gfni())
+				f[i][nf[i]++] = raid_recX_avx512gfni;
+#endif
+#endif
+#ifdef CONFIG_NEON
+			f[i][nf[i]++] = raid_recX_neon;
 #endif
 		}
 	}
@@ -352,7 +365,9 @@ int raid_test_par(int mode, int nd, size_t size)
 #ifdef CONFIG_SSE2
 	if (raid_cpu_has_sse2()) {
 		f[nf++] = raid_gen1_sse2;
+		f[nf++] = raid_gen1_sse2p;
 		f[nf++] = raid_gen2_sse2;
+		f[nf++] = raid_gen2_sse2p;
 #ifdef CONFIG_X86_64
 		f[nf++] = raid_gen2_sse2ext;
 #endif
@@ -362,11 +377,18 @@ int raid_test_par(int mode, int nd, size_t size)
 #ifdef CONFIG_AVX2
 	if (raid_cpu_has_avx2()) {
 		f[nf++] = raid_gen1_avx2;
+		f[nf++] = raid_gen1_avx2p;
 		f[nf++] = raid_gen2_avx2;
+		f[nf++] = raid_gen2_avx2p;
 	}
 #endif
 #endif /* CONFIG_X86 */
 
+#ifdef CONFIG_NEON
+	f[nf++] = raid_gen1_neon;
+	f[nf++] = raid_gen2_neon;
+#endif
+
 	if (mode == RAID_MODE_CAUCHY) {
 		f[nf++] = raid_gen3_int8;
 		f[nf++] = raid_gen4_int8;
@@ -399,7 +421,25 @@ int raid_test_par(int mode, int nd, size_t size)
 		}
 #endif
 #endif
+
+#ifdef CONFIG_AVX512GFNI
+#ifdef CONFIG_X86_64
+		if (raid_cpu_has_avx512gfni()) {
+			f[nf++] = raid_gen3_avx512gfni;
+			f[nf++] = raid_gen4_avx512gfni;
+			f[nf++] = raid_gen5_avx512gfni;
+			f[nf++] = raid_gen6_avx512gfni;
+		}
+#endif
+#endif
 #endif /* CONFIG_X86 */
+
+#ifdef CONFIG_NEON
+		f[nf++] = raid_gen3_neon;
+		f[nf++] = raid_gen4_neon;
+		f[nf++] = raid_gen5_neon;
+		f[nf++] = raid_gen6_neon;
+#endif
 	} else {
 		f[nf++] = raid_genz_int32;
 		f[nf++] = raid_genz_int64;
@@ -450,3 +490,370 @@ bail:
 	/* LCOV_EXCL_STOP */
 }
 
+
+int raid_test_ext(int nd, size_t size)
+{
+	void (*fg[8])(int np, int nd, size_t size, void **vbuf);
+	void (*fr[4])(int nr, int *id, int *ip, int nd, size_t size, void **vbuf);
+	void *v_alloc;
+	void **v;
+	void **data;
+	void **parity;
+	void **test;
+	void *data_save[RAID_PARITY_EXT_MAX];
+	void *parity_save[RAID_PARITY_EXT_MAX];
+	void *waste;
+	int nv;
+	int id[RAID_PARITY_EXT_MAX];
+	int ip[RAID_PARITY_EXT_MAX];
+	int ir[3];
+	int i;
+	int j;
+	int nr;
+	int ngf;
+	int nrf;
+	int np;
+
+	np = RAID_PARITY_EXT_MAX;
+
+	nv = nd + np * 2 + 2;
+
+	v = raid_malloc_vector(nd, nv, size, &v_alloc);
+	if (!v) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	data = v;
+	parity = v + nd;
+	test = v + nd + np;
+
+	for (i = 0; i < np; ++i)
+		parity_save[i] = parity[i];
+
+	memset(v[nv - 2], 0, size);
+	raid_zero(v[nv - 2]);
+
+	waste = v[nv - 1];
+
+	/* fill with pseudo-random data with the arbitrary seed "3" */
+	raid_mrand_vector(3, nd, size, v);
+
+	/* the first parities have to match the Cauchy matrix ones */
+	raid_mode(RAID_MODE_CAUCHY);
+	raid_gen_ref(nd, RAID_PARITY_MAX, size, v);
+	for (i = 0; i < RAID_PARITY_MAX; ++i)
+		memcpy(test[i], parity[i], size);
+
+	/* compute the reference parity */
+	raid_genext_int8(np, nd, size, v);
+	for (i = 0; i < RAID_PARITY_MAX; ++i) {
+		if (memcmp(test[i], parity[i], size) != 0) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	/* copy in test buffers */
+	for (i = 0; i < np; ++i)
+		memcpy(test[i], parity[i], size);
+
+	/* load all the available functions */
+	ngf = 0;
+	nrf = 0;
+	fg[ngf++] = raid_genext_int8;
+	fr[nrf++] = raid_recext_int8;
+#ifdef CONFIG_X86
+#ifdef CONFIG_SSSE3
+	if (raid_cpu_has_ssse3()) {
+		fg[ngf++] = raid_genext_ssse3;
+		fr[nrf++] = raid_recext_ssse3;
+	}
+#endif
+#ifdef CONFIG_AVX2
+	if (raid_cpu_has_avx2()) {
+		fg[ngf++] = raid_genext_avx2;
+#ifdef CONFIG_X86_64
+		fg[ngf++] = raid_genext_avx2ext;
+#endif
+		fr[nrf++] = raid_recext_avx2;
+	}
+#endif
+#endif
+
+	/* check all the generation functions for all the parity levels */
+	for (j = 0; j < ngf; ++j) {
+		for (nr = 1; nr <= np; ++nr) {
+			fg[j](nr, nd, size, v);
+
+			for (i = 0; i < nr; ++i) {
+				if (memcmp(test[i], parity[i], size) != 0) {
+					/* LCOV_EXCL_START */
+					goto bail;
+					/* LCOV_EXCL_STOP */
+				}
+			}
+		}
+	}
+
+	/* set all the parity to the waste v */
+	for (i = 0; i < np; ++i)
+		parity[i] = waste;
+
+	/* all parity levels */
+	for (nr = 1; nr <= np; ++nr) {
+		/* all combinations (nr of nd) disks */
+		combination_first(nr, nd, id);
+		do {
+			/* all combinations (nr of np) parities */
+			combination_first(nr, np, ip);
+			do {
+				/* for each recover function */
+				for (j = 0; j < nrf; ++j) {
+					/* set */
+					for (i = 0; i < nr; ++i) {
+						/* remove the missing data */
+						data_save[i] = data[id[i]];
+						data[id[i]] = test[i];
+						/* set the parity to use */
+						parity[ip[i]] = parity_save[ip[i]];
+					}
+
+					/* recover */
+					fr[j](nr, id, ip, nd, size, v);
+
+					/* check */
+					for (i = 0; i < nr; ++i) {
+						if (memcmp(test[i], data_save[i], size) != 0) {
+							/* LCOV_EXCL_START */
+							goto bail;
+							/* LCOV_EXCL_STOP */
+						}
+					}
+
+					/* restore */
+					for (i = 0; i < nr; ++i) {
+						/* restore the data */
+						data[id[i]] = data_save[i];
+						/* restore the parity */
+						parity[ip[i]] = waste;
+					}
+				}
+			} while (combination_next(nr, np, ip));
+		} while (combination_next(nr, nd, id));
+	}
+
+	/* restore all the parity */
+	for (i = 0; i < np; ++i)
+		parity[i] = parity_save[i];
+
+	/* recover data and parity at the same time, using the latest parity */
+	ir[0] = 0;
+	ir[1] = nd;
+	ir[2] = nd + np - 1;
+	data_save[0] = data[0];
+	data[0] = test[0];
+	parity[0] = test[1];
+	parity[np - 1] = test[2];
+	memset(test[0], 0x55, size);
+	memset(test[1], 0x55, size);
+	memset(test[2], 0x55, size);
+
+	raid_rec_ext(3, ir, nd, np, size, v);
+
+	data[0] = data_save[0];
+	parity[0] = parity_save[0];
+	parity[np - 1] = parity_save[np - 1];
+	if (memcmp(test[0], data[0], size) != 0
+		|| memcmp(test[1], parity[0], size) != 0
+		|| memcmp(test[2], parity[np - 1], size) != 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
+	free(v_alloc);
+	free(v);
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	free(v_alloc);
+	free(v);
+	return -1;
+	/* LCOV_EXCL_STOP */
+}
+
+/*
+ * Engine used for testing.
+ */
+struct raid_test_engine_context {
+	int gen; /* number of parity generations done */
+	int data; /* number of data recovering requested */
+	int broken; /* if the engine returns wrong results */
+};
+
+static int raid_test_engine_gen(void *context, int mode, int nd, int np, size_t size, void **v)
+{
+	struct raid_test_engine_context *c = context;
+	int i;
+
+	(void)mode;
+
+	++c->gen;
+
+	if (c->broken) {
+		for (i = 0; i < np; ++i)
+			memset(v[nd + i], 0, size);
+		return 0;
+	}
+
+	raid_gen_ref(nd, np, size, v);
+
+	return 0;
+}
+
+static int raid_test_engine_data(void *context, int mode, int nr, int *id, int *ip, int nd, size_t size, void **v)
+{
+	struct raid_test_engine_context *c = context;
+
+	(void)mode;
+	(void)nr;
+	(void)id;
+	(void)ip;
+	(void)nd;
+	(void)size;
+	(void)v;
+
+	++c->data;
+
+	/* fallback to the CPU */
+	return -1;
+}
+
+int raid_test_engine(void)
+{
+	struct raid_test_engine_context c;
+	struct raid_engine e = { "test", &c, raid_test_engine_gen, raid_test_engine_data };
+
+	raid_mode(RAID_MODE_CAUCHY);
+
+	/* a working engine is accepted and used */
+	memset(&c, 0, sizeof(c));
+	if (raid_engine(&e) != 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+	if (strcmp(raid_engine_tag(), "test") != 0 || c.gen == 0 || c.data == 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
+	raid_engine(0);
+	if (strcmp(raid_engine_tag(), "cpu") != 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* a broken engine is rejected */
+	memset(&c, 0, sizeof(c));
+	c.broken = 1;
+	if (raid_engine(&e) == 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+	if (strcmp(raid_engine_tag(), "cpu") != 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	raid_engine(0);
+	return -1;
+	/* LCOV_EXCL_STOP */
+}
+
+int raid_test_verify(int mode, int nd, size_t size)
+{
+	void *v_alloc;
+	void **v;
+	uint8_t *b;
+	int nv;
+	int np;
+	int i, j;
+
+	raid_mode(mode);
+	if (mode == RAID_MODE_CAUCHY)
+		np = RAID_PARITY_MAX;
+	else
+		np = 3;
+
+	nv = nd + np;
+
+	v = raid_malloc_vector(nd, nv, size, &v_alloc);
+	if (!v) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* fill with pseudo-random data with the arbitrary seed "4" */
+	raid_mrand_vector(4, nd, size, v);
+
+	/* compute the parity */
+	raid_gen_ref(nd, np, size, v);
+
+	for (i = 1; i <= np; ++i) {
+		/* the correct parity matches */
+		if (raid_verify(nd, i, size, v) != 0) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* a damaged parity is reported */
+		for (j = 0; j < i; ++j) {
+			b = v[nd + j];
+			b[size - 1] ^= 1;
+			if (raid_verify(nd, i, size, v) != 1 << j) {
+				/* LCOV_EXCL_START */
+				b[size - 1] ^= 1;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			b[size - 1] ^= 1;
+		}
+
+		/* a damaged data is reported by all the parities */
+		b = v[0];
+		b[0] ^= 1;
+		if (raid_verify(nd, i, size, v) != (1 << i) - 1) {
+			/* LCOV_EXCL_START */
+			b[0] ^= 1;
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+		b[0] ^= 1;
+	}
+
+	free(v_alloc);
+	free(v);
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	free(v_alloc);
+	free(v);
+	return -1;
+	/* LCOV_EXCL_STOP */
+}
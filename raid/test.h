@@ -64,5 +64,36 @@ int raid_test_rec(unsigned mode, int nd, size_t size);
  */
 int raid_test_par(unsigned mode, int nd, size_t size);
 
+/**
+ * Tests the extended parity generation and recovering functions.
+ *
+ * All the functions are tested for all the parity levels, and with all
+ * the combinations of failing disks and recovering parities.
+ *
+ * Take care that the test time grows exponentially with the number of disks.
+ *
+ * Returns 0 on success.
+ */
+int raid_test_ext(int nd, size_t size);
+
+/**
+ * Tests the external engine interface.
+ *
+ * A working engine must be accepted and used, and a broken one rejected.
+ *
+ * Returns 0 on success.
+ */
+int raid_test_engine(void);
+
+/**
+ * Tests the parity verification function.
+ *
+ * The function is tested for all the parity levels, with correct and
+ * damaged parity and data blocks.
+ *
+ * Returns 0 on success.
+ */
+int raid_test_verify(int mode, int nd, size_t size);
+
 #endif
 
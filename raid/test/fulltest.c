@@ -35,6 +35,11 @@
 #define TEST_COUNT 32
 #endif
 
+/**
+ * Number of disks in the extended recovering test.
+ */
+#define TEST_COUNT_EXT 10
+
 int main(void)
 {
 	printf("Full sanity test for the RAID Cauchy library\n\n");
@@ -97,6 +102,20 @@ int main(void)
 		/* LCOV_EXCL_STOP */
 	}
 
+	printf("Test extended Cauchy parity and recovering with all combinations of %u data and %u parity blocks...\n", TEST_COUNT_EXT, RAID_PARITY_EXT_MAX);
+	if (raid_test_ext(TEST_COUNT_EXT, TEST_SIZE) != 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
+	printf("Test Cauchy parity verification with %u data disks...\n", RAID_DATA_MAX);
+	if (raid_test_verify(RAID_MODE_CAUCHY, RAID_DATA_MAX, TEST_SIZE) != 0) {
+		/* LCOV_EXCL_START */
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
 	printf("Test Vandermonde parity generation with %u data disks...\n", RAID_DATA_MAX);
 	if (raid_test_par(RAID_MODE_VANDERMONDE, RAID_DATA_MAX, TEST_SIZE) != 0) {
 		/* LCOV_EXCL_START */
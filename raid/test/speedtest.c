@@ -82,6 +82,7 @@ void speed(void)
 	int64_t ds;
 	int64_t dt;
 	int i, j;
+	int np;
 	int id[RAID_PARITY_MAX];
 	int ip[RAID_PARITY_MAX];
 	int count;
@@ -92,7 +93,7 @@ void speed(void)
 	void *v_alloc;
 	void **v;
 
-	nv = nd + RAID_PARITY_MAX + 1;
+	nv = nd + RAID_PARITY_EXT_MAX + 1;
 
 	v = raid_malloc_vector(nd, nv, size, &v_alloc);
 
@@ -101,8 +102,8 @@ void speed(void)
 		memset(v[i], i, size);
 
 	/* zero buffer */
-	memset(v[nd + RAID_PARITY_MAX], 0, size);
-	raid_zero(v[nd + RAID_PARITY_MAX]);
+	memset(v[nd + RAID_PARITY_EXT_MAX], 0, size);
+	raid_zero(v[nd + RAID_PARITY_EXT_MAX]);
 
 	/* basic disks and parity mapping */
 	for (i = 0; i < RAID_PARITY_MAX; ++i) {
@@ -820,12 +821,439 @@ void speed(void)
 	printf("\n");
 	printf("\n");
 
+	/* generic table */
+	printf("RAID generic functions used for computing any number of parities,\n");
+	printf("compared with the hand-written ones used by raid_gen():\n");
+	printf("%8s", "");
+	printf("%8s", "best");
+	printf("%8s", "hand");
+	printf("%8s", "int8");
+#ifdef CONFIG_X86
+	printf("%8s", "ssse3");
+	printf("%8s", "avx2");
+#ifdef CONFIG_X86_64
+	printf("%8s", "avx2e");
+#endif
+#endif
+	printf("\n");
+
+	for (np = 1; np <= RAID_PARITY_EXT_MAX; ++np) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "gen%d", np);
+		printf("%8s", name);
+		printf("%8s", raid_genext_tag());
+		fflush(stdout);
+
+		if (np <= RAID_PARITY_MAX) {
+			SPEED_START {
+				raid_gen(nd, np, size, v);
+			} SPEED_STOP
+
+			printf("%8" PRIu64, ds / dt);
+		} else {
+			printf("%8s", "");
+		}
+		fflush(stdout);
+
+		SPEED_START {
+			raid_genext_int8(np, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+
+#ifdef CONFIG_X86
+#ifdef CONFIG_SSSE3
+		if (raid_cpu_has_ssse3()) {
+			SPEED_START {
+				raid_genext_ssse3(np, nd, size, v);
+			} SPEED_STOP
+
+			printf("%8" PRIu64, ds / dt);
+			fflush(stdout);
+		}
+#endif
+#ifdef CONFIG_AVX2
+		if (raid_cpu_has_avx2()) {
+			SPEED_START {
+				raid_genext_avx2(np, nd, size, v);
+			} SPEED_STOP
+
+			printf("%8" PRIu64, ds / dt);
+			fflush(stdout);
+
+#ifdef CONFIG_X86_64
+			SPEED_START {
+				raid_genext_avx2ext(np, nd, size, v);
+			} SPEED_STOP
+
+			printf("%8" PRIu64, ds / dt);
+			fflush(stdout);
+#endif
+		}
+#endif
+#endif
+		printf("\n");
+	}
+	printf("\n");
+
+	free(v_alloc);
+	free(v);
+}
+
+/*
+ * Benchmark mode.
+ *
+ * Measures all the implementations of each function, for different numbers
+ * of data blocks and block sizes, repeating each measure to get a median
+ * and a tail value less sensitive to the noise of the machine.
+ * The results are saved in JSON, with one result in each line, and
+ * they can be compared with a baseline saved in a previous run.
+ */
+
+/**
+ * Functions to benchmark.
+ */
+static const char *BENCH_FUNC[] = {
+	"gen1", "gen2", "genz", "gen3", "gen4", "gen5", "gen6",
+	"rec1", "rec2", "rec3", "rec4", "rec5", "rec6",
+	0
+};
+
+/**
+ * Implementations to try.
+ */
+static const char *BENCH_TAG[] = {
+	"int8", "int32", "int64",
+	"sse2", "sse2e", "sse2p", "ssse3", "ssse3e", "avx2", "avx2e", "avx2p", "avx512g",
+	"neon",
+	0
+};
+
+/**
+ * Number of data blocks to benchmark.
+ */
+static const int BENCH_ND[] = { 4, 16, 0 };
+
+/**
+ * Block sizes to benchmark.
+ */
+static const int BENCH_SIZE[] = { 64 * 1024, 256 * 1024, 0 };
+
+/**
+ * Max number of repetitions.
+ */
+#define BENCH_REPEAT_MAX 101
+
+/**
+ * Max number of results.
+ */
+#define BENCH_RESULT_MAX 4096
+
+struct bench_result {
+	char func[16];
+	char tag[16];
+	int nd;
+	int np;
+	int size;
+	double median; /**< Median speed in MiB/s. */
+	double p95; /**< Speed in MiB/s reached by 95% of the repetitions. */
+};
+
+static struct bench_result bench_result[BENCH_RESULT_MAX];
+static int bench_result_max;
+
+static int bench_compare_double(const void *void_a, const void *void_b)
+{
+	double a = *(const double *)void_a;
+	double b = *(const double *)void_b;
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+/**
+ * Number of parities used by the function.
+ */
+static int bench_np(const char *func)
+{
+	if (strcmp(func, "genz") == 0)
+		return 3;
+	return func[3] - '0';
+}
+
+/**
+ * Measure the speed in MiB/s of the selected function for the specified period in us.
+ */
+static double bench_measure(const char *func, int nd, int size, void **v, int64_t period)
+{
+	struct timeval start;
+	struct timeval stop;
+	int ir[RAID_PARITY_MAX];
+	int np = bench_np(func);
+	int64_t count;
+	int64_t dt;
+	int i;
+
+	for (i = 0; i < RAID_PARITY_MAX; ++i)
+		ir[i] = i;
+
+	count = 0;
+	gettimeofday(&start, 0);
+	do {
+		if (func[0] == 'g')
+			raid_gen(nd, np, size, v);
+		else /* recover the first data blocks using the first parities */
+			raid_rec(np, ir, nd, np, size, v);
+		++count;
+		gettimeofday(&stop, 0);
+		dt = diffgettimeofday(&start, &stop);
+	} while (dt < period);
+
+	return (double)size * count * nd / dt * 1000000.0 / (1024 * 1024);
+}
+
+static void bench_run(int repeat, int64_t period, FILE *f)
+{
+	double sample[BENCH_REPEAT_MAX];
+	int nv = 16 + RAID_PARITY_MAX + 1;
+	void *v_alloc;
+	void **v;
+	int i, j, k, n, r;
+
+	v = raid_malloc_vector(16, nv, 256 * 1024, &v_alloc);
+
+	/* initialize disks with fixed data */
+	for (i = 0; i < 16; ++i)
+		memset(v[i], i, 256 * 1024);
+
+	/* zero buffer */
+	memset(v[nv - 1], 0, 256 * 1024);
+	raid_zero(v[nv - 1]);
+
+	fprintf(f, "{\n");
+	fprintf(f, "\"repeat\": %d,\n", repeat);
+	fprintf(f, "\"period_us\": %" PRIi64 ",\n", period);
+	fprintf(f, "\"results\": [\n");
+
+	bench_result_max = 0;
+	for (i = 0; BENCH_FUNC[i] != 0; ++i) {
+		const char *func = BENCH_FUNC[i];
+		const char *best = raid_selected(func);
+
+		if (strcmp(func, "genz") == 0)
+			raid_mode(RAID_MODE_VANDERMONDE);
+
+		for (j = 0; BENCH_TAG[j] != 0; ++j) {
+			const char *tag = BENCH_TAG[j];
+
+			if (raid_select(func, tag) != 0)
+				continue;
+
+			for (k = 0; BENCH_ND[k] != 0; ++k) {
+				for (n = 0; BENCH_SIZE[n] != 0; ++n) {
+					struct bench_result *res;
+
+					if (bench_result_max == BENCH_RESULT_MAX)
+						continue;
+					res = &bench_result[bench_result_max];
+
+					/* warm-up the caches and the CPU frequency */
+					bench_measure(func, BENCH_ND[k], BENCH_SIZE[n], v, period);
+
+					for (r = 0; r < repeat; ++r)
+						sample[r] = bench_measure(func, BENCH_ND[k], BENCH_SIZE[n], v, period);
+
+					qsort(sample, repeat, sizeof(double), bench_compare_double);
+
+					strcpy(res->func, func);
+					strcpy(res->tag, tag);
+					res->nd = BENCH_ND[k];
+					res->np = bench_np(func);
+					res->size = BENCH_SIZE[n];
+					res->median = sample[repeat / 2];
+					res->p95 = sample[repeat * 5 / 100];
+
+					fprintf(f, "%s{\"func\":\"%s\",\"tag\":\"%s\",\"nd\":%d,\"np\":%d,\"size\":%d,\"median\":%.1f,\"p95\":%.1f}\n",
+						bench_result_max != 0 ? "," : "",
+						res->func, res->tag, res->nd, res->np, res->size, res->median, res->p95);
+					fflush(f);
+
+					++bench_result_max;
+				}
+			}
+		}
+
+		/* restore the default function */
+		raid_select(func, best);
+
+		if (strcmp(func, "genz") == 0)
+			raid_mode(RAID_MODE_CAUCHY);
+	}
+
+	fprintf(f, "]\n");
+	fprintf(f, "}\n");
+
 	free(v_alloc);
 	free(v);
 }
 
-int main(void)
+/**
+ * Compare the results with a baseline.
+ *
+ * Return the number of regressions, or -1 on error.
+ */
+static int bench_compare(const char *path, double threshold)
+{
+	char line[512];
+	int regression;
+	int matching;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Error opening the baseline '%s'\n", path);
+		return -1;
+	}
+
+	printf("%8s%8s%4s%4s%8s%10s%10s%8s\n", "func", "tag", "nd", "np", "size", "baseline", "current", "diff");
+
+	regression = 0;
+	matching = 0;
+	while (fgets(line, sizeof(line), f) != 0) {
+		struct bench_result base;
+		const char *p;
+		double diff;
+		int i;
+
+		/* the results start after the optional comma */
+		p = strchr(line, '{');
+		if (!p)
+			continue;
+
+		if (sscanf(p, "{\"func\":\"%15[^\"]\",\"tag\":\"%15[^\"]\",\"nd\":%d,\"np\":%d,\"size\":%d,\"median\":%lf,\"p95\":%lf}",
+			base.func, base.tag, &base.nd, &base.np, &base.size, &base.median, &base.p95) != 7)
+			continue;
+
+		for (i = 0; i < bench_result_max; ++i) {
+			struct bench_result *res = &bench_result[i];
+
+			if (strcmp(res->func, base.func) == 0
+				&& strcmp(res->tag, base.tag) == 0
+				&& res->nd == base.nd
+				&& res->size == base.size)
+				break;
+		}
+
+		/* functions not present in this CPU are ignored */
+		if (i == bench_result_max)
+			continue;
+
+		++matching;
+
+		if (base.median == 0)
+			continue;
+
+		diff = (bench_result[i].median - base.median) * 100 / base.median;
+
+		printf("%8s%8s%4d%4d%8d%10.0f%10.0f%7.1f%%", base.func, base.tag, base.nd, base.np, base.size, base.median, bench_result[i].median, diff);
+		if (diff < -threshold) {
+			printf(" REGRESSION");
+			++regression;
+		}
+		printf("\n");
+	}
+
+	fclose(f);
+
+	printf("\n");
+	printf("Compared %d results, with %d regressions beyond %.1f%%\n", matching, regression, threshold);
+
+	return regression;
+}
+
+static void usage(void)
 {
+	printf("Usage: speedtest [--json FILE] [--compare BASELINE] [--threshold PERCENT]\n");
+	printf("\t[--repeat N] [--period MS]\n");
+	printf("\n");
+	printf("Without options, prints the speed tables.\n");
+	printf("With --json, benchmarks all the implementations saving the results.\n");
+	printf("With --compare, also compares the results with a previous --json file,\n");
+	printf("and exits with an error if any median is slower than the threshold.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *json = 0;
+	const char *baseline = 0;
+	double threshold = 5;
+	int repeat = 9;
+	int64_t period = 20000;
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			json = argv[++i];
+		} else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+			baseline = argv[++i];
+		} else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+			repeat = atoi(argv[++i]);
+			if (repeat < 1 || repeat > BENCH_REPEAT_MAX) {
+				fprintf(stderr, "Invalid repeat '%s'\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		} else if (strcmp(argv[i], "--period") == 0 && i + 1 < argc) {
+			period = atoi(argv[++i]) * 1000LL;
+			if (period <= 0) {
+				fprintf(stderr, "Invalid period '%s'\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (json || baseline) {
+		FILE *f;
+		int ret;
+
+		raid_init();
+
+		if (json) {
+			f = fopen(json, "w");
+			if (!f) {
+				fprintf(stderr, "Error creating '%s'\n", json);
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			f = stdout;
+		}
+
+		bench_run(repeat, period, f);
+
+		if (json && fclose(f) != 0) {
+			fprintf(stderr, "Error writing '%s'\n", json);
+			exit(EXIT_FAILURE);
+		}
+
+		if (!baseline)
+			return 0;
+
+		ret = bench_compare(baseline, threshold);
+		if (ret != 0)
+			exit(EXIT_FAILURE);
+
+		return 0;
+	}
+
 	printf("Speed test for the RAID Cauchy library\n\n");
 
 	raid_init();
@@ -25,6 +25,19 @@
  * http://users.atw.hu/instlatx64/
  */
 
+/*
+ * Distance in bytes of the software prefetch.
+ *
+ * The variants with software prefetch, with tag ending with 'p', request
+ * in advance the data of the next blocks with a non-temporal hint.
+ * With many data disks, the hardware prefetcher is not able to follow all
+ * the streams, and the non-temporal hint limits the pollution of the cache
+ * shared with other processes.
+ *
+ * Note that the parity is always written with non-temporal stores.
+ */
+#define RAID_PREFETCH_AHEAD 512
+
 #if defined(CONFIG_X86) && defined(CONFIG_SSE2)
 /*
  * GEN1 (RAID5 with xor) SSE2 implementation
@@ -33,7 +46,7 @@
  * cache block, and processing 128 bytes doesn't increase performance, and in
  * some cases it even decreases it.
  */
-void raid_gen1_sse2(int nd, size_t size, void **vv)
+static __always_inline void raid_gen1_sse2_body(int nd, size_t size, void **vv, int prefetch)
 {
 	uint8_t **v = (uint8_t **)vv;
 	uint8_t *p;
@@ -50,7 +63,11 @@ void raid_gen1_sse2(int nd, size_t size, void **vv)
 		asm volatile ("movdqa %0,%%xmm1" : : "m" (v[l][i + 16]));
 		asm volatile ("movdqa %0,%%xmm2" : : "m" (v[l][i + 32]));
 		asm volatile ("movdqa %0,%%xmm3" : : "m" (v[l][i + 48]));
+		if (prefetch)
+			asm volatile ("prefetchnta %0" : : "m" (v[l][i + RAID_PREFETCH_AHEAD]));
 		for (d = l - 1; d >= 0; --d) {
+			if (prefetch)
+				asm volatile ("prefetchnta %0" : : "m" (v[d][i + RAID_PREFETCH_AHEAD]));
 			asm volatile ("pxor %0,%%xmm0" : : "m" (v[d][i]));
 			asm volatile ("pxor %0,%%xmm1" : : "m" (v[d][i + 16]));
 			asm volatile ("pxor %0,%%xmm2" : : "m" (v[d][i + 32]));
@@ -64,6 +81,16 @@ void raid_gen1_sse2(int nd, size_t size, void **vv)
 
 	raid_sse_end();
 }
+
+void raid_gen1_sse2(int nd, size_t size, void **vv)
+{
+	raid_gen1_sse2_body(nd, size, vv, 0);
+}
+
+void raid_gen1_sse2p(int nd, size_t size, void **vv)
+{
+	raid_gen1_sse2_body(nd, size, vv, 1);
+}
 #endif
 
 #if defined(CONFIG_X86) && defined(CONFIG_AVX2)
@@ -74,7 +101,7 @@ void raid_gen1_sse2(int nd, size_t size, void **vv)
  * cache block, and processing 128 bytes doesn't increase performance, and in
  * some cases it even decreases it.
  */
-void raid_gen1_avx2(int nd, size_t size, void **vv)
+static __always_inline void raid_gen1_avx2_body(int nd, size_t size, void **vv, int prefetch)
 {
 	uint8_t **v = (uint8_t **)vv;
 	uint8_t *p;
@@ -89,7 +116,11 @@ void raid_gen1_avx2(int nd, size_t size, void **vv)
 	for (i = 0; i < size; i += 64) {
 		asm volatile ("vmovdqa %0,%%ymm0" : : "m" (v[l][i]));
 		asm volatile ("vmovdqa %0,%%ymm1" : : "m" (v[l][i + 32]));
+		if (prefetch)
+			asm volatile ("prefetchnta %0" : : "m" (v[l][i + RAID_PREFETCH_AHEAD]));
 		for (d = l - 1; d >= 0; --d) {
+			if (prefetch)
+				asm volatile ("prefetchnta %0" : : "m" (v[d][i + RAID_PREFETCH_AHEAD]));
 			asm volatile ("vpxor %0,%%ymm0,%%ymm0" : : "m" (v[d][i]));
 			asm volatile ("vpxor %0,%%ymm1,%%ymm1" : : "m" (v[d][i + 32]));
 		}
@@ -99,6 +130,16 @@ void raid_gen1_avx2(int nd, size_t size, void **vv)
 
 	raid_avx_end();
 }
+
+void raid_gen1_avx2(int nd, size_t size, void **vv)
+{
+	raid_gen1_avx2_body(nd, size, vv, 0);
+}
+
+void raid_gen1_avx2p(int nd, size_t size, void **vv)
+{
+	raid_gen1_avx2_body(nd, size, vv, 1);
+}
 #endif
 
 #if defined(CONFIG_X86) && defined(CONFIG_SSE2)
@@ -121,12 +162,12 @@ static const struct gfconst16 {
 /*
  * GEN2 (RAID6 with powers of 2) SSE2 implementation
  */
-void raid_gen2_sse2(int nd, size_t size, void **vv)
+static __always_inline void raid_gen2_sse2_body(int nd, size_t size, void **vv, int prefetch)
 {
 	uint8_t **v = (uint8_t **)vv;
 	uint8_t *p;
 	uint8_t *q;
-	int d, l;
+	int d, l, pf;
 	size_t i;
 
 	l = nd - 1;
@@ -142,7 +183,13 @@ void raid_gen2_sse2(int nd, size_t size, void **vv)
 		asm volatile ("movdqa %0,%%xmm1" : : "m" (v[l][i + 16]));
 		asm volatile ("movdqa %xmm0,%xmm2");
 		asm volatile ("movdqa %xmm1,%xmm3");
+		/* prefetch one time for each cache line */
+		pf = prefetch && (i % 64) == 0;
+		if (pf)
+			asm volatile ("prefetchnta %0" : : "m" (v[l][i + RAID_PREFETCH_AHEAD]));
 		for (d = l - 1; d >= 0; --d) {
+			if (pf)
+				asm volatile ("prefetchnta %0" : : "m" (v[d][i + RAID_PREFETCH_AHEAD]));
 			asm volatile ("pxor %xmm4,%xmm4");
 			asm volatile ("pxor %xmm5,%xmm5");
 			asm volatile ("pcmpgtb %xmm2,%xmm4");
@@ -169,13 +216,23 @@ void raid_gen2_sse2(int nd, size_t size, void **vv)
 
 	raid_sse_end();
 }
+
+void raid_gen2_sse2(int nd, size_t size, void **vv)
+{
+	raid_gen2_sse2_body(nd, size, vv, 0);
+}
+
+void raid_gen2_sse2p(int nd, size_t size, void **vv)
+{
+	raid_gen2_sse2_body(nd, size, vv, 1);
+}
 #endif
 
 #if defined(CONFIG_X86) && defined(CONFIG_AVX2)
 /*
  * GEN2 (RAID6 with powers of 2) AVX2 implementation
  */
-void raid_gen2_avx2(int nd, size_t size, void **vv)
+static __always_inline void raid_gen2_avx2_body(int nd, size_t size, void **vv, int prefetch)
 {
 	uint8_t **v = (uint8_t **)vv;
 	uint8_t *p;
@@ -197,7 +254,11 @@ void raid_gen2_avx2(int nd, size_t size, void **vv)
 		asm volatile ("vmovdqa %0,%%ymm1" : : "m" (v[l][i + 32]));
 		asm volatile ("vmovdqa %ymm0,%ymm2");
 		asm volatile ("vmovdqa %ymm1,%ymm3");
+		if (prefetch)
+			asm volatile ("prefetchnta %0" : : "m" (v[l][i + RAID_PREFETCH_AHEAD]));
 		for (d = l - 1; d >= 0; --d) {
+			if (prefetch)
+				asm volatile ("prefetchnta %0" : : "m" (v[d][i + RAID_PREFETCH_AHEAD]));
 			asm volatile ("vpcmpgtb %ymm2,%ymm6,%ymm4");
 			asm volatile ("vpcmpgtb %ymm3,%ymm6,%ymm5");
 			asm volatile ("vpaddb %ymm2,%ymm2,%ymm2");
@@ -222,6 +283,16 @@ void raid_gen2_avx2(int nd, size_t size, void **vv)
 
 	raid_avx_end();
 }
+
+void raid_gen2_avx2(int nd, size_t size, void **vv)
+{
+	raid_gen2_avx2_body(nd, size, vv, 0);
+}
+
+void raid_gen2_avx2p(int nd, size_t size, void **vv)
+{
+	raid_gen2_avx2_body(nd, size, vv, 1);
+}
 #endif
 
 #if defined(CONFIG_X86_64) && defined(CONFIG_SSE2)
@@ -1980,6 +2051,112 @@ void raid_gen6_avx2ext(int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+/*
+ * GENn (multiple parity with Cauchy matrix) AVX512 and GFNI implementation
+ *
+ * Instead of the PSHUFB tables, the multiplication by each coefficient of
+ * the matrix is done with a single GF2P8AFFINEQB, using for it the 8x8 bit
+ * matrix of the linear map over GF(2) that it represents.
+ * This allows to not use the Horner rule for the second parity, and to
+ * process all the parities in the same way.
+ *
+ * Note that it uses registers over the 16th, meaning that x64 is required.
+ */
+static __always_inline void raid_genN_avx512gfni(int np, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p[RAID_PARITY_MAX];
+	int d, j;
+	size_t i;
+
+	for (j = 0; j < np; ++j)
+		p[j] = v[nd + j];
+
+	raid_avx_begin();
+
+	for (i = 0; i < size; i += 64) {
+		/* first disk */
+		asm volatile ("vmovdqa64 %0,%%zmm16" : : "m" (v[0][i]));
+		asm volatile ("vmovdqa64 %zmm16,%zmm0");
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm1" : : "m" (gfmulgfni[gfcauchy[1][0]]));
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm2" : : "m" (gfmulgfni[gfcauchy[2][0]]));
+		if (np > 3)
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm3" : : "m" (gfmulgfni[gfcauchy[3][0]]));
+		if (np > 4)
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm4" : : "m" (gfmulgfni[gfcauchy[4][0]]));
+		if (np > 5)
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm5" : : "m" (gfmulgfni[gfcauchy[5][0]]));
+
+		/* next disks */
+		for (d = 1; d < nd; ++d) {
+			asm volatile ("vmovdqa64 %0,%%zmm16" : : "m" (v[d][i]));
+			asm volatile ("vpxorq %zmm16,%zmm0,%zmm0");
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm17" : : "m" (gfmulgfni[gfcauchy[1][d]]));
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm18" : : "m" (gfmulgfni[gfcauchy[2][d]]));
+			asm volatile ("vpxorq %zmm17,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm18,%zmm2,%zmm2");
+			if (np > 3) {
+				asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm19" : : "m" (gfmulgfni[gfcauchy[3][d]]));
+				asm volatile ("vpxorq %zmm19,%zmm3,%zmm3");
+			}
+			if (np > 4) {
+				asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm20" : : "m" (gfmulgfni[gfcauchy[4][d]]));
+				asm volatile ("vpxorq %zmm20,%zmm4,%zmm4");
+			}
+			if (np > 5) {
+				asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm16,%%zmm21" : : "m" (gfmulgfni[gfcauchy[5][d]]));
+				asm volatile ("vpxorq %zmm21,%zmm5,%zmm5");
+			}
+		}
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[0][i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (p[1][i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (p[2][i]));
+		if (np > 3)
+			asm volatile ("vmovntdq %%zmm3,%0" : "=m" (p[3][i]));
+		if (np > 4)
+			asm volatile ("vmovntdq %%zmm4,%0" : "=m" (p[4][i]));
+		if (np > 5)
+			asm volatile ("vmovntdq %%zmm5,%0" : "=m" (p[5][i]));
+	}
+
+	raid_avx_end();
+}
+
+/*
+ * GEN3 (triple parity with Cauchy matrix) AVX512 and GFNI implementation
+ */
+void raid_gen3_avx512gfni(int nd, size_t size, void **vv)
+{
+	raid_genN_avx512gfni(3, nd, size, vv);
+}
+
+/*
+ * GEN4 (quad parity with Cauchy matrix) AVX512 and GFNI implementation
+ */
+void raid_gen4_avx512gfni(int nd, size_t size, void **vv)
+{
+	raid_genN_avx512gfni(4, nd, size, vv);
+}
+
+/*
+ * GEN5 (penta parity with Cauchy matrix) AVX512 and GFNI implementation
+ */
+void raid_gen5_avx512gfni(int nd, size_t size, void **vv)
+{
+	raid_genN_avx512gfni(5, nd, size, vv);
+}
+
+/*
+ * GEN6 (hexa parity with Cauchy matrix) AVX512 and GFNI implementation
+ */
+void raid_gen6_avx512gfni(int nd, size_t size, void **vv)
+{
+	raid_genN_avx512gfni(6, nd, size, vv);
+}
+#endif
+
 #if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
 /*
  * RAID recovering for one disk SSSE3 implementation
@@ -2450,3 +2627,557 @@ void raid_recX_avx2(int nr, int *id, int *ip, int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512GFNI)
+/*
+ * RAID recovering AVX512 and GFNI implementation
+ */
+void raid_recX_avx512gfni(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	int N = nr;
+	uint8_t *p[RAID_PARITY_MAX];
+	uint8_t *pa[RAID_PARITY_MAX];
+	uint8_t G[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8_t V[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8_t buffer[RAID_PARITY_MAX*64+64];
+	uint8_t *pd = __align_ptr(buffer, 64);
+	size_t i;
+	int j, k;
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = A(ip[j], id[k]);
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	raid_avx_begin();
+
+	for (i = 0; i < size; i += 64) {
+		/* delta */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (p[j][i]));
+			asm volatile ("vpxorq    %0,%%zmm0,%%zmm0" : : "m" (pa[j][i]));
+			asm volatile ("vmovdqa64 %%zmm0,%0" : "=m" (pd[j*64]));
+		}
+
+		/* reconstruct */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vpxorq %zmm0,%zmm0,%zmm0");
+
+			for (k = 0; k < N; ++k) {
+				uint8_t m = V[j * N + k];
+
+				asm volatile ("vmovdqa64 %0,%%zmm1" : : "m" (pd[k*64]));
+				asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm1,%%zmm1" : : "m" (gfmulgfni[m]));
+				asm volatile ("vpxorq %zmm1,%zmm0,%zmm0");
+			}
+
+			asm volatile ("vmovdqa64 %%zmm0,%0" : "=m" (pa[j][i]));
+		}
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
+/*
+ * GENEXT (generic parity with the extended Cauchy matrix) SSSE3 implementation
+ *
+ * The number of parities is a run-time argument, and the parities, except
+ * the first one, are accumulated in a small aligned buffer.
+ * The accumulator is always in the L1 cache, and the cost of this
+ * indirection is only a load and a store for each multiplication.
+ */
+void raid_genext_ssse3(int np, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p[RAID_PARITY_EXT_MAX];
+	uint8_t buffer[RAID_PARITY_EXT_MAX*16+16];
+	uint8_t *pd = __align_ptr(buffer, 16);
+	int d, j;
+	size_t i;
+
+	for (j = 0; j < np; ++j)
+		p[j] = v[nd + j];
+
+	raid_sse_begin();
+
+	asm volatile ("movdqa %0,%%xmm7" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 16) {
+		/* first disk */
+		asm volatile ("movdqa %0,%%xmm0" : : "m" (v[0][i]));
+		asm volatile ("movdqa %xmm0,%xmm1");
+		asm volatile ("movdqa %xmm0,%xmm2");
+		asm volatile ("psrlw  $4,%xmm2");
+		asm volatile ("pand   %xmm7,%xmm1");
+		asm volatile ("pand   %xmm7,%xmm2");
+		for (j = 1; j < np; ++j) {
+			uint8_t m = gfcauchyext[j][0];
+
+			asm volatile ("movdqa %0,%%xmm3" : : "m" (gfmulpshufb[m][0][0]));
+			asm volatile ("movdqa %0,%%xmm4" : : "m" (gfmulpshufb[m][1][0]));
+			asm volatile ("pshufb %xmm1,%xmm3");
+			asm volatile ("pshufb %xmm2,%xmm4");
+			asm volatile ("pxor   %xmm4,%xmm3");
+			asm volatile ("movdqa %%xmm3,%0" : "=m" (pd[j*16]));
+		}
+
+		/* next disks */
+		for (d = 1; d < nd; ++d) {
+			asm volatile ("movdqa %0,%%xmm1" : : "m" (v[d][i]));
+			asm volatile ("pxor   %xmm1,%xmm0");
+			asm volatile ("movdqa %xmm1,%xmm2");
+			asm volatile ("psrlw  $4,%xmm2");
+			asm volatile ("pand   %xmm7,%xmm1");
+			asm volatile ("pand   %xmm7,%xmm2");
+			for (j = 1; j < np; ++j) {
+				uint8_t m = gfcauchyext[j][d];
+
+				asm volatile ("movdqa %0,%%xmm3" : : "m" (gfmulpshufb[m][0][0]));
+				asm volatile ("movdqa %0,%%xmm4" : : "m" (gfmulpshufb[m][1][0]));
+				asm volatile ("pshufb %xmm1,%xmm3");
+				asm volatile ("pshufb %xmm2,%xmm4");
+				asm volatile ("pxor   %0,%%xmm3" : : "m" (pd[j*16]));
+				asm volatile ("pxor   %xmm4,%xmm3");
+				asm volatile ("movdqa %%xmm3,%0" : "=m" (pd[j*16]));
+			}
+		}
+
+		asm volatile ("movntdq %%xmm0,%0" : "=m" (p[0][i]));
+		for (j = 1; j < np; ++j) {
+			asm volatile ("movdqa  %0,%%xmm3" : : "m" (pd[j*16]));
+			asm volatile ("movntdq %%xmm3,%0" : "=m" (p[j][i]));
+		}
+	}
+
+	raid_sse_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_AVX2)
+/*
+ * GENEXT (generic parity with the extended Cauchy matrix) AVX2 implementation
+ *
+ * Like the SSSE3 one, with the accumulator buffer of 32 bytes for parity.
+ */
+void raid_genext_avx2(int np, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p[RAID_PARITY_EXT_MAX];
+	uint8_t buffer[RAID_PARITY_EXT_MAX*32+32];
+	uint8_t *pd = __align_ptr(buffer, 32);
+	int d, j;
+	size_t i;
+
+	for (j = 0; j < np; ++j)
+		p[j] = v[nd + j];
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti128 %0,%%ymm7" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 32) {
+		/* first disk */
+		asm volatile ("vmovdqa %0,%%ymm0" : : "m" (v[0][i]));
+		asm volatile ("vpsrlw  $4,%ymm0,%ymm2");
+		asm volatile ("vpand   %ymm7,%ymm0,%ymm1");
+		asm volatile ("vpand   %ymm7,%ymm2,%ymm2");
+		for (j = 1; j < np; ++j) {
+			uint8_t m = gfcauchyext[j][0];
+
+			asm volatile ("vbroadcasti128 %0,%%ymm3" : : "m" (gfmulpshufb[m][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm4" : : "m" (gfmulpshufb[m][1][0]));
+			asm volatile ("vpshufb %ymm1,%ymm3,%ymm3");
+			asm volatile ("vpshufb %ymm2,%ymm4,%ymm4");
+			asm volatile ("vpxor   %ymm4,%ymm3,%ymm3");
+			asm volatile ("vmovdqa %%ymm3,%0" : "=m" (pd[j*32]));
+		}
+
+		/* next disks */
+		for (d = 1; d < nd; ++d) {
+			asm volatile ("vmovdqa %0,%%ymm1" : : "m" (v[d][i]));
+			asm volatile ("vpxor   %ymm1,%ymm0,%ymm0");
+			asm volatile ("vpsrlw  $4,%ymm1,%ymm2");
+			asm volatile ("vpand   %ymm7,%ymm1,%ymm1");
+			asm volatile ("vpand   %ymm7,%ymm2,%ymm2");
+			for (j = 1; j < np; ++j) {
+				uint8_t m = gfcauchyext[j][d];
+
+				asm volatile ("vbroadcasti128 %0,%%ymm3" : : "m" (gfmulpshufb[m][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm4" : : "m" (gfmulpshufb[m][1][0]));
+				asm volatile ("vpshufb %ymm1,%ymm3,%ymm3");
+				asm volatile ("vpshufb %ymm2,%ymm4,%ymm4");
+				asm volatile ("vpxor   %0,%%ymm3,%%ymm3" : : "m" (pd[j*32]));
+				asm volatile ("vpxor   %ymm4,%ymm3,%ymm3");
+				asm volatile ("vmovdqa %%ymm3,%0" : "=m" (pd[j*32]));
+			}
+		}
+
+		asm volatile ("vmovntdq %%ymm0,%0" : "=m" (p[0][i]));
+		for (j = 1; j < np; ++j) {
+			asm volatile ("vmovdqa  %0,%%ymm3" : : "m" (pd[j*32]));
+			asm volatile ("vmovntdq %%ymm3,%0" : "=m" (p[j][i]));
+		}
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX2)
+/*
+ * GENEXT (generic parity with the extended Cauchy matrix) AVX2 implementation
+ *
+ * Like the AVX2 one, but with all the parities kept in the ymm0-ymm7
+ * registers, using the extended register set of x64.
+ * The body is instantiated for each number of parities, to allow the
+ * compiler to remove the checks on @np.
+ */
+static __always_inline void raid_genext_avx2ext_np(int np, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p[RAID_PARITY_EXT_MAX];
+	int d, j;
+	size_t i;
+
+	for (j = 0; j < np; ++j)
+		p[j] = v[nd + j];
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti128 %0,%%ymm15" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 32) {
+		/* first disk */
+		asm volatile ("vmovdqa %0,%%ymm0" : : "m" (v[0][i]));
+		asm volatile ("vpsrlw  $4,%ymm0,%ymm10");
+		asm volatile ("vpand   %ymm15,%ymm0,%ymm9");
+		asm volatile ("vpand   %ymm15,%ymm10,%ymm10");
+		if (np > 1) {
+			asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[1][0]][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[1][0]][1][0]));
+			asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+			asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+			asm volatile ("vpxor   %ymm11,%ymm12,%ymm1");
+		}
+		if (np > 2) {
+			asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[2][0]][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[2][0]][1][0]));
+			asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+			asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+			asm volatile ("vpxor   %ymm11,%ymm12,%ymm2");
+		}
+		if (np > 3) {
+			asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[3][0]][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[3][0]][1][0]));
+			asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+			asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+			asm volatile ("vpxor   %ymm11,%ymm12,%ymm3");
+		}
+		if (np > 4) {
+			asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[4][0]][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[4][0]][1][0]));
+			asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+			asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+			asm volatile ("vpxor   %ymm11,%ymm12,%ymm4");
+		}
+		if (np > 5) {
+			asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[5][0]][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[5][0]][1][0]));
+			asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+			asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+			asm volatile ("vpxor   %ymm11,%ymm12,%ymm5");
+		}
+		if (np > 6) {
+			asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[6][0]][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[6][0]][1][0]));
+			asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+			asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+			asm volatile ("vpxor   %ymm11,%ymm12,%ymm6");
+		}
+		if (np > 7) {
+			asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[7][0]][0][0]));
+			asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[7][0]][1][0]));
+			asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+			asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+			asm volatile ("vpxor   %ymm11,%ymm12,%ymm7");
+		}
+
+		/* next disks */
+		for (d = 1; d < nd; ++d) {
+			asm volatile ("vmovdqa %0,%%ymm8" : : "m" (v[d][i]));
+			asm volatile ("vpxor   %ymm8,%ymm0,%ymm0");
+			asm volatile ("vpsrlw  $4,%ymm8,%ymm10");
+			asm volatile ("vpand   %ymm15,%ymm8,%ymm9");
+			asm volatile ("vpand   %ymm15,%ymm10,%ymm10");
+			if (np > 1) {
+				asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[1][d]][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[1][d]][1][0]));
+				asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+				asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+				asm volatile ("vpxor   %ymm11,%ymm1,%ymm1");
+				asm volatile ("vpxor   %ymm12,%ymm1,%ymm1");
+			}
+			if (np > 2) {
+				asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[2][d]][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[2][d]][1][0]));
+				asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+				asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+				asm volatile ("vpxor   %ymm11,%ymm2,%ymm2");
+				asm volatile ("vpxor   %ymm12,%ymm2,%ymm2");
+			}
+			if (np > 3) {
+				asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[3][d]][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[3][d]][1][0]));
+				asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+				asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+				asm volatile ("vpxor   %ymm11,%ymm3,%ymm3");
+				asm volatile ("vpxor   %ymm12,%ymm3,%ymm3");
+			}
+			if (np > 4) {
+				asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[4][d]][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[4][d]][1][0]));
+				asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+				asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+				asm volatile ("vpxor   %ymm11,%ymm4,%ymm4");
+				asm volatile ("vpxor   %ymm12,%ymm4,%ymm4");
+			}
+			if (np > 5) {
+				asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[5][d]][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[5][d]][1][0]));
+				asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+				asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+				asm volatile ("vpxor   %ymm11,%ymm5,%ymm5");
+				asm volatile ("vpxor   %ymm12,%ymm5,%ymm5");
+			}
+			if (np > 6) {
+				asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[6][d]][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[6][d]][1][0]));
+				asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+				asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+				asm volatile ("vpxor   %ymm11,%ymm6,%ymm6");
+				asm volatile ("vpxor   %ymm12,%ymm6,%ymm6");
+			}
+			if (np > 7) {
+				asm volatile ("vbroadcasti128 %0,%%ymm11" : : "m" (gfmulpshufb[gfcauchyext[7][d]][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm12" : : "m" (gfmulpshufb[gfcauchyext[7][d]][1][0]));
+				asm volatile ("vpshufb %ymm9,%ymm11,%ymm11");
+				asm volatile ("vpshufb %ymm10,%ymm12,%ymm12");
+				asm volatile ("vpxor   %ymm11,%ymm7,%ymm7");
+				asm volatile ("vpxor   %ymm12,%ymm7,%ymm7");
+			}
+		}
+
+		asm volatile ("vmovntdq %%ymm0,%0" : "=m" (p[0][i]));
+		if (np > 1)
+			asm volatile ("vmovntdq %%ymm1,%0" : "=m" (p[1][i]));
+		if (np > 2)
+			asm volatile ("vmovntdq %%ymm2,%0" : "=m" (p[2][i]));
+		if (np > 3)
+			asm volatile ("vmovntdq %%ymm3,%0" : "=m" (p[3][i]));
+		if (np > 4)
+			asm volatile ("vmovntdq %%ymm4,%0" : "=m" (p[4][i]));
+		if (np > 5)
+			asm volatile ("vmovntdq %%ymm5,%0" : "=m" (p[5][i]));
+		if (np > 6)
+			asm volatile ("vmovntdq %%ymm6,%0" : "=m" (p[6][i]));
+		if (np > 7)
+			asm volatile ("vmovntdq %%ymm7,%0" : "=m" (p[7][i]));
+	}
+
+	raid_avx_end();
+}
+
+void raid_genext_avx2ext(int np, int nd, size_t size, void **vv)
+{
+	switch (np) {
+	case 1:
+		raid_genext_avx2ext_np(1, nd, size, vv);
+		break;
+	case 2:
+		raid_genext_avx2ext_np(2, nd, size, vv);
+		break;
+	case 3:
+		raid_genext_avx2ext_np(3, nd, size, vv);
+		break;
+	case 4:
+		raid_genext_avx2ext_np(4, nd, size, vv);
+		break;
+	case 5:
+		raid_genext_avx2ext_np(5, nd, size, vv);
+		break;
+	case 6:
+		raid_genext_avx2ext_np(6, nd, size, vv);
+		break;
+	case 7:
+		raid_genext_avx2ext_np(7, nd, size, vv);
+		break;
+	default:
+		raid_genext_avx2ext_np(8, nd, size, vv);
+		break;
+	}
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
+/*
+ * RAID recovering with the extended Cauchy matrix SSSE3 implementation
+ */
+void raid_recext_ssse3(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	int N = nr;
+	uint8_t *p[RAID_PARITY_EXT_MAX];
+	uint8_t *pa[RAID_PARITY_EXT_MAX];
+	uint8_t G[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+	uint8_t V[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+	uint8_t buffer[RAID_PARITY_EXT_MAX*16+16];
+	uint8_t *pd = __align_ptr(buffer, 16);
+	size_t i;
+	int j, k;
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = gfcauchyext[ip[j]][id[k]];
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen_ext(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	raid_sse_begin();
+
+	asm volatile ("movdqa %0,%%xmm7" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 16) {
+		/* delta */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("movdqa %0,%%xmm0" : : "m" (p[j][i]));
+			asm volatile ("movdqa %0,%%xmm1" : : "m" (pa[j][i]));
+			asm volatile ("pxor   %xmm1,%xmm0");
+			asm volatile ("movdqa %%xmm0,%0" : "=m" (pd[j*16]));
+		}
+
+		/* reconstruct */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("pxor %xmm0,%xmm0");
+			asm volatile ("pxor %xmm1,%xmm1");
+
+			for (k = 0; k < N; ++k) {
+				uint8_t m = V[j * N + k];
+
+				asm volatile ("movdqa %0,%%xmm2" : : "m" (gfmulpshufb[m][0][0]));
+				asm volatile ("movdqa %0,%%xmm3" : : "m" (gfmulpshufb[m][1][0]));
+				asm volatile ("movdqa %0,%%xmm4" : : "m" (pd[k*16]));
+				asm volatile ("movdqa %xmm4,%xmm5");
+				asm volatile ("psrlw  $4,%xmm5");
+				asm volatile ("pand   %xmm7,%xmm4");
+				asm volatile ("pand   %xmm7,%xmm5");
+				asm volatile ("pshufb %xmm4,%xmm2");
+				asm volatile ("pshufb %xmm5,%xmm3");
+				asm volatile ("pxor   %xmm2,%xmm0");
+				asm volatile ("pxor   %xmm3,%xmm1");
+			}
+
+			asm volatile ("pxor %xmm1,%xmm0");
+			asm volatile ("movdqa %%xmm0,%0" : "=m" (pa[j][i]));
+		}
+	}
+
+	raid_sse_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_AVX2)
+/*
+ * RAID recovering with the extended Cauchy matrix AVX2 implementation
+ */
+void raid_recext_avx2(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	int N = nr;
+	uint8_t *p[RAID_PARITY_EXT_MAX];
+	uint8_t *pa[RAID_PARITY_EXT_MAX];
+	uint8_t G[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+	uint8_t V[RAID_PARITY_EXT_MAX * RAID_PARITY_EXT_MAX];
+	uint8_t buffer[RAID_PARITY_EXT_MAX*32+32];
+	uint8_t *pd = __align_ptr(buffer, 32);
+	size_t i;
+	int j, k;
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = gfcauchyext[ip[j]][id[k]];
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen_ext(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti128 %0,%%ymm7" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 32) {
+		/* delta */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vmovdqa %0,%%ymm0" : : "m" (p[j][i]));
+			asm volatile ("vmovdqa %0,%%ymm1" : : "m" (pa[j][i]));
+			asm volatile ("vpxor   %ymm1,%ymm0,%ymm0");
+			asm volatile ("vmovdqa %%ymm0,%0" : "=m" (pd[j*32]));
+		}
+
+		/* reconstruct */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vpxor %ymm0,%ymm0,%ymm0");
+			asm volatile ("vpxor %ymm1,%ymm1,%ymm1");
+
+			for (k = 0; k < N; ++k) {
+				uint8_t m = V[j * N + k];
+
+				asm volatile ("vbroadcasti128 %0,%%ymm2" : : "m" (gfmulpshufb[m][0][0]));
+				asm volatile ("vbroadcasti128 %0,%%ymm3" : : "m" (gfmulpshufb[m][1][0]));
+				asm volatile ("vmovdqa %0,%%ymm4" : : "m" (pd[k*32]));
+				asm volatile ("vpsrlw  $4,%ymm4,%ymm5");
+				asm volatile ("vpand   %ymm7,%ymm4,%ymm4");
+				asm volatile ("vpand   %ymm7,%ymm5,%ymm5");
+				asm volatile ("vpshufb %ymm4,%ymm2,%ymm2");
+				asm volatile ("vpshufb %ymm5,%ymm3,%ymm3");
+				asm volatile ("vpxor   %ymm2,%ymm0,%ymm0");
+				asm volatile ("vpxor   %ymm3,%ymm1,%ymm1");
+			}
+
+			asm volatile ("vpxor %ymm1,%ymm0,%ymm0");
+			asm volatile ("vmovdqa %%ymm0,%0" : "=m" (pa[j][i]));
+		}
+	}
+
+	raid_avx_end();
+}
+#endif
@@ -75,10 +75,11 @@ static void tommy_hashdyn_resize(tommy_hashdyn* hashdyn, tommy_size_t new_bucket
 		/* grow */
 		for (i = 0; i < bucket_max; ++i) {
 			tommy_hashdyn_node* j;
+			tommy_size_t k;
 
-			/* setup the new two buckets */
-			new_bucket[i] = 0;
-			new_bucket[i + bucket_max] = 0;
+			/* setup the new buckets, two for a single step grow */
+			for (k = i; k < new_bucket_max; k += bucket_max)
+				new_bucket[k] = 0;
 
 			/* reinsert the bucket */
 			j = hashdyn->bucket[i];
@@ -134,6 +135,18 @@ tommy_inline void hashdyn_shrink_step(tommy_hashdyn* hashdyn)
 		tommy_hashdyn_resize(hashdyn, hashdyn->bucket_bit - 1);
 }
 
+void tommy_hashdyn_reserve(tommy_hashdyn* hashdyn, tommy_size_t count)
+{
+	tommy_size_t bucket_bit = hashdyn->bucket_bit;
+
+	/* keep it less than 50% full, like the grow step */
+	while (bucket_bit < TOMMY_SIZE_BIT - 1 && count >= ((tommy_size_t)1 << bucket_bit) / 2)
+		++bucket_bit;
+
+	if (bucket_bit > hashdyn->bucket_bit)
+		tommy_hashdyn_resize(hashdyn, bucket_bit);
+}
+
 void tommy_hashdyn_insert(tommy_hashdyn* hashdyn, tommy_hashdyn_node* node, void* data, tommy_hash_t hash)
 {
 	tommy_size_t pos = hash & hashdyn->bucket_mask;
@@ -179,6 +179,14 @@ void tommy_hashdyn_init(tommy_hashdyn* hashdyn);
  */
 void tommy_hashdyn_done(tommy_hashdyn* hashdyn);
 
+/**
+ * Reserves space in the hashtable for the specified number of elements.
+ * The bucket vector is resized only once, avoiding the resizes of the following insertions.
+ * If the hashtable is already big enough, nothing is done.
+ * \param count Number of elements that the hashtable is expected to contain.
+ */
+void tommy_hashdyn_reserve(tommy_hashdyn* hashdyn, tommy_size_t count);
+
 /**
  * Inserts an element in the hashtable.
  */